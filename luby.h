@@ -31,6 +31,10 @@ typedef struct luby_value luby_value;
 typedef struct luby_string_view luby_string_view;
 typedef struct luby_error luby_error;
 typedef struct luby_coroutine luby_coroutine;
+typedef struct luby_method_ref luby_method_ref;
+typedef struct luby_image luby_image;
+typedef struct luby_snapshot luby_snapshot;
+typedef struct luby_actor_pool luby_actor_pool;
 typedef struct luby_proc luby_proc;
 typedef struct luby_class luby_class;
 typedef struct luby_module luby_module;
@@ -54,7 +58,9 @@ typedef enum luby_type {
     LUBY_T_MODULE,
     LUBY_T_CMETHOD,
     LUBY_T_RANGE,
-    LUBY_T_USERDATA
+    LUBY_T_USERDATA,
+    LUBY_T_VECTOR,          // Vector2, Vector3, Quaternion or Matrix4
+    LUBY_T_BUFFER           // Float32Array, Float64Array or Int32Array
 } luby_type;
 
 struct luby_string_view {
@@ -439,6 +445,20 @@ typedef struct luby_inst {
     uint32_t c;
 } luby_inst;
 
+// Inline cache for one OP_CALL site. With a receiver: the struct field or
+// attr accessor its name resolved to for receiver class `klass`. Without a
+// receiver: the typed native it resolved to while self's class was
+// `self_klass`. Each half is valid while its epoch matches method_epoch.
+typedef struct luby_call_cache {
+    struct luby_class_obj *klass;
+    const struct luby_field_slot *field;    // NULL: not a field of klass
+    const struct luby_proc *accessor;       // NULL: not an attr accessor of klass
+    size_t epoch;
+    struct luby_class_obj *self_klass;
+    size_t native;                          // 1 + cfuncs index of a typed native, 0: none
+    size_t native_epoch;
+} luby_call_cache;
+
 typedef struct luby_chunk {
     luby_inst *code;
     int *lines;
@@ -447,6 +467,8 @@ typedef struct luby_chunk {
     luby_value *consts;
     size_t const_count;
     size_t const_capacity;
+    int shared;         // code/lines belong to a luby_image and are not freed with the chunk
+    luby_call_cache *call_cache; // one per instruction, allocated on first cached call
 } luby_chunk;
 
 typedef struct luby_compiler {
@@ -518,6 +540,10 @@ typedef struct luby_vm {
     int resume_pending;
     luby_value resume_value;
     int native_yield;
+    int pinned;  // bottom stack slots owned by a native caller; kept across luby_vm_reset
+    struct luby_vm *gc_prev;  // links in L->gc_vms while the VM is running
+    struct luby_vm *gc_next;
+    int gc_linked;
 } luby_vm;
 
 // ------------------------------ Allocator ----------------------------------
@@ -551,16 +577,65 @@ typedef struct luby_config {
     size_t call_depth_limit;    // Max call stack depth
     size_t allocation_limit;    // Max GC allocations per invocation
     size_t memory_limit;        // Max GC heap size in bytes
+
+    // Garbage collector
+    size_t gc_sweep_batch;      // If > 0, sweep incrementally: visit at most this many objects per allocation (0 = sweep all at once)
+    int defer_finalizers;       // Queue userdata finalizers for luby_run_finalizers instead of running them inside collection
 } luby_config;
 
 // --------------------------- Native Bindings -------------------------------
 
 typedef int (*luby_cfunc)(luby_state *L, int argc, const luby_value *argv, luby_value *out);
 typedef void (*luby_finalizer)(void *user_data);
+// Copies VM-owned userdata bytes from `src` into the fresh block `dst` for a
+// snapshot or clone. Returns 0 on success; anything else fails the copy.
+typedef int (*luby_copy_fn)(void *dst, const void *src, size_t size);
 
 LUBY_API luby_state *luby_new(const luby_config *cfg);
 LUBY_API void luby_free(luby_state *L);
 
+// Deferred finalizers (luby_config.defer_finalizers): run up to `max` queued
+// userdata finalizers (0 = all) and return how many ran
+LUBY_API size_t luby_run_finalizers(luby_state *L, size_t max);
+LUBY_API size_t luby_pending_finalizers(luby_state *L);
+
+// Snapshots: freeze a fully initialized state (base library, required
+// scripts, globals) and stamp out independent copies of it. The snapshot is
+// a deep copy, so L may keep running or be freed. Not allowed while L is
+// executing or has a suspended coroutine (returns NULL and sets L's error).
+// luby_clone returns NULL on allocation failure or when a userdata copy
+// hook fails; it only reads the snapshot, so clones may be made from
+// several threads at once.
+LUBY_API luby_snapshot *luby_snapshot_new(luby_state *L);
+LUBY_API luby_state *luby_clone(const luby_snapshot *snap);
+LUBY_API void luby_snapshot_free(luby_snapshot *snap);
+
+// Actors: scripts call spawn(:name, args...) to run a global function on a
+// host thread, inside a pooled worker state cloned from `snap`, and talk
+// through bounded Channel objects. Arguments, results and channel messages
+// cross states by deep copy; nil, booleans, numbers, strings, symbols,
+// ranges, arrays, hashes (frozen ones arrive frozen), vector math values
+// and channels can be sent. The host supplies threads and locks, so any thread pool works.
+typedef struct luby_thread_api {
+    void *user;
+    int (*submit)(void *user, void (*job)(void *arg), void *arg);  // run job(arg) on a pool thread; 0 on success
+    void *(*mutex_new)(void *user);
+    void (*mutex_free)(void *user, void *mutex);
+    void (*lock)(void *user, void *mutex);
+    void (*unlock)(void *user, void *mutex);
+    void *(*cond_new)(void *user);
+    void (*cond_free)(void *user, void *cond);
+    void (*wait)(void *user, void *cond, void *mutex);
+    void (*broadcast)(void *user, void *cond);
+} luby_thread_api;
+
+// The snapshot must outlive the pool. luby_actor_pool_free waits for running
+// actors to finish, then frees the idle worker states.
+LUBY_API luby_actor_pool *luby_actor_pool_new(const luby_snapshot *snap, const luby_thread_api *threads);
+LUBY_API void luby_actor_pool_free(luby_actor_pool *pool);
+// Defines spawn, Actor and Channel in L and routes its spawns to `pool`
+LUBY_API int luby_set_actor_pool(luby_state *L, luby_actor_pool *pool);
+
 // Execution limits
 LUBY_API void luby_set_instruction_limit(luby_state *L, size_t limit);
 LUBY_API void luby_set_call_depth_limit(luby_state *L, size_t limit);
@@ -575,6 +650,16 @@ LUBY_API int luby_eval(luby_state *L, const char *code, size_t len, const char *
 LUBY_API int luby_require(luby_state *L, const char *path, luby_value *out);
 LUBY_API int luby_load(luby_state *L, const char *path, luby_value *out);
 
+// Shared code images: compile a script once, then run it in any number of
+// states on any threads. An image is immutable and reference counted; its
+// bytecode is shared, while constants, method bodies and everything the
+// script defines are instantiated per state the first time it runs there.
+// luby_image_compile returns NULL and sets L's error on failure.
+LUBY_API luby_image *luby_image_compile(luby_state *L, const char *code, size_t len, const char *filename);
+LUBY_API void luby_image_retain(luby_image *img);
+LUBY_API void luby_image_release(luby_image *img);
+LUBY_API int luby_image_run(luby_state *L, luby_image *img, luby_value *out);
+
 LUBY_API luby_error luby_last_error(luby_state *L);
 LUBY_API void luby_clear_error(luby_state *L);
 LUBY_API const char *luby_error_code_string(luby_error_code code);
@@ -584,6 +669,16 @@ LUBY_API size_t luby_format_error(luby_state *L, char *buffer, size_t buffer_siz
 LUBY_API void luby_set_global_value(luby_state *L, const char *name, luby_value v);
 LUBY_API luby_value luby_get_global_value(luby_state *L, const char *name);
 
+// Host handles: keep values alive from C without parking them in globals.
+// luby_ref pins a value and returns a handle (LUBY_NOREF on failure).
+// luby_ref_weak does not keep its value alive; once the GC collects the
+// value the handle reads back as nil. Handles are reused after luby_unref.
+#define LUBY_NOREF 0
+LUBY_API int luby_ref(luby_state *L, luby_value v);
+LUBY_API int luby_ref_weak(luby_state *L, luby_value v);
+LUBY_API luby_value luby_ref_get(luby_state *L, int ref);
+LUBY_API void luby_unref(luby_state *L, int ref);
+
 // Value helpers
 LUBY_API luby_value luby_nil(void);
 LUBY_API luby_value luby_bool(int b);
@@ -607,6 +702,18 @@ LUBY_API int luby_hash_set_value(luby_state *L, luby_value h, luby_value key, lu
 // Call into Luby-defined functions/methods from C
 LUBY_API int luby_invoke_global(luby_state *L, const char *name, int argc, const luby_value *argv, luby_value *out);
 LUBY_API int luby_invoke_method(luby_state *L, luby_value recv, const char *method, int argc, const luby_value *argv, luby_value *out);
+// Pre-resolved method handles for calling the same method many times from C
+LUBY_API luby_method_ref *luby_method_ref_new(luby_state *L, luby_class *cls, const char *method);
+LUBY_API int luby_method_ref_call(luby_state *L, luby_method_ref *ref, luby_value recv, int argc, const luby_value *argv, luby_value *out);
+LUBY_API void luby_method_ref_free(luby_state *L, luby_method_ref *ref);
+// Call a method handle on many receivers in one entry. args_fn (may be NULL
+// for no arguments) fills argv for receiver `index` and returns argc, or -1
+// to fail that item. Each item gets its own instruction/allocation budget;
+// status[i] receives its error code. Returns the first failing code, or 0.
+#define LUBY_BATCH_MAX_ARGS 8
+typedef int (*luby_batch_args_fn)(luby_state *L, size_t index, luby_value recv, luby_value *argv, void *user);
+LUBY_API int luby_invoke_batch(luby_state *L, luby_method_ref *ref, const luby_value *receivers, size_t n,
+                               luby_batch_args_fn args_fn, void *user, luby_value *results, int *status);
 // Call C-registered functions (existing API)
 LUBY_API int luby_call(luby_state *L, luby_value recv, const char *method, int argc, const luby_value *argv, luby_value *out);
 
@@ -614,6 +721,41 @@ LUBY_API int luby_call(luby_state *L, luby_value recv, const char *method, int a
 LUBY_API int luby_register_function(luby_state *L, const char *name, luby_cfunc fn);
 LUBY_API int luby_register_module(luby_state *L, const char *name, luby_cfunc loader);
 
+// Typed natives: a signature states what a native accepts, and every call
+// is checked against it before the native runs, so the function can read
+// argv without re-validating and callers get a TypeError naming the bad
+// argument. Natives that map numbers to a number can add an unboxed entry
+// point (`num1`/`num2`) that the VM calls directly with doubles.
+#define LUBY_SIG_MAX_ARGS 8
+typedef enum luby_arg_type {
+    LUBY_ARG_ANY,
+    LUBY_ARG_INT,
+    LUBY_ARG_FLOAT,
+    LUBY_ARG_NUMBER,    // Integer or Float
+    LUBY_ARG_STRING,
+    LUBY_ARG_SYMBOL,
+    LUBY_ARG_BOOL,
+    LUBY_ARG_ARRAY,
+    LUBY_ARG_HASH,
+    LUBY_ARG_PROC,
+    LUBY_ARG_USERDATA
+} luby_arg_type;
+
+enum { LUBY_BLOCK_NONE, LUBY_BLOCK_OPTIONAL, LUBY_BLOCK_REQUIRED };
+
+typedef struct luby_signature {
+    int arity;                              // exact argument count (receiver excluded), or -1 for any
+    luby_arg_type args[LUBY_SIG_MAX_ARGS];  // expected type per position; later positions are unchecked
+    int block;                              // LUBY_BLOCK_NONE, _OPTIONAL or _REQUIRED
+    int pure;                               // never calls back into the VM, yields or keeps its arguments
+    double (*num1)(double);                 // optional unboxed entry for arity 1
+    double (*num2)(double, double);         // optional unboxed entry for arity 2
+} luby_signature;
+
+// Register a global native with a signature (NULL: untyped, like
+// luby_register_function). Registering a name again replaces it.
+LUBY_API int luby_register_function_ex(luby_state *L, const char *name, luby_cfunc fn, const luby_signature *sig);
+
 // Base standard library
 LUBY_API void luby_open_base(luby_state *L);
 
@@ -624,12 +766,83 @@ LUBY_API void luby_clear_search_paths(luby_state *L);
 // Classes and userdata
 LUBY_API luby_class *luby_define_class(luby_state *L, const char *name, const char *super_name);
 LUBY_API int luby_define_method(luby_state *L, luby_class *cls, const char *name, luby_cfunc fn);
+// Same, checked against `sig` on every call; the signature describes the
+// arguments after the receiver. Returns 1 on success, 0 on failure.
+LUBY_API int luby_define_method_ex(luby_state *L, luby_class *cls, const char *name, luby_cfunc fn, const luby_signature *sig);
 LUBY_API luby_value luby_new_userdata(luby_state *L, size_t size, luby_finalizer finalize);
 LUBY_API luby_value luby_wrap_userdata(luby_state *L, void *ptr, luby_finalizer finalize);
 LUBY_API void *luby_userdata_ptr(luby_value v);
 LUBY_API int luby_userdata_alive(luby_value v);
 LUBY_API int luby_invalidate_userdata(luby_value v);
 LUBY_API void luby_set_userdata_class(luby_state *L, luby_value v, luby_class *cls);
+// Same, with the class given as a value: a class constant or the receiver
+// of a native `new`. Returns 1 on success, 0 if `cls` is not a class.
+LUBY_API int luby_set_userdata_class_value(luby_state *L, luby_value v, luby_value cls);
+// Copy VM-owned userdata through `copy` instead of bytewise when the state
+// is snapshotted or cloned. Returns 1 on success, 0 if `v` is not VM-owned.
+LUBY_API int luby_set_userdata_copy(luby_state *L, luby_value v, luby_copy_fn copy);
+
+// Struct-layout bindings: describe the C struct that a class's userdata
+// points at, and `ud.name` / `ud.name = v` become direct loads and stores
+// at the field's offset instead of cfunc calls. Methods defined on the class
+// take precedence over fields of the same name; subclasses inherit fields.
+// Redefining a field name replaces it. Returns 1 on success, 0 on failure.
+typedef enum luby_field_type {
+    LUBY_FIELD_INT8,
+    LUBY_FIELD_INT16,
+    LUBY_FIELD_INT32,
+    LUBY_FIELD_INT64,
+    LUBY_FIELD_UINT8,
+    LUBY_FIELD_UINT16,
+    LUBY_FIELD_UINT32,
+    LUBY_FIELD_FLOAT,
+    LUBY_FIELD_DOUBLE,
+    LUBY_FIELD_BOOL         // C99 bool
+} luby_field_type;
+
+typedef struct luby_field {
+    const char *name;
+    size_t offset;
+    luby_field_type type;
+    int readonly;
+} luby_field;
+
+#define LUBY_FIELD(st, member, type) { #member, offsetof(st, member), (type), 0 }
+#define LUBY_FIELD_READONLY(st, member, type) { #member, offsetof(st, member), (type), 1 }
+
+LUBY_API int luby_define_fields(luby_state *L, luby_class *cls, const luby_field *fields, size_t count);
+
+// Vector math: immutable Vector2, Vector3, Quaternion (x, y, z, w) and
+// Matrix4 (column-major) values with single-precision components.
+// luby_vector_new copies the components (NULL for all zeros);
+// luby_vector_data returns them, or NULL if v is not a vector value.
+typedef enum luby_vector_kind {
+    LUBY_VECTOR2,
+    LUBY_VECTOR3,
+    LUBY_QUATERNION,
+    LUBY_MATRIX4
+} luby_vector_kind;
+
+LUBY_API luby_value luby_vector_new(luby_state *L, luby_vector_kind kind, const float *components);
+LUBY_API const float *luby_vector_data(luby_value v, luby_vector_kind *kind);
+
+// Transform `count` xyz points (packed, 3 floats each) by the column-major
+// 4x4 matrix m; `out` may equal `points`
+LUBY_API void luby_mat4_transform_points(const float *m, const float *points, float *out, size_t count);
+
+// Typed arrays: fixed-length Float32Array, Float64Array and Int32Array
+// values over contiguous primitive storage. luby_buffer_new copies `length`
+// elements from `init` (NULL for zeros). luby_buffer_data returns the first
+// element in place, valid while the value (or the array a view was taken
+// from) is reachable, or NULL if v is not a typed array.
+typedef enum luby_buffer_kind {
+    LUBY_FLOAT32,
+    LUBY_FLOAT64,
+    LUBY_INT32
+} luby_buffer_kind;
+
+LUBY_API luby_value luby_buffer_new(luby_state *L, luby_buffer_kind kind, size_t length, const void *init);
+LUBY_API void *luby_buffer_data(luby_value v, luby_buffer_kind *kind, size_t *length);
 
 // Coroutines
 LUBY_API luby_coroutine *luby_coroutine_new(luby_state *L, luby_value func);
@@ -660,6 +873,7 @@ LUBY_API void luby_set_hook(luby_state *L, luby_hook_fn fn, void *user);
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <float.h>
 
 #if defined(__GNUC__) || defined(__clang__)
 #define LUBY_UNUSED __attribute__((unused))
@@ -667,6 +881,85 @@ LUBY_API void luby_set_hook(luby_state *L, luby_hook_fn fn, void *user);
 #define LUBY_UNUSED
 #endif
 
+// Atomic add on a long, returning the new value; used for the reference
+// counts of images and actor objects, which states on different threads
+// share. Define it before including luby.h on other compilers.
+#ifndef LUBY_ATOMIC_ADD
+#if defined(__GNUC__) || defined(__clang__)
+#define LUBY_ATOMIC_ADD(p, n) __atomic_add_fetch((p), (n), __ATOMIC_ACQ_REL)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define LUBY_ATOMIC_ADD(p, n) (_InterlockedExchangeAdd((volatile long *)(p), (long)(n)) + (long)(n))
+#else
+#error "luby: no atomic add for this compiler; define LUBY_ATOMIC_ADD(p, n)"
+#endif
+#endif
+
+// Four-lane float operations for the vector math kernels: SSE on x86, NEON
+// on ARM, plain loops elsewhere. Define LUBY_NO_SIMD to force the loops.
+#if !defined(LUBY_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#include <xmmintrin.h>
+typedef __m128 luby_f4;
+#define luby_f4_load(p) _mm_loadu_ps(p)
+#define luby_f4_store(p, a) _mm_storeu_ps((p), (a))
+#define luby_f4_splat(x) _mm_set1_ps(x)
+#define luby_f4_add(a, b) _mm_add_ps((a), (b))
+#define luby_f4_sub(a, b) _mm_sub_ps((a), (b))
+#define luby_f4_mul(a, b) _mm_mul_ps((a), (b))
+#define luby_f4_min(a, b) _mm_min_ps((a), (b))
+#define luby_f4_max(a, b) _mm_max_ps((a), (b))
+#elif !defined(LUBY_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+typedef float32x4_t luby_f4;
+#define luby_f4_load(p) vld1q_f32(p)
+#define luby_f4_store(p, a) vst1q_f32((p), (a))
+#define luby_f4_splat(x) vdupq_n_f32(x)
+#define luby_f4_add(a, b) vaddq_f32((a), (b))
+#define luby_f4_sub(a, b) vsubq_f32((a), (b))
+#define luby_f4_mul(a, b) vmulq_f32((a), (b))
+#define luby_f4_min(a, b) vminq_f32((a), (b))
+#define luby_f4_max(a, b) vmaxq_f32((a), (b))
+#else
+typedef struct luby_f4 { float v[4]; } luby_f4;
+static LUBY_UNUSED luby_f4 luby_f4_load(const float *p) { luby_f4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static LUBY_UNUSED void luby_f4_store(float *p, luby_f4 a) { memcpy(p, a.v, sizeof(a.v)); }
+static LUBY_UNUSED luby_f4 luby_f4_splat(float x) { luby_f4 r = {{ x, x, x, x }}; return r; }
+#define LUBY_F4_LANES(name, expr) \
+    static LUBY_UNUSED luby_f4 name(luby_f4 a, luby_f4 b) { \
+        luby_f4 r; \
+        for (int i = 0; i < 4; i++) r.v[i] = (expr); \
+        return r; \
+    }
+LUBY_F4_LANES(luby_f4_add, a.v[i] + b.v[i])
+LUBY_F4_LANES(luby_f4_sub, a.v[i] - b.v[i])
+LUBY_F4_LANES(luby_f4_mul, a.v[i] * b.v[i])
+LUBY_F4_LANES(luby_f4_min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+LUBY_F4_LANES(luby_f4_max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef LUBY_F4_LANES
+#endif
+
+// Slot in the host handle table (see luby_ref)
+typedef enum luby_ref_kind {
+    LUBY_REF_FREE,
+    LUBY_REF_STRONG,
+    LUBY_REF_WEAK
+} luby_ref_kind;
+
+// Userdata finalizer queued by a collection (see luby_config.defer_finalizers)
+typedef struct luby_pending_finalizer {
+    luby_finalizer fn;
+    void *data;
+    int owned;                     // data is VM-owned and freed after fn runs
+} luby_pending_finalizer;
+
+struct luby_image_attachment;
+
+typedef struct luby_ref_slot {
+    luby_value value;
+    luby_ref_kind kind;
+    int next_free;                 // next free handle while kind == LUBY_REF_FREE
+} luby_ref_slot;
+
 struct luby_state {
     luby_config cfg;
     luby_error last_error;
@@ -696,6 +989,7 @@ struct luby_state {
     struct {
         const char **names;
         luby_cfunc *funcs;
+        luby_signature **sigs;  // owned copies; NULL for untyped natives
         size_t count;
         size_t capacity;
     } cfuncs;
@@ -710,6 +1004,18 @@ struct luby_state {
     size_t gc_threshold;           // trigger collection when gc_alloc_count reaches this
     size_t gc_total;               // total number of live GC objects
     int gc_paused;                 // if non-zero, GC collection is inhibited
+    luby_gc_obj **gc_mark_stack;   // gray objects awaiting a child scan
+    size_t gc_mark_count;
+    size_t gc_mark_capacity;
+    struct luby_vm *gc_vms;        // every VM currently running (all are roots)
+    luby_value *gc_temps;          // native temporaries rooted by builtins
+    size_t gc_temp_count;
+    size_t gc_temp_capacity;
+    luby_gc_obj *gc_sweep_list;    // objects from the last mark not yet swept
+    luby_gc_obj **gc_sweep_cursor; // next link to visit in gc_sweep_list
+    luby_pending_finalizer *finalizers;
+    size_t finalizer_count;
+    size_t finalizer_capacity;
     
     // Execution limits (from config)
     size_t instruction_limit;      // Max instructions per invocation (0 = unlimited)
@@ -731,6 +1037,39 @@ struct luby_state {
 
     // Arena for AST allocations during parsing (set temporarily)
     luby_arena *parse_arena;
+
+    // Live method handles (their cached targets are GC roots)
+    luby_method_ref *method_refs;
+
+    // Host handle table: handle h lives in refs[h - 1]
+    luby_ref_slot *refs;
+    int ref_count;
+    int ref_capacity;
+    int ref_free;                  // first free handle, LUBY_NOREF if none
+
+    // Code images instantiated in this state (their constants are GC roots)
+    struct luby_image_attachment *images;
+
+    // Worker pool that spawn hands actors to (see luby_set_actor_pool)
+    luby_actor_pool *actors;
+
+    // Innermost native Enumerable method driving a user-defined each
+    struct luby_enumerable_run *enumerable_run;
+
+    // Vector math classes, by luby_vector_kind, and swept vector blocks kept
+    // for reuse so steady-state vector arithmetic does not touch malloc
+    luby_class_obj *vector_classes[4];
+    luby_gc_obj *vector_free[4];
+    size_t vector_free_count[4];
+
+    // Typed array classes, by luby_buffer_kind
+    luby_class_obj *buffer_classes[3];
+
+    // Classes with an object pool (Class#pool); rooted so that a collected
+    // instance can always hand its block back
+    luby_class_obj **pool_classes;
+    size_t pool_class_count;
+    size_t pool_class_capacity;
 };
 
 // ----------------------------- GC Header ----------------------------------
@@ -745,7 +1084,9 @@ typedef enum luby_gc_type {
     LUBY_GC_RANGE,
     LUBY_GC_COROUTINE,
     LUBY_GC_CMETHOD,
-    LUBY_GC_USERDATA
+    LUBY_GC_USERDATA,
+    LUBY_GC_VECTOR,
+    LUBY_GC_BUFFER
 } luby_gc_type;
 
 struct luby_gc_obj {
@@ -770,9 +1111,10 @@ typedef struct luby_string_obj {
 typedef struct luby_array {
     luby_gc_obj gc;
     size_t count;
-    size_t capacity;
+    size_t capacity;             // slots from items[0] to the end of the block
     luby_value *items;
     int frozen;
+    size_t head;                 // free slots before items[0] (block starts at items - head)
 } luby_array;
 
 typedef struct luby_hash_entry {
@@ -807,9 +1149,27 @@ struct luby_class_obj {
     char **cvar_names;        // class variable names
     luby_value *cvar_values;  // class variable values
     size_t cvar_count;        // number of class variables
+    struct luby_field_slot *fields;  // host struct layout (luby_define_fields)
+    size_t field_count;
+    const char **members;     // Struct.new member names (interned); one slot each
+    size_t member_count;
+    size_t pool_capacity;     // Class#pool size; 0 when instances are not pooled
+    luby_array *pool_items;   // released instances waiting for acquire
+    luby_gc_obj *pool_free;   // blocks of collected instances, linked by gc_next
+    size_t pool_free_count;
     int frozen;
 };
 
+// A bound host struct field; `name` is stored as "name=" so one string
+// serves both the reader and the setter
+typedef struct luby_field_slot {
+    char *name;
+    size_t name_len;          // without the trailing '='
+    size_t offset;
+    luby_field_type type;
+    int readonly;
+} luby_field_slot;
+
 typedef struct luby_object {
     luby_gc_obj gc;
     luby_class_obj *klass;
@@ -820,6 +1180,10 @@ typedef struct luby_object {
     luby_value *ivar_values;
     size_t ivar_count;
     luby_gc_obj *native_ref;    // optional GC-traced native reference (e.g., coroutine)
+    luby_value *slots;          // Struct members, stored inline after the object
+    size_t slot_count;
+    int pooled;                 // block goes back to its class's pool when collected
+    int released;               // waiting in its class's pool_items
 } luby_object;
 
 typedef struct luby_range {
@@ -829,13 +1193,52 @@ typedef struct luby_range {
     int exclusive;
 } luby_range;
 
+// Vector math value: the components follow the header inline
+typedef struct luby_vector {
+    luby_gc_obj gc;
+    luby_class_obj *klass;      // Vector2, Vector3, Quaternion or Matrix4
+    luby_vector_kind kind;
+    float c[];
+} luby_vector;
+
+static const int luby_vector_lengths[] = { 2, 3, 4, 16 };
+#define LUBY_VECTOR_SIZE(kind) (sizeof(luby_vector) + (size_t)luby_vector_lengths[kind] * sizeof(float))
+#define LUBY_VECTOR_FREE_MAX 65536 // most recycled blocks kept per kind
+
+// Typed array: an owner keeps its elements inline after the header; a view
+// shares `length` elements of its owner starting at element `offset`
+typedef struct luby_buffer {
+    luby_gc_obj gc;
+    luby_class_obj *klass;      // Float32Array, Float64Array or Int32Array
+    struct luby_buffer *owner;  // array whose storage a view shares; NULL for an owner
+    luby_buffer_kind kind;
+    size_t offset;
+    size_t length;
+    double items[];             // an owner's elements (double keeps them aligned)
+} luby_buffer;
+
+static const size_t luby_buffer_elem_sizes[] = { sizeof(float), sizeof(double), sizeof(int32_t) };
+#define LUBY_BUFFER_SIZE(b) (sizeof(luby_buffer) + ((b)->owner ? 0 : (b)->length * luby_buffer_elem_sizes[(b)->kind]))
+#define LUBY_BUFFER_DATA(b) ((unsigned char *)((b)->owner ? (b)->owner : (b))->items + (b)->offset * luby_buffer_elem_sizes[(b)->kind])
+
+static double luby_buffer_get(const luby_buffer *b, size_t i) {
+    const unsigned char *p = LUBY_BUFFER_DATA(b);
+    switch (b->kind) {
+        case LUBY_FLOAT32: return (double)((const float *)p)[i];
+        case LUBY_FLOAT64: return ((const double *)p)[i];
+        default: return (double)((const int32_t *)p)[i];
+    }
+}
+
 typedef struct luby_userdata {
     luby_gc_obj gc;
     luby_class_obj *klass;      // associated class (for method dispatch)
     void *data;                  // host pointer or embedded data
     size_t size;                 // if > 0, we allocated the data
     luby_finalizer finalize;     // called on GC collection or invalidation
+    luby_copy_fn copy;           // copies owned data into snapshots (NULL = bytewise)
     int alive;                   // 1 = valid, 0 = tombstoned/invalidated
+    int cache;                   // internal cache rebuilt on demand; snapshots drop it
 } luby_userdata;
 
 struct luby_proc {
@@ -854,8 +1257,14 @@ struct luby_proc {
     char **kwarg_names;           // names of keyword params
     size_t kwarg_count;           // number of keyword params
     luby_chunk *kwarg_default_chunks; // bytecode for kwarg defaults (empty chunk = required)
+    int accessor;                 // LUBY_ACCESSOR_* for attr_reader/attr_writer methods
+    int slot;                     // 1 + Struct member index for member accessors, 0 otherwise
 };
 
+// Accessor procs keep their ivar name in chunk.consts[0]. A Struct's
+// initialize is one too: it stores its arguments into the member slots.
+enum { LUBY_ACCESSOR_NONE, LUBY_ACCESSOR_READER, LUBY_ACCESSOR_WRITER, LUBY_ACCESSOR_INIT };
+
 struct luby_coroutine {
     luby_gc_obj gc;
     luby_proc *proc;
@@ -868,6 +1277,79 @@ struct luby_class {
     luby_class_obj *obj;
 };
 
+// Host-held handle to a method, resolved once per receiver class and
+// revalidated against L->method_epoch before each call
+struct luby_method_ref {
+    const char *name;             // interned method name
+    luby_class_obj *cls;          // receiver class the cached target was resolved for
+    size_t epoch;                 // method_epoch at resolution (0 = unresolved)
+    luby_value target;            // PROC or CMETHOD, nil if undefined
+    luby_vm vm;                   // reused for every call that is not re-entrant
+    int busy;                     // vm is running a call further up the C stack
+    luby_method_ref *prev;
+    luby_method_ref *next;
+};
+
+// Code image contents. Everything here is written once by
+// luby_image_compile and only read afterwards, so any number of states may
+// use an image concurrently. Constants are stored as descriptions and
+// materialized per state.
+typedef struct luby_image_const {
+    luby_value value;                // immediates as-is; type tag for the rest
+    const char *str;                 // STRING / SYMBOL contents
+    size_t len;
+    struct luby_image_proc *proc;    // PROC template
+} luby_image_const;
+
+typedef struct luby_image_chunk {
+    luby_inst *code;
+    int *lines;
+    size_t count;
+    luby_image_const *consts;
+    size_t const_count;
+} luby_image_chunk;
+
+typedef struct luby_image_proc {
+    char **param_names;
+    size_t param_count;
+    luby_image_chunk *default_chunks;
+    int splat_index;
+    int has_block_param;
+    char *block_param_name;
+    char **local_names;
+    size_t local_count;
+    luby_image_chunk chunk;
+    int owned_by_chunk;
+    luby_visibility visibility;
+    char **kwarg_names;
+    size_t kwarg_count;
+    luby_image_chunk *kwarg_default_chunks;
+    int accessor;
+    int slot;
+} luby_image_proc;
+
+typedef struct luby_image_block {
+    struct luby_image_block *next;
+    union { double d; int64_t i; void *p; } align;
+} luby_image_block;
+
+struct luby_image {
+    long refs;
+    luby_alloc_fn alloc;             // allocator of the compiling state
+    void *alloc_user;
+    luby_image_block *blocks;        // every allocation, freed with the image
+    const char *filename;
+    luby_image_chunk top;
+};
+
+// Per-state instance of an image: shares the image's bytecode, owns the
+// constants materialized for this state
+typedef struct luby_image_attachment {
+    luby_image *image;
+    luby_chunk chunk;
+    struct luby_image_attachment *next;
+} luby_image_attachment;
+
 struct luby_module {
     luby_class_obj *obj;
 };
@@ -875,6 +1357,7 @@ struct luby_module {
 typedef struct luby_cmethod {
     luby_gc_obj gc;
     luby_cfunc fn;
+    luby_signature *sig;    // typed methods: points just past the struct, same allocation
 } luby_cmethod;
 
 static void *luby_default_alloc(void *user, void *ptr, size_t size) {
@@ -965,6 +1448,9 @@ static void luby_free_node(luby_state *L, void *node) {
 #define LUBY_GC_INITIAL_THRESHOLD 256
 
 static void luby_gc_collect(luby_state *L);
+static void luby_gc_sweep_step(luby_state *L, size_t budget);
+static void luby_object_free_ivars(luby_state *L, luby_object *o);
+static int luby_pool_recycle(luby_state *L, luby_object *o);
 static void luby_set_error(luby_state *L, luby_error_code code, const char *message, const char *file, int line, int column);
 
 // Track a GC object: link into intrusive list and bump counters.
@@ -977,33 +1463,44 @@ static void luby_gc_track(luby_state *L, luby_gc_obj *obj, luby_gc_type type) {
     L->gc_total++;
 }
 
-// Allocate a GC-tracked object of given size and type.  Triggers collection
-// when the allocation counter reaches the threshold.
-static void *luby_gc_alloc(luby_state *L, size_t size, luby_gc_type type) {
+// Enforce the allocation and memory limits for a new `size`-byte object and
+// run whatever sweeping or collection is due.  Returns 0 if over a limit.
+static int luby_gc_alloc_prepare(luby_state *L, size_t size) {
     // Check allocation count limit (per-invocation)
     L->allocation_count++;
     if (L->allocation_limit > 0 && L->allocation_count > L->allocation_limit) {
         luby_set_error(L, LUBY_E_RUNTIME, "allocation limit exceeded", NULL, 0, 0);
-        return NULL;
+        return 0;
     }
     
     // Check memory limit (persistent) - try GC first if close to limit
     if (L->memory_limit > 0 && L->gc_bytes_allocated + size > L->memory_limit) {
         if (!L->gc_paused) {
             luby_gc_collect(L);
+        } else if (L->gc_sweep_list) {
+            luby_gc_sweep_step(L, (size_t)-1);
         }
         // Check again after GC
         if (L->gc_bytes_allocated + size > L->memory_limit) {
             luby_set_error(L, LUBY_E_RUNTIME, "memory limit exceeded", NULL, 0, 0);
-            return NULL;
+            return 0;
         }
     }
     
+    // Incremental sweep of the previous collection's garbage
+    if (L->gc_sweep_list) luby_gc_sweep_step(L, L->cfg.gc_sweep_batch);
+
     // Normal GC threshold check
     if (!L->gc_paused && L->gc_alloc_count >= L->gc_threshold) {
         luby_gc_collect(L);
     }
-    
+    return 1;
+}
+
+// Allocate a GC-tracked object of given size and type.  Triggers collection
+// when the allocation counter reaches the threshold.
+static void *luby_gc_alloc(luby_state *L, size_t size, luby_gc_type type) {
+    if (!luby_gc_alloc_prepare(L, size)) return NULL;
     void *mem = luby_alloc_raw(L, NULL, size);
     if (!mem) return NULL;
     memset(mem, 0, size);
@@ -1018,6 +1515,112 @@ static void *luby_gc_alloc(luby_state *L, size_t size, luby_gc_type type) {
     return mem;
 }
 
+// A vector math value of `kind` with zeroed components. Blocks swept by the
+// collector are reused before asking the allocator for memory.
+static luby_vector *luby_vector_alloc(luby_state *L, luby_vector_kind kind) {
+    size_t size = LUBY_VECTOR_SIZE(kind);
+    if (!luby_gc_alloc_prepare(L, size)) return NULL;
+    luby_gc_obj *mem = L->vector_free[kind];
+    if (mem) {
+        L->vector_free[kind] = mem->gc_next;
+        L->vector_free_count[kind]--;
+    } else if (!(mem = (luby_gc_obj *)luby_alloc_raw(L, NULL, size))) {
+        return NULL;
+    }
+    memset(mem, 0, size);
+    L->gc_bytes_allocated += size;
+    if (L->gc_bytes_allocated > L->peak_gc_bytes) {
+        L->peak_gc_bytes = L->gc_bytes_allocated;
+    }
+    luby_gc_track(L, mem, LUBY_GC_VECTOR);
+    luby_vector *v = (luby_vector *)mem;
+    v->kind = kind;
+    v->klass = L->vector_classes[kind];
+    return v;
+}
+
+static int luby_vector_arith(luby_state *L, int op, luby_value a, luby_value b, luby_value *out);
+
+// A typed array owning `length` zeroed elements, or, given `owner`, a view
+// of `length` of its elements from `offset` on. The caller keeps owner rooted.
+static luby_buffer *luby_buffer_alloc(luby_state *L, luby_buffer_kind kind, size_t length, luby_buffer *owner, size_t offset) {
+    size_t size = sizeof(luby_buffer);
+    if (!owner) {
+        if (length > (SIZE_MAX - size) / luby_buffer_elem_sizes[kind]) return NULL;
+        size += length * luby_buffer_elem_sizes[kind];
+    }
+    luby_buffer *b = (luby_buffer *)luby_gc_alloc(L, size, LUBY_GC_BUFFER);
+    if (!b) return NULL;
+    b->klass = L->buffer_classes[kind];
+    b->kind = kind;
+    b->length = length;
+    if (owner) {
+        // Views of views share the root owner's storage
+        b->owner = owner->owner ? owner->owner : owner;
+        b->offset = owner->offset + offset;
+    }
+    return b;
+}
+
+// Array storage: items live in one block with `head` spare slots in front of
+// items[0], so shift/unshift move a pointer instead of the elements.
+// capacity counts the slots from items[0] to the end of the block.
+
+// Make room for `need` elements from items[0].  A large front gap is
+// reclaimed by sliding the elements down; otherwise the block doubles.
+static int luby_array_reserve(luby_state *L, luby_array *arr, size_t need) {
+    if (need <= arr->capacity) return 1;
+    luby_value *base = arr->items ? arr->items - arr->head : NULL;
+    size_t total = arr->head + arr->capacity;
+    if (arr->head > 0 && (need > total || arr->head >= arr->count / 2)) {
+        if (arr->count) memmove(base, arr->items, arr->count * sizeof(luby_value));
+        arr->items = base;
+        arr->capacity = total;
+        arr->head = 0;
+        if (need <= total) return 1;
+    }
+    size_t new_cap = arr->capacity < 8 ? 8 : arr->capacity * 2;
+    while (new_cap < need) new_cap *= 2;
+    luby_value *nb = (luby_value *)luby_alloc_raw(L, base, (arr->head + new_cap) * sizeof(luby_value));
+    if (!nb) return 0;
+    arr->items = nb + arr->head;
+    arr->capacity = new_cap;
+    return 1;
+}
+
+// Make room for `n` elements in front of items[0].  The new gap is at least
+// as large as the array so repeated unshifts stay amortized O(1).
+static int luby_array_reserve_front(luby_state *L, luby_array *arr, size_t n) {
+    if (arr->head >= n) return 1;
+    size_t room = arr->count < 8 ? 8 : arr->count;
+    if (room < n) room = n;
+    size_t cap = arr->capacity < arr->count ? arr->count : arr->capacity;
+    luby_value *nb = (luby_value *)luby_alloc_raw(L, NULL, (room + cap) * sizeof(luby_value));
+    if (!nb) return 0;
+    if (arr->count) memcpy(nb + room, arr->items, arr->count * sizeof(luby_value));
+    if (arr->items) luby_alloc_raw(L, arr->items - arr->head, 0);
+    arr->items = nb + room;
+    arr->head = room;
+    arr->capacity = cap;
+    return 1;
+}
+
+// Drop the first `n` elements by advancing items; an emptied array gets its
+// whole block back.
+static void luby_array_drop_front(luby_array *arr, size_t n) {
+    if (n > arr->count) n = arr->count;
+    if (n == 0) return;
+    arr->items += n;
+    arr->head += n;
+    arr->capacity -= n;
+    arr->count -= n;
+    if (arr->count == 0) {
+        arr->items -= arr->head;
+        arr->capacity += arr->head;
+        arr->head = 0;
+    }
+}
+
 // Allocate a GC-tracked string with data copied in.
 // Returns pointer to the char data (not the header), so it's a
 // drop-in replacement for luby_dup_string in luby_value.as.ptr.
@@ -1035,6 +1638,8 @@ static char *luby_gc_alloc_string(luby_state *L, const char *data, size_t len) {
     if (L->memory_limit > 0 && L->gc_bytes_allocated + total_size > L->memory_limit) {
         if (!L->gc_paused) {
             luby_gc_collect(L);
+        } else if (L->gc_sweep_list) {
+            luby_gc_sweep_step(L, (size_t)-1);
         }
         // Check again after GC
         if (L->gc_bytes_allocated + total_size > L->memory_limit) {
@@ -1043,6 +1648,9 @@ static char *luby_gc_alloc_string(luby_state *L, const char *data, size_t len) {
         }
     }
     
+    // Incremental sweep of the previous collection's garbage
+    if (L->gc_sweep_list) luby_gc_sweep_step(L, L->cfg.gc_sweep_batch);
+
     // Normal GC threshold check
     if (!L->gc_paused && L->gc_alloc_count >= L->gc_threshold) {
         luby_gc_collect(L);
@@ -1066,14 +1674,54 @@ static char *luby_gc_alloc_string(luby_state *L, const char *data, size_t len) {
 }
 
 // ------------------------------ GC Mark ------------------------------------
+//
+// Marking is iterative: marking an object only flags it and pushes it on
+// L->gc_mark_stack; luby_gc_drain then pops objects and marks their
+// children. Deep structures (long linked lists, deep trees) therefore cost
+// mark-stack slots instead of C stack frames.
+
+static void luby_gc_mark_obj(luby_state *L, luby_gc_obj *obj);
+static void luby_gc_mark_value(luby_state *L, luby_value v);
+
+static void luby_gc_mark_vm(luby_state *L, luby_vm *vm) {
+    for (int i = 0; i < vm->sp; i++) {
+        luby_gc_mark_value(L, vm->stack[i]);
+    }
+    for (int i = 0; i < vm->frame_count; i++) {
+        luby_vm_frame *fr = &vm->frames[i];
+        luby_gc_mark_value(L, fr->saved_block);
+        luby_gc_mark_value(L, fr->saved_self);
+        luby_gc_mark_value(L, fr->self_saved);
+        luby_gc_mark_value(L, fr->return_override);
+        if (fr->proc) luby_gc_mark_obj(L, &fr->proc->gc);
+        if (fr->saved_method_class) luby_gc_mark_obj(L, &fr->saved_method_class->gc);
+        if (fr->chunk) {
+            for (size_t j = 0; j < fr->chunk->const_count; j++) {
+                luby_gc_mark_value(L, fr->chunk->consts[j]);
+            }
+        }
+        for (size_t j = 0; j < fr->param_count; j++) {
+            if (fr->param_existed && fr->param_existed[j] >= 0) {
+                luby_gc_mark_value(L, fr->param_saved[j]);
+            }
+        }
+        for (size_t j = 0; j < fr->local_count; j++) {
+            if (fr->local_existed && fr->local_existed[j] >= 0) {
+                luby_gc_mark_value(L, fr->local_saved[j]);
+            }
+        }
+        for (size_t j = 0; j < fr->kwarg_count; j++) {
+            if (fr->kwarg_existed && fr->kwarg_existed[j] >= 0) {
+                luby_gc_mark_value(L, fr->kwarg_saved[j]);
+            }
+        }
+    }
+    luby_gc_mark_value(L, vm->yield_value);
+    luby_gc_mark_value(L, vm->resume_value);
+}
 
-static void luby_gc_mark_obj(luby_gc_obj *obj);
-static void luby_gc_mark_value(luby_value v);
-
-static void luby_gc_mark_obj(luby_gc_obj *obj) {
-    if (!obj || obj->gc_marked) return;
-    obj->gc_marked = 1;
-
+// Mark the direct children of an already-marked object.
+static void luby_gc_scan_obj(luby_state *L, luby_gc_obj *obj) {
     switch (obj->gc_type) {
         case LUBY_GC_STRING:
             // Strings have no references
@@ -1081,44 +1729,48 @@ static void luby_gc_mark_obj(luby_gc_obj *obj) {
         case LUBY_GC_ARRAY: {
             luby_array *arr = (luby_array *)obj;
             for (size_t i = 0; i < arr->count; i++) {
-                luby_gc_mark_value(arr->items[i]);
+                luby_gc_mark_value(L, arr->items[i]);
             }
             break;
         }
         case LUBY_GC_HASH: {
             luby_hash *h = (luby_hash *)obj;
             for (size_t i = 0; i < h->count; i++) {
-                luby_gc_mark_value(h->entries[i].key);
-                luby_gc_mark_value(h->entries[i].value);
+                luby_gc_mark_value(L, h->entries[i].key);
+                luby_gc_mark_value(L, h->entries[i].value);
             }
             break;
         }
         case LUBY_GC_CLASS: {
             luby_class_obj *cls = (luby_class_obj *)obj;
-            if (cls->super) luby_gc_mark_obj(&cls->super->gc);
-            if (cls->methods) luby_gc_mark_obj(&cls->methods->gc);
-            if (cls->singleton_methods) luby_gc_mark_obj(&cls->singleton_methods->gc);
-            if (cls->method_cache) luby_gc_mark_obj(&cls->method_cache->gc);
-            if (cls->singleton_cache) luby_gc_mark_obj(&cls->singleton_cache->gc);
+            if (cls->super) luby_gc_mark_obj(L, &cls->super->gc);
+            if (cls->methods) luby_gc_mark_obj(L, &cls->methods->gc);
+            if (cls->singleton_methods) luby_gc_mark_obj(L, &cls->singleton_methods->gc);
+            if (cls->method_cache) luby_gc_mark_obj(L, &cls->method_cache->gc);
+            if (cls->singleton_cache) luby_gc_mark_obj(L, &cls->singleton_cache->gc);
             for (size_t i = 0; i < cls->included_count; i++) {
-                if (cls->included_modules[i]) luby_gc_mark_obj(&cls->included_modules[i]->gc);
+                if (cls->included_modules[i]) luby_gc_mark_obj(L, &cls->included_modules[i]->gc);
             }
             for (size_t i = 0; i < cls->prepended_count; i++) {
-                if (cls->prepended_modules[i]) luby_gc_mark_obj(&cls->prepended_modules[i]->gc);
+                if (cls->prepended_modules[i]) luby_gc_mark_obj(L, &cls->prepended_modules[i]->gc);
             }
             for (size_t i = 0; i < cls->cvar_count; i++) {
-                luby_gc_mark_value(cls->cvar_values[i]);
+                luby_gc_mark_value(L, cls->cvar_values[i]);
             }
+            if (cls->pool_items) luby_gc_mark_obj(L, &cls->pool_items->gc);
             break;
         }
         case LUBY_GC_OBJECT: {
             luby_object *o = (luby_object *)obj;
-            if (o->klass) luby_gc_mark_obj(&o->klass->gc);
-            if (o->ivars) luby_gc_mark_obj(&o->ivars->gc);
-            if (o->singleton_methods) luby_gc_mark_obj(&o->singleton_methods->gc);
-            if (o->native_ref) luby_gc_mark_obj(o->native_ref);
+            if (o->klass) luby_gc_mark_obj(L, &o->klass->gc);
+            if (o->ivars) luby_gc_mark_obj(L, &o->ivars->gc);
+            if (o->singleton_methods) luby_gc_mark_obj(L, &o->singleton_methods->gc);
+            if (o->native_ref) luby_gc_mark_obj(L, o->native_ref);
             for (size_t i = 0; i < o->ivar_count; i++) {
-                luby_gc_mark_value(o->ivar_values[i]);
+                luby_gc_mark_value(L, o->ivar_values[i]);
+            }
+            for (size_t i = 0; i < o->slot_count; i++) {
+                luby_gc_mark_value(L, o->slots[i]);
             }
             break;
         }
@@ -1126,13 +1778,13 @@ static void luby_gc_mark_obj(luby_gc_obj *obj) {
             luby_proc *proc = (luby_proc *)obj;
             // Mark constants in the chunk (strings, procs, etc.)
             for (size_t i = 0; i < proc->chunk.const_count; i++) {
-                luby_gc_mark_value(proc->chunk.consts[i]);
+                luby_gc_mark_value(L, proc->chunk.consts[i]);
             }
             // Mark default value chunks
             if (proc->default_chunks) {
                 for (size_t i = 0; i < proc->param_count; i++) {
                     for (size_t j = 0; j < proc->default_chunks[i].const_count; j++) {
-                        luby_gc_mark_value(proc->default_chunks[i].consts[j]);
+                        luby_gc_mark_value(L, proc->default_chunks[i].consts[j]);
                     }
                 }
             }
@@ -1140,7 +1792,7 @@ static void luby_gc_mark_obj(luby_gc_obj *obj) {
             if (proc->kwarg_default_chunks) {
                 for (size_t i = 0; i < proc->kwarg_count; i++) {
                     for (size_t j = 0; j < proc->kwarg_default_chunks[i].const_count; j++) {
-                        luby_gc_mark_value(proc->kwarg_default_chunks[i].consts[j]);
+                        luby_gc_mark_value(L, proc->kwarg_default_chunks[i].consts[j]);
                     }
                 }
             }
@@ -1148,37 +1800,14 @@ static void luby_gc_mark_obj(luby_gc_obj *obj) {
         }
         case LUBY_GC_RANGE: {
             luby_range *r = (luby_range *)obj;
-            luby_gc_mark_value(r->start);
-            luby_gc_mark_value(r->end);
+            luby_gc_mark_value(L, r->start);
+            luby_gc_mark_value(L, r->end);
             break;
         }
         case LUBY_GC_COROUTINE: {
             luby_coroutine *co = (luby_coroutine *)obj;
-            if (co->proc) luby_gc_mark_obj(&co->proc->gc);
-            // Mark the coroutine's VM stack
-            for (int i = 0; i < co->vm.sp; i++) {
-                luby_gc_mark_value(co->vm.stack[i]);
-            }
-            // Mark saved values in coroutine VM frames
-            for (int i = 0; i < co->vm.frame_count; i++) {
-                luby_vm_frame *fr = &co->vm.frames[i];
-                luby_gc_mark_value(fr->saved_block);
-                luby_gc_mark_value(fr->saved_self);
-                luby_gc_mark_value(fr->self_saved);
-                if (fr->proc) luby_gc_mark_obj(&fr->proc->gc);
-                for (size_t j = 0; j < fr->param_count; j++) {
-                    if (fr->param_existed && fr->param_existed[j] >= 0) {
-                        luby_gc_mark_value(fr->param_saved[j]);
-                    }
-                }
-                for (size_t j = 0; j < fr->local_count; j++) {
-                    if (fr->local_existed && fr->local_existed[j] >= 0) {
-                        luby_gc_mark_value(fr->local_saved[j]);
-                    }
-                }
-            }
-            luby_gc_mark_value(co->vm.yield_value);
-            luby_gc_mark_value(co->vm.resume_value);
+            if (co->proc) luby_gc_mark_obj(L, &co->proc->gc);
+            luby_gc_mark_vm(L, &co->vm);
             break;
         }
         case LUBY_GC_CMETHOD:
@@ -1186,95 +1815,199 @@ static void luby_gc_mark_obj(luby_gc_obj *obj) {
             break;
         case LUBY_GC_USERDATA: {
             luby_userdata *ud = (luby_userdata *)obj;
-            if (ud->klass) luby_gc_mark_obj(&ud->klass->gc);
+            if (ud->klass) luby_gc_mark_obj(L, &ud->klass->gc);
+            break;
+        }
+        case LUBY_GC_VECTOR: {
+            luby_vector *vec = (luby_vector *)obj;
+            if (vec->klass) luby_gc_mark_obj(L, &vec->klass->gc);
+            break;
+        }
+        case LUBY_GC_BUFFER: {
+            luby_buffer *buf = (luby_buffer *)obj;
+            if (buf->klass) luby_gc_mark_obj(L, &buf->klass->gc);
+            if (buf->owner) luby_gc_mark_obj(L, &buf->owner->gc);
             break;
         }
     }
 }
 
-static void luby_gc_mark_value(luby_value v) {
+static void luby_gc_mark_obj(luby_state *L, luby_gc_obj *obj) {
+    if (!obj || obj->gc_marked) return;
+    obj->gc_marked = 1;
+    if (obj->gc_type == LUBY_GC_STRING || obj->gc_type == LUBY_GC_CMETHOD) return;
+
+    if (L->gc_mark_count == L->gc_mark_capacity) {
+        size_t new_cap = L->gc_mark_capacity ? L->gc_mark_capacity * 2 : 256;
+        luby_gc_obj **ns = (luby_gc_obj **)luby_alloc_raw(L, L->gc_mark_stack, new_cap * sizeof(luby_gc_obj *));
+        if (!ns) {
+            // Out of memory for the mark stack: scan this object in place
+            luby_gc_scan_obj(L, obj);
+            return;
+        }
+        L->gc_mark_stack = ns;
+        L->gc_mark_capacity = new_cap;
+    }
+    L->gc_mark_stack[L->gc_mark_count++] = obj;
+}
+
+// GC header of a heap value, or NULL for immediates (nil, bools, numbers,
+// interned symbols)
+static luby_gc_obj *luby_gc_value_obj(luby_value v) {
+    if (!v.as.ptr) return NULL;
     switch (v.type) {
-        case LUBY_T_STRING:
-            if (v.as.ptr) luby_gc_mark_obj(&LUBY_STRING_OBJ(v.as.ptr)->gc);
-            break;
-        case LUBY_T_ARRAY:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_array *)v.as.ptr)->gc);
-            break;
-        case LUBY_T_HASH:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_hash *)v.as.ptr)->gc);
-            break;
+        case LUBY_T_STRING: return &LUBY_STRING_OBJ(v.as.ptr)->gc;
+        case LUBY_T_ARRAY: return &((luby_array *)v.as.ptr)->gc;
+        case LUBY_T_HASH: return &((luby_hash *)v.as.ptr)->gc;
         case LUBY_T_CLASS:
-        case LUBY_T_MODULE:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_class_obj *)v.as.ptr)->gc);
-            break;
-        case LUBY_T_OBJECT:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_object *)v.as.ptr)->gc);
-            break;
-        case LUBY_T_PROC:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_proc *)v.as.ptr)->gc);
-            break;
-        case LUBY_T_RANGE:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_range *)v.as.ptr)->gc);
-            break;
-        case LUBY_T_CMETHOD:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_cmethod *)v.as.ptr)->gc);
-            break;
-        case LUBY_T_USERDATA:
-            if (v.as.ptr) luby_gc_mark_obj(&((luby_userdata *)v.as.ptr)->gc);
-            break;
-        default:
-            // NIL, BOOL, INT, FLOAT, SYMBOL — no heap allocation or interned
-            break;
+        case LUBY_T_MODULE: return &((luby_class_obj *)v.as.ptr)->gc;
+        case LUBY_T_OBJECT: return &((luby_object *)v.as.ptr)->gc;
+        case LUBY_T_PROC: return &((luby_proc *)v.as.ptr)->gc;
+        case LUBY_T_RANGE: return &((luby_range *)v.as.ptr)->gc;
+        case LUBY_T_CMETHOD: return &((luby_cmethod *)v.as.ptr)->gc;
+        case LUBY_T_USERDATA: return &((luby_userdata *)v.as.ptr)->gc;
+        case LUBY_T_VECTOR: return &((luby_vector *)v.as.ptr)->gc;
+        case LUBY_T_BUFFER: return &((luby_buffer *)v.as.ptr)->gc;
+        default: return NULL;
     }
 }
 
-// Mark all roots: globals, VM stack, frame saved values, current_* pointers
+static void luby_gc_mark_value(luby_state *L, luby_value v) {
+    luby_gc_obj *obj = luby_gc_value_obj(v);
+    if (obj) luby_gc_mark_obj(L, obj);
+}
+
+// Scan gray objects until the mark stack is empty.
+static void luby_gc_drain(luby_state *L) {
+    while (L->gc_mark_count > 0) {
+        luby_gc_obj *obj = L->gc_mark_stack[--L->gc_mark_count];
+        luby_gc_scan_obj(L, obj);
+    }
+}
+
+// Mark all roots: globals, every running VM, native temporaries, current_* pointers
 static void luby_gc_mark_roots(luby_state *L) {
     // Global values
     for (size_t i = 0; i < L->global_count; i++) {
-        luby_gc_mark_value(L->global_values[i]);
+        luby_gc_mark_value(L, L->global_values[i]);
     }
     // Current block, class, self
-    luby_gc_mark_value(L->current_block);
-    luby_gc_mark_value(L->saved_block_for_call);
-    luby_gc_mark_value(L->current_class);
-    luby_gc_mark_value(L->current_self);
-    if (L->current_method_class) luby_gc_mark_obj(&L->current_method_class->gc);
-    // Current VM stack and frames
-    if (L->current_vm) {
-        luby_vm *vm = L->current_vm;
-        for (int i = 0; i < vm->sp; i++) {
-            luby_gc_mark_value(vm->stack[i]);
-        }
-        for (int i = 0; i < vm->frame_count; i++) {
-            luby_vm_frame *fr = &vm->frames[i];
-            luby_gc_mark_value(fr->saved_block);
-            luby_gc_mark_value(fr->saved_self);
-            luby_gc_mark_value(fr->self_saved);
-            if (fr->proc) luby_gc_mark_obj(&fr->proc->gc);
-            if (fr->chunk) {
-                for (size_t j = 0; j < fr->chunk->const_count; j++) {
-                    luby_gc_mark_value(fr->chunk->consts[j]);
-                }
-            }
-            for (size_t j = 0; j < fr->param_count; j++) {
-                if (fr->param_existed && fr->param_existed[j] >= 0) {
-                    luby_gc_mark_value(fr->param_saved[j]);
-                }
-            }
-            for (size_t j = 0; j < fr->local_count; j++) {
-                if (fr->local_existed && fr->local_existed[j] >= 0) {
-                    luby_gc_mark_value(fr->local_saved[j]);
-                }
-            }
-        }
-        luby_gc_mark_value(vm->yield_value);
-        luby_gc_mark_value(vm->resume_value);
+    luby_gc_mark_value(L, L->current_block);
+    luby_gc_mark_value(L, L->saved_block_for_call);
+    luby_gc_mark_value(L, L->current_class);
+    luby_gc_mark_value(L, L->current_self);
+    luby_gc_mark_value(L, L->block_break_value);
+    if (L->current_method_class) luby_gc_mark_obj(L, &L->current_method_class->gc);
+    for (int i = 0; i < 4; i++) {
+        if (L->vector_classes[i]) luby_gc_mark_obj(L, &L->vector_classes[i]->gc);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (L->buffer_classes[i]) luby_gc_mark_obj(L, &L->buffer_classes[i]->gc);
+    }
+    for (size_t i = 0; i < L->pool_class_count; i++) {
+        luby_gc_mark_obj(L, &L->pool_classes[i]->gc);
+    }
+    // Stacks and frames of the current VM and of every VM suspended beneath
+    // it in a native call (block iterators, method handles, nested evals)
+    if (L->current_vm) luby_gc_mark_vm(L, L->current_vm);
+    for (luby_vm *vm = L->gc_vms; vm; vm = vm->gc_next) {
+        if (vm != L->current_vm) luby_gc_mark_vm(L, vm);
+    }
+    // Values a builtin is holding in C locals across allocations or calls
+    for (size_t i = 0; i < L->gc_temp_count; i++) {
+        luby_gc_mark_value(L, L->gc_temps[i]);
     }
     // Current coroutine
     if (L->current_coroutine) {
-        luby_gc_mark_obj(&L->current_coroutine->gc);
+        luby_gc_mark_obj(L, &L->current_coroutine->gc);
+    }
+    // Method handle caches
+    for (luby_method_ref *r = L->method_refs; r; r = r->next) {
+        luby_gc_mark_value(L, r->target);
+        if (r->cls) luby_gc_mark_obj(L, &r->cls->gc);
+    }
+    // Strong host handles
+    for (int i = 0; i < L->ref_count; i++) {
+        if (L->refs[i].kind == LUBY_REF_STRONG) luby_gc_mark_value(L, L->refs[i].value);
+    }
+    // Constants of attached code images
+    for (luby_image_attachment *a = L->images; a; a = a->next) {
+        for (size_t i = 0; i < a->chunk.const_count; i++) {
+            luby_gc_mark_value(L, a->chunk.consts[i]);
+        }
+    }
+    luby_gc_drain(L);
+}
+
+// Clear weak host handles whose values did not survive marking
+static void luby_gc_clear_weak_refs(luby_state *L) {
+    for (int i = 0; i < L->ref_count; i++) {
+        luby_ref_slot *slot = &L->refs[i];
+        if (slot->kind != LUBY_REF_WEAK) continue;
+        luby_gc_obj *obj = luby_gc_value_obj(slot->value);
+        if (obj && !obj->gc_marked) slot->value = luby_nil();
+    }
+}
+
+// ------------------------------ GC Roots -----------------------------------
+
+// Register a VM as a root for as long as it runs. Returns 0 if it was
+// already registered (a re-entrant run), in which case the caller must not
+// unlink it.
+static int luby_gc_link_vm(luby_state *L, luby_vm *vm) {
+    if (vm->gc_linked) return 0;
+    vm->gc_prev = NULL;
+    vm->gc_next = L->gc_vms;
+    if (L->gc_vms) L->gc_vms->gc_prev = vm;
+    L->gc_vms = vm;
+    vm->gc_linked = 1;
+    return 1;
+}
+
+static void luby_gc_unlink_vm(luby_state *L, luby_vm *vm) {
+    if (!vm->gc_linked) return;
+    if (vm->gc_prev) vm->gc_prev->gc_next = vm->gc_next;
+    else L->gc_vms = vm->gc_next;
+    if (vm->gc_next) vm->gc_next->gc_prev = vm->gc_prev;
+    vm->gc_prev = vm->gc_next = NULL;
+    vm->gc_linked = 0;
+}
+
+// Root a value held only in a C local. Temporaries are released in bulk
+// when the native call that created them returns (see luby_call_native).
+static int luby_gc_push_temp(luby_state *L, luby_value v) {
+    if (L->gc_temp_count == L->gc_temp_capacity) {
+        size_t new_cap = L->gc_temp_capacity ? L->gc_temp_capacity * 2 : 32;
+        luby_value *nt = (luby_value *)luby_alloc_raw(L, L->gc_temps, new_cap * sizeof(luby_value));
+        if (!nt) return 0;
+        L->gc_temps = nt;
+        L->gc_temp_capacity = new_cap;
     }
+    L->gc_temps[L->gc_temp_count++] = v;
+    return 1;
+}
+
+static int luby_gc_push_temp_ptr(luby_state *L, luby_type type, void *ptr) {
+    luby_value v;
+    v.type = type;
+    v.as.ptr = ptr;
+    return luby_gc_push_temp(L, v);
+}
+
+// Invoke a native function with its arguments rooted, dropping any
+// temporaries it pushed once it returns. Arguments are popped off the VM
+// stack before the call, so without this a collection triggered inside the
+// native (for instance by a block it yields to) could free its receiver.
+static int luby_call_native(luby_state *L, luby_cfunc fn, int argc, const luby_value *argv, luby_value *out) {
+    size_t base = L->gc_temp_count;
+    int rooted = 1;
+    for (int i = 0; i < argc && rooted; i++) rooted = luby_gc_push_temp(L, argv[i]);
+    int was_paused = L->gc_paused;
+    if (!rooted) L->gc_paused = 1;
+    int rc = fn(L, argc, argv, out);
+    L->gc_paused = was_paused;
+    L->gc_temp_count = base;
+    return rc;
 }
 
 // ------------------------------ GC Sweep -----------------------------------
@@ -1296,7 +2029,7 @@ static size_t luby_gc_obj_size(luby_gc_obj *obj) {
         case LUBY_GC_CLASS:
             return sizeof(luby_class_obj);
         case LUBY_GC_OBJECT:
-            return sizeof(luby_object);
+            return sizeof(luby_object) + ((luby_object *)obj)->slot_count * sizeof(luby_value);
         case LUBY_GC_PROC:
             return sizeof(luby_proc);
         case LUBY_GC_RANGE:
@@ -1304,14 +2037,33 @@ static size_t luby_gc_obj_size(luby_gc_obj *obj) {
         case LUBY_GC_COROUTINE:
             return sizeof(luby_coroutine);
         case LUBY_GC_CMETHOD:
-            return sizeof(luby_cmethod);
+            return sizeof(luby_cmethod) + (((luby_cmethod *)obj)->sig ? sizeof(luby_signature) : 0);
         case LUBY_GC_USERDATA:
             return sizeof(luby_userdata);
+        case LUBY_GC_VECTOR:
+            return LUBY_VECTOR_SIZE(((luby_vector *)obj)->kind);
+        case LUBY_GC_BUFFER:
+            return LUBY_BUFFER_SIZE((luby_buffer *)obj);
         default:
             return 0;
     }
 }
 
+static int luby_gc_defer_finalizer(luby_state *L, luby_finalizer fn, void *data, int owned) {
+    if (L->finalizer_count == L->finalizer_capacity) {
+        size_t new_cap = L->finalizer_capacity ? L->finalizer_capacity * 2 : 16;
+        luby_pending_finalizer *nf = (luby_pending_finalizer *)luby_alloc_raw(L, L->finalizers, new_cap * sizeof(luby_pending_finalizer));
+        if (!nf) return 0;
+        L->finalizers = nf;
+        L->finalizer_capacity = new_cap;
+    }
+    luby_pending_finalizer *pf = &L->finalizers[L->finalizer_count++];
+    pf->fn = fn;
+    pf->data = data;
+    pf->owned = owned;
+    return 1;
+}
+
 static void luby_gc_free_obj(luby_state *L, luby_gc_obj *obj) {
     // Decrement memory tracking before freeing
     size_t obj_size = luby_gc_obj_size(obj);
@@ -1326,7 +2078,7 @@ static void luby_gc_free_obj(luby_state *L, luby_gc_obj *obj) {
             break;
         case LUBY_GC_ARRAY: {
             luby_array *arr = (luby_array *)obj;
-            if (arr->items) luby_alloc_raw(L, arr->items, 0);
+            if (arr->items) luby_alloc_raw(L, arr->items - arr->head, 0);
             luby_alloc_raw(L, obj, 0);
             break;
         }
@@ -1348,19 +2100,20 @@ static void luby_gc_free_obj(luby_state *L, luby_gc_obj *obj) {
                 luby_alloc_raw(L, cls->cvar_names, 0);
             }
             if (cls->cvar_values) luby_alloc_raw(L, cls->cvar_values, 0);
+            if (cls->fields) {
+                for (size_t i = 0; i < cls->field_count; i++) luby_alloc_raw(L, cls->fields[i].name, 0);
+                luby_alloc_raw(L, cls->fields, 0);
+            }
+            if (cls->members) luby_alloc_raw(L, (void *)cls->members, 0);
+            L->method_epoch++;  // call caches may still point at its fields or accessors
             // methods, singleton_methods, method_cache, singleton_cache are GC hashes
             luby_alloc_raw(L, obj, 0);
             break;
         }
         case LUBY_GC_OBJECT: {
             luby_object *o = (luby_object *)obj;
-            if (o->ivar_names) {
-                for (size_t i = 0; i < o->ivar_count; i++) {
-                    luby_alloc_raw(L, o->ivar_names[i], 0);
-                }
-                luby_alloc_raw(L, o->ivar_names, 0);
-            }
-            if (o->ivar_values) luby_alloc_raw(L, o->ivar_values, 0);
+            if (o->pooled && luby_pool_recycle(L, o)) break;
+            luby_object_free_ivars(L, o);
             // ivars, singleton_methods are GC hashes
             luby_alloc_raw(L, obj, 0);
             break;
@@ -1385,20 +2138,46 @@ static void luby_gc_free_obj(luby_state *L, luby_gc_obj *obj) {
             break;
         case LUBY_GC_USERDATA: {
             luby_userdata *ud = (luby_userdata *)obj;
+            int data_queued = 0;
             if (ud->alive) {
-                if (ud->finalize) ud->finalize(ud->data);
+                if (ud->finalize) {
+                    if (L->cfg.defer_finalizers && luby_gc_defer_finalizer(L, ud->finalize, ud->data, ud->size > 0)) {
+                        data_queued = ud->size > 0;
+                    } else {
+                        ud->finalize(ud->data);
+                    }
+                }
                 ud->alive = 0;
             }
-            if (ud->size > 0 && ud->data) luby_alloc_raw(L, ud->data, 0);
+            if (ud->size > 0 && ud->data && !data_queued) luby_alloc_raw(L, ud->data, 0);
             luby_alloc_raw(L, obj, 0);
             break;
         }
+        case LUBY_GC_VECTOR: {
+            luby_vector_kind kind = ((luby_vector *)obj)->kind;
+            // One cycle's worth of blocks covers the next cycle's allocations
+            size_t keep = L->gc_threshold < LUBY_VECTOR_FREE_MAX ? L->gc_threshold : LUBY_VECTOR_FREE_MAX;
+            if (L->vector_free_count[kind] < keep) {
+                obj->gc_next = L->vector_free[kind];
+                L->vector_free[kind] = obj;
+                L->vector_free_count[kind]++;
+            } else {
+                luby_alloc_raw(L, obj, 0);
+            }
+            break;
+        }
+        case LUBY_GC_BUFFER:
+            luby_alloc_raw(L, obj, 0);
+            break;
     }
 }
 
-static void luby_gc_sweep(luby_state *L) {
-    luby_gc_obj **p = &L->gc_objects;
-    while (*p) {
+// Visit up to `budget` objects of the pending sweep list, freeing those the
+// last mark did not reach. Once the list is exhausted its survivors are
+// spliced back into gc_objects and the next collection threshold is set.
+static void luby_gc_sweep_step(luby_state *L, size_t budget) {
+    luby_gc_obj **p = L->gc_sweep_cursor;
+    while (*p && budget > 0) {
         if (!(*p)->gc_marked) {
             luby_gc_obj *unreached = *p;
             *p = unreached->gc_next;
@@ -1408,16 +2187,33 @@ static void luby_gc_sweep(luby_state *L) {
             (*p)->gc_marked = 0;
             p = &(*p)->gc_next;
         }
+        budget--;
+    }
+    if (*p) {
+        L->gc_sweep_cursor = p;
+        return;
     }
+    *p = L->gc_objects;
+    L->gc_objects = L->gc_sweep_list;
+    L->gc_sweep_list = NULL;
+    L->gc_sweep_cursor = NULL;
+    // Grow threshold: next collection after at least as many live objects again
+    L->gc_threshold = L->gc_total < LUBY_GC_INITIAL_THRESHOLD ? LUBY_GC_INITIAL_THRESHOLD : L->gc_total * 2;
 }
 
+// Mark, then hand every object allocated so far to the sweeper. With
+// gc_sweep_batch set the sweep is spread over later allocations; objects
+// allocated meanwhile go on a fresh gc_objects list and are not visited.
 static void luby_gc_collect(luby_state *L) {
     if (!L || L->gc_paused) return;
+    if (L->gc_sweep_list) luby_gc_sweep_step(L, (size_t)-1);
     luby_gc_mark_roots(L);
-    luby_gc_sweep(L);
-    // Grow threshold: next collection after at least as many live objects again
-    L->gc_threshold = L->gc_total < LUBY_GC_INITIAL_THRESHOLD ? LUBY_GC_INITIAL_THRESHOLD : L->gc_total * 2;
+    luby_gc_clear_weak_refs(L);
+    L->gc_sweep_list = L->gc_objects;
+    L->gc_sweep_cursor = &L->gc_sweep_list;
+    L->gc_objects = NULL;
     L->gc_alloc_count = 0;
+    luby_gc_sweep_step(L, L->cfg.gc_sweep_batch ? L->cfg.gc_sweep_batch : (size_t)-1);
 }
 
 static void luby_set_error(luby_state *L, luby_error_code code, const char *message, const char *file, int line, int column) {
@@ -1506,6 +2302,8 @@ static luby_value luby_get_global(luby_state *L, luby_string_view name) {
 
 static void luby_set_global(luby_state *L, luby_string_view name, luby_value v) {
     int idx = luby_find_global(L, name);
+    // A global def shadows natives of the same name in cached call sites
+    if (v.type == LUBY_T_PROC || (idx >= 0 && L->global_values[idx].type == LUBY_T_PROC)) L->method_epoch++;
     if (idx >= 0) {
         L->global_values[idx] = v;
         return;
@@ -1531,6 +2329,7 @@ static void luby_remove_global(luby_state *L, luby_string_view name) {
     if (!L) return;
     int idx = luby_find_global(L, name);
     if (idx < 0) return;
+    if (L->global_values[idx].type == LUBY_T_PROC) L->method_epoch++;
     luby_alloc_raw(L, (void *)L->global_names[idx].data, 0);
     for (size_t i = (size_t)idx + 1; i < L->global_count; i++) {
         L->global_names[i - 1] = L->global_names[i];
@@ -1550,6 +2349,16 @@ static int luby_value_eq(luby_value a, luby_value b) {
         case LUBY_T_SYMBOL:
             if (!a.as.ptr || !b.as.ptr) return a.as.ptr == b.as.ptr;
             return strcmp((const char *)a.as.ptr, (const char *)b.as.ptr) == 0;
+        case LUBY_T_VECTOR: {
+            // Values, not identities: same kind and components
+            const luby_vector *va = (const luby_vector *)a.as.ptr, *vb = (const luby_vector *)b.as.ptr;
+            if (va == vb) return 1;
+            if (!va || !vb || va->kind != vb->kind) return 0;
+            for (int i = 0; i < luby_vector_lengths[va->kind]; i++) {
+                if (va->c[i] != vb->c[i]) return 0;
+            }
+            return 1;
+        }
         default: return a.as.ptr == b.as.ptr;
     }
 }
@@ -1562,6 +2371,7 @@ static int luby_value_is_frozen(luby_value v) {
         case LUBY_T_FLOAT:
         case LUBY_T_STRING:
         case LUBY_T_SYMBOL:
+        case LUBY_T_VECTOR:
             return 1;
         case LUBY_T_ARRAY:
             return v.as.ptr ? ((luby_array *)v.as.ptr)->frozen : 0;
@@ -1631,7 +2441,37 @@ static luby_class_obj *luby_class_new(luby_state *L, const char *name, luby_clas
     return cls;
 }
 
+// The class in cls's chain that Struct.new gave members, or NULL
+static const luby_class_obj *luby_struct_layout(const luby_class_obj *cls) {
+    for (; cls; cls = cls->super) {
+        if (cls->member_count) return cls;
+    }
+    return NULL;
+}
+
+// Slot of the member an ivar name ("@x") refers to on a Struct instance, or -1
+static int luby_struct_ivar_slot(const luby_object *obj, const char *name) {
+    const luby_class_obj *layout = luby_struct_layout(obj->klass);
+    if (!layout || name[0] != '@') return -1;
+    for (size_t i = 0; i < layout->member_count && i < obj->slot_count; i++) {
+        if (strcmp(layout->members[i], name + 1) == 0) return (int)i;
+    }
+    return -1;
+}
+
 static luby_object *luby_object_new(luby_state *L, luby_class_obj *cls) {
+    // Struct instances are a single allocation: members live inline and the
+    // ivar and singleton tables are created on demand
+    const luby_class_obj *layout = luby_struct_layout(cls);
+    size_t slots = layout ? layout->member_count : 0;
+    if (slots) {
+        luby_object *obj = (luby_object *)luby_gc_alloc(L, sizeof(luby_object) + slots * sizeof(luby_value), LUBY_GC_OBJECT);
+        if (!obj) return NULL;
+        obj->klass = cls;
+        obj->slots = (luby_value *)(obj + 1);
+        obj->slot_count = slots;
+        return obj;
+    }
     // Pause GC during construction - sub-allocations could trigger collection
     int was_paused = L->gc_paused;
     L->gc_paused = 1;
@@ -1649,45 +2489,253 @@ static luby_object *luby_object_new(luby_state *L, luby_class_obj *cls) {
     return obj;
 }
 
-// Helper: extract the class from any receiver (object, userdata, class, module)
-// Returns NULL if the receiver has no class.
-static luby_class_obj *luby_get_receiver_class(luby_value recv) {
-    switch (recv.type) {
-        case LUBY_T_OBJECT:
-            return recv.as.ptr ? ((luby_object *)recv.as.ptr)->klass : NULL;
-        case LUBY_T_USERDATA:
-            return recv.as.ptr ? ((luby_userdata *)recv.as.ptr)->klass : NULL;
-        case LUBY_T_CLASS:
-        case LUBY_T_MODULE:
-            return (luby_class_obj *)recv.as.ptr;
-        default:
-            return NULL;
+// Instance variables live in parallel name/value arrays; names include the
+// '@'. On Struct instances, a member's ivar name reads and writes its slot.
+static luby_value luby_object_get_ivar(const luby_object *obj, const char *name) {
+    if (obj->slot_count) {
+        int slot = luby_struct_ivar_slot(obj, name);
+        if (slot >= 0) return obj->slots[slot];
     }
+    for (size_t i = 0; i < obj->ivar_count; i++) {
+        if (strcmp(obj->ivar_names[i], name) == 0) return obj->ivar_values[i];
+    }
+    return luby_nil();
 }
 
-// Helper: check if a value type supports class-based method dispatch
-static int luby_has_class_dispatch(luby_value v) {
-    return v.type == LUBY_T_OBJECT || v.type == LUBY_T_USERDATA ||
-           v.type == LUBY_T_CLASS  || v.type == LUBY_T_MODULE;
+// Returns 0 on OOM
+static int luby_object_set_ivar(luby_state *L, luby_object *obj, const char *name, luby_value v) {
+    if (obj->slot_count) {
+        int slot = luby_struct_ivar_slot(obj, name);
+        if (slot >= 0) { obj->slots[slot] = v; return 1; }
+    }
+    for (size_t i = 0; i < obj->ivar_count; i++) {
+        if (strcmp(obj->ivar_names[i], name) == 0) {
+            obj->ivar_values[i] = v;
+            return 1;
+        }
+    }
+    size_t n = obj->ivar_count;
+    char **names = (char **)luby_alloc_raw(L, obj->ivar_names, (n + 1) * sizeof(char *));
+    if (!names) return 0;
+    obj->ivar_names = names;
+    luby_value *values = (luby_value *)luby_alloc_raw(L, obj->ivar_values, (n + 1) * sizeof(luby_value));
+    if (!values) return 0;
+    obj->ivar_values = values;
+    if (!(names[n] = luby_dup_string(L, name, strlen(name)))) return 0;
+    values[n] = v;
+    obj->ivar_count = n + 1;
+    return 1;
 }
 
-static void luby_class_set_method(luby_state *L, luby_class_obj *cls, const char *name, luby_proc *proc) {
-    if (!cls || !name) return;
-    if (cls->frozen) {
-        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
-        return;
+static void luby_object_free_ivars(luby_state *L, luby_object *o) {
+    if (o->ivar_names) {
+        for (size_t i = 0; i < o->ivar_count; i++) {
+            luby_alloc_raw(L, o->ivar_names[i], 0);
+        }
+        luby_alloc_raw(L, o->ivar_names, 0);
     }
-    luby_value key = luby_symbol(L, name, 0);
-    luby_value val; val.type = LUBY_T_PROC; val.as.ptr = proc;
-    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = cls->methods }, key, val);
-    if (L) L->method_epoch++;
+    if (o->ivar_values) luby_alloc_raw(L, o->ivar_values, 0);
 }
 
-static int luby_class_add_include(luby_state *L, luby_class_obj *cls, luby_class_obj *mod) {
-    if (!cls || !mod) return 0;
-    if (cls->frozen) {
-        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
-        return 0;
+// ------------------------------ Object Pools --------------------------------
+//
+// Class#pool(n) keeps up to n instances of a class for reuse. Instances
+// handed back with release wait in pool_items until acquire re-runs their
+// initialize. Instances the collector finds dead leave their memory block on
+// pool_free, up to n blocks, for the next new or acquire. A block keeps its ivar
+// name table with the values reset to nil, so an instance built on it gets
+// the previous shape without reallocating. Pooled instances start without
+// ivar and singleton tables, like Struct instances.
+
+// Root a pooled class. Returns 0 on OOM.
+static int luby_pool_register(luby_state *L, luby_class_obj *cls) {
+    for (size_t i = 0; i < L->pool_class_count; i++) {
+        if (L->pool_classes[i] == cls) return 1;
+    }
+    if (L->pool_class_count == L->pool_class_capacity) {
+        size_t new_cap = L->pool_class_capacity ? L->pool_class_capacity * 2 : 8;
+        luby_class_obj **nc = (luby_class_obj **)luby_alloc_raw(L, L->pool_classes, new_cap * sizeof(luby_class_obj *));
+        if (!nc) return 0;
+        L->pool_classes = nc;
+        L->pool_class_capacity = new_cap;
+    }
+    L->pool_classes[L->pool_class_count++] = cls;
+    return 1;
+}
+
+// Unroot a class whose pool was turned off. Its live instances stop being
+// pooled, so the sweep never reads the class through a dead instance after
+// the class itself is gone.
+static void luby_pool_unregister(luby_state *L, luby_class_obj *cls) {
+    for (size_t i = 0; i < L->pool_class_count; i++) {
+        if (L->pool_classes[i] != cls) continue;
+        L->pool_classes[i] = L->pool_classes[--L->pool_class_count];
+        luby_gc_obj *lists[2] = { L->gc_objects, L->gc_sweep_list };
+        for (int k = 0; k < 2; k++) {
+            for (luby_gc_obj *o = lists[k]; o; o = o->gc_next) {
+                if (o->gc_type == LUBY_GC_OBJECT && ((luby_object *)o)->klass == cls) ((luby_object *)o)->pooled = 0;
+            }
+        }
+        return;
+    }
+}
+
+// Free spare blocks until at most `keep` remain
+static void luby_pool_trim(luby_state *L, luby_class_obj *cls, size_t keep) {
+    while (cls->pool_free_count > keep) {
+        luby_object *o = (luby_object *)cls->pool_free;
+        cls->pool_free = o->gc.gc_next;
+        cls->pool_free_count--;
+        luby_object_free_ivars(L, o);
+        luby_alloc_raw(L, o, 0);
+    }
+}
+
+// Bytes in an instance block of `cls`
+static size_t luby_pool_block_size(const luby_class_obj *cls) {
+    const luby_class_obj *layout = luby_struct_layout(cls);
+    return sizeof(luby_object) + (layout ? layout->member_count : 0) * sizeof(luby_value);
+}
+
+// Keep a collected instance's block for its class. Returns 0 if the pool
+// has no room (or the state is shutting down) and the block must be freed.
+static int luby_pool_recycle(luby_state *L, luby_object *o) {
+    if (!L->pool_classes) return 0;
+    luby_class_obj *cls = o->klass;
+    if (cls->pool_free_count >= cls->pool_capacity) return 0;
+    for (size_t i = 0; i < o->ivar_count; i++) o->ivar_values[i] = luby_nil();
+    o->gc.gc_next = cls->pool_free;
+    cls->pool_free = &o->gc;
+    cls->pool_free_count++;
+    return 1;
+}
+
+// A new instance of pooled class `cls`, on a spare block when there is one
+static luby_object *luby_pool_object_new(luby_state *L, luby_class_obj *cls) {
+    size_t size = luby_pool_block_size(cls);
+    if (!luby_gc_alloc_prepare(L, size)) return NULL;
+    luby_object *obj = (luby_object *)cls->pool_free;
+    char **names = NULL;
+    luby_value *values = NULL;
+    size_t count = 0;
+    if (obj) {
+        cls->pool_free = obj->gc.gc_next;
+        cls->pool_free_count--;
+        names = obj->ivar_names;
+        values = obj->ivar_values;
+        count = obj->ivar_count;
+    } else if (!(obj = (luby_object *)luby_alloc_raw(L, NULL, size))) {
+        return NULL;
+    }
+    memset(obj, 0, size);
+    L->gc_bytes_allocated += size;
+    if (L->gc_bytes_allocated > L->peak_gc_bytes) {
+        L->peak_gc_bytes = L->gc_bytes_allocated;
+    }
+    luby_gc_track(L, &obj->gc, LUBY_GC_OBJECT);
+    obj->klass = cls;
+    obj->ivar_names = names;
+    obj->ivar_values = values;
+    obj->ivar_count = count;
+    obj->pooled = 1;
+    if (size > sizeof(luby_object)) {
+        obj->slots = (luby_value *)(obj + 1);
+        obj->slot_count = (size - sizeof(luby_object)) / sizeof(luby_value);
+    }
+    return obj;
+}
+
+// An instance for Class#acquire: the most recently released one, otherwise
+// a new one. The caller runs initialize.
+static luby_object *luby_pool_acquire(luby_state *L, luby_class_obj *cls) {
+    luby_array *items = cls->pool_items;
+    if (items && items->count) {
+        luby_object *obj = (luby_object *)items->items[--items->count].as.ptr;
+        obj->released = 0;
+        return obj;
+    }
+    return luby_pool_object_new(L, cls);
+}
+
+// Arguments an attr_reader (0) or attr_writer (1) proc takes; -1 for others
+static int luby_accessor_arity(const luby_proc *m) {
+    return m->accessor == LUBY_ACCESSOR_READER ? 0 : m->accessor == LUBY_ACCESSOR_WRITER ? 1 : -1;
+}
+
+// Run an attr_reader/attr_writer proc on an object without a frame. argv
+// excludes the receiver; a writer returns the assigned value.
+static int luby_accessor_call(luby_state *L, const luby_proc *m, luby_object *obj, const luby_value *argv, luby_value *out) {
+    if (m->slot && (size_t)m->slot <= obj->slot_count) {
+        luby_value *slot = &obj->slots[m->slot - 1];
+        if (m->accessor == LUBY_ACCESSOR_WRITER) *slot = argv[0];
+        *out = *slot;
+        return 1;
+    }
+    const char *ivar = (const char *)m->chunk.consts[0].as.ptr;
+    if (m->accessor == LUBY_ACCESSOR_READER) {
+        *out = luby_object_get_ivar(obj, ivar);
+        return 1;
+    }
+    *out = argv[0];
+    return luby_object_set_ivar(L, obj, ivar, argv[0]);
+}
+
+// Helper: extract the class from any receiver (object, userdata, class, module)
+// Returns NULL if the receiver has no class.
+static luby_class_obj *luby_get_receiver_class(luby_value recv) {
+    switch (recv.type) {
+        case LUBY_T_OBJECT:
+            return recv.as.ptr ? ((luby_object *)recv.as.ptr)->klass : NULL;
+        case LUBY_T_USERDATA:
+            return recv.as.ptr ? ((luby_userdata *)recv.as.ptr)->klass : NULL;
+        case LUBY_T_VECTOR:
+            return recv.as.ptr ? ((luby_vector *)recv.as.ptr)->klass : NULL;
+        case LUBY_T_BUFFER:
+            return recv.as.ptr ? ((luby_buffer *)recv.as.ptr)->klass : NULL;
+        case LUBY_T_CLASS:
+        case LUBY_T_MODULE:
+            return (luby_class_obj *)recv.as.ptr;
+        default:
+            return NULL;
+    }
+}
+
+// Helper: check if a value type supports class-based method dispatch
+static int luby_has_class_dispatch(luby_value v) {
+    return v.type == LUBY_T_OBJECT || v.type == LUBY_T_USERDATA ||
+           v.type == LUBY_T_CLASS  || v.type == LUBY_T_MODULE ||
+           v.type == LUBY_T_VECTOR || v.type == LUBY_T_BUFFER;
+}
+
+static void luby_class_set_method(luby_state *L, luby_class_obj *cls, const char *name, luby_proc *proc) {
+    if (!cls || !name) return;
+    if (cls->frozen) {
+        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
+        return;
+    }
+    luby_value key = luby_symbol(L, name, 0);
+    luby_value val; val.type = LUBY_T_PROC; val.as.ptr = proc;
+    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = cls->methods }, key, val);
+    if (L) L->method_epoch++;
+}
+
+// Install a native method directly on a built-in class (no public luby_class handle needed)
+static void luby_class_set_cmethod(luby_state *L, luby_class_obj *cls, const char *name, luby_cfunc fn) {
+    if (!cls || !name || !fn) return;
+    luby_cmethod *cm = (luby_cmethod *)luby_gc_alloc(L, sizeof(luby_cmethod), LUBY_GC_CMETHOD);
+    if (!cm) return;
+    cm->fn = fn;
+    luby_value key = luby_symbol(L, name, 0);
+    luby_value val; val.type = LUBY_T_CMETHOD; val.as.ptr = cm;
+    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = cls->methods }, key, val);
+    if (L) L->method_epoch++;
+}
+
+static int luby_class_add_include(luby_state *L, luby_class_obj *cls, luby_class_obj *mod) {
+    if (!cls || !mod) return 0;
+    if (cls->frozen) {
+        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
+        return 0;
     }
     for (size_t i = 0; i < cls->included_count; i++) {
         if (cls->included_modules[i] == mod) return 1;
@@ -1921,6 +2969,10 @@ static int LUBY_UNUSED luby_call_method_direct(luby_state *L, luby_class_obj *cl
     return luby_call_method(L, cls, name, m, recv, argc, argv, out);
 }
 
+static int luby_call_cmethod(luby_state *L, luby_cmethod *cm, const char *name, luby_value recv, int argc, const luby_value *argv, luby_value *out);
+static const luby_field_slot *luby_field_resolve(luby_state *L, luby_class_obj *cls, const char *fname, int argc);
+static int luby_field_access(luby_state *L, luby_userdata *ud, const luby_field_slot *fs, int argc, luby_value *v);
+
 static int luby_call_method_by_name(luby_state *L, luby_value recv, const char *name, int argc, const luby_value *argv, luby_value *out) {
     if (!L || !name) return (int)LUBY_E_TYPE;
     if (!luby_has_class_dispatch(recv)) return (int)LUBY_E_TYPE;
@@ -1935,6 +2987,17 @@ static int luby_call_method_by_name(luby_state *L, luby_value recv, const char *
     }
     if (!m) m = luby_class_get_method(L, cls, name);
     if (m) return luby_call_method(L, cls, name, m, recv, argc, argv, out);
+    luby_value cm = luby_class_lookup_method(L, cls, name);
+    if (cm.type == LUBY_T_CMETHOD && cm.as.ptr) return luby_call_cmethod(L, (luby_cmethod *)cm.as.ptr, name, recv, argc, argv, out);
+    if (recv.type == LUBY_T_USERDATA && argc <= 1) {
+        const luby_field_slot *fs = luby_field_resolve(L, cls, name, argc + 1);
+        if (fs) {
+            luby_value v = argc == 1 ? argv[0] : luby_nil();
+            int rc = luby_field_access(L, (luby_userdata *)recv.as.ptr, fs, argc + 1, &v);
+            if (rc == 0 && out) *out = v;
+            return rc;
+        }
+    }
 
     luby_proc *mm = luby_class_get_method(L, cls, "method_missing");
     if (mm) {
@@ -1966,11 +3029,16 @@ static int luby_is_truthy(luby_value v) {
     return 1;
 }
 
-static luby_cfunc luby_find_cfunc(luby_state *L, const char *name) {
+static int luby_find_cfunc_index(luby_state *L, const char *name) {
     for (size_t i = 0; i < L->cfuncs.count; i++) {
-        if (luby_cstr_eq(L->cfuncs.names[i], name)) return L->cfuncs.funcs[i];
+        if (luby_cstr_eq(L->cfuncs.names[i], name)) return (int)i;
     }
-    return NULL;
+    return -1;
+}
+
+static luby_cfunc luby_find_cfunc(luby_state *L, const char *name) {
+    int idx = luby_find_cfunc_index(L, name);
+    return idx >= 0 ? L->cfuncs.funcs[idx] : NULL;
 }
 
 static const char *luby_type_name(luby_value v) {
@@ -1992,10 +3060,116 @@ static const char *luby_type_name(luby_value v) {
             if (ud && ud->klass && ud->klass->name) return ud->klass->name;
             return "userdata";
         }
+        case LUBY_T_VECTOR: {
+            static const char *const names[] = { "Vector2", "Vector3", "Quaternion", "Matrix4" };
+            return v.as.ptr ? names[((luby_vector *)v.as.ptr)->kind] : "vector";
+        }
+        case LUBY_T_BUFFER: {
+            static const char *const names[] = { "Float32Array", "Float64Array", "Int32Array" };
+            return v.as.ptr ? names[((luby_buffer *)v.as.ptr)->kind] : "buffer";
+        }
         default: return "unknown";
     }
 }
 
+// ---------------------------- Typed natives --------------------------------
+
+static double luby_to_double(luby_value v);
+
+static const char *const luby_arg_type_names[] = {
+    "any", "int", "float", "number", "string", "symbol", "bool", "array", "hash", "proc", "userdata"
+};
+
+static int luby_sig_valid(const luby_signature *sig) {
+    for (int i = 0; i < LUBY_SIG_MAX_ARGS; i++) {
+        if ((int)sig->args[i] < LUBY_ARG_ANY || sig->args[i] > LUBY_ARG_USERDATA) return 0;
+    }
+    if (sig->block < LUBY_BLOCK_NONE || sig->block > LUBY_BLOCK_REQUIRED) return 0;
+    if (sig->pure && sig->block != LUBY_BLOCK_NONE) return 0;
+    if (sig->num1 && sig->arity != 1) return 0;
+    if (sig->num2 && sig->arity != 2) return 0;
+    return 1;
+}
+
+static int luby_arg_matches(luby_arg_type t, luby_value v) {
+    switch (t) {
+        case LUBY_ARG_INT: return v.type == LUBY_T_INT;
+        case LUBY_ARG_FLOAT: return v.type == LUBY_T_FLOAT;
+        case LUBY_ARG_NUMBER: return v.type == LUBY_T_INT || v.type == LUBY_T_FLOAT;
+        case LUBY_ARG_STRING: return v.type == LUBY_T_STRING;
+        case LUBY_ARG_SYMBOL: return v.type == LUBY_T_SYMBOL;
+        case LUBY_ARG_BOOL: return v.type == LUBY_T_BOOL;
+        case LUBY_ARG_ARRAY: return v.type == LUBY_T_ARRAY;
+        case LUBY_ARG_HASH: return v.type == LUBY_T_HASH;
+        case LUBY_ARG_PROC: return v.type == LUBY_T_PROC;
+        case LUBY_ARG_USERDATA: return v.type == LUBY_T_USERDATA;
+        default: return 1;
+    }
+}
+
+// Check a call (receiver excluded) against a typed native's signature. The
+// error names the native and the offending argument; messages are interned
+// because errors borrow them.
+static int luby_sig_check(luby_state *L, const char *name, const luby_signature *sig, int argc, const luby_value *argv) {
+    char buf[160];
+    if (!name) name = "native";
+    buf[0] = '\0';
+    if (sig->arity >= 0 && argc != sig->arity) {
+        snprintf(buf, sizeof(buf), "%s: wrong number of arguments (given %d, expected %d)", name, argc, sig->arity);
+    } else if (sig->block == LUBY_BLOCK_REQUIRED && L->current_block.type != LUBY_T_PROC) {
+        snprintf(buf, sizeof(buf), "%s: no block given", name);
+    } else {
+        int n = argc < LUBY_SIG_MAX_ARGS ? argc : LUBY_SIG_MAX_ARGS;
+        for (int i = 0; i < n; i++) {
+            if (luby_arg_matches(sig->args[i], argv[i])) continue;
+            snprintf(buf, sizeof(buf), "%s: argument %d must be %s, got %s",
+                     name, i + 1, luby_arg_type_names[sig->args[i]], luby_type_name(argv[i]));
+            break;
+        }
+    }
+    if (!buf[0]) return 0;
+    const char *msg = luby_intern_symbol(L, buf, 0);
+    luby_set_error(L, LUBY_E_TYPE, msg ? msg : "argument type mismatch", NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
+
+// Call registered native `idx`, checked against its signature if it has one
+static int luby_call_registered(luby_state *L, int idx, int argc, const luby_value *argv, luby_value *out) {
+    const luby_signature *sig = L->cfuncs.sigs[idx];
+    if (sig && luby_sig_check(L, L->cfuncs.names[idx], sig, argc, argv) != 0) return (int)LUBY_E_TYPE;
+    return luby_call_native(L, L->cfuncs.funcs[idx], argc, argv, out);
+}
+
+// Call a native method with argv[0] as the receiver, checked against its
+// signature if it has one
+static int luby_call_cmethod_argv(luby_state *L, luby_cmethod *cm, const char *name, int argc, const luby_value *argv, luby_value *out) {
+    if (cm->sig && luby_sig_check(L, name, cm->sig, argc - 1, argv + 1) != 0) return (int)LUBY_E_TYPE;
+    return luby_call_native(L, cm->fn, argc, argv, out);
+}
+
+// "Vector2(1, 2.5)": the type name and components
+static void luby_vector_format(luby_value v, char *buf, size_t size) {
+    const luby_vector *vec = (const luby_vector *)v.as.ptr;
+    size_t len = (size_t)snprintf(buf, size, "%s(", luby_type_name(v));
+    for (int i = 0; vec && i < luby_vector_lengths[vec->kind] && len < size; i++) {
+        len += (size_t)snprintf(buf + len, size - len, i ? ", %g" : "%g", (double)vec->c[i]);
+    }
+    if (len < size) snprintf(buf + len, size - len, ")");
+}
+
+// "Float32Array[1, 2.5, ...]": the type name and the first 16 elements
+static void luby_buffer_format(luby_value v, char *buf, size_t size) {
+    const luby_buffer *b = (const luby_buffer *)v.as.ptr;
+    size_t len = (size_t)snprintf(buf, size, "%s[", luby_type_name(v));
+    size_t shown = b ? (b->length < 16 ? b->length : 16) : 0;
+    for (size_t i = 0; i < shown && len < size; i++) {
+        if (b->kind == LUBY_INT32) len += (size_t)snprintf(buf + len, size - len, i ? ", %lld" : "%lld", (long long)luby_buffer_get(b, i));
+        else len += (size_t)snprintf(buf + len, size - len, i ? ", %g" : "%g", luby_buffer_get(b, i));
+    }
+    if (b && b->length > shown && len < size) len += (size_t)snprintf(buf + len, size - len, ", ...");
+    if (len < size) snprintf(buf + len, size - len, "]");
+}
+
 // Convert a value to a string (for interpolation). Returns allocated string.
 static char *luby_value_to_string(luby_state *L, luby_value v) {
     char buf[128];
@@ -2031,6 +3205,16 @@ static char *luby_value_to_string(luby_state *L, luby_value v) {
             snprintf(buf, sizeof(buf), "#<%s>", luby_type_name(v));
             return luby_dup_string(L, buf, strlen(buf));
         }
+        case LUBY_T_VECTOR: {
+            char vbuf[512];
+            luby_vector_format(v, vbuf, sizeof(vbuf));
+            return luby_dup_string(L, vbuf, strlen(vbuf));
+        }
+        case LUBY_T_BUFFER: {
+            char vbuf[512];
+            luby_buffer_format(v, vbuf, sizeof(vbuf));
+            return luby_dup_string(L, vbuf, strlen(vbuf));
+        }
         default:
             snprintf(buf, sizeof(buf), "#<%s>", luby_type_name(v));
             return luby_dup_string(L, buf, strlen(buf));
@@ -2088,6 +3272,18 @@ static void luby_print_value(luby_value v) {
             else printf("<%s>", luby_type_name(v));
             break;
         }
+        case LUBY_T_VECTOR: {
+            char vbuf[512];
+            luby_vector_format(v, vbuf, sizeof(vbuf));
+            printf("%s", vbuf);
+            break;
+        }
+        case LUBY_T_BUFFER: {
+            char vbuf[512];
+            luby_buffer_format(v, vbuf, sizeof(vbuf));
+            printf("%s", vbuf);
+            break;
+        }
         default:
             printf("<%s>", luby_type_name(v));
             break;
@@ -2096,12 +3292,38 @@ static void luby_print_value(luby_value v) {
 
 // ------------------------------ Lexer Impl --------------------------------
 
+// Character classes for the lexer hot loops, indexed by byte value
+#define LUBY_CC_IDENT_START 0x01  // [A-Za-z_]
+#define LUBY_CC_IDENT       0x02  // [A-Za-z0-9_?!]
+#define LUBY_CC_DIGIT       0x04  // [0-9]
+#define LUBY_CC_BLANK       0x08  // space, tab, carriage return
+#define LUBY_CC_STR_STOP    0x10  // NUL, newline, quotes, '#', backslash
+
+static const unsigned char luby_char_class[256] = {
+    0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x10, 0x00, 0x00, 0x08, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x08, 0x02, 0x10, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03,
+    0x00, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
 static int luby_is_ident_start(int c) {
-    return (c == '_') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    return luby_char_class[(unsigned char)c] & LUBY_CC_IDENT_START;
 }
 
 static int luby_is_ident(int c) {
-    return luby_is_ident_start(c) || (c >= '0' && c <= '9') || c == '?' || c == '!';
+    return luby_char_class[(unsigned char)c] & LUBY_CC_IDENT;
 }
 
 static void luby_lexer_init(luby_lexer *lex, const char *src, size_t len, const char *filename) {
@@ -2144,18 +3366,39 @@ static int luby_lexer_advance(luby_lexer *lex) {
     return (unsigned char)c;
 }
 
+// Advance over a run of bytes that all carry `cls`. None of the classes used
+// here include newline, so the column moves by the run length in one step.
+static void luby_lexer_skip_class(luby_lexer *lex, unsigned char cls) {
+    const unsigned char *s = (const unsigned char *)lex->src;
+    size_t p = lex->pos;
+    while (p < lex->length && (luby_char_class[s[p]] & cls)) p++;
+    lex->column += (int)(p - lex->pos);
+    lex->pos = p;
+}
+
+// Advance over string body bytes that need no special handling, stopping at
+// the next quote, '#', backslash, newline or NUL.
+static void luby_lexer_skip_string_plain(luby_lexer *lex) {
+    const unsigned char *s = (const unsigned char *)lex->src;
+    size_t p = lex->pos;
+    while (p < lex->length && !(luby_char_class[s[p]] & LUBY_CC_STR_STOP)) p++;
+    lex->column += (int)(p - lex->pos);
+    lex->pos = p;
+}
+
 static void luby_lexer_skip_ws(luby_lexer *lex) {
     for (;;) {
         int c = luby_lexer_peek(lex);
-        if (c == ' ' || c == '\t' || c == '\r') {
-            luby_lexer_advance(lex);
+        if (luby_char_class[c] & LUBY_CC_BLANK) {
+            luby_lexer_skip_class(lex, LUBY_CC_BLANK);
             continue;
         }
         if (c == '#') {
-            while (c && c != '\n') {
-                luby_lexer_advance(lex);
-                c = luby_lexer_peek(lex);
-            }
+            // Comment runs to end of line; memchr scans it word-at-a-time
+            const char *nl = (const char *)memchr(lex->src + lex->pos, '\n', lex->length - lex->pos);
+            size_t end = nl ? (size_t)(nl - lex->src) : lex->length;
+            lex->column += (int)(end - lex->pos);
+            lex->pos = end;
             continue;
         }
         break;
@@ -2179,6 +3422,8 @@ static luby_token luby_lexer_continue_interp_string(luby_lexer *lex) {
     const char *start = lex->src + lex->pos;
 
     while (lex->pos < lex->length) {
+        luby_lexer_skip_string_plain(lex);
+        if (lex->pos >= lex->length) break;
         int c = luby_lexer_peek(lex);
         if (c == '\\') {
             luby_lexer_advance(lex);
@@ -2207,6 +3452,109 @@ static luby_token luby_lexer_continue_interp_string(luby_lexer *lex) {
     return luby_make_token(LUBY_TOK_ERROR, start, (size_t)(lex->src + lex->pos - start), line, column);
 }
 
+// Keyword lookup: dispatch on the first character, then compare length
+// before bytes, so most identifiers are rejected after one or two checks.
+static luby_token_kind luby_keyword_kind(const char *s, size_t len) {
+    if (len < 2 || len > 15) return LUBY_TOK_IDENTIFIER;
+    #define LUBY_KW(str, k) if (len == sizeof(str) - 1 && memcmp(s, str, len) == 0) return k
+    switch (s[0]) {
+        case '_':
+            LUBY_KW("__FILE__", LUBY_TOK_FILE);
+            LUBY_KW("__LINE__", LUBY_TOK_LINE);
+            LUBY_KW("__method__", LUBY_TOK_METHOD_NAME);
+            LUBY_KW("__callee__", LUBY_TOK_CALLEE_NAME);
+            break;
+        case 'a':
+            LUBY_KW("and", LUBY_TOK_AND);
+            LUBY_KW("alias", LUBY_TOK_ALIAS);
+            LUBY_KW("attr_reader", LUBY_TOK_ATTR_READER);
+            LUBY_KW("attr_writer", LUBY_TOK_ATTR_WRITER);
+            LUBY_KW("attr_accessor", LUBY_TOK_ATTR_ACCESSOR);
+            break;
+        case 'b':
+            LUBY_KW("begin", LUBY_TOK_BEGIN);
+            LUBY_KW("break", LUBY_TOK_BREAK);
+            break;
+        case 'c':
+            LUBY_KW("class", LUBY_TOK_CLASS);
+            LUBY_KW("case", LUBY_TOK_CASE);
+            break;
+        case 'd':
+            LUBY_KW("def", LUBY_TOK_DEF);
+            LUBY_KW("do", LUBY_TOK_DO);
+            break;
+        case 'e':
+            LUBY_KW("end", LUBY_TOK_END);
+            LUBY_KW("else", LUBY_TOK_ELSE);
+            LUBY_KW("elsif", LUBY_TOK_ELSIF);
+            LUBY_KW("ensure", LUBY_TOK_ENSURE);
+            LUBY_KW("extend", LUBY_TOK_EXTEND);
+            break;
+        case 'f':
+            LUBY_KW("for", LUBY_TOK_FOR);
+            LUBY_KW("false", LUBY_TOK_FALSE);
+            break;
+        case 'i':
+            LUBY_KW("if", LUBY_TOK_IF);
+            LUBY_KW("in", LUBY_TOK_IN);
+            LUBY_KW("include", LUBY_TOK_INCLUDE);
+            break;
+        case 'l':
+            LUBY_KW("loop", LUBY_TOK_LOOP);
+            LUBY_KW("load", LUBY_TOK_LOAD);
+            break;
+        case 'm':
+            LUBY_KW("module", LUBY_TOK_MODULE);
+            LUBY_KW("module_function", LUBY_TOK_MODULE_FUNCTION);
+            break;
+        case 'n':
+            LUBY_KW("nil", LUBY_TOK_NIL);
+            LUBY_KW("not", LUBY_TOK_NOT);
+            LUBY_KW("next", LUBY_TOK_NEXT);
+            break;
+        case 'o':
+            LUBY_KW("or", LUBY_TOK_OR);
+            break;
+        case 'p':
+            LUBY_KW("private", LUBY_TOK_PRIVATE);
+            LUBY_KW("public", LUBY_TOK_PUBLIC);
+            LUBY_KW("protected", LUBY_TOK_PROTECTED);
+            LUBY_KW("prepend", LUBY_TOK_PREPEND);
+            break;
+        case 'r':
+            LUBY_KW("return", LUBY_TOK_RETURN);
+            LUBY_KW("redo", LUBY_TOK_REDO);
+            LUBY_KW("rescue", LUBY_TOK_RESCUE);
+            LUBY_KW("raise", LUBY_TOK_RAISE);
+            LUBY_KW("retry", LUBY_TOK_RETRY);
+            LUBY_KW("require", LUBY_TOK_REQUIRE);
+            break;
+        case 's':
+            LUBY_KW("self", LUBY_TOK_SELF);
+            LUBY_KW("super", LUBY_TOK_SUPER);
+            break;
+        case 't':
+            LUBY_KW("then", LUBY_TOK_THEN);
+            LUBY_KW("true", LUBY_TOK_TRUE);
+            break;
+        case 'u':
+            LUBY_KW("unless", LUBY_TOK_UNLESS);
+            LUBY_KW("until", LUBY_TOK_UNTIL);
+            break;
+        case 'w':
+            LUBY_KW("while", LUBY_TOK_WHILE);
+            LUBY_KW("when", LUBY_TOK_WHEN);
+            break;
+        case 'y':
+            LUBY_KW("yield", LUBY_TOK_YIELD);
+            break;
+        default:
+            break;
+    }
+    #undef LUBY_KW
+    return LUBY_TOK_IDENTIFIER;
+}
+
 static luby_token luby_lexer_next(luby_lexer *lex) {
     // If we're inside an interpolated string and brace depth is 0, we just closed a #{}
     // Continue scanning the rest of the string
@@ -2228,64 +3576,11 @@ static luby_token luby_lexer_next(luby_lexer *lex) {
 
     // Identifiers and keywords
     if (luby_is_ident_start(c)) {
-        while (luby_is_ident(luby_lexer_peek(lex))) luby_lexer_advance(lex);
+        luby_lexer_skip_class(lex, LUBY_CC_IDENT);
         size_t len = (size_t)(lex->src + lex->pos - start);
 
-        // keywords
-        #define LUBY_KW(s, k) if (len == sizeof(s) - 1 && strncmp(start, s, len) == 0) return luby_make_token(k, start, len, line, column)
-        LUBY_KW("class", LUBY_TOK_CLASS);
-        LUBY_KW("module", LUBY_TOK_MODULE);
-        LUBY_KW("def", LUBY_TOK_DEF);
-        LUBY_KW("end", LUBY_TOK_END);
-        LUBY_KW("if", LUBY_TOK_IF);
-        LUBY_KW("elsif", LUBY_TOK_ELSIF);
-        LUBY_KW("else", LUBY_TOK_ELSE);
-        LUBY_KW("unless", LUBY_TOK_UNLESS);
-        LUBY_KW("while", LUBY_TOK_WHILE);
-        LUBY_KW("until", LUBY_TOK_UNTIL);
-        LUBY_KW("loop", LUBY_TOK_LOOP);
-        LUBY_KW("for", LUBY_TOK_FOR);
-        LUBY_KW("in", LUBY_TOK_IN);
-        LUBY_KW("case", LUBY_TOK_CASE);
-        LUBY_KW("when", LUBY_TOK_WHEN);
-        LUBY_KW("then", LUBY_TOK_THEN);
-        LUBY_KW("do", LUBY_TOK_DO);
-        LUBY_KW("yield", LUBY_TOK_YIELD);
-        LUBY_KW("return", LUBY_TOK_RETURN);
-        LUBY_KW("break", LUBY_TOK_BREAK);
-        LUBY_KW("next", LUBY_TOK_NEXT);
-        LUBY_KW("redo", LUBY_TOK_REDO);
-        LUBY_KW("super", LUBY_TOK_SUPER);
-        LUBY_KW("self", LUBY_TOK_SELF);
-        LUBY_KW("true", LUBY_TOK_TRUE);
-        LUBY_KW("false", LUBY_TOK_FALSE);
-        LUBY_KW("nil", LUBY_TOK_NIL);
-        LUBY_KW("and", LUBY_TOK_AND);
-        LUBY_KW("or", LUBY_TOK_OR);
-        LUBY_KW("not", LUBY_TOK_NOT);
-        LUBY_KW("begin", LUBY_TOK_BEGIN);
-        LUBY_KW("rescue", LUBY_TOK_RESCUE);
-        LUBY_KW("ensure", LUBY_TOK_ENSURE);
-        LUBY_KW("raise", LUBY_TOK_RAISE);
-        LUBY_KW("retry", LUBY_TOK_RETRY);
-        LUBY_KW("require", LUBY_TOK_REQUIRE);
-        LUBY_KW("load", LUBY_TOK_LOAD);
-        LUBY_KW("include", LUBY_TOK_INCLUDE);
-        LUBY_KW("prepend", LUBY_TOK_PREPEND);
-        LUBY_KW("extend", LUBY_TOK_EXTEND);
-        LUBY_KW("attr_reader", LUBY_TOK_ATTR_READER);
-        LUBY_KW("attr_writer", LUBY_TOK_ATTR_WRITER);
-        LUBY_KW("attr_accessor", LUBY_TOK_ATTR_ACCESSOR);
-        LUBY_KW("__FILE__", LUBY_TOK_FILE);
-        LUBY_KW("__LINE__", LUBY_TOK_LINE);
-        LUBY_KW("__method__", LUBY_TOK_METHOD_NAME);
-        LUBY_KW("__callee__", LUBY_TOK_CALLEE_NAME);
-        LUBY_KW("private", LUBY_TOK_PRIVATE);
-        LUBY_KW("public", LUBY_TOK_PUBLIC);
-        LUBY_KW("protected", LUBY_TOK_PROTECTED);
-        LUBY_KW("module_function", LUBY_TOK_MODULE_FUNCTION);
-        LUBY_KW("alias", LUBY_TOK_ALIAS);
-        #undef LUBY_KW
+        luby_token_kind kw = luby_keyword_kind(start, len);
+        if (kw != LUBY_TOK_IDENTIFIER) return luby_make_token(kw, start, len, line, column);
 
         if (start[0] >= 'A' && start[0] <= 'Z') {
             return luby_make_token(LUBY_TOK_CONSTANT, start, len, line, column);
@@ -2297,25 +3592,25 @@ static luby_token luby_lexer_next(luby_lexer *lex) {
     if (c == '@') {
         if (luby_lexer_peek(lex) == '@') {
             luby_lexer_advance(lex);
-            while (luby_is_ident(luby_lexer_peek(lex))) luby_lexer_advance(lex);
+            luby_lexer_skip_class(lex, LUBY_CC_IDENT);
             return luby_make_token(LUBY_TOK_CVAR, start, (size_t)(lex->src + lex->pos - start), line, column);
         }
-        while (luby_is_ident(luby_lexer_peek(lex))) luby_lexer_advance(lex);
+        luby_lexer_skip_class(lex, LUBY_CC_IDENT);
         return luby_make_token(LUBY_TOK_IVAR, start, (size_t)(lex->src + lex->pos - start), line, column);
     }
     if (c == '$') {
-        while (luby_is_ident(luby_lexer_peek(lex))) luby_lexer_advance(lex);
+        luby_lexer_skip_class(lex, LUBY_CC_IDENT);
         return luby_make_token(LUBY_TOK_GVAR, start, (size_t)(lex->src + lex->pos - start), line, column);
     }
 
     // Numbers
     if (c >= '0' && c <= '9') {
         int is_float = 0;
-        while (luby_lexer_peek(lex) >= '0' && luby_lexer_peek(lex) <= '9') luby_lexer_advance(lex);
+        luby_lexer_skip_class(lex, LUBY_CC_DIGIT);
         if (luby_lexer_peek(lex) == '.' && luby_lexer_peek_next(lex) >= '0' && luby_lexer_peek_next(lex) <= '9') {
             is_float = 1;
             luby_lexer_advance(lex);
-            while (luby_lexer_peek(lex) >= '0' && luby_lexer_peek(lex) <= '9') luby_lexer_advance(lex);
+            luby_lexer_skip_class(lex, LUBY_CC_DIGIT);
         }
         return luby_make_token(is_float ? LUBY_TOK_FLOAT : LUBY_TOK_INTEGER, start, (size_t)(lex->src + lex->pos - start), line, column);
     }
@@ -2324,7 +3619,9 @@ static luby_token luby_lexer_next(luby_lexer *lex) {
     if (c == '"' || c == '\'') {
         int quote = c;
         int is_double = (quote == '"');
-        while ((c = luby_lexer_peek(lex)) != 0) {
+        for (;;) {
+            luby_lexer_skip_string_plain(lex);
+            if ((c = luby_lexer_peek(lex)) == 0) break;
             if (c == '\\') {
                 luby_lexer_advance(lex);
                 if (luby_lexer_peek(lex)) luby_lexer_advance(lex);
@@ -2352,7 +3649,7 @@ static luby_token luby_lexer_next(luby_lexer *lex) {
     // Symbols
     if (c == ':') {
         if (luby_is_ident_start(luby_lexer_peek(lex))) {
-            while (luby_is_ident(luby_lexer_peek(lex))) luby_lexer_advance(lex);
+            luby_lexer_skip_class(lex, LUBY_CC_IDENT);
             return luby_make_token(LUBY_TOK_SYMBOL, start, (size_t)(lex->src + lex->pos - start), line, column);
         }
         if (luby_lexer_peek(lex) == '"' || luby_lexer_peek(lex) == '\'') {
@@ -2587,7 +3884,54 @@ static luby_ast_node *luby_new_node(luby_state *L, luby_ast_kind kind, int line,
     return node;
 }
 
+// Allocate parser-owned memory (child arrays, synthesized names). Comes from
+// the parse arena when one is active so it dies with the rest of the AST.
+static void *luby_ast_alloc(luby_state *L, size_t size) {
+    if (L->parse_arena) return luby_arena_alloc(L, L->parse_arena, size);
+    return luby_alloc_raw(L, NULL, size);
+}
+
+// Capacity of an AST child list is implied by its count: 0, then powers of
+// two starting at 4. Every list that can grow must be built with this push.
+static size_t luby_ast_list_cap(size_t count) {
+    size_t cap = 4;
+    if (count == 0) return 0;
+    while (cap < count) cap <<= 1;
+    return cap;
+}
+
+// Append to an AST child list with amortized doubling. In arena mode the old
+// array is simply abandoned; the arena reclaims it with the rest of the tree.
+static int luby_ast_list_push(luby_state *L, luby_ast_node ***items, size_t *count, luby_ast_node *item) {
+    size_t n = *count;
+    size_t cap = luby_ast_list_cap(n);
+    if (n == cap) {
+        size_t new_cap = cap ? cap * 2 : 4;
+        luby_ast_node **grown;
+        if (L->parse_arena) {
+            grown = (luby_ast_node **)luby_arena_alloc(L, L->parse_arena, new_cap * sizeof(luby_ast_node *));
+            if (grown && n) memcpy(grown, *items, n * sizeof(luby_ast_node *));
+        } else {
+            grown = (luby_ast_node **)luby_alloc_raw(L, *items, new_cap * sizeof(luby_ast_node *));
+        }
+        if (!grown) return 0;
+        *items = grown;
+    }
+    (*items)[n] = item;
+    *count = n + 1;
+    return 1;
+}
+
 // Deep-copy an AST node and all its children
+static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node);
+
+static int luby_dup_ast_list(luby_state *L, luby_ast_node ***items, size_t *count, luby_ast_node **src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!luby_ast_list_push(L, items, count, luby_dup_ast(L, src[i]))) return 0;
+    }
+    return 1;
+}
+
 static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node) {
     if (!node) return NULL;
     luby_ast_node *copy = luby_new_node(L, node->kind, node->line, node->column);
@@ -2621,13 +3965,9 @@ static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node) {
         case LUBY_AST_HASH:
         case LUBY_AST_BLOCK:
             // List nodes
-            if (node->as.list.count > 0) {
-                copy->as.list.items = (luby_ast_node **)luby_alloc_raw(L, NULL, node->as.list.count * sizeof(luby_ast_node *));
-                if (!copy->as.list.items) { luby_free_node(L, copy); return NULL; }
-                copy->as.list.count = node->as.list.count;
-                for (size_t i = 0; i < node->as.list.count; i++) {
-                    copy->as.list.items[i] = luby_dup_ast(L, node->as.list.items[i]);
-                }
+            if (!luby_dup_ast_list(L, &copy->as.list.items, &copy->as.list.count, node->as.list.items, node->as.list.count)) {
+                luby_free_node(L, copy);
+                return NULL;
             }
             break;
         case LUBY_AST_PAIR:
@@ -2644,20 +3984,8 @@ static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node) {
             copy->as.assign.value = luby_dup_ast(L, node->as.assign.value);
             break;
         case LUBY_AST_MULTI_ASSIGN:
-            if (node->as.multi_assign.target_count > 0) {
-                copy->as.multi_assign.targets = (luby_ast_node **)luby_alloc_raw(L, NULL, node->as.multi_assign.target_count * sizeof(luby_ast_node *));
-                copy->as.multi_assign.target_count = node->as.multi_assign.target_count;
-                for (size_t i = 0; i < node->as.multi_assign.target_count; i++) {
-                    copy->as.multi_assign.targets[i] = luby_dup_ast(L, node->as.multi_assign.targets[i]);
-                }
-            }
-            if (node->as.multi_assign.value_count > 0) {
-                copy->as.multi_assign.values = (luby_ast_node **)luby_alloc_raw(L, NULL, node->as.multi_assign.value_count * sizeof(luby_ast_node *));
-                copy->as.multi_assign.value_count = node->as.multi_assign.value_count;
-                for (size_t i = 0; i < node->as.multi_assign.value_count; i++) {
-                    copy->as.multi_assign.values[i] = luby_dup_ast(L, node->as.multi_assign.values[i]);
-                }
-            }
+            luby_dup_ast_list(L, &copy->as.multi_assign.targets, &copy->as.multi_assign.target_count, node->as.multi_assign.targets, node->as.multi_assign.target_count);
+            luby_dup_ast_list(L, &copy->as.multi_assign.values, &copy->as.multi_assign.value_count, node->as.multi_assign.values, node->as.multi_assign.value_count);
             break;
         case LUBY_AST_INDEX:
             copy->as.index.target = luby_dup_ast(L, node->as.index.target);
@@ -2673,23 +4001,11 @@ static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node) {
             copy->as.call.recv = luby_dup_ast(L, node->as.call.recv);
             copy->as.call.method = node->as.call.method;
             copy->as.call.safe = node->as.call.safe;
-            if (node->as.call.argc > 0) {
-                copy->as.call.args = (luby_ast_node **)luby_alloc_raw(L, NULL, node->as.call.argc * sizeof(luby_ast_node *));
-                copy->as.call.argc = node->as.call.argc;
-                for (size_t i = 0; i < node->as.call.argc; i++) {
-                    copy->as.call.args[i] = luby_dup_ast(L, node->as.call.args[i]);
-                }
-            }
+            luby_dup_ast_list(L, &copy->as.call.args, &copy->as.call.argc, node->as.call.args, node->as.call.argc);
             copy->as.call.block = luby_dup_ast(L, node->as.call.block);
             break;
         case LUBY_AST_LAMBDA:
-            if (node->as.lambda.param_count > 0) {
-                copy->as.lambda.params = (luby_ast_node **)luby_alloc_raw(L, NULL, node->as.lambda.param_count * sizeof(luby_ast_node *));
-                copy->as.lambda.param_count = node->as.lambda.param_count;
-                for (size_t i = 0; i < node->as.lambda.param_count; i++) {
-                    copy->as.lambda.params[i] = luby_dup_ast(L, node->as.lambda.params[i]);
-                }
-            }
+            luby_dup_ast_list(L, &copy->as.lambda.params, &copy->as.lambda.param_count, node->as.lambda.params, node->as.lambda.param_count);
             copy->as.lambda.body = luby_dup_ast(L, node->as.lambda.body);
             break;
         case LUBY_AST_CLASS:
@@ -2704,13 +4020,7 @@ static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node) {
         case LUBY_AST_DEF:
             copy->as.defn.name = node->as.defn.name;
             copy->as.defn.receiver = luby_dup_ast(L, node->as.defn.receiver);
-            if (node->as.defn.param_count > 0) {
-                copy->as.defn.params = (luby_ast_node **)luby_alloc_raw(L, NULL, node->as.defn.param_count * sizeof(luby_ast_node *));
-                copy->as.defn.param_count = node->as.defn.param_count;
-                for (size_t i = 0; i < node->as.defn.param_count; i++) {
-                    copy->as.defn.params[i] = luby_dup_ast(L, node->as.defn.params[i]);
-                }
-            }
+            luby_dup_ast_list(L, &copy->as.defn.params, &copy->as.defn.param_count, node->as.defn.params, node->as.defn.param_count);
             copy->as.defn.body = luby_dup_ast(L, node->as.defn.body);
             break;
         case LUBY_AST_IF:
@@ -2749,9 +4059,8 @@ static luby_ast_node *luby_dup_ast(luby_state *L, luby_ast_node *node) {
 
 static void luby_free_ast(luby_state *L, luby_ast_node *node) {
     if (!node) return;
-    // When using arena, nodes are freed wholesale via luby_arena_free
-    // We still need to free dynamically allocated child arrays though
-    int arena_active = (L->parse_arena != NULL);
+    // Under an arena, nodes and their child arrays go in one luby_arena_free
+    if (L->parse_arena) return;
     
     switch (node->kind) {
         case LUBY_AST_NIL:
@@ -2879,10 +4188,7 @@ static void luby_free_ast(luby_state *L, luby_ast_node *node) {
             luby_free_ast(L, node->as.unary.expr);
             break;
     }
-    // Only free the node itself when NOT using arena
-    if (!arena_active) {
-        luby_alloc_raw(L, node, 0);
-    }
+    luby_alloc_raw(L, node, 0);
 }
 
 static void luby_parser_init(luby_parser *p, const char *code, size_t len, const char *filename, luby_error *error_out) {
@@ -3039,29 +4345,16 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
             luby_ast_node *node = luby_new_node(L, LUBY_AST_INTERP_STRING, tok.line, tok.column);
             if (!node) return NULL;
 
-            // Temporary storage for parts
-            luby_ast_node **parts = NULL;
-            size_t part_count = 0;
-            size_t part_cap = 0;
-
             // First part: the string segment before first #{}
             luby_ast_node *str_part = luby_new_node(L, LUBY_AST_STRING, tok.line, tok.column);
             if (str_part) str_part->as.literal = tok.lexeme;
-            if (part_count >= part_cap) {
-                part_cap = part_cap ? part_cap * 2 : 4;
-                parts = (luby_ast_node **)luby_alloc_raw(L, parts, part_cap * sizeof(luby_ast_node *));
-            }
-            parts[part_count++] = str_part;
+            luby_ast_list_push(L, &node->as.list.items, &node->as.list.count, str_part);
 
             // Now parse: expression, INTERP_END, then either STRING_PART or STRING_END
             for (;;) {
                 // Parse expression inside #{}
                 luby_ast_node *expr = luby_parse_expr(L, p, 0);
-                if (part_count >= part_cap) {
-                    part_cap = part_cap ? part_cap * 2 : 4;
-                    parts = (luby_ast_node **)luby_alloc_raw(L, parts, part_cap * sizeof(luby_ast_node *));
-                }
-                parts[part_count++] = expr;
+                luby_ast_list_push(L, &node->as.list.items, &node->as.list.count, expr);
 
                 // Expect INTERP_END (the closing })
                 if (p->current.kind != LUBY_TOK_INTERP_END) {
@@ -3076,22 +4369,14 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
                     luby_parser_advance(p);
                     str_part = luby_new_node(L, LUBY_AST_STRING, tok.line, tok.column);
                     if (str_part) str_part->as.literal = tok.lexeme;
-                    if (part_count >= part_cap) {
-                        part_cap = part_cap ? part_cap * 2 : 4;
-                        parts = (luby_ast_node **)luby_alloc_raw(L, parts, part_cap * sizeof(luby_ast_node *));
-                    }
-                    parts[part_count++] = str_part;
+                    luby_ast_list_push(L, &node->as.list.items, &node->as.list.count, str_part);
                     // Continue loop to parse next interpolation
                 } else if (p->current.kind == LUBY_TOK_STRING_END) {
                     tok = p->current;
                     luby_parser_advance(p);
                     str_part = luby_new_node(L, LUBY_AST_STRING, tok.line, tok.column);
                     if (str_part) str_part->as.literal = tok.lexeme;
-                    if (part_count >= part_cap) {
-                        part_cap = part_cap ? part_cap * 2 : 4;
-                        parts = (luby_ast_node **)luby_alloc_raw(L, parts, part_cap * sizeof(luby_ast_node *));
-                    }
-                    parts[part_count++] = str_part;
+                    luby_ast_list_push(L, &node->as.list.items, &node->as.list.count, str_part);
                     break; // Done
                 } else {
                     luby_parser_error(p, "expected string continuation after interpolation");
@@ -3099,8 +4384,6 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
                 }
             }
 
-            node->as.list.items = parts;
-            node->as.list.count = part_count;
             return node;
         }
         case LUBY_TOK_SYMBOL: {
@@ -3139,7 +4422,7 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
             if (node) {
                 // __LINE__ returns the current line number as an integer literal
                 // We need to allocate a buffer for the line number string
-                char *buf = (char *)luby_alloc_raw(L, NULL, 32);
+                char *buf = (char *)luby_ast_alloc(L, 32);
                 if (buf) {
                     snprintf(buf, 32, "%d", tok.line);
                     node->as.literal.data = buf;
@@ -3236,11 +4519,7 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
                     luby_parser_advance(p);
                     luby_ast_node *param = luby_new_node(L, LUBY_AST_IDENT, name.line, name.column);
                     if (param) param->as.literal = name.lexeme;
-                    size_t n = params->as.list.count;
-                    params->as.list.items = (luby_ast_node **)luby_alloc_raw(L, params->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-                    if (!params->as.list.items) return NULL;
-                    params->as.list.items[n] = param;
-                    params->as.list.count = n + 1;
+                    if (!luby_ast_list_push(L, &params->as.list.items, &params->as.list.count, param)) return NULL;
                     if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
                 }
                 if (!luby_parser_match(p, LUBY_TOK_RPAREN)) {
@@ -3278,11 +4557,7 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
             if (!arr) return NULL;
             while (p->current.kind != LUBY_TOK_RBRACKET && p->current.kind != LUBY_TOK_EOF) {
                 luby_ast_node *item = luby_parse_expr(L, p, 0);
-                size_t n = arr->as.list.count;
-                arr->as.list.items = (luby_ast_node **)luby_alloc_raw(L, arr->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-                if (!arr->as.list.items) return NULL;
-                arr->as.list.items[n] = item;
-                arr->as.list.count = n + 1;
+                if (!luby_ast_list_push(L, &arr->as.list.items, &arr->as.list.count, item)) return NULL;
                 if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
             }
             if (!luby_parser_match(p, LUBY_TOK_RBRACKET)) {
@@ -3319,11 +4594,7 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
                 if (!pair) return NULL;
                 pair->as.pair.left = key;
                 pair->as.pair.right = value;
-                size_t n = hash->as.list.count;
-                hash->as.list.items = (luby_ast_node **)luby_alloc_raw(L, hash->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-                if (!hash->as.list.items) return NULL;
-                hash->as.list.items[n] = pair;
-                hash->as.list.count = n + 1;
+                if (!luby_ast_list_push(L, &hash->as.list.items, &hash->as.list.count, pair)) return NULL;
                 if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
             }
             if (!luby_parser_match(p, LUBY_TOK_RBRACE)) {
@@ -3339,6 +4610,18 @@ static luby_ast_node *luby_parse_primary(luby_state *L, luby_parser *p) {
 
 static luby_ast_node *luby_parse_postfix(luby_state *L, luby_parser *p, luby_ast_node *left) {
     for (;;) {
+        // Scoped constant (Float::INFINITY): resolves as the qualified global name
+        if (p->current.kind == LUBY_TOK_COLONCOLON && left && left->kind == LUBY_AST_CONST) {
+            luby_parser_advance(p);
+            if (p->current.kind != LUBY_TOK_CONSTANT ||
+                p->current.lexeme.data != left->as.literal.data + left->as.literal.length + 2) {
+                luby_parser_error(p, "expected constant after '::'");
+                return left;
+            }
+            left->as.literal.length += 2 + p->current.lexeme.length;
+            luby_parser_advance(p);
+            continue;
+        }
         if (p->current.kind == LUBY_TOK_DOT || p->current.kind == LUBY_TOK_SAFE_NAV) {
             int safe = (p->current.kind == LUBY_TOK_SAFE_NAV);
             luby_parser_advance(p);
@@ -3545,11 +4828,7 @@ static luby_ast_node *luby_parse_keyword_call(luby_state *L, luby_parser *p, con
     while (p->current.kind != LUBY_TOK_END && p->current.kind != LUBY_TOK_EOF &&
            p->current.kind != LUBY_TOK_SEMI && p->current.kind != LUBY_TOK_NEWLINE) {
         luby_ast_node *arg = luby_parse_expr(L, p, 0);
-        size_t n = call->as.call.argc;
-        call->as.call.args = (luby_ast_node **)luby_alloc_raw(L, call->as.call.args, (n + 1) * sizeof(luby_ast_node *));
-        if (!call->as.call.args) return NULL;
-        call->as.call.args[n] = arg;
-        call->as.call.argc = n + 1;
+        if (!luby_ast_list_push(L, &call->as.call.args, &call->as.call.argc, arg)) return NULL;
         if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
     }
     return call;
@@ -3574,10 +4853,7 @@ static void luby_parse_call_args(luby_state *L, luby_parser *p, luby_ast_node *c
             luby_ast_node *param = luby_new_node(L, LUBY_AST_IDENT, line, col);
             if (!param) return;
             param->as.literal = pname;
-            lambda->as.lambda.params = (luby_ast_node **)luby_alloc_raw(L, NULL, sizeof(luby_ast_node *));
-            if (!lambda->as.lambda.params) return;
-            lambda->as.lambda.params[0] = param;
-            lambda->as.lambda.param_count = 1;
+            if (!luby_ast_list_push(L, &lambda->as.lambda.params, &lambda->as.lambda.param_count, param)) return;
             luby_ast_node *recv = luby_new_node(L, LUBY_AST_IDENT, line, col);
             if (!recv) return;
             recv->as.literal = pname;
@@ -3606,28 +4882,16 @@ static void luby_parse_call_args(luby_state *L, luby_parser *p, luby_ast_node *c
             if (!pair) return;
             pair->as.pair.left = key;
             pair->as.pair.right = value;
-            size_t hn = kwargs_hash->as.list.count;
-            kwargs_hash->as.list.items = (luby_ast_node **)luby_alloc_raw(L, kwargs_hash->as.list.items, (hn + 1) * sizeof(luby_ast_node *));
-            if (!kwargs_hash->as.list.items) return;
-            kwargs_hash->as.list.items[hn] = pair;
-            kwargs_hash->as.list.count = hn + 1;
+            if (!luby_ast_list_push(L, &kwargs_hash->as.list.items, &kwargs_hash->as.list.count, pair)) return;
         } else {
             luby_ast_node *arg = luby_parse_expr(L, p, 0);
-            size_t n = call->as.call.argc;
-            call->as.call.args = (luby_ast_node **)luby_alloc_raw(L, call->as.call.args, (n + 1) * sizeof(luby_ast_node *));
-            if (!call->as.call.args) return;
-            call->as.call.args[n] = arg;
-            call->as.call.argc = n + 1;
+            if (!luby_ast_list_push(L, &call->as.call.args, &call->as.call.argc, arg)) return;
         }
         if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
     }
     // Append kwargs hash as last argument if any keyword args were found
     if (kwargs_hash) {
-        size_t n = call->as.call.argc;
-        call->as.call.args = (luby_ast_node **)luby_alloc_raw(L, call->as.call.args, (n + 1) * sizeof(luby_ast_node *));
-        if (!call->as.call.args) return;
-        call->as.call.args[n] = kwargs_hash;
-        call->as.call.argc = n + 1;
+        if (!luby_ast_list_push(L, &call->as.call.args, &call->as.call.argc, kwargs_hash)) return;
     }
 }
 
@@ -3649,11 +4913,7 @@ static luby_ast_node *luby_parse_block_expr(luby_state *L, luby_parser *p, luby_
             luby_parser_advance(p);
             luby_ast_node *param = luby_new_node(L, LUBY_AST_IDENT, name.line, name.column);
             if (param) param->as.literal = name.lexeme;
-            size_t n = params->as.list.count;
-            params->as.list.items = (luby_ast_node **)luby_alloc_raw(L, params->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-            if (!params->as.list.items) return NULL;
-            params->as.list.items[n] = param;
-            params->as.list.count = n + 1;
+            if (!luby_ast_list_push(L, &params->as.list.items, &params->as.list.count, param)) return NULL;
             if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
         }
         if (!luby_parser_match(p, LUBY_TOK_PIPE)) {
@@ -3738,11 +4998,7 @@ static luby_ast_node *luby_parse_params(luby_state *L, luby_parser *p) {
             break;
         }
         
-        size_t n = params->as.list.count;
-        params->as.list.items = (luby_ast_node **)luby_alloc_raw(L, params->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-        if (!params->as.list.items) return NULL;
-        params->as.list.items[n] = param;
-        params->as.list.count = n + 1;
+        if (!luby_ast_list_push(L, &params->as.list.items, &params->as.list.count, param)) return NULL;
         if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
     }
     return params;
@@ -4001,11 +5257,7 @@ static luby_ast_node *luby_parse_for(luby_state *L, luby_parser *p) {
         luby_parser_advance(p);
         luby_ast_node *param = luby_new_node(L, LUBY_AST_IDENT, name.line, name.column);
         if (param) param->as.literal = name.lexeme;
-        size_t n = params->as.list.count;
-        params->as.list.items = (luby_ast_node **)luby_alloc_raw(L, params->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-        if (!params->as.list.items) return NULL;
-        params->as.list.items[n] = param;
-        params->as.list.count = n + 1;
+        if (!luby_ast_list_push(L, &params->as.list.items, &params->as.list.count, param)) return NULL;
         if (!luby_parser_match(p, LUBY_TOK_COMMA)) break;
     }
     if (params->as.list.count == 0) {
@@ -4132,11 +5384,8 @@ static luby_ast_node *luby_parse_alias(luby_state *L, luby_parser *p) {
     luby_ast_node *call = luby_make_call(L, NULL, method, alias_tok.line, alias_tok.column);
     if (!call) return NULL;
     
-    call->as.call.args = (luby_ast_node **)luby_alloc_raw(L, NULL, 2 * sizeof(luby_ast_node *));
-    if (!call->as.call.args) return NULL;
-    call->as.call.args[0] = new_name;
-    call->as.call.args[1] = old_name;
-    call->as.call.argc = 2;
+    if (!luby_ast_list_push(L, &call->as.call.args, &call->as.call.argc, new_name)) return NULL;
+    if (!luby_ast_list_push(L, &call->as.call.args, &call->as.call.argc, old_name)) return NULL;
     
     return call;
 }
@@ -4322,22 +5571,12 @@ static luby_ast_node *luby_parse_statement(luby_state *L, luby_parser *p) {
                     // Collect targets into a list
                     luby_ast_node **targets = NULL;
                     size_t target_count = 0;
-                    size_t target_cap = 0;
-                    // Add first target
-                    if (target_count + 1 > target_cap) {
-                        target_cap = target_cap < 4 ? 4 : target_cap * 2;
-                        targets = (luby_ast_node **)luby_alloc_raw(L, targets, target_cap * sizeof(luby_ast_node *));
-                    }
-                    targets[target_count++] = expr;
+                    luby_ast_list_push(L, &targets, &target_count, expr);
                     // Parse remaining targets
                     while (p->current.kind == LUBY_TOK_COMMA) {
                         luby_parser_advance(p); // consume ','
                         luby_ast_node *target = luby_parse_expr(L, p, 0);
-                        if (target_count + 1 > target_cap) {
-                            target_cap = target_cap * 2;
-                            targets = (luby_ast_node **)luby_alloc_raw(L, targets, target_cap * sizeof(luby_ast_node *));
-                        }
-                        targets[target_count++] = target;
+                        luby_ast_list_push(L, &targets, &target_count, target);
                     }
                     if (p->current.kind != LUBY_TOK_EQ) {
                         luby_parser_error(p, "expected '=' in multiple assignment");
@@ -4347,18 +5586,11 @@ static luby_ast_node *luby_parse_statement(luby_state *L, luby_parser *p) {
                     // Parse values
                     luby_ast_node **values = NULL;
                     size_t value_count = 0;
-                    size_t value_cap = 0;
-                    luby_ast_node *first_val = luby_parse_expr(L, p, 0);
-                    if (value_cap < 4) { value_cap = 4; values = (luby_ast_node **)luby_alloc_raw(L, values, value_cap * sizeof(luby_ast_node *)); }
-                    values[value_count++] = first_val;
+                    luby_ast_list_push(L, &values, &value_count, luby_parse_expr(L, p, 0));
                     while (p->current.kind == LUBY_TOK_COMMA) {
                         luby_parser_advance(p);
                         luby_ast_node *val = luby_parse_expr(L, p, 0);
-                        if (value_count + 1 > value_cap) {
-                            value_cap = value_cap * 2;
-                            values = (luby_ast_node **)luby_alloc_raw(L, values, value_cap * sizeof(luby_ast_node *));
-                        }
-                        values[value_count++] = val;
+                        luby_ast_list_push(L, &values, &value_count, val);
                     }
                     luby_ast_node *node = luby_new_node(L, LUBY_AST_MULTI_ASSIGN, expr->line, expr->column);
                     if (!node) return NULL;
@@ -4574,7 +5806,7 @@ static luby_ast_node *luby_parse_assignment_from(luby_state *L, luby_parser *p,
     if (lhs->kind == LUBY_AST_CALL && lhs->as.call.recv && lhs->as.call.argc == 0) {
         // Create setter method name: "method="
         size_t mlen = lhs->as.call.method.length;
-        char *setter_name = (char *)luby_alloc_raw(L, NULL, mlen + 2);
+        char *setter_name = (char *)luby_ast_alloc(L, mlen + 2);
         if (setter_name) {
             memcpy(setter_name, lhs->as.call.method.data, mlen);
             setter_name[mlen] = '=';
@@ -4582,9 +5814,7 @@ static luby_ast_node *luby_parse_assignment_from(luby_state *L, luby_parser *p,
             lhs->as.call.method.data = setter_name;
             lhs->as.call.method.length = mlen + 1;
         }
-        lhs->as.call.args = (luby_ast_node **)luby_alloc_raw(L, NULL, sizeof(luby_ast_node *));
-        lhs->as.call.args[0] = rhs;
-        lhs->as.call.argc = 1;
+        luby_ast_list_push(L, &lhs->as.call.args, &lhs->as.call.argc, rhs);
         return lhs;
     }
     luby_parser_error(p, "invalid assignment target");
@@ -4601,11 +5831,7 @@ static luby_ast_node *luby_parse_block_until(luby_state *L, luby_parser *p, luby
         if (p->current.kind == end_kind || p->current.kind == LUBY_TOK_EOF) break;
         luby_ast_node *stmt = luby_parse_statement(L, p);
         if (!stmt) break;
-        size_t n = block->as.list.count;
-        block->as.list.items = (luby_ast_node **)luby_alloc_raw(L, block->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-        if (!block->as.list.items) return NULL;
-        block->as.list.items[n] = stmt;
-        block->as.list.count = n + 1;
+        if (!luby_ast_list_push(L, &block->as.list.items, &block->as.list.count, stmt)) return NULL;
         if (p->current.kind == LUBY_TOK_SEMI || p->current.kind == LUBY_TOK_NEWLINE) {
             luby_parser_advance(p);
         }
@@ -4623,11 +5849,7 @@ static luby_ast_node *luby_parse_block_until_any(luby_state *L, luby_parser *p,
         if (p->current.kind == a || p->current.kind == b || p->current.kind == c || p->current.kind == LUBY_TOK_EOF) break;
         luby_ast_node *stmt = luby_parse_statement(L, p);
         if (!stmt) break;
-        size_t n = block->as.list.count;
-        block->as.list.items = (luby_ast_node **)luby_alloc_raw(L, block->as.list.items, (n + 1) * sizeof(luby_ast_node *));
-        if (!block->as.list.items) return NULL;
-        block->as.list.items[n] = stmt;
-        block->as.list.count = n + 1;
+        if (!luby_ast_list_push(L, &block->as.list.items, &block->as.list.count, stmt)) return NULL;
         if (p->current.kind == LUBY_TOK_SEMI || p->current.kind == LUBY_TOK_NEWLINE) {
             luby_parser_advance(p);
         }
@@ -4695,9 +5917,12 @@ static void luby_chunk_free(luby_state *L, luby_chunk *chunk) {
     if (!chunk) return;
     // String consts are GC-tracked; symbol consts are interned; proc consts are GC-tracked.
     // Only free the infrastructure arrays (code, lines, consts).
-    luby_alloc_raw(L, chunk->code, 0);
-    luby_alloc_raw(L, chunk->lines, 0);
+    if (!chunk->shared) {
+        luby_alloc_raw(L, chunk->code, 0);
+        luby_alloc_raw(L, chunk->lines, 0);
+    }
     luby_alloc_raw(L, chunk->consts, 0);
+    if (chunk->call_cache) luby_alloc_raw(L, chunk->call_cache, 0);
     memset(chunk, 0, sizeof(*chunk));
 }
 
@@ -4807,12 +6032,15 @@ static void luby_vm_init(luby_vm *vm) {
 
 static void luby_vm_free(luby_state *L, luby_vm *vm) {
     if (!vm) return;
+    luby_gc_unlink_vm(L, vm);
     for (int i = vm->frame_count - 1; i >= 0; i--) {
         luby_vm_frame *f = &vm->frames[i];
         if (f->param_existed) luby_alloc_raw(L, f->param_existed, 0);
         if (f->param_saved) luby_alloc_raw(L, f->param_saved, 0);
         if (f->kwarg_existed) luby_alloc_raw(L, f->kwarg_existed, 0);
         if (f->kwarg_saved) luby_alloc_raw(L, f->kwarg_saved, 0);
+        if (f->local_existed) luby_alloc_raw(L, f->local_existed, 0);
+        if (f->local_saved) luby_alloc_raw(L, f->local_saved, 0);
     }
     luby_alloc_raw(L, vm->frames, 0);
     luby_alloc_raw(L, vm->stack, 0);
@@ -5115,8 +6343,157 @@ static void luby_vm_pop_frame(luby_state *L, luby_vm *vm, luby_value ret, int pu
     }
 }
 
+// ---- Struct field bindings ----
+
+// The field `fname` names on userdata of class `cls`: a reader for argc 1,
+// "name=" for argc 2. NULL when no field matches or a method shadows it.
+static const luby_field_slot *luby_field_resolve(luby_state *L, luby_class_obj *cls, const char *fname, int argc) {
+    size_t extra = argc == 2 ? 1 : 0;
+    for (luby_class_obj *c = cls; c; c = c->super) {
+        for (size_t i = 0; i < c->field_count; i++) {
+            const luby_field_slot *fs = &c->fields[i];
+            if (strncmp(fname, fs->name, fs->name_len + extra) != 0 || fname[fs->name_len + extra] != '\0') continue;
+            if (luby_class_lookup_method(L, cls, fname).type != LUBY_T_NIL) return NULL;
+            return fs;
+        }
+    }
+    return NULL;
+}
+
+// The attr_reader (argc 1) or attr_writer (argc 2) proc `fname` names on
+// instances of `cls`, or NULL when it is any other kind of method.
+static const luby_proc *luby_accessor_resolve(luby_state *L, luby_class_obj *cls, const char *fname, int argc) {
+    luby_value mv = luby_class_lookup_method(L, cls, fname);
+    if (mv.type != LUBY_T_PROC || !mv.as.ptr) return NULL;
+    const luby_proc *m = (const luby_proc *)mv.as.ptr;
+    return m->accessor == (argc == 2 ? LUBY_ACCESSOR_WRITER : LUBY_ACCESSOR_READER) ? m : NULL;
+}
+
+// Resolve a receiver through the call site's inline cache. The cache is
+// allocated the first time a site hits a field or accessor, so chunks that
+// never touch either pay nothing. NULL when neither applies.
+static const luby_call_cache *luby_receiver_lookup(luby_state *L, luby_chunk *chunk, size_t ip, luby_class_obj *cls, const char *fname, int argc) {
+    luby_call_cache *cc = chunk->call_cache;
+    if (cc && cc[ip].klass == cls && cc[ip].epoch == L->method_epoch) return &cc[ip];
+    const luby_field_slot *fs = luby_field_resolve(L, cls, fname, argc);
+    const luby_proc *acc = fs ? NULL : luby_accessor_resolve(L, cls, fname, argc);
+    if (!cc) {
+        if (!fs && !acc) return NULL;
+        cc = (luby_call_cache *)luby_alloc_raw(L, NULL, chunk->count * sizeof(luby_call_cache));
+        if (!cc) return NULL;
+        memset(cc, 0, chunk->count * sizeof(luby_call_cache));
+        chunk->call_cache = cc;
+    }
+    cc[ip].klass = cls;
+    cc[ip].field = fs;
+    cc[ip].accessor = acc;
+    cc[ip].epoch = L->method_epoch;
+    return &cc[ip];
+}
+
+// Typed native for a call site with no receiver, through the site's inline
+// cache. Returns 1 + its cfuncs index, or 0 when the call must take the
+// general path: no typed native of that name, a global def of the same name
+// shadowing it, or a method of that name on self's class.
+static size_t luby_native_lookup(luby_state *L, luby_chunk *chunk, size_t ip, luby_class_obj *self_cls, const char *fname) {
+    luby_call_cache *cc = chunk->call_cache;
+    if (cc && cc[ip].native_epoch == L->method_epoch && cc[ip].self_klass == self_cls) return cc[ip].native;
+    size_t native = 0;
+    int idx = luby_find_cfunc_index(L, fname);
+    if (idx >= 0 && L->cfuncs.sigs[idx] && strcmp(fname, "call") != 0) {
+        luby_string_view sv = { fname, strlen(fname) };
+        int shadowed = luby_get_global(L, sv).type == LUBY_T_PROC;
+        if (!shadowed && self_cls) shadowed = luby_class_lookup_method(L, self_cls, fname).type != LUBY_T_NIL;
+        if (!shadowed) native = (size_t)idx + 1;
+    }
+    if (!cc) {
+        cc = (luby_call_cache *)luby_alloc_raw(L, NULL, chunk->count * sizeof(luby_call_cache));
+        if (!cc) return native;
+        memset(cc, 0, chunk->count * sizeof(luby_call_cache));
+        chunk->call_cache = cc;
+    }
+    cc[ip].self_klass = self_cls;
+    cc[ip].native = native;
+    cc[ip].native_epoch = L->method_epoch;
+    return native;
+}
+
+// Load the field into *v (argc 1) or store *v into it (argc 2).
+static int luby_field_access(luby_state *L, luby_userdata *ud, const luby_field_slot *fs, int argc, luby_value *v) {
+    if (!ud->alive || !ud->data) {
+        luby_set_error(L, LUBY_E_RUNTIME, "userdata is no longer valid", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    char *p = (char *)ud->data + fs->offset;
+    if (argc == 1) {
+        switch (fs->type) {
+            case LUBY_FIELD_INT8: { int8_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_INT16: { int16_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_INT32: { int32_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_INT64: { int64_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_UINT8: { uint8_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_UINT16: { uint16_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_UINT32: { uint32_t x; memcpy(&x, p, sizeof(x)); *v = luby_int(x); break; }
+            case LUBY_FIELD_FLOAT: { float x; memcpy(&x, p, sizeof(x)); *v = luby_float(x); break; }
+            case LUBY_FIELD_DOUBLE: { double x; memcpy(&x, p, sizeof(x)); *v = luby_float(x); break; }
+            case LUBY_FIELD_BOOL: *v = luby_bool(*(unsigned char *)p != 0); break;
+        }
+        return 0;
+    }
+    if (fs->readonly) {
+        luby_set_error(L, LUBY_E_RUNTIME, "read-only field", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    if (fs->type == LUBY_FIELD_BOOL) {
+        if (v->type != LUBY_T_BOOL) {
+            luby_set_error(L, LUBY_E_TYPE, "field expects true or false", NULL, 0, 0);
+            return (int)LUBY_E_TYPE;
+        }
+        *(unsigned char *)p = v->as.b ? 1 : 0;
+        return 0;
+    }
+    if (fs->type == LUBY_FIELD_FLOAT || fs->type == LUBY_FIELD_DOUBLE) {
+        double d;
+        if (v->type == LUBY_T_FLOAT) d = v->as.f;
+        else if (v->type == LUBY_T_INT) d = (double)v->as.i;
+        else {
+            luby_set_error(L, LUBY_E_TYPE, "field expects a number", NULL, 0, 0);
+            return (int)LUBY_E_TYPE;
+        }
+        if (fs->type == LUBY_FIELD_FLOAT) { float x = (float)d; memcpy(p, &x, sizeof(x)); }
+        else memcpy(p, &d, sizeof(d));
+        return 0;
+    }
+    if (v->type != LUBY_T_INT) {
+        luby_set_error(L, LUBY_E_TYPE, "field expects an Integer", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    // Integers wrap to the field's width, as a C cast would
+    uint64_t u = (uint64_t)v->as.i;
+    switch (fs->type) {
+        case LUBY_FIELD_INT8: case LUBY_FIELD_UINT8: { uint8_t x = (uint8_t)u; memcpy(p, &x, sizeof(x)); break; }
+        case LUBY_FIELD_INT16: case LUBY_FIELD_UINT16: { uint16_t x = (uint16_t)u; memcpy(p, &x, sizeof(x)); break; }
+        case LUBY_FIELD_INT32: case LUBY_FIELD_UINT32: { uint32_t x = (uint32_t)u; memcpy(p, &x, sizeof(x)); break; }
+        default: memcpy(p, &u, sizeof(u)); break;
+    }
+    // Read back so signed fields report the wrapped value
+    return luby_field_access(L, ud, fs, 1, v);
+}
+
+static int luby_vm_exec(luby_state *L, luby_vm *vm, luby_value *out);
+static int luby_array_difference(luby_state *L, int argc, const luby_value *argv, luby_value *out);
+
+// Run a VM until its frames finish or it yields. The VM is a GC root for
+// the whole run, including while it is suspended in a native call.
 static int luby_vm_run(luby_state *L, luby_vm *vm, luby_value *out) {
     if (!L || !vm) return (int)LUBY_E_RUNTIME;
+    int linked = luby_gc_link_vm(L, vm);
+    int rc = luby_vm_exec(L, vm, out);
+    if (linked) luby_gc_unlink_vm(L, vm);
+    return rc;
+}
+
+static int luby_vm_exec(luby_state *L, luby_vm *vm, luby_value *out) {
     if (vm->resume_pending) {
         if (!luby_vm_ensure_stack(L, vm, 1)) return (int)LUBY_E_OOM;
         vm->stack[vm->sp++] = vm->resume_value;
@@ -5303,7 +6680,7 @@ static int luby_vm_run(luby_state *L, luby_vm *vm, luby_value *out) {
                                 luby_cmethod *cm = (luby_cmethod *)method_val.as.ptr;
                                 luby_value self_args[1] = { L->current_self };
                                 luby_value r = luby_nil();
-                                if (cm->fn(L, 1, self_args, &r) != 0) {
+                                if (luby_call_cmethod_argv(L, cm, name.data, 1, self_args, &r) != 0) {
                                     if (L->last_error.code == LUBY_E_OK) {
                                         luby_set_error(L, LUBY_E_RUNTIME, "native method failed", f->filename, line, 0);
                                     }
@@ -5379,6 +6756,33 @@ static int luby_vm_run(luby_state *L, luby_vm *vm, luby_value *out) {
                         L->gc_paused = was_paused;
                         luby_value rv; rv.type = LUBY_T_ARRAY; rv.as.ptr = ra;
                         vm->stack[vm->sp++] = rv;
+                    } else if (inst.op == LUBY_OP_SUB && a.type == LUBY_T_ARRAY && b.type == LUBY_T_ARRAY) {
+                        // Hashes the elements, which may call user hash/eql?
+                        luby_value args[2] = { a, b };
+                        luby_value rv = luby_nil();
+                        if (luby_call_native(L, luby_array_difference, 2, args, &rv) != 0) {
+                            if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_RUNTIME, "array difference failed", f->filename, line, 0);
+                            goto vm_error;
+                        }
+                        vm->stack[vm->sp++] = rv;
+                    } else if (a.type == LUBY_T_VECTOR || b.type == LUBY_T_VECTOR) {
+                        // Vector math runs inline: no method lookup, no frame
+                        luby_value rv = luby_nil();
+                        if (luby_vector_arith(L, inst.op, a, b, &rv) != 0) {
+                            if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_TYPE, "vector operation failed", f->filename, line, 0);
+                            else if (!L->last_error.file) luby_set_error(L, L->last_error.code, L->last_error.message, f->filename, line, 0);
+                            goto vm_error;
+                        }
+                        vm->stack[vm->sp++] = rv;
+                    } else if (luby_has_class_dispatch(a)) {
+                        /* Object arithmetic: call the receiver's operator method */
+                        static const char *const op_names[] = { "+", "-", "*", "/", "%" };
+                        luby_value rv = luby_nil();
+                        if (luby_invoke_method(L, a, op_names[inst.op - LUBY_OP_ADD], 1, &b, &rv) != 0) {
+                            if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_RUNTIME, "operator failed", f->filename, line, 0);
+                            goto vm_error;
+                        }
+                        vm->stack[vm->sp++] = rv;
                     } else if (a.type == LUBY_T_INT && b.type == LUBY_T_INT) {
                         int64_t r = 0;
                         if (inst.op == LUBY_OP_ADD) r = a.as.i + b.as.i;
@@ -5434,6 +6838,15 @@ static int luby_vm_run(luby_state *L, luby_vm *vm, luby_value *out) {
                     luby_value a = vm->stack[--vm->sp];
                     if (a.type == LUBY_T_INT) vm->stack[vm->sp++] = luby_int(-a.as.i);
                     else if (a.type == LUBY_T_FLOAT) vm->stack[vm->sp++] = luby_float(-a.as.f);
+                    else if (a.type == LUBY_T_VECTOR) {
+                        luby_value rv = luby_nil();
+                        if (luby_vector_arith(L, LUBY_OP_MUL, a, luby_float(-1.0), &rv) != 0) {
+                            if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_TYPE, "vector operation failed", f->filename, line, 0);
+                            else if (!L->last_error.file) luby_set_error(L, L->last_error.code, L->last_error.message, f->filename, line, 0);
+                            goto vm_error;
+                        }
+                        vm->stack[vm->sp++] = rv;
+                    }
                     else vm->stack[vm->sp++] = luby_nil();
                     break;
                 }
@@ -5455,6 +6868,8 @@ static int luby_vm_run(luby_state *L, luby_vm *vm, luby_value *out) {
                                 if (rng->exclusive) e--;
                                 res = (a.as.i >= s && a.as.i <= e);
                             }
+                        } else if (a.type == LUBY_T_VECTOR) {
+                            res = luby_value_eq(a, b);
                         } else if (luby_has_class_dispatch(a)) {
                             /* Object ==: try == method, fallback to identity */
                             luby_value eq_result = luby_nil();
@@ -5623,16 +7038,11 @@ static int luby_vm_run(luby_state *L, luby_vm *vm, luby_value *out) {
                         if (arr->frozen) { luby_set_error(L, LUBY_E_RUNTIME, "frozen", f->filename, line, 0); goto vm_error; }
                         int64_t idx = index.as.i;
                         if (idx >= 0) {
-                            if ((size_t)idx >= arr->capacity) {
-                                size_t new_cap = arr->capacity < 8 ? 8 : arr->capacity;
-                                while ((size_t)idx >= new_cap) new_cap *= 2;
-                                luby_value *ni = (luby_value *)luby_alloc_raw(L, arr->items, new_cap * sizeof(luby_value));
-                                if (!ni) { luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
-                                for (size_t i = arr->capacity; i < new_cap; i++) ni[i] = luby_nil();
-                                arr->items = ni;
-                                arr->capacity = new_cap;
+                            if ((size_t)idx >= arr->count) {
+                                if (!luby_array_reserve(L, arr, (size_t)idx + 1)) { luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
+                                for (size_t i = arr->count; i < (size_t)idx; i++) arr->items[i] = luby_nil();
+                                arr->count = (size_t)idx + 1;
                             }
-                            if ((size_t)idx >= arr->count) arr->count = (size_t)idx + 1;
                             arr->items[idx] = value;
                         }
                     } else if (target.type == LUBY_T_HASH && target.as.ptr) {
@@ -5673,12 +7083,99 @@ set_index_done:
                     if (vm->sp - f->stack_base < argc) { luby_set_error(L, LUBY_E_RUNTIME, "stack underflow", f->filename, line, 0); goto vm_error; }
                     luby_value sym = chunk->consts[inst.c];
                     const char *fname = (const char *)sym.as.ptr;
-                    luby_cfunc fn = luby_find_cfunc(L, fname);
-                    luby_value r = luby_nil();
-                    luby_value args[16];
-                    int use = argc > 16 ? 16 : argc;
-                    for (int i = 0; i < use; i++) {
-                        args[use - 1 - i] = vm->stack[--vm->sp];
+                    // Bound struct fields: load or store in place, no native call
+                    if ((argc == 1 || argc == 2) && fname && vm->stack[vm->sp - argc].type == LUBY_T_USERDATA) {
+                        luby_userdata *ud = (luby_userdata *)vm->stack[vm->sp - argc].as.ptr;
+                        const luby_call_cache *site = ud && ud->klass ? luby_receiver_lookup(L, chunk, f->ip, ud->klass, fname, argc) : NULL;
+                        const luby_field_slot *fs = site ? site->field : NULL;
+                        if (fs) {
+                            luby_value *slot = &vm->stack[vm->sp - 1];
+                            if (luby_field_access(L, ud, fs, argc, slot) != 0) {
+                                luby_set_error(L, L->last_error.code, L->last_error.message, f->filename, line, 0);
+                                goto vm_error;
+                            }
+                            vm->stack[vm->sp - argc] = *slot;
+                            vm->sp -= argc - 1;
+                            L->current_block = L->saved_block_for_call;
+                            break;
+                        }
+                    }
+                    // attr accessors: read or write the ivar, no frame. Objects
+                    // with singleton methods take the general path below.
+                    if ((argc == 1 || argc == 2) && inst.b && fname && vm->stack[vm->sp - argc].type == LUBY_T_OBJECT) {
+                        luby_object *obj = (luby_object *)vm->stack[vm->sp - argc].as.ptr;
+                        const luby_call_cache *site = obj && obj->klass && (!obj->singleton_methods || obj->singleton_methods->count == 0)
+                            ? luby_receiver_lookup(L, chunk, f->ip, obj->klass, fname, argc) : NULL;
+                        if (site && site->accessor) {
+                            luby_value r;
+                            if (!luby_accessor_call(L, site->accessor, obj, &vm->stack[vm->sp - 1], &r)) {
+                                luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0);
+                                goto vm_error;
+                            }
+                            vm->sp -= argc;
+                            vm->stack[vm->sp++] = r;
+                            L->current_block = L->saved_block_for_call;
+                            break;
+                        }
+                    }
+                    // Typed natives: checked in place on the stack and, once
+                    // the site is cached, called without a lookup by name
+                    if (!inst.b && fname && (argc == 0 || !luby_has_class_dispatch(vm->stack[vm->sp - argc]))) {
+                        luby_class_obj *self_cls = luby_has_class_dispatch(L->current_self) ? luby_get_receiver_class(L->current_self) : NULL;
+                        size_t native = luby_native_lookup(L, chunk, f->ip, self_cls, fname);
+                        if (native) {
+                            const luby_signature *sig = L->cfuncs.sigs[native - 1];
+                            luby_cfunc nfn = L->cfuncs.funcs[native - 1];
+                            luby_value *argv = &vm->stack[vm->sp - argc];
+                            luby_value r = luby_nil();
+                            if (luby_sig_check(L, fname, sig, argc, argv) != 0) {
+                                luby_set_error(L, L->last_error.code, L->last_error.message, f->filename, line, 0);
+                                goto vm_error;
+                            }
+                            // Unboxed entry points take doubles straight off the stack
+                            if (sig->num1 && (argv[0].type == LUBY_T_INT || argv[0].type == LUBY_T_FLOAT)) {
+                                r = luby_float(sig->num1(luby_to_double(argv[0])));
+                            } else if (sig->num2 && (argv[0].type == LUBY_T_INT || argv[0].type == LUBY_T_FLOAT) &&
+                                       (argv[1].type == LUBY_T_INT || argv[1].type == LUBY_T_FLOAT)) {
+                                r = luby_float(sig->num2(luby_to_double(argv[0]), luby_to_double(argv[1])));
+                            } else if (sig->pure) {
+                                // Pure natives never re-enter the VM, so the stack
+                                // slots stay put and keep the arguments rooted
+                                if (nfn(L, argc, argv, &r) != 0) {
+                                    if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_RUNTIME, "native call failed", f->filename, line, 0);
+                                    goto vm_error;
+                                }
+                            } else {
+                                luby_value nargs[16];
+                                int n = argc > 16 ? 16 : argc;
+                                for (int i = 0; i < n; i++) nargs[i] = argv[i];
+                                vm->sp -= argc;
+                                if (luby_call_native(L, nfn, n, nargs, &r) != 0) {
+                                    if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_RUNTIME, "native call failed", f->filename, line, 0);
+                                    goto vm_error;
+                                }
+                                if (vm->native_yield) {
+                                    vm->native_yield = 0;
+                                    f->ip++;
+                                    if (out) *out = vm->yield_value;
+                                    L->current_vm = saved_vm;
+                                    return (int)LUBY_E_OK;
+                                }
+                                argc = 0;
+                            }
+                            vm->sp -= argc;
+                            L->current_block = L->saved_block_for_call;
+                            vm->stack[vm->sp++] = r;
+                            break;
+                        }
+                    }
+                    int fidx = luby_find_cfunc_index(L, fname);
+                    luby_cfunc fn = fidx >= 0 ? L->cfuncs.funcs[fidx] : NULL;
+                    luby_value r = luby_nil();
+                    luby_value args[16];
+                    int use = argc > 16 ? 16 : argc;
+                    for (int i = 0; i < use; i++) {
+                        args[use - 1 - i] = vm->stack[--vm->sp];
                     }
                     if (argc > use) {
                         for (int i = use; i < argc; i++) (void)vm->stack[--vm->sp];
@@ -5730,12 +7227,14 @@ set_index_done:
                             }
                             goto vm_next_frame;
                         }
-                        if ((recv.type == LUBY_T_OBJECT || recv.type == LUBY_T_CLASS || recv.type == LUBY_T_MODULE || recv.type == LUBY_T_USERDATA) && fname) {
+                        if ((recv.type == LUBY_T_OBJECT || recv.type == LUBY_T_CLASS || recv.type == LUBY_T_MODULE || recv.type == LUBY_T_USERDATA || recv.type == LUBY_T_VECTOR || recv.type == LUBY_T_BUFFER) && fname) {
                             luby_class_obj *cls = luby_get_receiver_class(recv);
 
-                            if (cls && strcmp(fname, "new") == 0 && recv.type == LUBY_T_CLASS) {
+                            // Class#acquire on a pooled class constructs like new
+                            int acquire = cls && recv.type == LUBY_T_CLASS && cls->pool_capacity && strcmp(fname, "acquire") == 0;
+                            if (cls && (acquire || strcmp(fname, "new") == 0) && recv.type == LUBY_T_CLASS) {
                                 /* Check for singleton or cmethod override of 'new' (e.g., Struct.new) */
-                                luby_proc *new_sp = luby_class_get_singleton_method(L, cls, "new");
+                                luby_proc *new_sp = acquire ? NULL : luby_class_get_singleton_method(L, cls, "new");
                                 if (new_sp) {
                                     luby_value block = L->current_block;
                                     L->current_block = L->saved_block_for_call;
@@ -5748,10 +7247,10 @@ set_index_done:
                                     }
                                     goto vm_next_frame;
                                 }
-                                luby_value new_cm = luby_class_lookup_method(L, cls, "new");
+                                luby_value new_cm = acquire ? luby_nil() : luby_class_lookup_method(L, cls, "new");
                                 if (new_cm.type == LUBY_T_CMETHOD) {
                                     luby_cmethod *cm = (luby_cmethod *)new_cm.as.ptr;
-                                    if (cm->fn(L, use, args, &r) != 0) {
+                                    if (luby_call_cmethod_argv(L, cm, fname, use, args, &r) != 0) {
                                         if (L->last_error.code == LUBY_E_OK)
                                             luby_set_error(L, LUBY_E_RUNTIME, "native method failed", f->filename, line, 0);
                                         goto vm_error;
@@ -5760,11 +7259,19 @@ set_index_done:
                                     vm->stack[vm->sp++] = r;
                                     break;
                                 }
-                                luby_object *obj = luby_object_new(L, cls);
+                                luby_object *obj = acquire ? luby_pool_acquire(L, cls)
+                                                 : cls->pool_capacity ? luby_pool_object_new(L, cls) : luby_object_new(L, cls);
                                 if (!obj) { if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
                                 r.type = LUBY_T_OBJECT; r.as.ptr = obj;
                                 // Check for initialize method and call it
                                 luby_proc *init = luby_class_get_method(L, cls, "initialize");
+                                if (init && init->accessor == LUBY_ACCESSOR_INIT && obj->slot_count) {
+                                    // Struct initialize: fill the slots in place, no frame
+                                    for (int i = 1; i < use && (size_t)i <= obj->slot_count; i++) obj->slots[i - 1] = args[i];
+                                    L->current_block = L->saved_block_for_call;
+                                    vm->stack[vm->sp++] = r;
+                                    break;
+                                }
                                 if (init) {
                                     luby_value block = L->current_block;
                                     L->current_block = L->saved_block_for_call;
@@ -5802,6 +7309,16 @@ set_index_done:
                                 if (method_val.type == LUBY_T_NIL) method_val = luby_class_lookup_method(L, cls, fname);
                                 if (method_val.type == LUBY_T_PROC) {
                                     luby_proc *m = (luby_proc *)method_val.as.ptr;
+                                    // attr_reader/attr_writer: load or store the ivar, no frame
+                                    if (recv.type == LUBY_T_OBJECT && recv.as.ptr && luby_accessor_arity(m) == use - 1) {
+                                        if (!luby_accessor_call(L, m, (luby_object *)recv.as.ptr, args + 1, &r)) {
+                                            luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0);
+                                            goto vm_error;
+                                        }
+                                        L->current_block = L->saved_block_for_call;
+                                        vm->stack[vm->sp++] = r;
+                                        break;
+                                    }
                                     luby_value block = L->current_block;
                                     L->current_block = L->saved_block_for_call;
                                     f->ip++;
@@ -5814,7 +7331,7 @@ set_index_done:
                                     goto vm_next_frame;
                                 } else if (method_val.type == LUBY_T_CMETHOD) {
                                     luby_cmethod *cm = (luby_cmethod *)method_val.as.ptr;
-                                    if (cm->fn(L, use, args, &r) != 0) {
+                                    if (luby_call_cmethod_argv(L, cm, fname, use, args, &r) != 0) {
                                         L->current_block = L->saved_block_for_call;
                                         if (L->last_error.code == LUBY_E_OK) {
                                             luby_set_error(L, LUBY_E_RUNTIME, "native method failed", f->filename, line, 0);
@@ -5872,7 +7389,7 @@ set_index_done:
                                         }
                                         goto vm_next_frame;
                                     } else if (fn) {
-                                        if (fn(L, use, args, &r) != 0) {
+                                        if (luby_call_registered(L, fidx, use, args, &r) != 0) {
                                             if (L->last_error.code == LUBY_E_OK) {
                                                 luby_set_error(L, LUBY_E_RUNTIME, "native call failed", f->filename, line, 0);
                                             }
@@ -5948,12 +7465,21 @@ set_index_done:
 
                     /* Implicit self: if we're inside a method and have no receiver,
                        try to call the method on self */
-                    if (fname && luby_has_class_dispatch(L->current_self)) {
+                    if (fname && !inst.b && luby_has_class_dispatch(L->current_self)) {
                         luby_class_obj *cls = luby_get_receiver_class(L->current_self);
                         if (cls) {
                             luby_value method_val = luby_class_lookup_method(L, cls, fname);
                             if (method_val.type == LUBY_T_PROC) {
                                 luby_proc *m = (luby_proc *)method_val.as.ptr;
+                                if (L->current_self.type == LUBY_T_OBJECT && L->current_self.as.ptr && luby_accessor_arity(m) == use) {
+                                    if (!luby_accessor_call(L, m, (luby_object *)L->current_self.as.ptr, args, &r)) {
+                                        luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0);
+                                        goto vm_error;
+                                    }
+                                    L->current_block = L->saved_block_for_call;
+                                    vm->stack[vm->sp++] = r;
+                                    break;
+                                }
                                 luby_value block = L->current_block;
                                 L->current_block = L->saved_block_for_call;
                                 f->ip++;
@@ -5974,7 +7500,7 @@ set_index_done:
                                 for (int i = 0; i < use && i < 15; i++) {
                                     self_args[i + 1] = args[i];
                                 }
-                                if (cm->fn(L, self_argc, self_args, &r) != 0) {
+                                if (luby_call_cmethod_argv(L, cm, fname, self_argc, self_args, &r) != 0) {
                                     L->current_block = L->saved_block_for_call;
                                     if (L->last_error.code == LUBY_E_OK) {
                                         luby_set_error(L, LUBY_E_RUNTIME, "native method failed", f->filename, line, 0);
@@ -5999,7 +7525,7 @@ set_index_done:
                         luby_set_error(L, LUBY_E_NAME, "undefined function", f->filename, line, 0);
                         goto vm_error;
                     } else {
-                        if (fn(L, use, args, &r) != 0) {
+                        if (luby_call_registered(L, fidx, use, args, &r) != 0) {
                             if (L->last_error.code == LUBY_E_OK) {
                                 luby_set_error(L, LUBY_E_RUNTIME, "native call failed", f->filename, line, 0);
                             }
@@ -6225,14 +7751,7 @@ set_index_done:
                     luby_object *obj = (luby_object *)self_val.as.ptr;
                     luby_value namev = chunk->consts[inst.c];
                     const char *name = (namev.type == LUBY_T_SYMBOL || namev.type == LUBY_T_STRING) ? (const char *)namev.as.ptr : "";
-                    // Search for ivar
-                    luby_value result = luby_nil();
-                    for (size_t i = 0; i < obj->ivar_count; i++) {
-                        if (strcmp(obj->ivar_names[i], name) == 0) {
-                            result = obj->ivar_values[i];
-                            break;
-                        }
-                    }
+                    luby_value result = luby_object_get_ivar(obj, name);
                     if (!luby_vm_ensure_stack(L, vm, 1)) { luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
                     vm->stack[vm->sp++] = result;
                     break;
@@ -6249,25 +7768,7 @@ set_index_done:
                     luby_object *obj = (luby_object *)self_val.as.ptr;
                     luby_value namev = chunk->consts[inst.c];
                     const char *name = (namev.type == LUBY_T_SYMBOL || namev.type == LUBY_T_STRING) ? (const char *)namev.as.ptr : "";
-                    // Search for existing ivar
-                    int found = 0;
-                    for (size_t i = 0; i < obj->ivar_count; i++) {
-                        if (strcmp(obj->ivar_names[i], name) == 0) {
-                            obj->ivar_values[i] = val;
-                            found = 1;
-                            break;
-                        }
-                    }
-                    if (!found) {
-                        // Add new ivar
-                        size_t n = obj->ivar_count;
-                        obj->ivar_names = (char **)luby_alloc_raw(L, obj->ivar_names, (n + 1) * sizeof(char *));
-                        obj->ivar_values = (luby_value *)luby_alloc_raw(L, obj->ivar_values, (n + 1) * sizeof(luby_value));
-                        if (!obj->ivar_names || !obj->ivar_values) { luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
-                        obj->ivar_names[n] = luby_dup_string(L, name, strlen(name));
-                        obj->ivar_values[n] = val;
-                        obj->ivar_count = n + 1;
-                    }
+                    if (!luby_object_set_ivar(L, obj, name, val)) { luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
                     break;
                 }
                 case LUBY_OP_GET_CVAR: {
@@ -6395,6 +7896,17 @@ set_index_done:
                             }
                             break;
                         }
+                        if (single.type == LUBY_T_VECTOR && single.as.ptr) {
+                            // x, y = vec: the components, as floats
+                            const luby_vector *vec = (const luby_vector *)single.as.ptr;
+                            size_t n = (size_t)luby_vector_lengths[vec->kind];
+                            vm->sp--;
+                            if (!luby_vm_ensure_stack(L, vm, target_count)) { luby_set_error(L, LUBY_E_OOM, "oom", f->filename, line, 0); goto vm_error; }
+                            for (size_t i = 0; i < target_count; i++) {
+                                vm->stack[vm->sp++] = i < n ? luby_float((double)vec->c[i]) : luby_nil();
+                            }
+                            break;
+                        }
                     }
                     // Otherwise, ensure we have enough values (pad with nil if needed)
                     if (value_count < target_count) {
@@ -6908,7 +8420,9 @@ static int luby_compile_call(luby_compiler *C, luby_ast_node *node) {
     }
     luby_value sym = luby_symbol(C->L, node->as.call.method.data, node->as.call.method.length);
     uint32_t midx = luby_chunk_add_const(C->L, C->chunk, sym);
-    luby_chunk_emit(C->L, C->chunk, node->as.call.safe ? LUBY_OP_SAFE_CALL : LUBY_OP_CALL, (uint8_t)argc, 0, midx, node->line);
+    /* b=1 marks an explicit receiver so the VM never retries the call on implicit self */
+    luby_chunk_emit(C->L, C->chunk, node->as.call.safe ? LUBY_OP_SAFE_CALL : LUBY_OP_CALL, (uint8_t)argc,
+                    node->as.call.recv ? 1 : 0, midx, node->line);
     return 1;
 }
 
@@ -6981,6 +8495,24 @@ static int luby_compile_node(luby_compiler *C, luby_ast_node *node) {
                 uint8_t ci = luby_chunk_add_const(C->L, C->chunk, luby_symbol(C->L, "<=>", 0));
                 { luby_value pv = luby_nil(); uint32_t bpi = luby_chunk_add_const(C->L, C->chunk, pv); luby_chunk_emit(C->L, C->chunk, LUBY_OP_SET_BLOCK, 0, 0, bpi, node->line); }
                 luby_chunk_emit(C->L, C->chunk, LUBY_OP_CALL, 2, 0, ci, node->line);
+            } else if (node->as.binary.op == LUBY_TOK_SHL || node->as.binary.op == LUBY_TOK_SHR ||
+                       node->as.binary.op == LUBY_TOK_AMP || node->as.binary.op == LUBY_TOK_PIPE ||
+                       node->as.binary.op == LUBY_TOK_CARET) {
+                // Shifts and bitwise operators dispatch like methods (Array#<<, Array#&,
+                // Integer bit operations, user-defined operators)
+                if (!luby_compile_node(C, node->as.binary.left)) return 0;
+                if (!luby_compile_node(C, node->as.binary.right)) return 0;
+                const char *mname;
+                switch (node->as.binary.op) {
+                    case LUBY_TOK_SHL: mname = "<<"; break;
+                    case LUBY_TOK_SHR: mname = ">>"; break;
+                    case LUBY_TOK_AMP: mname = "&"; break;
+                    case LUBY_TOK_PIPE: mname = "|"; break;
+                    default: mname = "^"; break;
+                }
+                uint32_t ci = luby_chunk_add_const(C->L, C->chunk, luby_symbol(C->L, mname, 0));
+                { luby_value pv = luby_nil(); uint32_t bpi = luby_chunk_add_const(C->L, C->chunk, pv); luby_chunk_emit(C->L, C->chunk, LUBY_OP_SET_BLOCK, 0, 0, bpi, node->line); }
+                luby_chunk_emit(C->L, C->chunk, LUBY_OP_CALL, 2, 1, ci, node->line);
             } else if (!luby_compile_node(C, node->as.binary.left) || !luby_compile_node(C, node->as.binary.right)) {
                 return 0;
             } else if (node->as.binary.op == LUBY_TOK_NEQ) {
@@ -7422,16 +8954,42 @@ LUBY_API luby_state *luby_new(const luby_config *cfg) {
 
 LUBY_API void luby_free(luby_state *L) {
     if (!L) return;
+    while (L->method_refs) luby_method_ref_free(L, L->method_refs);
+    // Spare pool blocks first; with no pooled classes left, the sweep below
+    // frees instances of formerly pooled classes outright
+    for (size_t i = 0; i < L->pool_class_count; i++) luby_pool_trim(L, L->pool_classes[i], 0);
+    luby_alloc_raw(L, L->pool_classes, 0);
+    L->pool_classes = NULL;
+    L->pool_class_count = L->pool_class_capacity = 0;
     // Free all GC-tracked objects (mark nothing, sweep everything)
     L->gc_paused = 1;
-    luby_gc_obj *obj = L->gc_objects;
-    while (obj) {
-        luby_gc_obj *next = obj->gc_next;
-        luby_gc_free_obj(L, obj);
-        obj = next;
+    luby_gc_obj *lists[2] = { L->gc_objects, L->gc_sweep_list };
+    for (int i = 0; i < 2; i++) {
+        luby_gc_obj *obj = lists[i];
+        while (obj) {
+            luby_gc_obj *next = obj->gc_next;
+            luby_gc_free_obj(L, obj);
+            obj = next;
+        }
     }
     L->gc_objects = NULL;
+    L->gc_sweep_list = NULL;
     L->gc_total = 0;
+    for (int i = 0; i < 4; i++) {
+        while (L->vector_free[i]) {
+            luby_gc_obj *next = L->vector_free[i]->gc_next;
+            luby_alloc_raw(L, L->vector_free[i], 0);
+            L->vector_free[i] = next;
+        }
+    }
+    luby_run_finalizers(L, 0);
+    while (L->images) {
+        luby_image_attachment *a = L->images;
+        L->images = a->next;
+        luby_chunk_free(L, &a->chunk);
+        luby_image_release(a->image);
+        luby_alloc_raw(L, a, 0);
+    }
     // Free bookkeeping arrays
     for (size_t i = 0; i < L->global_count; i++) {
         luby_alloc_raw(L, (void *)L->global_names[i].data, 0);
@@ -7449,12 +9007,38 @@ LUBY_API void luby_free(luby_state *L) {
     luby_alloc_raw(L, L->global_values, 0);
     luby_alloc_raw(L, L->search_paths, 0);
     luby_alloc_raw(L, L->loaded_paths, 0);
+    for (size_t i = 0; i < L->cfuncs.count; i++) luby_alloc_raw(L, L->cfuncs.sigs[i], 0);
     luby_alloc_raw(L, L->cfuncs.names, 0);
     luby_alloc_raw(L, L->cfuncs.funcs, 0);
+    luby_alloc_raw(L, L->cfuncs.sigs, 0);
     luby_alloc_raw(L, L->symbol_names, 0);
+    luby_alloc_raw(L, L->gc_mark_stack, 0);
+    luby_alloc_raw(L, L->gc_temps, 0);
+    luby_alloc_raw(L, L->refs, 0);
+    luby_alloc_raw(L, L->finalizers, 0);
     luby_default_alloc(NULL, L, 0);
 }
 
+LUBY_API size_t luby_run_finalizers(luby_state *L, size_t max) {
+    if (!L) return 0;
+    size_t ran = 0;
+    // FIFO; a finalizer that triggers a collection may append to the queue
+    while (ran < L->finalizer_count && (max == 0 || ran < max)) {
+        luby_pending_finalizer pf = L->finalizers[ran++];
+        pf.fn(pf.data);
+        if (pf.owned && pf.data) luby_alloc_raw(L, pf.data, 0);
+    }
+    if (ran > 0) {
+        memmove(L->finalizers, L->finalizers + ran, (L->finalizer_count - ran) * sizeof(luby_pending_finalizer));
+        L->finalizer_count -= ran;
+    }
+    return ran;
+}
+
+LUBY_API size_t luby_pending_finalizers(luby_state *L) {
+    return L ? L->finalizer_count : 0;
+}
+
 // ------------------------------ Execution Limits API -----------------------
 
 LUBY_API void luby_set_instruction_limit(luby_state *L, size_t limit) {
@@ -7522,32 +9106,59 @@ static int luby_execute_chunk(luby_state *L, luby_chunk *chunk, luby_value *out,
         if (_rc != 0) return (int)LUBY_E_RUNTIME; \
     } while (0)
 
-static int luby_call_block(luby_state *L, luby_proc *proc, int argc, const luby_value *argv, luby_value *out) {
+// Drop whatever an earlier run left on a VM (frames abandoned by an error, a
+// stale return value) while keeping its stack and frame buffers for reuse.
+static void luby_vm_reset(luby_state *L, luby_vm *vm) {
+    for (int i = vm->frame_count - 1; i >= 0; i--) {
+        luby_vm_frame *f = &vm->frames[i];
+        if (f->param_existed) luby_alloc_raw(L, f->param_existed, 0);
+        if (f->param_saved) luby_alloc_raw(L, f->param_saved, 0);
+        if (f->kwarg_existed) luby_alloc_raw(L, f->kwarg_existed, 0);
+        if (f->kwarg_saved) luby_alloc_raw(L, f->kwarg_saved, 0);
+        if (f->local_existed) luby_alloc_raw(L, f->local_existed, 0);
+        if (f->local_saved) luby_alloc_raw(L, f->local_saved, 0);
+    }
+    vm->frame_count = 0;
+    vm->sp = vm->pinned;
+    vm->yielded = 0;
+    vm->resume_pending = 0;
+    vm->native_yield = 0;
+}
+
+// Call a block on a caller-owned VM. Iterators that invoke blocks in a tight
+// loop keep one VM alive across calls instead of building a new one each time.
+static int luby_call_block_on(luby_state *L, luby_vm *vm, luby_proc *proc, int argc, const luby_value *argv, luby_value *out) {
     if (!proc) return (int)LUBY_E_TYPE;
     luby_value saved_block = L->current_block;
     luby_value saved_sbfc = L->saved_block_for_call;
     L->current_block = luby_nil();
 
-    luby_vm vm;
-    luby_vm_init(&vm);
-    if (!luby_vm_ensure_stack(L, &vm, 1)) {
+    luby_vm_reset(L, vm);
+    if (!luby_vm_ensure_stack(L, vm, 1)) {
         L->current_block = saved_block;
         L->saved_block_for_call = saved_sbfc;
         return (int)LUBY_E_OOM;
     }
-    if (!luby_vm_push_frame(L, &vm, proc, &proc->chunk, "<block>", luby_nil(), NULL, NULL, argc, argv, luby_nil(), 0)) {
-        luby_vm_free(L, &vm);
+    if (!luby_vm_push_frame(L, vm, proc, &proc->chunk, "<block>", luby_nil(), NULL, NULL, argc, argv, luby_nil(), 0)) {
         L->current_block = saved_block;
         L->saved_block_for_call = saved_sbfc;
         return (L->last_error.code != LUBY_E_OK) ? (int)L->last_error.code : (int)LUBY_E_OOM;
     }
-    int rc = luby_vm_run(L, &vm, out);
-    luby_vm_free(L, &vm);
+    int rc = luby_vm_run(L, vm, out);
     L->current_block = saved_block;
     L->saved_block_for_call = saved_sbfc;
     return rc;
 }
 
+static int luby_call_block(luby_state *L, luby_proc *proc, int argc, const luby_value *argv, luby_value *out) {
+    if (!proc) return (int)LUBY_E_TYPE;
+    luby_vm vm;
+    luby_vm_init(&vm);
+    int rc = luby_call_block_on(L, &vm, proc, argc, argv, out);
+    luby_vm_free(L, &vm);
+    return rc;
+}
+
 static int luby_call_proc_with_self(luby_state *L, luby_proc *proc, luby_value recv, int argc, const luby_value *argv, luby_value *out) {
     if (!proc) return (int)LUBY_E_TYPE;
     luby_value saved_block = L->current_block;
@@ -7596,32 +9207,26 @@ static int luby_eval_with_context(luby_state *L, luby_value new_class, luby_valu
     return rc;
 }
 
-LUBY_API int luby_eval(luby_state *L, const char *code, size_t len, const char *filename, luby_value *out) {
-    luby_clear_error(L);
-    
-    // Reset per-invocation counters
-    L->instruction_count = 0;
-    L->allocation_count = 0;
-    
+// Parse and compile source into `chunk`. Returns LUBY_E_OK or the error
+// code (L's error is set); on failure the chunk is left empty.
+static int luby_compile_source(luby_state *L, const char *code, size_t len, const char *filename, luby_chunk *chunk) {
     // Set up arena for fast AST allocation
     luby_arena arena;
     luby_arena_init(&arena);
     L->parse_arena = &arena;
     
+    luby_chunk_init(chunk);
     luby_error err = {0};
     luby_ast_node *ast = luby_parse(L, code, len, filename, &err);
     if (err.code != LUBY_E_OK || !ast) {
-        luby_free_ast(L, ast);  // frees arrays, arena frees nodes
         luby_arena_free(L, &arena);
         L->parse_arena = NULL;
         luby_set_error(L, err.code, err.message ? err.message : "parse error", err.file, err.line, err.column);
         return (int)err.code;
     }
-    luby_chunk chunk;
-    luby_chunk_init(&chunk);
     luby_compiler C;
     C.L = L;
-    C.chunk = &chunk;
+    C.chunk = chunk;
     C.class_depth = (L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE) ? 1 : 0;
     C.loop_depth = 0;
     C.in_block = 0;
@@ -7633,19 +9238,31 @@ LUBY_API int luby_eval(luby_state *L, const char *code, size_t len, const char *
     L->gc_paused = 1;
     if (!luby_compile_node(&C, ast)) {
         L->gc_paused = was_paused;
-        luby_free_ast(L, ast);  // frees arrays, arena frees nodes
         luby_arena_free(L, &arena);
         L->parse_arena = NULL;
-        luby_chunk_free(L, &chunk);
+        luby_chunk_free(L, chunk);
         luby_set_error(L, LUBY_E_PARSE, "compile error", filename, 0, 0);
         return (int)LUBY_E_PARSE;
     }
     L->gc_paused = was_paused;
     
-    // AST is no longer needed after compilation - free arena and arrays
-    luby_free_ast(L, ast);  // frees arrays only (arena handles nodes)
+    // AST is no longer needed after compilation; nodes and child arrays
+    // all live in the arena
     luby_arena_free(L, &arena);
     L->parse_arena = NULL;
+    return (int)LUBY_E_OK;
+}
+
+LUBY_API int luby_eval(luby_state *L, const char *code, size_t len, const char *filename, luby_value *out) {
+    luby_clear_error(L);
+    
+    // Reset per-invocation counters
+    L->instruction_count = 0;
+    L->allocation_count = 0;
+    
+    luby_chunk chunk;
+    int crc = luby_compile_source(L, code, len, filename, &chunk);
+    if (crc != LUBY_E_OK) return crc;
     
     luby_value result = luby_nil();
     int rc = luby_execute_chunk(L, &chunk, &result, filename);
@@ -7660,5347 +9277,11461 @@ LUBY_API int luby_eval(luby_state *L, const char *code, size_t len, const char *
     return rc;
 }
 
-LUBY_API int luby_require(luby_state *L, const char *path, luby_value *out) {
-    if (!L || !path) return (int)LUBY_E_RUNTIME;
-    if (!L->cfg.vfs.read || !L->cfg.vfs.exists) {
-        luby_set_error(L, LUBY_E_IO, "vfs not configured", NULL, 0, 0);
-        return (int)LUBY_E_IO;
+// ------------------------------ Code Images --------------------------------
+
+static void *luby_image_alloc(luby_image *img, size_t size) {
+    luby_image_block *b = (luby_image_block *)img->alloc(img->alloc_user, NULL, sizeof(luby_image_block) + size);
+    if (!b) return NULL;
+    b->next = img->blocks;
+    img->blocks = b;
+    return b + 1;
+}
+
+// Copy `size` bytes into the image; a zero-size copy yields NULL
+static int luby_image_dup(luby_image *img, void **out, const void *src, size_t size) {
+    *out = NULL;
+    if (size == 0 || !src) return 1;
+    *out = luby_image_alloc(img, size);
+    if (!*out) return 0;
+    memcpy(*out, src, size);
+    return 1;
+}
+
+static char *luby_image_dup_string(luby_image *img, const char *s, size_t len) {
+    char *buf = (char *)luby_image_alloc(img, len + 1);
+    if (!buf) return NULL;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+static int luby_image_dup_names(luby_image *img, char ***out, char **names, size_t count) {
+    *out = NULL;
+    if (count == 0 || !names) return 1;
+    *out = (char **)luby_image_alloc(img, count * sizeof(char *));
+    if (!*out) return 0;
+    for (size_t i = 0; i < count; i++) {
+        (*out)[i] = NULL;
+        if (names[i] && !((*out)[i] = luby_image_dup_string(img, names[i], strlen(names[i])))) return 0;
     }
+    return 1;
+}
 
-    const char *candidate = path;
-    size_t path_len = strlen(path);
-    char *with_ext = NULL;
-    if (path_len < 3 || strcmp(path + path_len - 3, ".rb") != 0) {
-        with_ext = (char *)luby_alloc_raw(L, NULL, path_len + 4);
-        if (with_ext) {
-            memcpy(with_ext, path, path_len);
-            memcpy(with_ext + path_len, ".rb", 4);
+static luby_image_proc *luby_image_copy_proc(luby_image *img, const luby_proc *src);
+
+static int luby_image_copy_chunk(luby_image *img, luby_image_chunk *dst, const luby_chunk *src) {
+    memset(dst, 0, sizeof(*dst));
+    if (!luby_image_dup(img, (void **)&dst->code, src->code, src->count * sizeof(luby_inst))) return 0;
+    if (!luby_image_dup(img, (void **)&dst->lines, src->lines, src->count * sizeof(int))) return 0;
+    dst->count = src->count;
+    if (src->const_count == 0) return 1;
+    dst->consts = (luby_image_const *)luby_image_alloc(img, src->const_count * sizeof(luby_image_const));
+    if (!dst->consts) return 0;
+    memset(dst->consts, 0, src->const_count * sizeof(luby_image_const));
+    dst->const_count = src->const_count;
+    for (size_t i = 0; i < src->const_count; i++) {
+        luby_value v = src->consts[i];
+        luby_image_const *k = &dst->consts[i];
+        k->value = v;
+        switch (v.type) {
+            case LUBY_T_NIL:
+            case LUBY_T_BOOL:
+            case LUBY_T_INT:
+            case LUBY_T_FLOAT:
+                break;
+            case LUBY_T_STRING:
+            case LUBY_T_SYMBOL: {
+                const char *str = (const char *)v.as.ptr;
+                k->len = v.type == LUBY_T_STRING ? LUBY_STRING_OBJ(str)->length : strlen(str);
+                if (!(k->str = luby_image_dup_string(img, str, k->len))) return 0;
+                k->value.as.ptr = NULL;
+                break;
+            }
+            case LUBY_T_PROC:
+                if (!(k->proc = luby_image_copy_proc(img, (const luby_proc *)v.as.ptr))) return 0;
+                k->value.as.ptr = NULL;
+                break;
+            default:
+                return 0;
         }
     }
+    return 1;
+}
 
-    char fullpath[1024];
-    const char *resolved = NULL;
+static int luby_image_copy_chunks(luby_image *img, luby_image_chunk **out, const luby_chunk *src, size_t count) {
+    *out = NULL;
+    if (!src || count == 0) return 1;
+    *out = (luby_image_chunk *)luby_image_alloc(img, count * sizeof(luby_image_chunk));
+    if (!*out) return 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!luby_image_copy_chunk(img, &(*out)[i], &src[i])) return 0;
+    }
+    return 1;
+}
 
-    if (L->cfg.vfs.exists(L->cfg.vfs.user, candidate)) {
-        resolved = candidate;
-    } else if (with_ext && L->cfg.vfs.exists(L->cfg.vfs.user, with_ext)) {
-        resolved = with_ext;
-    } else {
-        for (size_t i = 0; i < L->search_path_count && !resolved; i++) {
-            const char *base = L->search_paths[i];
-            if (!base) continue;
-            size_t blen = strlen(base);
-            snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", candidate);
-            if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
-            if (with_ext) {
-                snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", with_ext);
-                if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
-            }
-        }
+static luby_image_proc *luby_image_copy_proc(luby_image *img, const luby_proc *src) {
+    luby_image_proc *p = (luby_image_proc *)luby_image_alloc(img, sizeof(luby_image_proc));
+    if (!p) return NULL;
+    memset(p, 0, sizeof(*p));
+    p->param_count = src->param_count;
+    p->splat_index = src->splat_index;
+    p->has_block_param = src->has_block_param;
+    p->local_count = src->local_count;
+    p->owned_by_chunk = src->owned_by_chunk;
+    p->visibility = src->visibility;
+    p->kwarg_count = src->kwarg_count;
+    p->accessor = src->accessor;
+    p->slot = src->slot;
+    if (!luby_image_dup_names(img, &p->param_names, src->param_names, src->param_count)) return NULL;
+    if (!luby_image_dup_names(img, &p->local_names, src->local_names, src->local_count)) return NULL;
+    if (!luby_image_dup_names(img, &p->kwarg_names, src->kwarg_names, src->kwarg_count)) return NULL;
+    if (src->block_param_name &&
+        !(p->block_param_name = luby_image_dup_string(img, src->block_param_name, strlen(src->block_param_name)))) return NULL;
+    if (!luby_image_copy_chunks(img, &p->default_chunks, src->default_chunks, src->param_count)) return NULL;
+    if (!luby_image_copy_chunks(img, &p->kwarg_default_chunks, src->kwarg_default_chunks, src->kwarg_count)) return NULL;
+    if (!luby_image_copy_chunk(img, &p->chunk, &src->chunk)) return NULL;
+    return p;
+}
+
+static luby_proc *luby_image_load_proc(luby_state *L, const luby_image_proc *src);
+
+// Point `dst` at the image's bytecode and materialize its constants in L.
+// On failure the constants loaded so far stay in dst for luby_chunk_free.
+static int luby_image_load_chunk(luby_state *L, luby_chunk *dst, const luby_image_chunk *src) {
+    luby_chunk_init(dst);
+    dst->code = src->code;
+    dst->lines = src->lines;
+    dst->count = dst->capacity = src->count;
+    dst->shared = 1;
+    if (src->const_count == 0) return 1;
+    dst->consts = (luby_value *)luby_alloc_raw(L, NULL, src->const_count * sizeof(luby_value));
+    if (!dst->consts) return 0;
+    dst->const_capacity = src->const_count;
+    for (size_t i = 0; i < src->const_count; i++) {
+        const luby_image_const *k = &src->consts[i];
+        luby_value v = k->value;
+        if (v.type == LUBY_T_STRING) {
+            if (!(v.as.ptr = luby_gc_alloc_string(L, k->str, k->len))) return 0;
+        } else if (v.type == LUBY_T_SYMBOL) {
+            if (!(v.as.ptr = (void *)luby_intern_symbol(L, k->str, k->len))) return 0;
+        } else if (v.type == LUBY_T_PROC) {
+            if (!(v.as.ptr = luby_image_load_proc(L, k->proc))) return 0;
+        }
+        dst->consts[dst->const_count++] = v;
     }
+    return 1;
+}
 
-    if (!resolved) {
-        luby_set_error(L, LUBY_E_IO, "module not found", path, 0, 0);
-        luby_alloc_raw(L, with_ext, 0);
-        return (int)LUBY_E_IO;
+static int luby_image_load_chunks(luby_state *L, luby_chunk **out, const luby_image_chunk *src, size_t count) {
+    *out = NULL;
+    if (!src || count == 0) return 1;
+    *out = (luby_chunk *)luby_alloc_raw(L, NULL, count * sizeof(luby_chunk));
+    if (!*out) return 0;
+    for (size_t i = 0; i < count; i++) luby_chunk_init(&(*out)[i]);
+    for (size_t i = 0; i < count; i++) {
+        if (!luby_image_load_chunk(L, &(*out)[i], &src[i])) return 0;
     }
+    return 1;
+}
 
-    if (luby_string_list_contains(L->loaded_paths, L->loaded_count, resolved)) {
-        luby_alloc_raw(L, with_ext, 0);
-        if (out) *out = luby_bool(0);
-        return (int)LUBY_E_OK;
+static int luby_image_load_names(luby_state *L, char ***out, char **names, size_t count) {
+    *out = NULL;
+    if (count == 0 || !names) return 1;
+    *out = (char **)luby_alloc_raw(L, NULL, count * sizeof(char *));
+    if (!*out) return 0;
+    memset(*out, 0, count * sizeof(char *));
+    for (size_t i = 0; i < count; i++) {
+        if (names[i] && !((*out)[i] = luby_dup_string(L, names[i], strlen(names[i])))) return 0;
     }
+    return 1;
+}
 
-    size_t size = 0;
-    char *code = L->cfg.vfs.read(L->cfg.vfs.user, resolved, &size);
-    if (!code) {
-        luby_set_error(L, LUBY_E_IO, "read failed", resolved, 0, 0);
-        luby_alloc_raw(L, with_ext, 0);
-        return (int)LUBY_E_IO;
+// Build this state's proc for an image template. A partially built proc is
+// still GC-tracked and luby_proc_free copes with it.
+static luby_proc *luby_image_load_proc(luby_state *L, const luby_image_proc *src) {
+    luby_proc *proc = (luby_proc *)luby_gc_alloc(L, sizeof(luby_proc), LUBY_GC_PROC);
+    if (!proc) return NULL;
+    proc->splat_index = src->splat_index;
+    proc->has_block_param = src->has_block_param;
+    proc->owned_by_chunk = src->owned_by_chunk;
+    proc->visibility = src->visibility;
+    proc->accessor = src->accessor;
+    proc->slot = src->slot;
+    if (!luby_image_load_names(L, &proc->param_names, src->param_names, src->param_count)) return NULL;
+    if (src->param_names) proc->param_count = src->param_count;
+    if (!luby_image_load_chunks(L, &proc->default_chunks, src->default_chunks, proc->param_count)) return NULL;
+    if (!luby_image_load_names(L, &proc->local_names, src->local_names, src->local_count)) return NULL;
+    if (src->local_names) proc->local_count = src->local_count;
+    if (!luby_image_load_names(L, &proc->kwarg_names, src->kwarg_names, src->kwarg_count)) return NULL;
+    if (src->kwarg_names) proc->kwarg_count = src->kwarg_count;
+    if (!luby_image_load_chunks(L, &proc->kwarg_default_chunks, src->kwarg_default_chunks, proc->kwarg_count)) return NULL;
+    if (src->block_param_name &&
+        !(proc->block_param_name = luby_dup_string(L, src->block_param_name, strlen(src->block_param_name)))) return NULL;
+    if (!luby_image_load_chunk(L, &proc->chunk, &src->chunk)) return NULL;
+    return proc;
+}
+
+LUBY_API luby_image *luby_image_compile(luby_state *L, const char *code, size_t len, const char *filename) {
+    if (!L || !code) return NULL;
+    luby_clear_error(L);
+    luby_chunk chunk;
+    if (luby_compile_source(L, code, len, filename, &chunk) != LUBY_E_OK) return NULL;
+
+    luby_alloc_fn fn = L->cfg.alloc ? L->cfg.alloc : luby_default_alloc;
+    luby_image *img = (luby_image *)fn(L->cfg.alloc_user, NULL, sizeof(luby_image));
+    int ok = img != NULL;
+    if (img) {
+        memset(img, 0, sizeof(*img));
+        img->refs = 1;
+        img->alloc = fn;
+        img->alloc_user = L->cfg.alloc_user;
+        const char *name = filename ? filename : "<image>";
+        ok = (img->filename = luby_image_dup_string(img, name, strlen(name))) != NULL
+            && luby_image_copy_chunk(img, &img->top, &chunk);
+    }
+    // The compiled procs are garbage now; the image holds its own copy
+    luby_chunk_free(L, &chunk);
+    if (!ok) {
+        luby_image_release(img);
+        luby_set_error(L, LUBY_E_OOM, "out of memory building code image", filename, 0, 0);
+        return NULL;
     }
+    return img;
+}
 
-    luby_string_list_add(L, &L->loaded_paths, &L->loaded_count, &L->loaded_capacity, resolved);
-    luby_value res;
-    int rc = luby_eval(L, code, size, resolved, &res);
-    L->cfg.alloc ? L->cfg.alloc(L->cfg.alloc_user, code, 0) : luby_default_alloc(NULL, code, 0);
-    luby_alloc_raw(L, with_ext, 0);
-    if (out) *out = luby_bool(rc == 0);
-    return rc;
+LUBY_API void luby_image_retain(luby_image *img) {
+    if (img) LUBY_ATOMIC_ADD(&img->refs, 1);
 }
 
-LUBY_API int luby_load(luby_state *L, const char *path, luby_value *out) {
-    if (!L || !path) return (int)LUBY_E_RUNTIME;
-    if (!L->cfg.vfs.read || !L->cfg.vfs.exists) {
-        luby_set_error(L, LUBY_E_IO, "vfs not configured", NULL, 0, 0);
-        return (int)LUBY_E_IO;
+LUBY_API void luby_image_release(luby_image *img) {
+    if (!img || LUBY_ATOMIC_ADD(&img->refs, -1) != 0) return;
+    luby_image_block *b = img->blocks;
+    while (b) {
+        luby_image_block *next = b->next;
+        img->alloc(img->alloc_user, b, 0);
+        b = next;
     }
+    img->alloc(img->alloc_user, img, 0);
+}
 
-    const char *candidate = path;
-    size_t path_len = strlen(path);
-    char *with_ext = NULL;
-    if (path_len < 3 || strcmp(path + path_len - 3, ".rb") != 0) {
-        with_ext = (char *)luby_alloc_raw(L, NULL, path_len + 4);
-        if (with_ext) {
-            memcpy(with_ext, path, path_len);
-            memcpy(with_ext + path_len, ".rb", 4);
+LUBY_API int luby_image_run(luby_state *L, luby_image *img, luby_value *out) {
+    if (!L || !img) return (int)LUBY_E_RUNTIME;
+    luby_clear_error(L);
+    
+    // Reset per-invocation counters
+    L->instruction_count = 0;
+    L->allocation_count = 0;
+
+    // Instantiate the image in this state on first use. Attachments are
+    // individually allocated so a running chunk never moves.
+    luby_image_attachment *a = L->images;
+    while (a && a->image != img) a = a->next;
+    if (!a) {
+        a = (luby_image_attachment *)luby_alloc_raw(L, NULL, sizeof(luby_image_attachment));
+        if (!a) {
+            luby_set_error(L, LUBY_E_OOM, "oom", img->filename, 0, 0);
+            return (int)LUBY_E_OOM;
+        }
+        int was_paused = L->gc_paused;
+        L->gc_paused = 1;
+        int ok = luby_image_load_chunk(L, &a->chunk, &img->top);
+        L->gc_paused = was_paused;
+        if (!ok) {
+            luby_chunk_free(L, &a->chunk);
+            luby_alloc_raw(L, a, 0);
+            if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_OOM, "oom", img->filename, 0, 0);
+            return (int)L->last_error.code;
         }
+        luby_image_retain(img);
+        a->image = img;
+        a->next = L->images;
+        L->images = a;
     }
 
-    char fullpath[1024];
-    const char *resolved = NULL;
+    luby_value result = luby_nil();
+    int rc = luby_execute_chunk(L, &a->chunk, &result, img->filename);
+    if (out) {
+        *out = result;
+    }
+    if (L->last_error.code != LUBY_E_OK) return (int)L->last_error.code;
+    return rc;
+}
 
-    if (L->cfg.vfs.exists(L->cfg.vfs.user, candidate)) {
-        resolved = candidate;
-    } else if (with_ext && L->cfg.vfs.exists(L->cfg.vfs.user, with_ext)) {
-        resolved = with_ext;
-    } else {
-        for (size_t i = 0; i < L->search_path_count && !resolved; i++) {
-            const char *base = L->search_paths[i];
-            if (!base) continue;
-            size_t blen = strlen(base);
-            snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", candidate);
-            if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
-            if (with_ext) {
-                snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", with_ext);
-                if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
-            }
-        }
-    }
+// ------------------------------ Snapshots ----------------------------------
+//
+// A snapshot is a private deep copy of a state that is never run; luby_clone
+// copies it again. Copying is two passes over the object list: first every
+// object gets a shell of the same type (owned arrays detached, so a failed
+// copy can be freed like any heap), then each shell's arrays are duplicated
+// and every pointer is remapped through an address table. Symbols are
+// remapped through the same table.
 
-    if (!resolved) {
-        luby_set_error(L, LUBY_E_IO, "module not found", path, 0, 0);
-        luby_alloc_raw(L, with_ext, 0);
-        return (int)LUBY_E_IO;
-    }
+// Shared channels and actor jobs (see Actors below) are retained by copies
+typedef struct luby_shared luby_shared;
+static void luby_shared_retain(luby_shared *sh);
+static void luby_shared_release(void *data);
 
-    size_t size = 0;
-    char *code = L->cfg.vfs.read(L->cfg.vfs.user, resolved, &size);
-    if (!code) {
-        luby_set_error(L, LUBY_E_IO, "read failed", resolved, 0, 0);
-        luby_alloc_raw(L, with_ext, 0);
-        return (int)LUBY_E_IO;
+struct luby_snapshot {
+    luby_state *state;
+};
+
+typedef struct luby_copy_map {
+    const void **keys;
+    void **values;
+    size_t capacity;               // power of two
+} luby_copy_map;
+
+static size_t luby_copy_map_slot(const luby_copy_map *m, const void *key) {
+    uintptr_t h = (uintptr_t)key;
+    h ^= h >> 17;
+    h *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 7) & (m->capacity - 1);
+}
+
+static void luby_copy_map_put(luby_copy_map *m, const void *key, void *value) {
+    size_t i = luby_copy_map_slot(m, key);
+    while (m->keys[i] && m->keys[i] != key) i = (i + 1) & (m->capacity - 1);
+    m->keys[i] = key;
+    m->values[i] = value;
+}
+
+static void *luby_copy_map_get(const luby_copy_map *m, const void *key) {
+    if (!key) return NULL;
+    size_t i = luby_copy_map_slot(m, key);
+    while (m->keys[i]) {
+        if (m->keys[i] == key) return m->values[i];
+        i = (i + 1) & (m->capacity - 1);
     }
+    return NULL;
+}
 
-    luby_value res;
-    int rc = luby_eval(L, code, size, resolved, &res);
-    L->cfg.alloc ? L->cfg.alloc(L->cfg.alloc_user, code, 0) : luby_default_alloc(NULL, code, 0);
-    luby_alloc_raw(L, with_ext, 0);
-    if (out) *out = luby_bool(rc == 0);
-    return rc;
+#define LUBY_COPY_OBJ(m, p) ((p) ? luby_copy_map_get((m), &(p)->gc) : NULL)
+
+// Remap a value into the copy. Immediates pass through; *ok is cleared if a
+// heap pointer has no counterpart. Some builtins make symbol values from
+// string literals rather than the symbol table; those are interned in D.
+static luby_value luby_copy_value(luby_state *D, const luby_copy_map *m, luby_value v, int *ok) {
+    if (!v.as.ptr) return v;
+    if (v.type == LUBY_T_SYMBOL) {
+        void *sym = luby_copy_map_get(m, v.as.ptr);
+        if (!sym) sym = (void *)luby_intern_symbol(D, (const char *)v.as.ptr, 0);
+        if (!sym) *ok = 0;
+        v.as.ptr = sym;
+        return v;
+    }
+    luby_gc_obj *obj = luby_gc_value_obj(v);
+    if (!obj) return v;
+    luby_gc_obj *copy = (luby_gc_obj *)luby_copy_map_get(m, obj);
+    if (!copy) { *ok = 0; return luby_nil(); }
+    v.as.ptr = v.type == LUBY_T_STRING ? (void *)((luby_string_obj *)copy)->data : (void *)copy;
+    return v;
 }
 
-LUBY_API luby_error luby_last_error(luby_state *L) {
-    luby_error err = {0};
-    if (!L) return err;
-    return L->last_error;
+static luby_value *luby_copy_values(luby_state *D, const luby_copy_map *m, const luby_value *src, size_t count, size_t capacity, int *ok) {
+    if (!src || capacity == 0) return NULL;
+    luby_value *out = (luby_value *)luby_alloc_raw(D, NULL, capacity * sizeof(luby_value));
+    if (!out) { *ok = 0; return NULL; }
+    for (size_t i = 0; i < count; i++) out[i] = luby_copy_value(D, m, src[i], ok);
+    return out;
 }
 
-LUBY_API void luby_clear_error(luby_state *L) {
-    if (!L) return;
-    L->last_error.code = LUBY_E_OK;
-    L->last_error.message = NULL;
-    L->last_error.file = NULL;
-    L->last_error.line = 0;
-    L->last_error.column = 0;
+static char **luby_copy_names(luby_state *D, char **names, size_t count, int *ok) {
+    if (!names || count == 0) return NULL;
+    char **out = (char **)luby_alloc_raw(D, NULL, count * sizeof(char *));
+    if (!out) { *ok = 0; return NULL; }
+    for (size_t i = 0; i < count; i++) {
+        out[i] = names[i] ? luby_dup_string(D, names[i], strlen(names[i])) : NULL;
+        if (names[i] && !out[i]) *ok = 0;
+    }
+    return out;
+}
+
+static void luby_copy_chunk(luby_state *D, const luby_copy_map *m, luby_chunk *dst, const luby_chunk *src, int *ok) {
+    luby_chunk_init(dst);
+    dst->shared = src->shared;
+    if (src->shared) {
+        dst->code = src->code;
+        dst->lines = src->lines;
+    } else if (src->count > 0) {
+        dst->code = (luby_inst *)luby_alloc_raw(D, NULL, src->count * sizeof(luby_inst));
+        dst->lines = (int *)luby_alloc_raw(D, NULL, src->count * sizeof(int));
+        if (!dst->code || !dst->lines) { *ok = 0; return; }
+        memcpy(dst->code, src->code, src->count * sizeof(luby_inst));
+        memcpy(dst->lines, src->lines, src->count * sizeof(int));
+    }
+    dst->count = dst->capacity = src->count;
+    dst->consts = luby_copy_values(D, m, src->consts, src->const_count, src->const_count, ok);
+    if (dst->consts) dst->const_count = dst->const_capacity = src->const_count;
+}
+
+static luby_chunk *luby_copy_chunks(luby_state *D, const luby_copy_map *m, const luby_chunk *src, size_t count, int *ok) {
+    if (!src || count == 0) return NULL;
+    luby_chunk *out = (luby_chunk *)luby_alloc_raw(D, NULL, count * sizeof(luby_chunk));
+    if (!out) { *ok = 0; return NULL; }
+    for (size_t i = 0; i < count; i++) luby_chunk_init(&out[i]);
+    for (size_t i = 0; i < count && *ok; i++) luby_copy_chunk(D, m, &out[i], &src[i], ok);
+    return out;
+}
+
+// Shell for `src`: the struct itself with every owned array detached
+static luby_gc_obj *luby_copy_shell(luby_state *D, const luby_gc_obj *src) {
+    size_t size = luby_gc_obj_size((luby_gc_obj *)src);
+    luby_gc_obj *obj = (luby_gc_obj *)luby_alloc_raw(D, NULL, size);
+    if (!obj) return NULL;
+    memcpy(obj, src, size);
+    obj->gc_marked = 0;
+    switch (obj->gc_type) {
+        case LUBY_GC_ARRAY: {
+            luby_array *a = (luby_array *)obj;
+            a->items = NULL; a->count = a->capacity = 0;
+            break;
+        }
+        case LUBY_GC_HASH: {
+            luby_hash *h = (luby_hash *)obj;
+            h->entries = NULL; h->count = h->capacity = 0;
+            break;
+        }
+        case LUBY_GC_CLASS: {
+            luby_class_obj *c = (luby_class_obj *)obj;
+            c->name = NULL;
+            c->included_modules = c->prepended_modules = NULL;
+            c->included_count = c->included_capacity = c->prepended_count = c->prepended_capacity = 0;
+            c->cvar_names = NULL; c->cvar_values = NULL; c->cvar_count = 0;
+            c->fields = NULL; c->field_count = 0;
+            c->members = NULL; c->member_count = 0;
+            c->pool_free = NULL; c->pool_free_count = 0;
+            break;
+        }
+        case LUBY_GC_OBJECT: {
+            luby_object *o = (luby_object *)obj;
+            o->ivar_names = NULL; o->ivar_values = NULL; o->ivar_count = 0;
+            if (o->slots) o->slots = (luby_value *)(o + 1);
+            break;
+        }
+        case LUBY_GC_PROC: {
+            luby_proc *p = (luby_proc *)obj;
+            p->param_names = NULL; p->param_count = 0; p->default_chunks = NULL;
+            p->block_param_name = NULL; p->local_names = NULL; p->local_count = 0;
+            luby_chunk_init(&p->chunk);
+            p->kwarg_names = NULL; p->kwarg_count = 0; p->kwarg_default_chunks = NULL;
+            break;
+        }
+        case LUBY_GC_COROUTINE:
+            luby_vm_init(&((luby_coroutine *)obj)->vm);
+            break;
+        case LUBY_GC_USERDATA: {
+            luby_userdata *u = (luby_userdata *)obj;
+            u->data = NULL; u->size = 0; u->alive = 0;
+            break;
+        }
+        case LUBY_GC_CMETHOD: {
+            luby_cmethod *cm = (luby_cmethod *)obj;
+            if (cm->sig) cm->sig = (luby_signature *)(cm + 1);
+            break;
+        }
+        default:
+            break;
+    }
+    return obj;
 }
 
-LUBY_API const char *luby_error_code_string(luby_error_code code) {
-    switch (code) {
-        case LUBY_E_OK: return "ok";
-        case LUBY_E_PARSE: return "parse";
-        case LUBY_E_RUNTIME: return "runtime";
-        case LUBY_E_OOM: return "oom";
-        case LUBY_E_IO: return "io";
-        case LUBY_E_TYPE: return "type";
-        case LUBY_E_NAME: return "name";
-        default: return "unknown";
+// Fill in a shell's arrays and remap its pointers
+static void luby_copy_fixup(luby_state *D, const luby_copy_map *m, luby_gc_obj *obj, const luby_gc_obj *src_obj, int *ok) {
+    switch (obj->gc_type) {
+        case LUBY_GC_ARRAY: {
+            luby_array *a = (luby_array *)obj;
+            const luby_array *s = (const luby_array *)src_obj;
+            a->head = 0;
+            a->items = luby_copy_values(D, m, s->items, s->count, s->capacity, ok);
+            if (a->items) { a->count = s->count; a->capacity = s->capacity; }
+            break;
+        }
+        case LUBY_GC_HASH: {
+            luby_hash *h = (luby_hash *)obj;
+            const luby_hash *s = (const luby_hash *)src_obj;
+            if (!s->entries || s->capacity == 0) break;
+            h->entries = (luby_hash_entry *)luby_alloc_raw(D, NULL, s->capacity * sizeof(luby_hash_entry));
+            if (!h->entries) { *ok = 0; break; }
+            for (size_t i = 0; i < s->count; i++) {
+                h->entries[i].key = luby_copy_value(D, m, s->entries[i].key, ok);
+                h->entries[i].value = luby_copy_value(D, m, s->entries[i].value, ok);
+            }
+            h->count = s->count;
+            h->capacity = s->capacity;
+            break;
+        }
+        case LUBY_GC_CLASS: {
+            luby_class_obj *c = (luby_class_obj *)obj;
+            const luby_class_obj *s = (const luby_class_obj *)src_obj;
+            if (s->name && !(c->name = luby_dup_string(D, s->name, strlen(s->name)))) *ok = 0;
+            c->super = (luby_class_obj *)LUBY_COPY_OBJ(m, s->super);
+            c->methods = (luby_hash *)LUBY_COPY_OBJ(m, s->methods);
+            c->singleton_methods = (luby_hash *)LUBY_COPY_OBJ(m, s->singleton_methods);
+            c->method_cache = (luby_hash *)LUBY_COPY_OBJ(m, s->method_cache);
+            c->singleton_cache = (luby_hash *)LUBY_COPY_OBJ(m, s->singleton_cache);
+            if (s->included_modules && s->included_capacity) {
+                c->included_modules = (luby_class_obj **)luby_alloc_raw(D, NULL, s->included_capacity * sizeof(luby_class_obj *));
+                if (!c->included_modules) { *ok = 0; break; }
+                for (size_t i = 0; i < s->included_count; i++) c->included_modules[i] = (luby_class_obj *)LUBY_COPY_OBJ(m, s->included_modules[i]);
+                c->included_count = s->included_count;
+                c->included_capacity = s->included_capacity;
+            }
+            if (s->prepended_modules && s->prepended_capacity) {
+                c->prepended_modules = (luby_class_obj **)luby_alloc_raw(D, NULL, s->prepended_capacity * sizeof(luby_class_obj *));
+                if (!c->prepended_modules) { *ok = 0; break; }
+                for (size_t i = 0; i < s->prepended_count; i++) c->prepended_modules[i] = (luby_class_obj *)LUBY_COPY_OBJ(m, s->prepended_modules[i]);
+                c->prepended_count = s->prepended_count;
+                c->prepended_capacity = s->prepended_capacity;
+            }
+            c->cvar_names = luby_copy_names(D, s->cvar_names, s->cvar_count, ok);
+            c->cvar_values = luby_copy_values(D, m, s->cvar_values, s->cvar_count, s->cvar_count, ok);
+            if (c->cvar_names && c->cvar_values) c->cvar_count = s->cvar_count;
+            if (s->field_count) {
+                c->fields = (luby_field_slot *)luby_alloc_raw(D, NULL, s->field_count * sizeof(luby_field_slot));
+                if (!c->fields) { *ok = 0; break; }
+                for (size_t i = 0; i < s->field_count; i++) {
+                    c->fields[i] = s->fields[i];
+                    c->fields[i].name = luby_dup_string(D, s->fields[i].name, s->fields[i].name_len + 1);
+                    if (!c->fields[i].name) *ok = 0;
+                }
+                c->field_count = s->field_count;
+            }
+            if (s->member_count) {
+                c->members = (const char **)luby_alloc_raw(D, NULL, s->member_count * sizeof(const char *));
+                if (!c->members) { *ok = 0; break; }
+                for (size_t i = 0; i < s->member_count; i++) {
+                    luby_value sym; sym.type = LUBY_T_SYMBOL; sym.as.ptr = (void *)s->members[i];
+                    c->members[i] = (const char *)luby_copy_value(D, m, sym, ok).as.ptr;
+                }
+                c->member_count = s->member_count;
+            }
+            c->pool_items = (luby_array *)LUBY_COPY_OBJ(m, s->pool_items);
+            break;
+        }
+        case LUBY_GC_OBJECT: {
+            luby_object *o = (luby_object *)obj;
+            const luby_object *s = (const luby_object *)src_obj;
+            o->klass = (luby_class_obj *)LUBY_COPY_OBJ(m, s->klass);
+            o->ivars = (luby_hash *)LUBY_COPY_OBJ(m, s->ivars);
+            o->singleton_methods = (luby_hash *)LUBY_COPY_OBJ(m, s->singleton_methods);
+            o->native_ref = (luby_gc_obj *)luby_copy_map_get(m, s->native_ref);
+            o->ivar_names = luby_copy_names(D, s->ivar_names, s->ivar_count, ok);
+            o->ivar_values = luby_copy_values(D, m, s->ivar_values, s->ivar_count, s->ivar_count, ok);
+            if (o->ivar_names && o->ivar_values) o->ivar_count = s->ivar_count;
+            for (size_t i = 0; i < o->slot_count; i++) o->slots[i] = luby_copy_value(D, m, s->slots[i], ok);
+            break;
+        }
+        case LUBY_GC_PROC: {
+            luby_proc *p = (luby_proc *)obj;
+            const luby_proc *s = (const luby_proc *)src_obj;
+            p->param_names = luby_copy_names(D, s->param_names, s->param_count, ok);
+            if (p->param_names) p->param_count = s->param_count;
+            p->default_chunks = luby_copy_chunks(D, m, s->default_chunks, p->param_count, ok);
+            p->local_names = luby_copy_names(D, s->local_names, s->local_count, ok);
+            if (p->local_names) p->local_count = s->local_count;
+            p->kwarg_names = luby_copy_names(D, s->kwarg_names, s->kwarg_count, ok);
+            if (p->kwarg_names) p->kwarg_count = s->kwarg_count;
+            p->kwarg_default_chunks = luby_copy_chunks(D, m, s->kwarg_default_chunks, p->kwarg_count, ok);
+            if (s->block_param_name && !(p->block_param_name = luby_dup_string(D, s->block_param_name, strlen(s->block_param_name)))) *ok = 0;
+            luby_copy_chunk(D, m, &p->chunk, &s->chunk, ok);
+            break;
+        }
+        case LUBY_GC_RANGE: {
+            luby_range *r = (luby_range *)obj;
+            r->start = luby_copy_value(D, m, r->start, ok);
+            r->end = luby_copy_value(D, m, r->end, ok);
+            break;
+        }
+        case LUBY_GC_COROUTINE: {
+            luby_coroutine *co = (luby_coroutine *)obj;
+            // Unstarted and finished coroutines carry no VM state
+            co->proc = (luby_proc *)LUBY_COPY_OBJ(m, co->proc);
+            break;
+        }
+        case LUBY_GC_VECTOR: {
+            luby_vector *vec = (luby_vector *)obj;
+            vec->klass = (luby_class_obj *)LUBY_COPY_OBJ(m, vec->klass);
+            break;
+        }
+        case LUBY_GC_BUFFER: {
+            luby_buffer *buf = (luby_buffer *)obj;
+            buf->klass = (luby_class_obj *)LUBY_COPY_OBJ(m, buf->klass);
+            buf->owner = (luby_buffer *)LUBY_COPY_OBJ(m, buf->owner);
+            break;
+        }
+        case LUBY_GC_USERDATA: {
+            luby_userdata *u = (luby_userdata *)obj;
+            const luby_userdata *s = (const luby_userdata *)src_obj;
+            u->klass = (luby_class_obj *)LUBY_COPY_OBJ(m, s->klass);
+            // Caches may hold raw pointers into the source heap; the copy
+            // starts dead and is rebuilt on first use
+            if (!s->alive || s->cache) break;
+            if (s->size > 0) {
+                // VM-owned: copied bytewise or by its copy hook, keeps its finalizer
+                if (!(u->data = luby_alloc_raw(D, NULL, s->size))) { *ok = 0; break; }
+                if (!s->copy) {
+                    memcpy(u->data, s->data, s->size);
+                } else if (s->copy(u->data, s->data, s->size) != 0) {
+                    // Left dead, so freeing the partial copy skips its finalizer
+                    luby_alloc_raw(D, u->data, 0);
+                    u->data = NULL;
+                    luby_set_error(D, LUBY_E_RUNTIME, "userdata could not be copied", NULL, 0, 0);
+                    *ok = 0;
+                    break;
+                }
+                u->size = s->size;
+            } else if (s->finalize == luby_shared_release) {
+                // Channel or actor: the copy holds its own reference
+                luby_shared_retain((luby_shared *)s->data);
+                u->data = s->data;
+            } else {
+                // Wrapped host pointer: shared, finalized only by its owner
+                u->data = s->data;
+                u->finalize = NULL;
+            }
+            u->alive = 1;
+            break;
+        }
+        default:
+            break;
     }
 }
 
-LUBY_API size_t luby_format_error(luby_state *L, char *buffer, size_t buffer_size) {
-    if (!buffer || buffer_size == 0) return 0;
-    if (!L || L->last_error.code == LUBY_E_OK) {
-        buffer[0] = '\0';
-        return 0;
+// Never writes to S, which may be a snapshot shared by cloning threads.
+// On failure *err (when given) receives D's error before D is freed.
+static luby_state *luby_state_copy(luby_state *S, luby_error *err) {
+    luby_state *D = luby_new(&S->cfg);
+    if (!D) return NULL;
+    int ok = 1;
+    luby_copy_map m = { NULL, NULL, 0 };
+    size_t entries = S->gc_total + S->symbol_count + 1;
+    m.capacity = 64;
+    while (m.capacity < entries * 2) m.capacity *= 2;
+    m.keys = (const void **)luby_alloc_raw(D, NULL, m.capacity * sizeof(void *));
+    m.values = (void **)luby_alloc_raw(D, NULL, m.capacity * sizeof(void *));
+    if (!m.keys || !m.values) { ok = 0; goto done; }
+    memset(m.keys, 0, m.capacity * sizeof(void *));
+
+    // Symbols keep their table order
+    if (S->symbol_count) {
+        D->symbol_names = (char **)luby_alloc_raw(D, NULL, S->symbol_capacity * sizeof(char *));
+        if (!D->symbol_names) { ok = 0; goto done; }
+        D->symbol_capacity = S->symbol_capacity;
+        for (size_t i = 0; i < S->symbol_count; i++) {
+            char *name = luby_dup_string(D, S->symbol_names[i], strlen(S->symbol_names[i]));
+            if (!name) { ok = 0; goto done; }
+            D->symbol_names[D->symbol_count++] = name;
+            luby_copy_map_put(&m, S->symbol_names[i], name);
+        }
+    }
+
+    // Pass 1: shells, appended in list order
+    luby_gc_obj **tail = &D->gc_objects;
+    for (luby_gc_obj *o = S->gc_objects; o; o = o->gc_next) {
+        luby_gc_obj *c = luby_copy_shell(D, o);
+        if (!c) { ok = 0; goto done; }
+        c->gc_next = NULL;
+        *tail = c;
+        tail = &c->gc_next;
+        D->gc_total++;
+        D->gc_bytes_allocated += luby_gc_obj_size(c);
+        luby_copy_map_put(&m, o, c);
+    }
+    D->peak_gc_bytes = D->gc_bytes_allocated;
+
+    // Pass 2: arrays and pointers
+    for (luby_gc_obj *o = S->gc_objects, *c = D->gc_objects; o && ok; o = o->gc_next, c = c->gc_next) {
+        luby_copy_fixup(D, &m, c, o, &ok);
+    }
+    if (!ok) goto done;
+
+    // Globals, search paths, native functions
+    if (S->global_count) {
+        D->global_names = (luby_string_view *)luby_alloc_raw(D, NULL, S->global_capacity * sizeof(luby_string_view));
+        D->global_values = (luby_value *)luby_alloc_raw(D, NULL, S->global_capacity * sizeof(luby_value));
+        if (!D->global_names || !D->global_values) { ok = 0; goto done; }
+        D->global_capacity = S->global_capacity;
+        for (size_t i = 0; i < S->global_count; i++) {
+            char *name = luby_dup_string(D, S->global_names[i].data, S->global_names[i].length);
+            if (!name) { ok = 0; goto done; }
+            D->global_names[i].data = name;
+            D->global_names[i].length = S->global_names[i].length;
+            D->global_values[i] = luby_copy_value(D, &m, S->global_values[i], &ok);
+            D->global_count++;
+        }
+    }
+    for (size_t i = 0; i < S->search_path_count; i++) luby_add_search_path(D, S->search_paths[i]);
+    if (S->loaded_count) {
+        D->loaded_paths = luby_copy_names(D, S->loaded_paths, S->loaded_count, &ok);
+        if (!D->loaded_paths) { ok = 0; goto done; }
+        D->loaded_count = D->loaded_capacity = S->loaded_count;
+    }
+    if (S->cfuncs.count) {
+        D->cfuncs.names = (const char **)luby_alloc_raw(D, NULL, S->cfuncs.capacity * sizeof(char *));
+        D->cfuncs.funcs = (luby_cfunc *)luby_alloc_raw(D, NULL, S->cfuncs.capacity * sizeof(luby_cfunc));
+        D->cfuncs.sigs = (luby_signature **)luby_alloc_raw(D, NULL, S->cfuncs.capacity * sizeof(luby_signature *));
+        if (!D->cfuncs.names || !D->cfuncs.funcs || !D->cfuncs.sigs) { ok = 0; goto done; }
+        memcpy((void *)D->cfuncs.names, S->cfuncs.names, S->cfuncs.count * sizeof(char *));
+        memcpy(D->cfuncs.funcs, S->cfuncs.funcs, S->cfuncs.count * sizeof(luby_cfunc));
+        memset(D->cfuncs.sigs, 0, S->cfuncs.count * sizeof(luby_signature *));
+        D->cfuncs.count = S->cfuncs.count;
+        D->cfuncs.capacity = S->cfuncs.capacity;
+        for (size_t i = 0; i < S->cfuncs.count; i++) {
+            if (!S->cfuncs.sigs[i]) continue;
+            if (!(D->cfuncs.sigs[i] = (luby_signature *)luby_alloc_raw(D, NULL, sizeof(luby_signature)))) { ok = 0; goto done; }
+            *D->cfuncs.sigs[i] = *S->cfuncs.sigs[i];
+        }
+    }
+
+    // Host handles keep their numbers
+    if (S->ref_count) {
+        D->refs = (luby_ref_slot *)luby_alloc_raw(D, NULL, (size_t)S->ref_capacity * sizeof(luby_ref_slot));
+        if (!D->refs) { ok = 0; goto done; }
+        for (int i = 0; i < S->ref_count; i++) {
+            D->refs[i] = S->refs[i];
+            D->refs[i].value = luby_copy_value(D, &m, S->refs[i].value, &ok);
+        }
+        D->ref_count = S->ref_count;
+        D->ref_capacity = S->ref_capacity;
+        D->ref_free = S->ref_free;
+    }
+
+    // Code image attachments
+    for (luby_image_attachment *a = S->images; a && ok; a = a->next) {
+        luby_image_attachment *na = (luby_image_attachment *)luby_alloc_raw(D, NULL, sizeof(luby_image_attachment));
+        if (!na) { ok = 0; break; }
+        luby_copy_chunk(D, &m, &na->chunk, &a->chunk, &ok);
+        luby_image_retain(a->image);
+        na->image = a->image;
+        na->next = D->images;
+        D->images = na;
+    }
+
+    // Interpreter context
+    D->hook = S->hook;
+    D->hook_user = S->hook_user;
+    D->current_class = luby_copy_value(D, &m, S->current_class, &ok);
+    D->current_self = luby_copy_value(D, &m, S->current_self, &ok);
+    D->current_visibility = S->current_visibility;
+    D->module_function_mode = S->module_function_mode;
+    D->method_epoch = S->method_epoch;
+    memcpy(D->rng_state, S->rng_state, sizeof(D->rng_state));
+    for (int i = 0; i < 4; i++) D->vector_classes[i] = (luby_class_obj *)LUBY_COPY_OBJ(&m, S->vector_classes[i]);
+    for (int i = 0; i < 3; i++) D->buffer_classes[i] = (luby_class_obj *)LUBY_COPY_OBJ(&m, S->buffer_classes[i]);
+    for (size_t i = 0; i < S->pool_class_count && ok; i++) {
+        ok = luby_pool_register(D, (luby_class_obj *)LUBY_COPY_OBJ(&m, S->pool_classes[i]));
+    }
+    D->gc_threshold = S->gc_threshold;
+    D->instruction_limit = S->instruction_limit;
+    D->call_depth_limit = S->call_depth_limit;
+    D->allocation_limit = S->allocation_limit;
+    D->memory_limit = S->memory_limit;
+    D->actors = S->actors;
+
+done:
+    luby_alloc_raw(D, (void *)m.keys, 0);
+    luby_alloc_raw(D, m.values, 0);
+    if (!ok) {
+        // Messages are static, so the reason outlives D
+        if (err) *err = D->last_error;
+        luby_free(D);
+        return NULL;
     }
-    const char *code = luby_error_code_string(L->last_error.code);
-    const char *msg = L->last_error.message ? L->last_error.message : "error";
-    const char *file = L->last_error.file ? L->last_error.file : "<unknown>";
-    int line = L->last_error.line;
-    int col = L->last_error.column;
-    int written = 0;
-    if (line > 0) {
-        if (col > 0) {
-            written = snprintf(buffer, buffer_size, "%s:%d:%d: %s: %s", file, line, col, code, msg);
-        } else {
-            written = snprintf(buffer, buffer_size, "%s:%d: %s: %s", file, line, code, msg);
+    return D;
+}
+
+#undef LUBY_COPY_OBJ
+
+LUBY_API luby_snapshot *luby_snapshot_new(luby_state *L) {
+    if (!L) return NULL;
+    if (L->current_vm || L->gc_vms) {
+        luby_set_error(L, LUBY_E_RUNTIME, "cannot snapshot a running state", NULL, 0, 0);
+        return NULL;
+    }
+    // Drop garbage first so it is not copied into every clone. Finishing
+    // the sweep also puts every live object back on gc_objects for the scan.
+    if (!L->gc_paused) luby_gc_collect(L);
+    if (L->gc_sweep_list) luby_gc_sweep_step(L, (size_t)-1);
+    for (luby_gc_obj *o = L->gc_objects; o; o = o->gc_next) {
+        luby_coroutine *co = (luby_coroutine *)o;
+        if (o->gc_type == LUBY_GC_COROUTINE && co->started && !co->done) {
+            luby_set_error(L, LUBY_E_RUNTIME, "cannot snapshot a suspended coroutine", NULL, 0, 0);
+            return NULL;
         }
-    } else {
-        written = snprintf(buffer, buffer_size, "%s: %s: %s", file, code, msg);
     }
-    if (written < 0) {
-        buffer[0] = '\0';
-        return 0;
+
+    luby_snapshot *snap = (luby_snapshot *)luby_alloc_raw(L, NULL, sizeof(luby_snapshot));
+    if (!snap) {
+        luby_set_error(L, LUBY_E_OOM, "oom", NULL, 0, 0);
+        return NULL;
     }
-    return (size_t)written;
+    luby_error err;
+    memset(&err, 0, sizeof(err));
+    snap->state = luby_state_copy(L, &err);
+    if (!snap->state) {
+        luby_alloc_raw(L, snap, 0);
+        if (err.code != LUBY_E_OK) L->last_error = err;
+        else luby_set_error(L, LUBY_E_OOM, "out of memory taking snapshot", NULL, 0, 0);
+        return NULL;
+    }
+    return snap;
 }
 
-LUBY_API luby_value luby_nil(void) { luby_value v; v.type = LUBY_T_NIL; v.as.ptr = NULL; return v; }
-LUBY_API luby_value luby_bool(int b) { luby_value v; v.type = LUBY_T_BOOL; v.as.b = !!b; return v; }
-LUBY_API luby_value luby_int(int64_t v) { luby_value r; r.type = LUBY_T_INT; r.as.i = v; return r; }
-LUBY_API luby_value luby_float(double v) { luby_value r; r.type = LUBY_T_FLOAT; r.as.f = v; return r; }
-LUBY_API luby_value luby_string(luby_state *L, const char *s, size_t len) {
-    luby_value v; v.type = LUBY_T_STRING;
-    if (!s) { v.as.ptr = NULL; return v; }
-    if (len == 0) len = strlen(s);
-    v.as.ptr = luby_gc_alloc_string(L, s, len);
-    return v;
-}
-LUBY_API luby_value luby_symbol(luby_state *L, const char *s, size_t len) {
-    luby_value v; v.type = LUBY_T_SYMBOL;
-    if (!s) { v.as.ptr = NULL; return v; }
-    v.as.ptr = (void *)luby_intern_symbol(L, s, len);
-    return v;
+LUBY_API luby_state *luby_clone(const luby_snapshot *snap) {
+    if (!snap || !snap->state) return NULL;
+    return luby_state_copy(snap->state, NULL);
 }
 
-LUBY_API void luby_set_global_value(luby_state *L, const char *name, luby_value v) {
-    if (!L || !name) return;
-    luby_string_view sv = { name, strlen(name) };
-    luby_set_global(L, sv, v);
+LUBY_API void luby_snapshot_free(luby_snapshot *snap) {
+    if (!snap) return;
+    luby_state *S = snap->state;
+    luby_alloc_raw(S, snap, 0);
+    luby_free(S);
 }
 
-LUBY_API luby_value luby_get_global_value(luby_state *L, const char *name) {
-    if (!L || !name) return luby_nil();
-    luby_string_view sv = { name, strlen(name) };
-    return luby_get_global(L, sv);
-}
+// ------------------------------- Actors ------------------------------------
+//
+// Objects shared between states (channels, actor jobs) live outside every GC
+// heap. Each is reference counted; a state holds its references through
+// wrapped userdata whose finalizer is luby_shared_release. Values travel
+// between states as messages: a flat, state-independent encoding of the
+// value tree that is decoded into the receiving state.
 
-LUBY_API luby_value luby_array_new(luby_state *L) {
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) return luby_nil();
-    arr->count = 0;
-    arr->capacity = 0;
-    arr->items = NULL;
-    arr->frozen = 0;
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = arr;
-    return v;
-}
+struct luby_shared {
+    long refs;
+    luby_alloc_fn alloc;
+    void *alloc_user;
+    luby_thread_api threads;
+    void *mutex;
+    void *cond;
+    void (*destroy)(luby_shared *sh);
+};
 
-LUBY_API size_t luby_array_len(luby_value arr) {
-    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return 0;
-    return ((luby_array *)arr.as.ptr)->count;
-}
+typedef struct luby_msg {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} luby_msg;
+
+typedef enum luby_msg_tag {
+    LUBY_MSG_NIL,
+    LUBY_MSG_TRUE,
+    LUBY_MSG_FALSE,
+    LUBY_MSG_INT,
+    LUBY_MSG_FLOAT,
+    LUBY_MSG_STRING,
+    LUBY_MSG_SYMBOL,
+    LUBY_MSG_ARRAY,
+    LUBY_MSG_HASH,
+    LUBY_MSG_RANGE,
+    LUBY_MSG_CHANNEL,
+    LUBY_MSG_VECTOR,
+    LUBY_MSG_BUFFER
+} luby_msg_tag;
+
+#define LUBY_MSG_FROZEN 0x80
+#define LUBY_MSG_MAX_DEPTH 64
+
+typedef struct luby_channel {
+    luby_shared sh;
+    luby_msg *items;   // ring buffer of pending messages
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+} luby_channel;
 
-LUBY_API int luby_array_get(luby_value arr, size_t index, luby_value *out) {
-    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *a = (luby_array *)arr.as.ptr;
-    if (index >= a->count) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-    if (out) *out = a->items[index];
-    return (int)LUBY_E_OK;
-}
+static void luby_channel_destroy(luby_shared *sh);
 
-LUBY_API int luby_array_set(luby_state *L, luby_value arr, size_t index, luby_value v) {
-    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *a = (luby_array *)arr.as.ptr;
-    if (a->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    if (index >= a->capacity) {
-        size_t new_cap = a->capacity < 8 ? 8 : a->capacity;
-        while (index >= new_cap) new_cap *= 2;
-        luby_value *ni = (luby_value *)luby_alloc_raw(L, a->items, new_cap * sizeof(luby_value));
-        if (!ni) return (int)LUBY_E_OOM;
-        for (size_t i = a->capacity; i < new_cap; i++) ni[i] = luby_nil();
-        a->items = ni;
-        a->capacity = new_cap;
-    }
-    if (index >= a->count) a->count = index + 1;
-    a->items[index] = v;
-    return (int)LUBY_E_OK;
-}
+struct luby_actor_pool {
+    const luby_snapshot *snap;
+    luby_thread_api threads;
+    luby_alloc_fn alloc;
+    void *alloc_user;
+    void *mutex;
+    void *cond;          // signalled when an actor finishes
+    luby_state **idle;   // worker states waiting for a job
+    size_t idle_count;
+    size_t idle_capacity;
+    size_t running;
+};
 
-LUBY_API int luby_array_push_value(luby_state *L, luby_value arr, luby_value v) {
-    return luby_array_set(L, arr, luby_array_len(arr), v);
+typedef struct luby_actor_job {
+    luby_shared sh;
+    luby_actor_pool *pool;   // valid until the job finishes
+    char *name;
+    luby_msg args;
+    luby_msg result;
+    int done;
+    int status;
+    char error[256];     // worker's formatted error
+    char message[320];   // error raised by Actor#value (lives with the job)
+} luby_actor_job;
+
+static void *luby_shared_alloc(luby_shared *sh, void *ptr, size_t size) {
+    return sh->alloc(sh->alloc_user, ptr, size);
+}
+
+static int luby_shared_init(luby_shared *sh, const luby_actor_pool *pool, void (*destroy)(luby_shared *sh)) {
+    sh->refs = 1;
+    sh->alloc = pool->alloc;
+    sh->alloc_user = pool->alloc_user;
+    sh->threads = pool->threads;
+    sh->destroy = destroy;
+    sh->mutex = sh->threads.mutex_new(sh->threads.user);
+    sh->cond = sh->threads.cond_new(sh->threads.user);
+    return sh->mutex && sh->cond;
+}
+
+static void luby_shared_retain(luby_shared *sh) {
+    LUBY_ATOMIC_ADD(&sh->refs, 1);
+}
+
+// Userdata finalizer for every shared object
+static void luby_shared_release(void *data) {
+    luby_shared *sh = (luby_shared *)data;
+    if (!sh || LUBY_ATOMIC_ADD(&sh->refs, -1) != 0) return;
+    sh->destroy(sh);
+    if (sh->mutex) sh->threads.mutex_free(sh->threads.user, sh->mutex);
+    if (sh->cond) sh->threads.cond_free(sh->threads.user, sh->cond);
+    luby_shared_alloc(sh, sh, 0);
+}
+
+static int luby_msg_write(luby_shared *sh, luby_msg *msg, const void *bytes, size_t n) {
+    if (msg->len + n > msg->cap) {
+        size_t cap = msg->cap ? msg->cap * 2 : 64;
+        while (cap < msg->len + n) cap *= 2;
+        unsigned char *data = (unsigned char *)luby_shared_alloc(sh, msg->data, cap);
+        if (!data) return 0;
+        msg->data = data;
+        msg->cap = cap;
+    }
+    memcpy(msg->data + msg->len, bytes, n);
+    msg->len += n;
+    return 1;
 }
 
-LUBY_API luby_value luby_hash_new(luby_state *L) {
-    luby_hash *h = (luby_hash *)luby_gc_alloc(L, sizeof(luby_hash), LUBY_GC_HASH);
-    if (!h) return luby_nil();
-    h->count = 0;
-    h->capacity = 0;
-    h->entries = NULL;
-    h->frozen = 0;
-    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = h;
-    return v;
+static int luby_msg_write_tag(luby_shared *sh, luby_msg *msg, int tag) {
+    unsigned char t = (unsigned char)tag;
+    return luby_msg_write(sh, msg, &t, 1);
 }
 
-LUBY_API size_t luby_hash_len(luby_value h) {
-    if (h.type != LUBY_T_HASH || !h.as.ptr) return 0;
-    return ((luby_hash *)h.as.ptr)->count;
+static int luby_msg_write_bytes(luby_shared *sh, luby_msg *msg, int tag, const char *s, size_t len) {
+    return luby_msg_write_tag(sh, msg, tag) && luby_msg_write(sh, msg, &len, sizeof(len)) && luby_msg_write(sh, msg, s, len);
 }
 
-LUBY_API int luby_hash_get_value(luby_value h, luby_value key, luby_value *out) {
-    if (h.type != LUBY_T_HASH || !h.as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *hh = (luby_hash *)h.as.ptr;
-    for (size_t i = 0; i < hh->count; i++) {
-        if (luby_value_eq(hh->entries[i].key, key)) {
-            if (out) *out = hh->entries[i].value;
-            return (int)LUBY_E_OK;
-        }
+static int luby_msg_encode(luby_state *L, luby_shared *sh, luby_msg *msg, luby_value v, int depth) {
+    if (depth > LUBY_MSG_MAX_DEPTH) {
+        luby_set_error(L, LUBY_E_RUNTIME, "value nested too deeply to send", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
     }
-    if (out) *out = luby_nil();
-    return (int)LUBY_E_OK;
-}
-
-LUBY_API int luby_hash_set_value(luby_state *L, luby_value h, luby_value key, luby_value value) {
-    if (h.type != LUBY_T_HASH || !h.as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *hh = (luby_hash *)h.as.ptr;
-    if (hh->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    for (size_t i = 0; i < hh->count; i++) {
-        if (luby_value_eq(hh->entries[i].key, key)) {
-            hh->entries[i].value = value;
-            return (int)LUBY_E_OK;
+    int ok = 1;
+    switch (v.type) {
+        case LUBY_T_NIL:
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_NIL);
+            break;
+        case LUBY_T_BOOL:
+            ok = luby_msg_write_tag(sh, msg, v.as.b ? LUBY_MSG_TRUE : LUBY_MSG_FALSE);
+            break;
+        case LUBY_T_INT:
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_INT) && luby_msg_write(sh, msg, &v.as.i, sizeof(v.as.i));
+            break;
+        case LUBY_T_FLOAT:
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_FLOAT) && luby_msg_write(sh, msg, &v.as.f, sizeof(v.as.f));
+            break;
+        case LUBY_T_STRING:
+            ok = luby_msg_write_bytes(sh, msg, LUBY_MSG_STRING, (const char *)v.as.ptr, LUBY_STRING_OBJ(v.as.ptr)->length);
+            break;
+        case LUBY_T_SYMBOL:
+            ok = luby_msg_write_bytes(sh, msg, LUBY_MSG_SYMBOL, (const char *)v.as.ptr, strlen((const char *)v.as.ptr));
+            break;
+        case LUBY_T_ARRAY: {
+            luby_array *arr = (luby_array *)v.as.ptr;
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_ARRAY | (arr->frozen ? LUBY_MSG_FROZEN : 0)) &&
+                 luby_msg_write(sh, msg, &arr->count, sizeof(arr->count));
+            for (size_t i = 0; ok && i < arr->count; i++) {
+                int rc = luby_msg_encode(L, sh, msg, arr->items[i], depth + 1);
+                if (rc != 0) return rc;
+            }
+            break;
+        }
+        case LUBY_T_HASH: {
+            luby_hash *h = (luby_hash *)v.as.ptr;
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_HASH | (h->frozen ? LUBY_MSG_FROZEN : 0)) &&
+                 luby_msg_write(sh, msg, &h->count, sizeof(h->count));
+            for (size_t i = 0; ok && i < h->count; i++) {
+                int rc = luby_msg_encode(L, sh, msg, h->entries[i].key, depth + 1);
+                if (rc == 0) rc = luby_msg_encode(L, sh, msg, h->entries[i].value, depth + 1);
+                if (rc != 0) return rc;
+            }
+            break;
+        }
+        case LUBY_T_RANGE: {
+            luby_range *r = (luby_range *)v.as.ptr;
+            unsigned char exclusive = (unsigned char)(r->exclusive != 0);
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_RANGE) && luby_msg_write(sh, msg, &exclusive, 1);
+            if (ok) {
+                int rc = luby_msg_encode(L, sh, msg, r->start, depth + 1);
+                if (rc == 0) rc = luby_msg_encode(L, sh, msg, r->end, depth + 1);
+                if (rc != 0) return rc;
+            }
+            break;
+        }
+        case LUBY_T_VECTOR: {
+            luby_vector *vec = (luby_vector *)v.as.ptr;
+            unsigned char kind = (unsigned char)vec->kind;
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_VECTOR) && luby_msg_write(sh, msg, &kind, 1) &&
+                 luby_msg_write(sh, msg, vec->c, (size_t)luby_vector_lengths[kind] * sizeof(float));
+            break;
+        }
+        case LUBY_T_BUFFER: {
+            // A view travels as a copy of just its elements
+            luby_buffer *buf = (luby_buffer *)v.as.ptr;
+            unsigned char kind = (unsigned char)buf->kind;
+            ok = luby_msg_write_tag(sh, msg, LUBY_MSG_BUFFER) && luby_msg_write(sh, msg, &kind, 1) &&
+                 luby_msg_write(sh, msg, &buf->length, sizeof(buf->length)) &&
+                 luby_msg_write(sh, msg, LUBY_BUFFER_DATA(buf), buf->length * luby_buffer_elem_sizes[kind]);
+            break;
+        }
+        case LUBY_T_USERDATA: {
+            luby_userdata *ud = (luby_userdata *)v.as.ptr;
+            if (ud && ud->alive && ud->finalize == luby_shared_release && ((luby_shared *)ud->data)->destroy == luby_channel_destroy) {
+                luby_shared *ch = (luby_shared *)ud->data;
+                ok = luby_msg_write_tag(sh, msg, LUBY_MSG_CHANNEL) && luby_msg_write(sh, msg, &ch, sizeof(ch));
+                if (ok) luby_shared_retain(ch);
+                break;
+            }
+        }
+        /* fall through */
+        default: {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "cannot send %s to another state", luby_type_name(v));
+            // Error messages are borrowed; interning keeps this one alive
+            luby_set_error(L, LUBY_E_TYPE, luby_intern_symbol(L, buf, 0), NULL, 0, 0);
+            return (int)LUBY_E_TYPE;
         }
     }
-    if (hh->count + 1 > hh->capacity) {
-        size_t new_cap = hh->capacity < 8 ? 8 : hh->capacity * 2;
-        luby_hash_entry *ne = (luby_hash_entry *)luby_alloc_raw(L, hh->entries, new_cap * sizeof(luby_hash_entry));
-        if (!ne) return (int)LUBY_E_OOM;
-        hh->entries = ne;
-        hh->capacity = new_cap;
+    if (!ok) {
+        luby_set_error(L, LUBY_E_OOM, "out of memory", NULL, 0, 0);
+        return (int)LUBY_E_OOM;
     }
-    hh->entries[hh->count].key = key;
-    hh->entries[hh->count].value = value;
-    hh->count++;
     return (int)LUBY_E_OK;
 }
 
-LUBY_API int luby_invoke_global(luby_state *L, const char *name, int argc, const luby_value *argv, luby_value *out) {
-    if (!L || !name) return (int)LUBY_E_RUNTIME;
-    luby_value saved_sbfc = L->saved_block_for_call;
-    
-    // First check for a Luby-defined proc in globals
-    luby_string_view sv = { name, strlen(name) };
-    luby_value gv = luby_get_global(L, sv);
-    if (gv.type == LUBY_T_PROC && gv.as.ptr) {
-        luby_proc *proc = (luby_proc *)gv.as.ptr;
-        luby_vm vm;
-        luby_vm_init(&vm);
-        luby_vm *saved_vm = L->current_vm;
-        L->current_vm = &vm;
-        
-        if (!luby_vm_push_frame(L, &vm, proc, &proc->chunk, name, luby_nil(), NULL, name, argc, argv, luby_nil(), 0)) {
-            L->current_vm = saved_vm;
-            luby_vm_free(L, &vm);
-            L->saved_block_for_call = saved_sbfc;
-            return (L->last_error.code != LUBY_E_OK) ? (int)L->last_error.code : (int)LUBY_E_OOM;
+// Drop the channel references a message holds. Containers are written as a
+// header followed by their elements, so one linear scan visits every node.
+static void luby_msg_free(luby_shared *sh, luby_msg *msg) {
+    const unsigned char *p = msg->data, *end = msg->data + msg->len;
+    while (p < end) {
+        int tag = *p++ & ~LUBY_MSG_FROZEN;
+        size_t n;
+        switch (tag) {
+            case LUBY_MSG_INT:
+            case LUBY_MSG_FLOAT: p += 8; break;
+            case LUBY_MSG_STRING:
+            case LUBY_MSG_SYMBOL: memcpy(&n, p, sizeof(n)); p += sizeof(n) + n; break;
+            case LUBY_MSG_ARRAY:
+            case LUBY_MSG_HASH: p += sizeof(size_t); break;
+            case LUBY_MSG_RANGE: p += 1; break;
+            case LUBY_MSG_VECTOR: p += 1 + (size_t)luby_vector_lengths[*p] * sizeof(float); break;
+            case LUBY_MSG_BUFFER: memcpy(&n, p + 1, sizeof(n)); p += 1 + sizeof(n) + n * luby_buffer_elem_sizes[*p]; break;
+            case LUBY_MSG_CHANNEL: {
+                luby_shared *ch;
+                memcpy(&ch, p, sizeof(ch));
+                p += sizeof(ch);
+                luby_shared_release(ch);
+                break;
+            }
+            default: break;
         }
-        
-        int rc = luby_vm_run(L, &vm, out);
-        L->current_vm = saved_vm;
-        luby_vm_free(L, &vm);
-        L->saved_block_for_call = saved_sbfc;
-        return rc;
-    }
-    
-    // Fall back to C function
-    luby_cfunc fn = luby_find_cfunc(L, name);
-    if (!fn) {
-        luby_set_error(L, LUBY_E_NAME, "undefined function", NULL, 0, 0);
-        return (int)LUBY_E_NAME;
     }
-    luby_value result = luby_nil();
-    int rc = fn(L, argc, argv, &result);
-    if (out) *out = result;
-    return rc;
+    luby_shared_alloc(sh, msg->data, 0);
+    msg->data = NULL;
+    msg->len = msg->cap = 0;
 }
 
-LUBY_API int luby_invoke_method(luby_state *L, luby_value recv, const char *method, int argc, const luby_value *argv, luby_value *out) {
-    if (!L || !method) return (int)LUBY_E_RUNTIME;
-    luby_value saved_sbfc = L->saved_block_for_call;
-    
-    luby_class_obj *cls = luby_get_receiver_class(recv);
-    
-    if (cls) {
-        // Check for singleton method first
-        luby_proc *m = NULL;
-        if (recv.type == LUBY_T_OBJECT) {
-            m = luby_object_get_singleton_method((luby_object *)recv.as.ptr, method);
-        } else if (recv.type == LUBY_T_CLASS || recv.type == LUBY_T_MODULE) {
-            m = luby_class_get_singleton_method(L, cls, method);
+static luby_value luby_channel_value(luby_state *L, luby_shared *ch) {
+    luby_value v = luby_wrap_userdata(L, ch, luby_shared_release);
+    if (v.type != LUBY_T_USERDATA) return v;
+    luby_shared_retain(ch);
+    luby_string_view name = { "Channel", 7 };
+    luby_value cls = luby_get_global(L, name);
+    if (cls.type == LUBY_T_CLASS) ((luby_userdata *)v.as.ptr)->klass = (luby_class_obj *)cls.as.ptr;
+    return v;
+}
+
+// Rebuild one encoded value in L. The caller pauses the GC.
+static int luby_msg_decode(luby_state *L, const unsigned char **pp, luby_value *out) {
+    const unsigned char *p = *pp;
+    int tag = *p++;
+    int frozen = (tag & LUBY_MSG_FROZEN) != 0;
+    size_t n = 0;
+    int rc = (int)LUBY_E_OK;
+    *out = luby_nil();
+    switch (tag & ~LUBY_MSG_FROZEN) {
+        case LUBY_MSG_NIL: break;
+        case LUBY_MSG_TRUE: *out = luby_bool(1); break;
+        case LUBY_MSG_FALSE: *out = luby_bool(0); break;
+        case LUBY_MSG_INT: {
+            int64_t i;
+            memcpy(&i, p, sizeof(i));
+            p += sizeof(i);
+            *out = luby_int(i);
+            break;
         }
-        if (!m) m = luby_class_get_method(L, cls, method);
-        
-        if (m) {
-            luby_vm vm;
-            luby_vm_init(&vm);
-            luby_vm *saved_vm = L->current_vm;
-            L->current_vm = &vm;
-            
-            if (!luby_vm_push_frame(L, &vm, m, &m->chunk, method, recv, cls, method, argc, argv, luby_nil(), 1)) {
-                L->current_vm = saved_vm;
-                luby_vm_free(L, &vm);
-                L->saved_block_for_call = saved_sbfc;
-                return (L->last_error.code != LUBY_E_OK) ? (int)L->last_error.code : (int)LUBY_E_OOM;
+        case LUBY_MSG_FLOAT: {
+            double f;
+            memcpy(&f, p, sizeof(f));
+            p += sizeof(f);
+            *out = luby_float(f);
+            break;
+        }
+        case LUBY_MSG_STRING:
+        case LUBY_MSG_SYMBOL:
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            *out = (tag == LUBY_MSG_STRING) ? luby_string(L, (const char *)p, n) : luby_symbol(L, (const char *)p, n);
+            p += n;
+            if (out->type == LUBY_T_NIL) rc = (int)LUBY_E_OOM;
+            break;
+        case LUBY_MSG_ARRAY: {
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            *out = luby_array_new(L);
+            if (out->type != LUBY_T_ARRAY) { rc = (int)LUBY_E_OOM; break; }
+            for (size_t i = 0; i < n && rc == 0; i++) {
+                luby_value item;
+                rc = luby_msg_decode(L, &p, &item);
+                if (rc == 0) rc = luby_array_push_value(L, *out, item);
             }
-            
-            int rc = luby_vm_run(L, &vm, out);
-            L->current_vm = saved_vm;
-            luby_vm_free(L, &vm);
-            L->saved_block_for_call = saved_sbfc;
-            return rc;
+            ((luby_array *)out->as.ptr)->frozen = frozen;
+            break;
         }
-        
-        // Check for native method (CMETHOD)
-        luby_value method_val = luby_class_lookup_method(L, cls, method);
-        if (method_val.type == LUBY_T_CMETHOD && method_val.as.ptr) {
-            luby_cmethod *cm = (luby_cmethod *)method_val.as.ptr;
-            // Build args with receiver at front
-            luby_value *full_argv = (luby_value *)luby_alloc_raw(L, NULL, (argc + 1) * sizeof(luby_value));
-            if (!full_argv) return (int)LUBY_E_OOM;
-            full_argv[0] = recv;
-            for (int i = 0; i < argc; i++) full_argv[i + 1] = argv[i];
-            luby_value result = luby_nil();
-            int rc = cm->fn(L, argc + 1, full_argv, &result);
-            luby_alloc_raw(L, full_argv, 0);
-            if (out) *out = result;
-            return rc;
+        case LUBY_MSG_HASH: {
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            *out = luby_hash_new(L);
+            if (out->type != LUBY_T_HASH) { rc = (int)LUBY_E_OOM; break; }
+            for (size_t i = 0; i < n && rc == 0; i++) {
+                luby_value key, value;
+                rc = luby_msg_decode(L, &p, &key);
+                if (rc == 0) rc = luby_msg_decode(L, &p, &value);
+                if (rc == 0) rc = luby_hash_set_value(L, *out, key, value);
+            }
+            ((luby_hash *)out->as.ptr)->frozen = frozen;
+            break;
+        }
+        case LUBY_MSG_RANGE: {
+            luby_range *r = (luby_range *)luby_gc_alloc(L, sizeof(luby_range), LUBY_GC_RANGE);
+            if (!r) { rc = (int)LUBY_E_OOM; break; }
+            r->exclusive = *p++;
+            r->start = r->end = luby_nil();
+            rc = luby_msg_decode(L, &p, &r->start);
+            if (rc == 0) rc = luby_msg_decode(L, &p, &r->end);
+            out->type = LUBY_T_RANGE;
+            out->as.ptr = r;
+            break;
         }
+        case LUBY_MSG_CHANNEL: {
+            luby_shared *ch;
+            memcpy(&ch, p, sizeof(ch));
+            p += sizeof(ch);
+            *out = luby_channel_value(L, ch);
+            if (out->type != LUBY_T_USERDATA) rc = (int)LUBY_E_OOM;
+            break;
+        }
+        case LUBY_MSG_VECTOR: {
+            luby_vector_kind kind = (luby_vector_kind)*p++;
+            luby_vector *vec = luby_vector_alloc(L, kind);
+            if (!vec) { rc = (int)LUBY_E_OOM; break; }
+            memcpy(vec->c, p, (size_t)luby_vector_lengths[kind] * sizeof(float));
+            p += (size_t)luby_vector_lengths[kind] * sizeof(float);
+            out->type = LUBY_T_VECTOR;
+            out->as.ptr = vec;
+            break;
+        }
+        case LUBY_MSG_BUFFER: {
+            luby_buffer_kind kind = (luby_buffer_kind)*p++;
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            luby_buffer *buf = luby_buffer_alloc(L, kind, n, NULL, 0);
+            if (!buf) { rc = (int)LUBY_E_OOM; break; }
+            memcpy(buf->items, p, n * luby_buffer_elem_sizes[kind]);
+            p += n * luby_buffer_elem_sizes[kind];
+            out->type = LUBY_T_BUFFER;
+            out->as.ptr = buf;
+            break;
+        }
+        default:
+            rc = (int)LUBY_E_RUNTIME;
+            break;
     }
-    
-    luby_set_error(L, LUBY_E_NAME, "undefined method", NULL, 0, 0);
-    return (int)LUBY_E_NAME;
+    *pp = p;
+    return rc;
 }
 
-LUBY_API int luby_call(luby_state *L, luby_value recv, const char *method, int argc, const luby_value *argv, luby_value *out) {
-    // If recv is nil, call as global function
-    if (recv.type == LUBY_T_NIL) {
-        return luby_invoke_global(L, method, argc, argv, out);
-    }
-    return luby_invoke_method(L, recv, method, argc, argv, out);
+static int luby_msg_to_value(luby_state *L, const luby_msg *msg, luby_value *out) {
+    const unsigned char *p = msg->data;
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    int rc = luby_msg_decode(L, &p, out);
+    L->gc_paused = was_paused;
+    if (rc != 0) luby_set_error(L, (luby_error_code)rc, "could not receive value", NULL, 0, 0);
+    return rc;
 }
 
-LUBY_API int luby_register_function(luby_state *L, const char *name, luby_cfunc fn) {
-    if (!L || !name || !fn) return (int)LUBY_E_RUNTIME;
-    if (L->cfuncs.count + 1 > L->cfuncs.capacity) {
-        size_t new_cap = L->cfuncs.capacity < 8 ? 8 : L->cfuncs.capacity * 2;
-        const char **nn = (const char **)luby_alloc_raw(L, L->cfuncs.names, new_cap * sizeof(char *));
-        luby_cfunc *nf = (luby_cfunc *)luby_alloc_raw(L, L->cfuncs.funcs, new_cap * sizeof(luby_cfunc));
-        if (!nn || !nf) return (int)LUBY_E_OOM;
-        L->cfuncs.names = nn;
-        L->cfuncs.funcs = nf;
-        L->cfuncs.capacity = new_cap;
-    }
-    L->cfuncs.names[L->cfuncs.count] = name;
-    L->cfuncs.funcs[L->cfuncs.count] = fn;
-    L->cfuncs.count++;
-    return (int)LUBY_E_OK;
+static void luby_channel_destroy(luby_shared *sh) {
+    luby_channel *ch = (luby_channel *)sh;
+    for (size_t i = 0; i < ch->count; i++) luby_msg_free(sh, &ch->items[(ch->head + i) % ch->capacity]);
+    luby_shared_alloc(sh, ch->items, 0);
 }
 
-LUBY_API int luby_register_module(luby_state *L, const char *name, luby_cfunc loader) {
-    return luby_register_function(L, name, loader);
+static void luby_actor_job_destroy(luby_shared *sh) {
+    luby_actor_job *job = (luby_actor_job *)sh;
+    luby_msg_free(sh, &job->args);
+    luby_msg_free(sh, &job->result);
+    luby_shared_alloc(sh, job->name, 0);
 }
 
-// --------------------------- Base Stdlib -----------------------------------
+// Shared object behind a Channel/Actor receiver, or NULL
+static luby_shared *luby_shared_arg(luby_state *L, luby_value v, void (*destroy)(luby_shared *sh), const char *expected) {
+    luby_userdata *ud = v.type == LUBY_T_USERDATA ? (luby_userdata *)v.as.ptr : NULL;
+    if (ud && ud->alive && ud->finalize == luby_shared_release && ((luby_shared *)ud->data)->destroy == destroy) {
+        return (luby_shared *)ud->data;
+    }
+    luby_set_error(L, LUBY_E_TYPE, expected, NULL, 0, 0);
+    return NULL;
+}
 
-static int luby_base_print(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    for (int i = 0; i < argc; i++) {
-        if (i > 0) printf(" ");
-        luby_print_value(argv[i]);
+static int luby_channel_new_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_actor_pool *pool = L->actors;
+    int64_t capacity = (argc >= 1 && argv[0].type == LUBY_T_INT) ? argv[0].as.i : 16;
+    if (capacity < 1) {
+        luby_set_error(L, LUBY_E_RUNTIME, "channel capacity must be positive", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
     }
-    if (out) *out = luby_nil();
+    luby_channel *ch = (luby_channel *)pool->alloc(pool->alloc_user, NULL, sizeof(luby_channel));
+    if (!ch) return (int)LUBY_E_OOM;
+    memset(ch, 0, sizeof(*ch));
+    int ok = luby_shared_init(&ch->sh, pool, luby_channel_destroy);
+    ch->capacity = (size_t)capacity;
+    ch->items = ok ? (luby_msg *)luby_shared_alloc(&ch->sh, NULL, ch->capacity * sizeof(luby_msg)) : NULL;
+    luby_value v = ch->items ? luby_channel_value(L, &ch->sh) : luby_nil();
+    luby_shared_release(&ch->sh);  // the userdata holds the only reference
+    if (v.type != LUBY_T_USERDATA) return (int)LUBY_E_OOM;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_puts(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc == 0) {
-        printf("\n");
-    } else {
-        for (int i = 0; i < argc; i++) {
-            luby_print_value(argv[i]);
-            printf("\n");
-        }
+// Channel#push / Channel#<<: blocks while the channel is full
+static int luby_channel_push_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_channel_destroy, "expected a Channel") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    luby_channel *ch = (luby_channel *)sh;
+    luby_msg msg = { NULL, 0, 0 };
+    int rc = luby_msg_encode(L, sh, &msg, argc >= 2 ? argv[1] : luby_nil(), 0);
+    if (rc != 0) {
+        luby_msg_free(sh, &msg);
+        return rc;
     }
-    if (out) *out = luby_nil();
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    while (ch->count == ch->capacity && !ch->closed) sh->threads.wait(sh->threads.user, sh->cond, sh->mutex);
+    int closed = ch->closed;
+    if (!closed) {
+        ch->items[(ch->head + ch->count) % ch->capacity] = msg;
+        ch->count++;
+        sh->threads.broadcast(sh->threads.user, sh->cond);
+    }
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    if (closed) {
+        luby_msg_free(sh, &msg);
+        luby_set_error(L, LUBY_E_RUNTIME, "push to a closed channel", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_type(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (out) {
-        *out = luby_string(L, luby_type_name(argv[0]), 0);
-    }
+// Channel#pop: blocks while the channel is empty; nil once closed and drained
+static int luby_channel_pop_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_channel_destroy, "expected a Channel") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    luby_channel *ch = (luby_channel *)sh;
+    luby_msg msg = { NULL, 0, 0 };
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    while (ch->count == 0 && !ch->closed) sh->threads.wait(sh->threads.user, sh->cond, sh->mutex);
+    if (ch->count > 0) {
+        msg = ch->items[ch->head];
+        ch->head = (ch->head + 1) % ch->capacity;
+        ch->count--;
+        sh->threads.broadcast(sh->threads.user, sh->cond);
+    }
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    luby_value v = luby_nil();
+    int rc = msg.data ? luby_msg_to_value(L, &msg, &v) : (int)LUBY_E_OK;
+    luby_msg_free(sh, &msg);
+    if (out) *out = v;
+    return rc;
+}
+
+static int luby_channel_close_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_channel_destroy, "expected a Channel") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    ((luby_channel *)sh)->closed = 1;
+    sh->threads.broadcast(sh->threads.user, sh->cond);
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_to_i(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value v = argv[0];
-    if (v.type == LUBY_T_INT) { if (out) *out = v; return (int)LUBY_E_OK; }
-    if (v.type == LUBY_T_FLOAT) { if (out) *out = luby_int((int64_t)v.as.f); return (int)LUBY_E_OK; }
-    if (v.type == LUBY_T_STRING && v.as.ptr) { if (out) *out = luby_int(strtoll((const char *)v.as.ptr, NULL, 10)); return (int)LUBY_E_OK; }
-    if (out) *out = luby_int(0);
+static int luby_channel_closed_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_channel_destroy, "expected a Channel") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    int closed = ((luby_channel *)sh)->closed;
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    if (out) *out = luby_bool(closed);
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_to_f(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value v = argv[0];
-    if (v.type == LUBY_T_FLOAT) { if (out) *out = v; return (int)LUBY_E_OK; }
-    if (v.type == LUBY_T_INT) { if (out) *out = luby_float((double)v.as.i); return (int)LUBY_E_OK; }
-    if (v.type == LUBY_T_STRING && v.as.ptr) { if (out) *out = luby_float(strtod((const char *)v.as.ptr, NULL)); return (int)LUBY_E_OK; }
-    if (out) *out = luby_float(0.0);
+static int luby_channel_size_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_channel_destroy, "expected a Channel") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    size_t count = ((luby_channel *)sh)->count;
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    if (out) *out = luby_int((int64_t)count);
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_len(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value v = argv[0];
-    if (v.type == LUBY_T_STRING && v.as.ptr) {
-        if (out) *out = luby_int((int64_t)strlen((const char *)v.as.ptr));
-        return (int)LUBY_E_OK;
+// Worker state for one job: an idle one, or a fresh clone of the snapshot
+static luby_state *luby_actor_pool_acquire(luby_actor_pool *pool) {
+    luby_state *W = NULL;
+    pool->threads.lock(pool->threads.user, pool->mutex);
+    if (pool->idle_count > 0) W = pool->idle[--pool->idle_count];
+    pool->threads.unlock(pool->threads.user, pool->mutex);
+    if (W) return W;
+    W = luby_clone(pool->snap);
+    if (W && luby_set_actor_pool(W, pool) != 0) {
+        luby_free(W);
+        W = NULL;
+    }
+    return W;
+}
+
+static void luby_actor_pool_return(luby_actor_pool *pool, luby_state *W) {
+    luby_clear_error(W);
+    pool->threads.lock(pool->threads.user, pool->mutex);
+    if (pool->idle_count == pool->idle_capacity) {
+        size_t cap = pool->idle_capacity ? pool->idle_capacity * 2 : 8;
+        luby_state **idle = (luby_state **)pool->alloc(pool->alloc_user, pool->idle, cap * sizeof(luby_state *));
+        if (idle) {
+            pool->idle = idle;
+            pool->idle_capacity = cap;
+        }
+    }
+    if (pool->idle_count < pool->idle_capacity) {
+        pool->idle[pool->idle_count++] = W;
+        W = NULL;
+    }
+    pool->threads.unlock(pool->threads.user, pool->mutex);
+    if (W) luby_free(W);
+}
+
+// Thread entry: decode the arguments in a worker, call the function, and
+// encode its result (or error) for Actor#value
+static void luby_actor_run(void *arg) {
+    luby_actor_job *job = (luby_actor_job *)arg;
+    luby_actor_pool *pool = job->pool;
+    luby_msg result = { NULL, 0, 0 };
+    int status;
+    char error[256] = "";
+    luby_state *W = luby_actor_pool_acquire(pool);
+    if (!W) {
+        status = (int)LUBY_E_OOM;
+        snprintf(error, sizeof(error), "could not create a worker state");
+    } else {
+        size_t base = W->gc_temp_count;
+        luby_value args = luby_nil(), rv = luby_nil();
+        status = luby_msg_to_value(W, &job->args, &args);
+        if (status == 0 && !luby_gc_push_temp(W, args)) status = (int)LUBY_E_OOM;
+        if (status == 0) {
+            luby_array *arr = (luby_array *)args.as.ptr;
+            status = luby_invoke_global(W, job->name, (int)arr->count, arr->items, &rv);
+        }
+        if (status == 0) status = luby_msg_encode(W, &job->sh, &result, rv, 0);
+        W->gc_temp_count = base;
+        if (status != 0) luby_format_error(W, error, sizeof(error));
+        luby_actor_pool_return(pool, W);
+    }
+
+    luby_shared *sh = &job->sh;
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    job->result = result;
+    job->status = status;
+    memcpy(job->error, error, sizeof(error));
+    job->done = 1;
+    job->pool = NULL;
+    sh->threads.broadcast(sh->threads.user, sh->cond);
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    luby_shared_release(sh);
+
+    pool->threads.lock(pool->threads.user, pool->mutex);
+    pool->running--;
+    pool->threads.broadcast(pool->threads.user, pool->cond);
+    pool->threads.unlock(pool->threads.user, pool->mutex);
+}
+
+// spawn(:name, args...) -> Actor
+static int luby_actor_spawn_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_actor_pool *pool = L->actors;
+    if (argc < 1 || (argv[0].type != LUBY_T_SYMBOL && argv[0].type != LUBY_T_STRING)) {
+        luby_set_error(L, LUBY_E_TYPE, "spawn expects a function name", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (v.type == LUBY_T_ARRAY && v.as.ptr) {
-        luby_array *arr = (luby_array *)v.as.ptr;
-        if (out) *out = luby_int((int64_t)arr->count);
-        return (int)LUBY_E_OK;
+    luby_actor_job *job = (luby_actor_job *)pool->alloc(pool->alloc_user, NULL, sizeof(luby_actor_job));
+    if (!job) return (int)LUBY_E_OOM;
+    memset(job, 0, sizeof(*job));
+    if (!luby_shared_init(&job->sh, pool, luby_actor_job_destroy)) {
+        luby_shared_release(&job->sh);
+        return (int)LUBY_E_OOM;
     }
-    if (v.type == LUBY_T_HASH && v.as.ptr) {
-        luby_hash *h = (luby_hash *)v.as.ptr;
-        if (out) *out = luby_int((int64_t)h->count);
-        return (int)LUBY_E_OK;
+    job->pool = pool;
+    const char *name = (const char *)argv[0].as.ptr;
+    size_t len = strlen(name);
+    job->name = (char *)luby_shared_alloc(&job->sh, NULL, len + 1);
+    if (!job->name) {
+        luby_shared_release(&job->sh);
+        return (int)LUBY_E_OOM;
     }
-    if (v.type == LUBY_T_RANGE && v.as.ptr) {
-        luby_range *r = (luby_range *)v.as.ptr;
-        if (r->start.type == LUBY_T_INT && r->end.type == LUBY_T_INT) {
-            int64_t s = r->start.as.i, e = r->end.as.i;
-            if (r->exclusive) e--;
-            int64_t count = (e >= s) ? (e - s + 1) : 0;
-            if (out) *out = luby_int(count);
-        } else {
-            if (out) *out = luby_int(0);
-        }
-        return (int)LUBY_E_OK;
+    memcpy(job->name, name, len + 1);
+
+    // Arguments travel as one array message
+    size_t count = (size_t)(argc - 1);
+    int rc = luby_msg_write_tag(&job->sh, &job->args, LUBY_MSG_ARRAY) &&
+             luby_msg_write(&job->sh, &job->args, &count, sizeof(count)) ? (int)LUBY_E_OK : (int)LUBY_E_OOM;
+    for (int i = 1; i < argc && rc == 0; i++) rc = luby_msg_encode(L, &job->sh, &job->args, argv[i], 0);
+    luby_value v = rc == 0 ? luby_wrap_userdata(L, job, luby_shared_release) : luby_nil();
+    if (v.type != LUBY_T_USERDATA) {
+        luby_shared_release(&job->sh);
+        return rc != 0 ? rc : (int)LUBY_E_OOM;
+    }
+    luby_string_view cls_name = { "Actor", 5 };
+    luby_value cls = luby_get_global(L, cls_name);
+    if (cls.type == LUBY_T_CLASS) ((luby_userdata *)v.as.ptr)->klass = (luby_class_obj *)cls.as.ptr;
+
+    // One reference for the userdata (taken above), one for the running job
+    luby_shared_retain(&job->sh);
+    pool->threads.lock(pool->threads.user, pool->mutex);
+    pool->running++;
+    pool->threads.unlock(pool->threads.user, pool->mutex);
+    if (pool->threads.submit(pool->threads.user, luby_actor_run, job) != 0) {
+        pool->threads.lock(pool->threads.user, pool->mutex);
+        pool->running--;
+        pool->threads.unlock(pool->threads.user, pool->mutex);
+        luby_shared_release(&job->sh);
+        luby_set_error(L, LUBY_E_RUNTIME, "could not submit actor to the thread pool", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
     }
-    if (out) *out = luby_int(0);
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_push(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    if (arr->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    luby_value v = argv[1];
-    if (arr->count + 1 > arr->capacity) {
-        size_t new_cap = arr->capacity < 8 ? 8 : arr->capacity * 2;
-        luby_value *ni = (luby_value *)luby_alloc_raw(L, arr->items, new_cap * sizeof(luby_value));
-        if (!ni) return (int)LUBY_E_OOM;
-        arr->items = ni;
-        arr->capacity = new_cap;
+// Actor#value: waits for the actor and returns a copy of its result, or
+// raises the actor's error
+static int luby_actor_value_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_actor_job_destroy, "expected an Actor") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    luby_actor_job *job = (luby_actor_job *)sh;
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    while (!job->done) sh->threads.wait(sh->threads.user, sh->cond, sh->mutex);
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    if (job->status != 0) {
+        snprintf(job->message, sizeof(job->message), "actor %s failed: %s", job->name, job->error);
+        luby_set_error(L, LUBY_E_RUNTIME, job->message, NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
     }
-    arr->items[arr->count++] = v;
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+    luby_value v = luby_nil();
+    int rc = luby_msg_to_value(L, &job->result, &v);
+    if (out) *out = v;
+    return rc;
 }
 
-static int luby_array_pop(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    if (arr->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    if (arr->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-    luby_value v = arr->items[--arr->count];
-    if (out) *out = v;
+static int luby_actor_done_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_shared *sh = argc >= 1 ? luby_shared_arg(L, argv[0], luby_actor_job_destroy, "expected an Actor") : NULL;
+    if (!sh) return (int)LUBY_E_TYPE;
+    sh->threads.lock(sh->threads.user, sh->mutex);
+    int done = ((luby_actor_job *)sh)->done;
+    sh->threads.unlock(sh->threads.user, sh->mutex);
+    if (out) *out = luby_bool(done);
     return (int)LUBY_E_OK;
 }
 
-enum {
-    LUBY_ENUM_ARRAY = 0,
-    LUBY_ENUM_ARRAY_WITH_INDEX = 1,
-    LUBY_ENUM_HASH = 2
-};
-
-static luby_value luby_enum_new(luby_state *L, luby_value target, int kind) {
-    luby_string_view name = { "Enumerator", 10 };
-    luby_value cv = luby_get_global(L, name);
-    luby_class_obj *cls = NULL;
-    if (cv.type == LUBY_T_CLASS && cv.as.ptr) {
-        cls = (luby_class_obj *)cv.as.ptr;
-    } else {
-        cls = luby_class_new(L, "Enumerator", NULL);
-        if (!cls) return luby_nil();
-        luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
-        luby_set_global(L, name, v);
+LUBY_API luby_actor_pool *luby_actor_pool_new(const luby_snapshot *snap, const luby_thread_api *threads) {
+    if (!snap || !threads || !threads->submit) return NULL;
+    luby_state *S = snap->state;
+    luby_alloc_fn alloc = S->cfg.alloc ? S->cfg.alloc : luby_default_alloc;
+    luby_actor_pool *pool = (luby_actor_pool *)alloc(S->cfg.alloc_user, NULL, sizeof(luby_actor_pool));
+    if (!pool) return NULL;
+    memset(pool, 0, sizeof(*pool));
+    pool->snap = snap;
+    pool->threads = *threads;
+    pool->alloc = alloc;
+    pool->alloc_user = S->cfg.alloc_user;
+    pool->mutex = threads->mutex_new(threads->user);
+    pool->cond = threads->cond_new(threads->user);
+    if (!pool->mutex || !pool->cond) {
+        luby_actor_pool_free(pool);
+        return NULL;
     }
-    luby_object *obj = luby_object_new(L, cls);
-    if (!obj) return luby_nil();
-    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
-
-    luby_value key_target = luby_symbol(L, "_enum_target", 0);
-    luby_value key_index = luby_symbol(L, "_enum_index", 0);
-    luby_value key_kind = luby_symbol(L, "_enum_kind", 0);
-    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_target, target);
-    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_index, luby_int(0));
-    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_kind, luby_int(kind));
-    return ov;
-}
-
-static int luby_enum_get_field(luby_state *L, luby_object *obj, const char *name, luby_value *out) {
-    if (!obj || !obj->ivars) return (int)LUBY_E_TYPE;
-    luby_value key = luby_symbol(L, name, 0);
-    return luby_hash_get_value((luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key, out);
-}
-
-static int luby_enum_set_field(luby_state *L, luby_object *obj, const char *name, luby_value val) {
-    if (!obj || !obj->ivars) return (int)LUBY_E_TYPE;
-    luby_value key = luby_symbol(L, name, 0);
-    return luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key, val);
+    return pool;
+}
+
+LUBY_API void luby_actor_pool_free(luby_actor_pool *pool) {
+    if (!pool) return;
+    const luby_thread_api *t = &pool->threads;
+    if (pool->mutex && pool->cond) {
+        t->lock(t->user, pool->mutex);
+        while (pool->running > 0) t->wait(t->user, pool->cond, pool->mutex);
+        t->unlock(t->user, pool->mutex);
+    }
+    for (size_t i = 0; i < pool->idle_count; i++) luby_free(pool->idle[i]);
+    pool->alloc(pool->alloc_user, pool->idle, 0);
+    if (pool->mutex) t->mutex_free(t->user, pool->mutex);
+    if (pool->cond) t->cond_free(t->user, pool->cond);
+    pool->alloc(pool->alloc_user, pool, 0);
+}
+
+LUBY_API int luby_set_actor_pool(luby_state *L, luby_actor_pool *pool) {
+    if (!L || !pool) return (int)LUBY_E_RUNTIME;
+    L->actors = pool;
+    luby_register_function(L, "spawn", luby_actor_spawn_cfunc);
+    luby_register_function(L, "channel_new", luby_channel_new_cfunc);
+    int rc = luby_eval(L,
+        "class Actor\n"
+        "end\n"
+        "class Channel\n"
+        " def self.new(capacity = 16)\n"
+        "  channel_new(capacity)\n"
+        " end\n"
+        "end\n",
+        0, "<actors>", NULL);
+    if (rc != 0) return rc;
+    luby_class *actor = luby_define_class(L, "Actor", NULL);
+    luby_class *channel = luby_define_class(L, "Channel", NULL);
+    int ok = actor && channel;
+    ok = ok && luby_define_method(L, actor, "value", luby_actor_value_cfunc);
+    ok = ok && luby_define_method(L, actor, "done?", luby_actor_done_cfunc);
+    ok = ok && luby_define_method(L, channel, "push", luby_channel_push_cfunc);
+    ok = ok && luby_define_method(L, channel, "<<", luby_channel_push_cfunc);
+    ok = ok && luby_define_method(L, channel, "pop", luby_channel_pop_cfunc);
+    ok = ok && luby_define_method(L, channel, "close", luby_channel_close_cfunc);
+    ok = ok && luby_define_method(L, channel, "closed?", luby_channel_closed_cfunc);
+    ok = ok && luby_define_method(L, channel, "size", luby_channel_size_cfunc);
+    luby_alloc_raw(L, actor, 0);
+    luby_alloc_raw(L, channel, 0);
+    return ok ? (int)LUBY_E_OK : (int)LUBY_E_OOM;
 }
 
-static luby_value luby_make_pair_array(luby_state *L, luby_value a, luby_value b) {
-    luby_value arrv = luby_array_new(L);
-    if (arrv.type != LUBY_T_ARRAY || !arrv.as.ptr) return luby_nil();
-    luby_array_set(L, arrv, 0, a);
-    luby_array_set(L, arrv, 1, b);
-    return arrv;
-}
+LUBY_API int luby_require(luby_state *L, const char *path, luby_value *out) {
+    if (!L || !path) return (int)LUBY_E_RUNTIME;
+    if (!L->cfg.vfs.read || !L->cfg.vfs.exists) {
+        luby_set_error(L, LUBY_E_IO, "vfs not configured", NULL, 0, 0);
+        return (int)LUBY_E_IO;
+    }
 
-static int luby_enum_next(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_value target = luby_nil();
-    luby_value indexv = luby_nil();
-    luby_value kindv = luby_nil();
-    if (luby_enum_get_field(L, obj, "_enum_target", &target) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
-    if (luby_enum_get_field(L, obj, "_enum_index", &indexv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
-    if (luby_enum_get_field(L, obj, "_enum_kind", &kindv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+    const char *candidate = path;
+    size_t path_len = strlen(path);
+    char *with_ext = NULL;
+    if (path_len < 3 || strcmp(path + path_len - 3, ".rb") != 0) {
+        with_ext = (char *)luby_alloc_raw(L, NULL, path_len + 4);
+        if (with_ext) {
+            memcpy(with_ext, path, path_len);
+            memcpy(with_ext + path_len, ".rb", 4);
+        }
+    }
 
-    if (indexv.type != LUBY_T_INT || kindv.type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    int64_t idx = indexv.as.i;
-    int kind = (int)kindv.as.i;
+    char fullpath[1024];
+    const char *resolved = NULL;
 
-    if (kind == LUBY_ENUM_ARRAY || kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
-        if (target.type != LUBY_T_ARRAY || !target.as.ptr) return (int)LUBY_E_TYPE;
-        luby_array *arr = (luby_array *)target.as.ptr;
-        if (idx < 0 || (size_t)idx >= arr->count) {
-            luby_set_error(L, LUBY_E_RUNTIME, "stop iteration", NULL, 0, 0);
-            return (int)LUBY_E_RUNTIME;
-        }
-        luby_value v = arr->items[idx];
-        idx++;
-        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
-        if (kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
-            if (out) *out = luby_make_pair_array(L, v, luby_int(idx - 1));
-        } else {
-            if (out) *out = v;
+    if (L->cfg.vfs.exists(L->cfg.vfs.user, candidate)) {
+        resolved = candidate;
+    } else if (with_ext && L->cfg.vfs.exists(L->cfg.vfs.user, with_ext)) {
+        resolved = with_ext;
+    } else {
+        for (size_t i = 0; i < L->search_path_count && !resolved; i++) {
+            const char *base = L->search_paths[i];
+            if (!base) continue;
+            size_t blen = strlen(base);
+            snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", candidate);
+            if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
+            if (with_ext) {
+                snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", with_ext);
+                if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
+            }
         }
-        return (int)LUBY_E_OK;
     }
 
-    if (kind == LUBY_ENUM_HASH) {
-        if (target.type != LUBY_T_HASH || !target.as.ptr) return (int)LUBY_E_TYPE;
-        luby_hash *h = (luby_hash *)target.as.ptr;
-        if (idx < 0 || (size_t)idx >= h->count) {
-            luby_set_error(L, LUBY_E_RUNTIME, "stop iteration", NULL, 0, 0);
-            return (int)LUBY_E_RUNTIME;
-        }
-        luby_hash_entry *e = &h->entries[idx];
-        idx++;
-        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
-        if (out) *out = luby_make_pair_array(L, e->key, e->value);
+    if (!resolved) {
+        luby_set_error(L, LUBY_E_IO, "module not found", path, 0, 0);
+        luby_alloc_raw(L, with_ext, 0);
+        return (int)LUBY_E_IO;
+    }
+
+    if (luby_string_list_contains(L->loaded_paths, L->loaded_count, resolved)) {
+        luby_alloc_raw(L, with_ext, 0);
+        if (out) *out = luby_bool(0);
         return (int)LUBY_E_OK;
     }
 
-    return (int)LUBY_E_TYPE;
-}
+    size_t size = 0;
+    char *code = L->cfg.vfs.read(L->cfg.vfs.user, resolved, &size);
+    if (!code) {
+        luby_set_error(L, LUBY_E_IO, "read failed", resolved, 0, 0);
+        luby_alloc_raw(L, with_ext, 0);
+        return (int)LUBY_E_IO;
+    }
 
-static int luby_enum_rewind(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_enum_set_field(L, obj, "_enum_index", luby_int(0));
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+    luby_string_list_add(L, &L->loaded_paths, &L->loaded_count, &L->loaded_capacity, resolved);
+    luby_value res;
+    int rc = luby_eval(L, code, size, resolved, &res);
+    L->cfg.alloc ? L->cfg.alloc(L->cfg.alloc_user, code, 0) : luby_default_alloc(NULL, code, 0);
+    luby_alloc_raw(L, with_ext, 0);
+    if (out) *out = luby_bool(rc == 0);
+    return rc;
 }
 
-static int luby_enum_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+LUBY_API int luby_load(luby_state *L, const char *path, luby_value *out) {
+    if (!L || !path) return (int)LUBY_E_RUNTIME;
+    if (!L->cfg.vfs.read || !L->cfg.vfs.exists) {
+        luby_set_error(L, LUBY_E_IO, "vfs not configured", NULL, 0, 0);
+        return (int)LUBY_E_IO;
+    }
 
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_value target = luby_nil();
-    luby_value indexv = luby_nil();
-    luby_value kindv = luby_nil();
-    if (luby_enum_get_field(L, obj, "_enum_target", &target) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
-    if (luby_enum_get_field(L, obj, "_enum_index", &indexv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
-    if (luby_enum_get_field(L, obj, "_enum_kind", &kindv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+    const char *candidate = path;
+    size_t path_len = strlen(path);
+    char *with_ext = NULL;
+    if (path_len < 3 || strcmp(path + path_len - 3, ".rb") != 0) {
+        with_ext = (char *)luby_alloc_raw(L, NULL, path_len + 4);
+        if (with_ext) {
+            memcpy(with_ext, path, path_len);
+            memcpy(with_ext + path_len, ".rb", 4);
+        }
+    }
 
-    if (indexv.type != LUBY_T_INT || kindv.type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    int64_t idx = indexv.as.i;
-    int kind = (int)kindv.as.i;
+    char fullpath[1024];
+    const char *resolved = NULL;
 
-    if (kind == LUBY_ENUM_ARRAY || kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
-        if (target.type != LUBY_T_ARRAY || !target.as.ptr) return (int)LUBY_E_TYPE;
-        luby_array *arr = (luby_array *)target.as.ptr;
-        for (; idx < (int64_t)arr->count; idx++) {
-            luby_value res = luby_nil();
-            if (kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
-                luby_value args[2];
-                args[0] = arr->items[idx];
-                args[1] = luby_int(idx);
-                LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-            } else {
-                LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &arr->items[idx], &res, out, luby_nil());
+    if (L->cfg.vfs.exists(L->cfg.vfs.user, candidate)) {
+        resolved = candidate;
+    } else if (with_ext && L->cfg.vfs.exists(L->cfg.vfs.user, with_ext)) {
+        resolved = with_ext;
+    } else {
+        for (size_t i = 0; i < L->search_path_count && !resolved; i++) {
+            const char *base = L->search_paths[i];
+            if (!base) continue;
+            size_t blen = strlen(base);
+            snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", candidate);
+            if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
+            if (with_ext) {
+                snprintf(fullpath, sizeof(fullpath), "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", with_ext);
+                if (L->cfg.vfs.exists(L->cfg.vfs.user, fullpath)) { resolved = fullpath; break; }
             }
         }
-        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
-        if (out) *out = argv[0];
-        return (int)LUBY_E_OK;
     }
 
-    if (kind == LUBY_ENUM_HASH) {
-        if (target.type != LUBY_T_HASH || !target.as.ptr) return (int)LUBY_E_TYPE;
-        luby_hash *h = (luby_hash *)target.as.ptr;
-        for (; idx < (int64_t)h->count; idx++) {
-            luby_value args[2];
-            args[0] = h->entries[idx].key;
-            args[1] = h->entries[idx].value;
-            luby_value res = luby_nil();
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        }
-        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
-        if (out) *out = argv[0];
-        return (int)LUBY_E_OK;
-    }
-
-    return (int)LUBY_E_TYPE;
-}
-
-static int luby_coroutine_new_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    luby_proc *proc = NULL;
-    if (argc >= 1 && argv[0].type == LUBY_T_PROC) proc = (luby_proc *)argv[0].as.ptr;
-    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
-    if (!proc) return (int)LUBY_E_TYPE;
-
-    luby_coroutine *co = luby_coroutine_new(L, (luby_value){ .type = LUBY_T_PROC, .as.ptr = proc });
-    if (!co) return (int)LUBY_E_OOM;
-
-    luby_string_view name = { "Coroutine", 9 };
-    luby_value cv = luby_get_global(L, name);
-    luby_class_obj *cls = NULL;
-    if (cv.type == LUBY_T_CLASS && cv.as.ptr) {
-        cls = (luby_class_obj *)cv.as.ptr;
-    } else {
-        cls = luby_class_new(L, "Coroutine", NULL);
-        if (!cls) return (int)LUBY_E_OOM;
-        luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
-        luby_set_global(L, name, v);
+    if (!resolved) {
+        luby_set_error(L, LUBY_E_IO, "module not found", path, 0, 0);
+        luby_alloc_raw(L, with_ext, 0);
+        return (int)LUBY_E_IO;
     }
-    luby_object *obj = luby_object_new(L, cls);
-    if (!obj) return (int)LUBY_E_OOM;
-    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
-
-    luby_value key_ptr = luby_symbol(L, "_co_ptr", 0);
-    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_ptr, luby_int((int64_t)(intptr_t)co));
-    if (out) *out = ov;
-    return (int)LUBY_E_OK;
-}
 
-static int luby_coroutine_resume_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_value key_ptr = luby_symbol(L, "_co_ptr", 0);
-    luby_value pv = luby_nil();
-    luby_hash_get_value((luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_ptr, &pv);
-    if (pv.type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_coroutine *co = (luby_coroutine *)(intptr_t)pv.as.i;
-    if (!co) return (int)LUBY_E_TYPE;
+    size_t size = 0;
+    char *code = L->cfg.vfs.read(L->cfg.vfs.user, resolved, &size);
+    if (!code) {
+        luby_set_error(L, LUBY_E_IO, "read failed", resolved, 0, 0);
+        luby_alloc_raw(L, with_ext, 0);
+        return (int)LUBY_E_IO;
+    }
 
-    luby_value rv = luby_nil();
-    int yielded = 0;
-    int rc = luby_coroutine_resume(L, co, argc - 1, argv + 1, &rv, &yielded);
-    if (out) *out = rv;
+    luby_value res;
+    int rc = luby_eval(L, code, size, resolved, &res);
+    L->cfg.alloc ? L->cfg.alloc(L->cfg.alloc_user, code, 0) : luby_default_alloc(NULL, code, 0);
+    luby_alloc_raw(L, with_ext, 0);
+    if (out) *out = luby_bool(rc == 0);
     return rc;
 }
 
-static int luby_coroutine_alive_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_value key_ptr = luby_symbol(L, "_co_ptr", 0);
-    luby_value pv = luby_nil();
-    luby_hash_get_value((luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_ptr, &pv);
-    luby_coroutine *co = (pv.type == LUBY_T_INT) ? (luby_coroutine *)(intptr_t)pv.as.i : NULL;
-    int alive = (co && !co->done);
-    if (out) *out = luby_bool(alive);
-    return (int)LUBY_E_OK;
+LUBY_API luby_error luby_last_error(luby_state *L) {
+    luby_error err = {0};
+    if (!L) return err;
+    return L->last_error;
 }
 
-/* ---- Fiber cfuncs ---- */
+LUBY_API void luby_clear_error(luby_state *L) {
+    if (!L) return;
+    L->last_error.code = LUBY_E_OK;
+    L->last_error.message = NULL;
+    L->last_error.file = NULL;
+    L->last_error.line = 0;
+    L->last_error.column = 0;
+}
 
-static int luby_fiber_new_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    luby_proc *proc = NULL;
-    if (argc >= 1 && argv[0].type == LUBY_T_PROC) proc = (luby_proc *)argv[0].as.ptr;
-    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
-    if (!proc) {
-        luby_set_error(L, LUBY_E_TYPE, "tried to create Fiber without a block", NULL, 0, 0);
-        return (int)LUBY_E_TYPE;
+LUBY_API const char *luby_error_code_string(luby_error_code code) {
+    switch (code) {
+        case LUBY_E_OK: return "ok";
+        case LUBY_E_PARSE: return "parse";
+        case LUBY_E_RUNTIME: return "runtime";
+        case LUBY_E_OOM: return "oom";
+        case LUBY_E_IO: return "io";
+        case LUBY_E_TYPE: return "type";
+        case LUBY_E_NAME: return "name";
+        default: return "unknown";
     }
+}
 
-    luby_coroutine *co = luby_coroutine_new(L, (luby_value){ .type = LUBY_T_PROC, .as.ptr = proc });
-    if (!co) return (int)LUBY_E_OOM;
-
-    luby_string_view name = { "Fiber", 5 };
-    luby_value cv = luby_get_global(L, name);
-    luby_class_obj *cls = NULL;
-    if (cv.type == LUBY_T_CLASS && cv.as.ptr) {
-        cls = (luby_class_obj *)cv.as.ptr;
+LUBY_API size_t luby_format_error(luby_state *L, char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return 0;
+    if (!L || L->last_error.code == LUBY_E_OK) {
+        buffer[0] = '\0';
+        return 0;
+    }
+    const char *code = luby_error_code_string(L->last_error.code);
+    const char *msg = L->last_error.message ? L->last_error.message : "error";
+    const char *file = L->last_error.file ? L->last_error.file : "<unknown>";
+    int line = L->last_error.line;
+    int col = L->last_error.column;
+    int written = 0;
+    if (line > 0) {
+        if (col > 0) {
+            written = snprintf(buffer, buffer_size, "%s:%d:%d: %s: %s", file, line, col, code, msg);
+        } else {
+            written = snprintf(buffer, buffer_size, "%s:%d: %s: %s", file, line, code, msg);
+        }
     } else {
-        cls = luby_class_new(L, "Fiber", NULL);
-        if (!cls) return (int)LUBY_E_OOM;
-        luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
-        luby_set_global(L, name, v);
+        written = snprintf(buffer, buffer_size, "%s: %s: %s", file, code, msg);
     }
-    luby_object *obj = luby_object_new(L, cls);
-    if (!obj) return (int)LUBY_E_OOM;
-    obj->native_ref = &co->gc;  // GC-traceable reference to keep coroutine alive
-    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
+    if (written < 0) {
+        buffer[0] = '\0';
+        return 0;
+    }
+    return (size_t)written;
+}
 
-    luby_value key_ptr = luby_symbol(L, "_co_ptr", 0);
-    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_ptr, luby_int((int64_t)(intptr_t)co));
-    if (out) *out = ov;
-    return (int)LUBY_E_OK;
+LUBY_API luby_value luby_nil(void) { luby_value v; v.type = LUBY_T_NIL; v.as.ptr = NULL; return v; }
+LUBY_API luby_value luby_bool(int b) { luby_value v; v.type = LUBY_T_BOOL; v.as.b = !!b; return v; }
+LUBY_API luby_value luby_int(int64_t v) { luby_value r; r.type = LUBY_T_INT; r.as.i = v; return r; }
+LUBY_API luby_value luby_float(double v) { luby_value r; r.type = LUBY_T_FLOAT; r.as.f = v; return r; }
+LUBY_API luby_value luby_string(luby_state *L, const char *s, size_t len) {
+    luby_value v; v.type = LUBY_T_STRING;
+    if (!s) { v.as.ptr = NULL; return v; }
+    if (len == 0) len = strlen(s);
+    v.as.ptr = luby_gc_alloc_string(L, s, len);
+    return v;
+}
+LUBY_API luby_value luby_symbol(luby_state *L, const char *s, size_t len) {
+    luby_value v; v.type = LUBY_T_SYMBOL;
+    if (!s) { v.as.ptr = NULL; return v; }
+    v.as.ptr = (void *)luby_intern_symbol(L, s, len);
+    return v;
 }
 
-static int luby_fiber_resume_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) {
-        luby_set_error(L, LUBY_E_TYPE, "resume called on non-Fiber", NULL, 0, 0);
-        return (int)LUBY_E_TYPE;
-    }
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_value key_ptr = luby_symbol(L, "_co_ptr", 0);
-    luby_value pv = luby_nil();
-    luby_hash_get_value((luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_ptr, &pv);
-    if (pv.type != LUBY_T_INT) {
-        luby_set_error(L, LUBY_E_TYPE, "resume called on non-Fiber", NULL, 0, 0);
-        return (int)LUBY_E_TYPE;
-    }
-    luby_coroutine *co = (luby_coroutine *)(intptr_t)pv.as.i;
-    if (!co) {
-        luby_set_error(L, LUBY_E_TYPE, "resume called on non-Fiber", NULL, 0, 0);
-        return (int)LUBY_E_TYPE;
-    }
+LUBY_API void luby_set_global_value(luby_state *L, const char *name, luby_value v) {
+    if (!L || !name) return;
+    luby_string_view sv = { name, strlen(name) };
+    luby_set_global(L, sv, v);
+}
 
-    luby_value rv = luby_nil();
-    int yielded = 0;
-    int rc = luby_coroutine_resume(L, co, argc - 1, argv + 1, &rv, &yielded);
-    if (out) *out = rv;
-    return rc;
+LUBY_API luby_value luby_get_global_value(luby_state *L, const char *name) {
+    if (!L || !name) return luby_nil();
+    luby_string_view sv = { name, strlen(name) };
+    return luby_get_global(L, sv);
 }
 
-static int luby_fiber_yield_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (!L->current_coroutine) {
-        luby_set_error(L, LUBY_E_RUNTIME, "Fiber.yield called outside of fiber", NULL, 0, 0);
-        return (int)LUBY_E_RUNTIME;
+// ------------------------------ Host Handles -------------------------------
+
+static int luby_ref_new(luby_state *L, luby_value v, luby_ref_kind kind) {
+    if (!L) return LUBY_NOREF;
+    int ref = L->ref_free;
+    if (ref != LUBY_NOREF) {
+        L->ref_free = L->refs[ref - 1].next_free;
+    } else {
+        if (L->ref_count == L->ref_capacity) {
+            int new_cap = L->ref_capacity ? L->ref_capacity * 2 : 16;
+            luby_ref_slot *ns = (luby_ref_slot *)luby_alloc_raw(L, L->refs, (size_t)new_cap * sizeof(luby_ref_slot));
+            if (!ns) {
+                luby_set_error(L, LUBY_E_OOM, "oom", NULL, 0, 0);
+                return LUBY_NOREF;
+            }
+            L->refs = ns;
+            L->ref_capacity = new_cap;
+        }
+        ref = ++L->ref_count;
     }
-    luby_value val = (argc >= 1) ? argv[0] : luby_nil();
-    return luby_native_yield(L, val);
+    luby_ref_slot *slot = &L->refs[ref - 1];
+    slot->value = v;
+    slot->kind = kind;
+    slot->next_free = LUBY_NOREF;
+    return ref;
 }
 
-static int luby_fiber_alive_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_object *obj = (luby_object *)argv[0].as.ptr;
-    luby_value key_ptr = luby_symbol(L, "_co_ptr", 0);
-    luby_value pv = luby_nil();
-    luby_hash_get_value((luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_ptr, &pv);
-    luby_coroutine *co = (pv.type == LUBY_T_INT) ? (luby_coroutine *)(intptr_t)pv.as.i : NULL;
-    int alive = (co && !co->done);
-    if (out) *out = luby_bool(alive);
-    return (int)LUBY_E_OK;
+LUBY_API int luby_ref(luby_state *L, luby_value v) {
+    return luby_ref_new(L, v, LUBY_REF_STRONG);
 }
 
-/* ---- Lazy Enumerator ---- */
+LUBY_API int luby_ref_weak(luby_state *L, luby_value v) {
+    return luby_ref_new(L, v, LUBY_REF_WEAK);
+}
 
-/* Step kinds: 0=identity, 1=map, 2=select, 3=reject, 4=take, 5=drop, 6=flat_map */
-#define LAZY_IDENTITY 0
-#define LAZY_MAP      1
-#define LAZY_SELECT   2
-#define LAZY_REJECT   3
-#define LAZY_TAKE     4
-#define LAZY_DROP     5
-#define LAZY_FLAT_MAP 6
-#define LAZY_MAX_STEPS 64
+LUBY_API luby_value luby_ref_get(luby_state *L, int ref) {
+    if (!L || ref <= 0 || ref > L->ref_count) return luby_nil();
+    luby_ref_slot *slot = &L->refs[ref - 1];
+    return slot->kind == LUBY_REF_FREE ? luby_nil() : slot->value;
+}
 
-typedef struct {
-    int kind;
-    luby_proc *block;   /* for map/select/reject/flat_map */
-    int64_t n;          /* for take/drop */
-    int64_t counter;    /* runtime counter for take/drop */
-} lazy_step;
+LUBY_API void luby_unref(luby_state *L, int ref) {
+    if (!L || ref <= 0 || ref > L->ref_count) return;
+    luby_ref_slot *slot = &L->refs[ref - 1];
+    if (slot->kind == LUBY_REF_FREE) return;
+    slot->value = luby_nil();
+    slot->kind = LUBY_REF_FREE;
+    slot->next_free = L->ref_free;
+    L->ref_free = ref;
+}
 
-/* Helper: get Lazy class, creating if needed */
-static luby_class_obj *lazy_get_class(luby_state *L) {
-    luby_string_view name = { "Lazy", 4 };
-    luby_value cv = luby_get_global(L, name);
-    if (cv.type == LUBY_T_CLASS && cv.as.ptr) return (luby_class_obj *)cv.as.ptr;
-    luby_class_obj *cls = luby_class_new(L, "Lazy", NULL);
-    if (!cls) return NULL;
-    luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
-    luby_set_global(L, name, v);
-    return cls;
+LUBY_API luby_value luby_array_new(luby_state *L) {
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return luby_nil();
+    arr->count = 0;
+    arr->capacity = 0;
+    arr->items = NULL;
+    arr->frozen = 0;
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = arr;
+    return v;
 }
 
-/* Helper: create a Lazy object with ivars */
-static luby_value lazy_make_obj(luby_state *L, luby_value source, luby_value parent, int kind, luby_value arg) {
-    luby_class_obj *cls = lazy_get_class(L);
-    if (!cls) return luby_nil();
-    luby_object *obj = luby_object_new(L, cls);
-    if (!obj) return luby_nil();
-    luby_enum_set_field(L, obj, "_lz_src", source);
-    luby_enum_set_field(L, obj, "_lz_par", parent);
-    luby_enum_set_field(L, obj, "_lz_kind", luby_int(kind));
-    luby_enum_set_field(L, obj, "_lz_arg", arg);
-    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
-    return ov;
+LUBY_API size_t luby_array_len(luby_value arr) {
+    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return 0;
+    return ((luby_array *)arr.as.ptr)->count;
 }
 
-/* lazy_create(source) — creates root Lazy wrapping a source */
-static int luby_lazy_create(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value ov = lazy_make_obj(L, argv[0], luby_nil(), LAZY_IDENTITY, luby_nil());
-    if (ov.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
-    if (out) *out = ov;
+LUBY_API int luby_array_get(luby_value arr, size_t index, luby_value *out) {
+    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *a = (luby_array *)arr.as.ptr;
+    if (index >= a->count) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+    if (out) *out = a->items[index];
     return (int)LUBY_E_OK;
 }
 
-/* lazy_chain(parent_lazy, kind_int, arg) — creates child Lazy */
-static int luby_lazy_chain(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 3) return (int)LUBY_E_TYPE;
-    luby_value parent = argv[0];
-    int kind = (argv[1].type == LUBY_T_INT) ? (int)argv[1].as.i : 0;
-    luby_value arg = argv[2];
-    luby_value ov = lazy_make_obj(L, luby_nil(), parent, kind, arg);
-    if (ov.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
-    if (out) *out = ov;
+LUBY_API int luby_array_set(luby_state *L, luby_value arr, size_t index, luby_value v) {
+    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *a = (luby_array *)arr.as.ptr;
+    if (a->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    if (index >= a->count) {
+        if (!luby_array_reserve(L, a, index + 1)) return (int)LUBY_E_OOM;
+        for (size_t i = a->count; i < index; i++) a->items[i] = luby_nil();
+        a->count = index + 1;
+    }
+    a->items[index] = v;
     return (int)LUBY_E_OK;
 }
 
-/* Walk chain to collect steps and find root source */
-static int lazy_collect_steps(luby_state *L, luby_value lv, lazy_step *steps, int *nsteps, luby_value *source) {
-    /* Walk to root, collecting steps in reverse */
-    luby_value chain[LAZY_MAX_STEPS];
-    int depth = 0;
-    luby_value cur = lv;
-    while (cur.type == LUBY_T_OBJECT && cur.as.ptr) {
-        if (depth >= LAZY_MAX_STEPS) return 0;
-        chain[depth++] = cur;
-        luby_object *obj = (luby_object *)cur.as.ptr;
-        luby_value par = luby_nil();
-        luby_enum_get_field(L, obj, "_lz_par", &par);
-        if (par.type != LUBY_T_OBJECT) break;
-        cur = par;
-    }
-    /* cur / chain[depth-1] is the root */
-    luby_object *root = (luby_object *)chain[depth - 1].as.ptr;
-    luby_enum_get_field(L, root, "_lz_src", source);
+LUBY_API int luby_array_push_value(luby_state *L, luby_value arr, luby_value v) {
+    return luby_array_set(L, arr, luby_array_len(arr), v);
+}
 
-    /* Collect steps from root to leaf (reverse of chain order), skip root identity */
-    *nsteps = 0;
-    for (int i = depth - 2; i >= 0; i--) {
-        luby_object *obj = (luby_object *)chain[i].as.ptr;
-        luby_value kv = luby_nil(), av = luby_nil();
-        luby_enum_get_field(L, obj, "_lz_kind", &kv);
-        luby_enum_get_field(L, obj, "_lz_arg", &av);
-        int kind = (kv.type == LUBY_T_INT) ? (int)kv.as.i : 0;
-        if (kind == LAZY_IDENTITY) continue;
-        lazy_step *s = &steps[*nsteps];
-        s->kind = kind;
-        s->block = (av.type == LUBY_T_PROC && av.as.ptr) ? (luby_proc *)av.as.ptr : NULL;
-        s->n = (av.type == LUBY_T_INT) ? av.as.i : 0;
-        s->counter = 0;
-        (*nsteps)++;
+LUBY_API luby_value luby_hash_new(luby_state *L) {
+    luby_hash *h = (luby_hash *)luby_gc_alloc(L, sizeof(luby_hash), LUBY_GC_HASH);
+    if (!h) return luby_nil();
+    h->count = 0;
+    h->capacity = 0;
+    h->entries = NULL;
+    h->frozen = 0;
+    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = h;
+    return v;
+}
+
+LUBY_API size_t luby_hash_len(luby_value h) {
+    if (h.type != LUBY_T_HASH || !h.as.ptr) return 0;
+    return ((luby_hash *)h.as.ptr)->count;
+}
+
+LUBY_API int luby_hash_get_value(luby_value h, luby_value key, luby_value *out) {
+    if (h.type != LUBY_T_HASH || !h.as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *hh = (luby_hash *)h.as.ptr;
+    for (size_t i = 0; i < hh->count; i++) {
+        if (luby_value_eq(hh->entries[i].key, key)) {
+            if (out) *out = hh->entries[i].value;
+            return (int)LUBY_E_OK;
+        }
     }
-    return 1;
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
 }
 
-/* Process one element through the pipeline. Returns:
-   0 = emit this element, 1 = skip, 2 = stop iteration */
-static int lazy_process_element(luby_state *L, luby_value *elem, lazy_step *steps, int nsteps) {
-    for (int i = 0; i < nsteps; i++) {
-        lazy_step *s = &steps[i];
-        switch (s->kind) {
-            case LAZY_MAP: {
-                if (!s->block) return 1;
-                luby_value res = luby_nil();
-                if (luby_call_block(L, s->block, 1, elem, &res) != 0) return 1;
-                *elem = res;
-                break;
-            }
-            case LAZY_SELECT: {
-                if (!s->block) return 1;
-                luby_value res = luby_nil();
-                if (luby_call_block(L, s->block, 1, elem, &res) != 0) return 1;
-                if (res.type == LUBY_T_NIL || (res.type == LUBY_T_BOOL && !res.as.b) ||
-                    (res.type == LUBY_T_INT && res.as.i == 0)) return 1;
-                break;
-            }
-            case LAZY_REJECT: {
-                if (!s->block) return 1;
-                luby_value res = luby_nil();
-                if (luby_call_block(L, s->block, 1, elem, &res) != 0) return 1;
-                if (!(res.type == LUBY_T_NIL || (res.type == LUBY_T_BOOL && !res.as.b) ||
-                      (res.type == LUBY_T_INT && res.as.i == 0))) return 1;
-                break;
-            }
-            case LAZY_TAKE: {
-                if (s->counter >= s->n) return 2;
-                s->counter++;
-                break;
-            }
-            case LAZY_DROP: {
-                if (s->counter < s->n) { s->counter++; return 1; }
-                break;
-            }
-            default: break;
+LUBY_API int luby_hash_set_value(luby_state *L, luby_value h, luby_value key, luby_value value) {
+    if (h.type != LUBY_T_HASH || !h.as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *hh = (luby_hash *)h.as.ptr;
+    if (hh->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    for (size_t i = 0; i < hh->count; i++) {
+        if (luby_value_eq(hh->entries[i].key, key)) {
+            hh->entries[i].value = value;
+            return (int)LUBY_E_OK;
         }
     }
-    return 0;
+    if (hh->count + 1 > hh->capacity) {
+        size_t new_cap = hh->capacity < 8 ? 8 : hh->capacity * 2;
+        luby_hash_entry *ne = (luby_hash_entry *)luby_alloc_raw(L, hh->entries, new_cap * sizeof(luby_hash_entry));
+        if (!ne) return (int)LUBY_E_OOM;
+        hh->entries = ne;
+        hh->capacity = new_cap;
+    }
+    hh->entries[hh->count].key = key;
+    hh->entries[hh->count].value = value;
+    hh->count++;
+    return (int)LUBY_E_OK;
 }
 
-/* lazy_to_a(lazy_obj) — force the pipeline, return array */
-static int luby_lazy_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr)
-        return (int)LUBY_E_TYPE;
+LUBY_API int luby_invoke_global(luby_state *L, const char *name, int argc, const luby_value *argv, luby_value *out) {
+    if (!L || !name) return (int)LUBY_E_RUNTIME;
+    luby_value saved_sbfc = L->saved_block_for_call;
+    
+    // First check for a Luby-defined proc in globals
+    luby_string_view sv = { name, strlen(name) };
+    luby_value gv = luby_get_global(L, sv);
+    if (gv.type == LUBY_T_PROC && gv.as.ptr) {
+        luby_proc *proc = (luby_proc *)gv.as.ptr;
+        luby_vm vm;
+        luby_vm_init(&vm);
+        luby_vm *saved_vm = L->current_vm;
+        L->current_vm = &vm;
+        
+        if (!luby_vm_push_frame(L, &vm, proc, &proc->chunk, name, luby_nil(), NULL, name, argc, argv, luby_nil(), 0)) {
+            L->current_vm = saved_vm;
+            luby_vm_free(L, &vm);
+            L->saved_block_for_call = saved_sbfc;
+            return (L->last_error.code != LUBY_E_OK) ? (int)L->last_error.code : (int)LUBY_E_OOM;
+        }
+        
+        int rc = luby_vm_run(L, &vm, out);
+        L->current_vm = saved_vm;
+        luby_vm_free(L, &vm);
+        L->saved_block_for_call = saved_sbfc;
+        return rc;
+    }
+    
+    // Fall back to C function
+    int idx = luby_find_cfunc_index(L, name);
+    if (idx < 0) {
+        luby_set_error(L, LUBY_E_NAME, "undefined function", NULL, 0, 0);
+        return (int)LUBY_E_NAME;
+    }
+    luby_value result = luby_nil();
+    int rc = luby_call_registered(L, idx, argc, argv, &result);
+    if (out) *out = result;
+    return rc;
+}
 
-    lazy_step steps[LAZY_MAX_STEPS];
-    int nsteps = 0;
-    luby_value source = luby_nil();
-    if (!lazy_collect_steps(L, argv[0], steps, &nsteps, &source)) return (int)LUBY_E_RUNTIME;
+// Call a native method with the receiver prepended to argv. Small argument
+// lists are built on the C stack; only long ones touch the allocator.
+#define LUBY_CMETHOD_STACK_ARGS 8
 
-    int was_paused = L->gc_paused; L->gc_paused = 1;
-    luby_value result = luby_array_new(L);
-    int has_flat_map = 0;
-    for (int i = 0; i < nsteps; i++) if (steps[i].kind == LAZY_FLAT_MAP) has_flat_map = 1;
+static int luby_call_cmethod(luby_state *L, luby_cmethod *cm, const char *name, luby_value recv, int argc, const luby_value *argv, luby_value *out) {
+    luby_value stack_argv[LUBY_CMETHOD_STACK_ARGS];
+    luby_value *full_argv = stack_argv;
+    if (argc + 1 > LUBY_CMETHOD_STACK_ARGS) {
+        full_argv = (luby_value *)luby_alloc_raw(L, NULL, (size_t)(argc + 1) * sizeof(luby_value));
+        if (!full_argv) return (int)LUBY_E_OOM;
+    }
+    full_argv[0] = recv;
+    for (int i = 0; i < argc; i++) full_argv[i + 1] = argv[i];
+    luby_value result = luby_nil();
+    int rc = luby_call_cmethod_argv(L, cm, name, argc + 1, full_argv, &result);
+    if (full_argv != stack_argv) luby_alloc_raw(L, full_argv, 0);
+    if (out) *out = result;
+    return rc;
+}
 
-    if (source.type == LUBY_T_ARRAY && source.as.ptr) {
-        luby_array *arr = (luby_array *)source.as.ptr;
-        for (size_t i = 0; i < arr->count; i++) {
-            if (has_flat_map) {
-                /* flat_map: need to expand results and process rest of pipeline for each */
-                luby_value cur = arr->items[i];
-                int stop = 0;
-                /* Process steps up to first flat_map */
-                int fm_idx = -1;
-                for (int si = 0; si < nsteps; si++) {
-                    if (steps[si].kind == LAZY_FLAT_MAP) { fm_idx = si; break; }
-                    int r = lazy_process_element(L, &cur, &steps[si], 1);
-                    if (r == 1) goto next_arr_fm;
-                    if (r == 2) { stop = 1; break; }
-                }
-                if (stop) { L->gc_paused = was_paused; goto done; }
-                if (fm_idx >= 0 && steps[fm_idx].block) {
-                    luby_value fm_res = luby_nil();
-                    luby_call_block(L, steps[fm_idx].block, 1, &cur, &fm_res);
-                    /* Iterate result of flat_map */
-                    luby_value items[256];
-                    int item_count = 0;
-                    if (fm_res.type == LUBY_T_ARRAY && fm_res.as.ptr) {
-                        luby_array *fa = (luby_array *)fm_res.as.ptr;
-                        for (size_t fi = 0; fi < fa->count && fi < 256; fi++)
-                            items[item_count++] = fa->items[fi];
-                    } else {
-                        items[item_count++] = fm_res;
-                    }
-                    /* Process remaining steps for each expanded item */
-                    for (int fi = 0; fi < item_count; fi++) {
-                        luby_value elem = items[fi];
-                        int remaining_nsteps = nsteps - fm_idx - 1;
-                        int r = 0;
-                        if (remaining_nsteps > 0)
-                            r = lazy_process_element(L, &elem, &steps[fm_idx + 1], remaining_nsteps);
-                        if (r == 0) luby_array_push_value(L, result, elem);
-                        if (r == 2) { L->gc_paused = was_paused; goto done; }
-                    }
-                }
-                next_arr_fm:;
-            } else {
-                luby_value elem = arr->items[i];
-                int r = lazy_process_element(L, &elem, steps, nsteps);
-                if (r == 0) luby_array_push_value(L, result, elem);
-                if (r == 2) break;
-            }
-        }
-    } else if (source.type == LUBY_T_RANGE && source.as.ptr) {
-        luby_range *rng = (luby_range *)source.as.ptr;
-        if (rng->start.type == LUBY_T_INT && rng->end.type == LUBY_T_INT) {
-            int64_t start = rng->start.as.i;
-            int64_t end = rng->end.as.i;
-            if (rng->exclusive) end--;
-            for (int64_t i = start; i <= end; i++) {
-                if (has_flat_map) {
-                    luby_value cur = luby_int(i);
-                    int stop = 0;
-                    int fm_idx = -1;
-                    for (int si = 0; si < nsteps; si++) {
-                        if (steps[si].kind == LAZY_FLAT_MAP) { fm_idx = si; break; }
-                        int r = lazy_process_element(L, &cur, &steps[si], 1);
-                        if (r == 1) goto next_rng_fm;
-                        if (r == 2) { stop = 1; break; }
-                    }
-                    if (stop) { L->gc_paused = was_paused; goto done; }
-                    if (fm_idx >= 0 && steps[fm_idx].block) {
-                        luby_value fm_res = luby_nil();
-                        luby_call_block(L, steps[fm_idx].block, 1, &cur, &fm_res);
-                        luby_value items[256];
-                        int item_count = 0;
-                        if (fm_res.type == LUBY_T_ARRAY && fm_res.as.ptr) {
-                            luby_array *fa = (luby_array *)fm_res.as.ptr;
-                            for (size_t fi = 0; fi < fa->count && fi < 256; fi++)
-                                items[item_count++] = fa->items[fi];
-                        } else {
-                            items[item_count++] = fm_res;
-                        }
-                        for (int fi = 0; fi < item_count; fi++) {
-                            luby_value elem = items[fi];
-                            int remaining_nsteps = nsteps - fm_idx - 1;
-                            int r = 0;
-                            if (remaining_nsteps > 0)
-                                r = lazy_process_element(L, &elem, &steps[fm_idx + 1], remaining_nsteps);
-                            if (r == 0) luby_array_push_value(L, result, elem);
-                            if (r == 2) { L->gc_paused = was_paused; goto done; }
-                        }
-                    }
-                    next_rng_fm:;
-                } else {
-                    luby_value elem = luby_int(i);
-                    int r = lazy_process_element(L, &elem, steps, nsteps);
-                    if (r == 0) luby_array_push_value(L, result, elem);
-                    if (r == 2) break;
-                }
+LUBY_API int luby_invoke_method(luby_state *L, luby_value recv, const char *method, int argc, const luby_value *argv, luby_value *out) {
+    if (!L || !method) return (int)LUBY_E_RUNTIME;
+    luby_value saved_sbfc = L->saved_block_for_call;
+    
+    luby_class_obj *cls = luby_get_receiver_class(recv);
+    
+    if (cls) {
+        // Check for singleton method first
+        luby_proc *m = NULL;
+        if (recv.type == LUBY_T_OBJECT) {
+            m = luby_object_get_singleton_method((luby_object *)recv.as.ptr, method);
+        } else if (recv.type == LUBY_T_CLASS || recv.type == LUBY_T_MODULE) {
+            m = luby_class_get_singleton_method(L, cls, method);
+        }
+        if (!m) m = luby_class_get_method(L, cls, method);
+        
+        if (m) {
+            luby_vm vm;
+            luby_vm_init(&vm);
+            luby_vm *saved_vm = L->current_vm;
+            L->current_vm = &vm;
+            
+            if (!luby_vm_push_frame(L, &vm, m, &m->chunk, method, recv, cls, method, argc, argv, luby_nil(), 1)) {
+                L->current_vm = saved_vm;
+                luby_vm_free(L, &vm);
+                L->saved_block_for_call = saved_sbfc;
+                return (L->last_error.code != LUBY_E_OK) ? (int)L->last_error.code : (int)LUBY_E_OOM;
             }
+            
+            int rc = luby_vm_run(L, &vm, out);
+            L->current_vm = saved_vm;
+            luby_vm_free(L, &vm);
+            L->saved_block_for_call = saved_sbfc;
+            return rc;
         }
-    } else if (source.type == LUBY_T_OBJECT || source.type == LUBY_T_HASH) {
-        /* Fallback: call to_a on source first, then process */
-        luby_value arr_val = luby_nil();
-        if (luby_invoke_method(L, source, "to_a", 0, NULL, &arr_val) == 0 &&
-            arr_val.type == LUBY_T_ARRAY && arr_val.as.ptr) {
-            luby_array *arr = (luby_array *)arr_val.as.ptr;
-            for (size_t i = 0; i < arr->count; i++) {
-                luby_value elem = arr->items[i];
-                int r = lazy_process_element(L, &elem, steps, nsteps);
-                if (r == 0) luby_array_push_value(L, result, elem);
-                if (r == 2) break;
+        
+        // Check for native method (CMETHOD)
+        luby_value method_val = luby_class_lookup_method(L, cls, method);
+        if (method_val.type == LUBY_T_CMETHOD && method_val.as.ptr) {
+            return luby_call_cmethod(L, (luby_cmethod *)method_val.as.ptr, method, recv, argc, argv, out);
+        }
+
+        // Bound struct field (argc excludes the receiver here)
+        if (recv.type == LUBY_T_USERDATA && argc <= 1) {
+            const luby_field_slot *fs = luby_field_resolve(L, cls, method, argc + 1);
+            if (fs) {
+                luby_value v = argc == 1 ? argv[0] : luby_nil();
+                int rc = luby_field_access(L, (luby_userdata *)recv.as.ptr, fs, argc + 1, &v);
+                if (rc == 0 && out) *out = v;
+                return rc;
             }
         }
     }
-
-done:
-    L->gc_paused = was_paused;
-    if (out) *out = result;
-    return (int)LUBY_E_OK;
+    
+    luby_set_error(L, LUBY_E_NAME, "undefined method", NULL, 0, 0);
+    return (int)LUBY_E_NAME;
 }
 
-/* lazy_each(lazy_obj) — force pipeline, yield each to current block */
-static int luby_lazy_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr)
-        return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) {
-        /* No block — return to_a */
-        return luby_lazy_to_a(L, argc, argv, out);
+// Resolve a handle's target for receiver class `cls`. Class receivers see
+// their singleton methods first, as in luby_invoke_method.
+static void luby_method_ref_resolve(luby_state *L, luby_method_ref *ref, luby_value recv, luby_class_obj *cls) {
+    luby_proc *m = NULL;
+    if (recv.type == LUBY_T_CLASS || recv.type == LUBY_T_MODULE) {
+        m = luby_class_get_singleton_method(L, cls, ref->name);
     }
-
-    lazy_step steps[LAZY_MAX_STEPS];
-    int nsteps = 0;
-    luby_value source = luby_nil();
-    if (!lazy_collect_steps(L, argv[0], steps, &nsteps, &source)) return (int)LUBY_E_RUNTIME;
-
-    /* Iterate source, process pipeline, yield to block */
-    if (source.type == LUBY_T_ARRAY && source.as.ptr) {
-        luby_array *arr = (luby_array *)source.as.ptr;
-        for (size_t i = 0; i < arr->count; i++) {
-            luby_value elem = arr->items[i];
-            int r = lazy_process_element(L, &elem, steps, nsteps);
-            if (r == 2) break;
-            if (r == 0) {
-                luby_value res = luby_nil();
-                LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &elem, &res, out, luby_nil());
-            }
-        }
-    } else if (source.type == LUBY_T_RANGE && source.as.ptr) {
-        luby_range *rng = (luby_range *)source.as.ptr;
-        if (rng->start.type == LUBY_T_INT && rng->end.type == LUBY_T_INT) {
-            int64_t start = rng->start.as.i;
-            int64_t end = rng->end.as.i;
-            if (rng->exclusive) end--;
-            for (int64_t i = start; i <= end; i++) {
-                luby_value elem = luby_int(i);
-                int r = lazy_process_element(L, &elem, steps, nsteps);
-                if (r == 2) break;
-                if (r == 0) {
-                    luby_value res = luby_nil();
-                    LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &elem, &res, out, luby_nil());
-                }
-            }
-        }
+    if (m) {
+        ref->target.type = LUBY_T_PROC;
+        ref->target.as.ptr = m;
     } else {
-        luby_value arr_val = luby_nil();
-        if (luby_invoke_method(L, source, "to_a", 0, NULL, &arr_val) == 0 &&
-            arr_val.type == LUBY_T_ARRAY && arr_val.as.ptr) {
-            luby_array *arr = (luby_array *)arr_val.as.ptr;
-            for (size_t i = 0; i < arr->count; i++) {
-                luby_value elem = arr->items[i];
-                int r = lazy_process_element(L, &elem, steps, nsteps);
-                if (r == 2) break;
-                if (r == 0) {
-                    luby_value res = luby_nil();
-                    LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &elem, &res, out, luby_nil());
-                }
-            }
+        ref->target = luby_class_lookup_method(L, cls, ref->name);
+    }
+    ref->cls = cls;
+    ref->epoch = L->method_epoch;
+}
+
+LUBY_API luby_method_ref *luby_method_ref_new(luby_state *L, luby_class *cls, const char *method) {
+    if (!L || !method) return NULL;
+    const char *name = luby_intern_symbol(L, method, 0);
+    if (!name) return NULL;
+    luby_method_ref *ref = (luby_method_ref *)luby_alloc_raw(L, NULL, sizeof(luby_method_ref));
+    if (!ref) return NULL;
+    memset(ref, 0, sizeof(*ref));
+    ref->name = name;
+    ref->target = luby_nil();
+    luby_vm_init(&ref->vm);
+    if (cls && cls->obj) {
+        ref->cls = cls->obj;
+        ref->target = luby_class_lookup_method(L, cls->obj, name);
+        ref->epoch = L->method_epoch;
+    }
+    ref->next = L->method_refs;
+    if (L->method_refs) L->method_refs->prev = ref;
+    L->method_refs = ref;
+    return ref;
+}
+
+// Dispatch one call through a handle on `vm`, which the caller has reset and
+// installed as L->current_vm.
+static int luby_method_ref_dispatch(luby_state *L, luby_method_ref *ref, luby_vm *vm, luby_value recv, int argc, const luby_value *argv, luby_value *out) {
+    luby_class_obj *cls = luby_get_receiver_class(recv);
+    if (!cls) {
+        luby_set_error(L, LUBY_E_NAME, "undefined method", NULL, 0, 0);
+        return (int)LUBY_E_NAME;
+    }
+
+    // Objects with singleton methods bypass the per-class cache
+    luby_value target = luby_nil();
+    luby_object *obj = (recv.type == LUBY_T_OBJECT) ? (luby_object *)recv.as.ptr : NULL;
+    if (obj && obj->singleton_methods && obj->singleton_methods->count > 0) {
+        luby_proc *sm = luby_object_get_singleton_method(obj, ref->name);
+        if (sm) { target.type = LUBY_T_PROC; target.as.ptr = sm; }
+    }
+    if (target.type == LUBY_T_NIL) {
+        if (ref->cls != cls || ref->epoch != L->method_epoch) luby_method_ref_resolve(L, ref, recv, cls);
+        target = ref->target;
+    }
+
+    if (target.type == LUBY_T_CMETHOD && target.as.ptr) {
+        return luby_call_cmethod(L, (luby_cmethod *)target.as.ptr, ref->name, recv, argc, argv, out);
+    }
+    // Bound struct field, as in luby_invoke_method
+    if (target.type != LUBY_T_PROC && recv.type == LUBY_T_USERDATA && argc <= 1) {
+        const luby_field_slot *fs = luby_field_resolve(L, cls, ref->name, argc + 1);
+        if (fs) {
+            luby_value v = argc == 1 ? argv[0] : luby_nil();
+            int rc = luby_field_access(L, (luby_userdata *)recv.as.ptr, fs, argc + 1, &v);
+            if (rc == 0 && out) *out = v;
+            return rc;
         }
     }
+    if (target.type != LUBY_T_PROC || !target.as.ptr) {
+        luby_set_error(L, LUBY_E_NAME, "undefined method", NULL, 0, 0);
+        return (int)LUBY_E_NAME;
+    }
+    luby_proc *m = (luby_proc *)target.as.ptr;
+    if (!luby_vm_ensure_stack(L, vm, 1)) return (int)LUBY_E_OOM;
+    if (!luby_vm_push_frame(L, vm, m, &m->chunk, ref->name, recv, cls, ref->name, argc, argv, luby_nil(), 1)) {
+        return (L->last_error.code != LUBY_E_OK) ? (int)L->last_error.code : (int)LUBY_E_OOM;
+    }
+    return luby_vm_run(L, vm, out);
+}
 
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+// Pick the VM for a call: the handle's own VM, or a fresh one when the
+// handle is already running further up the C stack (re-entrant call).
+static luby_vm *luby_method_ref_enter(luby_state *L, luby_method_ref *ref, luby_vm *fresh) {
+    if (ref->busy) {
+        luby_vm_init(fresh);
+        return fresh;
+    }
+    ref->busy = 1;
+    luby_vm_reset(L, &ref->vm);
+    return &ref->vm;
 }
 
-/* lazy_first_n(lazy_obj, n) — force pipeline with limit */
-static int luby_lazy_first_n(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    int64_t limit = (argv[1].type == LUBY_T_INT) ? argv[1].as.i : 1;
-    if (limit <= 0) { if (out) *out = luby_array_new(L); return (int)LUBY_E_OK; }
+static void luby_method_ref_leave(luby_state *L, luby_method_ref *ref, luby_vm *vm) {
+    if (vm == &ref->vm) ref->busy = 0;
+    else luby_vm_free(L, vm);
+}
 
-    lazy_step steps[LAZY_MAX_STEPS];
-    int nsteps = 0;
-    luby_value source = luby_nil();
-    if (!lazy_collect_steps(L, argv[0], steps, &nsteps, &source)) return (int)LUBY_E_RUNTIME;
+LUBY_API int luby_method_ref_call(luby_state *L, luby_method_ref *ref, luby_value recv, int argc, const luby_value *argv, luby_value *out) {
+    if (!L || !ref) return (int)LUBY_E_RUNTIME;
+    luby_vm fresh;
+    luby_vm *vm = luby_method_ref_enter(L, ref, &fresh);
+    luby_value saved_sbfc = L->saved_block_for_call;
+    luby_vm *saved_vm = L->current_vm;
+    L->current_vm = vm;
+    int rc = luby_method_ref_dispatch(L, ref, vm, recv, argc, argv, out);
+    L->current_vm = saved_vm;
+    L->saved_block_for_call = saved_sbfc;
+    luby_method_ref_leave(L, ref, vm);
+    return rc;
+}
 
-    int was_paused = L->gc_paused; L->gc_paused = 1;
-    luby_value result = luby_array_new(L);
-    int64_t count = 0;
+LUBY_API int luby_invoke_batch(luby_state *L, luby_method_ref *ref, const luby_value *receivers, size_t n,
+                               luby_batch_args_fn args_fn, void *user, luby_value *results, int *status) {
+    if (!L || !ref || (n > 0 && !receivers)) return (int)LUBY_E_RUNTIME;
+    luby_vm fresh;
+    luby_vm *vm = luby_method_ref_enter(L, ref, &fresh);
+    luby_value saved_sbfc = L->saved_block_for_call;
+    luby_vm *saved_vm = L->current_vm;
+    L->current_vm = vm;
 
-    if (source.type == LUBY_T_ARRAY && source.as.ptr) {
-        luby_array *arr = (luby_array *)source.as.ptr;
-        for (size_t i = 0; i < arr->count && count < limit; i++) {
-            luby_value elem = arr->items[i];
-            int r = lazy_process_element(L, &elem, steps, nsteps);
-            if (r == 0) { luby_array_push_value(L, result, elem); count++; }
-            if (r == 2) break;
-        }
-    } else if (source.type == LUBY_T_RANGE && source.as.ptr) {
-        luby_range *rng = (luby_range *)source.as.ptr;
-        if (rng->start.type == LUBY_T_INT && rng->end.type == LUBY_T_INT) {
-            int64_t start = rng->start.as.i;
-            int64_t end = rng->end.as.i;
-            if (rng->exclusive) end--;
-            for (int64_t i = start; i <= end && count < limit; i++) {
-                luby_value elem = luby_int(i);
-                int r = lazy_process_element(L, &elem, steps, nsteps);
-                if (r == 0) { luby_array_push_value(L, result, elem); count++; }
-                if (r == 2) break;
-            }
+    // Results already handed back are rooted until the batch returns; a
+    // later item may allocate enough to trigger a collection
+    size_t temp_base = L->gc_temp_count;
+    int was_paused = L->gc_paused;
+    int first_rc = (int)LUBY_E_OK;
+    luby_error first_err = {0};
+    luby_value argv[LUBY_BATCH_MAX_ARGS];
+    for (size_t i = 0; i < n; i++) {
+        // Each item is its own invocation: fresh counters, no stale error
+        L->instruction_count = 0;
+        L->allocation_count = 0;
+        luby_clear_error(L);
+        luby_vm_reset(L, vm);
+
+        luby_value result = luby_nil();
+        int argc = args_fn ? args_fn(L, i, receivers[i], argv, user) : 0;
+        int rc;
+        if (argc < 0 || argc > LUBY_BATCH_MAX_ARGS) {
+            luby_set_error(L, LUBY_E_TYPE, "batch argument callback failed", NULL, 0, 0);
+            rc = (int)LUBY_E_TYPE;
+        } else {
+            rc = luby_method_ref_dispatch(L, ref, vm, receivers[i], argc, argv, &result);
         }
-    } else {
-        luby_value arr_val = luby_nil();
-        if (luby_invoke_method(L, source, "to_a", 0, NULL, &arr_val) == 0 &&
-            arr_val.type == LUBY_T_ARRAY && arr_val.as.ptr) {
-            luby_array *arr = (luby_array *)arr_val.as.ptr;
-            for (size_t i = 0; i < arr->count && count < limit; i++) {
-                luby_value elem = arr->items[i];
-                int r = lazy_process_element(L, &elem, steps, nsteps);
-                if (r == 0) { luby_array_push_value(L, result, elem); count++; }
-                if (r == 2) break;
-            }
+        L->saved_block_for_call = saved_sbfc;
+        if (rc != (int)LUBY_E_OK) result = luby_nil();
+        if (results) results[i] = result;
+        if (results && !luby_gc_push_temp(L, result)) L->gc_paused = 1;
+        if (status) status[i] = rc;
+        if (rc != (int)LUBY_E_OK && first_rc == (int)LUBY_E_OK) {
+            first_rc = rc;
+            first_err = L->last_error;
         }
     }
 
+    L->gc_temp_count = temp_base;
     L->gc_paused = was_paused;
-    if (out) *out = result;
-    return (int)LUBY_E_OK;
+    L->current_vm = saved_vm;
+    L->saved_block_for_call = saved_sbfc;
+    luby_method_ref_leave(L, ref, vm);
+    // Leave the first failure visible through luby_last_error
+    if (first_rc != (int)LUBY_E_OK) L->last_error = first_err;
+    else luby_clear_error(L);
+    return first_rc;
 }
 
-static int luby_array_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    const char *fname = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
-    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
-    if (!block && !fn) return (int)LUBY_E_TYPE;
-
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0;
-    dst->capacity = src->count;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+LUBY_API void luby_method_ref_free(luby_state *L, luby_method_ref *ref) {
+    if (!L || !ref) return;
+    if (ref->prev) ref->prev->next = ref->next;
+    else L->method_refs = ref->next;
+    if (ref->next) ref->next->prev = ref->prev;
+    luby_vm_free(L, &ref->vm);
+    luby_alloc_raw(L, ref, 0);
+}
 
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        if (block) {
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        } else {
-            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
-        }
-        dst->items[dst->count++] = res;
+LUBY_API int luby_call(luby_state *L, luby_value recv, const char *method, int argc, const luby_value *argv, luby_value *out) {
+    // If recv is nil, call as global function
+    if (recv.type == LUBY_T_NIL) {
+        return luby_invoke_global(L, method, argc, argv, out);
     }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
-    return (int)LUBY_E_OK;
+    return luby_invoke_method(L, recv, method, argc, argv, out);
 }
 
-static int luby_array_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    const char *fname = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
-    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
-    if (!block && !fn) return (int)LUBY_E_TYPE;
+static int luby_cfuncs_reserve(luby_state *L) {
+    if (L->cfuncs.count + 1 <= L->cfuncs.capacity) return 1;
+    size_t new_cap = L->cfuncs.capacity < 8 ? 8 : L->cfuncs.capacity * 2;
+    const char **nn = (const char **)luby_alloc_raw(L, L->cfuncs.names, new_cap * sizeof(char *));
+    if (nn) L->cfuncs.names = nn;
+    luby_cfunc *nf = (luby_cfunc *)luby_alloc_raw(L, L->cfuncs.funcs, new_cap * sizeof(luby_cfunc));
+    if (nf) L->cfuncs.funcs = nf;
+    luby_signature **ns = (luby_signature **)luby_alloc_raw(L, L->cfuncs.sigs, new_cap * sizeof(luby_signature *));
+    if (ns) L->cfuncs.sigs = ns;
+    if (!nn || !nf || !ns) return 0;
+    L->cfuncs.capacity = new_cap;
+    return 1;
+}
 
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0;
-    dst->capacity = src->count;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+LUBY_API int luby_register_function(luby_state *L, const char *name, luby_cfunc fn) {
+    if (!L || !name || !fn) return (int)LUBY_E_RUNTIME;
+    if (!luby_cfuncs_reserve(L)) return (int)LUBY_E_OOM;
+    L->cfuncs.names[L->cfuncs.count] = name;
+    L->cfuncs.funcs[L->cfuncs.count] = fn;
+    L->cfuncs.sigs[L->cfuncs.count] = NULL;
+    L->cfuncs.count++;
+    L->method_epoch++;  // call sites cache which typed native a name resolves to
+    return (int)LUBY_E_OK;
+}
 
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        if (block) {
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        } else {
-            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
-        }
-        if (luby_is_truthy(res)) dst->items[dst->count++] = src->items[i];
-    }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
+LUBY_API int luby_register_function_ex(luby_state *L, const char *name, luby_cfunc fn, const luby_signature *sig) {
+    if (!L || !name || !fn) return (int)LUBY_E_RUNTIME;
+    if (sig && !luby_sig_valid(sig)) return (int)LUBY_E_TYPE;
+    luby_signature *copy = NULL;
+    if (sig) {
+        copy = (luby_signature *)luby_alloc_raw(L, NULL, sizeof(luby_signature));
+        if (!copy) return (int)LUBY_E_OOM;
+        *copy = *sig;
+    }
+    int idx = luby_find_cfunc_index(L, name);
+    if (idx < 0) {
+        if (!luby_cfuncs_reserve(L)) { luby_alloc_raw(L, copy, 0); return (int)LUBY_E_OOM; }
+        idx = (int)L->cfuncs.count++;
+        L->cfuncs.names[idx] = name;
+        L->cfuncs.sigs[idx] = NULL;
+    }
+    luby_alloc_raw(L, L->cfuncs.sigs[idx], 0);
+    L->cfuncs.funcs[idx] = fn;
+    L->cfuncs.sigs[idx] = copy;
+    L->method_epoch++;
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    const char *fname = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
-    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
-    if (!block && !fn) return (int)LUBY_E_TYPE;
+LUBY_API int luby_register_module(luby_state *L, const char *name, luby_cfunc loader) {
+    return luby_register_function(L, name, loader);
+}
 
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0;
-    dst->capacity = src->count;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    dst->frozen = 0;
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+// --------------------------- Base Stdlib -----------------------------------
 
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        if (block) {
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        } else {
-            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
-        }
-        if (!luby_is_truthy(res)) dst->items[dst->count++] = src->items[i];
+static int luby_base_print(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    for (int i = 0; i < argc; i++) {
+        if (i > 0) printf(" ");
+        luby_print_value(argv[i]);
     }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
+    if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-static int luby_range_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_RANGE || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) {
-        if (out) *out = argv[0];
-        return (int)LUBY_E_OK;
+static int luby_base_puts(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc == 0) {
+        printf("\n");
+    } else {
+        for (int i = 0; i < argc; i++) {
+            luby_print_value(argv[i]);
+            printf("\n");
+        }
     }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
 
-    luby_range *range = (luby_range *)argv[0].as.ptr;
-    if (range->start.type != LUBY_T_INT || range->end.type != LUBY_T_INT) {
-        return (int)LUBY_E_TYPE;
-    }
-    
-    int64_t start = range->start.as.i;
-    int64_t end = range->end.as.i;
-    if (range->exclusive) end--;
-    
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+static int luby_base_type(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (out) {
+        *out = luby_string(L, luby_type_name(argv[0]), 0);
     }
-    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// Helper: get range bounds as int64, adjusting for exclusive
-static int luby_range_bounds(const luby_value *argv, int64_t *start, int64_t *end) {
-    if (argv[0].type != LUBY_T_RANGE || !argv[0].as.ptr) return 0;
-    luby_range *r = (luby_range *)argv[0].as.ptr;
-    if (r->start.type != LUBY_T_INT || r->end.type != LUBY_T_INT) return 0;
-    *start = r->start.as.i;
-    *end = r->end.as.i;
-    if (r->exclusive) (*end)--;
-    return 1;
+static int luby_base_to_i(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value v = argv[0];
+    if (v.type == LUBY_T_INT) { if (out) *out = v; return (int)LUBY_E_OK; }
+    if (v.type == LUBY_T_FLOAT) { if (out) *out = luby_int((int64_t)v.as.f); return (int)LUBY_E_OK; }
+    if (v.type == LUBY_T_STRING && v.as.ptr) { if (out) *out = luby_int(strtoll((const char *)v.as.ptr, NULL, 10)); return (int)LUBY_E_OK; }
+    if (out) *out = luby_int(0);
+    return (int)LUBY_E_OK;
 }
 
-// (1..5).to_a => [1,2,3,4,5]
-static int luby_range_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+static int luby_base_to_f(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
     if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    int64_t count = (end >= start) ? (end - start + 1) : 0;
-    int was_paused = L->gc_paused; L->gc_paused = 1;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = (size_t)count; arr->capacity = (size_t)count; arr->frozen = 0;
-    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
-    if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (int64_t i = 0; i < count; i++) arr->items[i] = luby_int(start + i);
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    luby_value v = argv[0];
+    if (v.type == LUBY_T_FLOAT) { if (out) *out = v; return (int)LUBY_E_OK; }
+    if (v.type == LUBY_T_INT) { if (out) *out = luby_float((double)v.as.i); return (int)LUBY_E_OK; }
+    if (v.type == LUBY_T_STRING && v.as.ptr) { if (out) *out = luby_float(strtod((const char *)v.as.ptr, NULL)); return (int)LUBY_E_OK; }
+    if (out) *out = luby_float(0.0);
     return (int)LUBY_E_OK;
 }
 
-// (1..5).size => 5
-static int luby_range_size(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+static int luby_base_len(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     (void)L;
     if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    int64_t count = (end >= start) ? (end - start + 1) : 0;
-    if (out) *out = luby_int(count);
+    luby_value v = argv[0];
+    if (v.type == LUBY_T_STRING && v.as.ptr) {
+        if (out) *out = luby_int((int64_t)strlen((const char *)v.as.ptr));
+        return (int)LUBY_E_OK;
+    }
+    if (v.type == LUBY_T_ARRAY && v.as.ptr) {
+        luby_array *arr = (luby_array *)v.as.ptr;
+        if (out) *out = luby_int((int64_t)arr->count);
+        return (int)LUBY_E_OK;
+    }
+    if (v.type == LUBY_T_HASH && v.as.ptr) {
+        luby_hash *h = (luby_hash *)v.as.ptr;
+        if (out) *out = luby_int((int64_t)h->count);
+        return (int)LUBY_E_OK;
+    }
+    if (v.type == LUBY_T_RANGE && v.as.ptr) {
+        luby_range *r = (luby_range *)v.as.ptr;
+        if (r->start.type == LUBY_T_INT && r->end.type == LUBY_T_INT) {
+            int64_t s = r->start.as.i, e = r->end.as.i;
+            if (r->exclusive) e--;
+            int64_t count = (e >= s) ? (e - s + 1) : 0;
+            if (out) *out = luby_int(count);
+        } else {
+            if (out) *out = luby_int(0);
+        }
+        return (int)LUBY_E_OK;
+    }
+    if (out) *out = luby_int(0);
     return (int)LUBY_E_OK;
 }
 
-// (1..10).include?(5) => true
-static int luby_range_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    if (argv[1].type != LUBY_T_INT) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
-    int64_t v = argv[1].as.i;
-    if (out) *out = luby_bool(v >= start && v <= end);
+static int luby_array_check_mutable(luby_state *L, int argc, const luby_value *argv, int min_argc) {
+    if (argc < min_argc || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    if (((luby_array *)argv[0].as.ptr)->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
     return (int)LUBY_E_OK;
 }
 
-// (3..7).min => 3
-static int luby_range_min(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    if (out) *out = (start <= end) ? luby_int(start) : luby_nil();
+// Optional element count for pop(n)/shift(n); -1 when absent
+static int luby_array_count_arg(luby_state *L, int argc, const luby_value *argv, int64_t *n) {
+    *n = -1;
+    if (argc < 2) return (int)LUBY_E_OK;
+    if (argv[1].type != LUBY_T_INT || argv[1].as.i < 0) {
+        if (L) luby_set_error(L, LUBY_E_TYPE, "expected a non-negative count", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    *n = argv[1].as.i;
     return (int)LUBY_E_OK;
 }
 
-// (3..7).max => 7
-static int luby_range_max(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    if (out) *out = (start <= end) ? luby_int(end) : luby_nil();
+// push(arr, v...) / arr.push(v...) -> arr
+static int luby_array_push(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_array_check_mutable(L, argc, argv, 2);
+    if (rc != 0) return rc;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    size_t n = (size_t)argc - 1;
+    if (!luby_array_reserve(L, arr, arr->count + n)) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < n; i++) arr->items[arr->count++] = argv[i + 1];
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// (1..5).first => 1, (1..5).first(3) => [1,2,3]
-static int luby_range_first(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    if (argc >= 2 && argv[1].type == LUBY_T_INT) {
-        int64_t n = argv[1].as.i;
-        int64_t total = (end >= start) ? (end - start + 1) : 0;
-        if (n > total) n = total;
-        if (n < 0) n = 0;
-        int was_paused = L->gc_paused; L->gc_paused = 1;
-        luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        arr->count = (size_t)n; arr->capacity = (size_t)n; arr->frozen = 0;
-        arr->items = n > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)n * sizeof(luby_value)) : NULL;
-        if (!arr->items && n > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        for (int64_t i = 0; i < n; i++) arr->items[i] = luby_int(start + i);
-        L->gc_paused = was_paused;
-        if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    } else {
-        if (out) *out = (start <= end) ? luby_int(start) : luby_nil();
+// pop(arr) -> last element or nil; pop(arr, n) -> array of the last n
+static int luby_array_pop(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_array_check_mutable(L, argc, argv, 1);
+    if (rc != 0) return rc;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    int64_t n;
+    if ((rc = luby_array_count_arg(L, argc, argv, &n)) != 0) return rc;
+    if (n < 0) {
+        luby_value v = arr->count ? arr->items[--arr->count] : luby_nil();
+        if (out) *out = v;
+        return (int)LUBY_E_OK;
     }
+    size_t take = (size_t)n > arr->count ? arr->count : (size_t)n;
+    luby_value res = luby_array_new(L);
+    if (res.type != LUBY_T_ARRAY) return (int)LUBY_E_OOM;
+    luby_array *ra = (luby_array *)res.as.ptr;
+    if (take && !luby_array_reserve(L, ra, take)) return (int)LUBY_E_OOM;
+    memcpy(ra->items, arr->items + arr->count - take, take * sizeof(luby_value));
+    ra->count = take;
+    arr->count -= take;
+    if (out) *out = res;
     return (int)LUBY_E_OK;
 }
 
-// (1..5).last => 5, (1..5).last(2) => [4,5]
-static int luby_range_last(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    if (argc >= 2 && argv[1].type == LUBY_T_INT) {
-        int64_t n = argv[1].as.i;
-        int64_t total = (end >= start) ? (end - start + 1) : 0;
-        if (n > total) n = total;
-        if (n < 0) n = 0;
-        int64_t s = end - n + 1;
-        int was_paused = L->gc_paused; L->gc_paused = 1;
-        luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        arr->count = (size_t)n; arr->capacity = (size_t)n; arr->frozen = 0;
-        arr->items = n > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)n * sizeof(luby_value)) : NULL;
-        if (!arr->items && n > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        for (int64_t i = 0; i < n; i++) arr->items[i] = luby_int(s + i);
-        L->gc_paused = was_paused;
-        if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    } else {
-        if (out) *out = (start <= end) ? luby_int(end) : luby_nil();
+// shift(arr) -> first element or nil; shift(arr, n) -> array of the first n.
+// O(1) in the element count: the front gap grows instead of moving items.
+static int luby_array_shift(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_array_check_mutable(L, argc, argv, 1);
+    if (rc != 0) return rc;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    int64_t n;
+    if ((rc = luby_array_count_arg(L, argc, argv, &n)) != 0) return rc;
+    if (n < 0) {
+        luby_value v = arr->count ? arr->items[0] : luby_nil();
+        luby_array_drop_front(arr, 1);
+        if (out) *out = v;
+        return (int)LUBY_E_OK;
     }
+    size_t take = (size_t)n > arr->count ? arr->count : (size_t)n;
+    luby_value res = luby_array_new(L);
+    if (res.type != LUBY_T_ARRAY) return (int)LUBY_E_OOM;
+    luby_array *ra = (luby_array *)res.as.ptr;
+    if (take && !luby_array_reserve(L, ra, take)) return (int)LUBY_E_OOM;
+    memcpy(ra->items, arr->items, take * sizeof(luby_value));
+    ra->count = take;
+    luby_array_drop_front(arr, take);
+    if (out) *out = res;
     return (int)LUBY_E_OK;
 }
 
-// (1..10).step(3) { |x| ... } or (1..10).step(2) => array
-static int luby_range_step(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    if (argv[1].type != LUBY_T_INT || argv[1].as.i <= 0) return (int)LUBY_E_TYPE;
-    int64_t step = argv[1].as.i;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (block) {
-        for (int64_t i = start; i <= end; i += step) {
-            luby_value iv = luby_int(i);
-            luby_value res = luby_nil();
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        }
-        if (out) *out = argv[0];
-    } else {
-        // Return array of stepped values
-        int64_t count = (end >= start) ? ((end - start) / step + 1) : 0;
-        int was_paused = L->gc_paused; L->gc_paused = 1;
-        luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        arr->count = (size_t)count; arr->capacity = (size_t)count; arr->frozen = 0;
-        arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
-        if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        int64_t idx = 0;
-        for (int64_t i = start; i <= end; i += step) arr->items[idx++] = luby_int(i);
-        L->gc_paused = was_paused;
-        if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    }
+static int luby_array_prepend_values(luby_state *L, luby_array *arr, const luby_value *vals, size_t n) {
+    if (n && !luby_array_reserve_front(L, arr, n)) return (int)LUBY_E_OOM;
+    arr->items -= n;
+    arr->head -= n;
+    arr->capacity += n;
+    arr->count += n;
+    for (size_t i = 0; i < n; i++) arr->items[i] = vals[i];
     return (int)LUBY_E_OK;
 }
 
-// (1..5).reverse_each { |x| ... }
-static int luby_range_reverse_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    for (int64_t i = end; i >= start; i--) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-    }
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+// unshift(arr, v...) -> arr, with the values in argument order at the front
+static int luby_array_unshift(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_array_check_mutable(L, argc, argv, 1);
+    if (rc != 0) return rc;
+    rc = luby_array_prepend_values(L, (luby_array *)argv[0].as.ptr, argv + 1, (size_t)argc - 1);
+    if (rc == 0 && out) *out = argv[0];
+    return rc;
 }
 
-// (1..100).sum => 5050, (1..5).sum { |x| x * x } => 55
-static int luby_range_sum(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (block) {
-        int64_t sum = 0;
-        for (int64_t i = start; i <= end; i++) {
-            luby_value iv = luby_int(i);
-            luby_value res = luby_nil();
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-            if (res.type == LUBY_T_INT) sum += res.as.i;
-        }
-        if (out) *out = luby_int(sum);
-    } else {
-        // Arithmetic series: n*(start+end)/2
-        if (end < start) { if (out) *out = luby_int(0); return (int)LUBY_E_OK; }
-        int64_t n = end - start + 1;
-        int64_t sum = n * (start + end) / 2;
-        if (out) *out = luby_int(sum);
-    }
-    return (int)LUBY_E_OK;
+// insert(arr, index, v...) -> arr.  Negative indexes count from the end,
+// -1 inserting after the last element; a gap past the end fills with nil.
+static int luby_array_insert(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_array_check_mutable(L, argc, argv, 2);
+    if (rc != 0) return rc;
+    if (argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    int64_t idx = argv[1].as.i;
+    if (idx < 0) {
+        idx += (int64_t)arr->count + 1;
+        if (idx < 0) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "index out of range", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    }
+    size_t n = (size_t)argc - 2;
+    size_t at = (size_t)idx;
+    if (at == 0) {
+        rc = luby_array_prepend_values(L, arr, argv + 2, n);
+    } else if (n > 0) {
+        size_t old = arr->count;
+        size_t end = at > old ? at : old;
+        if (!luby_array_reserve(L, arr, end + n)) return (int)LUBY_E_OOM;
+        if (at < old) memmove(arr->items + at + n, arr->items + at, (old - at) * sizeof(luby_value));
+        for (size_t i = old; i < at; i++) arr->items[i] = luby_nil();
+        for (size_t i = 0; i < n; i++) arr->items[at + i] = argv[i + 2];
+        arr->count = end + n;
+    }
+    if (rc == 0 && out) *out = argv[0];
+    return rc;
 }
 
-// Range map: (1..5).map { |x| x * 2 } => [2,4,6,8,10]
-static int luby_range_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    int64_t count = (end >= start) ? (end - start + 1) : 0;
-    int was_paused = L->gc_paused; L->gc_paused = 1;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = 0; arr->capacity = (size_t)count; arr->frozen = 0;
-    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
-    if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    L->gc_paused = was_paused;
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        arr->items[arr->count++] = res;
-    }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    return (int)LUBY_E_OK;
-}
+enum {
+    LUBY_ENUM_ARRAY = 0,
+    LUBY_ENUM_ARRAY_WITH_INDEX = 1,
+    LUBY_ENUM_HASH = 2
+};
 
-// Range select: (1..10).select { |x| x % 2 == 0 } => [2,4,6,8,10]
-static int luby_range_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    int64_t count = (end >= start) ? (end - start + 1) : 0;
-    int was_paused = L->gc_paused; L->gc_paused = 1;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = 0; arr->capacity = (size_t)count; arr->frozen = 0;
-    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
-    if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    L->gc_paused = was_paused;
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        if (luby_is_truthy(res)) arr->items[arr->count++] = iv;
+static luby_value luby_enum_new(luby_state *L, luby_value target, int kind) {
+    luby_string_view name = { "Enumerator", 10 };
+    luby_value cv = luby_get_global(L, name);
+    luby_class_obj *cls = NULL;
+    if (cv.type == LUBY_T_CLASS && cv.as.ptr) {
+        cls = (luby_class_obj *)cv.as.ptr;
+    } else {
+        cls = luby_class_new(L, "Enumerator", NULL);
+        if (!cls) return luby_nil();
+        luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
+        luby_set_global(L, name, v);
     }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    return (int)LUBY_E_OK;
-}
+    luby_object *obj = luby_object_new(L, cls);
+    if (!obj) return luby_nil();
+    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
 
-// Range reject: (1..10).reject { |x| x % 2 == 0 } => [1,3,5,7,9]
-static int luby_range_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    int64_t count = (end >= start) ? (end - start + 1) : 0;
-    int was_paused = L->gc_paused; L->gc_paused = 1;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = 0; arr->capacity = (size_t)count; arr->frozen = 0;
-    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
-    if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    L->gc_paused = was_paused;
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        if (!luby_is_truthy(res)) arr->items[arr->count++] = iv;
-    }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    return (int)LUBY_E_OK;
+    luby_value key_target = luby_symbol(L, "_enum_target", 0);
+    luby_value key_index = luby_symbol(L, "_enum_index", 0);
+    luby_value key_kind = luby_symbol(L, "_enum_kind", 0);
+    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_target, target);
+    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_index, luby_int(0));
+    luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key_kind, luby_int(kind));
+    return ov;
 }
 
-// Range any?: (1..5).any? { |x| x > 3 } => true
-static int luby_range_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = luby_bool(start <= end); return (int)LUBY_E_OK; }
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
-    }
-    if (out) *out = luby_bool(0);
-    return (int)LUBY_E_OK;
+static int luby_enum_get_field(luby_state *L, luby_object *obj, const char *name, luby_value *out) {
+    if (!obj || !obj->ivars) return (int)LUBY_E_TYPE;
+    luby_value key = luby_symbol(L, name, 0);
+    return luby_hash_get_value((luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key, out);
 }
 
-// Range all?: (1..5).all? { |x| x > 0 } => true
-static int luby_range_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        if (!luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
-    }
-    if (out) *out = luby_bool(1);
-    return (int)LUBY_E_OK;
+static int luby_enum_set_field(luby_state *L, luby_object *obj, const char *name, luby_value val) {
+    if (!obj || !obj->ivars) return (int)LUBY_E_TYPE;
+    luby_value key = luby_symbol(L, name, 0);
+    return luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = obj->ivars }, key, val);
 }
 
-// Range none?: (1..5).none? { |x| x > 10 } => true
-static int luby_range_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int64_t start, end;
-    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = luby_bool(start > end); return (int)LUBY_E_OK; }
-    for (int64_t i = start; i <= end; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
-    }
-    if (out) *out = luby_bool(1);
-    return (int)LUBY_E_OK;
+static luby_value luby_make_pair_array(luby_state *L, luby_value a, luby_value b) {
+    luby_value arrv = luby_array_new(L);
+    if (arrv.type != LUBY_T_ARRAY || !arrv.as.ptr) return luby_nil();
+    luby_array_set(L, arrv, 0, a);
+    luby_array_set(L, arrv, 1, b);
+    return arrv;
 }
 
-static int luby_generic_each(luby_state *L, int argc, const luby_value *argv, luby_value *out);
+static int luby_enum_next(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_object *obj = (luby_object *)argv[0].as.ptr;
+    luby_value target = luby_nil();
+    luby_value indexv = luby_nil();
+    luby_value kindv = luby_nil();
+    if (luby_enum_get_field(L, obj, "_enum_target", &target) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+    if (luby_enum_get_field(L, obj, "_enum_index", &indexv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+    if (luby_enum_get_field(L, obj, "_enum_kind", &kindv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
 
-static int luby_array_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    const char *fname = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
-    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
-    if (!block && !fn) {
-        if (out) *out = luby_enum_new(L, argv[0], LUBY_ENUM_ARRAY);
+    if (indexv.type != LUBY_T_INT || kindv.type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    int64_t idx = indexv.as.i;
+    int kind = (int)kindv.as.i;
+
+    if (kind == LUBY_ENUM_ARRAY || kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
+        if (target.type != LUBY_T_ARRAY || !target.as.ptr) return (int)LUBY_E_TYPE;
+        luby_array *arr = (luby_array *)target.as.ptr;
+        if (idx < 0 || (size_t)idx >= arr->count) {
+            luby_set_error(L, LUBY_E_RUNTIME, "stop iteration", NULL, 0, 0);
+            return (int)LUBY_E_RUNTIME;
+        }
+        luby_value v = arr->items[idx];
+        idx++;
+        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
+        if (kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
+            if (out) *out = luby_make_pair_array(L, v, luby_int(idx - 1));
+        } else {
+            if (out) *out = v;
+        }
         return (int)LUBY_E_OK;
     }
 
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        if (block) {
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        } else {
-            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
+    if (kind == LUBY_ENUM_HASH) {
+        if (target.type != LUBY_T_HASH || !target.as.ptr) return (int)LUBY_E_TYPE;
+        luby_hash *h = (luby_hash *)target.as.ptr;
+        if (idx < 0 || (size_t)idx >= h->count) {
+            luby_set_error(L, LUBY_E_RUNTIME, "stop iteration", NULL, 0, 0);
+            return (int)LUBY_E_RUNTIME;
         }
+        luby_hash_entry *e = &h->entries[idx];
+        idx++;
+        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
+        if (out) *out = luby_make_pair_array(L, e->key, e->value);
+        return (int)LUBY_E_OK;
     }
+
+    return (int)LUBY_E_TYPE;
+}
+
+static int luby_enum_rewind(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_object *obj = (luby_object *)argv[0].as.ptr;
+    luby_enum_set_field(L, obj, "_enum_index", luby_int(0));
     if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_each_with_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+static int luby_enum_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    const char *fname = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
-    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
-    if (!block && !fn) {
-        if (out) *out = luby_enum_new(L, argv[0], LUBY_ENUM_ARRAY_WITH_INDEX);
+    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+
+    luby_object *obj = (luby_object *)argv[0].as.ptr;
+    luby_value target = luby_nil();
+    luby_value indexv = luby_nil();
+    luby_value kindv = luby_nil();
+    if (luby_enum_get_field(L, obj, "_enum_target", &target) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+    if (luby_enum_get_field(L, obj, "_enum_index", &indexv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+    if (luby_enum_get_field(L, obj, "_enum_kind", &kindv) != (int)LUBY_E_OK) return (int)LUBY_E_TYPE;
+
+    if (indexv.type != LUBY_T_INT || kindv.type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    int64_t idx = indexv.as.i;
+    int kind = (int)kindv.as.i;
+
+    if (kind == LUBY_ENUM_ARRAY || kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
+        if (target.type != LUBY_T_ARRAY || !target.as.ptr) return (int)LUBY_E_TYPE;
+        luby_array *arr = (luby_array *)target.as.ptr;
+        for (; idx < (int64_t)arr->count; idx++) {
+            luby_value res = luby_nil();
+            if (kind == LUBY_ENUM_ARRAY_WITH_INDEX) {
+                luby_value args[2];
+                args[0] = arr->items[idx];
+                args[1] = luby_int(idx);
+                LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+            } else {
+                LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &arr->items[idx], &res, out, luby_nil());
+            }
+        }
+        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
+        if (out) *out = argv[0];
         return (int)LUBY_E_OK;
     }
 
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value args[2];
-        args[0] = src->items[i];
-        args[1] = luby_int((int64_t)i);
-        luby_value res = luby_nil();
-        if (block) {
+    if (kind == LUBY_ENUM_HASH) {
+        if (target.type != LUBY_T_HASH || !target.as.ptr) return (int)LUBY_E_TYPE;
+        luby_hash *h = (luby_hash *)target.as.ptr;
+        for (; idx < (int64_t)h->count; idx++) {
+            luby_value args[2];
+            args[0] = h->entries[idx].key;
+            args[1] = h->entries[idx].value;
+            luby_value res = luby_nil();
             LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        } else {
-            if (fn(L, 2, args, &res) != 0) return (int)LUBY_E_RUNTIME;
         }
+        luby_enum_set_field(L, obj, "_enum_index", luby_int(idx));
+        if (out) *out = argv[0];
+        return (int)LUBY_E_OK;
     }
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
-}
-
-static int luby_array_compact(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0;
-    dst->capacity = src->count;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    dst->frozen = 0;
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
 
-    for (size_t i = 0; i < src->count; i++) {
-        if (src->items[i].type != LUBY_T_NIL) {
-            dst->items[dst->count++] = src->items[i];
-        }
-    }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
-    return (int)LUBY_E_OK;
+    return (int)LUBY_E_TYPE;
 }
 
-static int luby_array_compact_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    if (arr->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    size_t write = 0;
-    for (size_t i = 0; i < arr->count; i++) {
-        if (arr->items[i].type != LUBY_T_NIL) {
-            arr->items[write++] = arr->items[i];
-        }
-    }
-    arr->count = write;
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+// Coroutine wrapped by a Coroutine/Fiber object, or NULL
+static luby_coroutine *luby_object_coroutine(luby_object *obj) {
+    if (!obj->native_ref || obj->native_ref->gc_type != LUBY_GC_COROUTINE) return NULL;
+    return (luby_coroutine *)obj->native_ref;
 }
 
-static int luby_array_reduce(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
+static int luby_coroutine_new_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_proc *proc = NULL;
+    if (argc >= 1 && argv[0].type == LUBY_T_PROC) proc = (luby_proc *)argv[0].as.ptr;
+    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
+    if (!proc) return (int)LUBY_E_TYPE;
 
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    if (src->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+    luby_coroutine *co = luby_coroutine_new(L, (luby_value){ .type = LUBY_T_PROC, .as.ptr = proc });
+    if (!co) return (int)LUBY_E_OOM;
 
-    size_t i = 0;
-    luby_value acc = luby_nil();
-    if (argc >= 2) {
-        acc = argv[1];
+    luby_string_view name = { "Coroutine", 9 };
+    luby_value cv = luby_get_global(L, name);
+    luby_class_obj *cls = NULL;
+    if (cv.type == LUBY_T_CLASS && cv.as.ptr) {
+        cls = (luby_class_obj *)cv.as.ptr;
     } else {
-        acc = src->items[0];
-        i = 1;
-    }
-
-    for (; i < src->count; i++) {
-        luby_value args[2];
-        args[0] = acc;
-        args[1] = src->items[i];
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &acc, out, luby_nil());
+        cls = luby_class_new(L, "Coroutine", NULL);
+        if (!cls) return (int)LUBY_E_OOM;
+        luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
+        luby_set_global(L, name, v);
     }
-    if (out) *out = acc;
+    luby_object *obj = luby_object_new(L, cls);
+    if (!obj) return (int)LUBY_E_OOM;
+    obj->native_ref = &co->gc;  // GC-traceable reference to keep coroutine alive
+    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
+    if (out) *out = ov;
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
-    }
-    if (out) *out = luby_bool(0);
-    return (int)LUBY_E_OK;
+static int luby_coroutine_resume_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_coroutine *co = luby_object_coroutine((luby_object *)argv[0].as.ptr);
+    if (!co) return (int)LUBY_E_TYPE;
+
+    luby_value rv = luby_nil();
+    int yielded = 0;
+    int rc = luby_coroutine_resume(L, co, argc - 1, argv + 1, &rv, &yielded);
+    if (out) *out = rv;
+    return rc;
 }
 
-static int luby_array_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        if (!luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
-    }
-    if (out) *out = luby_bool(1);
+static int luby_coroutine_alive_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    (void)L;
+    luby_coroutine *co = luby_object_coroutine((luby_object *)argv[0].as.ptr);
+    int alive = (co && !co->done);
+    if (out) *out = luby_bool(alive);
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
+/* ---- Fiber cfuncs ---- */
+
+static int luby_fiber_new_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_proc *proc = NULL;
+    if (argc >= 1 && argv[0].type == LUBY_T_PROC) proc = (luby_proc *)argv[0].as.ptr;
+    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
+    if (!proc) {
+        luby_set_error(L, LUBY_E_TYPE, "tried to create Fiber without a block", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (out) *out = luby_bool(1);
-    return (int)LUBY_E_OK;
-}
 
-static int luby_array_find(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = src->items[i]; return (int)LUBY_E_OK; }
+    luby_coroutine *co = luby_coroutine_new(L, (luby_value){ .type = LUBY_T_PROC, .as.ptr = proc });
+    if (!co) return (int)LUBY_E_OOM;
+
+    luby_string_view name = { "Fiber", 5 };
+    luby_value cv = luby_get_global(L, name);
+    luby_class_obj *cls = NULL;
+    if (cv.type == LUBY_T_CLASS && cv.as.ptr) {
+        cls = (luby_class_obj *)cv.as.ptr;
+    } else {
+        cls = luby_class_new(L, "Fiber", NULL);
+        if (!cls) return (int)LUBY_E_OOM;
+        luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
+        luby_set_global(L, name, v);
     }
-    if (out) *out = luby_nil();
+    luby_object *obj = luby_object_new(L, cls);
+    if (!obj) return (int)LUBY_E_OOM;
+    obj->native_ref = &co->gc;  // GC-traceable reference to keep coroutine alive
+    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
+    if (out) *out = ov;
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_get(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        if (luby_value_eq(h->entries[i].key, argv[1])) {
-            if (out) *out = h->entries[i].value;
-            return (int)LUBY_E_OK;
-        }
+static int luby_fiber_resume_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) {
+        luby_set_error(L, LUBY_E_TYPE, "resume called on non-Fiber", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (out) *out = luby_nil();
-    return (int)LUBY_E_OK;
+    luby_coroutine *co = luby_object_coroutine((luby_object *)argv[0].as.ptr);
+    if (!co) {
+        luby_set_error(L, LUBY_E_TYPE, "resume called on non-Fiber", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+
+    luby_value rv = luby_nil();
+    int yielded = 0;
+    int rc = luby_coroutine_resume(L, co, argc - 1, argv + 1, &rv, &yielded);
+    if (out) *out = rv;
+    return rc;
 }
 
-static int luby_hash_set(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 3 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    if (h->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    for (size_t i = 0; i < h->count; i++) {
-        if (luby_value_eq(h->entries[i].key, argv[1])) {
-            h->entries[i].value = argv[2];
-            if (out) *out = argv[0];
-            return (int)LUBY_E_OK;
-        }
-    }
-    if (h->count + 1 > h->capacity) {
-        size_t new_cap = h->capacity < 8 ? 8 : h->capacity * 2;
-        luby_hash_entry *ne = (luby_hash_entry *)luby_alloc_raw(L, h->entries, new_cap * sizeof(luby_hash_entry));
-        if (!ne) return (int)LUBY_E_OOM;
-        h->entries = ne;
-        h->capacity = new_cap;
+static int luby_fiber_yield_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (!L->current_coroutine) {
+        luby_set_error(L, LUBY_E_RUNTIME, "Fiber.yield called outside of fiber", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
     }
-    h->entries[h->count].key = argv[1];
-    h->entries[h->count].value = argv[2];
-    h->count++;
-    if (out) *out = argv[0];
+    luby_value val = (argc >= 1) ? argv[0] : luby_nil();
+    return luby_native_yield(L, val);
+}
+
+static int luby_fiber_alive_cfunc(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    (void)L;
+    luby_coroutine *co = luby_object_coroutine((luby_object *)argv[0].as.ptr);
+    int alive = (co && !co->done);
+    if (out) *out = luby_bool(alive);
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_merge(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    if (argv[1].type != LUBY_T_HASH || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *a = (luby_hash *)argv[0].as.ptr;
-    luby_hash *b = (luby_hash *)argv[1].as.ptr;
-    luby_hash *dst = luby_hash_new_heap(L);
-    if (!dst) return (int)LUBY_E_OOM;
+/* ---- Lazy Enumerator ---- */
 
-    for (size_t i = 0; i < a->count; i++) {
-        luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, a->entries[i].key, a->entries[i].value);
-    }
-    for (size_t i = 0; i < b->count; i++) {
-        luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, b->entries[i].key, b->entries[i].value);
-    }
-    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = dst;
-    if (out) *out = v;
+/* A Lazy chain is a linked list of immutable nodes: each map/select/... call
+   creates a child pointing at its parent. The first terminal operation on a
+   node compiles the chain into a flat step program and caches it on that
+   node, so repeated terminal calls skip the walk. Elements then stream through
+   the program one at a time; nothing is materialized unless the terminal
+   operation collects into an array. */
+
+/* Step kinds: 0=identity, 1=map, 2=select, 3=reject, 4=take, 5=drop, 6=flat_map */
+#define LAZY_IDENTITY 0
+#define LAZY_MAP      1
+#define LAZY_SELECT   2
+#define LAZY_REJECT   3
+#define LAZY_TAKE     4
+#define LAZY_DROP     5
+#define LAZY_FLAT_MAP 6
+
+/* lazy_feed results */
+#define LAZY_NEXT 0
+#define LAZY_STOP 1
+
+typedef struct {
+    int kind;
+    luby_proc *block;   /* for map/select/reject/flat_map */
+    int64_t n;          /* for take/drop */
+} lazy_step;
+
+/* Compiled chain, stored as userdata in the terminal node's "_lz_prog" field.
+   Blocks and the source stay reachable through the chain's own fields. */
+typedef struct {
+    luby_value source;
+    int nsteps;
+    lazy_step steps[];
+} lazy_program;
+
+/* State for one terminal operation */
+typedef struct {
+    const lazy_program *prog;
+    int64_t *counters;      /* take/drop progress, one slot per step */
+    luby_vm vm;             /* shared by every block call of this run */
+    luby_value result;      /* collecting sink, or nil */
+    luby_proc *sink;        /* yielding sink, or NULL */
+    int64_t limit;          /* stop after this many emitted elements; -1 = unlimited */
+    int64_t emitted;
+    int rc;                 /* first failing block status (LUBY_E_BREAK on break) */
+} lazy_run;
+
+/* Helper: get Lazy class, creating if needed */
+static luby_class_obj *lazy_get_class(luby_state *L) {
+    luby_string_view name = { "Lazy", 4 };
+    luby_value cv = luby_get_global(L, name);
+    if (cv.type == LUBY_T_CLASS && cv.as.ptr) return (luby_class_obj *)cv.as.ptr;
+    luby_class_obj *cls = luby_class_new(L, "Lazy", NULL);
+    if (!cls) return NULL;
+    luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
+    luby_set_global(L, name, v);
+    return cls;
+}
+
+/* Helper: create a Lazy object with ivars */
+static luby_value lazy_make_obj(luby_state *L, luby_value source, luby_value parent, int kind, luby_value arg) {
+    luby_class_obj *cls = lazy_get_class(L);
+    if (!cls) return luby_nil();
+    luby_object *obj = luby_object_new(L, cls);
+    if (!obj) return luby_nil();
+    luby_enum_set_field(L, obj, "_lz_src", source);
+    luby_enum_set_field(L, obj, "_lz_par", parent);
+    luby_enum_set_field(L, obj, "_lz_kind", luby_int(kind));
+    luby_enum_set_field(L, obj, "_lz_arg", arg);
+    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
+    return ov;
+}
+
+/* lazy_create(source) — creates root Lazy wrapping a source */
+static int luby_lazy_create(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value ov = lazy_make_obj(L, argv[0], luby_nil(), LAZY_IDENTITY, luby_nil());
+    if (ov.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
+    if (out) *out = ov;
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) {
-        if (out) *out = luby_enum_new(L, argv[0], LUBY_ENUM_HASH);
-        return (int)LUBY_E_OK;
-    }
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-    }
-    if (out) *out = argv[0];
+/* lazy_chain(parent_lazy, kind_int, arg) — creates child Lazy */
+static int luby_lazy_chain(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    luby_value parent = argv[0];
+    int kind = (argv[1].type == LUBY_T_INT) ? (int)argv[1].as.i : 0;
+    luby_value arg = argv[2];
+    luby_value ov = lazy_make_obj(L, luby_nil(), parent, kind, arg);
+    if (ov.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
+    if (out) *out = ov;
     return (int)LUBY_E_OK;
 }
 
-static int luby_generic_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    switch (argv[0].type) {
-        case LUBY_T_ARRAY: return luby_array_each(L, argc, argv, out);
-        case LUBY_T_HASH: return luby_hash_each(L, argc, argv, out);
-        case LUBY_T_RANGE: return luby_range_each(L, argc, argv, out);
-        default: return (int)LUBY_E_TYPE;
+/* Compile the chain ending at lv, or return the program cached by an earlier
+   terminal call. Identity steps are dropped; take(a).take(b) and
+   drop(a).drop(b) collapse into a single counter step. */
+static const lazy_program *lazy_program_for(luby_state *L, luby_value lv) {
+    luby_object *leaf = (luby_object *)lv.as.ptr;
+    luby_value cached = luby_nil();
+    luby_enum_get_field(L, leaf, "_lz_prog", &cached);
+    if (cached.type == LUBY_T_USERDATA) {
+        void *p = luby_userdata_ptr(cached);
+        if (p) return (const lazy_program *)p;
+    }
+
+    size_t depth = 0;
+    luby_value cur = lv;
+    while (cur.type == LUBY_T_OBJECT && cur.as.ptr) {
+        depth++;
+        luby_value par = luby_nil();
+        luby_enum_get_field(L, (luby_object *)cur.as.ptr, "_lz_par", &par);
+        cur = par;
+    }
+
+    /* Fill root-to-leaf by walking leaf-to-root into the tail of the buffer */
+    lazy_step *tmp = (lazy_step *)luby_alloc_raw(L, NULL, (depth ? depth : 1) * sizeof(lazy_step));
+    if (!tmp) return NULL;
+    luby_value source = luby_nil();
+    size_t pos = depth;
+    cur = lv;
+    while (cur.type == LUBY_T_OBJECT && cur.as.ptr) {
+        luby_object *obj = (luby_object *)cur.as.ptr;
+        luby_value kv = luby_nil(), av = luby_nil(), par = luby_nil();
+        luby_enum_get_field(L, obj, "_lz_kind", &kv);
+        luby_enum_get_field(L, obj, "_lz_arg", &av);
+        luby_enum_get_field(L, obj, "_lz_par", &par);
+        lazy_step *s = &tmp[--pos];
+        s->kind = (kv.type == LUBY_T_INT) ? (int)kv.as.i : LAZY_IDENTITY;
+        s->block = (av.type == LUBY_T_PROC && av.as.ptr) ? (luby_proc *)av.as.ptr : NULL;
+        s->n = (av.type == LUBY_T_INT) ? av.as.i : 0;
+        if (par.type != LUBY_T_OBJECT) luby_enum_get_field(L, obj, "_lz_src", &source);
+        cur = par;
     }
+
+    size_t count = 0;
+    for (size_t i = 0; i < depth; i++) {
+        lazy_step s = tmp[i];
+        if (s.kind < LAZY_MAP || s.kind > LAZY_FLAT_MAP) continue;
+        if ((s.kind == LAZY_MAP || s.kind == LAZY_SELECT || s.kind == LAZY_REJECT ||
+             s.kind == LAZY_FLAT_MAP) && !s.block) continue;
+        if (s.n < 0) s.n = 0;
+        if (count > 0 && s.kind == LAZY_TAKE && tmp[count - 1].kind == LAZY_TAKE) {
+            if (s.n < tmp[count - 1].n) tmp[count - 1].n = s.n;
+            continue;
+        }
+        if (count > 0 && s.kind == LAZY_DROP && tmp[count - 1].kind == LAZY_DROP) {
+            tmp[count - 1].n = (s.n > INT64_MAX - tmp[count - 1].n) ? INT64_MAX : tmp[count - 1].n + s.n;
+            continue;
+        }
+        tmp[count++] = s;
+    }
+
+    luby_value ud = luby_new_userdata(L, sizeof(lazy_program) + count * sizeof(lazy_step), NULL);
+    lazy_program *prog = (lazy_program *)luby_userdata_ptr(ud);
+    if (!prog) { luby_alloc_raw(L, tmp, 0); return NULL; }
+    ((luby_userdata *)ud.as.ptr)->cache = 1;  // holds raw proc pointers
+    prog->source = source;
+    prog->nsteps = (int)count;
+    if (count > 0) memcpy(prog->steps, tmp, count * sizeof(lazy_step));
+    luby_alloc_raw(L, tmp, 0);
+    luby_enum_set_field(L, leaf, "_lz_prog", ud);
+    return prog;
 }
 
-static int luby_hash_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0;
-    dst->capacity = h->count;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+static int lazy_call(luby_state *L, lazy_run *run, luby_proc *block, luby_value arg, luby_value *res) {
+    int rc = luby_call_block_on(L, &run->vm, block, 1, &arg, res);
+    if (rc != 0) { run->rc = rc; return 0; }
+    return 1;
+}
 
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
+static int lazy_emit(luby_state *L, lazy_run *run, luby_value elem) {
+    if (run->sink) {
         luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        dst->items[dst->count++] = res;
+        if (!lazy_call(L, run, run->sink, elem, &res)) return LAZY_STOP;
+    } else {
+        luby_array_push_value(L, run->result, elem);
     }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
-    return (int)LUBY_E_OK;
+    run->emitted++;
+    if (run->limit >= 0 && run->emitted >= run->limit) return LAZY_STOP;
+    return LAZY_NEXT;
 }
 
-static int luby_hash_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    luby_hash *dst = luby_hash_new_heap(L);
-    if (!dst) return (int)LUBY_E_OOM;
-
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        if (luby_is_truthy(res)) {
-            luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, h->entries[i].key, h->entries[i].value);
+/* Push one element through steps [from, nsteps) and into the sink */
+static int lazy_feed(luby_state *L, lazy_run *run, int from, luby_value elem) {
+    const lazy_program *prog = run->prog;
+    for (int i = from; i < prog->nsteps; i++) {
+        const lazy_step *s = &prog->steps[i];
+        switch (s->kind) {
+            case LAZY_MAP: {
+                if (!lazy_call(L, run, s->block, elem, &elem)) return LAZY_STOP;
+                break;
+            }
+            case LAZY_SELECT:
+            case LAZY_REJECT: {
+                luby_value res = luby_nil();
+                if (!lazy_call(L, run, s->block, elem, &res)) return LAZY_STOP;
+                if (luby_is_truthy(res) != (s->kind == LAZY_SELECT)) return LAZY_NEXT;
+                break;
+            }
+            case LAZY_TAKE: {
+                if (run->counters[i] >= s->n) return LAZY_STOP;
+                /* Stop as soon as the last element is through rather than
+                   pulling one more from upstream */
+                if (++run->counters[i] == s->n) {
+                    lazy_feed(L, run, i + 1, elem);
+                    return LAZY_STOP;
+                }
+                break;
+            }
+            case LAZY_DROP: {
+                if (run->counters[i] < s->n) { run->counters[i]++; return LAZY_NEXT; }
+                break;
+            }
+            case LAZY_FLAT_MAP: {
+                luby_value res = luby_nil();
+                if (!lazy_call(L, run, s->block, elem, &res)) return LAZY_STOP;
+                if (res.type != LUBY_T_ARRAY || !res.as.ptr) { elem = res; break; }
+                /* The expansion is only referenced from here while the rest of
+                   the pipeline runs */
+                int was_paused = L->gc_paused; L->gc_paused = 1;
+                luby_array *fa = (luby_array *)res.as.ptr;
+                int r = LAZY_NEXT;
+                for (size_t fi = 0; fi < fa->count && r == LAZY_NEXT; fi++)
+                    r = lazy_feed(L, run, i + 1, fa->items[fi]);
+                L->gc_paused = was_paused;
+                return r;
+            }
+            default: break;
         }
     }
-    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = dst;
-    if (out) *out = v;
-    return (int)LUBY_E_OK;
+    return lazy_emit(L, run, elem);
 }
 
-static int luby_hash_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    luby_hash *dst = luby_hash_new_heap(L);
-    if (!dst) return (int)LUBY_E_OOM;
+/* Charge each source element as one instruction so a runaway pipeline over
+   an endless source still trips the host's instruction limit. */
+static int lazy_tick(luby_state *L, lazy_run *run) {
+    L->instruction_count++;
+    if (L->instruction_limit > 0 && L->instruction_count > L->instruction_limit) {
+        luby_set_error(L, LUBY_E_RUNTIME, "instruction limit exceeded", "<lazy>", 0, 0);
+        run->rc = (int)LUBY_E_RUNTIME;
+        return 0;
+    }
+    return 1;
+}
 
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        if (!luby_is_truthy(res)) {
-            luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, h->entries[i].key, h->entries[i].value);
+/* Inclusive bounds of a Range with an Integer start and an Integer or Float
+   end; a Float end past the Integer range (Float::INFINITY) gives INT64_MAX.
+   Returns 0 for other ranges and for NaN or Float ends below the start. */
+static int luby_range_int_bounds(const luby_range *rng, int64_t *start, int64_t *end) {
+    if (rng->start.type != LUBY_T_INT) return 0;
+    *start = rng->start.as.i;
+    *end = INT64_MAX;
+    if (rng->end.type == LUBY_T_INT) {
+        *end = rng->end.as.i;
+        if (rng->exclusive) (*end)--;
+    } else if (rng->end.type == LUBY_T_FLOAT) {
+        double e = rng->end.as.f;
+        if (e != e || e < (double)*start) return 0;
+        if (e < 9.2e18) {
+            *end = (int64_t)floor(e);
+            if (rng->exclusive && (double)*end == e) (*end)--;
         }
+    } else {
+        return 0;
     }
-    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = dst;
-    if (out) *out = v;
-    return (int)LUBY_E_OK;
+    return 1;
 }
 
-static int luby_hash_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
+/* Stream the program's source through the pipeline */
+static void lazy_drive(luby_state *L, lazy_run *run) {
+    luby_value source = run->prog->source;
+    if (source.type == LUBY_T_ARRAY && source.as.ptr) {
+        luby_array *arr = (luby_array *)source.as.ptr;
+        for (size_t i = 0; i < arr->count; i++) {
+            if (!lazy_tick(L, run)) return;
+            if (lazy_feed(L, run, 0, arr->items[i]) == LAZY_STOP) return;
+        }
+        return;
     }
-    if (out) *out = luby_bool(0);
+    if (source.type == LUBY_T_RANGE && source.as.ptr && ((luby_range *)source.as.ptr)->start.type == LUBY_T_INT) {
+        int64_t start, end;
+        if (!luby_range_int_bounds((luby_range *)source.as.ptr, &start, &end)) return;
+        /* An unbounded end (Float::INFINITY) relies on take/first or a break */
+        for (int64_t i = start; i <= end; i++) {
+            if (!lazy_tick(L, run)) return;
+            if (lazy_feed(L, run, 0, luby_int(i)) == LAZY_STOP) return;
+            if (i == INT64_MAX) return;
+        }
+        return;
+    }
+    if (source.type == LUBY_T_HASH && source.as.ptr) {
+        luby_hash *h = (luby_hash *)source.as.ptr;
+        for (size_t i = 0; i < h->count; i++) {
+            if (!lazy_tick(L, run)) return;
+            luby_value pair = luby_make_pair_array(L, h->entries[i].key, h->entries[i].value);
+            if (lazy_feed(L, run, 0, pair) == LAZY_STOP) return;
+        }
+        return;
+    }
+
+    /* Fallback: call to_a on the source first, then process */
+    luby_value arr_val = luby_nil();
+    int rc;
+    if (luby_has_class_dispatch(source)) {
+        rc = luby_invoke_method(L, source, "to_a", 0, NULL, &arr_val);
+    } else {
+        luby_cfunc to_a = luby_find_cfunc(L, "to_a");
+        rc = to_a ? to_a(L, 1, &source, &arr_val) : (int)LUBY_E_TYPE;
+    }
+    if (rc != 0 || arr_val.type != LUBY_T_ARRAY || !arr_val.as.ptr) return;
+    if (!luby_gc_push_temp(L, arr_val)) { run->rc = (int)LUBY_E_OOM; return; }
+    luby_array *arr = (luby_array *)arr_val.as.ptr;
+    for (size_t i = 0; i < arr->count; i++) {
+        if (!lazy_tick(L, run)) break;
+        if (lazy_feed(L, run, 0, arr->items[i]) == LAZY_STOP) break;
+    }
+}
+
+/* Compile (or fetch) the program for lv and stream it into the run's sink */
+static int lazy_execute(luby_state *L, luby_value lv, lazy_run *run) {
+    int was_paused = L->gc_paused; L->gc_paused = 1;
+    run->prog = lazy_program_for(L, lv);
+    L->gc_paused = was_paused;
+    if (!run->prog) return (int)LUBY_E_OOM;
+    run->counters = NULL;
+    run->emitted = 0;
+    run->rc = 0;
+    if (run->prog->nsteps > 0) {
+        size_t bytes = (size_t)run->prog->nsteps * sizeof(int64_t);
+        run->counters = (int64_t *)luby_alloc_raw(L, NULL, bytes);
+        if (!run->counters) return (int)LUBY_E_OOM;
+        memset(run->counters, 0, bytes);
+    }
+    /* Pin the terminal node (and with it the chain, its blocks and the
+       source) plus the sink block on the run's VM, which stands in as the
+       GC's stack root until the run finishes */
+    luby_vm_init(&run->vm);
+    if (!luby_vm_ensure_stack(L, &run->vm, 2)) {
+        luby_alloc_raw(L, run->counters, 0);
+        return (int)LUBY_E_OOM;
+    }
+    run->vm.stack[0] = lv;
+    run->vm.stack[1].type = run->sink ? LUBY_T_PROC : LUBY_T_NIL;
+    run->vm.stack[1].as.ptr = run->sink;
+    run->vm.sp = run->vm.pinned = 2;
+    void *saved_vm = L->current_vm;
+    L->current_vm = &run->vm;
+    luby_gc_link_vm(L, &run->vm);
+    if (run->limit != 0) lazy_drive(L, run);
+    L->current_vm = saved_vm;
+    luby_vm_free(L, &run->vm);
+    luby_alloc_raw(L, run->counters, 0);
+    return run->rc;
+}
+
+/* lazy_to_a(lazy_obj) — force the pipeline, return array */
+static int luby_lazy_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr)
+        return (int)LUBY_E_TYPE;
+
+    lazy_run run;
+    run.result = luby_array_new(L);
+    if (!luby_gc_push_temp(L, run.result)) return (int)LUBY_E_OOM;
+    run.sink = NULL;
+    run.limit = -1;
+    int rc = lazy_execute(L, argv[0], &run);
+    if (rc != 0) return rc;
+    if (out) *out = run.result;
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+/* lazy_each(lazy_obj) — stream the pipeline into the current block.
+   Also installed as Lazy#each. */
+static int luby_lazy_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr)
+        return (int)LUBY_E_TYPE;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        if (!luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
+    if (!block) {
+        /* No block — return to_a */
+        return luby_lazy_to_a(L, argc, argv, out);
     }
-    if (out) *out = luby_bool(1);
+
+    lazy_run run;
+    run.result = luby_nil();
+    run.sink = block;
+    run.limit = -1;
+    int rc = lazy_execute(L, argv[0], &run);
+    if (rc == (int)LUBY_E_BREAK) {
+        if (out) *out = L->block_break_value;
+        L->block_break = 0;
+        return (int)LUBY_E_OK;
+    }
+    if (rc != 0) return rc;
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+/* lazy_first_n(lazy_obj, n) — force pipeline with limit */
+static int luby_lazy_first_n(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    int64_t limit = (argv[1].type == LUBY_T_INT) ? argv[1].as.i : 1;
+    if (limit < 0) limit = 0;
+
+    lazy_run run;
+    run.result = luby_array_new(L);
+    if (!luby_gc_push_temp(L, run.result)) return (int)LUBY_E_OOM;
+    run.sink = NULL;
+    run.limit = limit;
+    int rc = lazy_execute(L, argv[0], &run);
+    if (rc != 0) return rc;
+    if (out) *out = run.result;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_array_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
+    const char *fname = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
+    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
+    if (!block && !fn) return (int)LUBY_E_TYPE;
+
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0;
+    dst->capacity = src->count;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+
+    for (size_t i = 0; i < src->count; i++) {
         luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
+        if (block) {
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        } else {
+            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
+        }
+        dst->items[dst->count++] = res;
     }
-    if (out) *out = luby_bool(1);
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_find(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+static int luby_array_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value args[2];
-        args[0] = h->entries[i].key;
-        args[1] = h->entries[i].value;
+    const char *fname = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
+    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
+    if (!block && !fn) return (int)LUBY_E_TYPE;
+
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0;
+    dst->capacity = src->count;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+
+    for (size_t i = 0; i < src->count; i++) {
         luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        if (luby_is_truthy(res)) { if (out) *out = h->entries[i].key; return (int)LUBY_E_OK; }
+        if (block) {
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        } else {
+            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
+        }
+        if (luby_is_truthy(res)) dst->items[dst->count++] = src->items[i];
     }
-    if (out) *out = luby_nil();
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_reduce(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+static int luby_array_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    if (h->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+    const char *fname = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
+    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
+    if (!block && !fn) return (int)LUBY_E_TYPE;
 
-    size_t i = 0;
-    luby_value acc = luby_nil();
-    if (argc >= 2) {
-        acc = argv[1];
-    } else {
-        acc = h->entries[0].value;
-        i = 1;
-    }
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0;
+    dst->capacity = src->count;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    dst->frozen = 0;
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
 
-    for (; i < h->count; i++) {
-        luby_value args[3];
-        args[0] = acc;
-        args[1] = h->entries[i].key;
-        args[2] = h->entries[i].value;
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 3, args, &acc, out, luby_nil());
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res = luby_nil();
+        if (block) {
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        } else {
+            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
+        }
+        if (!luby_is_truthy(res)) dst->items[dst->count++] = src->items[i];
     }
-    if (out) *out = acc;
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-// Generic map: dispatches to array or hash
-static int luby_generic_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_HASH) return luby_hash_map(L, argc, argv, out);
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_map(L, argc, argv, out);
-    return luby_array_map(L, argc, argv, out);
-}
-
-// Generic select: dispatches to array, hash, or range
-static int luby_generic_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_HASH) return luby_hash_select(L, argc, argv, out);
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_select(L, argc, argv, out);
-    return luby_array_select(L, argc, argv, out);
-}
+static int luby_range_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_RANGE || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) {
+        if (out) *out = argv[0];
+        return (int)LUBY_E_OK;
+    }
 
-// Generic reject: dispatches to array, hash, or range
-static int luby_generic_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_HASH) return luby_hash_reject(L, argc, argv, out);
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_reject(L, argc, argv, out);
-    return luby_array_reject(L, argc, argv, out);
+    luby_range *range = (luby_range *)argv[0].as.ptr;
+    if (range->start.type != LUBY_T_INT || range->end.type != LUBY_T_INT) {
+        return (int)LUBY_E_TYPE;
+    }
+    
+    int64_t start = range->start.as.i;
+    int64_t end = range->end.as.i;
+    if (range->exclusive) end--;
+    
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
 }
 
-// Generic any?: dispatches to array, hash, or range
-static int luby_generic_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_HASH) return luby_hash_any(L, argc, argv, out);
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_any(L, argc, argv, out);
-    return luby_array_any(L, argc, argv, out);
+// Helper: get range bounds as int64, adjusting for exclusive
+static int luby_range_bounds(const luby_value *argv, int64_t *start, int64_t *end) {
+    if (argv[0].type != LUBY_T_RANGE || !argv[0].as.ptr) return 0;
+    luby_range *r = (luby_range *)argv[0].as.ptr;
+    if (r->start.type != LUBY_T_INT || r->end.type != LUBY_T_INT) return 0;
+    *start = r->start.as.i;
+    *end = r->end.as.i;
+    if (r->exclusive) (*end)--;
+    return 1;
 }
 
-// Generic all?: dispatches to array, hash, or range
-static int luby_generic_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// (1..5).to_a => [1,2,3,4,5]
+static int luby_range_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_HASH) return luby_hash_all(L, argc, argv, out);
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_all(L, argc, argv, out);
-    return luby_array_all(L, argc, argv, out);
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    int64_t count = (end >= start) ? (end - start + 1) : 0;
+    int was_paused = L->gc_paused; L->gc_paused = 1;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    arr->count = (size_t)count; arr->capacity = (size_t)count; arr->frozen = 0;
+    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
+    if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    for (int64_t i = 0; i < count; i++) arr->items[i] = luby_int(start + i);
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    return (int)LUBY_E_OK;
 }
 
-// Generic none?: dispatches to array, hash, or range
-static int luby_generic_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// (1..5).size => 5
+static int luby_range_size(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_HASH) return luby_hash_none(L, argc, argv, out);
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_none(L, argc, argv, out);
-    return luby_array_none(L, argc, argv, out);
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    int64_t count = (end >= start) ? (end - start + 1) : 0;
+    if (out) *out = luby_int(count);
+    return (int)LUBY_E_OK;
 }
 
-// has_key? / key?: h.has_key?(:foo)
-static int luby_hash_has_key(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// (1..10).include?(5) => true
+static int luby_range_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        if (luby_value_eq(h->entries[i].key, argv[1])) {
-            if (out) *out = luby_bool(1);
-            return (int)LUBY_E_OK;
-        }
-    }
-    if (out) *out = luby_bool(0);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    if (argv[1].type != LUBY_T_INT) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
+    int64_t v = argv[1].as.i;
+    if (out) *out = luby_bool(v >= start && v <= end);
     return (int)LUBY_E_OK;
 }
 
-// has_value? / value?: h.has_value?(42)
-static int luby_hash_has_value(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// (3..7).min => 3
+static int luby_range_min(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        if (luby_value_eq(h->entries[i].value, argv[1])) {
-            if (out) *out = luby_bool(1);
-            return (int)LUBY_E_OK;
-        }
-    }
-    if (out) *out = luby_bool(0);
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    if (out) *out = (start <= end) ? luby_int(start) : luby_nil();
     return (int)LUBY_E_OK;
 }
 
-// fetch: h.fetch(:key) or h.fetch(:key, default)
-static int luby_hash_fetch(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_value result;
-    int found = 0;
-    luby_hash_get_value_found(argv[0], argv[1], &result, &found);
-    if (found) {
-        if (out) *out = result;
-        return (int)LUBY_E_OK;
-    }
-    if (argc >= 3) {
-        if (out) *out = argv[2];
-        return (int)LUBY_E_OK;
-    }
-    luby_set_error(L, LUBY_E_RUNTIME, "key not found", NULL, 0, 0);
-    return (int)LUBY_E_RUNTIME;
-}
-
-// delete: h.delete(:key) => removed value or nil
-static int luby_hash_delete(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// (3..7).max => 7
+static int luby_range_max(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        if (luby_value_eq(h->entries[i].key, argv[1])) {
-            luby_value removed = h->entries[i].value;
-            // Shift remaining entries
-            for (size_t j = i; j + 1 < h->count; j++) {
-                h->entries[j] = h->entries[j + 1];
-            }
-            h->count--;
-            if (out) *out = removed;
-            return (int)LUBY_E_OK;
-        }
-    }
-    if (out) *out = luby_nil();
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    if (out) *out = (start <= end) ? luby_int(end) : luby_nil();
     return (int)LUBY_E_OK;
 }
 
-// empty?: works on arrays, hashes, and strings
-static int luby_generic_empty(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
+// (1..5).first => 1, (1..5).first(3) => [1,2,3]
+static int luby_range_first(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
-        if (out) *out = luby_bool(((luby_array *)argv[0].as.ptr)->count == 0);
-        return (int)LUBY_E_OK;
-    }
-    if (argv[0].type == LUBY_T_HASH && argv[0].as.ptr) {
-        if (out) *out = luby_bool(((luby_hash *)argv[0].as.ptr)->count == 0);
-        return (int)LUBY_E_OK;
-    }
-    if (argv[0].type == LUBY_T_STRING && argv[0].as.ptr) {
-        if (out) *out = luby_bool(strlen((const char *)argv[0].as.ptr) == 0);
-        return (int)LUBY_E_OK;
-    }
-    if (argv[0].type == LUBY_T_RANGE && argv[0].as.ptr) {
-        luby_range *r = (luby_range *)argv[0].as.ptr;
-        if (r->start.type == LUBY_T_INT && r->end.type == LUBY_T_INT) {
-            int64_t s = r->start.as.i, e = r->end.as.i;
-            if (r->exclusive) e--;
-            if (out) *out = luby_bool(s > e);
-        } else {
-            if (out) *out = luby_bool(0);
-        }
-        return (int)LUBY_E_OK;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    if (argc >= 2 && argv[1].type == LUBY_T_INT) {
+        int64_t n = argv[1].as.i;
+        int64_t total = (end >= start) ? (end - start + 1) : 0;
+        if (n > total) n = total;
+        if (n < 0) n = 0;
+        int was_paused = L->gc_paused; L->gc_paused = 1;
+        luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        arr->count = (size_t)n; arr->capacity = (size_t)n; arr->frozen = 0;
+        arr->items = n > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)n * sizeof(luby_value)) : NULL;
+        if (!arr->items && n > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        for (int64_t i = 0; i < n; i++) arr->items[i] = luby_int(start + i);
+        L->gc_paused = was_paused;
+        if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    } else {
+        if (out) *out = (start <= end) ? luby_int(start) : luby_nil();
     }
-    return (int)LUBY_E_TYPE;
+    return (int)LUBY_E_OK;
 }
 
-// Generic to_a: dispatches to range or hash
-static int luby_generic_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// (1..5).last => 5, (1..5).last(2) => [4,5]
+static int luby_range_last(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_to_a(L, argc, argv, out);
-    // Fall through to hash to_a
-    if (argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = 0; arr->capacity = h->count; arr->frozen = 0;
-    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
-    if (!arr->items && arr->capacity > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (size_t i = 0; i < h->count; i++) {
-        luby_array *pair = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!pair) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        pair->count = 2; pair->capacity = 2; pair->frozen = 0;
-        pair->items = (luby_value *)luby_alloc_raw(L, NULL, 2 * sizeof(luby_value));
-        if (!pair->items) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        pair->items[0] = h->entries[i].key;
-        pair->items[1] = h->entries[i].value;
-        arr->items[arr->count].type = LUBY_T_ARRAY;
-        arr->items[arr->count].as.ptr = pair;
-        arr->count++;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    if (argc >= 2 && argv[1].type == LUBY_T_INT) {
+        int64_t n = argv[1].as.i;
+        int64_t total = (end >= start) ? (end - start + 1) : 0;
+        if (n > total) n = total;
+        if (n < 0) n = 0;
+        int64_t s = end - n + 1;
+        int was_paused = L->gc_paused; L->gc_paused = 1;
+        luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        arr->count = (size_t)n; arr->capacity = (size_t)n; arr->frozen = 0;
+        arr->items = n > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)n * sizeof(luby_value)) : NULL;
+        if (!arr->items && n > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        for (int64_t i = 0; i < n; i++) arr->items[i] = luby_int(s + i);
+        L->gc_paused = was_paused;
+        if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    } else {
+        if (out) *out = (start <= end) ? luby_int(end) : luby_nil();
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
     return (int)LUBY_E_OK;
 }
 
-// each_key: h.each_key { |k| ... }
-static int luby_hash_each_key(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+// (1..10).step(3) { |x| ... } or (1..10).step(2) => array
+static int luby_range_step(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    if (argv[1].type != LUBY_T_INT || argv[1].as.i <= 0) return (int)LUBY_E_TYPE;
+    int64_t step = argv[1].as.i;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &h->entries[i].key, &res, out, luby_nil());
+    if (block) {
+        for (int64_t i = start; i <= end; i += step) {
+            luby_value iv = luby_int(i);
+            luby_value res = luby_nil();
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        }
+        if (out) *out = argv[0];
+    } else {
+        // Return array of stepped values
+        int64_t count = (end >= start) ? ((end - start) / step + 1) : 0;
+        int was_paused = L->gc_paused; L->gc_paused = 1;
+        luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        arr->count = (size_t)count; arr->capacity = (size_t)count; arr->frozen = 0;
+        arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
+        if (!arr->items && count > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        int64_t idx = 0;
+        for (int64_t i = start; i <= end; i += step) arr->items[idx++] = luby_int(i);
+        L->gc_paused = was_paused;
+        if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
     }
-    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// each_value: h.each_value { |v| ... }
-static int luby_hash_each_value(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+// (1..5).reverse_each { |x| ... }
+static int luby_range_reverse_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
     luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    for (size_t i = 0; i < h->count; i++) {
+    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    for (int64_t i = end; i >= start; i--) {
+        luby_value iv = luby_int(i);
         luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &h->entries[i].value, &res, out, luby_nil());
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
     }
     if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_dig(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-    luby_value cur = argv[0];
-    for (int i = 1; i < argc; i++) {
-        if (cur.type == LUBY_T_NIL) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-        luby_value key = argv[i];
-        if (cur.type == LUBY_T_ARRAY && cur.as.ptr && key.type == LUBY_T_INT) {
-            luby_array *arr = (luby_array *)cur.as.ptr;
-            int64_t idx = key.as.i;
-            if (idx < 0 || (size_t)idx >= arr->count) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-            cur = arr->items[idx];
-            continue;
-        }
-        if (cur.type == LUBY_T_HASH && cur.as.ptr) {
-            luby_value v = luby_nil();
-            int found = 0;
-            if (luby_hash_get_value_found(cur, key, &v, &found) == (int)LUBY_E_OK && found) {
-                cur = v;
-                continue;
-            }
-            if (out) *out = luby_nil();
-            return (int)LUBY_E_OK;
+// (1..100).sum => 5050, (1..5).sum { |x| x * x } => 55
+static int luby_range_sum(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (block) {
+        int64_t sum = 0;
+        for (int64_t i = start; i <= end; i++) {
+            luby_value iv = luby_int(i);
+            luby_value res = luby_nil();
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+            if (res.type == LUBY_T_INT) sum += res.as.i;
         }
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+        if (out) *out = luby_int(sum);
+    } else {
+        // Arithmetic series: n*(start+end)/2
+        if (end < start) { if (out) *out = luby_int(0); return (int)LUBY_E_OK; }
+        int64_t n = end - start + 1;
+        int64_t sum = n * (start + end) / 2;
+        if (out) *out = luby_int(sum);
     }
-    if (out) *out = cur;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_respond_to(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    luby_value recv = argv[0];
-    const char *name = NULL;
-    if (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL) {
-        name = (const char *)argv[1].as.ptr;
-    }
-    int ok = 0;
-    if (name) {
-        luby_class_obj *rcls = luby_get_receiver_class(recv);
-        if (rcls) {
-            ok = luby_class_has_method(L, rcls, name);
-        } else {
-            ok = luby_find_cfunc(L, name) != NULL;
-            if (!ok) {
-                luby_string_view sv = { name, strlen(name) };
-                luby_value gv = luby_get_global(L, sv);
-                ok = (gv.type == LUBY_T_PROC);
-            }
-        }
-    }
-    if (!ok && name && luby_has_class_dispatch(recv)) {
-        luby_class_obj *cls = luby_get_receiver_class(recv);
-        if (cls) {
-            luby_proc *m = luby_class_get_method(L, cls, "respond_to_missing?");
-            if (m) {
-                luby_value arg; arg.type = LUBY_T_SYMBOL; arg.as.ptr = (void *)name;
-                luby_value res = luby_nil();
-                if (luby_call_method(L, cls, "respond_to_missing?", m, recv, 1, &arg, &res) == 0) {
-                    ok = luby_is_truthy(res);
-                }
-            }
-        }
+// Range map: (1..5).map { |x| x * 2 } => [2,4,6,8,10]
+static int luby_range_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    int64_t count = (end >= start) ? (end - start + 1) : 0;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return (int)LUBY_E_OOM;
+    arr->count = 0; arr->capacity = (size_t)count; arr->frozen = 0;
+    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
+    if (!arr->items && count > 0) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, arr)) return (int)LUBY_E_OOM;
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        arr->items[arr->count++] = res;
     }
-    if (out) *out = luby_bool(ok);
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
     return (int)LUBY_E_OK;
 }
 
-// is_a? and kind_of? check if object is instance of class or its ancestors
-static int luby_base_is_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    luby_value obj = argv[0];
-    luby_value klass = argv[1];
-    
-    if (klass.type != LUBY_T_CLASS && klass.type != LUBY_T_MODULE) {
-        if (out) *out = luby_bool(0);
-        return (int)LUBY_E_OK;
-    }
-    
-    luby_class_obj *target_class = (luby_class_obj *)klass.as.ptr;
-    luby_class_obj *obj_class = luby_get_receiver_class(obj);
-    
-    // Check if obj_class is target_class or includes it
-    int is_match = 0;
-    if (obj_class && target_class) {
-        // Check direct match or superclass chain
-        luby_class_obj *current = obj_class;
-        while (current) {
-            if (current == target_class) {
-                is_match = 1;
-                break;
-            }
-            // Check included modules
-            for (size_t i = 0; i < current->included_count; i++) {
-                if (current->included_modules[i] == target_class) {
-                    is_match = 1;
-                    break;
-                }
-            }
-            if (is_match) break;
-            current = current->super;
-        }
+// Range select: (1..10).select { |x| x % 2 == 0 } => [2,4,6,8,10]
+static int luby_range_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    int64_t count = (end >= start) ? (end - start + 1) : 0;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return (int)LUBY_E_OOM;
+    arr->count = 0; arr->capacity = (size_t)count; arr->frozen = 0;
+    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
+    if (!arr->items && count > 0) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, arr)) return (int)LUBY_E_OOM;
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        if (luby_is_truthy(res)) arr->items[arr->count++] = iv;
     }
-    
-    if (out) *out = luby_bool(is_match);
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
     return (int)LUBY_E_OK;
 }
 
-// instance_of? checks if object is exactly an instance of class (no inheritance)
-static int luby_base_instance_of(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    luby_value obj = argv[0];
-    luby_value klass = argv[1];
-    
-    if (klass.type != LUBY_T_CLASS) {
-        if (out) *out = luby_bool(0);
-        return (int)LUBY_E_OK;
-    }
-    
-    luby_class_obj *target_class = (luby_class_obj *)klass.as.ptr;
-    int is_match = 0;
-    
-    luby_class_obj *obj_class = luby_get_receiver_class(obj);
-    if (obj_class) {
-        is_match = (obj_class == target_class);
+// Range reject: (1..10).reject { |x| x % 2 == 0 } => [1,3,5,7,9]
+static int luby_range_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    int64_t count = (end >= start) ? (end - start + 1) : 0;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return (int)LUBY_E_OOM;
+    arr->count = 0; arr->capacity = (size_t)count; arr->frozen = 0;
+    arr->items = count > 0 ? (luby_value *)luby_alloc_raw(L, NULL, (size_t)count * sizeof(luby_value)) : NULL;
+    if (!arr->items && count > 0) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, arr)) return (int)LUBY_E_OOM;
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        if (!luby_is_truthy(res)) arr->items[arr->count++] = iv;
     }
-    
-    if (out) *out = luby_bool(is_match);
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
     return (int)LUBY_E_OK;
 }
 
-// defined? checks if a variable, method, or constant is defined
-static int luby_base_defined(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// Range any?: (1..5).any? { |x| x > 3 } => true
+static int luby_range_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    
-    // The argument is typically a symbol or string representing what to check
-    const char *name = NULL;
-    if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
-        name = (const char *)argv[0].as.ptr;
-    }
-    
-    if (!name) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
-    }
-    
-    // Check if it's a global variable
-    luby_string_view sv = { name, strlen(name) };
-    luby_value gv = luby_get_global(L, sv);
-    if (gv.type != LUBY_T_NIL) {
-        if (out) *out = luby_string(L, "global-variable", 0);
-        return (int)LUBY_E_OK;
-    }
-    
-    // Check if it's a method/function
-    if (luby_find_cfunc(L, name) != NULL) {
-        if (out) *out = luby_string(L, "method", 0);
-        return (int)LUBY_E_OK;
-    }
-    
-    // Check if it's a constant (starts with uppercase)
-    if (name[0] >= 'A' && name[0] <= 'Z') {
-        if (gv.type != LUBY_T_NIL) {
-            if (out) *out = luby_string(L, "constant", 0);
-            return (int)LUBY_E_OK;
-        }
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { if (out) *out = luby_bool(start <= end); return (int)LUBY_E_OK; }
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
     }
-    
-    if (out) *out = luby_nil();
+    if (out) *out = luby_bool(0);
     return (int)LUBY_E_OK;
 }
 
-// inspect - returns a string representation suitable for debugging
-static int luby_base_inspect(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value v = argv[0];
-    char buf[256];
-    
-    switch (v.type) {
-        case LUBY_T_NIL:
-            if (out) *out = luby_string(L, "nil", 0);
-            return (int)LUBY_E_OK;
-        case LUBY_T_BOOL:
-            if (out) *out = luby_string(L, v.as.b ? "true" : "false", 0);
-            return (int)LUBY_E_OK;
-        case LUBY_T_INT:
-            snprintf(buf, sizeof(buf), "%lld", (long long)v.as.i);
-            if (out) *out = luby_string(L, buf, 0);
-            return (int)LUBY_E_OK;
-        case LUBY_T_FLOAT:
-            snprintf(buf, sizeof(buf), "%g", v.as.f);
-            if (out) *out = luby_string(L, buf, 0);
-            return (int)LUBY_E_OK;
-        case LUBY_T_STRING: {
-            // Strings are shown with quotes and escaped characters
-            const char *str = v.as.ptr ? (const char *)v.as.ptr : "";
-            size_t len = strlen(str);
-            size_t dest_len = len + 2;  // for quotes
-            // Count escape chars
-            for (size_t i = 0; i < len; i++) {
-                if (str[i] == '"' || str[i] == '\\' || str[i] == '\n' || str[i] == '\t' || str[i] == '\r')
-                    dest_len++;
-            }
-            int was_paused = L->gc_paused;
-            L->gc_paused = 1;
-            char *result = luby_gc_alloc_string(L, NULL, dest_len);
-            if (!result) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-            char *p = result;
-            *p++ = '"';
-            for (size_t i = 0; i < len; i++) {
-                if (str[i] == '"') { *p++ = '\\'; *p++ = '"'; }
-                else if (str[i] == '\\') { *p++ = '\\'; *p++ = '\\'; }
-                else if (str[i] == '\n') { *p++ = '\\'; *p++ = 'n'; }
-                else if (str[i] == '\t') { *p++ = '\\'; *p++ = 't'; }
-                else if (str[i] == '\r') { *p++ = '\\'; *p++ = 'r'; }
-                else *p++ = str[i];
-            }
-            *p++ = '"';
-            *p = '\0';
-            L->gc_paused = was_paused;
-            if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_SYMBOL: {
-            // Symbols are shown with colon prefix
-            const char *sym = v.as.ptr ? (const char *)v.as.ptr : "";
-            size_t len = strlen(sym);
-            int was_paused = L->gc_paused;
-            L->gc_paused = 1;
-            char *result = luby_gc_alloc_string(L, NULL, len + 1);  // +1 for colon
-            if (!result) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-            result[0] = ':';
-            memcpy(result + 1, sym, len);
-            result[len + 1] = '\0';
-            L->gc_paused = was_paused;
-            if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_ARRAY: {
-            luby_array *arr = (luby_array *)v.as.ptr;
-            snprintf(buf, sizeof(buf), "[Array: %zu items]", arr ? arr->count : 0);
-            if (out) *out = luby_string(L, buf, 0);
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_HASH: {
-            luby_hash *h = (luby_hash *)v.as.ptr;
-            snprintf(buf, sizeof(buf), "{Hash: %zu items}", h ? h->count : 0);
-            if (out) *out = luby_string(L, buf, 0);
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_CLASS: {
-            luby_class_obj *cls = (luby_class_obj *)v.as.ptr;
-            if (cls && cls->name) {
-                if (out) *out = luby_string(L, cls->name, 0);
-            } else {
-                if (out) *out = luby_string(L, "#<Class>", 0);
-            }
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_MODULE: {
-            luby_class_obj *mod = (luby_class_obj *)v.as.ptr;
-            if (mod && mod->name) {
-                if (out) *out = luby_string(L, mod->name, 0);
-            } else {
-                if (out) *out = luby_string(L, "#<Module>", 0);
-            }
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_OBJECT: {
-            luby_object *obj = (luby_object *)v.as.ptr;
-            if (obj && obj->klass && obj->klass->name) {
-                snprintf(buf, sizeof(buf), "#<%s:0x%016llx>", obj->klass->name, (unsigned long long)(uintptr_t)obj);
-            } else {
-                snprintf(buf, sizeof(buf), "#<Object:0x%016llx>", (unsigned long long)(uintptr_t)obj);
-            }
-            if (out) *out = luby_string(L, buf, 0);
-            return (int)LUBY_E_OK;
-        }
-        case LUBY_T_USERDATA: {
-            luby_userdata *ud = (luby_userdata *)v.as.ptr;
-            if (ud && !ud->alive) {
-                if (out) *out = luby_string(L, "#<dead>", 0);
-            } else if (ud && ud->klass && ud->klass->name) {
-                snprintf(buf, sizeof(buf), "#<%s:0x%016llx>", ud->klass->name, (unsigned long long)(uintptr_t)ud);
-                if (out) *out = luby_string(L, buf, 0);
-            } else {
-                snprintf(buf, sizeof(buf), "#<%s>", luby_type_name(v));
-                if (out) *out = luby_string(L, buf, 0);
-            }
-            return (int)LUBY_E_OK;
-        }
-        default:
-            snprintf(buf, sizeof(buf), "#<%s>", luby_type_name(v));
-            if (out) *out = luby_string(L, buf, 0);
-            return (int)LUBY_E_OK;
-    }
-}
-
-// object_id - returns a unique identifier for the object
-static int luby_base_object_id(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
+// Range all?: (1..5).all? { |x| x > 0 } => true
+static int luby_range_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value v = argv[0];
-    
-    // For immediate values (nil, bool, int), use a deterministic ID
-    switch (v.type) {
-        case LUBY_T_NIL:
-            if (out) *out = luby_int(4LL);  // Ruby convention: nil.object_id == 4
-            return (int)LUBY_E_OK;
-        case LUBY_T_BOOL:
-            // Ruby convention: true.object_id == 20, false.object_id == 0
-            if (out) *out = luby_int(v.as.b ? 20LL : 0LL);
-            return (int)LUBY_E_OK;
-        case LUBY_T_INT:
-            // Ruby convention: for integers, object_id = (int * 2) + 1
-            if (out) *out = luby_int((v.as.i * 2) + 1);
-            return (int)LUBY_E_OK;
-        case LUBY_T_SYMBOL:
-            // Symbols with same name should have same object_id (use pointer address)
-            if (out) *out = luby_int((int64_t)(uintptr_t)v.as.ptr);
-            return (int)LUBY_E_OK;
-        default:
-            // For heap-allocated objects, use pointer address
-            if (out) *out = luby_int((int64_t)(uintptr_t)v.as.ptr);
-            return (int)LUBY_E_OK;
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        if (!luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
     }
+    if (out) *out = luby_bool(1);
+    return (int)LUBY_E_OK;
 }
 
-// Class#name - returns the name of the class
-static int luby_class_name(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// Range none?: (1..5).none? { |x| x > 10 } => true
+static int luby_range_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type != LUBY_T_CLASS && argv[0].type != LUBY_T_MODULE) return (int)LUBY_E_TYPE;
-    
-    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
-    if (cls && cls->name) {
-        if (out) *out = luby_string(L, cls->name, 0);
-    } else {
-        if (out) *out = luby_nil();
+    int64_t start, end;
+    if (!luby_range_bounds(argv, &start, &end)) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { if (out) *out = luby_bool(start > end); return (int)LUBY_E_OK; }
+    for (int64_t i = start; i <= end; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
     }
+    if (out) *out = luby_bool(1);
     return (int)LUBY_E_OK;
 }
 
-// Class#superclass - returns the superclass
-static int luby_class_superclass(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type != LUBY_T_CLASS) {
-        if (out) *out = luby_nil();
+static int luby_generic_each(luby_state *L, int argc, const luby_value *argv, luby_value *out);
+
+static int luby_array_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    const char *fname = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
+    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
+    if (!block && !fn) {
+        if (out) *out = luby_enum_new(L, argv[0], LUBY_ENUM_ARRAY);
         return (int)LUBY_E_OK;
     }
-    
-    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
-    if (cls && cls->super) {
-        if (out) { out->type = LUBY_T_CLASS; out->as.ptr = cls->super; }
-    } else {
-        if (out) *out = luby_nil();
+
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res = luby_nil();
+        if (block) {
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        } else {
+            if (fn(L, 1, &src->items[i], &res) != 0) return (int)LUBY_E_RUNTIME;
+        }
     }
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// Class#ancestors - returns array of ancestors (class + included modules + superclasses)
-static int luby_class_ancestors(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type != LUBY_T_CLASS && argv[0].type != LUBY_T_MODULE) return (int)LUBY_E_TYPE;
-    
-    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
-    if (!cls) {
-        if (out) *out = luby_array_new(L);
+static int luby_array_each_with_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    const char *fname = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) fname = (const char *)argv[1].as.ptr;
+    luby_cfunc fn = fname ? luby_find_cfunc(L, fname) : NULL;
+    if (!block && !fn) {
+        if (out) *out = luby_enum_new(L, argv[0], LUBY_ENUM_ARRAY_WITH_INDEX);
         return (int)LUBY_E_OK;
     }
-    
-    luby_value arr = luby_array_new(L);
-    
-    // Walk the inheritance chain
-    luby_class_obj *current = cls;
-    while (current) {
-        // Add the current class/module
-        luby_value cls_val;
-        cls_val.type = (current == cls && argv[0].type == LUBY_T_MODULE) ? LUBY_T_MODULE : LUBY_T_CLASS;
-        cls_val.as.ptr = current;
-        luby_array_push_value(L, arr, cls_val);
-        
-        // Add included modules (in reverse order of inclusion)
-        for (size_t i = 0; i < current->included_count; i++) {
-            luby_value mod_val;
-            mod_val.type = LUBY_T_MODULE;
-            mod_val.as.ptr = current->included_modules[i];
-            luby_array_push_value(L, arr, mod_val);
+
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value args[2];
+        args[0] = src->items[i];
+        args[1] = luby_int((int64_t)i);
+        luby_value res = luby_nil();
+        if (block) {
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        } else {
+            if (fn(L, 2, args, &res) != 0) return (int)LUBY_E_RUNTIME;
         }
-        
-        // Move to superclass
-        current = current->super;
     }
-    
-    if (out) *out = arr;
-    return (int)LUBY_E_OK;
-}
-
-// Symbol#to_sym - returns self (a symbol is already a symbol)
-static int luby_symbol_to_sym(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
     if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_freeze(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value v = argv[0];
-    switch (v.type) {
-        case LUBY_T_ARRAY:
-            if (v.as.ptr) ((luby_array *)v.as.ptr)->frozen = 1;
-            break;
-        case LUBY_T_HASH:
-            if (v.as.ptr) ((luby_hash *)v.as.ptr)->frozen = 1;
-            break;
-        case LUBY_T_OBJECT:
-            if (v.as.ptr) ((luby_object *)v.as.ptr)->frozen = 1;
-            break;
-        case LUBY_T_CLASS:
-        case LUBY_T_MODULE:
-            if (v.as.ptr) ((luby_class_obj *)v.as.ptr)->frozen = 1;
-            break;
-        default:
-            break;
+static int luby_array_compact(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    dst->count = 0;
+    dst->capacity = src->count;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    dst->frozen = 0;
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+
+    for (size_t i = 0; i < src->count; i++) {
+        if (src->items[i].type != LUBY_T_NIL) {
+            dst->items[dst->count++] = src->items[i];
+        }
     }
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
     if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_frozen(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    int frz = luby_value_is_frozen(argv[0]);
-    if (out) *out = luby_bool(frz);
+static int luby_array_compact_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    if (arr->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    size_t write = 0;
+    for (size_t i = 0; i < arr->count; i++) {
+        if (arr->items[i].type != LUBY_T_NIL) {
+            arr->items[write++] = arr->items[i];
+        }
+    }
+    arr->count = write;
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_require(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || (argv[0].type != LUBY_T_STRING && argv[0].type != LUBY_T_SYMBOL)) return (int)LUBY_E_TYPE;
-    const char *path = (const char *)argv[0].as.ptr;
-    if (!path) return (int)LUBY_E_TYPE;
-    return luby_require(L, path, out);
-}
+static int luby_array_reduce(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
 
-static int luby_base_load(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || (argv[0].type != LUBY_T_STRING && argv[0].type != LUBY_T_SYMBOL)) return (int)LUBY_E_TYPE;
-    const char *path = (const char *)argv[0].as.ptr;
-    if (!path) return (int)LUBY_E_TYPE;
-    return luby_load(L, path, out);
-}
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    if (src->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
 
-static int luby_base_yield(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    return luby_yield(L, argc, argv, out);
-}
+    size_t i = 0;
+    luby_value acc = luby_nil();
+    if (argc >= 2) {
+        acc = argv[1];
+    } else {
+        acc = src->items[0];
+        i = 1;
+    }
 
-static int luby_base_caller(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)argc; (void)argv;
-    luby_value arr = luby_array_new(L);
-    luby_vm *vm = L->current_vm;
-    if (vm) {
-        // Walk frames from top to bottom (skip the very top frame which is
-        // the one executing the current method that called `caller`)
-        for (int i = vm->frame_count - 1; i >= 0; i--) {
-            luby_vm_frame *fr = &vm->frames[i];
-            const char *fn = fr->filename ? fr->filename : "<unknown>";
-            int ln = (fr->chunk && fr->chunk->lines && fr->ip < fr->chunk->count)
-                     ? (int)fr->chunk->lines[fr->ip] : 0;
-            const char *mn = fr->saved_method_name;
-            char buf[256];
-            if (mn && mn[0]) {
-                snprintf(buf, sizeof(buf), "%s:%d:in '%s'", fn, ln, mn);
-            } else {
-                snprintf(buf, sizeof(buf), "%s:%d:in '<main>'", fn, ln);
-            }
-            luby_array_push_value(L, arr, luby_string(L, buf, 0));
-        }
+    for (; i < src->count; i++) {
+        luby_value args[2];
+        args[0] = acc;
+        args[1] = src->items[i];
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &acc, out, luby_nil());
     }
-    if (out) *out = arr;
+    if (out) *out = acc;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_send(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    luby_value recv = argv[0];
-    const char *name = NULL;
-    if (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL) {
-        name = (const char *)argv[1].as.ptr;
+static int luby_array_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
     }
-    if (!name) return (int)LUBY_E_TYPE;
-    return luby_call_method_by_name(L, recv, name, argc - 2, argv + 2, out);
+    if (out) *out = luby_bool(0);
+    return (int)LUBY_E_OK;
 }
 
-static int luby_base_public_send(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    return luby_base_send(L, argc, argv, out);
+static int luby_array_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        if (!luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
+    }
+    if (out) *out = luby_bool(1);
+    return (int)LUBY_E_OK;
 }
 
-static int luby_base_define_method(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    const char *name = NULL;
-    if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
-        name = (const char *)argv[0].as.ptr;
+static int luby_array_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
     }
-    if (!name) return (int)LUBY_E_TYPE;
-    if (!(L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE)) return (int)LUBY_E_TYPE;
-    luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
-    if (!cls) return (int)LUBY_E_TYPE;
-    if (cls->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-
-    luby_proc *proc = NULL;
-    if (argc >= 2 && argv[1].type == LUBY_T_PROC) proc = (luby_proc *)argv[1].as.ptr;
-    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
-    if (!proc) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_bool(1);
+    return (int)LUBY_E_OK;
+}
 
-    luby_class_set_method(L, cls, name, proc);
+static int luby_array_find(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = src->items[i]; return (int)LUBY_E_OK; }
+    }
     if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_define_singleton_method(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value target = L->current_self;
-    const char *name = NULL;
-
-    if (argc >= 2 && (argv[0].type == LUBY_T_OBJECT || argv[0].type == LUBY_T_CLASS || argv[0].type == LUBY_T_MODULE)) {
-        target = argv[0];
-        if (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL) {
-            name = (const char *)argv[1].as.ptr;
-        }
-    } else {
-        if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
-            name = (const char *)argv[0].as.ptr;
+static int luby_hash_get(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        if (luby_value_eq(h->entries[i].key, argv[1])) {
+            if (out) *out = h->entries[i].value;
+            return (int)LUBY_E_OK;
         }
     }
-
-    if (!name) return (int)LUBY_E_TYPE;
-    if (!(target.type == LUBY_T_OBJECT || target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE)) return (int)LUBY_E_TYPE;
-    if (target.type == LUBY_T_OBJECT && target.as.ptr && ((luby_object *)target.as.ptr)->frozen) {
-        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
-        return (int)LUBY_E_RUNTIME;
-    }
-    if ((target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE) && target.as.ptr && ((luby_class_obj *)target.as.ptr)->frozen) {
-        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
-        return (int)LUBY_E_RUNTIME;
-    }
-
-    luby_proc *proc = NULL;
-    if (argc >= 3 && argv[2].type == LUBY_T_PROC) proc = (luby_proc *)argv[2].as.ptr;
-    else if (argc >= 2 && argv[1].type == LUBY_T_PROC) proc = (luby_proc *)argv[1].as.ptr;
-    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
-    if (!proc) return (int)LUBY_E_TYPE;
-
-    if (target.type == LUBY_T_OBJECT && target.as.ptr) {
-        luby_object_set_singleton_method(L, (luby_object *)target.as.ptr, name, proc);
-    } else {
-        luby_class_set_singleton_method(L, (luby_class_obj *)target.as.ptr, name, proc);
-    }
     if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_class_eval(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value target = argv[0];
-    if (!(target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE)) return (int)LUBY_E_TYPE;
-
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) {
-        const char *code = (const char *)argv[1].as.ptr;
-        if (!code) return (int)LUBY_E_TYPE;
-        return luby_eval_with_context(L, target, target, code, 0, "<class_eval>", out);
+static int luby_hash_set(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    if (h->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    for (size_t i = 0; i < h->count; i++) {
+        if (luby_value_eq(h->entries[i].key, argv[1])) {
+            h->entries[i].value = argv[2];
+            if (out) *out = argv[0];
+            return (int)LUBY_E_OK;
+        }
     }
-
-    if (L->current_block.type == LUBY_T_PROC) {
-        luby_value saved_class = L->current_class;
-        L->current_class = target;
-        int rc = luby_call_proc_with_self(L, (luby_proc *)L->current_block.as.ptr, target, 0, NULL, out);
-        L->current_class = saved_class;
-        return rc;
+    if (h->count + 1 > h->capacity) {
+        size_t new_cap = h->capacity < 8 ? 8 : h->capacity * 2;
+        luby_hash_entry *ne = (luby_hash_entry *)luby_alloc_raw(L, h->entries, new_cap * sizeof(luby_hash_entry));
+        if (!ne) return (int)LUBY_E_OOM;
+        h->entries = ne;
+        h->capacity = new_cap;
     }
-
-    return (int)LUBY_E_TYPE;
+    h->entries[h->count].key = argv[1];
+    h->entries[h->count].value = argv[2];
+    h->count++;
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
 }
 
-static int luby_base_instance_eval(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value target = argv[0];
-    if (!luby_has_class_dispatch(target)) return (int)LUBY_E_TYPE;
-
-    luby_value target_class = luby_nil();
-    luby_class_obj *tcls = luby_get_receiver_class(target);
-    if (tcls) {
-        if (target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE) {
-            target_class = target;
-        } else {
-            target_class.type = LUBY_T_CLASS;
-            target_class.as.ptr = tcls;
-        }
-    }
+static int luby_hash_merge(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    if (argv[1].type != LUBY_T_HASH || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *a = (luby_hash *)argv[0].as.ptr;
+    luby_hash *b = (luby_hash *)argv[1].as.ptr;
+    luby_hash *dst = luby_hash_new_heap(L);
+    if (!dst) return (int)LUBY_E_OOM;
 
-    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) {
-        const char *code = (const char *)argv[1].as.ptr;
-        if (!code) return (int)LUBY_E_TYPE;
-        return luby_eval_with_context(L, target_class, target, code, 0, "<instance_eval>", out);
+    for (size_t i = 0; i < a->count; i++) {
+        luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, a->entries[i].key, a->entries[i].value);
     }
-
-    if (L->current_block.type == LUBY_T_PROC) {
-        luby_value saved_class = L->current_class;
-        L->current_class = target_class;
-        int rc = luby_call_proc_with_self(L, (luby_proc *)L->current_block.as.ptr, target, 0, NULL, out);
-        L->current_class = saved_class;
-        return rc;
+    for (size_t i = 0; i < b->count; i++) {
+        luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, b->entries[i].key, b->entries[i].value);
     }
-
-    return (int)LUBY_E_TYPE;
+    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = dst;
+    if (out) *out = v;
+    return (int)LUBY_E_OK;
 }
 
-static int luby_base_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value modv = argv[0];
-    if (modv.type != LUBY_T_MODULE && modv.type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
-    luby_class_obj *mod = (luby_class_obj *)modv.as.ptr;
-    luby_class_obj *target = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_CLASS || argv[1].type == LUBY_T_MODULE)) {
-        target = (luby_class_obj *)argv[1].as.ptr;
-    } else if (L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE) {
-        target = (luby_class_obj *)L->current_class.as.ptr;
+static int luby_hash_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) {
+        if (out) *out = luby_enum_new(L, argv[0], LUBY_ENUM_HASH);
+        return (int)LUBY_E_OK;
     }
-    if (!target) return (int)LUBY_E_TYPE;
-    if (target->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    if (!luby_class_add_include(L, target, mod)) return (int)LUBY_E_RUNTIME;
-    {
-        luby_value recv; recv.type = modv.type; recv.as.ptr = mod;
-        luby_value arg; arg.type = (target == mod) ? modv.type : LUBY_T_CLASS; arg.as.ptr = target;
-        int hook_rc = luby_call_hook_if_exists(L, recv, "included", arg);
-        if (hook_rc == (int)LUBY_E_RUNTIME) return (int)LUBY_E_RUNTIME;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
     }
-    if (out) *out = luby_nil();
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_prepend(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+static int luby_generic_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    luby_value modv = argv[0];
-    if (modv.type != LUBY_T_MODULE && modv.type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
-    luby_class_obj *mod = (luby_class_obj *)modv.as.ptr;
-    luby_class_obj *target = NULL;
-    if (argc >= 2 && (argv[1].type == LUBY_T_CLASS || argv[1].type == LUBY_T_MODULE)) {
-        target = (luby_class_obj *)argv[1].as.ptr;
-    } else if (L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE) {
-        target = (luby_class_obj *)L->current_class.as.ptr;
+    switch (argv[0].type) {
+        case LUBY_T_ARRAY: return luby_array_each(L, argc, argv, out);
+        case LUBY_T_HASH: return luby_hash_each(L, argc, argv, out);
+        case LUBY_T_RANGE: return luby_range_each(L, argc, argv, out);
+        default: return (int)LUBY_E_TYPE;
     }
-    if (!target) return (int)LUBY_E_TYPE;
-    if (target->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    if (!luby_class_add_prepend(L, target, mod)) return (int)LUBY_E_RUNTIME;
-    if (out) *out = luby_nil();
-    return (int)LUBY_E_OK;
 }
 
-static int luby_base_extend(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    luby_value recv = luby_nil();
-    luby_value modv = luby_nil();
-    if (argc == 1) {
-        recv = L->current_self;
-        modv = argv[0];
-    } else if (argc >= 2) {
-        recv = argv[0];
-        modv = argv[1];
-    } else {
-        return (int)LUBY_E_TYPE;
-    }
-    if (modv.type != LUBY_T_MODULE && modv.type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
-    luby_class_obj *mod = (luby_class_obj *)modv.as.ptr;
-    luby_class_obj *target = luby_get_receiver_class(recv);
-    if (!target) return (int)LUBY_E_TYPE;
-    if (target->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
-    if (!luby_class_merge_methods(L, target, mod)) return (int)LUBY_E_RUNTIME;
-    if (out) *out = recv;
-    return (int)LUBY_E_OK;
-}
+static int luby_hash_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0;
+    dst->capacity = h->count;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
 
-// attr_reader: defines a getter method for instance variable
-// attr_reader(:name) generates: def name; @name; end
-static int luby_base_attr_reader(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
-        return (int)LUBY_E_RUNTIME;
-    }
-    for (int i = 0; i < argc; i++) {
-        if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
-        const char *name = (const char *)argv[i].as.ptr;
-        // Generate: def name; @name; end
-        char code[128];
-        snprintf(code, sizeof(code), "def %s; @%s; end", name, name);
-        luby_value dummy;
-        luby_eval(L, code, 0, "<attr_reader>", &dummy);
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        dst->items[dst->count++] = res;
     }
-    if (out) *out = luby_nil();
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-// attr_writer: defines a setter method for instance variable
-// attr_writer(:name) generates: def name=(v); @name = v; end
-static int luby_base_attr_writer(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
-        return (int)LUBY_E_RUNTIME;
-    }
-    for (int i = 0; i < argc; i++) {
-        if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
-        const char *name = (const char *)argv[i].as.ptr;
-        // Generate: def name=(v); @name = v; end
-        char code[128];
-        snprintf(code, sizeof(code), "def %s=(v); @%s = v; end", name, name);
-        luby_value dummy;
-        luby_eval(L, code, 0, "<attr_writer>", &dummy);
+static int luby_hash_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    luby_hash *dst = luby_hash_new_heap(L);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_HASH, dst)) return (int)LUBY_E_OOM;
+
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        if (luby_is_truthy(res)) {
+            luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, h->entries[i].key, h->entries[i].value);
+        }
     }
-    if (out) *out = luby_nil();
+    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = dst;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-// attr_accessor: defines both getter and setter
-static int luby_base_attr_accessor(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    luby_base_attr_reader(L, argc, argv, out);
-    luby_base_attr_writer(L, argc, argv, out);
+static int luby_hash_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    luby_hash *dst = luby_hash_new_heap(L);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_HASH, dst)) return (int)LUBY_E_OOM;
+
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        if (!luby_is_truthy(res)) {
+            luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = dst }, h->entries[i].key, h->entries[i].value);
+        }
+    }
+    luby_value v; v.type = LUBY_T_HASH; v.as.ptr = dst;
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-// private: sets visibility of subsequent methods to private
-static int luby_base_private(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc == 0) {
-        // No arguments: change visibility mode for subsequent methods
-        L->current_visibility = LUBY_VIS_PRIVATE;
-    } else {
-        // With arguments: change visibility of specific methods
-        if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
-            return (int)LUBY_E_RUNTIME;
-        }
-        luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
-        for (int i = 0; i < argc; i++) {
-            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
-            const char *name = (const char *)argv[i].as.ptr;
-            luby_proc *proc = luby_class_get_method(L, cls, name);
-            if (proc) {
-                proc->visibility = LUBY_VIS_PRIVATE;
-                L->method_epoch++;  // Invalidate method cache
-            }
-        }
+static int luby_hash_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
     }
-    if (out) *out = luby_nil();
+    if (out) *out = luby_bool(0);
     return (int)LUBY_E_OK;
 }
 
-// public: sets visibility of subsequent methods to public
-static int luby_base_public(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc == 0) {
-        // No arguments: change visibility mode for subsequent methods
-        L->current_visibility = LUBY_VIS_PUBLIC;
-    } else {
-        // With arguments: change visibility of specific methods
-        if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
-            return (int)LUBY_E_RUNTIME;
-        }
-        luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
-        for (int i = 0; i < argc; i++) {
-            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
-            const char *name = (const char *)argv[i].as.ptr;
-            luby_proc *proc = luby_class_get_method(L, cls, name);
-            if (proc) {
-                proc->visibility = LUBY_VIS_PUBLIC;
-                L->method_epoch++;  // Invalidate method cache
-            }
-        }
+static int luby_hash_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        if (!luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
     }
-    if (out) *out = luby_nil();
+    if (out) *out = luby_bool(1);
     return (int)LUBY_E_OK;
 }
 
-// protected: sets visibility of subsequent methods to protected
-static int luby_base_protected(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc == 0) {
-        // No arguments: change visibility mode for subsequent methods
-        L->current_visibility = LUBY_VIS_PROTECTED;
-    } else {
-        // With arguments: change visibility of specific methods
-        if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
-            return (int)LUBY_E_RUNTIME;
-        }
-        luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
-        for (int i = 0; i < argc; i++) {
-            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
-            const char *name = (const char *)argv[i].as.ptr;
-            luby_proc *proc = luby_class_get_method(L, cls, name);
-            if (proc) {
-                proc->visibility = LUBY_VIS_PROTECTED;
-                L->method_epoch++;  // Invalidate method cache
-            }
-        }
+static int luby_hash_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
     }
-    if (out) *out = luby_nil();
+    if (out) *out = luby_bool(1);
     return (int)LUBY_E_OK;
 }
 
-// module_function: makes methods both private instance methods and public singleton methods
-// When called without args, subsequent method definitions become module functions
-// When called with method names, those specific methods become module functions
-static int luby_base_module_function(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (L->current_class.type != LUBY_T_MODULE) {
-        luby_set_error(L, LUBY_E_RUNTIME, "module_function is only for modules", NULL, 0, 0);
-        return (int)LUBY_E_RUNTIME;
-    }
-    luby_class_obj *mod = (luby_class_obj *)L->current_class.as.ptr;
-    
-    if (argc == 0) {
-        // No arguments: enable module_function mode for subsequent methods
-        L->module_function_mode = 1;
-    } else {
-        // With arguments: make specific methods module functions
-        for (int i = 0; i < argc; i++) {
-            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
-            const char *name = (const char *)argv[i].as.ptr;
-            luby_proc *proc = luby_class_get_method(L, mod, name);
-            if (proc) {
-                // Make instance method private
-                proc->visibility = LUBY_VIS_PRIVATE;
-                // Add as singleton method (public)
-                luby_class_set_singleton_method(L, mod, name, proc);
-            }
-        }
+static int luby_hash_find(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value args[2];
+        args[0] = h->entries[i].key;
+        args[1] = h->entries[i].value;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        if (luby_is_truthy(res)) { if (out) *out = h->entries[i].key; return (int)LUBY_E_OK; }
     }
     if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-// alias: creates an alias for a method
-// Usage: alias new_name old_name
-static int luby_base_alias(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    const char *new_name = NULL;
-    const char *old_name = NULL;
-    luby_class_obj *cls;
-    luby_proc *old_proc;
-    char msg[256];
-    
-    if (argc < 2) {
-        luby_set_error(L, LUBY_E_TYPE, "alias requires 2 arguments", NULL, 0, 0);
-        return (int)LUBY_E_TYPE;
-    }
-    if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
-        luby_set_error(L, LUBY_E_RUNTIME, "alias must be called in class/module context", NULL, 0, 0);
-        return (int)LUBY_E_RUNTIME;
-    }
-    
-    // Convert arguments to symbols/strings
-    if (argv[0].type == LUBY_T_SYMBOL || argv[0].type == LUBY_T_STRING) {
-        new_name = (const char *)argv[0].as.ptr;
-    }
-    
-    if (argv[1].type == LUBY_T_SYMBOL || argv[1].type == LUBY_T_STRING) {
-        old_name = (const char *)argv[1].as.ptr;
-    }
-    
-    if (!new_name || !old_name) {
-        luby_set_error(L, LUBY_E_TYPE, "alias arguments must be symbols or strings", NULL, 0, 0);
-        return (int)LUBY_E_TYPE;
+static int luby_hash_reduce(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    if (h->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+
+    size_t i = 0;
+    luby_value acc = luby_nil();
+    if (argc >= 2) {
+        acc = argv[1];
+    } else {
+        acc = h->entries[0].value;
+        i = 1;
     }
-    
-    cls = (luby_class_obj *)L->current_class.as.ptr;
-    old_proc = luby_class_get_method(L, cls, old_name);
-    
-    if (!old_proc) {
-        snprintf(msg, sizeof(msg), "undefined method '%s' for class", old_name);
-        luby_set_error(L, LUBY_E_NAME, msg, NULL, 0, 0);
-        return (int)LUBY_E_NAME;
+
+    for (; i < h->count; i++) {
+        luby_value args[3];
+        args[0] = acc;
+        args[1] = h->entries[i].key;
+        args[2] = h->entries[i].value;
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 3, args, &acc, out, luby_nil());
     }
-    
-    // Copy the method to the new name
-    luby_class_set_method(L, cls, new_name, old_proc);
-    
-    if (out) *out = luby_nil();
+    if (out) *out = acc;
     return (int)LUBY_E_OK;
 }
 
-// ---------------------- Additional stdlib functions -------------------------
+// Generic map: dispatches to array or hash
+static int luby_generic_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_HASH) return luby_hash_map(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_map(L, argc, argv, out);
+    return luby_array_map(L, argc, argv, out);
+}
 
-static int luby_base_to_s(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// Generic select: dispatches to array, hash, or range
+static int luby_generic_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    char *str = luby_value_to_string(L, argv[0]);
-    if (out) *out = luby_string(L, str, 0);
-    if (str) luby_alloc_raw(L, str, 0);
-    return (int)LUBY_E_OK;
+    if (argv[0].type == LUBY_T_HASH) return luby_hash_select(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_select(L, argc, argv, out);
+    return luby_array_select(L, argc, argv, out);
 }
 
-static int luby_base_is_nil(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
-    if (out) *out = luby_bool(argv[0].type == LUBY_T_NIL);
-    return (int)LUBY_E_OK;
+// Generic reject: dispatches to array, hash, or range
+static int luby_generic_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_HASH) return luby_hash_reject(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_reject(L, argc, argv, out);
+    return luby_array_reject(L, argc, argv, out);
 }
 
-static int luby_str_upcase(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t len = strlen(src);
-    // Pause GC - src points to argv which may not be rooted during alloc
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, len);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (size_t i = 0; i < len; i++) {
-        dst[i] = (char)((src[i] >= 'a' && src[i] <= 'z') ? src[i] - 32 : src[i]);
-    }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
+// Generic any?: dispatches to array, hash, or range
+static int luby_generic_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_HASH) return luby_hash_any(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_any(L, argc, argv, out);
+    return luby_array_any(L, argc, argv, out);
 }
 
-static int luby_str_downcase(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t len = strlen(src);
-    // Pause GC - src points to argv which may not be rooted during alloc
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, len);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (size_t i = 0; i < len; i++) {
-        dst[i] = (char)((src[i] >= 'A' && src[i] <= 'Z') ? src[i] + 32 : src[i]);
+// Generic all?: dispatches to array, hash, or range
+static int luby_generic_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_HASH) return luby_hash_all(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_all(L, argc, argv, out);
+    return luby_array_all(L, argc, argv, out);
+}
+
+// Generic none?: dispatches to array, hash, or range
+static int luby_generic_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_HASH) return luby_hash_none(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_none(L, argc, argv, out);
+    return luby_array_none(L, argc, argv, out);
+}
+
+// has_key? / key?: h.has_key?(:foo)
+static int luby_hash_has_key(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        if (luby_value_eq(h->entries[i].key, argv[1])) {
+            if (out) *out = luby_bool(1);
+            return (int)LUBY_E_OK;
+        }
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    if (out) *out = luby_bool(0);
     return (int)LUBY_E_OK;
 }
 
-static int luby_str_split(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    const char *delim = (argv[1].type == LUBY_T_STRING && argv[1].as.ptr) ? (const char *)argv[1].as.ptr : " ";
-    size_t delim_len = strlen(delim);
-    
-    // Pause GC - src and delim point to argv which may not be rooted
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = 0; arr->capacity = 4; arr->frozen = 0;
-    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
-    
-    const char *p = src;
-    while (*p) {
-        const char *found = delim_len > 0 ? strstr(p, delim) : NULL;
-        size_t part_len = found ? (size_t)(found - p) : strlen(p);
-        char *part = luby_gc_alloc_string(L, p, part_len);
-        
-        if (arr->count >= arr->capacity) {
-            arr->capacity *= 2;
-            arr->items = (luby_value *)luby_alloc_raw(L, arr->items, arr->capacity * sizeof(luby_value));
+// has_value? / value?: h.has_value?(42)
+static int luby_hash_has_value(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        if (luby_value_eq(h->entries[i].value, argv[1])) {
+            if (out) *out = luby_bool(1);
+            return (int)LUBY_E_OK;
         }
-        arr->items[arr->count].type = LUBY_T_STRING;
-        arr->items[arr->count].as.ptr = part;
-        arr->count++;
-        
-        if (!found) break;
-        p = found + delim_len;
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    if (out) *out = luby_bool(0);
     return (int)LUBY_E_OK;
 }
 
-static int luby_str_join(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    const char *sep = (argc >= 2 && argv[1].type == LUBY_T_STRING && argv[1].as.ptr) ? (const char *)argv[1].as.ptr : "";
-    size_t sep_len = strlen(sep);
-    
-    size_t total = 0;
-    for (size_t i = 0; i < arr->count; i++) {
-        if (arr->items[i].type == LUBY_T_STRING && arr->items[i].as.ptr)
-            total += strlen((const char *)arr->items[i].as.ptr);
-        if (i > 0) total += sep_len;
+// fetch: h.fetch(:key) or h.fetch(:key, default)
+static int luby_hash_fetch(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_value result;
+    int found = 0;
+    luby_hash_get_value_found(argv[0], argv[1], &result, &found);
+    if (found) {
+        if (out) *out = result;
+        return (int)LUBY_E_OK;
     }
-    
-    // Pause GC - arr and sep point to argv which may not be rooted
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    
-    char *result = luby_gc_alloc_string(L, NULL, total);
-    if (!result) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    char *p = result;
-    for (size_t i = 0; i < arr->count; i++) {
-        if (i > 0) { memcpy(p, sep, sep_len); p += sep_len; }
-        if (arr->items[i].type == LUBY_T_STRING && arr->items[i].as.ptr) {
-            size_t len = strlen((const char *)arr->items[i].as.ptr);
-            memcpy(p, arr->items[i].as.ptr, len);
-            p += len;
+    if (argc >= 3) {
+        if (out) *out = argv[2];
+        return (int)LUBY_E_OK;
+    }
+    luby_set_error(L, LUBY_E_RUNTIME, "key not found", NULL, 0, 0);
+    return (int)LUBY_E_RUNTIME;
+}
+
+// delete: h.delete(:key) => removed value or nil
+static int luby_hash_delete(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        if (luby_value_eq(h->entries[i].key, argv[1])) {
+            luby_value removed = h->entries[i].value;
+            // Shift remaining entries
+            for (size_t j = i; j + 1 < h->count; j++) {
+                h->entries[j] = h->entries[j + 1];
+            }
+            h->count--;
+            if (out) *out = removed;
+            return (int)LUBY_E_OK;
         }
     }
-    *p = '\0';
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+    if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_reverse(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    // Pause GC - src/argv may not be rooted during allocation
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    /* String reverse */
-    if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
-        const char *src = (const char *)argv[0].as.ptr;
-        size_t slen = strlen(src);
-        char *dst = luby_gc_alloc_string(L, NULL, slen);
-        if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        for (size_t i = 0; i < slen; i++) {
-            dst[i] = src[slen - 1 - i];
+// empty?: works on arrays, hashes, and strings
+static int luby_generic_empty(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
+        if (out) *out = luby_bool(((luby_array *)argv[0].as.ptr)->count == 0);
+        return (int)LUBY_E_OK;
+    }
+    if (argv[0].type == LUBY_T_HASH && argv[0].as.ptr) {
+        if (out) *out = luby_bool(((luby_hash *)argv[0].as.ptr)->count == 0);
+        return (int)LUBY_E_OK;
+    }
+    if (argv[0].type == LUBY_T_STRING && argv[0].as.ptr) {
+        if (out) *out = luby_bool(strlen((const char *)argv[0].as.ptr) == 0);
+        return (int)LUBY_E_OK;
+    }
+    if (argv[0].type == LUBY_T_RANGE && argv[0].as.ptr) {
+        luby_range *r = (luby_range *)argv[0].as.ptr;
+        if (r->start.type == LUBY_T_INT && r->end.type == LUBY_T_INT) {
+            int64_t s = r->start.as.i, e = r->end.as.i;
+            if (r->exclusive) e--;
+            if (out) *out = luby_bool(s > e);
+        } else {
+            if (out) *out = luby_bool(0);
         }
-        L->gc_paused = was_paused;
-        if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
         return (int)LUBY_E_OK;
     }
-    /* Array reverse */
-    if (argv[0].type != LUBY_T_ARRAY) { L->gc_paused = was_paused; return (int)LUBY_E_TYPE; }
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    dst->count = src->count; dst->capacity = src->count; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    for (size_t i = 0; i < src->count; i++) {
-        dst->items[i] = src->items[src->count - 1 - i];
+    return (int)LUBY_E_TYPE;
+}
+
+// Generic to_a: dispatches to range or hash
+static int luby_generic_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_to_a(L, argc, argv, out);
+    if (argv[0].type == LUBY_T_ARRAY) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    // Fall through to hash to_a
+    if (argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    arr->count = 0; arr->capacity = h->count; arr->frozen = 0;
+    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
+    if (!arr->items && arr->capacity > 0) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    for (size_t i = 0; i < h->count; i++) {
+        luby_array *pair = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!pair) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        pair->count = 2; pair->capacity = 2; pair->frozen = 0;
+        pair->items = (luby_value *)luby_alloc_raw(L, NULL, 2 * sizeof(luby_value));
+        if (!pair->items) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        pair->items[0] = h->entries[i].key;
+        pair->items[1] = h->entries[i].value;
+        arr->items[arr->count].type = LUBY_T_ARRAY;
+        arr->items[arr->count].as.ptr = pair;
+        arr->count++;
     }
     L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_first(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_first(L, argc, argv, out);
-    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    if (out) *out = (arr->count > 0) ? arr->items[0] : luby_nil();
+// each_key: h.each_key { |k| ... }
+static int luby_hash_each_key(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &h->entries[i].key, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_last(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_last(L, argc, argv, out);
-    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    if (out) *out = (arr->count > 0) ? arr->items[arr->count - 1] : luby_nil();
+// each_value: h.each_value { |v| ... }
+static int luby_hash_each_value(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    for (size_t i = 0; i < h->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &h->entries[i].value, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_flatten(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0; dst->capacity = src->count * 2; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    
-    for (size_t i = 0; i < src->count; i++) {
-        if (src->items[i].type == LUBY_T_ARRAY && src->items[i].as.ptr) {
-            luby_array *inner = (luby_array *)src->items[i].as.ptr;
-            for (size_t j = 0; j < inner->count; j++) {
-                if (dst->count >= dst->capacity) {
-                    dst->capacity *= 2;
-                    dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
-                }
-                dst->items[dst->count++] = inner->items[j];
-            }
-        } else {
-            if (dst->count >= dst->capacity) {
-                dst->capacity *= 2;
-                dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
+static int luby_base_dig(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+    luby_value cur = argv[0];
+    for (int i = 1; i < argc; i++) {
+        if (cur.type == LUBY_T_NIL) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+        luby_value key = argv[i];
+        if (cur.type == LUBY_T_ARRAY && cur.as.ptr && key.type == LUBY_T_INT) {
+            luby_array *arr = (luby_array *)cur.as.ptr;
+            int64_t idx = key.as.i;
+            if (idx < 0 || (size_t)idx >= arr->count) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+            cur = arr->items[idx];
+            continue;
+        }
+        if (cur.type == LUBY_T_HASH && cur.as.ptr) {
+            luby_value v = luby_nil();
+            int found = 0;
+            if (luby_hash_get_value_found(cur, key, &v, &found) == (int)LUBY_E_OK && found) {
+                cur = v;
+                continue;
             }
-            dst->items[dst->count++] = src->items[i];
+            if (out) *out = luby_nil();
+            return (int)LUBY_E_OK;
         }
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
     }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    if (out) *out = cur;
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_uniq(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0; dst->capacity = src->count; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    
-    for (size_t i = 0; i < src->count; i++) {
-        int found = 0;
-        for (size_t j = 0; j < dst->count; j++) {
-            if (luby_value_eq(src->items[i], dst->items[j])) { found = 1; break; }
+static int luby_base_respond_to(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_value recv = argv[0];
+    const char *name = NULL;
+    if (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL) {
+        name = (const char *)argv[1].as.ptr;
+    }
+    int ok = 0;
+    if (name) {
+        luby_class_obj *rcls = luby_get_receiver_class(recv);
+        if (rcls) {
+            ok = luby_class_has_method(L, rcls, name);
+            if (!ok && recv.type == LUBY_T_USERDATA) {
+                ok = luby_field_resolve(L, rcls, name, 1) || luby_field_resolve(L, rcls, name, 2);
+            }
+        } else {
+            ok = luby_find_cfunc(L, name) != NULL;
+            if (!ok) {
+                luby_string_view sv = { name, strlen(name) };
+                luby_value gv = luby_get_global(L, sv);
+                ok = (gv.type == LUBY_T_PROC);
+            }
         }
-        if (!found) dst->items[dst->count++] = src->items[i];
     }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    if (!ok && name && luby_has_class_dispatch(recv)) {
+        luby_class_obj *cls = luby_get_receiver_class(recv);
+        if (cls) {
+            luby_proc *m = luby_class_get_method(L, cls, "respond_to_missing?");
+            if (m) {
+                luby_value arg; arg.type = LUBY_T_SYMBOL; arg.as.ptr = (void *)name;
+                luby_value res = luby_nil();
+                if (luby_call_method(L, cls, "respond_to_missing?", m, recv, 1, &arg, &res) == 0) {
+                    ok = luby_is_truthy(res);
+                }
+            }
+        }
+    }
+    if (out) *out = luby_bool(ok);
     return (int)LUBY_E_OK;
 }
 
-static int luby_array_sort(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = src->count; dst->capacity = src->count; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    memcpy(dst->items, src->items, src->count * sizeof(luby_value));
+// is_a? and kind_of? check if object is instance of class or its ancestors
+static int luby_base_is_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_value obj = argv[0];
+    luby_value klass = argv[1];
     
-    // Simple bubble sort for now
-    for (size_t i = 0; i < dst->count; i++) {
-        for (size_t j = i + 1; j < dst->count; j++) {
-            int swap = 0;
-            if (dst->items[i].type == LUBY_T_INT && dst->items[j].type == LUBY_T_INT) {
-                swap = dst->items[i].as.i > dst->items[j].as.i;
-            } else if (dst->items[i].type == LUBY_T_FLOAT && dst->items[j].type == LUBY_T_FLOAT) {
-                swap = dst->items[i].as.f > dst->items[j].as.f;
-            } else if (dst->items[i].type == LUBY_T_STRING && dst->items[j].type == LUBY_T_STRING) {
-                swap = strcmp((const char *)dst->items[i].as.ptr, (const char *)dst->items[j].as.ptr) > 0;
+    if (klass.type != LUBY_T_CLASS && klass.type != LUBY_T_MODULE) {
+        if (out) *out = luby_bool(0);
+        return (int)LUBY_E_OK;
+    }
+    
+    luby_class_obj *target_class = (luby_class_obj *)klass.as.ptr;
+    luby_class_obj *obj_class = luby_get_receiver_class(obj);
+    
+    // Check if obj_class is target_class or includes it
+    int is_match = 0;
+    if (obj_class && target_class) {
+        // Check direct match or superclass chain
+        luby_class_obj *current = obj_class;
+        while (current) {
+            if (current == target_class) {
+                is_match = 1;
+                break;
             }
-            if (swap) {
-                luby_value tmp = dst->items[i];
-                dst->items[i] = dst->items[j];
-                dst->items[j] = tmp;
+            // Check included modules
+            for (size_t i = 0; i < current->included_count; i++) {
+                if (current->included_modules[i] == target_class) {
+                    is_match = 1;
+                    break;
+                }
             }
+            if (is_match) break;
+            current = current->super;
         }
     }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    
+    if (out) *out = luby_bool(is_match);
     return (int)LUBY_E_OK;
 }
 
-// sort_by: [arr].sort_by { |x| key_expr }
-static int luby_array_sort_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-
-    // Build parallel arrays: copy of items + computed keys
-    size_t n = src->count;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = n; dst->capacity = n; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, n * sizeof(luby_value));
-    memcpy(dst->items, src->items, n * sizeof(luby_value));
-
-    luby_value *keys = (luby_value *)luby_alloc_raw(L, NULL, n * sizeof(luby_value));
-    for (size_t i = 0; i < n; i++) {
-        int _rc = luby_call_block(L, block, 1, &src->items[i], &keys[i]);
-        if (_rc == (int)LUBY_E_BREAK) {
-            luby_alloc_raw(L, keys, 0);
-            if (out) *out = L->block_break_value;
-            L->block_break = 0;
-            return (int)LUBY_E_OK;
-        }
-        if (_rc != 0) {
-            luby_alloc_raw(L, keys, 0);
-            return (int)LUBY_E_RUNTIME;
-        }
+// instance_of? checks if object is exactly an instance of class (no inheritance)
+static int luby_base_instance_of(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_value obj = argv[0];
+    luby_value klass = argv[1];
+    
+    if (klass.type != LUBY_T_CLASS) {
+        if (out) *out = luby_bool(0);
+        return (int)LUBY_E_OK;
     }
-    // Bubble sort by keys
-    for (size_t i = 0; i < n; i++) {
-        for (size_t j = i + 1; j < n; j++) {
-            int swap = 0;
-            if (keys[i].type == LUBY_T_INT && keys[j].type == LUBY_T_INT) swap = keys[i].as.i > keys[j].as.i;
-            else if (keys[i].type == LUBY_T_FLOAT && keys[j].type == LUBY_T_FLOAT) swap = keys[i].as.f > keys[j].as.f;
-            else if (keys[i].type == LUBY_T_STRING && keys[j].type == LUBY_T_STRING) swap = strcmp((const char *)keys[i].as.ptr, (const char *)keys[j].as.ptr) > 0;
-            if (swap) {
-                luby_value tk = keys[i]; keys[i] = keys[j]; keys[j] = tk;
-                luby_value tv = dst->items[i]; dst->items[i] = dst->items[j]; dst->items[j] = tv;
-            }
-        }
+    
+    luby_class_obj *target_class = (luby_class_obj *)klass.as.ptr;
+    int is_match = 0;
+    
+    luby_class_obj *obj_class = luby_get_receiver_class(obj);
+    if (obj_class) {
+        is_match = (obj_class == target_class);
     }
-    luby_alloc_raw(L, keys, 0);
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    
+    if (out) *out = luby_bool(is_match);
     return (int)LUBY_E_OK;
 }
 
-// min_by: [arr].min_by { |x| key_expr }
-static int luby_array_min_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    if (src->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-
-    luby_value best = src->items[0];
-    luby_value best_key;
-    LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[0], &best_key, out, luby_nil());
-
-    for (size_t i = 1; i < src->count; i++) {
-        luby_value key;
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &key, out, luby_nil());
-        int less = 0;
-        if (key.type == LUBY_T_INT && best_key.type == LUBY_T_INT) less = key.as.i < best_key.as.i;
-        else if (key.type == LUBY_T_FLOAT && best_key.type == LUBY_T_FLOAT) less = key.as.f < best_key.as.f;
-        else if (key.type == LUBY_T_STRING && best_key.type == LUBY_T_STRING) less = strcmp((const char *)key.as.ptr, (const char *)best_key.as.ptr) < 0;
-        if (less) { best = src->items[i]; best_key = key; }
+// defined? checks if a variable, method, or constant is defined
+static int luby_base_defined(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    
+    // The argument is typically a symbol or string representing what to check
+    const char *name = NULL;
+    if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
+        name = (const char *)argv[0].as.ptr;
     }
-    if (out) *out = best;
+    
+    if (!name) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    
+    // Check if it's a global variable
+    luby_string_view sv = { name, strlen(name) };
+    luby_value gv = luby_get_global(L, sv);
+    if (gv.type != LUBY_T_NIL) {
+        if (out) *out = luby_string(L, "global-variable", 0);
+        return (int)LUBY_E_OK;
+    }
+    
+    // Check if it's a method/function
+    if (luby_find_cfunc(L, name) != NULL) {
+        if (out) *out = luby_string(L, "method", 0);
+        return (int)LUBY_E_OK;
+    }
+    
+    // Check if it's a constant (starts with uppercase)
+    if (name[0] >= 'A' && name[0] <= 'Z') {
+        if (gv.type != LUBY_T_NIL) {
+            if (out) *out = luby_string(L, "constant", 0);
+            return (int)LUBY_E_OK;
+        }
+    }
+    
+    if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-// max_by: [arr].max_by { |x| key_expr }
-static int luby_array_max_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    if (src->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
-
-    luby_value best = src->items[0];
-    luby_value best_key;
-    LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[0], &best_key, out, luby_nil());
-
-    for (size_t i = 1; i < src->count; i++) {
-        luby_value key;
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &key, out, luby_nil());
-        int greater = 0;
-        if (key.type == LUBY_T_INT && best_key.type == LUBY_T_INT) greater = key.as.i > best_key.as.i;
-        else if (key.type == LUBY_T_FLOAT && best_key.type == LUBY_T_FLOAT) greater = key.as.f > best_key.as.f;
-        else if (key.type == LUBY_T_STRING && best_key.type == LUBY_T_STRING) greater = strcmp((const char *)key.as.ptr, (const char *)best_key.as.ptr) > 0;
-        if (greater) { best = src->items[i]; best_key = key; }
-    }
-    if (out) *out = best;
-    return (int)LUBY_E_OK;
-}
-
-// group_by: [arr].group_by { |x| key_expr } => { key => [items] }
-static int luby_array_group_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-
-    luby_hash *h = (luby_hash *)luby_gc_alloc(L, sizeof(luby_hash), LUBY_GC_HASH);
-    if (!h) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    h->count = 0; h->capacity = 8; h->frozen = 0;
-    h->entries = (luby_hash_entry *)luby_alloc_raw(L, NULL, h->capacity * sizeof(luby_hash_entry));
-    luby_value hv; hv.type = LUBY_T_HASH; hv.as.ptr = h;
-
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value key;
-        int _rc = luby_call_block(L, block, 1, &src->items[i], &key);
-        if (_rc == (int)LUBY_E_BREAK) {
+// inspect - returns a string representation suitable for debugging
+static int luby_base_inspect(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value v = argv[0];
+    char buf[256];
+    
+    switch (v.type) {
+        case LUBY_T_NIL:
+            if (out) *out = luby_string(L, "nil", 0);
+            return (int)LUBY_E_OK;
+        case LUBY_T_BOOL:
+            if (out) *out = luby_string(L, v.as.b ? "true" : "false", 0);
+            return (int)LUBY_E_OK;
+        case LUBY_T_INT:
+            snprintf(buf, sizeof(buf), "%lld", (long long)v.as.i);
+            if (out) *out = luby_string(L, buf, 0);
+            return (int)LUBY_E_OK;
+        case LUBY_T_FLOAT:
+            snprintf(buf, sizeof(buf), "%g", v.as.f);
+            if (out) *out = luby_string(L, buf, 0);
+            return (int)LUBY_E_OK;
+        case LUBY_T_STRING: {
+            // Strings are shown with quotes and escaped characters
+            const char *str = v.as.ptr ? (const char *)v.as.ptr : "";
+            size_t len = strlen(str);
+            size_t dest_len = len + 2;  // for quotes
+            // Count escape chars
+            for (size_t i = 0; i < len; i++) {
+                if (str[i] == '"' || str[i] == '\\' || str[i] == '\n' || str[i] == '\t' || str[i] == '\r')
+                    dest_len++;
+            }
+            int was_paused = L->gc_paused;
+            L->gc_paused = 1;
+            char *result = luby_gc_alloc_string(L, NULL, dest_len);
+            if (!result) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+            char *p = result;
+            *p++ = '"';
+            for (size_t i = 0; i < len; i++) {
+                if (str[i] == '"') { *p++ = '\\'; *p++ = '"'; }
+                else if (str[i] == '\\') { *p++ = '\\'; *p++ = '\\'; }
+                else if (str[i] == '\n') { *p++ = '\\'; *p++ = 'n'; }
+                else if (str[i] == '\t') { *p++ = '\\'; *p++ = 't'; }
+                else if (str[i] == '\r') { *p++ = '\\'; *p++ = 'r'; }
+                else *p++ = str[i];
+            }
+            *p++ = '"';
+            *p = '\0';
             L->gc_paused = was_paused;
-            if (out) *out = L->block_break_value;
-            L->block_break = 0;
+            if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
             return (int)LUBY_E_OK;
         }
-        if (_rc != 0) { L->gc_paused = was_paused; return (int)LUBY_E_RUNTIME; }
-
-        // Find or create array for this key
-        luby_array *group = NULL;
-        for (size_t j = 0; j < h->count; j++) {
-            if (luby_value_eq(h->entries[j].key, key) && h->entries[j].value.type == LUBY_T_ARRAY) {
-                group = (luby_array *)h->entries[j].value.as.ptr;
-                break;
-            }
+        case LUBY_T_SYMBOL: {
+            // Symbols are shown with colon prefix
+            const char *sym = v.as.ptr ? (const char *)v.as.ptr : "";
+            size_t len = strlen(sym);
+            int was_paused = L->gc_paused;
+            L->gc_paused = 1;
+            char *result = luby_gc_alloc_string(L, NULL, len + 1);  // +1 for colon
+            if (!result) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+            result[0] = ':';
+            memcpy(result + 1, sym, len);
+            result[len + 1] = '\0';
+            L->gc_paused = was_paused;
+            if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+            return (int)LUBY_E_OK;
         }
-        if (!group) {
-            group = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-            if (!group) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-            group->count = 0; group->capacity = 4; group->frozen = 0;
-            group->items = (luby_value *)luby_alloc_raw(L, NULL, group->capacity * sizeof(luby_value));
-            luby_value gv; gv.type = LUBY_T_ARRAY; gv.as.ptr = group;
-            luby_hash_set_value(L, hv, key, gv);
+        case LUBY_T_ARRAY: {
+            luby_array *arr = (luby_array *)v.as.ptr;
+            snprintf(buf, sizeof(buf), "[Array: %zu items]", arr ? arr->count : 0);
+            if (out) *out = luby_string(L, buf, 0);
+            return (int)LUBY_E_OK;
         }
-        if (group->count >= group->capacity) {
-            group->capacity *= 2;
-            group->items = (luby_value *)luby_alloc_raw(L, group->items, group->capacity * sizeof(luby_value));
+        case LUBY_T_HASH: {
+            luby_hash *h = (luby_hash *)v.as.ptr;
+            snprintf(buf, sizeof(buf), "{Hash: %zu items}", h ? h->count : 0);
+            if (out) *out = luby_string(L, buf, 0);
+            return (int)LUBY_E_OK;
         }
-        group->items[group->count++] = src->items[i];
-    }
-    L->gc_paused = was_paused;
-    if (out) *out = hv;
-    return (int)LUBY_E_OK;
-}
-
-// flat_map: [arr].flat_map { |x| array_expr } => flattened array
-static int luby_array_flat_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0; dst->capacity = src->count * 2; dst->frozen = 0;
-    if (dst->capacity < 4) dst->capacity = 4;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res;
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        if (res.type == LUBY_T_ARRAY && res.as.ptr) {
-            luby_array *sub = (luby_array *)res.as.ptr;
-            for (size_t j = 0; j < sub->count; j++) {
-                if (dst->count >= dst->capacity) {
-                    dst->capacity *= 2;
-                    dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
-                }
-                dst->items[dst->count++] = sub->items[j];
+        case LUBY_T_CLASS: {
+            luby_class_obj *cls = (luby_class_obj *)v.as.ptr;
+            if (cls && cls->name) {
+                if (out) *out = luby_string(L, cls->name, 0);
+            } else {
+                if (out) *out = luby_string(L, "#<Class>", 0);
             }
-        } else {
-            if (dst->count >= dst->capacity) {
-                dst->capacity *= 2;
-                dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
+            return (int)LUBY_E_OK;
+        }
+        case LUBY_T_MODULE: {
+            luby_class_obj *mod = (luby_class_obj *)v.as.ptr;
+            if (mod && mod->name) {
+                if (out) *out = luby_string(L, mod->name, 0);
+            } else {
+                if (out) *out = luby_string(L, "#<Module>", 0);
             }
-            dst->items[dst->count++] = res;
+            return (int)LUBY_E_OK;
+        }
+        case LUBY_T_OBJECT: {
+            luby_object *obj = (luby_object *)v.as.ptr;
+            if (obj && obj->klass && obj->klass->name) {
+                snprintf(buf, sizeof(buf), "#<%s:0x%016llx>", obj->klass->name, (unsigned long long)(uintptr_t)obj);
+            } else {
+                snprintf(buf, sizeof(buf), "#<Object:0x%016llx>", (unsigned long long)(uintptr_t)obj);
+            }
+            if (out) *out = luby_string(L, buf, 0);
+            return (int)LUBY_E_OK;
+        }
+        case LUBY_T_USERDATA: {
+            luby_userdata *ud = (luby_userdata *)v.as.ptr;
+            if (ud && !ud->alive) {
+                if (out) *out = luby_string(L, "#<dead>", 0);
+            } else if (ud && ud->klass && ud->klass->name) {
+                snprintf(buf, sizeof(buf), "#<%s:0x%016llx>", ud->klass->name, (unsigned long long)(uintptr_t)ud);
+                if (out) *out = luby_string(L, buf, 0);
+            } else {
+                snprintf(buf, sizeof(buf), "#<%s>", luby_type_name(v));
+                if (out) *out = luby_string(L, buf, 0);
+            }
+            return (int)LUBY_E_OK;
+        }
+        case LUBY_T_VECTOR: {
+            char vbuf[512];
+            luby_vector_format(v, vbuf, sizeof(vbuf));
+            if (out) *out = luby_string(L, vbuf, 0);
+            return (int)LUBY_E_OK;
+        }
+        case LUBY_T_BUFFER: {
+            char vbuf[512];
+            luby_buffer_format(v, vbuf, sizeof(vbuf));
+            if (out) *out = luby_string(L, vbuf, 0);
+            return (int)LUBY_E_OK;
         }
+        default:
+            snprintf(buf, sizeof(buf), "#<%s>", luby_type_name(v));
+            if (out) *out = luby_string(L, buf, 0);
+            return (int)LUBY_E_OK;
     }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
 }
 
-// sum: [arr].sum or [arr].sum { |x| expr }
-static int luby_array_sum(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// object_id - returns a unique identifier for the object
+static int luby_base_object_id(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_sum(L, argc, argv, out);
-    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-
-    int use_float = 0;
-    int64_t isum = 0;
-    double fsum = 0.0;
-
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value v = src->items[i];
-        if (block) {
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &v, out, luby_nil());
-        }
-        if (v.type == LUBY_T_FLOAT) {
-            if (!use_float) { fsum = (double)isum; use_float = 1; }
-            fsum += v.as.f;
-        } else if (v.type == LUBY_T_INT) {
-            if (use_float) fsum += (double)v.as.i;
-            else isum += v.as.i;
-        }
-    }
-    if (out) {
-        if (use_float) { out->type = LUBY_T_FLOAT; out->as.f = fsum; }
-        else { out->type = LUBY_T_INT; out->as.i = isum; }
+    luby_value v = argv[0];
+    
+    // For immediate values (nil, bool, int), use a deterministic ID
+    switch (v.type) {
+        case LUBY_T_NIL:
+            if (out) *out = luby_int(4LL);  // Ruby convention: nil.object_id == 4
+            return (int)LUBY_E_OK;
+        case LUBY_T_BOOL:
+            // Ruby convention: true.object_id == 20, false.object_id == 0
+            if (out) *out = luby_int(v.as.b ? 20LL : 0LL);
+            return (int)LUBY_E_OK;
+        case LUBY_T_INT:
+            // Ruby convention: for integers, object_id = (int * 2) + 1
+            if (out) *out = luby_int((v.as.i * 2) + 1);
+            return (int)LUBY_E_OK;
+        case LUBY_T_SYMBOL:
+            // Symbols with same name should have same object_id (use pointer address)
+            if (out) *out = luby_int((int64_t)(uintptr_t)v.as.ptr);
+            return (int)LUBY_E_OK;
+        default:
+            // For heap-allocated objects, use pointer address
+            if (out) *out = luby_int((int64_t)(uintptr_t)v.as.ptr);
+            return (int)LUBY_E_OK;
     }
-    return (int)LUBY_E_OK;
 }
 
-// count: [arr].count or [arr].count { |x| predicate }
-static int luby_array_count(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_RANGE) return luby_range_size(L, argc, argv, out);
-    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
+// Class#name - returns the name of the class
+static int luby_class_name(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type != LUBY_T_CLASS && argv[0].type != LUBY_T_MODULE) return (int)LUBY_E_TYPE;
+    
+    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
+    if (cls && cls->name) {
+        if (out) *out = luby_string(L, cls->name, 0);
+    } else {
+        if (out) *out = luby_nil();
+    }
+    return (int)LUBY_E_OK;
+}
 
-    if (!block) {
-        // No block: return array length
-        if (out) { out->type = LUBY_T_INT; out->as.i = (int64_t)src->count; }
+// Class#superclass - returns the superclass
+static int luby_class_superclass(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type != LUBY_T_CLASS) {
+        if (out) *out = luby_nil();
         return (int)LUBY_E_OK;
     }
-    int64_t cnt = 0;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value res;
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-        if (luby_is_truthy(res)) cnt++;
+    
+    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
+    if (cls && cls->super) {
+        if (out) { out->type = LUBY_T_CLASS; out->as.ptr = cls->super; }
+    } else {
+        if (out) *out = luby_nil();
     }
-    if (out) { out->type = LUBY_T_INT; out->as.i = cnt; }
     return (int)LUBY_E_OK;
 }
 
-// zip: [a].zip([b], [c], ...) => [[a0,b0,c0], [a1,b1,c1], ...]
-static int luby_array_zip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *first = (luby_array *)argv[0].as.ptr;
-    size_t n = first->count;
-    int num_arrays = argc; // first + others
-
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    dst->count = n; dst->capacity = n; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, n * sizeof(luby_value));
-
-    for (size_t i = 0; i < n; i++) {
-        luby_array *row = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!row) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        row->count = (size_t)num_arrays; row->capacity = (size_t)num_arrays; row->frozen = 0;
-        row->items = (luby_value *)luby_alloc_raw(L, NULL, (size_t)num_arrays * sizeof(luby_value));
-        row->items[0] = first->items[i];
-        for (int j = 1; j < num_arrays; j++) {
-            if (argv[j].type == LUBY_T_ARRAY && argv[j].as.ptr) {
-                luby_array *other = (luby_array *)argv[j].as.ptr;
-                row->items[j] = (i < other->count) ? other->items[i] : luby_nil();
-            } else {
-                row->items[j] = luby_nil();
-            }
+// Class#ancestors - returns array of ancestors (class + included modules + superclasses)
+static int luby_class_ancestors(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type != LUBY_T_CLASS && argv[0].type != LUBY_T_MODULE) return (int)LUBY_E_TYPE;
+    
+    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
+    if (!cls) {
+        if (out) *out = luby_array_new(L);
+        return (int)LUBY_E_OK;
+    }
+    
+    luby_value arr = luby_array_new(L);
+    
+    // Walk the inheritance chain
+    luby_class_obj *current = cls;
+    while (current) {
+        // Add the current class/module
+        luby_value cls_val;
+        cls_val.type = (current == cls && argv[0].type == LUBY_T_MODULE) ? LUBY_T_MODULE : LUBY_T_CLASS;
+        cls_val.as.ptr = current;
+        luby_array_push_value(L, arr, cls_val);
+        
+        // Add included modules (in reverse order of inclusion)
+        for (size_t i = 0; i < current->included_count; i++) {
+            luby_value mod_val;
+            mod_val.type = LUBY_T_MODULE;
+            mod_val.as.ptr = current->included_modules[i];
+            luby_array_push_value(L, arr, mod_val);
         }
-        dst->items[i].type = LUBY_T_ARRAY;
-        dst->items[i].as.ptr = row;
+        
+        // Move to superclass
+        current = current->super;
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    
+    if (out) *out = arr;
     return (int)LUBY_E_OK;
 }
 
-// gsub(str, pattern, replacement) - replace all occurrences
-static int luby_str_gsub(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 3 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr ||
-        argv[2].type != LUBY_T_STRING || !argv[2].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    const char *pat = (const char *)argv[1].as.ptr;
-    const char *rep = (const char *)argv[2].as.ptr;
-    size_t pat_len = strlen(pat);
-    size_t rep_len = strlen(rep);
-    if (pat_len == 0) {
-        // Empty pattern: return original
+// Class#pool(n) - keep up to n instances for reuse, with n blocks allocated
+// up front; pool(0) turns pooling off. Classes with their own new are
+// refused, since acquire would bypass it.
+static int luby_class_pool(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc != 2 || argv[0].type != LUBY_T_CLASS || !argv[0].as.ptr || argv[1].type != LUBY_T_INT || argv[1].as.i < 0) {
+        luby_set_error(L, LUBY_E_TYPE, "pool: expected a non-negative Integer size", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    luby_class_obj *cls = (luby_class_obj *)argv[0].as.ptr;
+    if (luby_class_get_singleton_method(L, cls, "new") || luby_class_lookup_method(L, cls, "new").type == LUBY_T_CMETHOD) {
+        luby_set_error(L, LUBY_E_TYPE, "pool: class defines its own new", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    size_t n = (size_t)argv[1].as.i;
+    // Released instances beyond the new size become ordinary objects again
+    luby_array *items = cls->pool_items;
+    while (items && items->count > n) ((luby_object *)items->items[--items->count].as.ptr)->released = 0;
+    luby_pool_trim(L, cls, n);
+    if (n == 0) {
+        cls->pool_capacity = 0;
+        luby_pool_unregister(L, cls);
         if (out) *out = argv[0];
         return (int)LUBY_E_OK;
     }
-
-    // Count replacements to size the buffer
-    size_t src_len = strlen(src);
-    size_t count = 0;
-    const char *p = src;
-    while ((p = strstr(p, pat)) != NULL) { count++; p += pat_len; }
-
-    size_t new_len = src_len + count * (rep_len - pat_len);
-    char *buf = (char *)luby_alloc_raw(L, NULL, new_len + 1);
-    char *dst = buf;
-    p = src;
-    while (*p) {
-        const char *found = strstr(p, pat);
-        if (!found) {
-            size_t tail = strlen(p);
-            memcpy(dst, p, tail);
-            dst += tail;
-            break;
-        }
-        size_t seg = (size_t)(found - p);
-        memcpy(dst, p, seg); dst += seg;
-        memcpy(dst, rep, rep_len); dst += rep_len;
-        p = found + pat_len;
-    }
-    *dst = '\0';
-
-    char *result = luby_gc_alloc_string(L, buf, new_len);
-    luby_alloc_raw(L, buf, 0);
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+    if (!items) {
+        luby_value arr = luby_array_new(L);
+        if (arr.type != LUBY_T_ARRAY) return (int)LUBY_E_OOM;
+        cls->pool_items = (luby_array *)arr.as.ptr;
+    }
+    if (!luby_pool_register(L, cls)) return (int)LUBY_E_OOM;
+    size_t size = luby_pool_block_size(cls);
+    while (cls->pool_free_count < n) {
+        luby_gc_obj *mem = (luby_gc_obj *)luby_alloc_raw(L, NULL, size);
+        if (!mem) return (int)LUBY_E_OOM;
+        memset(mem, 0, size);
+        mem->gc_next = cls->pool_free;
+        cls->pool_free = mem;
+        cls->pool_free_count++;
+    }
+    cls->pool_capacity = n;
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// sub(str, pattern, replacement) - replace first occurrence
-static int luby_str_sub(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 3 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr ||
-        argv[2].type != LUBY_T_STRING || !argv[2].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    const char *pat = (const char *)argv[1].as.ptr;
-    const char *rep = (const char *)argv[2].as.ptr;
-    size_t pat_len = strlen(pat);
-    size_t rep_len = strlen(rep);
-    if (pat_len == 0) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-
-    const char *found = strstr(src, pat);
-    if (!found) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-
-    size_t src_len = strlen(src);
-    size_t new_len = src_len - pat_len + rep_len;
-    char *buf = (char *)luby_alloc_raw(L, NULL, new_len + 1);
-    size_t prefix = (size_t)(found - src);
-    memcpy(buf, src, prefix);
-    memcpy(buf + prefix, rep, rep_len);
-    memcpy(buf + prefix + rep_len, found + pat_len, src_len - prefix - pat_len);
-    buf[new_len] = '\0';
+// The receiver of acquire/release if it is a pooled class; NULL with a
+// TypeError otherwise
+static luby_class_obj *luby_pool_receiver(luby_state *L, int argc, const luby_value *argv, const char *msg) {
+    if (argc < 1 || argv[0].type != LUBY_T_CLASS || !argv[0].as.ptr || !((luby_class_obj *)argv[0].as.ptr)->pool_capacity) {
+        luby_set_error(L, LUBY_E_TYPE, msg, NULL, 0, 0);
+        return NULL;
+    }
+    return (luby_class_obj *)argv[0].as.ptr;
+}
 
-    char *result = luby_gc_alloc_string(L, buf, new_len);
-    luby_alloc_raw(L, buf, 0);
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+// Class#acquire(*args) - a pooled instance with initialize run on it. The VM
+// builds these inline, like new; this entry serves luby_invoke_global and
+// reports classes that are not pooled.
+static int luby_class_acquire(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_class_obj *cls = luby_pool_receiver(L, argc, argv, "acquire: class is not pooled");
+    if (!cls) return (int)LUBY_E_TYPE;
+    luby_object *obj = luby_pool_acquire(L, cls);
+    if (!obj) return (int)LUBY_E_OOM;
+    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
+    if (!luby_gc_push_temp(L, ov)) return (int)LUBY_E_OOM;
+    if (luby_class_get_method(L, cls, "initialize")) {
+        luby_value ignored;
+        int rc = luby_invoke_method(L, ov, "initialize", argc - 1, argv + 1, &ignored);
+        if (rc != 0) return rc;
+    }
+    if (out) *out = ov;
     return (int)LUBY_E_OK;
 }
 
-// start_with?(str, prefix)
-static int luby_str_start_with(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
-    const char *str = (const char *)argv[0].as.ptr;
-    const char *prefix = (const char *)argv[1].as.ptr;
-    size_t plen = strlen(prefix);
-    if (out) *out = luby_bool(strncmp(str, prefix, plen) == 0);
+// Class#release(obj) - hand an instance back for acquire. Its ivars keep
+// their names but read nil, Struct members are cleared and singleton methods
+// dropped. Returns false, leaving obj to the collector, if it is already
+// released or the pool is full.
+static int luby_class_release(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_class_obj *cls = luby_pool_receiver(L, argc, argv, "release: class is not pooled");
+    if (!cls) return (int)LUBY_E_TYPE;
+    if (argc != 2 || argv[1].type != LUBY_T_OBJECT || !argv[1].as.ptr || ((luby_object *)argv[1].as.ptr)->klass != cls) {
+        luby_set_error(L, LUBY_E_TYPE, "release: expected an instance of the pooled class", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    luby_object *obj = (luby_object *)argv[1].as.ptr;
+    luby_array *items = cls->pool_items;
+    if (obj->released || items->count >= cls->pool_capacity) {
+        if (out) *out = luby_bool(0);
+        return (int)LUBY_E_OK;
+    }
+    if (!luby_array_reserve(L, items, items->count + 1)) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < obj->ivar_count; i++) obj->ivar_values[i] = luby_nil();
+    for (size_t i = 0; i < obj->slot_count; i++) obj->slots[i] = luby_nil();
+    obj->singleton_methods = NULL;
+    obj->frozen = 0;
+    obj->released = 1;
+    items->items[items->count++] = argv[1];
+    if (out) *out = luby_bool(1);
     return (int)LUBY_E_OK;
 }
 
-// end_with?(str, suffix)
-static int luby_str_end_with(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+// Symbol#to_sym - returns self (a symbol is already a symbol)
+static int luby_symbol_to_sym(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
-    const char *str = (const char *)argv[0].as.ptr;
-    const char *suffix = (const char *)argv[1].as.ptr;
-    size_t slen = strlen(str);
-    size_t xlen = strlen(suffix);
-    if (out) *out = luby_bool(xlen <= slen && strcmp(str + slen - xlen, suffix) == 0);
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// chars: "hello".chars => ["h", "e", "l", "l", "o"]
-static int luby_str_chars(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t slen = strlen(src);
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    arr->count = 0; arr->capacity = slen > 0 ? slen : 1; arr->frozen = 0;
-    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
-    if (!arr->items) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (size_t i = 0; i < slen; i++) {
-        char *ch = luby_gc_alloc_string(L, src + i, 1);
-        if (!ch) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-        arr->items[arr->count].type = LUBY_T_STRING;
-        arr->items[arr->count].as.ptr = ch;
-        arr->count++;
+static int luby_base_freeze(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value v = argv[0];
+    switch (v.type) {
+        case LUBY_T_ARRAY:
+            if (v.as.ptr) ((luby_array *)v.as.ptr)->frozen = 1;
+            break;
+        case LUBY_T_HASH:
+            if (v.as.ptr) ((luby_hash *)v.as.ptr)->frozen = 1;
+            break;
+        case LUBY_T_OBJECT:
+            if (v.as.ptr) ((luby_object *)v.as.ptr)->frozen = 1;
+            break;
+        case LUBY_T_CLASS:
+        case LUBY_T_MODULE:
+            if (v.as.ptr) ((luby_class_obj *)v.as.ptr)->frozen = 1;
+            break;
+        default:
+            break;
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    if (out) *out = v;
     return (int)LUBY_E_OK;
 }
 
-// chomp: "hello\n".chomp => "hello"
-static int luby_str_chomp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t slen = strlen(src);
-    size_t new_len = slen;
-    if (new_len > 0 && src[new_len - 1] == '\n') {
-        new_len--;
-        if (new_len > 0 && src[new_len - 1] == '\r') new_len--;
-    } else if (new_len > 0 && src[new_len - 1] == '\r') {
-        new_len--;
-    }
-    if (new_len == slen) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, new_len);
-    L->gc_paused = was_paused;
-    if (!dst) return (int)LUBY_E_OOM;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+static int luby_base_frozen(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    int frz = luby_value_is_frozen(argv[0]);
+    if (out) *out = luby_bool(frz);
     return (int)LUBY_E_OK;
 }
 
-// lstrip: "  hello  ".lstrip => "hello  "
-static int luby_str_lstrip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    while (*src == ' ' || *src == '\t' || *src == '\n' || *src == '\r') src++;
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, strlen(src));
-    L->gc_paused = was_paused;
-    if (!dst) return (int)LUBY_E_OOM;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
+static int luby_base_require(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || (argv[0].type != LUBY_T_STRING && argv[0].type != LUBY_T_SYMBOL)) return (int)LUBY_E_TYPE;
+    const char *path = (const char *)argv[0].as.ptr;
+    if (!path) return (int)LUBY_E_TYPE;
+    return luby_require(L, path, out);
 }
 
-// rstrip: "  hello  ".rstrip => "  hello"
-static int luby_str_rstrip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t slen = strlen(src);
-    while (slen > 0 && (src[slen - 1] == ' ' || src[slen - 1] == '\t' || src[slen - 1] == '\n' || src[slen - 1] == '\r')) slen--;
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, slen);
-    L->gc_paused = was_paused;
-    if (!dst) return (int)LUBY_E_OOM;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
+static int luby_base_load(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || (argv[0].type != LUBY_T_STRING && argv[0].type != LUBY_T_SYMBOL)) return (int)LUBY_E_TYPE;
+    const char *path = (const char *)argv[0].as.ptr;
+    if (!path) return (int)LUBY_E_TYPE;
+    return luby_load(L, path, out);
 }
 
-// tr: "hello".tr("el", "ip") => "hippo"
-static int luby_str_tr(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 3 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr ||
-        argv[2].type != LUBY_T_STRING || !argv[2].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    const char *from = (const char *)argv[1].as.ptr;
-    const char *to = (const char *)argv[2].as.ptr;
-    size_t slen = strlen(src);
-    size_t from_len = strlen(from);
-    size_t to_len = strlen(to);
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, slen);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (size_t i = 0; i < slen; i++) {
-        for (size_t j = 0; j < from_len; j++) {
-            if (dst[i] == from[j]) {
-                dst[i] = (j < to_len) ? to[j] : to[to_len - 1];
-                break;
+static int luby_base_yield(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_yield(L, argc, argv, out);
+}
+
+static int luby_base_caller(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)argc; (void)argv;
+    luby_value arr = luby_array_new(L);
+    luby_vm *vm = L->current_vm;
+    if (vm) {
+        // Walk frames from top to bottom (skip the very top frame which is
+        // the one executing the current method that called `caller`)
+        for (int i = vm->frame_count - 1; i >= 0; i--) {
+            luby_vm_frame *fr = &vm->frames[i];
+            const char *fn = fr->filename ? fr->filename : "<unknown>";
+            int ln = (fr->chunk && fr->chunk->lines && fr->ip < fr->chunk->count)
+                     ? (int)fr->chunk->lines[fr->ip] : 0;
+            const char *mn = fr->saved_method_name;
+            char buf[256];
+            if (mn && mn[0]) {
+                snprintf(buf, sizeof(buf), "%s:%d:in '%s'", fn, ln, mn);
+            } else {
+                snprintf(buf, sizeof(buf), "%s:%d:in '<main>'", fn, ln);
             }
+            luby_array_push_value(L, arr, luby_string(L, buf, 0));
         }
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    if (out) *out = arr;
     return (int)LUBY_E_OK;
 }
 
-// center: "hi".center(10) => "    hi    ", "hi".center(10, "-") => "----hi----"
-static int luby_str_center(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    int64_t width = argv[1].as.i;
-    char pad = ' ';
-    if (argc >= 3 && argv[2].type == LUBY_T_STRING && argv[2].as.ptr)
-        pad = ((const char *)argv[2].as.ptr)[0];
-    size_t slen = strlen(src);
-    if ((int64_t)slen >= width) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    size_t total_pad = (size_t)width - slen;
-    size_t left_pad = total_pad / 2;
-    size_t right_pad = total_pad - left_pad;
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = (char *)luby_gc_alloc_string(L, NULL, (size_t)width);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    memset(dst, pad, left_pad);
-    memcpy(dst + left_pad, src, slen);
-    memset(dst + left_pad + slen, pad, right_pad);
-    dst[width] = '\0';
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
+static int luby_base_send(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_value recv = argv[0];
+    const char *name = NULL;
+    if (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL) {
+        name = (const char *)argv[1].as.ptr;
+    }
+    if (!name) return (int)LUBY_E_TYPE;
+    return luby_call_method_by_name(L, recv, name, argc - 2, argv + 2, out);
 }
 
-// ljust: "hi".ljust(10) => "hi        ", "hi".ljust(10, "-") => "hi--------"
-static int luby_str_ljust(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    int64_t width = argv[1].as.i;
-    char pad = ' ';
-    if (argc >= 3 && argv[2].type == LUBY_T_STRING && argv[2].as.ptr)
-        pad = ((const char *)argv[2].as.ptr)[0];
-    size_t slen = strlen(src);
-    if ((int64_t)slen >= width) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = (char *)luby_gc_alloc_string(L, NULL, (size_t)width);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    memcpy(dst, src, slen);
-    memset(dst + slen, pad, (size_t)width - slen);
-    dst[width] = '\0';
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
+static int luby_base_public_send(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_base_send(L, argc, argv, out);
 }
 
-// rjust: "hi".rjust(10) => "        hi", "hi".rjust(10, "-") => "--------hi"
-static int luby_str_rjust(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    int64_t width = argv[1].as.i;
-    char pad = ' ';
-    if (argc >= 3 && argv[2].type == LUBY_T_STRING && argv[2].as.ptr)
-        pad = ((const char *)argv[2].as.ptr)[0];
-    size_t slen = strlen(src);
-    if ((int64_t)slen >= width) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = (char *)luby_gc_alloc_string(L, NULL, (size_t)width);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    size_t pad_len = (size_t)width - slen;
-    memset(dst, pad, pad_len);
-    memcpy(dst + pad_len, src, slen);
-    dst[width] = '\0';
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
-    return (int)LUBY_E_OK;
-}
+static int luby_base_define_method(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    const char *name = NULL;
+    if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
+        name = (const char *)argv[0].as.ptr;
+    }
+    if (!name) return (int)LUBY_E_TYPE;
+    if (!(L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE)) return (int)LUBY_E_TYPE;
+    luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
+    if (!cls) return (int)LUBY_E_TYPE;
+    if (cls->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
 
-// include? for strings: "hello".include?("ell") => true
-static int luby_str_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
-    if (out) *out = luby_bool(strstr((const char *)argv[0].as.ptr, (const char *)argv[1].as.ptr) != NULL);
-    return (int)LUBY_E_OK;
-}
+    luby_proc *proc = NULL;
+    if (argc >= 2 && argv[1].type == LUBY_T_PROC) proc = (luby_proc *)argv[1].as.ptr;
+    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
+    if (!proc) return (int)LUBY_E_TYPE;
 
-// map_with_index: [arr].map_with_index { |item, i| expr }
-static int luby_array_map_with_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0; dst->capacity = src->count; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value args[2]; args[0] = src->items[i]; args[1] = luby_int((int64_t)i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-        dst->items[dst->count++] = res;
-    }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
+    luby_class_set_method(L, cls, name, proc);
+    if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-// each_with_object: [arr].each_with_object(obj) { |item, memo| ... }
-static int luby_array_each_with_object(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_value memo = argv[1];
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value args[2]; args[0] = src->items[i]; args[1] = memo;
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
-    }
-    if (out) *out = memo;
-    return (int)LUBY_E_OK;
-}
+static int luby_base_define_singleton_method(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value target = L->current_self;
+    const char *name = NULL;
 
-// each_slice: [arr].each_slice(n) => [[slice1], [slice2], ...]
-static int luby_array_each_slice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    int64_t n = argv[1].as.i;
-    if (n <= 0) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (argc >= 2 && (argv[0].type == LUBY_T_OBJECT || argv[0].type == LUBY_T_CLASS || argv[0].type == LUBY_T_MODULE)) {
+        target = argv[0];
+        if (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL) {
+            name = (const char *)argv[1].as.ptr;
+        }
+    } else {
+        if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
+            name = (const char *)argv[0].as.ptr;
+        }
+    }
+
+    if (!name) return (int)LUBY_E_TYPE;
+    if (!(target.type == LUBY_T_OBJECT || target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE)) return (int)LUBY_E_TYPE;
+    if (target.type == LUBY_T_OBJECT && target.as.ptr && ((luby_object *)target.as.ptr)->frozen) {
+        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    if ((target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE) && target.as.ptr && ((luby_class_obj *)target.as.ptr)->frozen) {
+        if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+
+    luby_proc *proc = NULL;
+    if (argc >= 3 && argv[2].type == LUBY_T_PROC) proc = (luby_proc *)argv[2].as.ptr;
+    else if (argc >= 2 && argv[1].type == LUBY_T_PROC) proc = (luby_proc *)argv[1].as.ptr;
+    else if (L->current_block.type == LUBY_T_PROC) proc = (luby_proc *)L->current_block.as.ptr;
+    if (!proc) return (int)LUBY_E_TYPE;
+
+    if (target.type == LUBY_T_OBJECT && target.as.ptr) {
+        luby_object_set_singleton_method(L, (luby_object *)target.as.ptr, name, proc);
+    } else {
+        luby_class_set_singleton_method(L, (luby_class_obj *)target.as.ptr, name, proc);
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_class_eval(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value target = argv[0];
+    if (!(target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE)) return (int)LUBY_E_TYPE;
+
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) {
+        const char *code = (const char *)argv[1].as.ptr;
+        if (!code) return (int)LUBY_E_TYPE;
+        return luby_eval_with_context(L, target, target, code, 0, "<class_eval>", out);
+    }
+
+    if (L->current_block.type == LUBY_T_PROC) {
+        luby_value saved_class = L->current_class;
+        L->current_class = target;
+        int rc = luby_call_proc_with_self(L, (luby_proc *)L->current_block.as.ptr, target, 0, NULL, out);
+        L->current_class = saved_class;
+        return rc;
+    }
+
+    return (int)LUBY_E_TYPE;
+}
+
+static int luby_base_instance_eval(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value target = argv[0];
+    if (!luby_has_class_dispatch(target)) return (int)LUBY_E_TYPE;
+
+    luby_value target_class = luby_nil();
+    luby_class_obj *tcls = luby_get_receiver_class(target);
+    if (tcls) {
+        if (target.type == LUBY_T_CLASS || target.type == LUBY_T_MODULE) {
+            target_class = target;
+        } else {
+            target_class.type = LUBY_T_CLASS;
+            target_class.as.ptr = tcls;
+        }
+    }
+
+    if (argc >= 2 && (argv[1].type == LUBY_T_STRING || argv[1].type == LUBY_T_SYMBOL)) {
+        const char *code = (const char *)argv[1].as.ptr;
+        if (!code) return (int)LUBY_E_TYPE;
+        return luby_eval_with_context(L, target_class, target, code, 0, "<instance_eval>", out);
+    }
+
+    if (L->current_block.type == LUBY_T_PROC) {
+        luby_value saved_class = L->current_class;
+        L->current_class = target_class;
+        int rc = luby_call_proc_with_self(L, (luby_proc *)L->current_block.as.ptr, target, 0, NULL, out);
+        L->current_class = saved_class;
+        return rc;
+    }
+
+    return (int)LUBY_E_TYPE;
+}
+
+static int luby_base_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value modv = argv[0];
+    if (modv.type != LUBY_T_MODULE && modv.type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    luby_class_obj *mod = (luby_class_obj *)modv.as.ptr;
+    luby_class_obj *target = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_CLASS || argv[1].type == LUBY_T_MODULE)) {
+        target = (luby_class_obj *)argv[1].as.ptr;
+    } else if (L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE) {
+        target = (luby_class_obj *)L->current_class.as.ptr;
+    }
+    if (!target) return (int)LUBY_E_TYPE;
+    if (target->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    if (!luby_class_add_include(L, target, mod)) return (int)LUBY_E_RUNTIME;
+    {
+        luby_value recv; recv.type = modv.type; recv.as.ptr = mod;
+        luby_value arg; arg.type = (target == mod) ? modv.type : LUBY_T_CLASS; arg.as.ptr = target;
+        int hook_rc = luby_call_hook_if_exists(L, recv, "included", arg);
+        if (hook_rc == (int)LUBY_E_RUNTIME) return (int)LUBY_E_RUNTIME;
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_prepend(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    luby_value modv = argv[0];
+    if (modv.type != LUBY_T_MODULE && modv.type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    luby_class_obj *mod = (luby_class_obj *)modv.as.ptr;
+    luby_class_obj *target = NULL;
+    if (argc >= 2 && (argv[1].type == LUBY_T_CLASS || argv[1].type == LUBY_T_MODULE)) {
+        target = (luby_class_obj *)argv[1].as.ptr;
+    } else if (L->current_class.type == LUBY_T_CLASS || L->current_class.type == LUBY_T_MODULE) {
+        target = (luby_class_obj *)L->current_class.as.ptr;
+    }
+    if (!target) return (int)LUBY_E_TYPE;
+    if (target->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    if (!luby_class_add_prepend(L, target, mod)) return (int)LUBY_E_RUNTIME;
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_extend(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_value recv = luby_nil();
+    luby_value modv = luby_nil();
+    if (argc == 1) {
+        recv = L->current_self;
+        modv = argv[0];
+    } else if (argc >= 2) {
+        recv = argv[0];
+        modv = argv[1];
+    } else {
+        return (int)LUBY_E_TYPE;
+    }
+    if (modv.type != LUBY_T_MODULE && modv.type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    luby_class_obj *mod = (luby_class_obj *)modv.as.ptr;
+    luby_class_obj *target = luby_get_receiver_class(recv);
+    if (!target) return (int)LUBY_E_TYPE;
+    if (target->frozen) { if (L) luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    if (!luby_class_merge_methods(L, target, mod)) return (int)LUBY_E_RUNTIME;
+    if (out) *out = recv;
+    return (int)LUBY_E_OK;
+}
+
+// Build an attr_reader/attr_writer proc. The chunk is the bytecode of
+// `def name; @name; end` (or the `name=(value)` writer) so send, method
+// objects and snapshots run it like any method; OP_CALL skips it and reads
+// or writes the ivar in place.
+static luby_proc *luby_accessor_new(luby_state *L, const char *name, int kind) {
+    size_t len = strlen(name);
+    char *ivar = (char *)luby_alloc_raw(L, NULL, len + 2);
+    if (!ivar) return NULL;
+    ivar[0] = '@';
+    memcpy(ivar + 1, name, len + 1);
+    luby_value ivar_sym = luby_symbol(L, ivar, len + 1);
+    luby_alloc_raw(L, ivar, 0);
+    luby_value value_sym = luby_symbol(L, "value", 5);
+    if (!ivar_sym.as.ptr || !value_sym.as.ptr) return NULL;
+
+    luby_proc *proc = (luby_proc *)luby_gc_alloc(L, sizeof(luby_proc), LUBY_GC_PROC);
+    if (!proc) return NULL;
+    proc->splat_index = -1;
+    proc->visibility = L->current_visibility;
+    proc->accessor = kind;
+    luby_chunk_init(&proc->chunk);
+    luby_chunk_add_const(L, &proc->chunk, ivar_sym);
+    if (kind == LUBY_ACCESSOR_WRITER) {
+        proc->param_names = (char **)luby_alloc_raw(L, NULL, sizeof(char *));
+        proc->default_chunks = (luby_chunk *)luby_alloc_raw(L, NULL, sizeof(luby_chunk));
+        if (!proc->param_names || !proc->default_chunks) return NULL;
+        luby_chunk_init(&proc->default_chunks[0]);
+        proc->param_names[0] = luby_dup_string(L, "value", 5);
+        proc->param_count = 1;
+        if (!proc->param_names[0]) return NULL;
+        luby_chunk_add_const(L, &proc->chunk, value_sym);
+        luby_chunk_emit(L, &proc->chunk, LUBY_OP_GET_GLOBAL, 0, 0, 1, 0);
+        luby_chunk_emit(L, &proc->chunk, LUBY_OP_SET_IVAR, 0, 0, 0, 0);
+    } else {
+        luby_chunk_emit(L, &proc->chunk, LUBY_OP_GET_IVAR, 0, 0, 0, 0);
+    }
+    luby_chunk_emit(L, &proc->chunk, LUBY_OP_RET, 0, 0, 0, 0);
+    if (proc->chunk.const_count != proc->param_count + 1 || proc->chunk.count != proc->param_count + 2) return NULL;
+    return proc;
+}
+
+// Shared body of attr_reader/attr_writer: one accessor proc per name,
+// installed on the class or module being defined
+static int luby_base_attr_define(luby_state *L, int argc, const luby_value *argv, luby_value *out, int kind) {
+    if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
+        return (int)LUBY_E_RUNTIME;
+    }
+    luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
+    if (cls->frozen) { luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0); return (int)LUBY_E_RUNTIME; }
+    for (int i = 0; i < argc; i++) {
+        if ((argv[i].type != LUBY_T_SYMBOL && argv[i].type != LUBY_T_STRING) || !argv[i].as.ptr) continue;
+        const char *name = (const char *)argv[i].as.ptr;
+        const char *mname = name;
+        if (kind == LUBY_ACCESSOR_WRITER) {
+            size_t len = strlen(name);
+            char *setter = (char *)luby_alloc_raw(L, NULL, len + 2);
+            if (!setter) { luby_set_error(L, LUBY_E_OOM, "oom", NULL, 0, 0); return (int)LUBY_E_OOM; }
+            memcpy(setter, name, len);
+            setter[len] = '=';
+            setter[len + 1] = '\0';
+            mname = luby_intern_symbol(L, setter, len + 1);
+            luby_alloc_raw(L, setter, 0);
+        }
+        luby_proc *proc = mname ? luby_accessor_new(L, name, kind) : NULL;
+        if (!proc) { luby_set_error(L, LUBY_E_OOM, "oom", NULL, 0, 0); return (int)LUBY_E_OOM; }
+        luby_class_set_method(L, cls, mname, proc);
+        if (L->module_function_mode && L->current_class.type == LUBY_T_MODULE) {
+            proc->visibility = LUBY_VIS_PRIVATE;
+            luby_class_set_singleton_method(L, cls, mname, proc);
+        }
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// attr_reader(:name) defines `name`, returning @name
+static int luby_base_attr_reader(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_base_attr_define(L, argc, argv, out, LUBY_ACCESSOR_READER);
+}
+
+// attr_writer(:name) defines `name=(value)`, setting @name
+static int luby_base_attr_writer(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_base_attr_define(L, argc, argv, out, LUBY_ACCESSOR_WRITER);
+}
+
+// attr_accessor: defines both getter and setter
+static int luby_base_attr_accessor(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_base_attr_reader(L, argc, argv, out);
+    return rc != 0 ? rc : luby_base_attr_writer(L, argc, argv, out);
+}
+
+// private: sets visibility of subsequent methods to private
+static int luby_base_private(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc == 0) {
+        // No arguments: change visibility mode for subsequent methods
+        L->current_visibility = LUBY_VIS_PRIVATE;
+    } else {
+        // With arguments: change visibility of specific methods
+        if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
+            return (int)LUBY_E_RUNTIME;
+        }
+        luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
+        for (int i = 0; i < argc; i++) {
+            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
+            const char *name = (const char *)argv[i].as.ptr;
+            luby_proc *proc = luby_class_get_method(L, cls, name);
+            if (proc) {
+                proc->visibility = LUBY_VIS_PRIVATE;
+                L->method_epoch++;  // Invalidate method cache
+            }
+        }
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// public: sets visibility of subsequent methods to public
+static int luby_base_public(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc == 0) {
+        // No arguments: change visibility mode for subsequent methods
+        L->current_visibility = LUBY_VIS_PUBLIC;
+    } else {
+        // With arguments: change visibility of specific methods
+        if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
+            return (int)LUBY_E_RUNTIME;
+        }
+        luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
+        for (int i = 0; i < argc; i++) {
+            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
+            const char *name = (const char *)argv[i].as.ptr;
+            luby_proc *proc = luby_class_get_method(L, cls, name);
+            if (proc) {
+                proc->visibility = LUBY_VIS_PUBLIC;
+                L->method_epoch++;  // Invalidate method cache
+            }
+        }
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// protected: sets visibility of subsequent methods to protected
+static int luby_base_protected(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc == 0) {
+        // No arguments: change visibility mode for subsequent methods
+        L->current_visibility = LUBY_VIS_PROTECTED;
+    } else {
+        // With arguments: change visibility of specific methods
+        if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
+            return (int)LUBY_E_RUNTIME;
+        }
+        luby_class_obj *cls = (luby_class_obj *)L->current_class.as.ptr;
+        for (int i = 0; i < argc; i++) {
+            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
+            const char *name = (const char *)argv[i].as.ptr;
+            luby_proc *proc = luby_class_get_method(L, cls, name);
+            if (proc) {
+                proc->visibility = LUBY_VIS_PROTECTED;
+                L->method_epoch++;  // Invalidate method cache
+            }
+        }
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// module_function: makes methods both private instance methods and public singleton methods
+// When called without args, subsequent method definitions become module functions
+// When called with method names, those specific methods become module functions
+static int luby_base_module_function(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (L->current_class.type != LUBY_T_MODULE) {
+        luby_set_error(L, LUBY_E_RUNTIME, "module_function is only for modules", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    luby_class_obj *mod = (luby_class_obj *)L->current_class.as.ptr;
+    
+    if (argc == 0) {
+        // No arguments: enable module_function mode for subsequent methods
+        L->module_function_mode = 1;
+    } else {
+        // With arguments: make specific methods module functions
+        for (int i = 0; i < argc; i++) {
+            if (argv[i].type != LUBY_T_SYMBOL || !argv[i].as.ptr) continue;
+            const char *name = (const char *)argv[i].as.ptr;
+            luby_proc *proc = luby_class_get_method(L, mod, name);
+            if (proc) {
+                // Make instance method private
+                proc->visibility = LUBY_VIS_PRIVATE;
+                // Add as singleton method (public)
+                luby_class_set_singleton_method(L, mod, name, proc);
+            }
+        }
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// alias: creates an alias for a method
+// Usage: alias new_name old_name
+static int luby_base_alias(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const char *new_name = NULL;
+    const char *old_name = NULL;
+    luby_class_obj *cls;
+    luby_proc *old_proc;
+    char msg[256];
+    
+    if (argc < 2) {
+        luby_set_error(L, LUBY_E_TYPE, "alias requires 2 arguments", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    if (L->current_class.type != LUBY_T_CLASS && L->current_class.type != LUBY_T_MODULE) {
+        luby_set_error(L, LUBY_E_RUNTIME, "alias must be called in class/module context", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    
+    // Convert arguments to symbols/strings
+    if (argv[0].type == LUBY_T_SYMBOL || argv[0].type == LUBY_T_STRING) {
+        new_name = (const char *)argv[0].as.ptr;
+    }
+    
+    if (argv[1].type == LUBY_T_SYMBOL || argv[1].type == LUBY_T_STRING) {
+        old_name = (const char *)argv[1].as.ptr;
+    }
+    
+    if (!new_name || !old_name) {
+        luby_set_error(L, LUBY_E_TYPE, "alias arguments must be symbols or strings", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    
+    cls = (luby_class_obj *)L->current_class.as.ptr;
+    old_proc = luby_class_get_method(L, cls, old_name);
+    
+    if (!old_proc) {
+        snprintf(msg, sizeof(msg), "undefined method '%s' for class", old_name);
+        luby_set_error(L, LUBY_E_NAME, msg, NULL, 0, 0);
+        return (int)LUBY_E_NAME;
+    }
+    
+    // Copy the method to the new name
+    luby_class_set_method(L, cls, new_name, old_proc);
+    
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// ---------------------- Additional stdlib functions -------------------------
+
+static int luby_base_to_s(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    char *str = luby_value_to_string(L, argv[0]);
+    if (out) *out = luby_string(L, str, 0);
+    if (str) luby_alloc_raw(L, str, 0);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_is_nil(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) { if (out) *out = luby_bool(1); return (int)LUBY_E_OK; }
+    if (out) *out = luby_bool(argv[0].type == LUBY_T_NIL);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_str_upcase(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t len = strlen(src);
+    char *dst = luby_gc_alloc_string(L, src, len);
+    if (!dst) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = (char)((src[i] >= 'a' && src[i] <= 'z') ? src[i] - 32 : src[i]);
+    }
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_str_downcase(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t len = strlen(src);
+    char *dst = luby_gc_alloc_string(L, src, len);
+    if (!dst) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = (char)((src[i] >= 'A' && src[i] <= 'Z') ? src[i] + 32 : src[i]);
+    }
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_str_split(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    const char *delim = (argv[1].type == LUBY_T_STRING && argv[1].as.ptr) ? (const char *)argv[1].as.ptr : " ";
+    size_t delim_len = strlen(delim);
+
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, arr)) return (int)LUBY_E_OOM;
+    arr->count = 0; arr->capacity = 4; arr->frozen = 0;
+    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
+    
+    const char *p = src;
+    while (*p) {
+        const char *found = delim_len > 0 ? strstr(p, delim) : NULL;
+        size_t part_len = found ? (size_t)(found - p) : strlen(p);
+        char *part = luby_gc_alloc_string(L, p, part_len);
+        
+        if (arr->count >= arr->capacity) {
+            arr->capacity *= 2;
+            arr->items = (luby_value *)luby_alloc_raw(L, arr->items, arr->capacity * sizeof(luby_value));
+        }
+        arr->items[arr->count].type = LUBY_T_STRING;
+        arr->items[arr->count].as.ptr = part;
+        arr->count++;
+        
+        if (!found) break;
+        p = found + delim_len;
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_str_join(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    const char *sep = (argc >= 2 && argv[1].type == LUBY_T_STRING && argv[1].as.ptr) ? (const char *)argv[1].as.ptr : "";
+    size_t sep_len = strlen(sep);
+    
+    size_t total = 0;
+    for (size_t i = 0; i < arr->count; i++) {
+        if (arr->items[i].type == LUBY_T_STRING && arr->items[i].as.ptr)
+            total += strlen((const char *)arr->items[i].as.ptr);
+        if (i > 0) total += sep_len;
+    }
+
+    char *result = luby_gc_alloc_string(L, NULL, total);
+    if (!result) return (int)LUBY_E_OOM;
+    char *p = result;
+    for (size_t i = 0; i < arr->count; i++) {
+        if (i > 0) { memcpy(p, sep, sep_len); p += sep_len; }
+        if (arr->items[i].type == LUBY_T_STRING && arr->items[i].as.ptr) {
+            size_t len = strlen((const char *)arr->items[i].as.ptr);
+            memcpy(p, arr->items[i].as.ptr, len);
+            p += len;
+        }
+    }
+    *p = '\0';
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_array_reverse(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    /* String reverse */
+    if (argv[0].type == LUBY_T_STRING || argv[0].type == LUBY_T_SYMBOL) {
+        const char *src = (const char *)argv[0].as.ptr;
+        size_t slen = strlen(src);
+        char *dst = luby_gc_alloc_string(L, NULL, slen);
+        if (!dst) return (int)LUBY_E_OOM;
+        for (size_t i = 0; i < slen; i++) {
+            dst[i] = src[slen - 1 - i];
+        }
+        if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+        return (int)LUBY_E_OK;
+    }
+    /* Array reverse */
+    if (argv[0].type != LUBY_T_ARRAY) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    dst->count = src->count; dst->capacity = src->count; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    for (size_t i = 0; i < src->count; i++) {
+        dst->items[i] = src->items[src->count - 1 - i];
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_array_first(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_first(L, argc, argv, out);
+    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    if (out) *out = (arr->count > 0) ? arr->items[0] : luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_array_last(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_last(L, argc, argv, out);
+    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    if (out) *out = (arr->count > 0) ? arr->items[arr->count - 1] : luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_array_flatten(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    dst->count = 0; dst->capacity = src->count * 2; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    
+    for (size_t i = 0; i < src->count; i++) {
+        if (src->items[i].type == LUBY_T_ARRAY && src->items[i].as.ptr) {
+            luby_array *inner = (luby_array *)src->items[i].as.ptr;
+            for (size_t j = 0; j < inner->count; j++) {
+                if (dst->count >= dst->capacity) {
+                    dst->capacity *= 2;
+                    dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
+                }
+                dst->items[dst->count++] = inner->items[j];
+            }
+        } else {
+            if (dst->count >= dst->capacity) {
+                dst->capacity *= 2;
+                dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
+            }
+            dst->items[dst->count++] = src->items[i];
+        }
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// ------------------------------ Value hashing ------------------------------
+// Shared by the set-like Array operations (uniq, tally, group_by, &, |, -).
+// Strings, symbols, numbers and frozen arrays hash by content. Objects and
+// userdata hash by identity unless their class defines `hash`, and compare
+// with `eql?` when it is defined. Everything else hashes by identity.
+
+#define LUBY_VALUE_HASH_DEPTH 32
+#define LUBY_VALUE_SET_NONE ((size_t)-1)
+
+typedef struct luby_value_set_slot {
+    luby_value key;
+    uint64_t hash;
+    size_t index;               // caller's position + 1; 0 marks an empty slot
+} luby_value_set_slot;
+
+// Open-addressing index from values to positions in some caller-owned
+// sequence. Keys are not rooted: they must stay reachable elsewhere.
+typedef struct luby_value_set {
+    luby_value_set_slot *slots;
+    size_t capacity;            // power of two, or 0
+    size_t count;
+} luby_value_set;
+
+static uint64_t luby_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Does an object or userdata respond to `name`?
+static int luby_value_defines(luby_state *L, luby_value v, const char *name) {
+    if ((v.type != LUBY_T_OBJECT && v.type != LUBY_T_USERDATA) || !v.as.ptr) return 0;
+    if (v.type == LUBY_T_OBJECT && luby_object_get_singleton_method((luby_object *)v.as.ptr, name)) return 1;
+    luby_value m = luby_class_lookup_method(L, luby_get_receiver_class(v), name);
+    return (m.type == LUBY_T_PROC || m.type == LUBY_T_CMETHOD) && m.as.ptr;
+}
+
+// With `contents` set, unfrozen arrays hash by content too (for Object#hash)
+static int luby_value_hash_depth(luby_state *L, luby_value v, int depth, int contents, uint64_t *out) {
+    uint64_t h;
+    switch (v.type) {
+        case LUBY_T_NIL: h = 0; break;
+        case LUBY_T_BOOL: h = v.as.b ? 1 : 0; break;
+        case LUBY_T_INT: h = (uint64_t)v.as.i; break;
+        case LUBY_T_FLOAT: {
+            double d = v.as.f == 0.0 ? 0.0 : v.as.f;    // -0.0 == 0.0
+            memcpy(&h, &d, sizeof(h));
+            break;
+        }
+        case LUBY_T_STRING:
+        case LUBY_T_SYMBOL: {
+            h = 14695981039346656037ULL;    // FNV-1a
+            for (const unsigned char *p = (const unsigned char *)v.as.ptr; p && *p; p++) {
+                h ^= *p;
+                h *= 1099511628211ULL;
+            }
+            break;
+        }
+        case LUBY_T_ARRAY: {
+            luby_array *arr = (luby_array *)v.as.ptr;
+            if (!arr || (!arr->frozen && !contents)) { h = (uint64_t)(uintptr_t)v.as.ptr; break; }
+            // Past the depth limit only the length counts; equality still decides
+            h = arr->count;
+            for (size_t i = 0; depth < LUBY_VALUE_HASH_DEPTH && i < arr->count; i++) {
+                uint64_t ih;
+                int rc = luby_value_hash_depth(L, arr->items[i], depth + 1, contents, &ih);
+                if (rc != 0) return rc;
+                h = h * 31 + ih;
+            }
+            break;
+        }
+        case LUBY_T_OBJECT:
+        case LUBY_T_USERDATA:
+            if (luby_value_defines(L, v, "hash")) {
+                luby_value r = luby_nil();
+                int rc = luby_invoke_method(L, v, "hash", 0, NULL, &r);
+                if (rc != 0) return rc;
+                if (r.type != LUBY_T_INT) {
+                    luby_set_error(L, LUBY_E_TYPE, "hash must return an Integer", NULL, 0, 0);
+                    return (int)LUBY_E_TYPE;
+                }
+                h = (uint64_t)r.as.i;
+                break;
+            }
+            h = (uint64_t)(uintptr_t)v.as.ptr;
+            break;
+        case LUBY_T_VECTOR: {
+            const luby_vector *vec = (const luby_vector *)v.as.ptr;
+            h = vec ? (uint64_t)vec->kind : 0;
+            for (int i = 0; vec && i < luby_vector_lengths[vec->kind]; i++) {
+                float c = vec->c[i] == 0.0f ? 0.0f : vec->c[i];
+                uint32_t bits;
+                memcpy(&bits, &c, sizeof(bits));
+                h = h * 31 + bits;
+            }
+            break;
+        }
+        default:
+            h = (uint64_t)(uintptr_t)v.as.ptr;
+            break;
+    }
+    *out = luby_hash_mix(h ^ ((uint64_t)v.type << 56));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_value_hash(luby_state *L, luby_value v, uint64_t *out) {
+    return luby_value_hash_depth(L, v, 0, 0, out);
+}
+
+// Key equality matching luby_value_hash: luby_value_eq, plus content
+// comparison of frozen arrays and a user-defined eql?
+static int luby_value_key_eq_depth(luby_state *L, luby_value a, luby_value b, int depth, int *eq) {
+    *eq = 0;
+    if (a.type == b.type && luby_has_class_dispatch(a) && a.as.ptr == b.as.ptr) { *eq = 1; return (int)LUBY_E_OK; }
+    if (luby_value_defines(L, a, "eql?")) {
+        luby_value r = luby_nil();
+        int rc = luby_invoke_method(L, a, "eql?", 1, &b, &r);
+        if (rc == 0) *eq = luby_is_truthy(r);
+        return rc;
+    }
+    if (a.type != b.type) return (int)LUBY_E_OK;
+    if (a.type == LUBY_T_ARRAY && a.as.ptr != b.as.ptr) {
+        luby_array *x = (luby_array *)a.as.ptr, *y = (luby_array *)b.as.ptr;
+        if (!x || !y || !x->frozen || !y->frozen || x->count != y->count || depth >= LUBY_VALUE_HASH_DEPTH) return (int)LUBY_E_OK;
+        for (size_t i = 0; i < x->count; i++) {
+            int rc = luby_value_key_eq_depth(L, x->items[i], y->items[i], depth + 1, eq);
+            if (rc != 0 || !*eq) return rc;
+        }
+        *eq = 1;
+        return (int)LUBY_E_OK;
+    }
+    *eq = luby_value_eq(a, b);
+    return (int)LUBY_E_OK;
+}
+
+static void luby_value_set_free(luby_state *L, luby_value_set *s) {
+    if (s->slots) luby_alloc_raw(L, s->slots, 0);
+    s->slots = NULL;
+    s->capacity = 0;
+    s->count = 0;
+}
+
+// Find the slot holding `key`, or the empty slot where it belongs
+static int luby_value_set_probe(luby_state *L, const luby_value_set *s, luby_value key, uint64_t hash, size_t *slot, int *found) {
+    size_t mask = s->capacity - 1;
+    *found = 0;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        const luby_value_set_slot *e = &s->slots[i];
+        if (!e->index) { *slot = i; return (int)LUBY_E_OK; }
+        if (e->hash != hash) continue;
+        int rc = luby_value_key_eq_depth(L, e->key, key, 0, found);
+        if (rc != 0) return rc;
+        if (*found) { *slot = i; return (int)LUBY_E_OK; }
+    }
+}
+
+static int luby_value_set_grow(luby_state *L, luby_value_set *s) {
+    size_t cap = s->capacity ? s->capacity * 2 : 16;
+    luby_value_set_slot *slots = (luby_value_set_slot *)luby_alloc_raw(L, NULL, cap * sizeof(luby_value_set_slot));
+    if (!slots) return (int)LUBY_E_OOM;
+    memset(slots, 0, cap * sizeof(luby_value_set_slot));
+    for (size_t i = 0; i < s->capacity; i++) {
+        if (!s->slots[i].index) continue;
+        size_t j = (size_t)s->slots[i].hash & (cap - 1);
+        while (slots[j].index) j = (j + 1) & (cap - 1);
+        slots[j] = s->slots[i];
+    }
+    if (s->slots) luby_alloc_raw(L, s->slots, 0);
+    s->slots = slots;
+    s->capacity = cap;
+    return (int)LUBY_E_OK;
+}
+
+// *index receives the position `key` was added with, or LUBY_VALUE_SET_NONE
+static int luby_value_set_find(luby_state *L, const luby_value_set *s, luby_value key, size_t *index) {
+    *index = LUBY_VALUE_SET_NONE;
+    if (s->count == 0) return (int)LUBY_E_OK;
+    uint64_t hash;
+    size_t slot;
+    int found;
+    int rc = luby_value_hash(L, key, &hash);
+    if (rc == 0) rc = luby_value_set_probe(L, s, key, hash, &slot, &found);
+    if (rc == 0 && found) *index = s->slots[slot].index - 1;
+    return rc;
+}
+
+// Add `key` at position `index` unless an equal key is present. *existing
+// receives that key's position, or LUBY_VALUE_SET_NONE when `key` was added.
+static int luby_value_set_add(luby_state *L, luby_value_set *s, luby_value key, size_t index, size_t *existing) {
+    *existing = LUBY_VALUE_SET_NONE;
+    uint64_t hash;
+    int rc = luby_value_hash(L, key, &hash);
+    if (rc != 0) return rc;
+    if ((s->count + 1) * 2 > s->capacity && (rc = luby_value_set_grow(L, s)) != 0) return rc;
+    size_t slot;
+    int found;
+    rc = luby_value_set_probe(L, s, key, hash, &slot, &found);
+    if (rc != 0) return rc;
+    if (found) { *existing = s->slots[slot].index - 1; return (int)LUBY_E_OK; }
+    s->slots[slot].key = key;
+    s->slots[slot].hash = hash;
+    s->slots[slot].index = index + 1;
+    s->count++;
+    return (int)LUBY_E_OK;
+}
+
+// Remove `key`; *index receives the position it was added with, or
+// LUBY_VALUE_SET_NONE. Later slots of the probe run shift back into the gap.
+static int luby_value_set_remove(luby_state *L, luby_value_set *s, luby_value key, size_t *index) {
+    *index = LUBY_VALUE_SET_NONE;
+    if (s->count == 0) return (int)LUBY_E_OK;
+    uint64_t hash;
+    size_t i;
+    int found;
+    int rc = luby_value_hash(L, key, &hash);
+    if (rc == 0) rc = luby_value_set_probe(L, s, key, hash, &i, &found);
+    if (rc != 0 || !found) return rc;
+    *index = s->slots[i].index - 1;
+    size_t mask = s->capacity - 1;
+    for (size_t j = (i + 1) & mask; s->slots[j].index; j = (j + 1) & mask) {
+        size_t home = (size_t)s->slots[j].hash & mask;
+        // Move j into the gap unless its home lies cyclically in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            s->slots[i] = s->slots[j];
+            i = j;
+        }
+    }
+    s->slots[i].index = 0;
+    s->count--;
+    return (int)LUBY_E_OK;
+}
+
+// Record that `key`, present at position `from`, now lives at `to`
+static int luby_value_set_move(luby_state *L, luby_value_set *s, luby_value key, size_t from, size_t to) {
+    uint64_t hash;
+    int rc = luby_value_hash(L, key, &hash);
+    if (rc != 0) return rc;
+    size_t mask = s->capacity - 1;
+    for (size_t i = (size_t)hash & mask; s->slots[i].index; i = (i + 1) & mask) {
+        if (s->slots[i].index == from + 1) { s->slots[i].index = to + 1; break; }
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_array_append(luby_state *L, luby_array *arr, luby_value v) {
+    if (!luby_array_reserve(L, arr, arr->count + 1)) return (int)LUBY_E_OOM;
+    arr->items[arr->count++] = v;
+    return (int)LUBY_E_OK;
+}
+
+// Append an entry known not to be in `h` yet
+static int luby_hash_append(luby_state *L, luby_hash *h, luby_value key, luby_value value) {
+    if (h->count + 1 > h->capacity) {
+        size_t new_cap = h->capacity < 8 ? 8 : h->capacity * 2;
+        luby_hash_entry *ne = (luby_hash_entry *)luby_alloc_raw(L, h->entries, new_cap * sizeof(luby_hash_entry));
+        if (!ne) return (int)LUBY_E_OOM;
+        h->entries = ne;
+        h->capacity = new_cap;
+    }
+    h->entries[h->count].key = key;
+    h->entries[h->count].value = value;
+    h->count++;
+    return (int)LUBY_E_OK;
+}
+
+// A fresh array, rooted until the calling native returns
+static luby_array *luby_array_new_temp(luby_state *L, luby_value *out) {
+    luby_value v = luby_array_new(L);
+    if (v.type != LUBY_T_ARRAY || !luby_gc_push_temp(L, v)) return NULL;
+    *out = v;
+    return (luby_array *)v.as.ptr;
+}
+
+static int luby_array_uniq(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_value dv;
+    luby_array *dst = luby_array_new_temp(L, &dv);
+    if (!dst) return (int)LUBY_E_OOM;
+    luby_value_set seen = { NULL, 0, 0 };
+    int rc = 0;
+    for (size_t i = 0; i < src->count && rc == 0; i++) {
+        luby_value item = src->items[i];
+        size_t existing;
+        rc = luby_value_set_add(L, &seen, item, dst->count, &existing);
+        if (rc == 0 && existing == LUBY_VALUE_SET_NONE) rc = luby_array_append(L, dst, item);
+    }
+    luby_value_set_free(L, &seen);
+    if (rc == 0 && out) *out = dv;
+    return rc;
+}
+
+// Index the elements of the arrays in argv[from..argc) into `s`
+static int luby_array_index_args(luby_state *L, luby_value_set *s, int argc, const luby_value *argv, int from) {
+    size_t n = 0;
+    for (int a = from; a < argc; a++) {
+        if (argv[a].type != LUBY_T_ARRAY || !argv[a].as.ptr) {
+            luby_set_error(L, LUBY_E_TYPE, "expected an Array", NULL, 0, 0);
+            return (int)LUBY_E_TYPE;
+        }
+        luby_array *arr = (luby_array *)argv[a].as.ptr;
+        for (size_t i = 0; i < arr->count; i++) {
+            size_t existing;
+            int rc = luby_value_set_add(L, s, arr->items[i], n++, &existing);
+            if (rc != 0) return rc;
+        }
+    }
+    return (int)LUBY_E_OK;
+}
+
+// a - b, a.difference(*others): elements of a found in none of the others
+static int luby_array_difference(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_value dv;
+    luby_array *dst = luby_array_new_temp(L, &dv);
+    if (!dst) return (int)LUBY_E_OOM;
+    luby_value_set drop = { NULL, 0, 0 };
+    int rc = luby_array_index_args(L, &drop, argc, argv, 1);
+    for (size_t i = 0; i < src->count && rc == 0; i++) {
+        luby_value item = src->items[i];
+        size_t at;
+        rc = luby_value_set_find(L, &drop, item, &at);
+        if (rc == 0 && at == LUBY_VALUE_SET_NONE) rc = luby_array_append(L, dst, item);
+    }
+    luby_value_set_free(L, &drop);
+    if (rc == 0 && out) *out = dv;
+    return rc;
+}
+
+// a & b, a.intersection(*others): unique elements of a found in every other
+static int luby_array_intersection(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_value acc = argv[0];
+    for (int a = 1; a < argc; a++) {
+        luby_array *src = (luby_array *)acc.as.ptr;
+        luby_value dv;
+        luby_array *dst = luby_array_new_temp(L, &dv);
+        if (!dst) return (int)LUBY_E_OOM;
+        luby_value_set keep = { NULL, 0, 0 }, seen = { NULL, 0, 0 };
+        int rc = luby_array_index_args(L, &keep, a + 1, argv, a);
+        for (size_t i = 0; i < src->count && rc == 0; i++) {
+            luby_value item = src->items[i];
+            size_t at, existing;
+            rc = luby_value_set_find(L, &keep, item, &at);
+            if (rc != 0 || at == LUBY_VALUE_SET_NONE) continue;
+            rc = luby_value_set_add(L, &seen, item, dst->count, &existing);
+            if (rc == 0 && existing == LUBY_VALUE_SET_NONE) rc = luby_array_append(L, dst, item);
+        }
+        luby_value_set_free(L, &keep);
+        luby_value_set_free(L, &seen);
+        if (rc != 0) return rc;
+        acc = dv;
+    }
+    if (argc == 1) return luby_array_uniq(L, 1, argv, out);
+    if (out) *out = acc;
+    return (int)LUBY_E_OK;
+}
+
+// a | b, a.union(*others): unique elements of a and then of each other
+static int luby_array_union(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_value dv;
+    luby_array *dst = luby_array_new_temp(L, &dv);
+    if (!dst) return (int)LUBY_E_OOM;
+    luby_value_set seen = { NULL, 0, 0 };
+    int rc = 0;
+    for (int a = 0; a < argc && rc == 0; a++) {
+        if (argv[a].type != LUBY_T_ARRAY || !argv[a].as.ptr) {
+            luby_set_error(L, LUBY_E_TYPE, "expected an Array", NULL, 0, 0);
+            rc = (int)LUBY_E_TYPE;
+            break;
+        }
+        luby_array *src = (luby_array *)argv[a].as.ptr;
+        for (size_t i = 0; i < src->count && rc == 0; i++) {
+            luby_value item = src->items[i];
+            size_t existing;
+            rc = luby_value_set_add(L, &seen, item, dst->count, &existing);
+            if (rc == 0 && existing == LUBY_VALUE_SET_NONE) rc = luby_array_append(L, dst, item);
+        }
+    }
+    luby_value_set_free(L, &seen);
+    if (rc == 0 && out) *out = dv;
+    return rc;
+}
+
+static int luby_array_sort(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    dst->count = src->count; dst->capacity = src->count; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    memcpy(dst->items, src->items, src->count * sizeof(luby_value));
+    
+    // Simple bubble sort for now
+    for (size_t i = 0; i < dst->count; i++) {
+        for (size_t j = i + 1; j < dst->count; j++) {
+            int swap = 0;
+            if (dst->items[i].type == LUBY_T_INT && dst->items[j].type == LUBY_T_INT) {
+                swap = dst->items[i].as.i > dst->items[j].as.i;
+            } else if (dst->items[i].type == LUBY_T_FLOAT && dst->items[j].type == LUBY_T_FLOAT) {
+                swap = dst->items[i].as.f > dst->items[j].as.f;
+            } else if (dst->items[i].type == LUBY_T_STRING && dst->items[j].type == LUBY_T_STRING) {
+                swap = strcmp((const char *)dst->items[i].as.ptr, (const char *)dst->items[j].as.ptr) > 0;
+            }
+            if (swap) {
+                luby_value tmp = dst->items[i];
+                dst->items[i] = dst->items[j];
+                dst->items[j] = tmp;
+            }
+        }
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// sort_by: [arr].sort_by { |x| key_expr }
+static int luby_array_sort_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+
+    // Build parallel arrays: copy of items + computed keys
+    size_t n = src->count;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = n; dst->capacity = n; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, n * sizeof(luby_value));
+    memcpy(dst->items, src->items, n * sizeof(luby_value));
+
+    luby_value *keys = (luby_value *)luby_alloc_raw(L, NULL, n * sizeof(luby_value));
+    for (size_t i = 0; i < n; i++) {
+        int _rc = luby_call_block(L, block, 1, &src->items[i], &keys[i]);
+        if (_rc == (int)LUBY_E_BREAK) {
+            luby_alloc_raw(L, keys, 0);
+            if (out) *out = L->block_break_value;
+            L->block_break = 0;
+            return (int)LUBY_E_OK;
+        }
+        if (_rc != 0 || !luby_gc_push_temp(L, keys[i])) {
+            luby_alloc_raw(L, keys, 0);
+            return _rc != 0 ? (int)LUBY_E_RUNTIME : (int)LUBY_E_OOM;
+        }
+    }
+    // Bubble sort by keys
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            int swap = 0;
+            if (keys[i].type == LUBY_T_INT && keys[j].type == LUBY_T_INT) swap = keys[i].as.i > keys[j].as.i;
+            else if (keys[i].type == LUBY_T_FLOAT && keys[j].type == LUBY_T_FLOAT) swap = keys[i].as.f > keys[j].as.f;
+            else if (keys[i].type == LUBY_T_STRING && keys[j].type == LUBY_T_STRING) swap = strcmp((const char *)keys[i].as.ptr, (const char *)keys[j].as.ptr) > 0;
+            if (swap) {
+                luby_value tk = keys[i]; keys[i] = keys[j]; keys[j] = tk;
+                luby_value tv = dst->items[i]; dst->items[i] = dst->items[j]; dst->items[j] = tv;
+            }
+        }
+    }
+    luby_alloc_raw(L, keys, 0);
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// min_by: [arr].min_by { |x| key_expr }
+static int luby_array_min_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    if (src->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+
+    luby_value best = src->items[0];
+    luby_value best_key;
+    LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[0], &best_key, out, luby_nil());
+
+    for (size_t i = 1; i < src->count; i++) {
+        luby_value key;
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &key, out, luby_nil());
+        int less = 0;
+        if (key.type == LUBY_T_INT && best_key.type == LUBY_T_INT) less = key.as.i < best_key.as.i;
+        else if (key.type == LUBY_T_FLOAT && best_key.type == LUBY_T_FLOAT) less = key.as.f < best_key.as.f;
+        else if (key.type == LUBY_T_STRING && best_key.type == LUBY_T_STRING) less = strcmp((const char *)key.as.ptr, (const char *)best_key.as.ptr) < 0;
+        if (less) { best = src->items[i]; best_key = key; }
+    }
+    if (out) *out = best;
+    return (int)LUBY_E_OK;
+}
+
+// max_by: [arr].max_by { |x| key_expr }
+static int luby_array_max_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    if (src->count == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+
+    luby_value best = src->items[0];
+    luby_value best_key;
+    LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[0], &best_key, out, luby_nil());
+
+    for (size_t i = 1; i < src->count; i++) {
+        luby_value key;
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &key, out, luby_nil());
+        int greater = 0;
+        if (key.type == LUBY_T_INT && best_key.type == LUBY_T_INT) greater = key.as.i > best_key.as.i;
+        else if (key.type == LUBY_T_FLOAT && best_key.type == LUBY_T_FLOAT) greater = key.as.f > best_key.as.f;
+        else if (key.type == LUBY_T_STRING && best_key.type == LUBY_T_STRING) greater = strcmp((const char *)key.as.ptr, (const char *)best_key.as.ptr) > 0;
+        if (greater) { best = src->items[i]; best_key = key; }
+    }
+    if (out) *out = best;
+    return (int)LUBY_E_OK;
+}
+
+// group_by: [arr].group_by { |x| key_expr } => { key => [items] }
+static int luby_array_group_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+
+    luby_value hv = luby_hash_new(L);
+    if (hv.type != LUBY_T_HASH || !luby_gc_push_temp(L, hv)) return (int)LUBY_E_OOM;
+    luby_hash *h = (luby_hash *)hv.as.ptr;
+    luby_value_set groups = { NULL, 0, 0 };
+
+    int rc = 0;
+    for (size_t i = 0; i < src->count && rc == 0; i++) {
+        luby_value key;
+        int _rc = luby_call_block(L, block, 1, &src->items[i], &key);
+        if (_rc == (int)LUBY_E_BREAK) {
+            luby_value_set_free(L, &groups);
+            if (out) *out = L->block_break_value;
+            L->block_break = 0;
+            return (int)LUBY_E_OK;
+        }
+        if (_rc != 0) { rc = (int)LUBY_E_RUNTIME; break; }
+
+        // The key is only held here until it lands in the hash
+        if (!luby_gc_push_temp(L, key)) { rc = (int)LUBY_E_OOM; break; }
+        size_t at;
+        rc = luby_value_set_add(L, &groups, key, h->count, &at);
+        if (rc != 0) break;
+        luby_array *group;
+        if (at == LUBY_VALUE_SET_NONE) {
+            luby_value gv = luby_array_new(L);
+            if (gv.type != LUBY_T_ARRAY) { rc = (int)LUBY_E_OOM; break; }
+            rc = luby_hash_append(L, h, key, gv);
+            group = (luby_array *)gv.as.ptr;
+        } else {
+            group = (luby_array *)h->entries[at].value.as.ptr;
+        }
+        if (rc == 0) rc = luby_array_append(L, group, src->items[i]);
+    }
+    luby_value_set_free(L, &groups);
+    if (rc == 0 && out) *out = hv;
+    return rc;
+}
+
+// flat_map: [arr].flat_map { |x| array_expr } => flattened array
+static int luby_array_flat_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0; dst->capacity = src->count * 2; dst->frozen = 0;
+    if (dst->capacity < 4) dst->capacity = 4;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res;
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        if (res.type == LUBY_T_ARRAY && res.as.ptr) {
+            luby_array *sub = (luby_array *)res.as.ptr;
+            for (size_t j = 0; j < sub->count; j++) {
+                if (dst->count >= dst->capacity) {
+                    dst->capacity *= 2;
+                    dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
+                }
+                dst->items[dst->count++] = sub->items[j];
+            }
+        } else {
+            if (dst->count >= dst->capacity) {
+                dst->capacity *= 2;
+                dst->items = (luby_value *)luby_alloc_raw(L, dst->items, dst->capacity * sizeof(luby_value));
+            }
+            dst->items[dst->count++] = res;
+        }
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// sum: [arr].sum or [arr].sum { |x| expr }
+static int luby_array_sum(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_sum(L, argc, argv, out);
+    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+
+    int use_float = 0;
+    int64_t isum = 0;
+    double fsum = 0.0;
+
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value v = src->items[i];
+        if (block) {
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &v, out, luby_nil());
+        }
+        if (v.type == LUBY_T_FLOAT) {
+            if (!use_float) { fsum = (double)isum; use_float = 1; }
+            fsum += v.as.f;
+        } else if (v.type == LUBY_T_INT) {
+            if (use_float) fsum += (double)v.as.i;
+            else isum += v.as.i;
+        }
+    }
+    if (out) {
+        if (use_float) { out->type = LUBY_T_FLOAT; out->as.f = fsum; }
+        else { out->type = LUBY_T_INT; out->as.i = isum; }
+    }
+    return (int)LUBY_E_OK;
+}
+
+// count: [arr].count or [arr].count { |x| predicate }
+static int luby_array_count(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_RANGE) return luby_range_size(L, argc, argv, out);
+    if (argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+
+    if (!block) {
+        // No block: return array length
+        if (out) { out->type = LUBY_T_INT; out->as.i = (int64_t)src->count; }
+        return (int)LUBY_E_OK;
+    }
+    int64_t cnt = 0;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value res;
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+        if (luby_is_truthy(res)) cnt++;
+    }
+    if (out) { out->type = LUBY_T_INT; out->as.i = cnt; }
+    return (int)LUBY_E_OK;
+}
+
+// zip: [a].zip([b], [c], ...) => [[a0,b0,c0], [a1,b1,c1], ...]
+static int luby_array_zip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *first = (luby_array *)argv[0].as.ptr;
+    size_t n = first->count;
+    int num_arrays = argc; // first + others
+
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    dst->count = n; dst->capacity = n; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, n * sizeof(luby_value));
+
+    for (size_t i = 0; i < n; i++) {
+        luby_array *row = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!row) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        row->count = (size_t)num_arrays; row->capacity = (size_t)num_arrays; row->frozen = 0;
+        row->items = (luby_value *)luby_alloc_raw(L, NULL, (size_t)num_arrays * sizeof(luby_value));
+        row->items[0] = first->items[i];
+        for (int j = 1; j < num_arrays; j++) {
+            if (argv[j].type == LUBY_T_ARRAY && argv[j].as.ptr) {
+                luby_array *other = (luby_array *)argv[j].as.ptr;
+                row->items[j] = (i < other->count) ? other->items[i] : luby_nil();
+            } else {
+                row->items[j] = luby_nil();
+            }
+        }
+        dst->items[i].type = LUBY_T_ARRAY;
+        dst->items[i].as.ptr = row;
+    }
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// gsub(str, pattern, replacement) - replace all occurrences
+static int luby_str_gsub(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr ||
+        argv[2].type != LUBY_T_STRING || !argv[2].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    const char *pat = (const char *)argv[1].as.ptr;
+    const char *rep = (const char *)argv[2].as.ptr;
+    size_t pat_len = strlen(pat);
+    size_t rep_len = strlen(rep);
+    if (pat_len == 0) {
+        // Empty pattern: return original
+        if (out) *out = argv[0];
+        return (int)LUBY_E_OK;
+    }
+
+    // Count replacements to size the buffer
+    size_t src_len = strlen(src);
+    size_t count = 0;
+    const char *p = src;
+    while ((p = strstr(p, pat)) != NULL) { count++; p += pat_len; }
+
+    size_t new_len = src_len + count * (rep_len - pat_len);
+    char *buf = (char *)luby_alloc_raw(L, NULL, new_len + 1);
+    char *dst = buf;
+    p = src;
+    while (*p) {
+        const char *found = strstr(p, pat);
+        if (!found) {
+            size_t tail = strlen(p);
+            memcpy(dst, p, tail);
+            dst += tail;
+            break;
+        }
+        size_t seg = (size_t)(found - p);
+        memcpy(dst, p, seg); dst += seg;
+        memcpy(dst, rep, rep_len); dst += rep_len;
+        p = found + pat_len;
+    }
+    *dst = '\0';
+
+    char *result = luby_gc_alloc_string(L, buf, new_len);
+    luby_alloc_raw(L, buf, 0);
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+    return (int)LUBY_E_OK;
+}
+
+// sub(str, pattern, replacement) - replace first occurrence
+static int luby_str_sub(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr ||
+        argv[2].type != LUBY_T_STRING || !argv[2].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    const char *pat = (const char *)argv[1].as.ptr;
+    const char *rep = (const char *)argv[2].as.ptr;
+    size_t pat_len = strlen(pat);
+    size_t rep_len = strlen(rep);
+    if (pat_len == 0) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+
+    const char *found = strstr(src, pat);
+    if (!found) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+
+    size_t src_len = strlen(src);
+    size_t new_len = src_len - pat_len + rep_len;
+    char *buf = (char *)luby_alloc_raw(L, NULL, new_len + 1);
+    size_t prefix = (size_t)(found - src);
+    memcpy(buf, src, prefix);
+    memcpy(buf + prefix, rep, rep_len);
+    memcpy(buf + prefix + rep_len, found + pat_len, src_len - prefix - pat_len);
+    buf[new_len] = '\0';
+
+    char *result = luby_gc_alloc_string(L, buf, new_len);
+    luby_alloc_raw(L, buf, 0);
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
+    return (int)LUBY_E_OK;
+}
+
+// start_with?(str, prefix)
+static int luby_str_start_with(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
+    const char *str = (const char *)argv[0].as.ptr;
+    const char *prefix = (const char *)argv[1].as.ptr;
+    size_t plen = strlen(prefix);
+    if (out) *out = luby_bool(strncmp(str, prefix, plen) == 0);
+    return (int)LUBY_E_OK;
+}
+
+// end_with?(str, suffix)
+static int luby_str_end_with(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
+    const char *str = (const char *)argv[0].as.ptr;
+    const char *suffix = (const char *)argv[1].as.ptr;
+    size_t slen = strlen(str);
+    size_t xlen = strlen(suffix);
+    if (out) *out = luby_bool(xlen <= slen && strcmp(str + slen - xlen, suffix) == 0);
+    return (int)LUBY_E_OK;
+}
+
+// chars: "hello".chars => ["h", "e", "l", "l", "o"]
+static int luby_str_chars(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t slen = strlen(src);
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    arr->count = 0; arr->capacity = slen > 0 ? slen : 1; arr->frozen = 0;
+    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
+    if (!arr->items) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    for (size_t i = 0; i < slen; i++) {
+        char *ch = luby_gc_alloc_string(L, src + i, 1);
+        if (!ch) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+        arr->items[arr->count].type = LUBY_T_STRING;
+        arr->items[arr->count].as.ptr = ch;
+        arr->count++;
+    }
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    return (int)LUBY_E_OK;
+}
+
+// chomp: "hello\n".chomp => "hello"
+static int luby_str_chomp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t slen = strlen(src);
+    size_t new_len = slen;
+    if (new_len > 0 && src[new_len - 1] == '\n') {
+        new_len--;
+        if (new_len > 0 && src[new_len - 1] == '\r') new_len--;
+    } else if (new_len > 0 && src[new_len - 1] == '\r') {
+        new_len--;
+    }
+    if (new_len == slen) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = luby_gc_alloc_string(L, src, new_len);
+    L->gc_paused = was_paused;
+    if (!dst) return (int)LUBY_E_OOM;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// lstrip: "  hello  ".lstrip => "hello  "
+static int luby_str_lstrip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    while (*src == ' ' || *src == '\t' || *src == '\n' || *src == '\r') src++;
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = luby_gc_alloc_string(L, src, strlen(src));
+    L->gc_paused = was_paused;
+    if (!dst) return (int)LUBY_E_OOM;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// rstrip: "  hello  ".rstrip => "  hello"
+static int luby_str_rstrip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t slen = strlen(src);
+    while (slen > 0 && (src[slen - 1] == ' ' || src[slen - 1] == '\t' || src[slen - 1] == '\n' || src[slen - 1] == '\r')) slen--;
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = luby_gc_alloc_string(L, src, slen);
+    L->gc_paused = was_paused;
+    if (!dst) return (int)LUBY_E_OOM;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// tr: "hello".tr("el", "ip") => "hippo"
+static int luby_str_tr(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr ||
+        argv[2].type != LUBY_T_STRING || !argv[2].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    const char *from = (const char *)argv[1].as.ptr;
+    const char *to = (const char *)argv[2].as.ptr;
+    size_t slen = strlen(src);
+    size_t from_len = strlen(from);
+    size_t to_len = strlen(to);
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = luby_gc_alloc_string(L, src, slen);
+    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    for (size_t i = 0; i < slen; i++) {
+        for (size_t j = 0; j < from_len; j++) {
+            if (dst[i] == from[j]) {
+                dst[i] = (j < to_len) ? to[j] : to[to_len - 1];
+                break;
+            }
+        }
+    }
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// center: "hi".center(10) => "    hi    ", "hi".center(10, "-") => "----hi----"
+static int luby_str_center(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    int64_t width = argv[1].as.i;
+    char pad = ' ';
+    if (argc >= 3 && argv[2].type == LUBY_T_STRING && argv[2].as.ptr)
+        pad = ((const char *)argv[2].as.ptr)[0];
+    size_t slen = strlen(src);
+    if ((int64_t)slen >= width) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    size_t total_pad = (size_t)width - slen;
+    size_t left_pad = total_pad / 2;
+    size_t right_pad = total_pad - left_pad;
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = (char *)luby_gc_alloc_string(L, NULL, (size_t)width);
+    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    memset(dst, pad, left_pad);
+    memcpy(dst + left_pad, src, slen);
+    memset(dst + left_pad + slen, pad, right_pad);
+    dst[width] = '\0';
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// ljust: "hi".ljust(10) => "hi        ", "hi".ljust(10, "-") => "hi--------"
+static int luby_str_ljust(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    int64_t width = argv[1].as.i;
+    char pad = ' ';
+    if (argc >= 3 && argv[2].type == LUBY_T_STRING && argv[2].as.ptr)
+        pad = ((const char *)argv[2].as.ptr)[0];
+    size_t slen = strlen(src);
+    if ((int64_t)slen >= width) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = (char *)luby_gc_alloc_string(L, NULL, (size_t)width);
+    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    memcpy(dst, src, slen);
+    memset(dst + slen, pad, (size_t)width - slen);
+    dst[width] = '\0';
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// rjust: "hi".rjust(10) => "        hi", "hi".rjust(10, "-") => "--------hi"
+static int luby_str_rjust(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    int64_t width = argv[1].as.i;
+    char pad = ' ';
+    if (argc >= 3 && argv[2].type == LUBY_T_STRING && argv[2].as.ptr)
+        pad = ((const char *)argv[2].as.ptr)[0];
+    size_t slen = strlen(src);
+    if ((int64_t)slen >= width) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    int was_paused = L->gc_paused;
+    L->gc_paused = 1;
+    char *dst = (char *)luby_gc_alloc_string(L, NULL, (size_t)width);
+    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
+    size_t pad_len = (size_t)width - slen;
+    memset(dst, pad, pad_len);
+    memcpy(dst + pad_len, src, slen);
+    dst[width] = '\0';
+    L->gc_paused = was_paused;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+    return (int)LUBY_E_OK;
+}
+
+// include? for strings: "hello".include?("ell") => true
+static int luby_str_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_STRING || !argv[1].as.ptr) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_bool(strstr((const char *)argv[0].as.ptr, (const char *)argv[1].as.ptr) != NULL);
+    return (int)LUBY_E_OK;
+}
+
+// map_with_index: [arr].map_with_index { |item, i| expr }
+static int luby_array_map_with_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0; dst->capacity = src->count; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value args[2]; args[0] = src->items[i]; args[1] = luby_int((int64_t)i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+        dst->items[dst->count++] = res;
+    }
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
+    return (int)LUBY_E_OK;
+}
+
+// each_with_object: [arr].each_with_object(obj) { |item, memo| ... }
+static int luby_array_each_with_object(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_value memo = argv[1];
+    for (size_t i = 0; i < src->count; i++) {
+        luby_value args[2]; args[0] = src->items[i]; args[1] = memo;
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 2, args, &res, out, luby_nil());
+    }
+    if (out) *out = memo;
+    return (int)LUBY_E_OK;
+}
+
+// each_slice: [arr].each_slice(n) => [[slice1], [slice2], ...]
+static int luby_array_each_slice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    int64_t n = argv[1].as.i;
+    if (n <= 0) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
     size_t num_slices = (src->count + (size_t)n - 1) / (size_t)n;
     luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
     if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0; dst->capacity = num_slices; dst->frozen = 0;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0; dst->capacity = num_slices; dst->frozen = 0;
+    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
+    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < src->count; i += (size_t)n) {
+        size_t slice_len = (size_t)n;
+        if (i + slice_len > src->count) slice_len = src->count - i;
+        luby_array *slice = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!slice) return (int)LUBY_E_OOM;
+        slice->count = slice_len; slice->capacity = slice_len; slice->frozen = 0;
+        slice->items = (luby_value *)luby_alloc_raw(L, NULL, slice_len * sizeof(luby_value));
+        if (!slice->items && slice_len > 0) return (int)LUBY_E_OOM;
+        for (size_t j = 0; j < slice_len; j++) slice->items[j] = src->items[i + j];
+        luby_value sv; sv.type = LUBY_T_ARRAY; sv.as.ptr = slice;
+        if (block) {
+            luby_value res = luby_nil();
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &sv, &res, out, luby_nil());
+        }
+        dst->items[dst->count++] = sv;
+    }
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
+    return (int)LUBY_E_OK;
+}
+
+// each_cons: [arr].each_cons(n) => [[cons1], [cons2], ...]
+static int luby_array_each_cons(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr ||
+        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    int64_t n = argv[1].as.i;
+    if (n <= 0 || (size_t)n > src->count) {
+        luby_array *empty = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!empty) return (int)LUBY_E_OOM;
+        empty->count = 0; empty->capacity = 0; empty->frozen = 0; empty->items = NULL;
+        luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = empty;
+        if (out) *out = v;
+        return (int)LUBY_E_OK;
+    }
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    size_t num_cons = src->count - (size_t)n + 1;
+    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (!luby_gc_push_temp_ptr(L, LUBY_T_ARRAY, dst)) return (int)LUBY_E_OOM;
+    dst->count = 0; dst->capacity = num_cons; dst->frozen = 0;
     dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
     if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
-    for (size_t i = 0; i < src->count; i += (size_t)n) {
-        size_t slice_len = (size_t)n;
-        if (i + slice_len > src->count) slice_len = src->count - i;
-        luby_array *slice = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!slice) return (int)LUBY_E_OOM;
-        slice->count = slice_len; slice->capacity = slice_len; slice->frozen = 0;
-        slice->items = (luby_value *)luby_alloc_raw(L, NULL, slice_len * sizeof(luby_value));
-        if (!slice->items && slice_len > 0) return (int)LUBY_E_OOM;
-        for (size_t j = 0; j < slice_len; j++) slice->items[j] = src->items[i + j];
-        luby_value sv; sv.type = LUBY_T_ARRAY; sv.as.ptr = slice;
+    for (size_t i = 0; i < num_cons; i++) {
+        luby_array *cons = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+        if (!cons) return (int)LUBY_E_OOM;
+        cons->count = (size_t)n; cons->capacity = (size_t)n; cons->frozen = 0;
+        cons->items = (luby_value *)luby_alloc_raw(L, NULL, (size_t)n * sizeof(luby_value));
+        if (!cons->items) return (int)LUBY_E_OOM;
+        for (size_t j = 0; j < (size_t)n; j++) cons->items[j] = src->items[i + j];
+        luby_value cv; cv.type = LUBY_T_ARRAY; cv.as.ptr = cons;
         if (block) {
             luby_value res = luby_nil();
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &sv, &res, out, luby_nil());
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &cv, &res, out, luby_nil());
+        }
+        dst->items[dst->count++] = cv;
+    }
+    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
+    if (out) *out = v;
+    return (int)LUBY_E_OK;
+}
+
+// find_index: [arr].find_index { |x| predicate } => index or nil
+static int luby_array_find_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (block) {
+        for (size_t i = 0; i < src->count; i++) {
+            luby_value res = luby_nil();
+            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
+            if (luby_is_truthy(res)) { if (out) *out = luby_int((int64_t)i); return (int)LUBY_E_OK; }
+        }
+    } else if (argc >= 2) {
+        for (size_t i = 0; i < src->count; i++) {
+            if (luby_value_eq(src->items[i], argv[1])) { if (out) *out = luby_int((int64_t)i); return (int)LUBY_E_OK; }
+        }
+    } else {
+        return (int)LUBY_E_TYPE;
+    }
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+// tally: [arr].tally => { element => count }
+static int luby_array_tally(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    luby_value hv = luby_hash_new(L);
+    if (hv.type != LUBY_T_HASH || !luby_gc_push_temp(L, hv)) return (int)LUBY_E_OOM;
+    luby_hash *h = (luby_hash *)hv.as.ptr;
+    luby_value_set seen = { NULL, 0, 0 };
+    int rc = 0;
+    for (size_t i = 0; i < src->count && rc == 0; i++) {
+        luby_value item = src->items[i];
+        size_t at;
+        rc = luby_value_set_add(L, &seen, item, h->count, &at);
+        if (rc != 0) break;
+        if (at == LUBY_VALUE_SET_NONE) rc = luby_hash_append(L, h, item, luby_int(1));
+        else h->entries[at].value.as.i++;
+    }
+    luby_value_set_free(L, &seen);
+    if (rc == 0 && out) *out = hv;
+    return rc;
+}
+
+static int luby_hash_keys(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return (int)LUBY_E_OOM;
+    arr->count = h->count; arr->capacity = h->count; arr->frozen = 0;
+    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
+    for (size_t i = 0; i < h->count; i++) {
+        arr->items[i] = h->entries[i].key;
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_hash_values(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_hash *h = (luby_hash *)argv[0].as.ptr;
+    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!arr) return (int)LUBY_E_OOM;
+    arr->count = h->count; arr->capacity = h->count; arr->frozen = 0;
+    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
+    for (size_t i = 0; i < h->count; i++) {
+        arr->items[i] = h->entries[i].value;
+    }
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_times(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    
+    int64_t n = argv[0].as.i;
+    for (int64_t i = 0; i < n; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_upto(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_INT || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    
+    int64_t from = argv[0].as.i;
+    int64_t to = argv[1].as.i;
+    for (int64_t i = from; i <= to; i++) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_downto(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_INT || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
+    
+    int64_t from = argv[0].as.i;
+    int64_t to = argv[1].as.i;
+    for (int64_t i = from; i >= to; i--) {
+        luby_value iv = luby_int(i);
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// ---------------------- More stdlib functions -------------------------
+
+static int luby_base_abs(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_INT) {
+        int64_t v = argv[0].as.i;
+        if (out) *out = luby_int(v < 0 ? -v : v);
+    } else if (argv[0].type == LUBY_T_FLOAT) {
+        double v = argv[0].as.f;
+        if (out) *out = luby_float(v < 0 ? -v : v);
+    } else return (int)LUBY_E_TYPE;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_floor(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_FLOAT) {
+        if (out) *out = luby_int((int64_t)argv[0].as.f);
+    } else if (argv[0].type == LUBY_T_INT) {
+        if (out) *out = argv[0];
+    } else return (int)LUBY_E_TYPE;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_ceil(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_FLOAT) {
+        double v = argv[0].as.f;
+        int64_t iv = (int64_t)v;
+        if (v > (double)iv) iv++;
+        if (out) *out = luby_int(iv);
+    } else if (argv[0].type == LUBY_T_INT) {
+        if (out) *out = argv[0];
+    } else return (int)LUBY_E_TYPE;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_round(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_FLOAT) {
+        double v = argv[0].as.f;
+        if (out) *out = luby_int((int64_t)(v + (v >= 0 ? 0.5 : -0.5)));
+    } else if (argv[0].type == LUBY_T_INT) {
+        if (out) *out = argv[0];
+    } else return (int)LUBY_E_TYPE;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_even(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_bool((argv[0].as.i % 2) == 0);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_odd(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_bool((argv[0].as.i % 2) != 0);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_numeric_zero(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_INT) {
+        if (out) *out = luby_bool(argv[0].as.i == 0);
+        return (int)LUBY_E_OK;
+    }
+    if (argv[0].type == LUBY_T_FLOAT) {
+        if (out) *out = luby_bool(argv[0].as.f == 0.0);
+        return (int)LUBY_E_OK;
+    }
+    return (int)LUBY_E_TYPE;
+}
+
+static int luby_numeric_positive(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_INT) {
+        if (out) *out = luby_bool(argv[0].as.i > 0);
+        return (int)LUBY_E_OK;
+    }
+    if (argv[0].type == LUBY_T_FLOAT) {
+        if (out) *out = luby_bool(argv[0].as.f > 0.0);
+        return (int)LUBY_E_OK;
+    }
+    return (int)LUBY_E_TYPE;
+}
+
+static int luby_numeric_negative(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_INT) {
+        if (out) *out = luby_bool(argv[0].as.i < 0);
+        return (int)LUBY_E_OK;
+    }
+    if (argv[0].type == LUBY_T_FLOAT) {
+        if (out) *out = luby_bool(argv[0].as.f < 0.0);
+        return (int)LUBY_E_OK;
+    }
+    return (int)LUBY_E_TYPE;
+}
+
+// ---------------------- Game math helpers -------------------------
+
+static double luby_to_double(luby_value v) {
+    if (v.type == LUBY_T_INT) return (double)v.as.i;
+    if (v.type == LUBY_T_FLOAT) return v.as.f;
+    return 0.0;
+}
+
+static int luby_math_lerp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    double a = luby_to_double(argv[0]);
+    double b = luby_to_double(argv[1]);
+    double t = luby_to_double(argv[2]);
+    if (out) *out = luby_float(a + (b - a) * t);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_inverse_lerp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    double a = luby_to_double(argv[0]);
+    double b = luby_to_double(argv[1]);
+    double v = luby_to_double(argv[2]);
+    if (b == a) {
+        if (out) *out = luby_float(0.0);
+    } else {
+        if (out) *out = luby_float((v - a) / (b - a));
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_smoothstep(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    double edge0 = luby_to_double(argv[0]);
+    double edge1 = luby_to_double(argv[1]);
+    double x = luby_to_double(argv[2]);
+    double t = (x - edge0) / (edge1 - edge0);
+    if (t < 0.0) t = 0.0;
+    if (t > 1.0) t = 1.0;
+    if (out) *out = luby_float(t * t * (3.0 - 2.0 * t));
+    return (int)LUBY_E_OK;
+}
+
+// Easing curves, by name: "linear" or a family with an _in, _out or
+// _in_out suffix. Each family is defined by its _in curve; _out mirrors it
+// and _in_out runs _in to the midpoint and _out after it.
+static const char *const luby_ease_families[] = {
+    "linear", "quad", "cubic", "quart", "quint", "sine", "expo", "circ", "back", "elastic", "bounce"
+};
+
+#define LUBY_EASE_FAMILIES (sizeof(luby_ease_families) / sizeof(luby_ease_families[0]))
+
+// The curve id for `name` (family * 3 + variant), or -1
+static int luby_ease_lookup(const char *name) {
+    for (size_t f = 0; f < LUBY_EASE_FAMILIES; f++) {
+        size_t n = strlen(luby_ease_families[f]);
+        if (strncmp(name, luby_ease_families[f], n) != 0) continue;
+        if (f == 0) return name[n] == '\0' ? 0 : -1;
+        if (strcmp(name + n, "_in") == 0) return (int)f * 3;
+        if (strcmp(name + n, "_out") == 0) return (int)f * 3 + 1;
+        if (strcmp(name + n, "_in_out") == 0) return (int)f * 3 + 2;
+    }
+    return -1;
+}
+
+static double luby_ease_bounce_out(double t) {
+    const double n1 = 7.5625, d1 = 2.75;
+    if (t < 1.0 / d1) return n1 * t * t;
+    if (t < 2.0 / d1) { t -= 1.5 / d1; return n1 * t * t + 0.75; }
+    if (t < 2.5 / d1) { t -= 2.25 / d1; return n1 * t * t + 0.9375; }
+    t -= 2.625 / d1;
+    return n1 * t * t + 0.984375;
+}
+
+static double luby_ease_in(int family, double t) {
+    switch (family) {
+        case 1: return t * t;
+        case 2: return t * t * t;
+        case 3: return t * t * t * t;
+        case 4: return t * t * t * t * t;
+        case 5: return 1.0 - cos(t * 1.5707963267948966);
+        case 6: return t <= 0.0 ? 0.0 : pow(2.0, 10.0 * t - 10.0);
+        case 7: return 1.0 - sqrt(1.0 - t * t);
+        case 8: return 2.70158 * t * t * t - 1.70158 * t * t;
+        case 9:
+            if (t <= 0.0 || t >= 1.0) return t;
+            return -pow(2.0, 10.0 * t - 10.0) * sin((10.0 * t - 10.75) * 2.0943951023931953);
+        case 10: return 1.0 - luby_ease_bounce_out(1.0 - t);
+        default: return t;
+    }
+}
+
+// Curve `id` at t, with t clamped to [0, 1]
+static double luby_ease_apply(int id, double t) {
+    if (!(t > 0.0)) t = 0.0;
+    if (t > 1.0) t = 1.0;
+    int family = id / 3;
+    switch (id % 3) {
+        case 0: return luby_ease_in(family, t);
+        case 1: return 1.0 - luby_ease_in(family, 1.0 - t);
+        default:
+            return t < 0.5 ? luby_ease_in(family, 2.0 * t) * 0.5
+                           : 1.0 - luby_ease_in(family, 2.0 - 2.0 * t) * 0.5;
+    }
+}
+
+// The curve a Symbol or String names, else a TypeError with `message`
+static int luby_ease_arg(luby_state *L, luby_value v, const char *message, int *id) {
+    const char *name = (v.type == LUBY_T_SYMBOL || v.type == LUBY_T_STRING) ? (const char *)v.as.ptr : NULL;
+    *id = name ? luby_ease_lookup(name) : -1;
+    if (*id >= 0) return (int)LUBY_E_OK;
+    luby_set_error(L, LUBY_E_TYPE, message, NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
+
+// ease(curve, t): the named curve at t (clamped to 0..1)
+static int luby_math_ease(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int id;
+    if (argc < 2 || (argv[1].type != LUBY_T_INT && argv[1].type != LUBY_T_FLOAT)) {
+        luby_set_error(L, LUBY_E_TYPE, "ease: expected a curve and a number", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    int rc = luby_ease_arg(L, argv[0], "ease: unknown easing curve", &id);
+    if (rc != 0) return rc;
+    if (out) *out = luby_float(luby_ease_apply(id, luby_to_double(argv[1])));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_clamp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    double lo = luby_to_double(argv[1]);
+    double hi = luby_to_double(argv[2]);
+    if (v < lo) v = lo;
+    if (v > hi) v = hi;
+    // Return int if all inputs were int
+    if (argv[0].type == LUBY_T_INT && argv[1].type == LUBY_T_INT && argv[2].type == LUBY_T_INT) {
+        if (out) *out = luby_int((int64_t)v);
+    } else {
+        if (out) *out = luby_float(v);
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_wrap(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    double lo = luby_to_double(argv[1]);
+    double hi = luby_to_double(argv[2]);
+    double range = hi - lo;
+    if (range <= 0) {
+        if (out) *out = luby_float(lo);
+        return (int)LUBY_E_OK;
+    }
+    double result = v - range * floor((v - lo) / range);
+    if (argv[0].type == LUBY_T_INT && argv[1].type == LUBY_T_INT && argv[2].type == LUBY_T_INT) {
+        if (out) *out = luby_int((int64_t)result);
+    } else {
+        if (out) *out = luby_float(result);
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_sign(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    int64_t s = (v > 0) ? 1 : ((v < 0) ? -1 : 0);
+    if (out) *out = luby_int(s);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_min(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc == 1 && argv[0].type == LUBY_T_RANGE) return luby_range_min(L, argc, argv, out);
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double result = luby_to_double(argv[0]);
+    int all_int = (argv[0].type == LUBY_T_INT);
+    for (int i = 1; i < argc; i++) {
+        double v = luby_to_double(argv[i]);
+        if (v < result) result = v;
+        if (argv[i].type != LUBY_T_INT) all_int = 0;
+    }
+    if (all_int) {
+        if (out) *out = luby_int((int64_t)result);
+    } else {
+        if (out) *out = luby_float(result);
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_max(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc == 1 && argv[0].type == LUBY_T_RANGE) return luby_range_max(L, argc, argv, out);
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double result = luby_to_double(argv[0]);
+    int all_int = (argv[0].type == LUBY_T_INT);
+    for (int i = 1; i < argc; i++) {
+        double v = luby_to_double(argv[i]);
+        if (v > result) result = v;
+        if (argv[i].type != LUBY_T_INT) all_int = 0;
+    }
+    if (all_int) {
+        if (out) *out = luby_int((int64_t)result);
+    } else {
+        if (out) *out = luby_float(result);
+    }
+    return (int)LUBY_E_OK;
+}
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Unboxed entry points for the typed registrations in luby_open_base
+static double luby_num_deg_to_rad(double deg) { return deg * M_PI / 180.0; }
+static double luby_num_rad_to_deg(double rad) { return rad * 180.0 / M_PI; }
+
+static int luby_math_deg_to_rad(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double deg = luby_to_double(argv[0]);
+    if (out) *out = luby_float(deg * M_PI / 180.0);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_rad_to_deg(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double rad = luby_to_double(argv[0]);
+    if (out) *out = luby_float(rad * 180.0 / M_PI);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_sin(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(sin(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_cos(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(cos(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_tan(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(tan(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_asin(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(asin(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_acos(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(acos(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_atan(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(atan(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_atan2(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    double y = luby_to_double(argv[0]);
+    double x = luby_to_double(argv[1]);
+    if (out) *out = luby_float(atan2(y, x));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_sqrt(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(sqrt(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_pow(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    double base = luby_to_double(argv[0]);
+    double exp = luby_to_double(argv[1]);
+    if (out) *out = luby_float(pow(base, exp));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_log(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(log(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_exp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1) return (int)LUBY_E_TYPE;
+    double v = luby_to_double(argv[0]);
+    if (out) *out = luby_float(exp(v));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_distance(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 4) return (int)LUBY_E_TYPE;
+    double x1 = luby_to_double(argv[0]);
+    double y1 = luby_to_double(argv[1]);
+    double x2 = luby_to_double(argv[2]);
+    double y2 = luby_to_double(argv[3]);
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    if (out) *out = luby_float(sqrt(dx * dx + dy * dy));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_distance_squared(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 4) return (int)LUBY_E_TYPE;
+    double x1 = luby_to_double(argv[0]);
+    double y1 = luby_to_double(argv[1]);
+    double x2 = luby_to_double(argv[2]);
+    double y2 = luby_to_double(argv[3]);
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    if (out) *out = luby_float(dx * dx + dy * dy);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_normalize(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    double x = luby_to_double(argv[0]);
+    double y = luby_to_double(argv[1]);
+    double len = sqrt(x * x + y * y);
+    // A Vector2, which indexes and destructures like the old [x, y] pair
+    float c[2] = { 0.0f, 0.0f };
+    if (len > 0) {
+        c[0] = (float)(x / len);
+        c[1] = (float)(y / len);
+    }
+    luby_vector *v = luby_vector_alloc(L, LUBY_VECTOR2);
+    if (!v) return (int)LUBY_E_OOM;
+    memcpy(v->c, c, sizeof(c));
+    if (out) { out->type = LUBY_T_VECTOR; out->as.ptr = v; }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_dot(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 4) return (int)LUBY_E_TYPE;
+    double x1 = luby_to_double(argv[0]);
+    double y1 = luby_to_double(argv[1]);
+    double x2 = luby_to_double(argv[2]);
+    double y2 = luby_to_double(argv[3]);
+    if (out) *out = luby_float(x1 * x2 + y1 * y2);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_cross(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 4) return (int)LUBY_E_TYPE;
+    double x1 = luby_to_double(argv[0]);
+    double y1 = luby_to_double(argv[1]);
+    double x2 = luby_to_double(argv[2]);
+    double y2 = luby_to_double(argv[3]);
+    if (out) *out = luby_float(x1 * y2 - y1 * x2);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_angle(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    double x = luby_to_double(argv[0]);
+    double y = luby_to_double(argv[1]);
+    if (out) *out = luby_float(atan2(y, x));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_math_fmod(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    double a = luby_to_double(argv[0]);
+    double b = luby_to_double(argv[1]);
+    if (b == 0) {
+        if (out) *out = luby_float(0.0);
+    } else {
+        if (out) *out = luby_float(fmod(a, b));
+    }
+    return (int)LUBY_E_OK;
+}
+
+// ------------------------------ Vector math ------------------------------
+// Vector2, Vector3, Quaternion and Matrix4 are LUBY_T_VECTOR values: the
+// float components sit inline after the GC header and never change, so
+// operators build a new value instead of mutating. The VM sends + - * / on
+// them straight to luby_vector_arith, and the collector keeps swept blocks
+// on a per-kind free list (luby_vector_alloc), so a loop of vector math
+// recycles the same few blocks instead of calling the allocator.
+// Matrices are column-major: element (row, col) is c[col * 4 + row].
+
+static int luby_vector_make(luby_state *L, luby_vector_kind kind, const float *c, luby_value *out) {
+    luby_vector *v = luby_vector_alloc(L, kind);
+    if (!v) {
+        if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_OOM, "oom", NULL, 0, 0);
+        return (int)LUBY_E_OOM;
+    }
+    if (c) memcpy(v->c, c, (size_t)luby_vector_lengths[kind] * sizeof(float));
+    if (out) { out->type = LUBY_T_VECTOR; out->as.ptr = v; }
+    return (int)LUBY_E_OK;
+}
+
+// The vector in `v` if it is of `kind`, else NULL
+static const luby_vector *luby_vector_of(luby_value v, luby_vector_kind kind) {
+    if (v.type != LUBY_T_VECTOR || !v.as.ptr) return NULL;
+    const luby_vector *vec = (const luby_vector *)v.as.ptr;
+    return vec->kind == kind ? vec : NULL;
+}
+
+static int luby_vector_number(luby_value v, float *out) {
+    if (v.type != LUBY_T_INT && v.type != LUBY_T_FLOAT) return 0;
+    *out = (float)luby_to_double(v);
+    return 1;
+}
+
+static int luby_vector_type_error(luby_state *L, const char *message) {
+    luby_set_error(L, LUBY_E_TYPE, message, NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
+
+static void luby_mat4_identity(float *m) {
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+// r = a * b; r may alias either operand
+static void luby_mat4_mul(const float *a, const float *b, float *r) {
+    luby_f4 a0 = luby_f4_load(a), a1 = luby_f4_load(a + 4);
+    luby_f4 a2 = luby_f4_load(a + 8), a3 = luby_f4_load(a + 12);
+    float tmp[16];
+    for (int j = 0; j < 4; j++) {
+        const float *bc = b + j * 4;
+        luby_f4 col = luby_f4_add(luby_f4_add(luby_f4_mul(a0, luby_f4_splat(bc[0])), luby_f4_mul(a1, luby_f4_splat(bc[1]))),
+                                  luby_f4_add(luby_f4_mul(a2, luby_f4_splat(bc[2])), luby_f4_mul(a3, luby_f4_splat(bc[3]))));
+        luby_f4_store(tmp + j * 4, col);
+    }
+    memcpy(r, tmp, sizeof(tmp));
+}
+
+// Points take the translation column (w = 1); directions do not (w = 0)
+static void luby_mat4_apply(const float *m, const float *v, float w, float *r) {
+    float x = v[0], y = v[1], z = v[2];
+    for (int i = 0; i < 3; i++) r[i] = m[i] * x + m[4 + i] * y + m[8 + i] * z + m[12 + i] * w;
+}
+
+LUBY_API void luby_mat4_transform_points(const float *m, const float *points, float *out, size_t count) {
+    luby_f4 c0 = luby_f4_load(m), c1 = luby_f4_load(m + 4);
+    luby_f4 c2 = luby_f4_load(m + 8), c3 = luby_f4_load(m + 12);
+    float tmp[4];
+    for (size_t i = 0; i < count; i++) {
+        const float *p = points + i * 3;
+        luby_f4 r = luby_f4_add(luby_f4_add(luby_f4_mul(c0, luby_f4_splat(p[0])), luby_f4_mul(c1, luby_f4_splat(p[1]))),
+                                luby_f4_add(luby_f4_mul(c2, luby_f4_splat(p[2])), c3));
+        luby_f4_store(tmp, r);
+        memcpy(out + i * 3, tmp, 3 * sizeof(float));
+    }
+}
+
+// Cofactor inverse; returns the determinant and leaves `r` untouched when
+// it is zero. r may alias m.
+static double luby_mat4_invert(const float *m, float *r) {
+    double inv[16];
+    inv[0] = (double)m[5] * m[10] * m[15] - (double)m[5] * m[11] * m[14] - (double)m[9] * m[6] * m[15]
+           + (double)m[9] * m[7] * m[14] + (double)m[13] * m[6] * m[11] - (double)m[13] * m[7] * m[10];
+    inv[4] = -(double)m[4] * m[10] * m[15] + (double)m[4] * m[11] * m[14] + (double)m[8] * m[6] * m[15]
+           - (double)m[8] * m[7] * m[14] - (double)m[12] * m[6] * m[11] + (double)m[12] * m[7] * m[10];
+    inv[8] = (double)m[4] * m[9] * m[15] - (double)m[4] * m[11] * m[13] - (double)m[8] * m[5] * m[15]
+           + (double)m[8] * m[7] * m[13] + (double)m[12] * m[5] * m[11] - (double)m[12] * m[7] * m[9];
+    inv[12] = -(double)m[4] * m[9] * m[14] + (double)m[4] * m[10] * m[13] + (double)m[8] * m[5] * m[14]
+            - (double)m[8] * m[6] * m[13] - (double)m[12] * m[5] * m[10] + (double)m[12] * m[6] * m[9];
+    inv[1] = -(double)m[1] * m[10] * m[15] + (double)m[1] * m[11] * m[14] + (double)m[9] * m[2] * m[15]
+           - (double)m[9] * m[3] * m[14] - (double)m[13] * m[2] * m[11] + (double)m[13] * m[3] * m[10];
+    inv[5] = (double)m[0] * m[10] * m[15] - (double)m[0] * m[11] * m[14] - (double)m[8] * m[2] * m[15]
+           + (double)m[8] * m[3] * m[14] + (double)m[12] * m[2] * m[11] - (double)m[12] * m[3] * m[10];
+    inv[9] = -(double)m[0] * m[9] * m[15] + (double)m[0] * m[11] * m[13] + (double)m[8] * m[1] * m[15]
+           - (double)m[8] * m[3] * m[13] - (double)m[12] * m[1] * m[11] + (double)m[12] * m[3] * m[9];
+    inv[13] = (double)m[0] * m[9] * m[14] - (double)m[0] * m[10] * m[13] - (double)m[8] * m[1] * m[14]
+            + (double)m[8] * m[2] * m[13] + (double)m[12] * m[1] * m[10] - (double)m[12] * m[2] * m[9];
+    inv[2] = (double)m[1] * m[6] * m[15] - (double)m[1] * m[7] * m[14] - (double)m[5] * m[2] * m[15]
+           + (double)m[5] * m[3] * m[14] + (double)m[13] * m[2] * m[7] - (double)m[13] * m[3] * m[6];
+    inv[6] = -(double)m[0] * m[6] * m[15] + (double)m[0] * m[7] * m[14] + (double)m[4] * m[2] * m[15]
+           - (double)m[4] * m[3] * m[14] - (double)m[12] * m[2] * m[7] + (double)m[12] * m[3] * m[6];
+    inv[10] = (double)m[0] * m[5] * m[15] - (double)m[0] * m[7] * m[13] - (double)m[4] * m[1] * m[15]
+            + (double)m[4] * m[3] * m[13] + (double)m[12] * m[1] * m[7] - (double)m[12] * m[3] * m[5];
+    inv[14] = -(double)m[0] * m[5] * m[14] + (double)m[0] * m[6] * m[13] + (double)m[4] * m[1] * m[14]
+            - (double)m[4] * m[2] * m[13] - (double)m[12] * m[1] * m[6] + (double)m[12] * m[2] * m[5];
+    inv[3] = -(double)m[1] * m[6] * m[11] + (double)m[1] * m[7] * m[10] + (double)m[5] * m[2] * m[11]
+           - (double)m[5] * m[3] * m[10] - (double)m[9] * m[2] * m[7] + (double)m[9] * m[3] * m[6];
+    inv[7] = (double)m[0] * m[6] * m[11] - (double)m[0] * m[7] * m[10] - (double)m[4] * m[2] * m[11]
+           + (double)m[4] * m[3] * m[10] + (double)m[8] * m[2] * m[7] - (double)m[8] * m[3] * m[6];
+    inv[11] = -(double)m[0] * m[5] * m[11] + (double)m[0] * m[7] * m[9] + (double)m[4] * m[1] * m[11]
+            - (double)m[4] * m[3] * m[9] - (double)m[8] * m[1] * m[7] + (double)m[8] * m[3] * m[5];
+    inv[15] = (double)m[0] * m[5] * m[10] - (double)m[0] * m[6] * m[9] - (double)m[4] * m[1] * m[10]
+            + (double)m[4] * m[2] * m[9] + (double)m[8] * m[1] * m[6] - (double)m[8] * m[2] * m[5];
+    double det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if (det != 0.0 && r) {
+        for (int i = 0; i < 16; i++) r[i] = (float)(inv[i] / det);
+    }
+    return det;
+}
+
+// Hamilton product a * b (apply b, then a)
+static void luby_quat_mul(const float *a, const float *b, float *r) {
+    float x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+    float y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+    float z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+    float w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+    r[0] = x; r[1] = y; r[2] = z; r[3] = w;
+}
+
+// v' = v + 2w(q x v) + 2 q x (q x v), for a unit quaternion
+static void luby_quat_rotate(const float *q, const float *v, float *r) {
+    float tx = 2.0f * (q[1] * v[2] - q[2] * v[1]);
+    float ty = 2.0f * (q[2] * v[0] - q[0] * v[2]);
+    float tz = 2.0f * (q[0] * v[1] - q[1] * v[0]);
+    float x = v[0] + q[3] * tx + (q[1] * tz - q[2] * ty);
+    float y = v[1] + q[3] * ty + (q[2] * tx - q[0] * tz);
+    float z = v[2] + q[3] * tz + (q[0] * ty - q[1] * tx);
+    r[0] = x; r[1] = y; r[2] = z;
+}
+
+static void luby_quat_to_mat4(const float *q, float *m) {
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    luby_mat4_identity(m);
+    m[0] = 1 - 2 * (y * y + z * z); m[1] = 2 * (x * y + w * z);     m[2] = 2 * (x * z - w * y);
+    m[4] = 2 * (x * y - w * z);     m[5] = 1 - 2 * (x * x + z * z); m[6] = 2 * (y * z + w * x);
+    m[8] = 2 * (x * z + w * y);     m[9] = 2 * (y * z - w * x);     m[10] = 1 - 2 * (x * x + y * y);
+}
+
+static double luby_vector_dot_n(const float *a, const float *b, int n) {
+    double d = 0.0;
+    for (int i = 0; i < n; i++) d += (double)a[i] * b[i];
+    return d;
+}
+
+static void luby_quat_slerp(const float *a, const float *b, float t, float *r) {
+    float to[4];
+    double d = luby_vector_dot_n(a, b, 4);
+    for (int i = 0; i < 4; i++) to[i] = d < 0.0 ? -b[i] : b[i];     // take the short way round
+    if (d < 0.0) d = -d;
+    double wa = 1.0 - t, wb = t;
+    if (d < 0.9995) {
+        double theta = acos(d), s = sin(theta);
+        wa = sin((1.0 - t) * theta) / s;
+        wb = sin(t * theta) / s;
+    }
+    for (int i = 0; i < 4; i++) r[i] = (float)(wa * a[i] + wb * to[i]);
+    double len = sqrt(luby_vector_dot_n(r, r, 4));
+    if (len > 0.0) for (int i = 0; i < 4; i++) r[i] = (float)(r[i] / len);
+}
+
+// a (op) b for the VM's arithmetic opcodes. The operands may be unrooted
+// stack values, so the result is computed before anything is allocated.
+static int luby_vector_arith(luby_state *L, int op, luby_value a, luby_value b, luby_value *out) {
+    const luby_vector *va = a.type == LUBY_T_VECTOR ? (const luby_vector *)a.as.ptr : NULL;
+    const luby_vector *vb = b.type == LUBY_T_VECTOR ? (const luby_vector *)b.as.ptr : NULL;
+    float r[16], k = 0.0f;
+    luby_vector_kind kind;
+    if (va && vb) {
+        int n = luby_vector_lengths[va->kind];
+        kind = va->kind;
+        if (op == LUBY_OP_MUL && va->kind == LUBY_MATRIX4 && vb->kind == LUBY_MATRIX4) {
+            luby_mat4_mul(va->c, vb->c, r);
+        } else if (op == LUBY_OP_MUL && va->kind == LUBY_MATRIX4 && vb->kind == LUBY_VECTOR3) {
+            luby_mat4_apply(va->c, vb->c, 1.0f, r);
+            kind = LUBY_VECTOR3;
+        } else if (op == LUBY_OP_MUL && va->kind == LUBY_QUATERNION && vb->kind == LUBY_QUATERNION) {
+            luby_quat_mul(va->c, vb->c, r);
+        } else if (op == LUBY_OP_MUL && va->kind == LUBY_QUATERNION && vb->kind == LUBY_VECTOR3) {
+            luby_quat_rotate(va->c, vb->c, r);
+            kind = LUBY_VECTOR3;
+        } else if (va->kind != vb->kind) {
+            return luby_vector_type_error(L, "vector operands of different types");
+        } else if (op == LUBY_OP_ADD || op == LUBY_OP_SUB) {
+            for (int i = 0; i < n; i++) r[i] = op == LUBY_OP_ADD ? va->c[i] + vb->c[i] : va->c[i] - vb->c[i];
+        } else if ((op == LUBY_OP_MUL || op == LUBY_OP_DIV) && (kind == LUBY_VECTOR2 || kind == LUBY_VECTOR3)) {
+            // Componentwise, as for scaling by a per-axis factor
+            for (int i = 0; i < n; i++) {
+                if (op == LUBY_OP_DIV && vb->c[i] == 0.0f) {
+                    luby_set_error(L, LUBY_E_RUNTIME, "ZeroDivisionError: divided by 0", NULL, 0, 0);
+                    return (int)LUBY_E_RUNTIME;
+                }
+                r[i] = op == LUBY_OP_MUL ? va->c[i] * vb->c[i] : va->c[i] / vb->c[i];
+            }
+        } else {
+            return luby_vector_type_error(L, "unsupported vector operation");
+        }
+    } else if (va && luby_vector_number(b, &k) && (op == LUBY_OP_MUL || op == LUBY_OP_DIV)) {
+        if (op == LUBY_OP_DIV && k == 0.0f) {
+            luby_set_error(L, LUBY_E_RUNTIME, "ZeroDivisionError: divided by 0", NULL, 0, 0);
+            return (int)LUBY_E_RUNTIME;
+        }
+        kind = va->kind;
+        for (int i = 0; i < luby_vector_lengths[kind]; i++) r[i] = op == LUBY_OP_MUL ? va->c[i] * k : va->c[i] / k;
+    } else if (vb && luby_vector_number(a, &k) && op == LUBY_OP_MUL) {
+        kind = vb->kind;
+        for (int i = 0; i < luby_vector_lengths[kind]; i++) r[i] = k * vb->c[i];
+    } else {
+        return luby_vector_type_error(L, "unsupported operand for vector arithmetic");
+    }
+    return luby_vector_make(L, kind, r, out);
+}
+
+LUBY_API luby_value luby_vector_new(luby_state *L, luby_vector_kind kind, const float *components) {
+    luby_value v = luby_nil();
+    if (!L || (int)kind < 0 || kind > LUBY_MATRIX4) return v;
+    if (luby_vector_make(L, kind, components, &v) != 0) return luby_nil();
+    return v;
+}
+
+LUBY_API const float *luby_vector_data(luby_value v, luby_vector_kind *kind) {
+    if (v.type != LUBY_T_VECTOR || !v.as.ptr) return NULL;
+    luby_vector *vec = (luby_vector *)v.as.ptr;
+    if (kind) *kind = vec->kind;
+    return vec->c;
+}
+
+// Vector2.new(x, y), Vector3.new(x, y, z), Quaternion.new(x, y, z, w),
+// Matrix4.new(16 numbers, column-major); each also takes one Array of the
+// components. With no arguments: zero, or the identity rotation/matrix.
+static int luby_vector_construct(luby_state *L, luby_vector_kind kind, int argc, const luby_value *argv, luby_value *out) {
+    int n = luby_vector_lengths[kind];
+    float c[16];
+    memset(c, 0, sizeof(c));
+    if (argc == 0) {
+        if (kind == LUBY_QUATERNION) c[3] = 1.0f;
+        if (kind == LUBY_MATRIX4) luby_mat4_identity(c);
+        return luby_vector_make(L, kind, c, out);
+    }
+    const luby_value *src = argv;
+    if (argc == 1 && argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
+        luby_array *arr = (luby_array *)argv[0].as.ptr;
+        src = arr->items;
+        argc = (int)(arr->count < 17 ? arr->count : 17);
+    }
+    if (argc != n) return luby_vector_type_error(L, "wrong number of vector components");
+    for (int i = 0; i < n; i++) {
+        if (!luby_vector_number(src[i], &c[i])) return luby_vector_type_error(L, "vector components must be numbers");
+    }
+    return luby_vector_make(L, kind, c, out);
+}
+
+static int luby_vector2_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_construct(L, LUBY_VECTOR2, argc - 1, argv + 1, out);
+}
+
+static int luby_vector3_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_construct(L, LUBY_VECTOR3, argc - 1, argv + 1, out);
+}
+
+static int luby_quat_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_construct(L, LUBY_QUATERNION, argc - 1, argv + 1, out);
+}
+
+static int luby_mat4_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_construct(L, LUBY_MATRIX4, argc - 1, argv + 1, out);
+}
+
+static int luby_vector_identity(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_class_obj *cls = argc >= 1 ? luby_get_receiver_class(argv[0]) : NULL;
+    luby_vector_kind kind = cls == L->vector_classes[LUBY_QUATERNION] ? LUBY_QUATERNION : LUBY_MATRIX4;
+    return luby_vector_construct(L, kind, 0, NULL, out);
+}
+
+// Quaternion.axis_angle(axis, radians)
+static int luby_quat_axis_angle(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *axis = argc >= 3 ? luby_vector_of(argv[1], LUBY_VECTOR3) : NULL;
+    float angle = 0.0f;
+    if (!axis || !luby_vector_number(argv[2], &angle)) return luby_vector_type_error(L, "axis_angle expects a Vector3 and an angle");
+    double len = sqrt(luby_vector_dot_n(axis->c, axis->c, 3));
+    if (len == 0.0) return luby_vector_type_error(L, "axis_angle: zero-length axis");
+    double s = sin(angle * 0.5) / len;
+    float q[4] = { (float)(axis->c[0] * s), (float)(axis->c[1] * s), (float)(axis->c[2] * s), (float)cos(angle * 0.5) };
+    return luby_vector_make(L, LUBY_QUATERNION, q, out);
+}
+
+// Matrix4.translation(v), Matrix4.scaling(v or number), Matrix4.rotation(q)
+static int luby_mat4_translation(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *t = argc >= 2 ? luby_vector_of(argv[1], LUBY_VECTOR3) : NULL;
+    if (!t) return luby_vector_type_error(L, "translation expects a Vector3");
+    float m[16];
+    luby_mat4_identity(m);
+    memcpy(m + 12, t->c, 3 * sizeof(float));
+    return luby_vector_make(L, LUBY_MATRIX4, m, out);
+}
+
+static int luby_mat4_scaling(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *s = argc >= 2 ? luby_vector_of(argv[1], LUBY_VECTOR3) : NULL;
+    float k = 0.0f, m[16];
+    if (!s && (argc < 2 || !luby_vector_number(argv[1], &k))) return luby_vector_type_error(L, "scaling expects a Vector3 or a number");
+    luby_mat4_identity(m);
+    for (int i = 0; i < 3; i++) m[i * 5] = s ? s->c[i] : k;
+    return luby_vector_make(L, LUBY_MATRIX4, m, out);
+}
+
+static int luby_mat4_rotation(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *q = argc >= 2 ? luby_vector_of(argv[1], LUBY_QUATERNION) : NULL;
+    if (!q) return luby_vector_type_error(L, "rotation expects a Quaternion");
+    float m[16];
+    luby_quat_to_mat4(q->c, m);
+    return luby_vector_make(L, LUBY_MATRIX4, m, out);
+}
+
+// Self as a vector (any kind), for the instance methods below
+static const luby_vector *luby_vector_self(int argc, const luby_value *argv) {
+    return argc >= 1 && argv[0].type == LUBY_T_VECTOR ? (const luby_vector *)argv[0].as.ptr : NULL;
+}
+
+static int luby_vector_component(luby_state *L, int argc, const luby_value *argv, luby_value *out, int i) {
+    const luby_vector *v = luby_vector_self(argc, argv);
+    if (!v || i >= luby_vector_lengths[v->kind]) return luby_vector_type_error(L, "no such vector component");
+    if (out) *out = luby_float((double)v->c[i]);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_vector_x(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_component(L, argc, argv, out, 0);
+}
+
+static int luby_vector_y(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_component(L, argc, argv, out, 1);
+}
+
+static int luby_vector_z(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_component(L, argc, argv, out, 2);
+}
+
+static int luby_vector_w(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_vector_component(L, argc, argv, out, 3);
+}
+
+// v[i] (negative counts from the end); nil when out of range
+static int luby_vector_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *v = luby_vector_self(argc, argv);
+    if (!v || argc < 2 || argv[1].type != LUBY_T_INT) return luby_vector_type_error(L, "vector index must be an Integer");
+    int64_t n = luby_vector_lengths[v->kind], i = argv[1].as.i;
+    if (i < 0) i += n;
+    if (out) *out = (i >= 0 && i < n) ? luby_float((double)v->c[i]) : luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_vector_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *v = luby_vector_self(argc, argv);
+    if (!v) return (int)LUBY_E_TYPE;
+    int n = luby_vector_lengths[v->kind];
+    luby_value av = luby_array_new(L);
+    if (av.type != LUBY_T_ARRAY || !luby_array_reserve(L, (luby_array *)av.as.ptr, (size_t)n)) return (int)LUBY_E_OOM;
+    luby_array *arr = (luby_array *)av.as.ptr;
+    for (int i = 0; i < n; i++) arr->items[i] = luby_float((double)v->c[i]);
+    arr->count = (size_t)n;
+    if (out) *out = av;
+    return (int)LUBY_E_OK;
+}
+
+// Self and argv[1] as two vectors of the same kind, for dot, distance etc.
+static int luby_vector_pair(luby_state *L, int argc, const luby_value *argv, const luby_vector **a, const luby_vector **b) {
+    *a = luby_vector_self(argc, argv);
+    *b = *a && argc >= 2 ? luby_vector_of(argv[1], (*a)->kind) : NULL;
+    if (!*b) return luby_vector_type_error(L, "expected a vector of the same type");
+    return (int)LUBY_E_OK;
+}
+
+static int luby_vector_length(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *v = luby_vector_self(argc, argv);
+    if (!v) return (int)LUBY_E_TYPE;
+    (void)L;
+    if (out) *out = luby_float(sqrt(luby_vector_dot_n(v->c, v->c, luby_vector_lengths[v->kind])));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_vector_length_squared(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *v = luby_vector_self(argc, argv);
+    if (!v) return (int)LUBY_E_TYPE;
+    (void)L;
+    if (out) *out = luby_float(luby_vector_dot_n(v->c, v->c, luby_vector_lengths[v->kind]));
+    return (int)LUBY_E_OK;
+}
+
+// Unit length; a zero vector stays zero
+static int luby_vector_normalize(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *v = luby_vector_self(argc, argv);
+    if (!v) return (int)LUBY_E_TYPE;
+    int n = luby_vector_lengths[v->kind];
+    double len = sqrt(luby_vector_dot_n(v->c, v->c, n));
+    float r[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < n && len > 0.0; i++) r[i] = (float)(v->c[i] / len);
+    return luby_vector_make(L, v->kind, r, out);
+}
+
+static int luby_vector_dot(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *a, *b;
+    int rc = luby_vector_pair(L, argc, argv, &a, &b);
+    if (rc != 0) return rc;
+    if (out) *out = luby_float(luby_vector_dot_n(a->c, b->c, luby_vector_lengths[a->kind]));
+    return (int)LUBY_E_OK;
+}
+
+// Vector3#cross is a Vector3; Vector2#cross is the scalar z of the 3D cross
+static int luby_vector_cross(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *a, *b;
+    int rc = luby_vector_pair(L, argc, argv, &a, &b);
+    if (rc != 0) return rc;
+    if (a->kind == LUBY_VECTOR2) {
+        if (out) *out = luby_float((double)a->c[0] * b->c[1] - (double)a->c[1] * b->c[0]);
+        return (int)LUBY_E_OK;
+    }
+    float r[3] = {
+        a->c[1] * b->c[2] - a->c[2] * b->c[1],
+        a->c[2] * b->c[0] - a->c[0] * b->c[2],
+        a->c[0] * b->c[1] - a->c[1] * b->c[0]
+    };
+    return luby_vector_make(L, LUBY_VECTOR3, r, out);
+}
+
+static int luby_vector_distance_squared(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *a, *b;
+    int rc = luby_vector_pair(L, argc, argv, &a, &b);
+    if (rc != 0) return rc;
+    double d = 0.0;
+    for (int i = 0; i < luby_vector_lengths[a->kind]; i++) {
+        double di = (double)a->c[i] - b->c[i];
+        d += di * di;
+    }
+    if (out) *out = luby_float(d);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_vector_distance(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_vector_distance_squared(L, argc, argv, out);
+    if (rc == 0 && out) *out = luby_float(sqrt(out->as.f));
+    return rc;
+}
+
+// a.lerp(b, t): a + (b - a) * t
+static int luby_vector_lerp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *a, *b;
+    float t = 0.0f, r[4];
+    int rc = luby_vector_pair(L, argc, argv, &a, &b);
+    if (rc != 0) return rc;
+    if (argc < 3 || !luby_vector_number(argv[2], &t)) return luby_vector_type_error(L, "lerp expects a number for t");
+    for (int i = 0; i < luby_vector_lengths[a->kind]; i++) r[i] = a->c[i] + (b->c[i] - a->c[i]) * t;
+    return luby_vector_make(L, a->kind, r, out);
+}
+
+// Vector2#angle with no argument is the heading atan2(y, x); with another
+// vector it is the unsigned angle between the two
+static int luby_vector_angle(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *a = luby_vector_self(argc, argv), *b = NULL;
+    if (!a) return (int)LUBY_E_TYPE;
+    if (argc < 2 && a->kind == LUBY_VECTOR2) {
+        if (out) *out = luby_float(atan2(a->c[1], a->c[0]));
+        return (int)LUBY_E_OK;
+    }
+    int rc = luby_vector_pair(L, argc, argv, &a, &b);
+    if (rc != 0) return rc;
+    int n = luby_vector_lengths[a->kind];
+    double la = sqrt(luby_vector_dot_n(a->c, a->c, n)), lb = sqrt(luby_vector_dot_n(b->c, b->c, n));
+    double c = (la > 0.0 && lb > 0.0) ? luby_vector_dot_n(a->c, b->c, n) / (la * lb) : 1.0;
+    if (c > 1.0) c = 1.0;
+    if (c < -1.0) c = -1.0;
+    if (out) *out = luby_float(acos(c));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_quat_conjugate(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *q = argc >= 1 ? luby_vector_of(argv[0], LUBY_QUATERNION) : NULL;
+    if (!q) return (int)LUBY_E_TYPE;
+    float r[4] = { -q->c[0], -q->c[1], -q->c[2], q->c[3] };
+    return luby_vector_make(L, LUBY_QUATERNION, r, out);
+}
+
+static int luby_quat_inverse(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *q = argc >= 1 ? luby_vector_of(argv[0], LUBY_QUATERNION) : NULL;
+    if (!q) return (int)LUBY_E_TYPE;
+    double n = luby_vector_dot_n(q->c, q->c, 4);
+    if (n == 0.0) return luby_vector_type_error(L, "zero quaternion has no inverse");
+    float r[4] = { (float)(-q->c[0] / n), (float)(-q->c[1] / n), (float)(-q->c[2] / n), (float)(q->c[3] / n) };
+    return luby_vector_make(L, LUBY_QUATERNION, r, out);
+}
+
+static int luby_quat_slerp_m(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *a = argc >= 1 ? luby_vector_of(argv[0], LUBY_QUATERNION) : NULL;
+    const luby_vector *b = argc >= 2 ? luby_vector_of(argv[1], LUBY_QUATERNION) : NULL;
+    float t = 0.0f, r[4];
+    if (!a || !b || argc < 3 || !luby_vector_number(argv[2], &t)) return luby_vector_type_error(L, "slerp expects a Quaternion and t");
+    luby_quat_slerp(a->c, b->c, t, r);
+    return luby_vector_make(L, LUBY_QUATERNION, r, out);
+}
+
+// q.rotate(v) is q * v
+static int luby_quat_rotate_m(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || !luby_vector_of(argv[0], LUBY_QUATERNION) || !luby_vector_of(argv[1], LUBY_VECTOR3)) {
+        return luby_vector_type_error(L, "rotate expects a Vector3");
+    }
+    return luby_vector_arith(L, LUBY_OP_MUL, argv[0], argv[1], out);
+}
+
+static int luby_mat4_transpose(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *m = argc >= 1 ? luby_vector_of(argv[0], LUBY_MATRIX4) : NULL;
+    if (!m) return (int)LUBY_E_TYPE;
+    float r[16];
+    for (int col = 0; col < 4; col++) {
+        for (int row = 0; row < 4; row++) r[row * 4 + col] = m->c[col * 4 + row];
+    }
+    return luby_vector_make(L, LUBY_MATRIX4, r, out);
+}
+
+static int luby_mat4_inverse(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *m = argc >= 1 ? luby_vector_of(argv[0], LUBY_MATRIX4) : NULL;
+    if (!m) return (int)LUBY_E_TYPE;
+    float r[16];
+    if (luby_mat4_invert(m->c, r) == 0.0) {
+        luby_set_error(L, LUBY_E_RUNTIME, "matrix is not invertible", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    return luby_vector_make(L, LUBY_MATRIX4, r, out);
+}
+
+static int luby_mat4_determinant(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *m = argc >= 1 ? luby_vector_of(argv[0], LUBY_MATRIX4) : NULL;
+    if (!m) return (int)LUBY_E_TYPE;
+    (void)L;
+    if (out) *out = luby_float(luby_mat4_invert(m->c, NULL));
+    return (int)LUBY_E_OK;
+}
+
+static int luby_mat4_transform(luby_state *L, int argc, const luby_value *argv, luby_value *out, float w) {
+    const luby_vector *m = argc >= 1 ? luby_vector_of(argv[0], LUBY_MATRIX4) : NULL;
+    const luby_vector *v = argc >= 2 ? luby_vector_of(argv[1], LUBY_VECTOR3) : NULL;
+    if (!m || !v) return luby_vector_type_error(L, "transform expects a Vector3");
+    float r[3];
+    luby_mat4_apply(m->c, v->c, w, r);
+    return luby_vector_make(L, LUBY_VECTOR3, r, out);
+}
+
+static int luby_mat4_transform_point(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_mat4_transform(L, argc, argv, out, 1.0f);
+}
+
+static int luby_mat4_transform_direction(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_mat4_transform(L, argc, argv, out, 0.0f);
+}
+
+// m.transform_points(array of Vector3): the whole batch goes through the
+// SIMD kernel before the results are boxed
+static int luby_mat4_transform_points_m(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_vector *m = argc >= 1 ? luby_vector_of(argv[0], LUBY_MATRIX4) : NULL;
+    if (!m || argc < 2 || argv[1].type != LUBY_T_ARRAY || !argv[1].as.ptr) {
+        return luby_vector_type_error(L, "transform_points expects an Array of Vector3");
+    }
+    luby_array *src = (luby_array *)argv[1].as.ptr;
+    size_t count = src->count;
+    float *pts = count ? (float *)luby_alloc_raw(L, NULL, count * 3 * sizeof(float)) : NULL;
+    if (count && !pts) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < count; i++) {
+        const luby_vector *v = luby_vector_of(src->items[i], LUBY_VECTOR3);
+        if (!v) {
+            luby_alloc_raw(L, pts, 0);
+            return luby_vector_type_error(L, "transform_points expects an Array of Vector3");
+        }
+        memcpy(pts + i * 3, v->c, 3 * sizeof(float));
+    }
+    if (count) luby_mat4_transform_points(m->c, pts, pts, count);
+    luby_value av = luby_array_new(L);
+    int rc = (av.type == LUBY_T_ARRAY && luby_gc_push_temp(L, av)
+              && luby_array_reserve(L, (luby_array *)av.as.ptr, count)) ? (int)LUBY_E_OK : (int)LUBY_E_OOM;
+    luby_array *dst = rc == 0 ? (luby_array *)av.as.ptr : NULL;
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        rc = luby_vector_make(L, LUBY_VECTOR3, pts + i * 3, &dst->items[i]);
+        if (rc == 0) dst->count = i + 1;
+    }
+    if (pts) luby_alloc_raw(L, pts, 0);
+    if (rc != 0) return rc;
+    if (out) *out = av;
+    return (int)LUBY_E_OK;
+}
+
+// Operator methods, so send(:+, v) and method(:*) work like the operators
+static int luby_vector_op_add(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    return luby_vector_arith(L, LUBY_OP_ADD, argv[0], argv[1], out);
+}
+
+static int luby_vector_op_sub(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    return luby_vector_arith(L, LUBY_OP_SUB, argv[0], argv[1], out);
+}
+
+static int luby_vector_op_mul(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    return luby_vector_arith(L, LUBY_OP_MUL, argv[0], argv[1], out);
+}
+
+static int luby_vector_op_div(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    return luby_vector_arith(L, LUBY_OP_DIV, argv[0], argv[1], out);
+}
+
+// ------------------------------ Typed arrays ------------------------------
+// Float32Array, Float64Array and Int32Array are LUBY_T_BUFFER values over
+// contiguous primitive storage. An owner keeps its elements inline after the
+// GC header; view(start, length) makes a header that points into its owner,
+// so slicing never copies. Bulk operations run as tight loops over the raw
+// elements, and Float32 ones go four lanes at a time through luby_f4.
+// Int32 arithmetic wraps like the C int32_t it stores.
+
+static int luby_buffer_type_error(luby_state *L, const char *message) {
+    luby_set_error(L, LUBY_E_TYPE, message, NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
+
+static luby_buffer *luby_buffer_of(luby_value v) {
+    return v.type == LUBY_T_BUFFER ? (luby_buffer *)v.as.ptr : NULL;
+}
+
+static luby_buffer *luby_buffer_self(int argc, const luby_value *argv) {
+    return argc >= 1 ? luby_buffer_of(argv[0]) : NULL;
+}
+
+static int luby_buffer_make(luby_state *L, luby_buffer_kind kind, size_t length, luby_buffer *owner, size_t offset, luby_value *out) {
+    luby_buffer *b = luby_buffer_alloc(L, kind, length, owner, offset);
+    if (!b) {
+        if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_OOM, "oom", NULL, 0, 0);
+        return (int)LUBY_E_OOM;
+    }
+    if (out) { out->type = LUBY_T_BUFFER; out->as.ptr = b; }
+    return (int)LUBY_E_OK;
+}
+
+// A number as an element of `kind`: any number for the float kinds, an
+// Integer (wrapped to 32 bits) for Int32Array
+static int luby_buffer_scalar(luby_buffer_kind kind, luby_value v, double *out) {
+    if (kind == LUBY_INT32) {
+        if (v.type != LUBY_T_INT) return 0;
+        *out = (double)(int32_t)(uint32_t)v.as.i;
+        return 1;
+    }
+    if (v.type != LUBY_T_INT && v.type != LUBY_T_FLOAT) return 0;
+    *out = luby_to_double(v);
+    return 1;
+}
+
+static luby_value luby_buffer_value(const luby_buffer *b, size_t i) {
+    if (b->kind == LUBY_INT32) return luby_int((int64_t)((const int32_t *)LUBY_BUFFER_DATA(b))[i]);
+    return luby_float(luby_buffer_get(b, i));
+}
+
+// A float as an Int32Array element: truncated, saturating at the ends
+static int32_t luby_buffer_i32(double d) {
+    if (d != d) return 0;
+    if (d >= 2147483647.0) return INT32_MAX;
+    if (d <= -2147483648.0) return INT32_MIN;
+    return (int32_t)d;
+}
+
+// b[i] = v, converted to the element type
+static int luby_buffer_store(luby_buffer *b, size_t i, luby_value v) {
+    unsigned char *p = LUBY_BUFFER_DATA(b);
+    if (v.type != LUBY_T_INT && v.type != LUBY_T_FLOAT) return 0;
+    switch (b->kind) {
+        case LUBY_FLOAT32: ((float *)p)[i] = (float)luby_to_double(v); break;
+        case LUBY_FLOAT64: ((double *)p)[i] = luby_to_double(v); break;
+        default: ((int32_t *)p)[i] = v.type == LUBY_T_INT ? (int32_t)(uint32_t)v.as.i : luby_buffer_i32(v.as.f); break;
+    }
+    return 1;
+}
+
+#define LUBY_BUFFER_OP(op, x, y) ((op) == LUBY_OP_ADD ? (x) + (y) : (op) == LUBY_OP_SUB ? (x) - (y) : (x) * (y))
+
+// r[i] = a[i] (op) b[i], or a[i] (op) k when b is NULL, for + - *.
+// r may be a; b must not partially overlap r.
+static void luby_buffer_apply(luby_buffer_kind kind, int op, const void *a, const void *b, double k, void *r, size_t n) {
+    size_t i = 0;
+    if (kind == LUBY_FLOAT32) {
+        const float *fa = (const float *)a, *fb = (const float *)b;
+        float *fr = (float *)r, fk = (float)k;
+        luby_f4 vk = luby_f4_splat(fk);
+        for (; i + 4 <= n; i += 4) {
+            luby_f4 x = luby_f4_load(fa + i), y = fb ? luby_f4_load(fb + i) : vk;
+            luby_f4_store(fr + i, op == LUBY_OP_ADD ? luby_f4_add(x, y) : op == LUBY_OP_SUB ? luby_f4_sub(x, y) : luby_f4_mul(x, y));
+        }
+        for (; i < n; i++) fr[i] = LUBY_BUFFER_OP(op, fa[i], fb ? fb[i] : fk);
+    } else if (kind == LUBY_FLOAT64) {
+        const double *da = (const double *)a, *db = (const double *)b;
+        double *dr = (double *)r;
+        for (; i < n; i++) dr[i] = LUBY_BUFFER_OP(op, da[i], db ? db[i] : k);
+    } else {
+        const int32_t *ia = (const int32_t *)a, *ib = (const int32_t *)b;
+        int32_t *ir = (int32_t *)r;
+        uint32_t uk = (uint32_t)(int32_t)k;
+        for (; i < n; i++) ir[i] = (int32_t)LUBY_BUFFER_OP(op, (uint32_t)ia[i], ib ? (uint32_t)ib[i] : uk);
+    }
+}
+
+// Sum of a[i] * b[i], or of a[i] when b is NULL
+static double luby_buffer_reduce(luby_buffer_kind kind, const void *a, const void *b, size_t n, int64_t *isum) {
+    size_t i = 0;
+    if (kind == LUBY_FLOAT32) {
+        const float *fa = (const float *)a, *fb = (const float *)b;
+        luby_f4 acc = luby_f4_splat(0.0f);
+        float lanes[4];
+        for (; i + 4 <= n; i += 4) {
+            luby_f4 x = luby_f4_load(fa + i);
+            acc = luby_f4_add(acc, fb ? luby_f4_mul(x, luby_f4_load(fb + i)) : x);
+        }
+        luby_f4_store(lanes, acc);
+        double s = (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (; i < n; i++) s += fb ? (double)(fa[i] * fb[i]) : (double)fa[i];
+        return s;
+    }
+    if (kind == LUBY_FLOAT64) {
+        const double *da = (const double *)a, *db = (const double *)b;
+        double s = 0.0;
+        for (; i < n; i++) s += db ? da[i] * db[i] : da[i];
+        return s;
+    }
+    const int32_t *ia = (const int32_t *)a, *ib = (const int32_t *)b;
+    uint64_t s = 0;
+    for (; i < n; i++) s += ib ? (uint64_t)((int64_t)ia[i] * ib[i]) : (uint64_t)(int64_t)ia[i];
+    *isum = (int64_t)s;
+    return (double)*isum;
+}
+
+// r[i] = a[i] clamped to [lo, hi]
+static void luby_buffer_clamp_n(luby_buffer_kind kind, const void *a, double lo, double hi, void *r, size_t n) {
+    size_t i = 0;
+    if (kind == LUBY_FLOAT32) {
+        const float *fa = (const float *)a;
+        float *fr = (float *)r, flo = (float)lo, fhi = (float)hi;
+        luby_f4 vlo = luby_f4_splat(flo), vhi = luby_f4_splat(fhi);
+        for (; i + 4 <= n; i += 4) luby_f4_store(fr + i, luby_f4_min(luby_f4_max(luby_f4_load(fa + i), vlo), vhi));
+        for (; i < n; i++) fr[i] = fa[i] < flo ? flo : fa[i] > fhi ? fhi : fa[i];
+    } else if (kind == LUBY_FLOAT64) {
+        const double *da = (const double *)a;
+        double *dr = (double *)r;
+        for (; i < n; i++) dr[i] = da[i] < lo ? lo : da[i] > hi ? hi : da[i];
+    } else {
+        const int32_t *ia = (const int32_t *)a;
+        int32_t *ir = (int32_t *)r, ilo = (int32_t)lo, ihi = (int32_t)hi;
+        for (; i < n; i++) ir[i] = ia[i] < ilo ? ilo : ia[i] > ihi ? ihi : ia[i];
+    }
+}
+
+// r[i] = a[i] + (b[i] - a[i]) * t
+static void luby_buffer_lerp_n(luby_buffer_kind kind, const void *a, const void *b, double t, void *r, size_t n) {
+    size_t i = 0;
+    if (kind == LUBY_FLOAT32) {
+        const float *fa = (const float *)a, *fb = (const float *)b;
+        float *fr = (float *)r, ft = (float)t;
+        luby_f4 vt = luby_f4_splat(ft);
+        for (; i + 4 <= n; i += 4) {
+            luby_f4 x = luby_f4_load(fa + i);
+            luby_f4_store(fr + i, luby_f4_add(x, luby_f4_mul(luby_f4_sub(luby_f4_load(fb + i), x), vt)));
+        }
+        for (; i < n; i++) fr[i] = fa[i] + (fb[i] - fa[i]) * ft;
+    } else if (kind == LUBY_FLOAT64) {
+        const double *da = (const double *)a, *db = (const double *)b;
+        double *dr = (double *)r;
+        for (; i < n; i++) dr[i] = da[i] + (db[i] - da[i]) * t;
+    } else {
+        const int32_t *ia = (const int32_t *)a, *ib = (const int32_t *)b;
+        int32_t *ir = (int32_t *)r;
+        for (; i < n; i++) ir[i] = luby_buffer_i32(ia[i] + ((double)ib[i] - ia[i]) * t);
+    }
+}
+
+// Smallest (want_max = 0) or largest element; n must be positive
+static double luby_buffer_extreme(luby_buffer_kind kind, const void *a, size_t n, int want_max) {
+    size_t i = 0;
+    if (kind == LUBY_FLOAT32) {
+        const float *fa = (const float *)a;
+        float best = fa[0];
+        if (n >= 4) {
+            luby_f4 acc = luby_f4_load(fa);
+            for (i = 4; i + 4 <= n; i += 4) {
+                luby_f4 x = luby_f4_load(fa + i);
+                acc = want_max ? luby_f4_max(acc, x) : luby_f4_min(acc, x);
+            }
+            float lanes[4];
+            luby_f4_store(lanes, acc);
+            for (int j = 0; j < 4; j++) best = (want_max ? lanes[j] > best : lanes[j] < best) ? lanes[j] : best;
+        }
+        for (; i < n; i++) best = (want_max ? fa[i] > best : fa[i] < best) ? fa[i] : best;
+        return (double)best;
+    }
+    double best = kind == LUBY_FLOAT64 ? ((const double *)a)[0] : (double)((const int32_t *)a)[0];
+    for (; i < n; i++) {
+        double x = kind == LUBY_FLOAT64 ? ((const double *)a)[i] : (double)((const int32_t *)a)[i];
+        if (want_max ? x > best : x < best) best = x;
+    }
+    return best;
+}
+
+static int luby_buffer_overlaps(const luby_buffer *a, const luby_buffer *b) {
+    const unsigned char *pa = LUBY_BUFFER_DATA(a), *pb = LUBY_BUFFER_DATA(b);
+    size_t na = a->length * luby_buffer_elem_sizes[a->kind], nb = b->length * luby_buffer_elem_sizes[b->kind];
+    return pa != pb && pa < pb + nb && pb < pa + na;
+}
+
+LUBY_API luby_value luby_buffer_new(luby_state *L, luby_buffer_kind kind, size_t length, const void *init) {
+    luby_value v = luby_nil();
+    if (!L || (int)kind < 0 || kind > LUBY_INT32) return v;
+    if (luby_buffer_make(L, kind, length, NULL, 0, &v) != 0) return luby_nil();
+    if (init && length) memcpy(((luby_buffer *)v.as.ptr)->items, init, length * luby_buffer_elem_sizes[kind]);
+    return v;
+}
+
+LUBY_API void *luby_buffer_data(luby_value v, luby_buffer_kind *kind, size_t *length) {
+    luby_buffer *b = luby_buffer_of(v);
+    if (!b) return NULL;
+    if (kind) *kind = b->kind;
+    if (length) *length = b->length;
+    return LUBY_BUFFER_DATA(b);
+}
+
+// Float32Array.new(length), .new(Array of numbers) or .new(typed array),
+// converting elements to the class's type
+static int luby_buffer_construct(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_class_obj *cls = argc >= 1 ? luby_get_receiver_class(argv[0]) : NULL;
+    luby_buffer_kind kind = cls == L->buffer_classes[LUBY_FLOAT64] ? LUBY_FLOAT64 :
+                            cls == L->buffer_classes[LUBY_INT32] ? LUBY_INT32 : LUBY_FLOAT32;
+    luby_value src = argc >= 2 ? argv[1] : luby_int(0);
+    if (src.type == LUBY_T_INT) {
+        if (src.as.i < 0) return luby_buffer_type_error(L, "negative typed array length");
+        return luby_buffer_make(L, kind, (size_t)src.as.i, NULL, 0, out);
+    }
+    luby_value rv = luby_nil();
+    if (src.type == LUBY_T_ARRAY && src.as.ptr) {
+        luby_array *arr = (luby_array *)src.as.ptr;
+        int rc = luby_buffer_make(L, kind, arr->count, NULL, 0, &rv);
+        if (rc != 0) return rc;
+        luby_buffer *b = (luby_buffer *)rv.as.ptr;
+        for (size_t i = 0; i < arr->count; i++) {
+            if (!luby_buffer_store(b, i, arr->items[i])) return luby_buffer_type_error(L, "typed array elements must be numbers");
+        }
+    } else if (src.type == LUBY_T_BUFFER && src.as.ptr) {
+        const luby_buffer *from = (const luby_buffer *)src.as.ptr;
+        int rc = luby_buffer_make(L, kind, from->length, NULL, 0, &rv);
+        if (rc != 0) return rc;
+        luby_buffer *b = (luby_buffer *)rv.as.ptr;
+        if (from->kind == kind) {
+            memcpy(b->items, LUBY_BUFFER_DATA(from), from->length * luby_buffer_elem_sizes[kind]);
+        } else {
+            for (size_t i = 0; i < from->length; i++) luby_buffer_store(b, i, luby_buffer_value(from, i));
+        }
+    } else {
+        return luby_buffer_type_error(L, "typed array expects a length, an Array or a typed array");
+    }
+    if (out) *out = rv;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_length(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    (void)L;
+    if (!b) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_int((int64_t)b->length);
+    return (int)LUBY_E_OK;
+}
+
+// Index argument i (negative counts from the end) as an offset, or -1
+static int64_t luby_buffer_index_arg(const luby_buffer *b, luby_value v) {
+    if (v.type != LUBY_T_INT) return -1;
+    int64_t i = v.as.i;
+    if (i < 0) i += (int64_t)b->length;
+    return (i >= 0 && (uint64_t)i < b->length) ? i : -1;
+}
+
+// a[i]; nil when out of range
+static int luby_buffer_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b || argc < 2 || argv[1].type != LUBY_T_INT) return luby_buffer_type_error(L, "typed array index must be an Integer");
+    int64_t i = luby_buffer_index_arg(b, argv[1]);
+    if (out) *out = i >= 0 ? luby_buffer_value(b, (size_t)i) : luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_index_set(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b || argc < 3 || argv[1].type != LUBY_T_INT) return luby_buffer_type_error(L, "typed array index must be an Integer");
+    int64_t i = luby_buffer_index_arg(b, argv[1]);
+    if (i < 0) {
+        luby_set_error(L, LUBY_E_RUNTIME, "index out of range", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    if (!luby_buffer_store(b, (size_t)i, argv[2])) return luby_buffer_type_error(L, "typed array elements must be numbers");
+    if (out) *out = argv[2];
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b) return (int)LUBY_E_TYPE;
+    luby_value av = luby_array_new(L);
+    if (av.type != LUBY_T_ARRAY || !luby_array_reserve(L, (luby_array *)av.as.ptr, b->length)) return (int)LUBY_E_OOM;
+    luby_array *arr = (luby_array *)av.as.ptr;
+    for (size_t i = 0; i < b->length; i++) arr->items[i] = luby_buffer_value(b, i);
+    arr->count = b->length;
+    if (out) *out = av;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b) return (int)LUBY_E_TYPE;
+    luby_proc *block = L->current_block.type == LUBY_T_PROC ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { luby_set_error(L, LUBY_E_TYPE, "no block given", NULL, 0, 0); return (int)LUBY_E_TYPE; }
+    for (size_t i = 0; i < b->length; i++) {
+        luby_value elem = luby_buffer_value(b, i), res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &elem, &res, out, luby_nil());
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// A new owner holding a copy of the elements (of a view, only its own)
+static int luby_buffer_dup(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b) return (int)LUBY_E_TYPE;
+    luby_value rv = luby_nil();
+    int rc = luby_buffer_make(L, b->kind, b->length, NULL, 0, &rv);
+    if (rc != 0) return rc;
+    if (b->length) memcpy(((luby_buffer *)rv.as.ptr)->items, LUBY_BUFFER_DATA(b), b->length * luby_buffer_elem_sizes[b->kind]);
+    if (out) *out = rv;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_fill(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b || argc < 2) return (int)LUBY_E_TYPE;
+    if (argv[1].type != LUBY_T_INT && argv[1].type != LUBY_T_FLOAT) return luby_buffer_type_error(L, "typed array elements must be numbers");
+    if (b->length) {
+        // Store the first element, then double the filled prefix
+        size_t es = luby_buffer_elem_sizes[b->kind], done = 1;
+        unsigned char *p = LUBY_BUFFER_DATA(b);
+        luby_buffer_store(b, 0, argv[1]);
+        while (done < b->length) {
+            size_t n = done < b->length - done ? done : b->length - done;
+            memcpy(p + done * es, p, n * es);
+            done += n;
+        }
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// a.view(start, length): shares a's storage; writes show through both ways
+static int luby_buffer_view(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_buffer *b = luby_buffer_self(argc, argv);
+    if (!b || argc < 2 || argv[1].type != LUBY_T_INT || (argc >= 3 && argv[2].type != LUBY_T_INT)) {
+        return luby_buffer_type_error(L, "view expects a start and a length");
+    }
+    int64_t start = argv[1].as.i;
+    if (start < 0) start += (int64_t)b->length;
+    int64_t len = argc >= 3 ? argv[2].as.i : (int64_t)b->length - start;
+    if (start < 0 || len < 0 || (uint64_t)start > b->length || (uint64_t)len > b->length - (uint64_t)start) {
+        luby_set_error(L, LUBY_E_RUNTIME, "index out of range", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    return luby_buffer_make(L, b->kind, (size_t)len, b, (size_t)start, out);
+}
+
+// a + b, a - b, a * b with a typed array of the same type and length or a
+// number; the ! forms write into a and return it
+static int luby_buffer_arith(luby_state *L, int op, int in_place, int argc, const luby_value *argv, luby_value *out) {
+    luby_buffer *a = luby_buffer_self(argc, argv);
+    if (!a || argc < 2) return (int)LUBY_E_TYPE;
+    const luby_buffer *b = luby_buffer_of(argv[1]);
+    double k = 0.0;
+    if (b) {
+        if (b->kind != a->kind || b->length != a->length) return luby_buffer_type_error(L, "typed array operands differ in type or length");
+    } else if (!luby_buffer_scalar(a->kind, argv[1], &k)) {
+        return luby_buffer_type_error(L, a->kind == LUBY_INT32 ? "Int32Array operand must be an Int32Array or Integer"
+                                                                : "typed array operand must be a typed array of the same type or a number");
+    }
+    luby_value rv = argv[0];
+    if (!in_place) {
+        int rc = luby_buffer_make(L, a->kind, a->length, NULL, 0, &rv);
+        if (rc != 0) return rc;
+    }
+    const void *pb = b ? LUBY_BUFFER_DATA(b) : NULL;
+    void *tmp = NULL;
+    if (in_place && b && luby_buffer_overlaps(a, b)) {
+        // An overlapping view of a would see its own earlier writes
+        size_t bytes = b->length * luby_buffer_elem_sizes[b->kind];
+        if (!(tmp = luby_alloc_raw(L, NULL, bytes))) return (int)LUBY_E_OOM;
+        memcpy(tmp, pb, bytes);
+        pb = tmp;
+    }
+    luby_buffer_apply(a->kind, op, LUBY_BUFFER_DATA(a), pb, k, LUBY_BUFFER_DATA((luby_buffer *)rv.as.ptr), a->length);
+    if (tmp) luby_alloc_raw(L, tmp, 0);
+    if (out) *out = rv;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_add(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_arith(L, LUBY_OP_ADD, 0, argc, argv, out);
+}
+
+static int luby_buffer_sub(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_arith(L, LUBY_OP_SUB, 0, argc, argv, out);
+}
+
+static int luby_buffer_mul(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_arith(L, LUBY_OP_MUL, 0, argc, argv, out);
+}
+
+static int luby_buffer_add_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_arith(L, LUBY_OP_ADD, 1, argc, argv, out);
+}
+
+static int luby_buffer_sub_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_arith(L, LUBY_OP_SUB, 1, argc, argv, out);
+}
+
+static int luby_buffer_mul_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_arith(L, LUBY_OP_MUL, 1, argc, argv, out);
+}
+
+// Reductions: Integer for Int32Array, Float otherwise
+static int luby_buffer_reduce_result(const luby_buffer *b, double s, int64_t is, luby_value *out) {
+    if (out) *out = b->kind == LUBY_INT32 ? luby_int(is) : luby_float(s);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_sum(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    (void)L;
+    if (!b) return (int)LUBY_E_TYPE;
+    int64_t is = 0;
+    double s = luby_buffer_reduce(b->kind, LUBY_BUFFER_DATA(b), NULL, b->length, &is);
+    return luby_buffer_reduce_result(b, s, is, out);
+}
+
+static int luby_buffer_dot(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *a = luby_buffer_self(argc, argv);
+    const luby_buffer *b = argc >= 2 ? luby_buffer_of(argv[1]) : NULL;
+    if (!a) return (int)LUBY_E_TYPE;
+    if (!b || b->kind != a->kind || b->length != a->length) return luby_buffer_type_error(L, "dot expects a typed array of the same type and length");
+    int64_t is = 0;
+    double s = luby_buffer_reduce(a->kind, LUBY_BUFFER_DATA(a), LUBY_BUFFER_DATA(b), a->length, &is);
+    return luby_buffer_reduce_result(a, s, is, out);
+}
+
+static int luby_buffer_extreme_m(luby_state *L, int argc, const luby_value *argv, luby_value *out, int want_max) {
+    const luby_buffer *b = luby_buffer_self(argc, argv);
+    (void)L;
+    if (!b) return (int)LUBY_E_TYPE;
+    if (b->length == 0) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    double x = luby_buffer_extreme(b->kind, LUBY_BUFFER_DATA(b), b->length, want_max);
+    return luby_buffer_reduce_result(b, x, (int64_t)x, out);
+}
+
+static int luby_buffer_min(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_extreme_m(L, argc, argv, out, 0);
+}
+
+static int luby_buffer_max(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_extreme_m(L, argc, argv, out, 1);
+}
+
+// a.clamp(lo, hi) / a.clamp!(lo, hi)
+static int luby_buffer_clamp_m(luby_state *L, int in_place, int argc, const luby_value *argv, luby_value *out) {
+    luby_buffer *a = luby_buffer_self(argc, argv);
+    double lo = 0.0, hi = 0.0;
+    if (!a) return (int)LUBY_E_TYPE;
+    if (argc < 3 || !luby_buffer_scalar(a->kind, argv[1], &lo) || !luby_buffer_scalar(a->kind, argv[2], &hi)) {
+        return luby_buffer_type_error(L, "clamp expects a minimum and a maximum element");
+    }
+    if (lo > hi) return luby_buffer_type_error(L, "clamp: minimum is greater than maximum");
+    luby_value rv = argv[0];
+    if (!in_place) {
+        int rc = luby_buffer_make(L, a->kind, a->length, NULL, 0, &rv);
+        if (rc != 0) return rc;
+    }
+    luby_buffer_clamp_n(a->kind, LUBY_BUFFER_DATA(a), lo, hi, LUBY_BUFFER_DATA((luby_buffer *)rv.as.ptr), a->length);
+    if (out) *out = rv;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_clamp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_clamp_m(L, 0, argc, argv, out);
+}
+
+static int luby_buffer_clamp_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_clamp_m(L, 1, argc, argv, out);
+}
+
+// a.lerp(b, t) / a.lerp!(b, t)
+static int luby_buffer_lerp_m(luby_state *L, int in_place, int argc, const luby_value *argv, luby_value *out) {
+    luby_buffer *a = luby_buffer_self(argc, argv);
+    const luby_buffer *b = argc >= 2 ? luby_buffer_of(argv[1]) : NULL;
+    if (!a) return (int)LUBY_E_TYPE;
+    if (!b || b->kind != a->kind || b->length != a->length || argc < 3 ||
+        (argv[2].type != LUBY_T_INT && argv[2].type != LUBY_T_FLOAT)) {
+        return luby_buffer_type_error(L, "lerp expects a typed array of the same type and length and a number");
+    }
+    double t = luby_to_double(argv[2]);
+    luby_value rv = argv[0];
+    if (!in_place) {
+        int rc = luby_buffer_make(L, a->kind, a->length, NULL, 0, &rv);
+        if (rc != 0) return rc;
+    }
+    const void *pb = LUBY_BUFFER_DATA(b);
+    void *tmp = NULL;
+    if (in_place && luby_buffer_overlaps(a, b)) {
+        size_t bytes = b->length * luby_buffer_elem_sizes[b->kind];
+        if (!(tmp = luby_alloc_raw(L, NULL, bytes))) return (int)LUBY_E_OOM;
+        memcpy(tmp, pb, bytes);
+        pb = tmp;
+    }
+    luby_buffer_lerp_n(a->kind, LUBY_BUFFER_DATA(a), pb, t, LUBY_BUFFER_DATA((luby_buffer *)rv.as.ptr), a->length);
+    if (tmp) luby_alloc_raw(L, tmp, 0);
+    if (out) *out = rv;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_buffer_lerp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_lerp_m(L, 0, argc, argv, out);
+}
+
+static int luby_buffer_lerp_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_buffer_lerp_m(L, 1, argc, argv, out);
+}
+
+// Same type, same length, equal elements
+static int luby_buffer_equal(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    const luby_buffer *a = luby_buffer_self(argc, argv);
+    const luby_buffer *b = argc >= 2 ? luby_buffer_of(argv[1]) : NULL;
+    (void)L;
+    if (!a) return (int)LUBY_E_TYPE;
+    int eq = b && b->kind == a->kind && b->length == a->length;
+    for (size_t i = 0; eq && i < a->length; i++) eq = luby_buffer_get(a, i) == luby_buffer_get(b, i);
+    if (out) *out = luby_bool(eq);
+    return (int)LUBY_E_OK;
+}
+
+// ---------------------- Seeded RNG (xoroshiro128+) -------------------------
+
+static uint64_t luby_rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t luby_rng_next(luby_state *L) {
+    uint64_t s0 = L->rng_state[0];
+    uint64_t s1 = L->rng_state[1];
+    uint64_t result = s0 + s1;
+    s1 ^= s0;
+    L->rng_state[0] = luby_rng_rotl(s0, 24) ^ s1 ^ (s1 << 16);
+    L->rng_state[1] = luby_rng_rotl(s1, 37);
+    return result;
+}
+
+static double luby_rng_double(luby_state *L) {
+    uint64_t r = luby_rng_next(L);
+    return (double)(r >> 11) * (1.0 / (double)(1ULL << 53));
+}
+
+static int luby_rng_srand(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    uint64_t seed = 0;
+    if (argc >= 1) {
+        if (argv[0].type == LUBY_T_INT) seed = (uint64_t)argv[0].as.i;
+        else if (argv[0].type == LUBY_T_FLOAT) seed = (uint64_t)argv[0].as.f;
+    }
+    // SplitMix64 to initialize state from seed
+    seed += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    L->rng_state[0] = z ^ (z >> 31);
+    seed += 0x9e3779b97f4a7c15ULL;
+    z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    L->rng_state[1] = z ^ (z >> 31);
+    if (out) *out = luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_rand(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc == 0) {
+        // rand() -> float in [0, 1)
+        if (out) *out = luby_float(luby_rng_double(L));
+    } else if (argc == 1) {
+        if (argv[0].type == LUBY_T_INT) {
+            // rand(n) -> int in [0, n)
+            int64_t n = argv[0].as.i;
+            if (n <= 0) {
+                if (out) *out = luby_int(0);
+            } else {
+                uint64_t r = luby_rng_next(L);
+                if (out) *out = luby_int((int64_t)(r % (uint64_t)n));
+            }
+        } else if (argv[0].type == LUBY_T_RANGE && argv[0].as.ptr) {
+            // rand(a..b) -> int in [a, b] (inclusive for .. ranges)
+            luby_range *rng = (luby_range *)argv[0].as.ptr;
+            int64_t lo = (rng->start.type == LUBY_T_INT) ? rng->start.as.i : 0;
+            int64_t hi = (rng->end.type == LUBY_T_INT) ? rng->end.as.i : 0;
+            if (rng->exclusive) hi--;
+            if (hi < lo) {
+                if (out) *out = luby_int(lo);
+            } else {
+                uint64_t span = (uint64_t)(hi - lo + 1);
+                uint64_t r = luby_rng_next(L);
+                if (out) *out = luby_int(lo + (int64_t)(r % span));
+            }
+        } else {
+            if (out) *out = luby_float(luby_rng_double(L));
+        }
+    } else if (argc >= 2) {
+        // rand(a, b) -> int in [a, b]
+        int64_t lo = (argv[0].type == LUBY_T_INT) ? argv[0].as.i : 0;
+        int64_t hi = (argv[1].type == LUBY_T_INT) ? argv[1].as.i : 0;
+        if (hi < lo) {
+            if (out) *out = luby_int(lo);
+        } else {
+            uint64_t span = (uint64_t)(hi - lo + 1);
+            uint64_t r = luby_rng_next(L);
+            if (out) *out = luby_int(lo + (int64_t)(r % span));
+        }
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_rand_float(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) {
+        if (out) *out = luby_float(luby_rng_double(L));
+    } else {
+        double lo = luby_to_double(argv[0]);
+        double hi = luby_to_double(argv[1]);
+        double t = luby_rng_double(L);
+        if (out) *out = luby_float(lo + (hi - lo) * t);
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_sample(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    if (arr->count == 0) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    uint64_t r = luby_rng_next(L);
+    size_t idx = (size_t)(r % arr->count);
+    if (out) *out = arr->items[idx];
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_shuffle(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    luby_array *src = (luby_array *)argv[0].as.ptr;
+    // Create a copy
+    luby_value arrv = luby_array_new(L);
+    if (arrv.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < src->count; i++) {
+        luby_array_push_value(L, arrv, src->items[i]);
+    }
+    luby_array *arr = (luby_array *)arrv.as.ptr;
+    // Fisher-Yates shuffle
+    for (size_t i = arr->count; i > 1; i--) {
+        uint64_t r = luby_rng_next(L);
+        size_t j = (size_t)(r % i);
+        luby_value tmp = arr->items[i - 1];
+        arr->items[i - 1] = arr->items[j];
+        arr->items[j] = tmp;
+    }
+    if (out) *out = arrv;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_shuffle_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    // Fisher-Yates shuffle in-place
+    for (size_t i = arr->count; i > 1; i--) {
+        uint64_t r = luby_rng_next(L);
+        size_t j = (size_t)(r % i);
+        luby_value tmp = arr->items[i - 1];
+        arr->items[i - 1] = arr->items[j];
+        arr->items[j] = tmp;
+    }
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// ---------------------- Probability helpers -------------------------
+
+static int luby_rng_chance(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) {
+        if (out) *out = luby_bool(0);
+        return (int)LUBY_E_OK;
+    }
+    double percent = luby_to_double(argv[0]);
+    double roll = luby_rng_double(L) * 100.0;
+    if (out) *out = luby_bool(roll < percent);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_dice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int64_t count = 1;
+    int64_t sides = 6;
+    if (argc >= 1 && argv[0].type == LUBY_T_INT) count = argv[0].as.i;
+    if (argc >= 2 && argv[1].type == LUBY_T_INT) sides = argv[1].as.i;
+    if (count < 0) count = 0;
+    if (sides < 1) sides = 1;
+    int64_t total = 0;
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t r = luby_rng_next(L);
+        total += 1 + (int64_t)(r % (uint64_t)sides);
+    }
+    if (out) *out = luby_int(total);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_weighted_choice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    // Accept either hash {item => weight} or array [[item, weight], ...]
+    if (argv[0].type == LUBY_T_HASH && argv[0].as.ptr) {
+        luby_hash *h = (luby_hash *)argv[0].as.ptr;
+        if (h->count == 0) {
+            if (out) *out = luby_nil();
+            return (int)LUBY_E_OK;
         }
-        dst->items[dst->count++] = sv;
+        // Sum weights
+        double total_weight = 0.0;
+        for (size_t i = 0; i < h->count; i++) {
+            total_weight += luby_to_double(h->entries[i].value);
+        }
+        if (total_weight <= 0.0) {
+            if (out) *out = luby_nil();
+            return (int)LUBY_E_OK;
+        }
+        // Pick
+        double roll = luby_rng_double(L) * total_weight;
+        double cumulative = 0.0;
+        for (size_t i = 0; i < h->count; i++) {
+            cumulative += luby_to_double(h->entries[i].value);
+            if (roll < cumulative) {
+                if (out) *out = h->entries[i].key;
+                return (int)LUBY_E_OK;
+            }
+        }
+        // Fallback to last
+        if (out) *out = h->entries[h->count - 1].key;
+    } else if (argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
+        luby_array *arr = (luby_array *)argv[0].as.ptr;
+        if (arr->count == 0) {
+            if (out) *out = luby_nil();
+            return (int)LUBY_E_OK;
+        }
+        // Sum weights from [[item, weight], ...]
+        double total_weight = 0.0;
+        for (size_t i = 0; i < arr->count; i++) {
+            if (arr->items[i].type == LUBY_T_ARRAY && arr->items[i].as.ptr) {
+                luby_array *pair = (luby_array *)arr->items[i].as.ptr;
+                if (pair->count >= 2) {
+                    total_weight += luby_to_double(pair->items[1]);
+                }
+            }
+        }
+        if (total_weight <= 0.0) {
+            if (out) *out = luby_nil();
+            return (int)LUBY_E_OK;
+        }
+        // Pick
+        double roll = luby_rng_double(L) * total_weight;
+        double cumulative = 0.0;
+        for (size_t i = 0; i < arr->count; i++) {
+            if (arr->items[i].type == LUBY_T_ARRAY && arr->items[i].as.ptr) {
+                luby_array *pair = (luby_array *)arr->items[i].as.ptr;
+                if (pair->count >= 2) {
+                    cumulative += luby_to_double(pair->items[1]);
+                    if (roll < cumulative) {
+                        if (out) *out = pair->items[0];
+                        return (int)LUBY_E_OK;
+                    }
+                }
+            }
+        }
+        // Fallback
+        luby_array *last = (luby_array *)arr->items[arr->count - 1].as.ptr;
+        if (last && last->count >= 1) {
+            if (out) *out = last->items[0];
+        } else {
+            if (out) *out = luby_nil();
+        }
+    } else {
+        if (out) *out = luby_nil();
+    }
+    return (int)LUBY_E_OK;
+}
+
+static int luby_rng_roll(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    // roll("3d6") or roll("2d20+5") style parsing
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) {
+        if (out) *out = luby_int(0);
+        return (int)LUBY_E_OK;
+    }
+    const char *str = (const char *)argv[0].as.ptr;
+    int64_t count = 0, sides = 0, modifier = 0;
+    int sign = 1;
+    // Parse: [count]d<sides>[+/-modifier]
+    const char *p = str;
+    // Count (optional, defaults to 1)
+    while (*p >= '0' && *p <= '9') {
+        count = count * 10 + (*p - '0');
+        p++;
+    }
+    if (count == 0) count = 1;
+    // 'd' or 'D'
+    if (*p == 'd' || *p == 'D') p++;
+    // Sides
+    while (*p >= '0' && *p <= '9') {
+        sides = sides * 10 + (*p - '0');
+        p++;
+    }
+    if (sides == 0) sides = 6;
+    // Modifier
+    if (*p == '+') { sign = 1; p++; }
+    else if (*p == '-') { sign = -1; p++; }
+    while (*p >= '0' && *p <= '9') {
+        modifier = modifier * 10 + (*p - '0');
+        p++;
+    }
+    modifier *= sign;
+    // Roll
+    int64_t total = 0;
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t r = luby_rng_next(L);
+        total += 1 + (int64_t)(r % (uint64_t)sides);
+    }
+    total += modifier;
+    if (out) *out = luby_int(total);
+    return (int)LUBY_E_OK;
+}
+
+// ---------------------- VFS Data Loading -------------------------
+
+static int luby_resolve_vfs_path(luby_state *L, const char *path, char *resolved, size_t resolved_size) {
+    if (!L->cfg.vfs.exists) return 0;
+    
+    // Try direct path first
+    if (L->cfg.vfs.exists(L->cfg.vfs.user, path)) {
+        snprintf(resolved, resolved_size, "%s", path);
+        return 1;
+    }
+    
+    // Search in search paths
+    for (size_t i = 0; i < L->search_path_count; i++) {
+        const char *base = L->search_paths[i];
+        if (!base) continue;
+        size_t blen = strlen(base);
+        snprintf(resolved, resolved_size, "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", path);
+        if (L->cfg.vfs.exists(L->cfg.vfs.user, resolved)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int luby_base_load_text(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    
+    if (!L->cfg.vfs.read || !L->cfg.vfs.exists) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    
+    const char *path = (const char *)argv[0].as.ptr;
+    char resolved[1024];
+    
+    if (!luby_resolve_vfs_path(L, path, resolved, sizeof(resolved))) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    
+    size_t size = 0;
+    char *content = L->cfg.vfs.read(L->cfg.vfs.user, resolved, &size);
+    if (!content) {
+        if (out) *out = luby_nil();
+        return (int)LUBY_E_OK;
+    }
+    
+    luby_value result = luby_string(L, content, size);
+    // Free the VFS-allocated buffer
+    if (L->cfg.alloc) {
+        L->cfg.alloc(L->cfg.alloc_user, content, 0);
+    } else {
+        luby_default_alloc(NULL, content, 0);
     }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
+    
+    if (out) *out = result;
     return (int)LUBY_E_OK;
 }
 
-// each_cons: [arr].each_cons(n) => [[cons1], [cons2], ...]
-static int luby_array_each_cons(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr ||
-        argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    int64_t n = argv[1].as.i;
-    if (n <= 0 || (size_t)n > src->count) {
-        luby_array *empty = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!empty) return (int)LUBY_E_OOM;
-        empty->count = 0; empty->capacity = 0; empty->frozen = 0; empty->items = NULL;
-        luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = empty;
-        if (out) *out = v;
+static int luby_base_file_exists(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) {
+        if (out) *out = luby_bool(0);
         return (int)LUBY_E_OK;
     }
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    size_t num_cons = src->count - (size_t)n + 1;
-    luby_array *dst = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!dst) return (int)LUBY_E_OOM;
-    dst->count = 0; dst->capacity = num_cons; dst->frozen = 0;
-    dst->items = (luby_value *)luby_alloc_raw(L, NULL, dst->capacity * sizeof(luby_value));
-    if (!dst->items && dst->capacity > 0) return (int)LUBY_E_OOM;
-    for (size_t i = 0; i < num_cons; i++) {
-        luby_array *cons = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-        if (!cons) return (int)LUBY_E_OOM;
-        cons->count = (size_t)n; cons->capacity = (size_t)n; cons->frozen = 0;
-        cons->items = (luby_value *)luby_alloc_raw(L, NULL, (size_t)n * sizeof(luby_value));
-        if (!cons->items) return (int)LUBY_E_OOM;
-        for (size_t j = 0; j < (size_t)n; j++) cons->items[j] = src->items[i + j];
-        luby_value cv; cv.type = LUBY_T_ARRAY; cv.as.ptr = cons;
-        if (block) {
-            luby_value res = luby_nil();
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &cv, &res, out, luby_nil());
-        }
-        dst->items[dst->count++] = cv;
+    
+    if (!L->cfg.vfs.exists) {
+        if (out) *out = luby_bool(0);
+        return (int)LUBY_E_OK;
     }
-    luby_value v; v.type = LUBY_T_ARRAY; v.as.ptr = dst;
-    if (out) *out = v;
+    
+    const char *path = (const char *)argv[0].as.ptr;
+    char resolved[1024];
+    
+    if (out) *out = luby_bool(luby_resolve_vfs_path(L, path, resolved, sizeof(resolved)));
     return (int)LUBY_E_OK;
 }
 
-// find_index: [arr].find_index { |x| predicate } => index or nil
-static int luby_array_find_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (block) {
-        for (size_t i = 0; i < src->count; i++) {
-            luby_value res = luby_nil();
-            LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &src->items[i], &res, out, luby_nil());
-            if (luby_is_truthy(res)) { if (out) *out = luby_int((int64_t)i); return (int)LUBY_E_OK; }
+static int luby_base_includes(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_STRING && argv[0].as.ptr && argv[1].type == LUBY_T_STRING && argv[1].as.ptr) {
+        const char *haystack = (const char *)argv[0].as.ptr;
+        const char *needle = (const char *)argv[1].as.ptr;
+        if (out) *out = luby_bool(strstr(haystack, needle) != NULL);
+    } else if (argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
+        luby_array *arr = (luby_array *)argv[0].as.ptr;
+        int found = 0;
+        for (size_t i = 0; i < arr->count; i++) {
+            if (luby_value_eq(arr->items[i], argv[1])) { found = 1; break; }
         }
-    } else if (argc >= 2) {
-        for (size_t i = 0; i < src->count; i++) {
-            if (luby_value_eq(src->items[i], argv[1])) { if (out) *out = luby_int((int64_t)i); return (int)LUBY_E_OK; }
+        if (out) *out = luby_bool(found);
+    } else if (argv[0].type == LUBY_T_RANGE) {
+        return luby_range_include(L, argc, argv, out);
+    } else return (int)LUBY_E_TYPE;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_base_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    for (size_t i = 0; i < arr->count; i++) {
+        if (luby_value_eq(arr->items[i], argv[1])) {
+            if (out) *out = luby_int((int64_t)i);
+            return (int)LUBY_E_OK;
         }
-    } else {
-        return (int)LUBY_E_TYPE;
     }
     if (out) *out = luby_nil();
     return (int)LUBY_E_OK;
 }
 
-// tally: [arr].tally => { element => count }
-static int luby_array_tally(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    luby_hash *h = (luby_hash *)luby_gc_alloc(L, sizeof(luby_hash), LUBY_GC_HASH);
-    if (!h) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    h->count = 0; h->capacity = 8; h->frozen = 0;
-    h->entries = (luby_hash_entry *)luby_alloc_raw(L, NULL, h->capacity * sizeof(luby_hash_entry));
-    luby_value hv; hv.type = LUBY_T_HASH; hv.as.ptr = h;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_value existing;
-        int found = 0;
-        luby_hash_get_value_found(hv, src->items[i], &existing, &found);
-        int64_t cnt = found ? existing.as.i + 1 : 1;
-        luby_hash_set_value(L, hv, src->items[i], luby_int(cnt));
+// concat(arr, other...) appends each array's elements to arr in place
+static int luby_base_concat(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    int rc = luby_array_check_mutable(L, argc, argv, 2);
+    if (rc != 0) return rc;
+    luby_array *a = (luby_array *)argv[0].as.ptr;
+    size_t total = a->count;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i].type != LUBY_T_ARRAY || !argv[i].as.ptr) return (int)LUBY_E_TYPE;
+        total += ((luby_array *)argv[i].as.ptr)->count;
     }
-    L->gc_paused = was_paused;
-    if (out) *out = hv;
+    if (!luby_array_reserve(L, a, total)) return (int)LUBY_E_OOM;
+    size_t own = a->count;
+    for (int i = 1; i < argc; i++) {
+        luby_array *b = (luby_array *)argv[i].as.ptr;
+        // a.concat(a) copies only the elements present before the call
+        size_t n = b == a ? own : b->count;
+        memcpy(a->items + a->count, b->items, n * sizeof(luby_value));
+        a->count += n;
+    }
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_keys(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) return (int)LUBY_E_OOM;
-    arr->count = h->count; arr->capacity = h->count; arr->frozen = 0;
-    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
-    for (size_t i = 0; i < h->count; i++) {
-        arr->items[i] = h->entries[i].key;
+static int luby_shift_amount(luby_state *L, luby_value v, int64_t *out) {
+    if (v.type != LUBY_T_INT) {
+        if (L) luby_set_error(L, LUBY_E_TYPE, "shift amount must be an Integer", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
+    *out = v.as.i;
     return (int)LUBY_E_OK;
 }
 
-static int luby_hash_values(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_HASH || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_hash *h = (luby_hash *)argv[0].as.ptr;
-    luby_array *arr = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!arr) return (int)LUBY_E_OOM;
-    arr->count = h->count; arr->capacity = h->count; arr->frozen = 0;
-    arr->items = (luby_value *)luby_alloc_raw(L, NULL, arr->capacity * sizeof(luby_value));
-    for (size_t i = 0; i < h->count; i++) {
-        arr->items[i] = h->entries[i].value;
-    }
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = arr; }
-    return (int)LUBY_E_OK;
+static int64_t luby_int_shift(int64_t v, int64_t by) {
+    if (by >= 64) return 0;
+    if (by <= -64) return v < 0 ? -1 : 0;
+    if (by >= 0) return (int64_t)((uint64_t)v << by);
+    return v >> -by;
 }
 
-static int luby_base_times(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    
-    int64_t n = argv[0].as.i;
-    for (int64_t i = 0; i < n; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+// arr << v appends one element; Integer << n shifts left
+static int luby_base_shl(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_ARRAY) return luby_array_push(L, 2, argv, out);
+    if (argv[0].type == LUBY_T_INT) {
+        int64_t by;
+        int rc = luby_shift_amount(L, argv[1], &by);
+        if (rc == 0 && out) *out = luby_int(luby_int_shift(argv[0].as.i, by));
+        return rc;
     }
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+    if (L) luby_set_error(L, LUBY_E_TYPE, "undefined method '<<'", NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
 }
 
-static int luby_base_upto(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_INT || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    
-    int64_t from = argv[0].as.i;
-    int64_t to = argv[1].as.i;
-    for (int64_t i = from; i <= to; i++) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+static int luby_base_shr(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_INT) {
+        int64_t by;
+        int rc = luby_shift_amount(L, argv[1], &by);
+        if (rc == 0 && out) *out = luby_int(luby_int_shift(argv[0].as.i, by == INT64_MIN ? 64 : -by));
+        return rc;
     }
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+    if (L) luby_set_error(L, LUBY_E_TYPE, "undefined method '>>'", NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
 }
 
-static int luby_base_downto(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_INT || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_proc *block = (L && L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
-    if (!block) { if (out) *out = argv[0]; return (int)LUBY_E_OK; }
-    
-    int64_t from = argv[0].as.i;
-    int64_t to = argv[1].as.i;
-    for (int64_t i = from; i >= to; i--) {
-        luby_value iv = luby_int(i);
-        luby_value res = luby_nil();
-        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &iv, &res, out, luby_nil());
+static int luby_base_bitop(luby_state *L, int argc, const luby_value *argv, luby_value *out, char op) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    if (argv[0].type == LUBY_T_INT && argv[1].type == LUBY_T_INT) {
+        int64_t a = argv[0].as.i, b = argv[1].as.i;
+        if (out) *out = luby_int(op == '&' ? (a & b) : op == '|' ? (a | b) : (a ^ b));
+        return (int)LUBY_E_OK;
     }
-    if (out) *out = argv[0];
-    return (int)LUBY_E_OK;
+    if (argv[0].type == LUBY_T_ARRAY && op != '^') {
+        return op == '&' ? luby_array_intersection(L, 2, argv, out) : luby_array_union(L, 2, argv, out);
+    }
+    if (L) {
+        const char *msg = op == '&' ? "undefined method '&'" : op == '|' ? "undefined method '|'" : "undefined method '^'";
+        luby_set_error(L, LUBY_E_TYPE, msg, NULL, 0, 0);
+    }
+    return (int)LUBY_E_TYPE;
 }
 
-// ---------------------- More stdlib functions -------------------------
+static int luby_base_and(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_base_bitop(L, argc, argv, out, '&');
+}
 
-static int luby_base_abs(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_INT) {
-        int64_t v = argv[0].as.i;
-        if (out) *out = luby_int(v < 0 ? -v : v);
-    } else if (argv[0].type == LUBY_T_FLOAT) {
-        double v = argv[0].as.f;
-        if (out) *out = luby_float(v < 0 ? -v : v);
-    } else return (int)LUBY_E_TYPE;
-    return (int)LUBY_E_OK;
+static int luby_base_or(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_base_bitop(L, argc, argv, out, '|');
 }
 
-static int luby_base_floor(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_FLOAT) {
-        if (out) *out = luby_int((int64_t)argv[0].as.f);
-    } else if (argv[0].type == LUBY_T_INT) {
-        if (out) *out = argv[0];
-    } else return (int)LUBY_E_TYPE;
-    return (int)LUBY_E_OK;
+static int luby_base_xor(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_base_bitop(L, argc, argv, out, '^');
 }
 
-static int luby_base_ceil(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
+// hash: content hash of a value, consistent with uniq/tally/& and usable
+// from a user-defined hash method
+static int luby_base_hash(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
     if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_FLOAT) {
-        double v = argv[0].as.f;
-        int64_t iv = (int64_t)v;
-        if (v > (double)iv) iv++;
-        if (out) *out = luby_int(iv);
-    } else if (argv[0].type == LUBY_T_INT) {
-        if (out) *out = argv[0];
-    } else return (int)LUBY_E_TYPE;
+    uint64_t h;
+    int rc = luby_value_hash_depth(L, argv[0], 0, 1, &h);
+    if (rc == 0 && out) *out = luby_int((int64_t)h);
+    return rc;
+}
+
+static int luby_base_take(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    size_t n = (size_t)argv[1].as.i;
+    if (n > arr->count) n = arr->count;
+    luby_array *result = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!result) return (int)LUBY_E_OOM;
+    result->count = n;
+    result->capacity = n > 0 ? n : 1;
+    result->frozen = 0;
+    result->items = (luby_value *)luby_alloc_raw(L, NULL, result->capacity * sizeof(luby_value));
+    memcpy(result->items, arr->items, n * sizeof(luby_value));
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = result; }
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_round(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_FLOAT) {
-        double v = argv[0].as.f;
-        if (out) *out = luby_int((int64_t)(v + (v >= 0 ? 0.5 : -0.5)));
-    } else if (argv[0].type == LUBY_T_INT) {
-        if (out) *out = argv[0];
-    } else return (int)LUBY_E_TYPE;
+static int luby_base_drop(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_array *arr = (luby_array *)argv[0].as.ptr;
+    size_t n = (size_t)argv[1].as.i;
+    if (n > arr->count) n = arr->count;
+    size_t rem = arr->count - n;
+    luby_array *result = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
+    if (!result) return (int)LUBY_E_OOM;
+    result->count = rem;
+    result->capacity = rem > 0 ? rem : 1;
+    result->frozen = 0;
+    result->items = (luby_value *)luby_alloc_raw(L, NULL, result->capacity * sizeof(luby_value));
+    memcpy(result->items, arr->items + n, rem * sizeof(luby_value));
+    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = result; }
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_even(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    if (out) *out = luby_bool((argv[0].as.i % 2) == 0);
+static int luby_str_capitalize(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t len = strlen(src);
+    char *dst = luby_gc_alloc_string(L, src, len);
+    if (!dst) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < len; i++) {
+        if (i == 0 && src[i] >= 'a' && src[i] <= 'z') dst[i] = (char)(src[i] - 32);
+        else if (i > 0 && src[i] >= 'A' && src[i] <= 'Z') dst[i] = (char)(src[i] + 32);
+        else dst[i] = src[i];
+    }
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_odd(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    if (out) *out = luby_bool((argv[0].as.i % 2) != 0);
+static int luby_str_strip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
+    const char *src = (const char *)argv[0].as.ptr;
+    size_t len = strlen(src);
+    size_t start = 0, end = len;
+    while (start < len && (src[start] == ' ' || src[start] == '\t' || src[start] == '\n' || src[start] == '\r')) start++;
+    while (end > start && (src[end-1] == ' ' || src[end-1] == '\t' || src[end-1] == '\n' || src[end-1] == '\r')) end--;
+    size_t new_len = end - start;
+    char *dst = luby_gc_alloc_string(L, src + start, new_len);
+    if (!dst) return (int)LUBY_E_OOM;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
     return (int)LUBY_E_OK;
 }
 
-static int luby_numeric_zero(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_INT) {
-        if (out) *out = luby_bool(argv[0].as.i == 0);
-        return (int)LUBY_E_OK;
-    }
-    if (argv[0].type == LUBY_T_FLOAT) {
-        if (out) *out = luby_bool(argv[0].as.f == 0.0);
-        return (int)LUBY_E_OK;
-    }
-    return (int)LUBY_E_TYPE;
-}
+/* ------------------------------------------------------------------ */
+/*  Struct.new(:field1, :field2, ...) → creates a new struct class     */
+/* ------------------------------------------------------------------ */
 
-static int luby_numeric_positive(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_INT) {
-        if (out) *out = luby_bool(argv[0].as.i > 0);
-        return (int)LUBY_E_OK;
-    }
-    if (argv[0].type == LUBY_T_FLOAT) {
-        if (out) *out = luby_bool(argv[0].as.f > 0.0);
-        return (int)LUBY_E_OK;
+/* Instances keep their members in inline slots (luby_object.slots), so a
+   new struct is one allocation. Readers, writers and initialize are
+   accessor procs that OP_CALL runs in place; the rest are natives that
+   index the slots directly. */
+
+// The Struct instance a native was called on, or NULL
+static luby_object *luby_struct_self(luby_state *L, int argc, const luby_value *argv) {
+    if (argc < 1 || argv[0].type != LUBY_T_OBJECT || !argv[0].as.ptr || !((luby_object *)argv[0].as.ptr)->slot_count) {
+        luby_set_error(L, LUBY_E_TYPE, "not a struct", NULL, 0, 0);
+        return NULL;
     }
-    return (int)LUBY_E_TYPE;
+    return (luby_object *)argv[0].as.ptr;
 }
 
-static int luby_numeric_negative(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_INT) {
-        if (out) *out = luby_bool(argv[0].as.i < 0);
-        return (int)LUBY_E_OK;
+// Slot for a [] / []= key: an index (negative counts from the end) or a
+// member name as symbol or string. -1 when there is no such member.
+static int luby_struct_key_slot(const luby_object *obj, luby_value key) {
+    if (key.type == LUBY_T_INT) {
+        int64_t i = key.as.i < 0 ? key.as.i + (int64_t)obj->slot_count : key.as.i;
+        return i >= 0 && (uint64_t)i < obj->slot_count ? (int)i : -1;
     }
-    if (argv[0].type == LUBY_T_FLOAT) {
-        if (out) *out = luby_bool(argv[0].as.f < 0.0);
-        return (int)LUBY_E_OK;
+    if ((key.type != LUBY_T_SYMBOL && key.type != LUBY_T_STRING) || !key.as.ptr) return -1;
+    const luby_class_obj *layout = luby_struct_layout(obj->klass);
+    for (size_t i = 0; layout && i < layout->member_count; i++) {
+        // Members are interned, so a symbol key matches by pointer
+        if (key.type == LUBY_T_SYMBOL ? layout->members[i] == key.as.ptr : strcmp(layout->members[i], (const char *)key.as.ptr) == 0) return (int)i;
     }
-    return (int)LUBY_E_TYPE;
+    return -1;
 }
 
-// ---------------------- Game math helpers -------------------------
+static int luby_struct_get(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    int slot = argc > 1 ? luby_struct_key_slot(obj, argv[1]) : -1;
+    if (out) *out = slot >= 0 ? obj->slots[slot] : luby_nil();
+    return (int)LUBY_E_OK;
+}
 
-static double luby_to_double(luby_value v) {
-    if (v.type == LUBY_T_INT) return (double)v.as.i;
-    if (v.type == LUBY_T_FLOAT) return v.as.f;
-    return 0.0;
+static int luby_struct_set(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    luby_value v = argc > 2 ? argv[2] : luby_nil();
+    int slot = argc > 1 ? luby_struct_key_slot(obj, argv[1]) : -1;
+    if (slot >= 0) obj->slots[slot] = v;
+    if (out) *out = v;
+    return (int)LUBY_E_OK;
 }
 
-static int luby_math_lerp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 3) return (int)LUBY_E_TYPE;
-    double a = luby_to_double(argv[0]);
-    double b = luby_to_double(argv[1]);
-    double t = luby_to_double(argv[2]);
-    if (out) *out = luby_float(a + (b - a) * t);
+static int luby_struct_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    luby_value arr = luby_array_new(L);
+    if (arr.type != LUBY_T_ARRAY) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < obj->slot_count; i++) {
+        if (luby_array_push_value(L, arr, obj->slots[i]) != 0) return (int)LUBY_E_OOM;
+    }
+    if (out) *out = arr;
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_inverse_lerp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 3) return (int)LUBY_E_TYPE;
-    double a = luby_to_double(argv[0]);
-    double b = luby_to_double(argv[1]);
-    double v = luby_to_double(argv[2]);
-    if (b == a) {
-        if (out) *out = luby_float(0.0);
-    } else {
-        if (out) *out = luby_float((v - a) / (b - a));
+static int luby_struct_to_h(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    const luby_class_obj *layout = luby_struct_layout(obj->klass);
+    luby_value h = luby_hash_new(L);
+    if (h.type != LUBY_T_HASH) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < obj->slot_count; i++) {
+        luby_value key; key.type = LUBY_T_SYMBOL; key.as.ptr = (void *)layout->members[i];
+        if (luby_hash_set_value(L, h, key, obj->slots[i]) != 0) return (int)LUBY_E_OOM;
     }
+    if (out) *out = h;
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_smoothstep(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 3) return (int)LUBY_E_TYPE;
-    double edge0 = luby_to_double(argv[0]);
-    double edge1 = luby_to_double(argv[1]);
-    double x = luby_to_double(argv[2]);
-    double t = (x - edge0) / (edge1 - edge0);
-    if (t < 0.0) t = 0.0;
-    if (t > 1.0) t = 1.0;
-    if (out) *out = luby_float(t * t * (3.0 - 2.0 * t));
+static int luby_struct_members(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    const luby_class_obj *layout = luby_struct_layout(obj->klass);
+    luby_value arr = luby_array_new(L);
+    if (arr.type != LUBY_T_ARRAY) return (int)LUBY_E_OOM;
+    for (size_t i = 0; i < obj->slot_count; i++) {
+        luby_value sym; sym.type = LUBY_T_SYMBOL; sym.as.ptr = (void *)layout->members[i];
+        if (luby_array_push_value(L, arr, sym) != 0) return (int)LUBY_E_OOM;
+    }
+    if (out) *out = arr;
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_clamp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 3) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    double lo = luby_to_double(argv[1]);
-    double hi = luby_to_double(argv[2]);
-    if (v < lo) v = lo;
-    if (v > hi) v = hi;
-    // Return int if all inputs were int
-    if (argv[0].type == LUBY_T_INT && argv[1].type == LUBY_T_INT && argv[2].type == LUBY_T_INT) {
-        if (out) *out = luby_int((int64_t)v);
-    } else {
-        if (out) *out = luby_float(v);
+static int luby_struct_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    for (size_t i = 0; i < obj->slot_count; i++) {
+        luby_value r;
+        int rc = luby_yield(L, 1, &obj->slots[i], &r);
+        if (rc != 0) return rc;
     }
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_wrap(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 3) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    double lo = luby_to_double(argv[1]);
-    double hi = luby_to_double(argv[2]);
-    double range = hi - lo;
-    if (range <= 0) {
-        if (out) *out = luby_float(lo);
-        return (int)LUBY_E_OK;
+// #<struct x=1, y=2>
+static int luby_struct_to_s(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    const luby_class_obj *layout = luby_struct_layout(obj->klass);
+    size_t n = obj->slot_count;
+    char **parts = (char **)luby_alloc_raw(L, NULL, n * sizeof(char *));
+    if (!parts) return (int)LUBY_E_OOM;
+    size_t total = strlen("#<struct >");
+    int ok = 1;
+    for (size_t i = 0; i < n; i++) {
+        parts[i] = ok ? luby_value_to_string(L, obj->slots[i]) : NULL;
+        if (!parts[i]) { ok = 0; continue; }
+        total += (i > 0 ? 2 : 0) + strlen(layout->members[i]) + 1 + strlen(parts[i]);
+    }
+    char *result = ok ? luby_gc_alloc_string(L, NULL, total) : NULL;
+    if (result) {
+        char *p = result;
+        memcpy(p, "#<struct ", 9); p += 9;
+        for (size_t i = 0; i < n; i++) {
+            size_t ml = strlen(layout->members[i]), vl = strlen(parts[i]);
+            if (i > 0) { memcpy(p, ", ", 2); p += 2; }
+            memcpy(p, layout->members[i], ml); p += ml;
+            *p++ = '=';
+            memcpy(p, parts[i], vl); p += vl;
+        }
+        *p++ = '>';
+        *p = '\0';
     }
-    double result = v - range * floor((v - lo) / range);
-    if (argv[0].type == LUBY_T_INT && argv[1].type == LUBY_T_INT && argv[2].type == LUBY_T_INT) {
-        if (out) *out = luby_int((int64_t)result);
-    } else {
-        if (out) *out = luby_float(result);
+    for (size_t i = 0; i < n; i++) {
+        if (parts[i]) luby_alloc_raw(L, parts[i], 0);
     }
+    luby_alloc_raw(L, parts, 0);
+    if (!result) return (int)LUBY_E_OOM;
+    if (out) { out->type = LUBY_T_STRING; out->as.ptr = result; }
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_sign(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    int64_t s = (v > 0) ? 1 : ((v < 0) ? -1 : 0);
-    if (out) *out = luby_int(s);
+// The other struct for == / eql?: an instance of exactly the same class
+static const luby_object *luby_struct_peer(const luby_object *obj, luby_value other) {
+    if (other.type != LUBY_T_OBJECT || !other.as.ptr) return NULL;
+    const luby_object *o = (const luby_object *)other.as.ptr;
+    return o->klass == obj->klass && o->slot_count == obj->slot_count ? o : NULL;
+}
+
+// Members compared with ==, dispatching to the member's own == like OP_EQ
+static int luby_struct_eq(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    const luby_object *o = argc > 1 ? luby_struct_peer(obj, argv[1]) : NULL;
+    int eq = o != NULL;
+    for (size_t i = 0; eq && o != obj && i < obj->slot_count; i++) {
+        luby_value a = obj->slots[i], b = o->slots[i];
+        if (luby_has_class_dispatch(a) && a.type != LUBY_T_VECTOR) {
+            luby_value r = luby_nil();
+            int rc = luby_invoke_method(L, a, "==", 1, &b, &r);
+            if (rc != 0) { luby_clear_error(L); eq = luby_value_eq(a, b); }
+            else eq = luby_is_truthy(r);
+        } else {
+            eq = luby_value_eq(a, b);
+        }
+    }
+    if (out) *out = luby_bool(eq);
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_min(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc == 1 && argv[0].type == LUBY_T_RANGE) return luby_range_min(L, argc, argv, out);
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double result = luby_to_double(argv[0]);
-    int all_int = (argv[0].type == LUBY_T_INT);
-    for (int i = 1; i < argc; i++) {
-        double v = luby_to_double(argv[i]);
-        if (v < result) result = v;
-        if (argv[i].type != LUBY_T_INT) all_int = 0;
+// eql? and hash agree with Hash keys and Array#uniq: members compare as keys
+static int luby_struct_eql(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    const luby_object *o = argc > 1 ? luby_struct_peer(obj, argv[1]) : NULL;
+    int eq = o != NULL;
+    for (size_t i = 0; eq && o != obj && i < obj->slot_count; i++) {
+        int rc = luby_value_key_eq_depth(L, obj->slots[i], o->slots[i], 1, &eq);
+        if (rc != 0) return rc;
     }
-    if (all_int) {
-        if (out) *out = luby_int((int64_t)result);
-    } else {
-        if (out) *out = luby_float(result);
+    if (out) *out = luby_bool(eq);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_struct_hash(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_object *obj = luby_struct_self(L, argc, argv);
+    if (!obj) return (int)LUBY_E_TYPE;
+    uint64_t h = (uint64_t)(uintptr_t)obj->klass;
+    for (size_t i = 0; i < obj->slot_count; i++) {
+        uint64_t mh;
+        int rc = luby_value_hash_depth(L, obj->slots[i], 1, 0, &mh);
+        if (rc != 0) return rc;
+        h = h * 31 + mh;
     }
+    if (out) *out = luby_int((int64_t)luby_hash_mix(h));
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_max(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc == 1 && argv[0].type == LUBY_T_RANGE) return luby_range_max(L, argc, argv, out);
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double result = luby_to_double(argv[0]);
-    int all_int = (argv[0].type == LUBY_T_INT);
-    for (int i = 1; i < argc; i++) {
-        double v = luby_to_double(argv[i]);
-        if (v > result) result = v;
-        if (argv[i].type != LUBY_T_INT) all_int = 0;
+// initialize(m0, m1, ...): the bytecode of `@m0 = m0; @m1 = m1; ...` for
+// callers that push a frame (super, send). Struct.new calls skip it.
+static luby_proc *luby_struct_init_new(luby_state *L, const luby_class_obj *cls) {
+    size_t n = cls->member_count;
+    luby_proc *proc = (luby_proc *)luby_gc_alloc(L, sizeof(luby_proc), LUBY_GC_PROC);
+    if (!proc) return NULL;
+    proc->splat_index = -1;
+    proc->visibility = LUBY_VIS_PRIVATE;
+    proc->accessor = LUBY_ACCESSOR_INIT;
+    luby_chunk_init(&proc->chunk);
+    proc->param_names = (char **)luby_alloc_raw(L, NULL, n * sizeof(char *));
+    proc->default_chunks = (luby_chunk *)luby_alloc_raw(L, NULL, n * sizeof(luby_chunk));
+    if (!proc->param_names || !proc->default_chunks) return NULL;
+    memset(proc->param_names, 0, n * sizeof(char *));
+    for (size_t i = 0; i < n; i++) luby_chunk_init(&proc->default_chunks[i]);
+    proc->param_count = n;
+    for (size_t i = 0; i < n; i++) {
+        const char *name = cls->members[i];
+        size_t len = strlen(name);
+        if (!(proc->param_names[i] = luby_dup_string(L, name, len))) return NULL;
+        char *ivar = (char *)luby_alloc_raw(L, NULL, len + 2);
+        if (!ivar) return NULL;
+        ivar[0] = '@';
+        memcpy(ivar + 1, name, len + 1);
+        luby_value ivar_sym = luby_symbol(L, ivar, len + 1);
+        luby_alloc_raw(L, ivar, 0);
+        luby_value name_sym = luby_symbol(L, name, len);
+        uint32_t k = (uint32_t)proc->chunk.const_count;
+        luby_chunk_add_const(L, &proc->chunk, name_sym);
+        luby_chunk_add_const(L, &proc->chunk, ivar_sym);
+        if (i > 0) luby_chunk_emit(L, &proc->chunk, LUBY_OP_POP, 0, 0, 0, 0);
+        luby_chunk_emit(L, &proc->chunk, LUBY_OP_GET_GLOBAL, 0, 0, k, 0);
+        luby_chunk_emit(L, &proc->chunk, LUBY_OP_SET_IVAR, 0, 0, k + 1, 0);
+    }
+    luby_chunk_emit(L, &proc->chunk, LUBY_OP_RET, 0, 0, 0, 0);
+    if (proc->chunk.const_count != 2 * n || proc->chunk.count != 3 * n) return NULL;
+    return proc;
+}
+
+static int luby_struct_create_class(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    /* argv[0] = Struct class (receiver), argv[1..] = symbol names */
+    int field_count = argc - 1;
+    if (field_count < 1) {
+        luby_set_error(L, LUBY_E_TYPE, "wrong number of arguments for Struct.new", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (all_int) {
-        if (out) *out = luby_int((int64_t)result);
-    } else {
-        if (out) *out = luby_float(result);
+    for (int i = 0; i < field_count; i++) {
+        if (argv[i + 1].type != LUBY_T_SYMBOL || !argv[i + 1].as.ptr) {
+            luby_set_error(L, LUBY_E_TYPE, "expected symbol for Struct field", NULL, 0, 0);
+            return (int)LUBY_E_TYPE;
+        }
+        for (int j = 0; j < i; j++) {
+            if (argv[j + 1].as.ptr == argv[i + 1].as.ptr) {
+                luby_set_error(L, LUBY_E_TYPE, "duplicate member in Struct.new", NULL, 0, 0);
+                return (int)LUBY_E_TYPE;
+            }
+        }
     }
+    /* Generate unique class name */
+    static int struct_counter = 0;
+    char class_name[64];
+    snprintf(class_name, sizeof(class_name), "Struct__%d", struct_counter++);
+
+    luby_class_obj *cls = luby_class_new(L, class_name, NULL);
+    if (!cls) return (int)LUBY_E_OOM;
+    luby_value cv; cv.type = LUBY_T_CLASS; cv.as.ptr = cls;
+    luby_set_global_value(L, class_name, cv);   // roots the class while it is built
+
+    cls->members = (const char **)luby_alloc_raw(L, NULL, (size_t)field_count * sizeof(const char *));
+    if (!cls->members) return (int)LUBY_E_OOM;
+    for (int i = 0; i < field_count; i++) cls->members[i] = (const char *)argv[i + 1].as.ptr;
+    cls->member_count = (size_t)field_count;
+
+    luby_proc *init = luby_struct_init_new(L, cls);
+    if (!init) return (int)LUBY_E_OOM;
+    luby_class_set_method(L, cls, "initialize", init);
+    for (int i = 0; i < field_count; i++) {
+        const char *name = cls->members[i];
+        size_t len = strlen(name);
+        char *setter = (char *)luby_alloc_raw(L, NULL, len + 2);
+        if (!setter) return (int)LUBY_E_OOM;
+        memcpy(setter, name, len);
+        setter[len] = '=';
+        setter[len + 1] = '\0';
+        const char *setter_name = luby_intern_symbol(L, setter, len + 1);
+        luby_alloc_raw(L, setter, 0);
+        luby_proc *reader = luby_accessor_new(L, name, LUBY_ACCESSOR_READER);
+        if (!reader) return (int)LUBY_E_OOM;
+        reader->slot = i + 1;
+        luby_class_set_method(L, cls, name, reader);
+        luby_proc *writer = setter_name ? luby_accessor_new(L, name, LUBY_ACCESSOR_WRITER) : NULL;
+        if (!writer) return (int)LUBY_E_OOM;
+        writer->slot = i + 1;
+        luby_class_set_method(L, cls, setter_name, writer);
+    }
+    luby_class_set_cmethod(L, cls, "[]", luby_struct_get);
+    luby_class_set_cmethod(L, cls, "[]=", luby_struct_set);
+    luby_class_set_cmethod(L, cls, "to_a", luby_struct_to_a);
+    luby_class_set_cmethod(L, cls, "to_h", luby_struct_to_h);
+    luby_class_set_cmethod(L, cls, "members", luby_struct_members);
+    luby_class_set_cmethod(L, cls, "each", luby_struct_each);
+    luby_class_set_cmethod(L, cls, "to_s", luby_struct_to_s);
+    luby_class_set_cmethod(L, cls, "==", luby_struct_eq);
+    luby_class_set_cmethod(L, cls, "eql?", luby_struct_eql);
+    luby_class_set_cmethod(L, cls, "hash", luby_struct_hash);
+
+    if (out) *out = cv;
     return (int)LUBY_E_OK;
 }
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
+// ---------------------------- Native Enumerable ----------------------------
+//
+// Enumerable methods stream the receiver's elements into a C step function.
+// When the class's each is the usual `@items.each { |x| blk.call(x) }` over an
+// Array or Integer Range, the elements are read straight from the ivar.
+// Otherwise the user's each runs with the __enum_drive helper's block, which
+// hands every element to __enum_yield and breaks out once the step is done.
 
-static int luby_math_deg_to_rad(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double deg = luby_to_double(argv[0]);
-    if (out) *out = luby_float(deg * M_PI / 180.0);
+typedef struct luby_enumerable_run luby_enumerable_run;
+typedef int (*luby_enumerable_step)(luby_state *L, luby_enumerable_run *run, luby_value elem);
+
+enum { ENUMERABLE_NEXT = 0, ENUMERABLE_STOP = 1 };
+
+/* Pinned slots on the run's VM, which roots them while user code runs */
+enum {
+    ENUMERABLE_SELF,
+    ENUMERABLE_BLOCK,
+    ENUMERABLE_SOURCE,
+    ENUMERABLE_ACC,     // result being built (array, accumulator, best element)
+    ENUMERABLE_AUX,     // method argument or best key
+    ENUMERABLE_BREAK,   // value of a break out of the user's block
+    ENUMERABLE_SLOTS
+};
+
+struct luby_enumerable_run {
+    luby_enumerable_step step;
+    luby_proc *block;
+    int mode;            // step variant (select vs reject, any? vs all?)
+    int64_t index;       // elements fed so far
+    int64_t count;       // elements kept or matched so far
+    int64_t limit;       // n for first/take/drop
+    int rc;
+    int done;
+    luby_vm vm;          // block calls run here; stack[0..ENUMERABLE_SLOTS) are pinned
+    void *saved_vm;
+    luby_enumerable_run *prev;
+};
+
+#define ENUMERABLE_SLOT(run, i) ((run)->vm.stack[(i)])
+
+static int enumerable_begin(luby_state *L, luby_enumerable_run *run, luby_value self, luby_proc *block, luby_enumerable_step step) {
+    memset(run, 0, sizeof(*run));
+    run->step = step;
+    run->block = block;
+    luby_vm_init(&run->vm);
+    if (!luby_vm_ensure_stack(L, &run->vm, ENUMERABLE_SLOTS)) {
+        luby_vm_free(L, &run->vm);
+        return (int)LUBY_E_OOM;
+    }
+    for (int i = 0; i < ENUMERABLE_SLOTS; i++) run->vm.stack[i] = luby_nil();
+    run->vm.stack[ENUMERABLE_SELF] = self;
+    if (block) {
+        run->vm.stack[ENUMERABLE_BLOCK].type = LUBY_T_PROC;
+        run->vm.stack[ENUMERABLE_BLOCK].as.ptr = block;
+    }
+    run->vm.sp = run->vm.pinned = ENUMERABLE_SLOTS;
+    run->saved_vm = L->current_vm;
+    L->current_vm = &run->vm;
+    luby_gc_link_vm(L, &run->vm);
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_rad_to_deg(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double rad = luby_to_double(argv[0]);
-    if (out) *out = luby_float(rad * 180.0 / M_PI);
-    return (int)LUBY_E_OK;
+/* Release a run started by enumerable_begin and hand back `result`, or the
+   value of a break out of the user's block */
+static int enumerable_finish(luby_state *L, luby_enumerable_run *run, luby_value result, luby_value *out) {
+    int rc = run->rc;
+    if (rc == (int)LUBY_E_BREAK) {
+        result = ENUMERABLE_SLOT(run, ENUMERABLE_BREAK);
+        rc = (int)LUBY_E_OK;
+    }
+    L->current_vm = run->saved_vm;
+    luby_vm_free(L, &run->vm);
+    if (rc == 0 && out) *out = result;
+    return rc;
 }
 
-static int luby_math_sin(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(sin(v));
-    return (int)LUBY_E_OK;
+static int enumerable_call(luby_state *L, luby_enumerable_run *run, int argc, const luby_value *argv, luby_value *res) {
+    int rc = luby_call_block_on(L, &run->vm, run->block, argc, argv, res);
+    if (rc == 0) return 1;
+    if (rc == (int)LUBY_E_BREAK) {
+        ENUMERABLE_SLOT(run, ENUMERABLE_BREAK) = L->block_break_value;
+        L->block_break = 0;
+    }
+    run->rc = rc;
+    return 0;
+}
+
+static void enumerable_feed(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    int r = run->step(L, run, elem);
+    run->index++;
+    if (r == ENUMERABLE_STOP || run->rc != 0) run->done = 1;
+}
+
+/* Direct iteration is charged one instruction per element, like lazy_tick */
+static int enumerable_tick(luby_state *L, luby_enumerable_run *run) {
+    L->instruction_count++;
+    if (L->instruction_limit > 0 && L->instruction_count > L->instruction_limit) {
+        luby_set_error(L, LUBY_E_RUNTIME, "instruction limit exceeded", "<enumerable>", 0, 0);
+        run->rc = (int)LUBY_E_RUNTIME;
+        run->done = 1;
+        return 0;
+    }
+    return 1;
 }
 
-static int luby_math_cos(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(cos(v));
-    return (int)LUBY_E_OK;
+static int enumerable_is_symbol(const luby_chunk *c, uint32_t k, const char *name) {
+    if (k >= c->const_count) return 0;
+    luby_value v = c->consts[k];
+    if ((v.type != LUBY_T_SYMBOL && v.type != LUBY_T_STRING) || !v.as.ptr) return 0;
+    return !name || strcmp((const char *)v.as.ptr, name) == 0;
+}
+
+/* Is `m` exactly `def each(&blk) @ivar.each { |x| blk.call(x) } end`,
+   optionally ending in `self`? On a match, returns the ivar's name. */
+static const char *enumerable_forwarded_ivar(const luby_proc *m) {
+    if (!m->has_block_param || !m->block_param_name || m->param_count != 0 ||
+        m->splat_index >= 0 || m->kwarg_count != 0) return NULL;
+    const luby_chunk *c = &m->chunk;
+    size_t n = c->count;
+    if (n > 0 && c->code[n - 1].op == LUBY_OP_RET) n--;
+    if (n == 5) {
+        if (c->code[3].op != LUBY_OP_POP || c->code[4].op != LUBY_OP_GET_GLOBAL ||
+            !enumerable_is_symbol(c, c->code[4].c, "self")) return NULL;
+    } else if (n != 3) {
+        return NULL;
+    }
+    const luby_inst *code = c->code;
+    if (code[0].op != LUBY_OP_GET_IVAR || !enumerable_is_symbol(c, code[0].c, NULL)) return NULL;
+    if (code[1].op != LUBY_OP_SET_BLOCK || code[1].c >= c->const_count) return NULL;
+    if (code[2].op != LUBY_OP_CALL || code[2].a != 1 || code[2].b != 1 ||
+        !enumerable_is_symbol(c, code[2].c, "each")) return NULL;
+
+    luby_value bv = c->consts[code[1].c];
+    if (bv.type != LUBY_T_PROC || !bv.as.ptr) return NULL;
+    const luby_proc *bp = (const luby_proc *)bv.as.ptr;
+    if (bp->param_count != 1 || bp->splat_index >= 0 || bp->has_block_param) return NULL;
+    const luby_chunk *bc = &bp->chunk;
+    size_t bn = bc->count;
+    if (bn > 0 && bc->code[bn - 1].op == LUBY_OP_RET) bn--;
+    if (bn != 4) return NULL;
+    if (bc->code[0].op != LUBY_OP_GET_GLOBAL || !enumerable_is_symbol(bc, bc->code[0].c, m->block_param_name)) return NULL;
+    if (bc->code[1].op != LUBY_OP_GET_GLOBAL || !enumerable_is_symbol(bc, bc->code[1].c, bp->param_names[0])) return NULL;
+    if (bc->code[2].op != LUBY_OP_SET_BLOCK || bc->code[2].c >= bc->const_count ||
+        bc->consts[bc->code[2].c].type != LUBY_T_NIL) return NULL;
+    if (bc->code[3].op != LUBY_OP_CALL || bc->code[3].a != 2 || bc->code[3].b != 1 ||
+        !enumerable_is_symbol(bc, bc->code[3].c, "call")) return NULL;
+    return (const char *)c->consts[code[0].c].as.ptr;
+}
+
+static int luby_collection_each(luby_state *L, int argc, const luby_value *argv, luby_value *out);
+
+/* The Array or Integer Range that self's each forwards, if any */
+static int enumerable_direct_source(luby_state *L, luby_value self, luby_value *src) {
+    if (self.type != LUBY_T_OBJECT || !self.as.ptr) return 0;
+    luby_object *obj = (luby_object *)self.as.ptr;
+    if (luby_object_get_singleton_method(obj, "each")) return 0;
+    luby_value mv = luby_class_lookup_method(L, obj->klass, "each");
+    if (mv.type == LUBY_T_CMETHOD && mv.as.ptr && ((luby_cmethod *)mv.as.ptr)->fn == luby_collection_each) {
+        // Set and PriorityQueue: their elements are the hidden _items Array
+        luby_value items = luby_nil();
+        luby_enum_get_field(L, obj, "_items", &items);
+        if (items.type != LUBY_T_ARRAY || !items.as.ptr) return 0;
+        *src = items;
+        return 1;
+    }
+    if (mv.type != LUBY_T_PROC || !mv.as.ptr) return 0;
+    const char *ivar = enumerable_forwarded_ivar((const luby_proc *)mv.as.ptr);
+    if (!ivar) return 0;
+    for (size_t i = 0; i < obj->ivar_count; i++) {
+        if (strcmp(obj->ivar_names[i], ivar) != 0) continue;
+        luby_value v = obj->ivar_values[i];
+        int64_t start, end;
+        if (v.type == LUBY_T_ARRAY && v.as.ptr) { *src = v; return 1; }
+        if (v.type == LUBY_T_RANGE && v.as.ptr && luby_range_int_bounds((luby_range *)v.as.ptr, &start, &end)) {
+            *src = v;
+            return 1;
+        }
+        return 0;
+    }
+    return 0;
 }
 
-static int luby_math_tan(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(tan(v));
-    return (int)LUBY_E_OK;
+static void enumerable_drive(luby_state *L, luby_enumerable_run *run) {
+    luby_value self = ENUMERABLE_SLOT(run, ENUMERABLE_SELF);
+    luby_value src = luby_nil();
+    if (run->done) return;
+    if (self.type == LUBY_T_BUFFER && self.as.ptr) {
+        // Typed arrays have a fixed length; elements are boxed one at a time
+        const luby_buffer *b = (const luby_buffer *)self.as.ptr;
+        for (size_t i = 0; i < b->length && !run->done; i++) {
+            if (!enumerable_tick(L, run)) return;
+            enumerable_feed(L, run, luby_buffer_value(b, i));
+        }
+        return;
+    }
+    if (enumerable_direct_source(L, self, &src)) {
+        ENUMERABLE_SLOT(run, ENUMERABLE_SOURCE) = src;
+        if (src.type == LUBY_T_ARRAY) {
+            // Re-read the array each step: the block may resize it
+            luby_array *arr = (luby_array *)src.as.ptr;
+            for (size_t i = 0; i < arr->count && !run->done; i++) {
+                if (!enumerable_tick(L, run)) return;
+                enumerable_feed(L, run, arr->items[i]);
+            }
+        } else {
+            int64_t start, end;
+            luby_range_int_bounds((luby_range *)src.as.ptr, &start, &end);
+            for (int64_t i = start; i <= end && !run->done; i++) {
+                if (!enumerable_tick(L, run)) return;
+                enumerable_feed(L, run, luby_int(i));
+                if (i == INT64_MAX) break;
+            }
+        }
+        return;
+    }
+
+    run->prev = L->enumerable_run;
+    L->enumerable_run = run;
+    luby_value ignored = luby_nil();
+    int rc = luby_invoke_method(L, self, "__enum_drive", 0, NULL, &ignored);
+    L->enumerable_run = run->prev;
+    // The helper breaks out of each once the step is done
+    if (rc == (int)LUBY_E_BREAK) {
+        L->block_break = 0;
+        rc = 0;
+    }
+    if (rc != 0 && run->rc == 0) run->rc = rc;
 }
 
-static int luby_math_asin(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(asin(v));
+// __enum_yield(x): feed one element of a user each to the innermost run.
+// Returns true once the run needs no more elements.
+static int luby_enumerable_yield(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_enumerable_run *run = L->enumerable_run;
+    if (!run) {
+        luby_set_error(L, LUBY_E_RUNTIME, "__enum_yield called outside an Enumerable method", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
+    }
+    if (!run->done) {
+        enumerable_feed(L, run, argc > 0 ? argv[0] : luby_nil());
+        if (run->rc != 0 && run->rc != (int)LUBY_E_BREAK) return run->rc;
+    }
+    if (out) *out = luby_bool(run->done);
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_acos(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(acos(v));
-    return (int)LUBY_E_OK;
+/* Three-way comparison for sort, min and max: numbers and strings directly,
+   objects through their <=> */
+static int enumerable_compare(luby_state *L, luby_value a, luby_value b, int *cmp) {
+    if (a.type == LUBY_T_INT && b.type == LUBY_T_INT) {
+        *cmp = (a.as.i > b.as.i) - (a.as.i < b.as.i);
+        return (int)LUBY_E_OK;
+    }
+    if ((a.type == LUBY_T_INT || a.type == LUBY_T_FLOAT) && (b.type == LUBY_T_INT || b.type == LUBY_T_FLOAT)) {
+        double da = (a.type == LUBY_T_FLOAT) ? a.as.f : (double)a.as.i;
+        double db = (b.type == LUBY_T_FLOAT) ? b.as.f : (double)b.as.i;
+        *cmp = (da > db) - (da < db);
+        return (int)LUBY_E_OK;
+    }
+    if ((a.type == LUBY_T_STRING || a.type == LUBY_T_SYMBOL) && a.type == b.type) {
+        int c = strcmp(a.as.ptr ? (const char *)a.as.ptr : "", b.as.ptr ? (const char *)b.as.ptr : "");
+        *cmp = (c > 0) - (c < 0);
+        return (int)LUBY_E_OK;
+    }
+    if (luby_has_class_dispatch(a)) {
+        luby_value r = luby_nil();
+        int rc = luby_invoke_method(L, a, "<=>", 1, &b, &r);
+        if (rc != 0) return rc;
+        if (r.type == LUBY_T_INT) { *cmp = (r.as.i > 0) - (r.as.i < 0); return (int)LUBY_E_OK; }
+    }
+    luby_set_error(L, LUBY_E_TYPE, "comparison failed", NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
 }
 
-static int luby_math_atan(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(atan(v));
-    return (int)LUBY_E_OK;
+/* == as the VM's OP_EQ sees it: objects through their == method */
+static int enumerable_equal(luby_state *L, luby_value a, luby_value b) {
+    if (!luby_has_class_dispatch(a)) return luby_value_eq(a, b);
+    luby_value r = luby_nil();
+    if (luby_invoke_method(L, a, "==", 1, &b, &r) == 0) return luby_is_truthy(r);
+    luby_clear_error(L);
+    return luby_value_eq(a, b);
 }
 
-static int luby_math_atan2(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    double y = luby_to_double(argv[0]);
-    double x = luby_to_double(argv[1]);
-    if (out) *out = luby_float(atan2(y, x));
-    return (int)LUBY_E_OK;
+static int enumerable_push(luby_state *L, luby_enumerable_run *run, luby_value v) {
+    if (luby_array_push_value(L, ENUMERABLE_SLOT(run, ENUMERABLE_ACC), v) != 0) {
+        run->rc = (int)LUBY_E_OOM;
+        return ENUMERABLE_STOP;
+    }
+    return ENUMERABLE_NEXT;
 }
 
-static int luby_math_sqrt(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(sqrt(v));
-    return (int)LUBY_E_OK;
+static int enumerable_step_collect(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    return enumerable_push(L, run, elem);
 }
 
-static int luby_math_pow(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    double base = luby_to_double(argv[0]);
-    double exp = luby_to_double(argv[1]);
-    if (out) *out = luby_float(pow(base, exp));
-    return (int)LUBY_E_OK;
+static int enumerable_step_map(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value res = luby_nil();
+    if (!enumerable_call(L, run, 1, &elem, &res)) return ENUMERABLE_STOP;
+    return enumerable_push(L, run, res);
 }
 
-static int luby_math_log(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(log(v));
-    return (int)LUBY_E_OK;
+static int enumerable_step_flat_map(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value res = luby_nil();
+    if (!enumerable_call(L, run, 1, &elem, &res)) return ENUMERABLE_STOP;
+    if (res.type != LUBY_T_ARRAY || !res.as.ptr) return enumerable_push(L, run, res);
+    luby_array *sub = (luby_array *)res.as.ptr;
+    // The block's array is only referenced from here while it is copied
+    int was_paused = L->gc_paused; L->gc_paused = 1;
+    int r = ENUMERABLE_NEXT;
+    for (size_t i = 0; i < sub->count && r == ENUMERABLE_NEXT; i++) r = enumerable_push(L, run, sub->items[i]);
+    L->gc_paused = was_paused;
+    return r;
 }
 
-static int luby_math_exp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 1) return (int)LUBY_E_TYPE;
-    double v = luby_to_double(argv[0]);
-    if (out) *out = luby_float(exp(v));
-    return (int)LUBY_E_OK;
+// mode 1 keeps elements the block accepts (select), mode 0 the rest (reject)
+static int enumerable_step_filter(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value res = luby_nil();
+    if (!enumerable_call(L, run, 1, &elem, &res)) return ENUMERABLE_STOP;
+    if (luby_is_truthy(res) != run->mode) return ENUMERABLE_NEXT;
+    return enumerable_push(L, run, elem);
 }
 
-static int luby_math_distance(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 4) return (int)LUBY_E_TYPE;
-    double x1 = luby_to_double(argv[0]);
-    double y1 = luby_to_double(argv[1]);
-    double x2 = luby_to_double(argv[2]);
-    double y2 = luby_to_double(argv[3]);
-    double dx = x2 - x1;
-    double dy = y2 - y1;
-    if (out) *out = luby_float(sqrt(dx * dx + dy * dy));
-    return (int)LUBY_E_OK;
+static int enumerable_step_find(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value res = luby_nil();
+    if (!enumerable_call(L, run, 1, &elem, &res)) return ENUMERABLE_STOP;
+    if (!luby_is_truthy(res)) return ENUMERABLE_NEXT;
+    ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = elem;
+    return ENUMERABLE_STOP;
 }
 
-static int luby_math_distance_squared(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 4) return (int)LUBY_E_TYPE;
-    double x1 = luby_to_double(argv[0]);
-    double y1 = luby_to_double(argv[1]);
-    double x2 = luby_to_double(argv[2]);
-    double y2 = luby_to_double(argv[3]);
-    double dx = x2 - x1;
-    double dy = y2 - y1;
-    if (out) *out = luby_float(dx * dx + dy * dy);
-    return (int)LUBY_E_OK;
+enum { ENUMERABLE_ANY, ENUMERABLE_ALL, ENUMERABLE_NONE };
+
+/* any?/all?/none? stop at the first element that decides the answer */
+static int enumerable_step_test(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value res = elem;
+    if (run->block && !enumerable_call(L, run, 1, &elem, &res)) return ENUMERABLE_STOP;
+    int truthy = luby_is_truthy(res);
+    if (run->mode == ENUMERABLE_ALL ? truthy : !truthy) return ENUMERABLE_NEXT;
+    ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = luby_bool(run->mode == ENUMERABLE_ANY);
+    return ENUMERABLE_STOP;
 }
 
-static int luby_math_normalize(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    double x = luby_to_double(argv[0]);
-    double y = luby_to_double(argv[1]);
-    double len = sqrt(x * x + y * y);
-    luby_value arrv = luby_array_new(L);
-    if (arrv.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
-    if (len > 0) {
-        luby_array_push_value(L, arrv, luby_float(x / len));
-        luby_array_push_value(L, arrv, luby_float(y / len));
+// mode 0 counts everything, 1 block matches, 2 elements == the argument
+static int enumerable_step_count(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    if (run->mode == 1) {
+        luby_value res = luby_nil();
+        if (!enumerable_call(L, run, 1, &elem, &res)) return ENUMERABLE_STOP;
+        if (!luby_is_truthy(res)) return ENUMERABLE_NEXT;
+    } else if (run->mode == 2) {
+        if (!enumerable_equal(L, elem, ENUMERABLE_SLOT(run, ENUMERABLE_AUX))) return ENUMERABLE_NEXT;
+    }
+    run->count++;
+    return ENUMERABLE_NEXT;
+}
+
+static int enumerable_step_include(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    if (!enumerable_equal(L, elem, ENUMERABLE_SLOT(run, ENUMERABLE_AUX))) return ENUMERABLE_NEXT;
+    ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = luby_bool(1);
+    return ENUMERABLE_STOP;
+}
+
+static int enumerable_step_first(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    if (enumerable_push(L, run, elem) == ENUMERABLE_STOP) return ENUMERABLE_STOP;
+    return (++run->count >= run->limit) ? ENUMERABLE_STOP : ENUMERABLE_NEXT;
+}
+
+static int enumerable_step_drop(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    if (run->index < run->limit) return ENUMERABLE_NEXT;
+    return enumerable_push(L, run, elem);
+}
+
+static int enumerable_step_with_index(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value args[2] = { elem, luby_int(run->index) };
+    luby_value res = luby_nil();
+    return enumerable_call(L, run, 2, args, &res) ? ENUMERABLE_NEXT : ENUMERABLE_STOP;
+}
+
+static int enumerable_step_with_object(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value args[2] = { elem, ENUMERABLE_SLOT(run, ENUMERABLE_AUX) };
+    luby_value res = luby_nil();
+    return enumerable_call(L, run, 2, args, &res) ? ENUMERABLE_NEXT : ENUMERABLE_STOP;
+}
+
+/* reduce without an initial value starts from the first element */
+static int enumerable_step_reduce(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    if (run->count++ == 0 && !run->mode) {
+        ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = elem;
+        return ENUMERABLE_NEXT;
+    }
+    luby_value args[2] = { ENUMERABLE_SLOT(run, ENUMERABLE_ACC), elem };
+    luby_value res = luby_nil();
+    if (!enumerable_call(L, run, 2, args, &res)) return ENUMERABLE_STOP;
+    ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = res;
+    return ENUMERABLE_NEXT;
+}
+
+static int enumerable_step_sum(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value v = elem;
+    if (run->block && !enumerable_call(L, run, 1, &elem, &v)) return ENUMERABLE_STOP;
+    luby_value acc = ENUMERABLE_SLOT(run, ENUMERABLE_ACC);
+    if (acc.type == LUBY_T_INT && v.type == LUBY_T_INT) {
+        acc.as.i += v.as.i;
+    } else if ((acc.type == LUBY_T_INT || acc.type == LUBY_T_FLOAT) && (v.type == LUBY_T_INT || v.type == LUBY_T_FLOAT)) {
+        double a = (acc.type == LUBY_T_FLOAT) ? acc.as.f : (double)acc.as.i;
+        acc.type = LUBY_T_FLOAT;
+        acc.as.f = a + ((v.type == LUBY_T_FLOAT) ? v.as.f : (double)v.as.i);
+    } else if (acc.type == LUBY_T_STRING && v.type == LUBY_T_STRING) {
+        size_t la = strlen((const char *)acc.as.ptr), lb = strlen((const char *)v.as.ptr);
+        char *buf = (char *)luby_alloc_raw(L, NULL, la + lb + 1);
+        if (!buf) { run->rc = (int)LUBY_E_OOM; return ENUMERABLE_STOP; }
+        memcpy(buf, acc.as.ptr, la);
+        memcpy(buf + la, v.as.ptr, lb);
+        acc = luby_string(L, buf, la + lb);
+        luby_alloc_raw(L, buf, 0);
+    } else if (luby_has_class_dispatch(acc)) {
+        int rc = luby_invoke_method(L, acc, "+", 1, &v, &acc);
+        if (rc != 0) { run->rc = rc; return ENUMERABLE_STOP; }
     } else {
-        luby_array_push_value(L, arrv, luby_float(0.0));
-        luby_array_push_value(L, arrv, luby_float(0.0));
+        luby_set_error(L, LUBY_E_TYPE, "sum: cannot add element", NULL, 0, 0);
+        run->rc = (int)LUBY_E_TYPE;
+        return ENUMERABLE_STOP;
+    }
+    ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = acc;
+    return ENUMERABLE_NEXT;
+}
+
+/* min/max (mode -1/1) keep the best element; min_by/max_by (with a block)
+   also keep its key in AUX */
+static int enumerable_step_extreme(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value key = elem;
+    if (run->block && !enumerable_call(L, run, 1, &elem, &key)) return ENUMERABLE_STOP;
+    if (run->count++ > 0) {
+        luby_value best = run->block ? ENUMERABLE_SLOT(run, ENUMERABLE_AUX) : ENUMERABLE_SLOT(run, ENUMERABLE_ACC);
+        int cmp = 0;
+        int rc = enumerable_compare(L, key, best, &cmp);
+        if (rc != 0) { run->rc = rc; return ENUMERABLE_STOP; }
+        if (cmp * run->mode <= 0) return ENUMERABLE_NEXT;
+    }
+    ENUMERABLE_SLOT(run, ENUMERABLE_ACC) = elem;
+    ENUMERABLE_SLOT(run, ENUMERABLE_AUX) = key;
+    return ENUMERABLE_NEXT;
+}
+
+/* sort_by collects elements into ACC and their keys into AUX */
+static int enumerable_step_keyed(luby_state *L, luby_enumerable_run *run, luby_value elem) {
+    luby_value key = luby_nil();
+    if (!enumerable_call(L, run, 1, &elem, &key)) return ENUMERABLE_STOP;
+    if (luby_array_push_value(L, ENUMERABLE_SLOT(run, ENUMERABLE_AUX), key) != 0) {
+        run->rc = (int)LUBY_E_OOM;
+        return ENUMERABLE_STOP;
+    }
+    return enumerable_push(L, run, elem);
+}
+
+/* Stable merge sort of ACC by the keys in `keys` (ACC itself for sort);
+   returns the sorted copy */
+static int enumerable_sorted(luby_state *L, luby_enumerable_run *run, luby_value keys, luby_value *out) {
+    luby_array *items = (luby_array *)ENUMERABLE_SLOT(run, ENUMERABLE_ACC).as.ptr;
+    size_t n = items->count;
+    if (n < 2) { *out = ENUMERABLE_SLOT(run, ENUMERABLE_ACC); return (int)LUBY_E_OK; }
+    size_t *idx = (size_t *)luby_alloc_raw(L, NULL, 2 * n * sizeof(size_t));
+    if (!idx) return (int)LUBY_E_OOM;
+    size_t *tmp = idx + n;
+    for (size_t i = 0; i < n; i++) idx[i] = i;
+    int rc = 0;
+    for (size_t width = 1; width < n && rc == 0; width *= 2) {
+        for (size_t lo = 0; lo < n && rc == 0; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                // Keys are re-read each time: a user <=> may touch the array
+                luby_array *ka = (luby_array *)keys.as.ptr;
+                if (idx[i] >= ka->count || idx[j] >= ka->count) { rc = (int)LUBY_E_RUNTIME; break; }
+                int cmp = 0;
+                rc = enumerable_compare(L, ka->items[idx[j]], ka->items[idx[i]], &cmp);
+                if (rc != 0) break;
+                tmp[k++] = (cmp < 0) ? idx[j++] : idx[i++];
+            }
+            if (rc != 0) break;
+            while (i < mid) tmp[k++] = idx[i++];
+            while (j < hi) tmp[k++] = idx[j++];
+        }
+        if (rc == 0) { size_t *t = idx; idx = tmp; tmp = t; }
     }
-    if (out) *out = arrv;
-    return (int)LUBY_E_OK;
+    if (rc == 0) {
+        luby_value sorted = luby_array_new(L);
+        luby_array *dst = (luby_array *)sorted.as.ptr;
+        if (!dst || !luby_array_reserve(L, dst, n)) {
+            rc = (int)LUBY_E_OOM;
+        } else {
+            items = (luby_array *)ENUMERABLE_SLOT(run, ENUMERABLE_ACC).as.ptr;
+            for (size_t i = 0; i < n; i++) dst->items[i] = idx[i] < items->count ? items->items[idx[i]] : luby_nil();
+            dst->count = n;
+            *out = sorted;
+        }
+    }
+    luby_alloc_raw(L, idx < tmp ? idx : tmp, 0);
+    if (rc == (int)LUBY_E_RUNTIME && L->last_error.code == LUBY_E_OK) {
+        luby_set_error(L, LUBY_E_RUNTIME, "array modified during sort", NULL, 0, 0);
+    }
+    return rc;
 }
 
-static int luby_math_dot(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 4) return (int)LUBY_E_TYPE;
-    double x1 = luby_to_double(argv[0]);
-    double y1 = luby_to_double(argv[1]);
-    double x2 = luby_to_double(argv[2]);
-    double y2 = luby_to_double(argv[3]);
-    if (out) *out = luby_float(x1 * x2 + y1 * y2);
-    return (int)LUBY_E_OK;
+static luby_proc *enumerable_block(luby_state *L) {
+    return (L->current_block.type == LUBY_T_PROC) ? (luby_proc *)L->current_block.as.ptr : NULL;
 }
 
-static int luby_math_cross(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 4) return (int)LUBY_E_TYPE;
-    double x1 = luby_to_double(argv[0]);
-    double y1 = luby_to_double(argv[1]);
-    double x2 = luby_to_double(argv[2]);
-    double y2 = luby_to_double(argv[3]);
-    if (out) *out = luby_float(x1 * y2 - y1 * x2);
+static int enumerable_new_array(luby_state *L, luby_enumerable_run *run, int slot) {
+    luby_value arr = luby_array_new(L);
+    if (arr.type != LUBY_T_ARRAY || !arr.as.ptr) return (int)LUBY_E_OOM;
+    ENUMERABLE_SLOT(run, slot) = arr;
     return (int)LUBY_E_OK;
 }
 
-static int luby_math_angle(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    double x = luby_to_double(argv[0]);
-    double y = luby_to_double(argv[1]);
-    if (out) *out = luby_float(atan2(y, x));
-    return (int)LUBY_E_OK;
+/* Run `step` over self with an empty array in ACC and return that array */
+static int enumerable_collect_with(luby_state *L, luby_value self, luby_proc *block, luby_enumerable_step step, int mode, luby_value *out) {
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, self, block, step);
+    if (rc != 0) return rc;
+    rc = enumerable_new_array(L, &run, ENUMERABLE_ACC);
+    if (rc != 0) { run.rc = rc; return enumerable_finish(L, &run, luby_nil(), out); }
+    run.mode = mode;
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
 }
 
-static int luby_math_fmod(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    double a = luby_to_double(argv[0]);
-    double b = luby_to_double(argv[1]);
-    if (b == 0) {
-        if (out) *out = luby_float(0.0);
-    } else {
-        if (out) *out = luby_float(fmod(a, b));
-    }
-    return (int)LUBY_E_OK;
+#define ENUMERABLE_NEED_SELF(argc) do { if ((argc) < 1) return (int)LUBY_E_TYPE; } while (0)
+#define ENUMERABLE_NEED_BLOCK(block) do { \
+        if (!(block)) { luby_set_error(L, LUBY_E_TYPE, "no block given", NULL, 0, 0); return (int)LUBY_E_TYPE; } \
+    } while (0)
+
+static int luby_enumerable_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    return enumerable_collect_with(L, argv[0], NULL, enumerable_step_collect, 0, out);
 }
 
-// ---------------------- Seeded RNG (xoroshiro128+) -------------------------
+static int luby_enumerable_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    return enumerable_collect_with(L, argv[0], block, enumerable_step_map, 0, out);
+}
 
-static uint64_t luby_rng_rotl(uint64_t x, int k) {
-    return (x << k) | (x >> (64 - k));
+static int luby_enumerable_flat_map(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    return enumerable_collect_with(L, argv[0], block, enumerable_step_flat_map, 0, out);
 }
 
-static uint64_t luby_rng_next(luby_state *L) {
-    uint64_t s0 = L->rng_state[0];
-    uint64_t s1 = L->rng_state[1];
-    uint64_t result = s0 + s1;
-    s1 ^= s0;
-    L->rng_state[0] = luby_rng_rotl(s0, 24) ^ s1 ^ (s1 << 16);
-    L->rng_state[1] = luby_rng_rotl(s1, 37);
-    return result;
+static int luby_enumerable_select(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    return enumerable_collect_with(L, argv[0], block, enumerable_step_filter, 1, out);
 }
 
-static double luby_rng_double(luby_state *L) {
-    uint64_t r = luby_rng_next(L);
-    return (double)(r >> 11) * (1.0 / (double)(1ULL << 53));
+static int luby_enumerable_reject(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    return enumerable_collect_with(L, argv[0], block, enumerable_step_filter, 0, out);
 }
 
-static int luby_rng_srand(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    uint64_t seed = 0;
-    if (argc >= 1) {
-        if (argv[0].type == LUBY_T_INT) seed = (uint64_t)argv[0].as.i;
-        else if (argv[0].type == LUBY_T_FLOAT) seed = (uint64_t)argv[0].as.f;
-    }
-    // SplitMix64 to initialize state from seed
-    seed += 0x9e3779b97f4a7c15ULL;
-    uint64_t z = seed;
-    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
-    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
-    L->rng_state[0] = z ^ (z >> 31);
-    seed += 0x9e3779b97f4a7c15ULL;
-    z = seed;
-    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
-    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
-    L->rng_state[1] = z ^ (z >> 31);
-    if (out) *out = luby_nil();
-    return (int)LUBY_E_OK;
+static int luby_enumerable_find(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_find);
+    if (rc != 0) return rc;
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
 }
 
-static int luby_rng_rand(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc == 0) {
-        // rand() -> float in [0, 1)
-        if (out) *out = luby_float(luby_rng_double(L));
-    } else if (argc == 1) {
-        if (argv[0].type == LUBY_T_INT) {
-            // rand(n) -> int in [0, n)
-            int64_t n = argv[0].as.i;
-            if (n <= 0) {
-                if (out) *out = luby_int(0);
-            } else {
-                uint64_t r = luby_rng_next(L);
-                if (out) *out = luby_int((int64_t)(r % (uint64_t)n));
-            }
-        } else if (argv[0].type == LUBY_T_RANGE && argv[0].as.ptr) {
-            // rand(a..b) -> int in [a, b] (inclusive for .. ranges)
-            luby_range *rng = (luby_range *)argv[0].as.ptr;
-            int64_t lo = (rng->start.type == LUBY_T_INT) ? rng->start.as.i : 0;
-            int64_t hi = (rng->end.type == LUBY_T_INT) ? rng->end.as.i : 0;
-            if (rng->exclusive) hi--;
-            if (hi < lo) {
-                if (out) *out = luby_int(lo);
-            } else {
-                uint64_t span = (uint64_t)(hi - lo + 1);
-                uint64_t r = luby_rng_next(L);
-                if (out) *out = luby_int(lo + (int64_t)(r % span));
-            }
-        } else {
-            if (out) *out = luby_float(luby_rng_double(L));
-        }
-    } else if (argc >= 2) {
-        // rand(a, b) -> int in [a, b]
-        int64_t lo = (argv[0].type == LUBY_T_INT) ? argv[0].as.i : 0;
-        int64_t hi = (argv[1].type == LUBY_T_INT) ? argv[1].as.i : 0;
-        if (hi < lo) {
-            if (out) *out = luby_int(lo);
-        } else {
-            uint64_t span = (uint64_t)(hi - lo + 1);
-            uint64_t r = luby_rng_next(L);
-            if (out) *out = luby_int(lo + (int64_t)(r % span));
-        }
-    }
-    return (int)LUBY_E_OK;
+static int enumerable_test(luby_state *L, int argc, const luby_value *argv, luby_value *out, int mode) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], enumerable_block(L), enumerable_step_test);
+    if (rc != 0) return rc;
+    run.mode = mode;
+    ENUMERABLE_SLOT(&run, ENUMERABLE_ACC) = luby_bool(mode != ENUMERABLE_ANY);
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
+}
+
+static int luby_enumerable_any(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_test(L, argc, argv, out, ENUMERABLE_ANY);
 }
 
-static int luby_rng_rand_float(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2) {
-        if (out) *out = luby_float(luby_rng_double(L));
+static int luby_enumerable_all(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_test(L, argc, argv, out, ENUMERABLE_ALL);
+}
+
+static int luby_enumerable_none(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_test(L, argc, argv, out, ENUMERABLE_NONE);
+}
+
+// count, count(value) or count { |x| ... }
+static int luby_enumerable_count(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_count);
+    if (rc != 0) return rc;
+    if (argc >= 2) {
+        run.mode = 2;
+        ENUMERABLE_SLOT(&run, ENUMERABLE_AUX) = argv[1];
     } else {
-        double lo = luby_to_double(argv[0]);
-        double hi = luby_to_double(argv[1]);
-        double t = luby_rng_double(L);
-        if (out) *out = luby_float(lo + (hi - lo) * t);
+        run.mode = block ? 1 : 0;
     }
-    return (int)LUBY_E_OK;
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, luby_int(run.count), out);
 }
 
-static int luby_rng_sample(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
-    }
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    if (arr->count == 0) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+static int luby_enumerable_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], NULL, enumerable_step_include);
+    if (rc != 0) return rc;
+    ENUMERABLE_SLOT(&run, ENUMERABLE_AUX) = argv[1];
+    ENUMERABLE_SLOT(&run, ENUMERABLE_ACC) = luby_bool(0);
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
+}
+
+// first -> element or nil; first(n) / take(n) -> array of at most n
+static int luby_enumerable_first(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    int with_n = argc >= 2 && argv[1].type != LUBY_T_NIL;
+    if (with_n && argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], NULL, enumerable_step_first);
+    if (rc != 0) return rc;
+    rc = enumerable_new_array(L, &run, ENUMERABLE_ACC);
+    if (rc != 0) { run.rc = rc; return enumerable_finish(L, &run, luby_nil(), out); }
+    run.limit = with_n ? argv[1].as.i : 1;
+    if (run.limit <= 0) run.done = 1;
+    enumerable_drive(L, &run);
+    luby_value acc = ENUMERABLE_SLOT(&run, ENUMERABLE_ACC);
+    if (!with_n) {
+        luby_array *a = (luby_array *)acc.as.ptr;
+        acc = a->count > 0 ? a->items[0] : luby_nil();
+    }
+    return enumerable_finish(L, &run, acc, out);
+}
+
+static int luby_enumerable_drop(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2 || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], NULL, enumerable_step_drop);
+    if (rc != 0) return rc;
+    rc = enumerable_new_array(L, &run, ENUMERABLE_ACC);
+    if (rc != 0) { run.rc = rc; return enumerable_finish(L, &run, luby_nil(), out); }
+    run.limit = argv[1].as.i;
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
+}
+
+static int luby_enumerable_each_with_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_with_index);
+    if (rc != 0) return rc;
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, argv[0], out);
+}
+
+static int luby_enumerable_each_with_object(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_with_object);
+    if (rc != 0) return rc;
+    ENUMERABLE_SLOT(&run, ENUMERABLE_AUX) = argv[1];
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_AUX), out);
+}
+
+// reduce(init) { |acc, x| ... } or reduce { |acc, x| ... }
+static int luby_enumerable_reduce(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_reduce);
+    if (rc != 0) return rc;
+    run.mode = argc >= 2;
+    if (run.mode) ENUMERABLE_SLOT(&run, ENUMERABLE_ACC) = argv[1];
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
+}
+
+// sum, sum(init), sum { |x| ... }
+static int luby_enumerable_sum(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], enumerable_block(L), enumerable_step_sum);
+    if (rc != 0) return rc;
+    ENUMERABLE_SLOT(&run, ENUMERABLE_ACC) = (argc >= 2 && argv[1].type != LUBY_T_NIL) ? argv[1] : luby_int(0);
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
+}
+
+static int enumerable_extreme(luby_state *L, int argc, const luby_value *argv, luby_value *out, int mode, luby_proc *block) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_extreme);
+    if (rc != 0) return rc;
+    run.mode = mode;
+    enumerable_drive(L, &run);
+    return enumerable_finish(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), out);
+}
+
+static int luby_enumerable_min(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_extreme(L, argc, argv, out, -1, NULL);
+}
+
+static int luby_enumerable_max(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_extreme(L, argc, argv, out, 1, NULL);
+}
+
+static int luby_enumerable_min_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    return enumerable_extreme(L, argc, argv, out, -1, block);
+}
+
+static int luby_enumerable_max_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    return enumerable_extreme(L, argc, argv, out, 1, block);
+}
+
+static int luby_enumerable_sort(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], NULL, enumerable_step_collect);
+    if (rc != 0) return rc;
+    rc = enumerable_new_array(L, &run, ENUMERABLE_ACC);
+    if (rc != 0) { run.rc = rc; return enumerable_finish(L, &run, luby_nil(), out); }
+    enumerable_drive(L, &run);
+    luby_value sorted = luby_nil();
+    if (run.rc == 0) run.rc = enumerable_sorted(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_ACC), &sorted);
+    return enumerable_finish(L, &run, sorted, out);
+}
+
+static int luby_enumerable_sort_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_proc *block = enumerable_block(L);
+    ENUMERABLE_NEED_BLOCK(block);
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], block, enumerable_step_keyed);
+    if (rc != 0) return rc;
+    rc = enumerable_new_array(L, &run, ENUMERABLE_ACC);
+    if (rc == 0) rc = enumerable_new_array(L, &run, ENUMERABLE_AUX);
+    if (rc != 0) { run.rc = rc; return enumerable_finish(L, &run, luby_nil(), out); }
+    enumerable_drive(L, &run);
+    luby_value sorted = luby_nil();
+    if (run.rc == 0) run.rc = enumerable_sorted(L, &run, ENUMERABLE_SLOT(&run, ENUMERABLE_AUX), &sorted);
+    return enumerable_finish(L, &run, sorted, out);
+}
+
+/* group_by, tally and zip work on the collected elements through the Array
+   implementations */
+static int enumerable_via_array(luby_state *L, int argc, const luby_value *argv, luby_value *out, luby_cfunc fn) {
+    ENUMERABLE_NEED_SELF(argc);
+    luby_value block = L->current_block;
+    luby_enumerable_run run;
+    int rc = enumerable_begin(L, &run, argv[0], NULL, enumerable_step_collect);
+    if (rc != 0) return rc;
+    rc = enumerable_new_array(L, &run, ENUMERABLE_ACC);
+    if (rc != 0) { run.rc = rc; return enumerable_finish(L, &run, luby_nil(), out); }
+    enumerable_drive(L, &run);
+    luby_value result = luby_nil();
+    if (run.rc == 0) {
+        luby_value args[LUBY_CMETHOD_STACK_ARGS];
+        int n = argc < LUBY_CMETHOD_STACK_ARGS ? argc : LUBY_CMETHOD_STACK_ARGS;
+        args[0] = ENUMERABLE_SLOT(&run, ENUMERABLE_ACC);
+        for (int i = 1; i < n; i++) args[i] = argv[i];
+        L->current_block = block;
+        run.rc = fn(L, n, args, &result);
     }
-    uint64_t r = luby_rng_next(L);
-    size_t idx = (size_t)(r % arr->count);
-    if (out) *out = arr->items[idx];
+    return enumerable_finish(L, &run, result, out);
+}
+
+static int luby_enumerable_group_by(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (!enumerable_block(L)) { luby_set_error(L, LUBY_E_TYPE, "no block given", NULL, 0, 0); return (int)LUBY_E_TYPE; }
+    return enumerable_via_array(L, argc, argv, out, luby_array_group_by);
+}
+
+static int luby_enumerable_tally(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_via_array(L, argc, argv, out, luby_array_tally);
+}
+
+static int luby_enumerable_zip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return enumerable_via_array(L, argc, argv, out, luby_array_zip);
+}
+
+static int luby_enumerable_lazy(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_lazy_create(L, argc, argv, out);
+}
+
+// ---------------------------- Native Comparable ----------------------------
+
+/* self <=> other through the including class's <=> */
+static int comparable_cmp(luby_state *L, luby_value self, luby_value other, int *cmp) {
+    luby_value r = luby_nil();
+    int rc = luby_invoke_method(L, self, "<=>", 1, &other, &r);
+    if (rc != 0) return rc;
+    if (r.type == LUBY_T_INT) { *cmp = (r.as.i > 0) - (r.as.i < 0); return (int)LUBY_E_OK; }
+    if (r.type == LUBY_T_FLOAT) { *cmp = (r.as.f > 0) - (r.as.f < 0); return (int)LUBY_E_OK; }
+    luby_set_error(L, LUBY_E_TYPE, "comparison failed", NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
+
+enum { COMPARABLE_LT, COMPARABLE_LE, COMPARABLE_GT, COMPARABLE_GE };
+
+static int comparable_relation(luby_state *L, int argc, const luby_value *argv, luby_value *out, int op) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    int cmp = 0;
+    int rc = comparable_cmp(L, argv[0], argv[1], &cmp);
+    if (rc != 0) return rc;
+    int res = (op == COMPARABLE_LT) ? cmp < 0 : (op == COMPARABLE_LE) ? cmp <= 0 :
+              (op == COMPARABLE_GT) ? cmp > 0 : cmp >= 0;
+    if (out) *out = luby_bool(res);
     return (int)LUBY_E_OK;
 }
 
-static int luby_rng_shuffle(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) {
-        if (out) *out = luby_nil();
+static int luby_comparable_lt(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return comparable_relation(L, argc, argv, out, COMPARABLE_LT);
+}
+
+static int luby_comparable_le(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return comparable_relation(L, argc, argv, out, COMPARABLE_LE);
+}
+
+static int luby_comparable_gt(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return comparable_relation(L, argc, argv, out, COMPARABLE_GT);
+}
+
+static int luby_comparable_ge(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return comparable_relation(L, argc, argv, out, COMPARABLE_GE);
+}
+
+// == is identity or <=> returning 0; a non-numeric <=> result means unequal
+static int luby_comparable_eq(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    if (luby_value_eq(argv[0], argv[1])) {
+        if (out) *out = luby_bool(1);
         return (int)LUBY_E_OK;
     }
-    luby_array *src = (luby_array *)argv[0].as.ptr;
-    // Create a copy
-    luby_value arrv = luby_array_new(L);
-    if (arrv.type == LUBY_T_NIL) return (int)LUBY_E_OOM;
-    for (size_t i = 0; i < src->count; i++) {
-        luby_array_push_value(L, arrv, src->items[i]);
-    }
-    luby_array *arr = (luby_array *)arrv.as.ptr;
-    // Fisher-Yates shuffle
-    for (size_t i = arr->count; i > 1; i--) {
-        uint64_t r = luby_rng_next(L);
-        size_t j = (size_t)(r % i);
-        luby_value tmp = arr->items[i - 1];
-        arr->items[i - 1] = arr->items[j];
-        arr->items[j] = tmp;
-    }
-    if (out) *out = arrv;
+    luby_value r = luby_nil();
+    int rc = luby_invoke_method(L, argv[0], "<=>", 1, &argv[1], &r);
+    if (rc != 0) return rc;
+    if (out) *out = luby_bool((r.type == LUBY_T_INT && r.as.i == 0) || (r.type == LUBY_T_FLOAT && r.as.f == 0.0));
     return (int)LUBY_E_OK;
 }
 
-static int luby_rng_shuffle_bang(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
-    }
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    // Fisher-Yates shuffle in-place
-    for (size_t i = arr->count; i > 1; i--) {
-        uint64_t r = luby_rng_next(L);
-        size_t j = (size_t)(r % i);
-        luby_value tmp = arr->items[i - 1];
-        arr->items[i - 1] = arr->items[j];
-        arr->items[j] = tmp;
+static int luby_comparable_between(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    int lo = 0, hi = 0;
+    int rc = comparable_cmp(L, argv[0], argv[1], &lo);
+    if (rc == 0 && lo >= 0) rc = comparable_cmp(L, argv[0], argv[2], &hi);
+    if (rc != 0) return rc;
+    if (out) *out = luby_bool(lo >= 0 && hi <= 0);
+    return (int)LUBY_E_OK;
+}
+
+static int luby_comparable_clamp(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 3) return (int)LUBY_E_TYPE;
+    int cmp = 0;
+    int rc = comparable_cmp(L, argv[0], argv[1], &cmp);
+    if (rc != 0) return rc;
+    if (cmp < 0) { if (out) *out = argv[1]; return (int)LUBY_E_OK; }
+    rc = comparable_cmp(L, argv[0], argv[2], &cmp);
+    if (rc != 0) return rc;
+    if (out) *out = (cmp > 0) ? argv[2] : argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// ------------------------- Set and PriorityQueue -------------------------
+// Both are ordinary objects whose elements live in the hidden `_items`
+// field, so the GC, snapshots and Enumerable see a plain Array (see
+// luby_collection_each). A Set also keeps a luby_value_set over _items in a
+// cache userdata (`_index`): snapshots drop it and the next call rebuilds
+// it. Deleting from a Set moves its last element into the gap.
+
+typedef struct luby_set_index {
+    luby_value_set set;         // slots point just past this header
+} luby_set_index;
+
+static luby_value luby_collection_field(luby_state *L, luby_object *obj, const char *name) {
+    luby_value v = luby_nil();
+    luby_enum_get_field(L, obj, name, &v);
+    return v;
+}
+
+// The elements of a Set or PriorityQueue, or NULL if v is neither
+static luby_array *luby_collection_items(luby_state *L, luby_value v, const char *marker, luby_object **obj) {
+    if (v.type != LUBY_T_OBJECT || !v.as.ptr) return NULL;
+    luby_object *o = (luby_object *)v.as.ptr;
+    if (!o->ivars) return NULL;
+    int found = 0;
+    luby_value key = luby_symbol(L, marker, 0);
+    luby_hash_get_value_found((luby_value){ .type = LUBY_T_HASH, .as.ptr = o->ivars }, key, NULL, &found);
+    luby_value items = luby_collection_field(L, o, "_items");
+    if (!found || items.type != LUBY_T_ARRAY || !items.as.ptr) return NULL;
+    if (obj) *obj = o;
+    return (luby_array *)items.as.ptr;
+}
+
+// each for both collections; Enumerable iterates _items directly instead
+static int luby_collection_each(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_array *items = argc >= 1 ? luby_collection_items(L, argv[0], "_items", NULL) : NULL;
+    if (!items) return (int)LUBY_E_TYPE;
+    luby_proc *block = L->current_block.type == LUBY_T_PROC ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) { luby_set_error(L, LUBY_E_TYPE, "no block given", NULL, 0, 0); return (int)LUBY_E_TYPE; }
+    for (size_t i = 0; i < items->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &items->items[i], &res, out, luby_nil());
     }
     if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-// ---------------------- Probability helpers -------------------------
+static int luby_collection_size(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_array *items = argc >= 1 ? luby_collection_items(L, argv[0], "_items", NULL) : NULL;
+    if (!items) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_int((int64_t)items->count);
+    return (int)LUBY_E_OK;
+}
 
-static int luby_rng_chance(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) {
-        if (out) *out = luby_bool(0);
-        return (int)LUBY_E_OK;
-    }
-    double percent = luby_to_double(argv[0]);
-    double roll = luby_rng_double(L) * 100.0;
-    if (out) *out = luby_bool(roll < percent);
+static int luby_collection_empty(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_array *items = argc >= 1 ? luby_collection_items(L, argv[0], "_items", NULL) : NULL;
+    if (!items) return (int)LUBY_E_TYPE;
+    if (out) *out = luby_bool(items->count == 0);
     return (int)LUBY_E_OK;
 }
 
-static int luby_rng_dice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    int64_t count = 1;
-    int64_t sides = 6;
-    if (argc >= 1 && argv[0].type == LUBY_T_INT) count = argv[0].as.i;
-    if (argc >= 2 && argv[1].type == LUBY_T_INT) sides = argv[1].as.i;
-    if (count < 0) count = 0;
-    if (sides < 1) sides = 1;
-    int64_t total = 0;
-    for (int64_t i = 0; i < count; i++) {
-        uint64_t r = luby_rng_next(L);
-        total += 1 + (int64_t)(r % (uint64_t)sides);
+static int luby_collection_to_a(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_array *items = argc >= 1 ? luby_collection_items(L, argv[0], "_items", NULL) : NULL;
+    if (!items) return (int)LUBY_E_TYPE;
+    luby_value av = luby_array_new(L);
+    if (av.type != LUBY_T_ARRAY || !luby_array_reserve(L, (luby_array *)av.as.ptr, items->count)) return (int)LUBY_E_OOM;
+    luby_array *arr = (luby_array *)av.as.ptr;
+    if (items->count) memcpy(arr->items, items->items, items->count * sizeof(luby_value));
+    arr->count = items->count;
+    if (out) *out = av;
+    return (int)LUBY_E_OK;
+}
+
+// A new, empty collection of class `cls` with `marker` as its kind field
+static luby_object *luby_collection_new(luby_state *L, luby_value cls, const char *marker, luby_value *out) {
+    if (cls.type != LUBY_T_CLASS || !cls.as.ptr) return NULL;
+    luby_object *obj = luby_object_new(L, (luby_class_obj *)cls.as.ptr);
+    if (!obj) return NULL;
+    luby_value ov; ov.type = LUBY_T_OBJECT; ov.as.ptr = obj;
+    if (!luby_gc_push_temp(L, ov)) return NULL;
+    luby_value items = luby_array_new(L);
+    if (items.type != LUBY_T_ARRAY) return NULL;
+    if (luby_enum_set_field(L, obj, "_items", items) != 0) return NULL;
+    if (luby_enum_set_field(L, obj, marker, luby_nil()) != 0) return NULL;
+    *out = ov;
+    return obj;
+}
+
+// The elements of any collection argument: an Array, a Set or
+// PriorityQueue, or whatever to_a returns
+static int luby_collection_elements(luby_state *L, luby_value v, luby_array **out) {
+    luby_array *items = NULL;
+    if (v.type == LUBY_T_ARRAY && v.as.ptr) items = (luby_array *)v.as.ptr;
+    else items = luby_collection_items(L, v, "_items", NULL);
+    if (!items && (luby_has_class_dispatch(v) || v.type == LUBY_T_RANGE || v.type == LUBY_T_HASH)) {
+        luby_value av = luby_nil();
+        int rc = luby_has_class_dispatch(v) ? luby_invoke_method(L, v, "to_a", 0, NULL, &av)
+                                            : luby_call(L, v, "to_a", 0, NULL, &av);
+        if (rc != 0) return rc;
+        if (av.type == LUBY_T_ARRAY && av.as.ptr && luby_gc_push_temp(L, av)) items = (luby_array *)av.as.ptr;
+    }
+    if (!items) {
+        luby_set_error(L, LUBY_E_TYPE, "expected a collection", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (out) *out = luby_int(total);
+    *out = items;
     return (int)LUBY_E_OK;
 }
 
-static int luby_rng_weighted_choice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+/* ---- Set ---- */
+
+static luby_array *luby_set_items(luby_state *L, luby_value v, luby_object **obj) {
+    return luby_collection_items(L, v, "_index", obj);
+}
+
+// The index over a Set's items with room for `extra` more keys. Rebuilt
+// from _items when missing (new Set, snapshot copy); replaced when full.
+static int luby_set_index_reserve(luby_state *L, luby_object *obj, luby_array *items, size_t extra, luby_value_set **out) {
+    luby_set_index *idx = (luby_set_index *)luby_userdata_ptr(luby_collection_field(L, obj, "_index"));
+    size_t need = (idx ? idx->set.count : items->count) + extra;
+    if (idx && need * 2 <= idx->set.capacity) { *out = &idx->set; return (int)LUBY_E_OK; }
+    size_t cap = 16;
+    while (cap < need * 2) cap *= 2;
+    luby_value uv = luby_new_userdata(L, sizeof(luby_set_index) + cap * sizeof(luby_value_set_slot), NULL);
+    luby_set_index *nidx = (luby_set_index *)luby_userdata_ptr(uv);
+    if (!nidx) return (int)LUBY_E_OOM;
+    ((luby_userdata *)uv.as.ptr)->cache = 1;    // holds raw pointers into the heap
+    nidx->set.slots = (luby_value_set_slot *)(nidx + 1);
+    nidx->set.capacity = cap;
+    nidx->set.count = 0;
+    if (idx) {
+        // Same keys, new table: no hashing needed
+        for (size_t i = 0; i < idx->set.capacity; i++) {
+            luby_value_set_slot *e = &idx->set.slots[i];
+            if (!e->index) continue;
+            size_t j = (size_t)e->hash & (cap - 1);
+            while (nidx->set.slots[j].index) j = (j + 1) & (cap - 1);
+            nidx->set.slots[j] = *e;
+        }
+        nidx->set.count = idx->set.count;
+    }
+    int rc = luby_enum_set_field(L, obj, "_index", uv);
+    for (size_t i = 0; !idx && rc == 0 && i < items->count; i++) {
+        size_t existing;
+        rc = luby_value_set_add(L, &nidx->set, items->items[i], i, &existing);
+    }
+    if (rc != 0) {
+        luby_enum_set_field(L, obj, "_index", luby_nil());
+        return rc;
     }
-    // Accept either hash {item => weight} or array [[item, weight], ...]
-    if (argv[0].type == LUBY_T_HASH && argv[0].as.ptr) {
-        luby_hash *h = (luby_hash *)argv[0].as.ptr;
-        if (h->count == 0) {
-            if (out) *out = luby_nil();
-            return (int)LUBY_E_OK;
-        }
-        // Sum weights
-        double total_weight = 0.0;
-        for (size_t i = 0; i < h->count; i++) {
-            total_weight += luby_to_double(h->entries[i].value);
-        }
-        if (total_weight <= 0.0) {
-            if (out) *out = luby_nil();
-            return (int)LUBY_E_OK;
-        }
-        // Pick
-        double roll = luby_rng_double(L) * total_weight;
-        double cumulative = 0.0;
-        for (size_t i = 0; i < h->count; i++) {
-            cumulative += luby_to_double(h->entries[i].value);
-            if (roll < cumulative) {
-                if (out) *out = h->entries[i].key;
-                return (int)LUBY_E_OK;
-            }
-        }
-        // Fallback to last
-        if (out) *out = h->entries[h->count - 1].key;
-    } else if (argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
-        luby_array *arr = (luby_array *)argv[0].as.ptr;
-        if (arr->count == 0) {
-            if (out) *out = luby_nil();
-            return (int)LUBY_E_OK;
-        }
-        // Sum weights from [[item, weight], ...]
-        double total_weight = 0.0;
-        for (size_t i = 0; i < arr->count; i++) {
-            if (arr->items[i].type == LUBY_T_ARRAY && arr->items[i].as.ptr) {
-                luby_array *pair = (luby_array *)arr->items[i].as.ptr;
-                if (pair->count >= 2) {
-                    total_weight += luby_to_double(pair->items[1]);
-                }
-            }
-        }
-        if (total_weight <= 0.0) {
-            if (out) *out = luby_nil();
-            return (int)LUBY_E_OK;
-        }
-        // Pick
-        double roll = luby_rng_double(L) * total_weight;
-        double cumulative = 0.0;
-        for (size_t i = 0; i < arr->count; i++) {
-            if (arr->items[i].type == LUBY_T_ARRAY && arr->items[i].as.ptr) {
-                luby_array *pair = (luby_array *)arr->items[i].as.ptr;
-                if (pair->count >= 2) {
-                    cumulative += luby_to_double(pair->items[1]);
-                    if (roll < cumulative) {
-                        if (out) *out = pair->items[0];
-                        return (int)LUBY_E_OK;
-                    }
-                }
-            }
-        }
-        // Fallback
-        luby_array *last = (luby_array *)arr->items[arr->count - 1].as.ptr;
-        if (last && last->count >= 1) {
-            if (out) *out = last->items[0];
-        } else {
-            if (out) *out = luby_nil();
+    *out = &nidx->set;
+    return (int)LUBY_E_OK;
+}
+
+// Add `v` unless present; *added reports whether it was
+static int luby_set_insert(luby_state *L, luby_object *obj, luby_array *items, luby_value v, int *added) {
+    luby_value_set *s;
+    size_t existing;
+    int rc = luby_set_index_reserve(L, obj, items, 1, &s);
+    if (rc == 0) rc = luby_value_set_add(L, s, v, items->count, &existing);
+    if (rc != 0) return rc;
+    *added = existing == LUBY_VALUE_SET_NONE;
+    return *added ? luby_array_append(L, items, v) : (int)LUBY_E_OK;
+}
+
+static int luby_set_contains(luby_state *L, luby_object *obj, luby_array *items, luby_value v, int *found) {
+    luby_value_set *s;
+    size_t at = LUBY_VALUE_SET_NONE;
+    int rc = luby_set_index_reserve(L, obj, items, 0, &s);
+    if (rc == 0) rc = luby_value_set_find(L, s, v, &at);
+    *found = at != LUBY_VALUE_SET_NONE;
+    return rc;
+}
+
+// A new Set of self's class holding the elements of argv[from..argc)
+static int luby_set_build(luby_state *L, luby_value cls, int argc, const luby_value *argv, int from, luby_value *out) {
+    luby_value sv;
+    luby_object *obj = luby_collection_new(L, cls, "_index", &sv);
+    if (!obj) return (int)LUBY_E_OOM;
+    luby_array *items = luby_set_items(L, sv, NULL);
+    for (int a = from; a < argc; a++) {
+        luby_array *src;
+        int rc = luby_collection_elements(L, argv[a], &src);
+        for (size_t i = 0; rc == 0 && i < src->count; i++) {
+            int added;
+            rc = luby_set_insert(L, obj, items, src->items[i], &added);
         }
-    } else {
-        if (out) *out = luby_nil();
+        if (rc != 0) return rc;
+    }
+    *out = sv;
+    return (int)LUBY_E_OK;
+}
+
+static luby_value luby_set_class_of(luby_object *obj) {
+    luby_value cv; cv.type = LUBY_T_CLASS; cv.as.ptr = obj->klass;
+    return cv;
+}
+
+#define LUBY_SET_SELF(L, argc, argv, obj, items) \
+    luby_object *obj = NULL; \
+    luby_array *items = (argc) >= 1 ? luby_set_items((L), (argv)[0], &obj) : NULL; \
+    if (!items) { luby_set_error((L), LUBY_E_TYPE, "expected a Set", NULL, 0, 0); return (int)LUBY_E_TYPE; }
+
+// Set.new(collection = nil)
+static int luby_set_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    int from = (argc >= 2 && argv[1].type == LUBY_T_NIL) ? argc : 1;
+    return luby_set_build(L, argv[0], argc, argv, from, out);
+}
+
+// add / << return self; add? returns nil when the element was present
+static int luby_set_add_impl(luby_state *L, int argc, const luby_value *argv, luby_value *out, int report) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    int added;
+    int rc = luby_set_insert(L, obj, items, argv[1], &added);
+    if (rc == 0 && out) *out = (report && !added) ? luby_nil() : argv[0];
+    return rc;
+}
+
+static int luby_set_add(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_add_impl(L, argc, argv, out, 0);
+}
+
+static int luby_set_add_p(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_add_impl(L, argc, argv, out, 1);
+}
+
+// delete returns self; delete? returns nil when the element was absent
+static int luby_set_delete_impl(luby_state *L, int argc, const luby_value *argv, luby_value *out, int report) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_value_set *s;
+    size_t at = LUBY_VALUE_SET_NONE;
+    int rc = luby_set_index_reserve(L, obj, items, 0, &s);
+    if (rc == 0) rc = luby_value_set_remove(L, s, argv[1], &at);
+    if (rc == 0 && at != LUBY_VALUE_SET_NONE) {
+        size_t last = items->count - 1;
+        if (at != last) {
+            items->items[at] = items->items[last];
+            rc = luby_value_set_move(L, s, items->items[at], last, at);
+        }
+        items->count--;
+    }
+    if (rc == 0 && out) *out = (report && at == LUBY_VALUE_SET_NONE) ? luby_nil() : argv[0];
+    return rc;
+}
+
+static int luby_set_delete(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_delete_impl(L, argc, argv, out, 0);
+}
+
+static int luby_set_delete_p(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_delete_impl(L, argc, argv, out, 1);
+}
+
+static int luby_set_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    int found;
+    int rc = luby_set_contains(L, obj, items, argv[1], &found);
+    if (rc == 0 && out) *out = luby_bool(found);
+    return rc;
+}
+
+static int luby_set_clear(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    items->count = 0;
+    luby_enum_set_field(L, obj, "_index", luby_nil());
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// |, +, union: self's elements, then the others'
+static int luby_set_union(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    (void)items;
+    return luby_set_build(L, luby_set_class_of(obj), argc, argv, 0, out);
+}
+
+// The elements of self kept (or dropped) by membership in argv[1]
+static int luby_set_filter(luby_state *L, int argc, const luby_value *argv, luby_value *out, int keep) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_value other = argv[1];
+    luby_object *oobj = NULL;
+    luby_array *oitems = luby_set_items(L, other, &oobj);
+    int rc;
+    if (!oitems) {
+        // Index a plain collection once rather than scanning it per element
+        if ((rc = luby_set_build(L, luby_set_class_of(obj), 2, argv, 1, &other)) != 0) return rc;
+        oitems = luby_set_items(L, other, &oobj);
+    }
+    luby_value rv;
+    luby_object *robj = luby_collection_new(L, luby_set_class_of(obj), "_index", &rv);
+    if (!robj) return (int)LUBY_E_OOM;
+    luby_array *ritems = luby_set_items(L, rv, NULL);
+    rc = 0;
+    for (size_t i = 0; rc == 0 && i < items->count; i++) {
+        luby_value v = items->items[i];
+        int found, added;
+        rc = luby_set_contains(L, oobj, oitems, v, &found);
+        if (rc == 0 && found == keep) rc = luby_set_insert(L, robj, ritems, v, &added);
+    }
+    if (rc == 0 && out) *out = rv;
+    return rc;
+}
+
+static int luby_set_intersection(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_filter(L, argc, argv, out, 1);
+}
+
+static int luby_set_difference(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_filter(L, argc, argv, out, 0);
+}
+
+// How many of a's elements b contains
+static int luby_set_overlap(luby_state *L, luby_array *a, luby_object *bobj, luby_array *b, size_t *n) {
+    *n = 0;
+    for (size_t i = 0; i < a->count; i++) {
+        int found;
+        int rc = luby_set_contains(L, bobj, b, a->items[i], &found);
+        if (rc != 0) return rc;
+        *n += (size_t)found;
     }
     return (int)LUBY_E_OK;
 }
 
-static int luby_rng_roll(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    // roll("3d6") or roll("2d20+5") style parsing
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) {
-        if (out) *out = luby_int(0);
-        return (int)LUBY_E_OK;
-    }
-    const char *str = (const char *)argv[0].as.ptr;
-    int64_t count = 0, sides = 0, modifier = 0;
-    int sign = 1;
-    // Parse: [count]d<sides>[+/-modifier]
-    const char *p = str;
-    // Count (optional, defaults to 1)
-    while (*p >= '0' && *p <= '9') {
-        count = count * 10 + (*p - '0');
-        p++;
-    }
-    if (count == 0) count = 1;
-    // 'd' or 'D'
-    if (*p == 'd' || *p == 'D') p++;
-    // Sides
-    while (*p >= '0' && *p <= '9') {
-        sides = sides * 10 + (*p - '0');
-        p++;
+enum { LUBY_SET_SUBSET, LUBY_SET_SUPERSET, LUBY_SET_DISJOINT, LUBY_SET_INTERSECT, LUBY_SET_EQUAL };
+
+static int luby_set_relation(luby_state *L, int argc, const luby_value *argv, luby_value *out, int rel) {
+    LUBY_SET_SELF(L, argc, argv, obj, items);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_object *oobj = NULL;
+    luby_array *oitems = luby_set_items(L, argv[1], &oobj);
+    if (!oitems) {
+        if (rel == LUBY_SET_EQUAL) { if (out) *out = luby_bool(0); return (int)LUBY_E_OK; }
+        luby_set_error(L, LUBY_E_TYPE, "expected a Set", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    if (sides == 0) sides = 6;
-    // Modifier
-    if (*p == '+') { sign = 1; p++; }
-    else if (*p == '-') { sign = -1; p++; }
-    while (*p >= '0' && *p <= '9') {
-        modifier = modifier * 10 + (*p - '0');
-        p++;
+    size_t n = 0;
+    int rc, res;
+    switch (rel) {
+        case LUBY_SET_SUBSET:
+            rc = luby_set_overlap(L, items, oobj, oitems, &n);
+            res = n == items->count;
+            break;
+        case LUBY_SET_SUPERSET:
+            rc = luby_set_overlap(L, oitems, obj, items, &n);
+            res = n == oitems->count;
+            break;
+        case LUBY_SET_EQUAL:
+            rc = items->count == oitems->count ? luby_set_overlap(L, items, oobj, oitems, &n) : 0;
+            res = items->count == oitems->count && n == items->count;
+            break;
+        default:
+            rc = luby_set_overlap(L, items, oobj, oitems, &n);
+            res = (n > 0) == (rel == LUBY_SET_INTERSECT);
+            break;
     }
-    modifier *= sign;
-    // Roll
-    int64_t total = 0;
-    for (int64_t i = 0; i < count; i++) {
-        uint64_t r = luby_rng_next(L);
-        total += 1 + (int64_t)(r % (uint64_t)sides);
+    if (rc == 0 && out) *out = luby_bool(res);
+    return rc;
+}
+
+static int luby_set_subset(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_relation(L, argc, argv, out, LUBY_SET_SUBSET);
+}
+
+static int luby_set_superset(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_relation(L, argc, argv, out, LUBY_SET_SUPERSET);
+}
+
+static int luby_set_disjoint(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_relation(L, argc, argv, out, LUBY_SET_DISJOINT);
+}
+
+static int luby_set_intersect(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_relation(L, argc, argv, out, LUBY_SET_INTERSECT);
+}
+
+static int luby_set_equal(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    return luby_set_relation(L, argc, argv, out, LUBY_SET_EQUAL);
+}
+
+/* ---- PriorityQueue ---- */
+// A binary heap over _items with each element's priority at the same
+// position in _keys. The smallest priority pops first (the largest with
+// PriorityQueue.new(:max)). Priorities come from push's second argument,
+// else the block given to new, else the element itself.
+
+typedef struct luby_pqueue {
+    luby_object *obj;
+    luby_array *items;
+    luby_array *keys;
+    int order;                  // 1 = min-heap, -1 = max-heap
+} luby_pqueue;
+
+static int luby_pqueue_get(luby_state *L, luby_value v, luby_pqueue *q) {
+    luby_object *obj = NULL;
+    luby_array *items = luby_collection_items(L, v, "_keys", &obj);
+    luby_value keys = items ? luby_collection_field(L, obj, "_keys") : luby_nil();
+    if (keys.type != LUBY_T_ARRAY || !keys.as.ptr) {
+        luby_set_error(L, LUBY_E_TYPE, "expected a PriorityQueue", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    total += modifier;
-    if (out) *out = luby_int(total);
+    luby_value order = luby_collection_field(L, obj, "_order");
+    q->obj = obj;
+    q->items = items;
+    q->keys = (luby_array *)keys.as.ptr;
+    q->order = (order.type == LUBY_T_INT && order.as.i < 0) ? -1 : 1;
     return (int)LUBY_E_OK;
 }
 
-// ---------------------- VFS Data Loading -------------------------
+// Should the element at i sit above the one at j?
+static int luby_pqueue_before(luby_state *L, const luby_pqueue *q, size_t i, size_t j, int *before) {
+    int cmp;
+    int rc = enumerable_compare(L, q->keys->items[i], q->keys->items[j], &cmp);
+    *before = rc == 0 && cmp * q->order < 0;
+    return rc;
+}
 
-static int luby_resolve_vfs_path(luby_state *L, const char *path, char *resolved, size_t resolved_size) {
-    if (!L->cfg.vfs.exists) return 0;
-    
-    // Try direct path first
-    if (L->cfg.vfs.exists(L->cfg.vfs.user, path)) {
-        snprintf(resolved, resolved_size, "%s", path);
-        return 1;
+static void luby_pqueue_swap(const luby_pqueue *q, size_t i, size_t j) {
+    luby_value t = q->items->items[i]; q->items->items[i] = q->items->items[j]; q->items->items[j] = t;
+    t = q->keys->items[i]; q->keys->items[i] = q->keys->items[j]; q->keys->items[j] = t;
+}
+
+// Undo the swaps along path[0..n] after a failed comparison
+static void luby_pqueue_unwind(const luby_pqueue *q, const size_t *path, size_t n) {
+    while (n > 0) { luby_pqueue_swap(q, path[n - 1], path[n]); n--; }
+}
+
+static int luby_pqueue_sift_up(luby_state *L, const luby_pqueue *q, size_t i) {
+    size_t path[64];
+    size_t n = 0;
+    path[0] = i;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        int before;
+        int rc = luby_pqueue_before(L, q, i, parent, &before);
+        if (rc != 0) { luby_pqueue_unwind(q, path, n); return rc; }
+        if (!before) break;
+        luby_pqueue_swap(q, i, parent);
+        path[++n] = i = parent;
     }
-    
-    // Search in search paths
-    for (size_t i = 0; i < L->search_path_count; i++) {
-        const char *base = L->search_paths[i];
-        if (!base) continue;
-        size_t blen = strlen(base);
-        snprintf(resolved, resolved_size, "%s%s%s", base, (blen && base[blen - 1] == '/') ? "" : "/", path);
-        if (L->cfg.vfs.exists(L->cfg.vfs.user, resolved)) {
-            return 1;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_pqueue_sift_down(luby_state *L, const luby_pqueue *q, size_t i) {
+    size_t path[64];
+    size_t n = 0, count = q->items->count;
+    path[0] = i;
+    for (;;) {
+        size_t best = i, l = 2 * i + 1, r = l + 1;
+        int before, rc = 0;
+        if (l < count && (rc = luby_pqueue_before(L, q, l, best, &before)) == 0 && before) best = l;
+        if (rc == 0 && r < count && (rc = luby_pqueue_before(L, q, r, best, &before)) == 0 && before) best = r;
+        if (rc != 0) { luby_pqueue_unwind(q, path, n); return rc; }
+        if (best == i) return (int)LUBY_E_OK;
+        luby_pqueue_swap(q, i, best);
+        path[++n] = i = best;
+    }
+}
+
+// PriorityQueue.new(order = :min) { |x| priority }
+static int luby_pqueue_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    int order = 1;
+    if (argc >= 2 && argv[1].type != LUBY_T_NIL) {
+        const char *name = argv[1].type == LUBY_T_SYMBOL ? (const char *)argv[1].as.ptr : NULL;
+        if (!name || (strcmp(name, "min") != 0 && strcmp(name, "max") != 0)) {
+            luby_set_error(L, LUBY_E_TYPE, "order must be :min or :max", NULL, 0, 0);
+            return (int)LUBY_E_TYPE;
         }
-    }
-    return 0;
+        order = name[1] == 'a' ? -1 : 1;
+    }
+    luby_value block = L->current_block.type == LUBY_T_PROC ? L->current_block : luby_nil();
+    luby_value qv;
+    luby_object *obj = luby_collection_new(L, argv[0], "_keys", &qv);
+    luby_value keys = obj ? luby_array_new(L) : luby_nil();
+    if (keys.type != LUBY_T_ARRAY) return (int)LUBY_E_OOM;
+    if (luby_enum_set_field(L, obj, "_keys", keys) != 0 ||
+        luby_enum_set_field(L, obj, "_order", luby_int(order)) != 0 ||
+        luby_enum_set_field(L, obj, "_key_fn", block) != 0) return (int)LUBY_E_OOM;
+    if (out) *out = qv;
+    return (int)LUBY_E_OK;
 }
 
-static int luby_base_load_text(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+// push(item, priority = nil) / << : O(log n)
+static int luby_pqueue_push(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_pqueue q;
+    int rc = argc >= 2 ? luby_pqueue_get(L, argv[0], &q) : (int)LUBY_E_TYPE;
+    if (rc != 0) return rc;
+    luby_value key = argv[1];
+    if (argc >= 3) {
+        key = argv[2];
+    } else {
+        luby_value fn = luby_collection_field(L, q.obj, "_key_fn");
+        if (fn.type == LUBY_T_PROC && fn.as.ptr) {
+            int brc = luby_call_block(L, (luby_proc *)fn.as.ptr, 1, &argv[1], &key);
+            if (brc != 0) {
+                if (brc == (int)LUBY_E_BREAK) L->block_break = 0;
+                if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_RUNTIME, "priority block failed", NULL, 0, 0);
+                return (int)LUBY_E_RUNTIME;
+            }
+        }
     }
-    
-    if (!L->cfg.vfs.read || !L->cfg.vfs.exists) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+    if (luby_array_append(L, q.keys, key) != 0) return (int)LUBY_E_OOM;
+    if (luby_array_append(L, q.items, argv[1]) != 0) { q.keys->count--; return (int)LUBY_E_OOM; }
+    rc = luby_pqueue_sift_up(L, &q, q.items->count - 1);
+    if (rc != 0) {
+        // The new element is back in the last slot
+        q.items->count--;
+        q.keys->count--;
+        return rc;
     }
-    
-    const char *path = (const char *)argv[0].as.ptr;
-    char resolved[1024];
-    
-    if (!luby_resolve_vfs_path(L, path, resolved, sizeof(resolved))) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// pop: remove and return the first element, nil when empty; O(log n)
+static int luby_pqueue_pop(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_pqueue q;
+    int rc = argc >= 1 ? luby_pqueue_get(L, argv[0], &q) : (int)LUBY_E_TYPE;
+    if (rc != 0) return rc;
+    size_t n = q.items->count;
+    if (n == 0) { if (out) *out = luby_nil(); return (int)LUBY_E_OK; }
+    luby_value top = q.items->items[0], top_key = q.keys->items[0];
+    q.items->items[0] = q.items->items[n - 1];
+    q.keys->items[0] = q.keys->items[n - 1];
+    q.items->count = q.keys->count = n - 1;
+    rc = luby_pqueue_sift_down(L, &q, 0);
+    if (rc != 0) {
+        // Put the heap back as it was
+        q.items->items[n - 1] = q.items->items[0];
+        q.keys->items[n - 1] = q.keys->items[0];
+        q.items->items[0] = top;
+        q.keys->items[0] = top_key;
+        q.items->count = q.keys->count = n;
+        return rc;
     }
-    
-    size_t size = 0;
-    char *content = L->cfg.vfs.read(L->cfg.vfs.user, resolved, &size);
-    if (!content) {
-        if (out) *out = luby_nil();
-        return (int)LUBY_E_OK;
+    if (out) *out = top;
+    return (int)LUBY_E_OK;
+}
+
+static int luby_pqueue_peek(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_pqueue q;
+    int rc = argc >= 1 ? luby_pqueue_get(L, argv[0], &q) : (int)LUBY_E_TYPE;
+    if (rc != 0) return rc;
+    if (out) *out = q.items->count ? q.items->items[0] : luby_nil();
+    return (int)LUBY_E_OK;
+}
+
+static int luby_pqueue_clear(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_pqueue q;
+    int rc = argc >= 1 ? luby_pqueue_get(L, argv[0], &q) : (int)LUBY_E_TYPE;
+    if (rc != 0) return rc;
+    q.items->count = q.keys->count = 0;
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
+
+// ---------------------------- SpatialHash ----------------------------
+// A uniform grid over 2D points for broadphase queries. Like a Set, it is
+// an ordinary object: payloads live in `_items`, their positions in the
+// Float64Array `_pos` (x and y per item) and the cell size in `_cell`, so
+// the GC and snapshots see plain values. The grid itself is a cache
+// userdata (`_grid`) rebuilt from those on demand: a luby_value_set from
+// payload to item index, and per-item chains hanging off hashed cells.
+// Removing a payload moves the last one into its place.
+
+typedef struct luby_grid_index {
+    luby_value_set set;         // slots point just past this header
+    size_t capacity;            // items the chains have room for
+    size_t mask;                // bucket count - 1
+    uint32_t *heads;            // per bucket: first item + 1, or 0
+    uint32_t *next;             // per item: next item in its bucket + 1, or 0
+    int32_t *cells;             // per item: its cell's x and y
+} luby_grid_index;
+
+#define LUBY_GRID_CELL_MAX 1073741823.0
+
+typedef struct luby_spatial {
+    luby_object *obj;
+    luby_array *items;
+    double *pos;
+    double cell;
+} luby_spatial;
+
+static int luby_spatial_get(luby_state *L, luby_value v, luby_spatial *sp) {
+    sp->items = luby_collection_items(L, v, "_grid", &sp->obj);
+    luby_value pv = sp->items ? luby_collection_field(L, sp->obj, "_pos") : luby_nil();
+    sp->pos = (double *)luby_buffer_data(pv, NULL, NULL);
+    sp->cell = luby_to_double(sp->items ? luby_collection_field(L, sp->obj, "_cell") : luby_nil());
+    if (!sp->items || !sp->pos || !(sp->cell > 0.0)) {
+        luby_set_error(L, LUBY_E_TYPE, "expected a SpatialHash", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    
-    luby_value result = luby_string(L, content, size);
-    // Free the VFS-allocated buffer
-    if (L->cfg.alloc) {
-        L->cfg.alloc(L->cfg.alloc_user, content, 0);
-    } else {
-        luby_default_alloc(NULL, content, 0);
+    return (int)LUBY_E_OK;
+}
+
+static int32_t luby_grid_coord(double v, double cell) {
+    double c = floor(v / cell);
+    if (!(c > -LUBY_GRID_CELL_MAX)) return (int32_t)-LUBY_GRID_CELL_MAX;     // also NaN
+    if (c > LUBY_GRID_CELL_MAX) return (int32_t)LUBY_GRID_CELL_MAX;
+    return (int32_t)c;
+}
+
+static size_t luby_grid_bucket(const luby_grid_index *g, int32_t cx, int32_t cy) {
+    uint32_t h = ((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u);
+    return (size_t)(h ^ (h >> 16)) & g->mask;
+}
+
+static void luby_grid_link(luby_grid_index *g, size_t i, int32_t cx, int32_t cy) {
+    size_t b = luby_grid_bucket(g, cx, cy);
+    g->cells[i * 2] = cx;
+    g->cells[i * 2 + 1] = cy;
+    g->next[i] = g->heads[b];
+    g->heads[b] = (uint32_t)(i + 1);
+}
+
+static void luby_grid_unlink(luby_grid_index *g, size_t i) {
+    uint32_t *at = &g->heads[luby_grid_bucket(g, g->cells[i * 2], g->cells[i * 2 + 1])];
+    while (*at && *at != i + 1) at = &g->next[*at - 1];
+    if (*at) *at = g->next[i];
+}
+
+// The grid over sp's items with room for `extra` more. Rebuilt from
+// _items and _pos when missing (new hash, snapshot copy); replaced when
+// full.
+static int luby_grid_reserve(luby_state *L, luby_spatial *sp, size_t extra, luby_grid_index **out) {
+    luby_grid_index *g = (luby_grid_index *)luby_userdata_ptr(luby_collection_field(L, sp->obj, "_grid"));
+    size_t need = sp->items->count + extra;
+    if (g && need <= g->capacity) { *out = g; return (int)LUBY_E_OK; }
+    size_t cap = 16;
+    while (cap < need) cap *= 2;
+    if (cap > UINT32_MAX / 2) {
+        luby_set_error(L, LUBY_E_OOM, "SpatialHash: too many items", NULL, 0, 0);
+        return (int)LUBY_E_OOM;
     }
-    
-    if (out) *out = result;
+    size_t bytes = sizeof(luby_grid_index) + cap * 2 * sizeof(luby_value_set_slot) +
+                   cap * (2 * sizeof(uint32_t) + 2 * sizeof(int32_t));
+    luby_value uv = luby_new_userdata(L, bytes, NULL);
+    luby_grid_index *ng = (luby_grid_index *)luby_userdata_ptr(uv);
+    if (!ng) return (int)LUBY_E_OOM;
+    ((luby_userdata *)uv.as.ptr)->cache = 1;    // holds raw pointers into the heap
+    memset(ng, 0, bytes);
+    ng->set.slots = (luby_value_set_slot *)(ng + 1);
+    ng->set.capacity = cap * 2;
+    ng->capacity = cap;
+    ng->mask = cap - 1;
+    ng->heads = (uint32_t *)(ng->set.slots + cap * 2);
+    ng->next = ng->heads + cap;
+    ng->cells = (int32_t *)(ng->next + cap);
+    if (g) {
+        // Same keys, new table: no hashing needed
+        for (size_t i = 0; i < g->set.capacity; i++) {
+            luby_value_set_slot *e = &g->set.slots[i];
+            if (!e->index) continue;
+            size_t j = (size_t)e->hash & (ng->set.capacity - 1);
+            while (ng->set.slots[j].index) j = (j + 1) & (ng->set.capacity - 1);
+            ng->set.slots[j] = *e;
+        }
+        ng->set.count = g->set.count;
+    }
+    for (size_t i = 0; i < sp->items->count; i++) {
+        if (g) luby_grid_link(ng, i, g->cells[i * 2], g->cells[i * 2 + 1]);
+        else luby_grid_link(ng, i, luby_grid_coord(sp->pos[i * 2], sp->cell), luby_grid_coord(sp->pos[i * 2 + 1], sp->cell));
+    }
+    int rc = luby_enum_set_field(L, sp->obj, "_grid", uv);
+    for (size_t i = 0; !g && rc == 0 && i < sp->items->count; i++) {
+        size_t existing;
+        rc = luby_value_set_add(L, &ng->set, sp->items->items[i], i, &existing);
+    }
+    if (rc != 0) {
+        luby_enum_set_field(L, sp->obj, "_grid", luby_nil());
+        return rc;
+    }
+    *out = ng;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_file_exists(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) {
-        if (out) *out = luby_bool(0);
-        return (int)LUBY_E_OK;
+// A point given as argv[at], argv[at + 1] numbers or as a Vector2 at
+// argv[at]; returns the number of arguments used, 0 if there is no point
+static int luby_spatial_point(int argc, const luby_value *argv, int at, double *x, double *y) {
+    const luby_vector *v = at < argc ? luby_vector_of(argv[at], LUBY_VECTOR2) : NULL;
+    if (v) {
+        *x = v->c[0];
+        *y = v->c[1];
+        return 1;
     }
-    
-    if (!L->cfg.vfs.exists) {
-        if (out) *out = luby_bool(0);
-        return (int)LUBY_E_OK;
+    if (at + 1 >= argc || (argv[at].type != LUBY_T_INT && argv[at].type != LUBY_T_FLOAT) ||
+        (argv[at + 1].type != LUBY_T_INT && argv[at + 1].type != LUBY_T_FLOAT)) return 0;
+    *x = luby_to_double(argv[at]);
+    *y = luby_to_double(argv[at + 1]);
+    return 2;
+}
+
+static int luby_spatial_point_error(luby_state *L) {
+    luby_set_error(L, LUBY_E_TYPE, "SpatialHash: expected x and y numbers or a Vector2", NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
+
+// SpatialHash.new(cell_size = 64)
+static int luby_spatial_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    double cell = argc >= 2 ? luby_to_double(argv[1]) : 64.0;
+    if ((argc >= 2 && argv[1].type != LUBY_T_INT && argv[1].type != LUBY_T_FLOAT) || !(cell > 0.0) || isinf(cell)) {
+        luby_set_error(L, LUBY_E_TYPE, "SpatialHash: expected a positive cell size", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    
-    const char *path = (const char *)argv[0].as.ptr;
-    char resolved[1024];
-    
-    if (out) *out = luby_bool(luby_resolve_vfs_path(L, path, resolved, sizeof(resolved)));
+    luby_value sv;
+    luby_object *obj = luby_collection_new(L, argv[0], "_grid", &sv);
+    if (!obj) return (int)LUBY_E_OOM;
+    luby_value pos = luby_buffer_new(L, LUBY_FLOAT64, 32, NULL);
+    if (pos.type != LUBY_T_BUFFER || luby_enum_set_field(L, obj, "_pos", pos) != 0 ||
+        luby_enum_set_field(L, obj, "_cell", luby_float(cell)) != 0) return (int)LUBY_E_OOM;
+    *out = sv;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_includes(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2) return (int)LUBY_E_TYPE;
-    if (argv[0].type == LUBY_T_STRING && argv[0].as.ptr && argv[1].type == LUBY_T_STRING && argv[1].as.ptr) {
-        const char *haystack = (const char *)argv[0].as.ptr;
-        const char *needle = (const char *)argv[1].as.ptr;
-        if (out) *out = luby_bool(strstr(haystack, needle) != NULL);
-    } else if (argv[0].type == LUBY_T_ARRAY && argv[0].as.ptr) {
-        luby_array *arr = (luby_array *)argv[0].as.ptr;
-        int found = 0;
-        for (size_t i = 0; i < arr->count; i++) {
-            if (luby_value_eq(arr->items[i], argv[1])) { found = 1; break; }
-        }
-        if (out) *out = luby_bool(found);
-    } else if (argv[0].type == LUBY_T_RANGE) {
-        return luby_range_include(L, argc, argv, out);
-    } else return (int)LUBY_E_TYPE;
+// Room in _pos for one more item
+static int luby_spatial_grow(luby_state *L, luby_spatial *sp) {
+    size_t length = 0;
+    if (!luby_buffer_data(luby_collection_field(L, sp->obj, "_pos"), NULL, &length)) {
+        luby_set_error(L, LUBY_E_TYPE, "expected a SpatialHash", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
+    }
+    if ((sp->items->count + 1) * 2 <= length) return (int)LUBY_E_OK;
+    luby_value pos = luby_buffer_new(L, LUBY_FLOAT64, length * 2, NULL);
+    double *data = (double *)luby_buffer_data(pos, NULL, NULL);
+    if (!data) return (int)LUBY_E_OOM;
+    memcpy(data, sp->pos, sp->items->count * 2 * sizeof(double));
+    if (luby_enum_set_field(L, sp->obj, "_pos", pos) != 0) return (int)LUBY_E_OOM;
+    sp->pos = data;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_index(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    (void)L;
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    for (size_t i = 0; i < arr->count; i++) {
-        if (luby_value_eq(arr->items[i], argv[1])) {
-            if (out) *out = luby_int((int64_t)i);
-            return (int)LUBY_E_OK;
+// Put item i at (x, y), relinking it if its cell changed
+static void luby_spatial_place(luby_spatial *sp, luby_grid_index *g, size_t i, double x, double y) {
+    int32_t cx = luby_grid_coord(x, sp->cell), cy = luby_grid_coord(y, sp->cell);
+    sp->pos[i * 2] = x;
+    sp->pos[i * 2 + 1] = y;
+    if (g->cells[i * 2] == cx && g->cells[i * 2 + 1] == cy) return;
+    luby_grid_unlink(g, i);
+    luby_grid_link(g, i, cx, cy);
+}
+
+#define LUBY_SPATIAL_SELF(L, argc, argv, sp) \
+    luby_spatial sp; \
+    if ((argc) < 1) return (int)LUBY_E_TYPE; \
+    { int _rc = luby_spatial_get((L), (argv)[0], &sp); if (_rc != 0) return _rc; }
+
+// insert(payload, x, y) or insert(payload, vector2): adds the payload, or
+// moves it if present; returns self
+static int luby_spatial_insert(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    double x, y;
+    if (argc < 2 || !luby_spatial_point(argc, argv, 2, &x, &y)) return luby_spatial_point_error(L);
+    luby_grid_index *g;
+    size_t existing;
+    int rc = luby_spatial_grow(L, &sp);
+    if (rc == 0) rc = luby_grid_reserve(L, &sp, 1, &g);
+    if (rc == 0) rc = luby_value_set_add(L, &g->set, argv[1], sp.items->count, &existing);
+    if (rc != 0) return rc;
+    if (existing != LUBY_VALUE_SET_NONE) {
+        luby_spatial_place(&sp, g, existing, x, y);
+    } else {
+        size_t i = sp.items->count;
+        if ((rc = luby_array_append(L, sp.items, argv[1])) != 0) {
+            size_t at;
+            luby_value_set_remove(L, &g->set, argv[1], &at);
+            return rc;
         }
+        sp.pos[i * 2] = x;
+        sp.pos[i * 2 + 1] = y;
+        luby_grid_link(g, i, luby_grid_coord(x, sp.cell), luby_grid_coord(y, sp.cell));
     }
-    if (out) *out = luby_nil();
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_concat(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || argv[1].type != LUBY_T_ARRAY) return (int)LUBY_E_TYPE;
-    luby_array *a = (luby_array *)argv[0].as.ptr;
-    luby_array *b = (luby_array *)argv[1].as.ptr;
-    luby_array *result = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!result) return (int)LUBY_E_OOM;
-    result->count = a->count + b->count;
-    result->capacity = result->count;
-    result->frozen = 0;
-    result->items = (luby_value *)luby_alloc_raw(L, NULL, result->capacity * sizeof(luby_value));
-    memcpy(result->items, a->items, a->count * sizeof(luby_value));
-    memcpy(result->items + a->count, b->items, b->count * sizeof(luby_value));
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = result; }
+// move(payload, x, y) or move(payload, vector2): self, or nil when the
+// payload is absent
+static int luby_spatial_move(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    double x, y;
+    if (argc < 2 || !luby_spatial_point(argc, argv, 2, &x, &y)) return luby_spatial_point_error(L);
+    luby_grid_index *g;
+    size_t at = LUBY_VALUE_SET_NONE;
+    int rc = luby_grid_reserve(L, &sp, 0, &g);
+    if (rc == 0) rc = luby_value_set_find(L, &g->set, argv[1], &at);
+    if (rc != 0) return rc;
+    if (at != LUBY_VALUE_SET_NONE) luby_spatial_place(&sp, g, at, x, y);
+    if (out) *out = at != LUBY_VALUE_SET_NONE ? argv[0] : luby_nil();
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_take(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    size_t n = (size_t)argv[1].as.i;
-    if (n > arr->count) n = arr->count;
-    luby_array *result = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!result) return (int)LUBY_E_OOM;
-    result->count = n;
-    result->capacity = n > 0 ? n : 1;
-    result->frozen = 0;
-    result->items = (luby_value *)luby_alloc_raw(L, NULL, result->capacity * sizeof(luby_value));
-    memcpy(result->items, arr->items, n * sizeof(luby_value));
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = result; }
+// remove(payload): the payload, or nil when it was absent
+static int luby_spatial_remove(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_grid_index *g;
+    size_t at = LUBY_VALUE_SET_NONE;
+    int rc = luby_grid_reserve(L, &sp, 0, &g);
+    if (rc == 0) rc = luby_value_set_remove(L, &g->set, argv[1], &at);
+    if (rc != 0) return rc;
+    luby_value removed = at != LUBY_VALUE_SET_NONE ? sp.items->items[at] : luby_nil();
+    if (at != LUBY_VALUE_SET_NONE) {
+        size_t last = sp.items->count - 1;
+        luby_grid_unlink(g, at);
+        if (at != last) {
+            int32_t cx = g->cells[last * 2], cy = g->cells[last * 2 + 1];
+            luby_grid_unlink(g, last);
+            sp.items->items[at] = sp.items->items[last];
+            sp.pos[at * 2] = sp.pos[last * 2];
+            sp.pos[at * 2 + 1] = sp.pos[last * 2 + 1];
+            luby_grid_link(g, at, cx, cy);
+            rc = luby_value_set_move(L, &g->set, sp.items->items[at], last, at);
+        }
+        sp.items->count--;
+    }
+    if (out) *out = removed;
+    return rc;
+}
+
+// position(payload): [x, y], or nil when the payload is absent
+static int luby_spatial_position(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_grid_index *g;
+    size_t at = LUBY_VALUE_SET_NONE;
+    int rc = luby_grid_reserve(L, &sp, 0, &g);
+    if (rc == 0) rc = luby_value_set_find(L, &g->set, argv[1], &at);
+    if (rc != 0) return rc;
+    luby_value r = luby_nil();
+    if (at != LUBY_VALUE_SET_NONE) {
+        r = luby_array_new(L);
+        if (r.type != LUBY_T_ARRAY ||
+            luby_array_append(L, (luby_array *)r.as.ptr, luby_float(sp.pos[at * 2])) != 0 ||
+            luby_array_append(L, (luby_array *)r.as.ptr, luby_float(sp.pos[at * 2 + 1])) != 0) return (int)LUBY_E_OOM;
+    }
+    if (out) *out = r;
     return (int)LUBY_E_OK;
 }
 
-static int luby_base_drop(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 2 || argv[0].type != LUBY_T_ARRAY || argv[1].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
-    luby_array *arr = (luby_array *)argv[0].as.ptr;
-    size_t n = (size_t)argv[1].as.i;
-    if (n > arr->count) n = arr->count;
-    size_t rem = arr->count - n;
-    luby_array *result = (luby_array *)luby_gc_alloc(L, sizeof(luby_array), LUBY_GC_ARRAY);
-    if (!result) return (int)LUBY_E_OOM;
-    result->count = rem;
-    result->capacity = rem > 0 ? rem : 1;
-    result->frozen = 0;
-    result->items = (luby_value *)luby_alloc_raw(L, NULL, result->capacity * sizeof(luby_value));
-    memcpy(result->items, arr->items + n, rem * sizeof(luby_value));
-    if (out) { out->type = LUBY_T_ARRAY; out->as.ptr = result; }
+static int luby_spatial_include(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    if (argc < 2) return (int)LUBY_E_TYPE;
+    luby_grid_index *g;
+    size_t at = LUBY_VALUE_SET_NONE;
+    int rc = luby_grid_reserve(L, &sp, 0, &g);
+    if (rc == 0) rc = luby_value_set_find(L, &g->set, argv[1], &at);
+    if (rc == 0 && out) *out = luby_bool(at != LUBY_VALUE_SET_NONE);
+    return rc;
+}
+
+static int luby_spatial_clear(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    sp.items->count = 0;
+    luby_enum_set_field(L, sp.obj, "_grid", luby_nil());
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
-static int luby_str_capitalize(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t len = strlen(src);
-    // Pause GC - src points to argv which may not be rooted during alloc
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src, len);
-    if (!dst) { L->gc_paused = was_paused; return (int)LUBY_E_OOM; }
-    for (size_t i = 0; i < len; i++) {
-        if (i == 0 && src[i] >= 'a' && src[i] <= 'z') dst[i] = (char)(src[i] - 32);
-        else if (i > 0 && src[i] >= 'A' && src[i] <= 'Z') dst[i] = (char)(src[i] + 32);
-        else dst[i] = src[i];
+static int luby_spatial_cell_size(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    if (out) *out = luby_float(sp.cell);
+    return (int)LUBY_E_OK;
+}
+
+// Payloads inside a circle (r >= 0) or a box. Cells overlapping the shape
+// are visited through their buckets, skipping items that only share the
+// bucket; when the shape spans more cells than there are items, every item
+// is tested instead. Matches are collected before any block runs, so the
+// block may insert, move or remove freely.
+static int luby_spatial_collect(luby_state *L, luby_spatial *sp, double x0, double y0, double x1, double y1,
+                                double cx, double cy, double r, luby_value *out) {
+    luby_grid_index *g;
+    int rc = luby_grid_reserve(L, sp, 0, &g);
+    if (rc != 0) return rc;
+    luby_value av = luby_array_new(L);
+    if (av.type != LUBY_T_ARRAY || !luby_gc_push_temp(L, av)) return (int)LUBY_E_OOM;
+    luby_array *arr = (luby_array *)av.as.ptr;
+    int32_t gx0 = luby_grid_coord(x0, sp->cell), gy0 = luby_grid_coord(y0, sp->cell);
+    int32_t gx1 = luby_grid_coord(x1, sp->cell), gy1 = luby_grid_coord(y1, sp->cell);
+    double span = ((double)gx1 - gx0 + 1.0) * ((double)gy1 - gy0 + 1.0);
+    const double *pos = sp->pos;
+    double r2 = r * r;
+#define LUBY_SPATIAL_HIT(i) \
+    (r >= 0.0 ? (pos[(i) * 2] - cx) * (pos[(i) * 2] - cx) + (pos[(i) * 2 + 1] - cy) * (pos[(i) * 2 + 1] - cy) <= r2 \
+              : pos[(i) * 2] >= x0 && pos[(i) * 2] <= x1 && pos[(i) * 2 + 1] >= y0 && pos[(i) * 2 + 1] <= y1)
+    if (span > (double)sp->items->count) {
+        for (size_t i = 0; rc == 0 && i < sp->items->count; i++) {
+            if (LUBY_SPATIAL_HIT(i)) rc = luby_array_append(L, arr, sp->items->items[i]);
+        }
+    } else {
+        for (int32_t gy = gy0; rc == 0 && gy <= gy1; gy++) {
+            for (int32_t gx = gx0; rc == 0 && gx <= gx1; gx++) {
+                for (uint32_t e = g->heads[luby_grid_bucket(g, gx, gy)]; rc == 0 && e; e = g->next[e - 1]) {
+                    size_t i = e - 1;
+                    if (g->cells[i * 2] != gx || g->cells[i * 2 + 1] != gy || !LUBY_SPATIAL_HIT(i)) continue;
+                    rc = luby_array_append(L, arr, sp->items->items[i]);
+                }
+            }
+        }
     }
-    L->gc_paused = was_paused;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+#undef LUBY_SPATIAL_HIT
+    if (rc != 0) return rc;
+    *out = av;
     return (int)LUBY_E_OK;
 }
 
-static int luby_str_strip(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    if (argc < 1 || argv[0].type != LUBY_T_STRING || !argv[0].as.ptr) return (int)LUBY_E_TYPE;
-    const char *src = (const char *)argv[0].as.ptr;
-    size_t len = strlen(src);
-    size_t start = 0, end = len;
-    while (start < len && (src[start] == ' ' || src[start] == '\t' || src[start] == '\n' || src[start] == '\r')) start++;
-    while (end > start && (src[end-1] == ' ' || src[end-1] == '\t' || src[end-1] == '\n' || src[end-1] == '\r')) end--;
-    size_t new_len = end - start;
-    // Pause GC - src points to argv which may not be rooted during alloc
-    int was_paused = L->gc_paused;
-    L->gc_paused = 1;
-    char *dst = luby_gc_alloc_string(L, src + start, new_len);
-    L->gc_paused = was_paused;
-    if (!dst) return (int)LUBY_E_OOM;
-    if (out) { out->type = LUBY_T_STRING; out->as.ptr = dst; }
+// The matches as an Array, or yielded one by one with self returned
+static int luby_spatial_results(luby_state *L, luby_value self, luby_value found, luby_value *out) {
+    luby_proc *block = L->current_block.type == LUBY_T_PROC ? (luby_proc *)L->current_block.as.ptr : NULL;
+    if (!block) {
+        if (out) *out = found;
+        return (int)LUBY_E_OK;
+    }
+    luby_array *arr = (luby_array *)found.as.ptr;
+    for (size_t i = 0; i < arr->count; i++) {
+        luby_value res = luby_nil();
+        LUBY_CALL_BLOCK_OR_BREAK(L, block, 1, &arr->items[i], &res, out, luby_nil());
+    }
+    if (out) *out = self;
     return (int)LUBY_E_OK;
 }
 
-/* ------------------------------------------------------------------ */
-/*  Struct.new(:field1, :field2, ...) → creates a new struct class     */
-/* ------------------------------------------------------------------ */
-static int luby_struct_create_class(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
-    /* argv[0] = Struct class (receiver), argv[1..] = symbol names */
-    int field_count = argc - 1;
-    if (field_count < 1 || field_count > 32) {
-        luby_set_error(L, LUBY_E_TYPE, "wrong number of arguments for Struct.new", NULL, 0, 0);
+// query(x, y, radius) or query(vector2, radius): payloads within radius
+static int luby_spatial_query(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    double x, y;
+    int used = luby_spatial_point(argc, argv, 1, &x, &y);
+    if (!used) return luby_spatial_point_error(L);
+    luby_value rv = 1 + used < argc ? argv[1 + used] : luby_nil();
+    double r = luby_to_double(rv);
+    if ((rv.type != LUBY_T_INT && rv.type != LUBY_T_FLOAT) || !(r >= 0.0)) {
+        luby_set_error(L, LUBY_E_TYPE, "query: expected a non-negative radius", NULL, 0, 0);
         return (int)LUBY_E_TYPE;
     }
-    const char *fields[32];
-    for (int i = 0; i < field_count; i++) {
-        if (argv[i + 1].type != LUBY_T_SYMBOL || !argv[i + 1].as.ptr) {
-            luby_set_error(L, LUBY_E_TYPE, "expected symbol for Struct field", NULL, 0, 0);
-            return (int)LUBY_E_TYPE;
-        }
-        fields[i] = (const char *)argv[i + 1].as.ptr;
+    luby_value found;
+    int rc = luby_spatial_collect(L, &sp, x - r, y - r, x + r, y + r, x, y, r, &found);
+    return rc != 0 ? rc : luby_spatial_results(L, argv[0], found, out);
+}
+
+// query_rect(x0, y0, x1, y1) or query_rect(min_vector2, max_vector2):
+// payloads inside the box, edges included
+static int luby_spatial_query_rect(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_SPATIAL_SELF(L, argc, argv, sp);
+    double x0, y0, x1, y1;
+    int used = luby_spatial_point(argc, argv, 1, &x0, &y0);
+    if (!used || !luby_spatial_point(argc, argv, 1 + used, &x1, &y1)) return luby_spatial_point_error(L);
+    if (x1 < x0) { double t = x0; x0 = x1; x1 = t; }
+    if (y1 < y0) { double t = y0; y0 = y1; y1 = t; }
+    luby_value found;
+    int rc = luby_spatial_collect(L, &sp, x0, y0, x1, y1, 0.0, 0.0, -1.0, &found);
+    return rc != 0 ? rc : luby_spatial_results(L, argv[0], found, out);
+}
+
+// ------------------------------- Tweener -------------------------------
+// Runs many property tweens in one native tick. Like the collections
+// above, a Tweener is an ordinary object: the targets live in `_items`,
+// property names in `_props`, completion blocks in `_done`, and the numbers
+// in the Float64Array `_data`, LUBY_TWEEN_STRIDE per tween. Each tween
+// remembers where its property lives, so a tick writes straight into the
+// ivar, Struct slot or bound userdata field without a method call.
+
+enum {
+    LUBY_TWEEN_FROM,
+    LUBY_TWEEN_TO,
+    LUBY_TWEEN_DURATION,
+    LUBY_TWEEN_ELAPSED,
+    LUBY_TWEEN_CURVE,
+    LUBY_TWEEN_KIND,            // one of the LUBY_TWEEN_AT_* below
+    LUBY_TWEEN_LOC,             // ivar index, slot index or field offset
+    LUBY_TWEEN_TYPE,            // field type; for objects, 1 to write Integers
+    LUBY_TWEEN_STRIDE
+};
+
+enum { LUBY_TWEEN_AT_IVAR, LUBY_TWEEN_AT_SLOT, LUBY_TWEEN_AT_FIELD };
+
+typedef struct luby_tweener {
+    luby_object *obj;
+    luby_array *items;
+    luby_array *props;
+    luby_array *done;
+    double *data;
+} luby_tweener;
+
+static int luby_tweener_get(luby_state *L, luby_value v, luby_tweener *tw) {
+    tw->items = luby_collection_items(L, v, "_data", &tw->obj);
+    luby_value pv = tw->items ? luby_collection_field(L, tw->obj, "_props") : luby_nil();
+    luby_value dv = tw->items ? luby_collection_field(L, tw->obj, "_done") : luby_nil();
+    size_t length = 0;
+    tw->data = tw->items ? (double *)luby_buffer_data(luby_collection_field(L, tw->obj, "_data"), NULL, &length) : NULL;
+    tw->props = pv.type == LUBY_T_ARRAY ? (luby_array *)pv.as.ptr : NULL;
+    tw->done = dv.type == LUBY_T_ARRAY ? (luby_array *)dv.as.ptr : NULL;
+    if (!tw->items || !tw->props || !tw->done || !tw->data || length < tw->items->count * LUBY_TWEEN_STRIDE ||
+        tw->props->count != tw->items->count || tw->done->count != tw->items->count) {
+        luby_set_error(L, LUBY_E_TYPE, "expected a Tweener", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    /* Generate unique class name */
-    static int struct_counter = 0;
-    char class_name[64];
-    snprintf(class_name, sizeof(class_name), "Struct__%d", struct_counter++);
+    return (int)LUBY_E_OK;
+}
+
+#define LUBY_TWEENER_SELF(L, argc, argv, tw) \
+    luby_tweener tw; \
+    if ((argc) < 1) return (int)LUBY_E_TYPE; \
+    { int _rc = luby_tweener_get((L), (argv)[0], &tw); if (_rc != 0) return _rc; }
+
+// Tweener.new
+static int luby_tweener_new(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1 || argv[0].type != LUBY_T_CLASS) return (int)LUBY_E_TYPE;
+    luby_value tv;
+    luby_object *obj = luby_collection_new(L, argv[0], "_data", &tv);
+    luby_value props = obj ? luby_array_new(L) : luby_nil();
+    if (props.type != LUBY_T_ARRAY || luby_enum_set_field(L, obj, "_props", props) != 0) return (int)LUBY_E_OOM;
+    luby_value done = luby_array_new(L);
+    if (done.type != LUBY_T_ARRAY || luby_enum_set_field(L, obj, "_done", done) != 0) return (int)LUBY_E_OOM;
+    luby_value data = luby_buffer_new(L, LUBY_FLOAT64, 16 * LUBY_TWEEN_STRIDE, NULL);
+    if (data.type != LUBY_T_BUFFER || luby_enum_set_field(L, obj, "_data", data) != 0) return (int)LUBY_E_OOM;
+    *out = tv;
+    return (int)LUBY_E_OK;
+}
 
-    /* Build Ruby code for the class */
-    char buf[8192];
-    int pos = 0;
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "class %s\n", class_name);
+// The property name without a leading '@'
+static const char *luby_tween_prop_name(luby_value prop) {
+    const char *name = (const char *)prop.as.ptr;
+    return name[0] == '@' ? name + 1 : name;
+}
 
-    /* initialize(field1, field2, ...) */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def initialize(");
-    for (int i = 0; i < field_count; i++) {
-        if (i > 0) pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ", ");
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "%s", fields[i]);
+// Find where `prop` lives on `target`, filling the kind, location and type
+// of rec. An object's ivar is created (as nil) if it does not exist yet.
+static int luby_tween_locate(luby_state *L, luby_value target, luby_value prop, double *rec) {
+    const char *name = luby_tween_prop_name(prop);
+    if (target.type == LUBY_T_OBJECT && target.as.ptr) {
+        luby_object *o = (luby_object *)target.as.ptr;
+        char ivar[128];
+        size_t n = strlen(name);
+        if (n + 2 > sizeof(ivar)) return (int)LUBY_E_TYPE;
+        ivar[0] = '@';
+        memcpy(ivar + 1, name, n + 1);
+        int slot = o->slot_count ? luby_struct_ivar_slot(o, ivar) : -1;
+        if (slot >= 0) {
+            rec[LUBY_TWEEN_KIND] = LUBY_TWEEN_AT_SLOT;
+            rec[LUBY_TWEEN_LOC] = slot;
+            return (int)LUBY_E_OK;
+        }
+        size_t i = 0;
+        while (i < o->ivar_count && strcmp(o->ivar_names[i], ivar) != 0) i++;
+        if (i == o->ivar_count && !luby_object_set_ivar(L, o, ivar, luby_nil())) return (int)LUBY_E_OOM;
+        rec[LUBY_TWEEN_KIND] = LUBY_TWEEN_AT_IVAR;
+        rec[LUBY_TWEEN_LOC] = (double)i;
+        return (int)LUBY_E_OK;
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ")\n");
-    for (int i = 0; i < field_count; i++) {
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "    @%s = %s\n", fields[i], fields[i]);
+    if (target.type == LUBY_T_USERDATA && target.as.ptr) {
+        char setter[128];
+        size_t n = strlen(name);
+        if (n + 2 > sizeof(setter)) return (int)LUBY_E_TYPE;
+        memcpy(setter, name, n);
+        memcpy(setter + n, "=", 2);
+        const luby_field_slot *fs = luby_field_resolve(L, ((luby_userdata *)target.as.ptr)->klass, setter, 2);
+        if (!fs || fs->readonly || fs->type == LUBY_FIELD_BOOL) return (int)LUBY_E_TYPE;
+        rec[LUBY_TWEEN_KIND] = LUBY_TWEEN_AT_FIELD;
+        rec[LUBY_TWEEN_LOC] = (double)fs->offset;
+        rec[LUBY_TWEEN_TYPE] = fs->type;
+        return (int)LUBY_E_OK;
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  end\n");
+    return (int)LUBY_E_TYPE;
+}
 
-    /* attr readers and writers */
-    for (int i = 0; i < field_count; i++) {
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos),
-            "  def %s\n    @%s\n  end\n", fields[i], fields[i]);
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos),
-            "  def %s=(v)\n    @%s = v\n  end\n", fields[i], fields[i]);
+// Read (argc 1) or write (argc 2) the property a tween points at
+static int luby_tween_access(luby_state *L, luby_value target, luby_value prop, double *rec, int argc, luby_value *v) {
+    int kind = (int)rec[LUBY_TWEEN_KIND];
+    size_t loc = (size_t)rec[LUBY_TWEEN_LOC];
+    if (kind == LUBY_TWEEN_AT_FIELD) {
+        luby_field_slot fs;
+        memset(&fs, 0, sizeof(fs));
+        fs.offset = loc;
+        fs.type = (luby_field_type)(int)rec[LUBY_TWEEN_TYPE];
+        return luby_field_access(L, (luby_userdata *)target.as.ptr, &fs, argc, v);
+    }
+    luby_object *o = (luby_object *)target.as.ptr;
+    if (argc == 2 && o->frozen) {
+        luby_set_error(L, LUBY_E_RUNTIME, "frozen", NULL, 0, 0);
+        return (int)LUBY_E_RUNTIME;
     }
+    luby_value *at = NULL;
+    if (kind == LUBY_TWEEN_AT_SLOT) at = loc < o->slot_count ? &o->slots[loc] : NULL;
+    else if (loc < o->ivar_count && strcmp(o->ivar_names[loc] + 1, luby_tween_prop_name(prop)) == 0) at = &o->ivar_values[loc];
+    if (!at) {
+        // The ivar moved (the object was copied into a clone): find it again
+        int rc = luby_tween_locate(L, target, prop, rec);
+        if (rc != 0) return rc;
+        return luby_tween_access(L, target, prop, rec, argc, v);
+    }
+    if (argc == 1) *v = *at;
+    else *at = *v;
+    return (int)LUBY_E_OK;
+}
 
-    /* to_s */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def to_s\n    \"#<struct ");
-    for (int i = 0; i < field_count; i++) {
-        if (i > 0) pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ", ");
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "%s=#{@%s}", fields[i], fields[i]);
-    }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ">\"\n  end\n");
+// The value a tween writes for eased progress e
+static luby_value luby_tween_value(const double *rec, double e) {
+    double from = rec[LUBY_TWEEN_FROM], to = rec[LUBY_TWEEN_TO];
+    double d = e >= 1.0 ? to : from + (to - from) * e;
+    int kind = (int)rec[LUBY_TWEEN_KIND], type = (int)rec[LUBY_TWEEN_TYPE];
+    int integral = kind == LUBY_TWEEN_AT_FIELD ? type != LUBY_FIELD_FLOAT && type != LUBY_FIELD_DOUBLE : type == 1;
+    return integral ? luby_int((int64_t)floor(d + 0.5)) : luby_float(d);
+}
 
-    /* to_a */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def to_a\n    [");
-    for (int i = 0; i < field_count; i++) {
-        if (i > 0) pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ", ");
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "@%s", fields[i]);
+// Room in _data for one more tween
+static int luby_tweener_grow(luby_state *L, luby_tweener *tw) {
+    size_t length = 0;
+    if (!luby_buffer_data(luby_collection_field(L, tw->obj, "_data"), NULL, &length)) {
+        luby_set_error(L, LUBY_E_TYPE, "expected a Tweener", NULL, 0, 0);
+        return (int)LUBY_E_TYPE;
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "]\n  end\n");
+    if ((tw->items->count + 1) * LUBY_TWEEN_STRIDE <= length) return (int)LUBY_E_OK;
+    luby_value data = luby_buffer_new(L, LUBY_FLOAT64, length * 2, NULL);
+    double *d = (double *)luby_buffer_data(data, NULL, NULL);
+    if (!d) return (int)LUBY_E_OOM;
+    memcpy(d, tw->data, tw->items->count * LUBY_TWEEN_STRIDE * sizeof(double));
+    if (luby_enum_set_field(L, tw->obj, "_data", data) != 0) return (int)LUBY_E_OOM;
+    tw->data = d;
+    return (int)LUBY_E_OK;
+}
 
-    /* to_h */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def to_h\n    {");
-    for (int i = 0; i < field_count; i++) {
-        if (i > 0) pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ", ");
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "%s: @%s", fields[i], fields[i]);
-    }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "}\n  end\n");
+static int luby_tweener_error(luby_state *L, const char *message) {
+    luby_set_error(L, LUBY_E_TYPE, message, NULL, 0, 0);
+    return (int)LUBY_E_TYPE;
+}
 
-    /* members */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def members\n    [");
-    for (int i = 0; i < field_count; i++) {
-        if (i > 0) pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ", ");
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), ":%s", fields[i]);
+// add(target, prop, from, to, duration, curve = :linear) { |target| ... }:
+// from nil starts at the property's current value; returns self
+static int luby_tweener_add(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_TWEENER_SELF(L, argc, argv, tw);
+    if (argc < 6) return luby_tweener_error(L, "add: expected target, property, from, to and duration");
+    luby_value target = argv[1], prop = argv[2];
+    if (prop.type != LUBY_T_SYMBOL && prop.type != LUBY_T_STRING) return luby_tweener_error(L, "add: property must be a Symbol or String");
+    prop = prop.type == LUBY_T_SYMBOL ? prop : luby_symbol(L, (const char *)prop.as.ptr, 0);
+    for (int i = 3; i <= 5; i++) {
+        if ((i > 3 || argv[i].type != LUBY_T_NIL) && argv[i].type != LUBY_T_INT && argv[i].type != LUBY_T_FLOAT) {
+            return luby_tweener_error(L, "add: from, to and duration must be numbers");
+        }
+    }
+    double duration = luby_to_double(argv[5]);
+    if (!(duration >= 0.0)) return luby_tweener_error(L, "add: duration must not be negative");
+    int curve = 0;
+    int rc = argc >= 7 ? luby_ease_arg(L, argv[6], "add: unknown easing curve", &curve) : 0;
+    if (rc != 0) return rc;
+    double rec[LUBY_TWEEN_STRIDE];
+    memset(rec, 0, sizeof(rec));
+    rc = luby_tween_locate(L, target, prop, rec);
+    if (rc == (int)LUBY_E_TYPE) return luby_tweener_error(L, "add: target has no such ivar or writable numeric field");
+    if (rc != 0) return rc;
+    luby_value from = argv[3];
+    if (from.type == LUBY_T_NIL && (rc = luby_tween_access(L, target, prop, rec, 1, &from)) != 0) return rc;
+    if (from.type != LUBY_T_INT && from.type != LUBY_T_FLOAT) return luby_tweener_error(L, "add: property does not hold a number");
+    rec[LUBY_TWEEN_FROM] = luby_to_double(from);
+    rec[LUBY_TWEEN_TO] = luby_to_double(argv[4]);
+    rec[LUBY_TWEEN_DURATION] = duration;
+    rec[LUBY_TWEEN_CURVE] = curve;
+    if (rec[LUBY_TWEEN_KIND] != LUBY_TWEEN_AT_FIELD) rec[LUBY_TWEEN_TYPE] = from.type == LUBY_T_INT && argv[4].type == LUBY_T_INT;
+    luby_value block = L->current_block.type == LUBY_T_PROC ? L->current_block : luby_nil();
+    if ((rc = luby_tweener_grow(L, &tw)) != 0) return rc;
+    if (luby_array_append(L, tw.items, target) != 0) return (int)LUBY_E_OOM;
+    if (luby_array_append(L, tw.props, prop) != 0 || luby_array_append(L, tw.done, block) != 0) {
+        tw.items->count--;
+        tw.props->count = tw.done->count = tw.items->count;
+        return (int)LUBY_E_OOM;
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "]\n  end\n");
+    memcpy(tw.data + (tw.items->count - 1) * LUBY_TWEEN_STRIDE, rec, sizeof(rec));
+    if (out) *out = argv[0];
+    return (int)LUBY_E_OK;
+}
 
-    /* == */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def ==(other)\n    ");
-    for (int i = 0; i < field_count; i++) {
-        if (i > 0) pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), " && ");
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "@%s == other.%s", fields[i], fields[i]);
-    }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "\n  end\n");
+// Move tween `from` into position `to`
+static void luby_tweener_move(luby_tweener *tw, size_t from, size_t to) {
+    tw->items->items[to] = tw->items->items[from];
+    tw->props->items[to] = tw->props->items[from];
+    tw->done->items[to] = tw->done->items[from];
+    memcpy(tw->data + to * LUBY_TWEEN_STRIDE, tw->data + from * LUBY_TWEEN_STRIDE, LUBY_TWEEN_STRIDE * sizeof(double));
+}
 
-    /* [] accessor */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def [](key)\n");
-    for (int i = 0; i < field_count; i++) {
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos),
-            "    %s key == :%s || key == %d\n      @%s\n",
-            i == 0 ? "if" : "elsif", fields[i], i, fields[i]);
+// tick(dt): advance every tween by dt seconds and write its property.
+// Finished tweens are dropped, then their blocks run in the order the
+// tweens were added, each given its target. Returns the number still
+// running.
+static int luby_tweener_tick(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_TWEENER_SELF(L, argc, argv, tw);
+    if (argc < 2 || (argv[1].type != LUBY_T_INT && argv[1].type != LUBY_T_FLOAT) || !(luby_to_double(argv[1]) >= 0.0)) {
+        return luby_tweener_error(L, "tick: expected a non-negative time step");
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "    else\n      nil\n    end\n  end\n");
-
-    /* []= accessor */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def []=(key, val)\n");
-    for (int i = 0; i < field_count; i++) {
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos),
-            "    %s key == :%s || key == %d\n      @%s = val\n",
-            i == 0 ? "if" : "elsif", fields[i], i, fields[i]);
+    double dt = luby_to_double(argv[1]);
+    luby_array *fired = NULL;
+    size_t n = tw.items->count, kept = 0;
+    int rc = 0;
+    for (size_t i = 0; i < n; i++) {
+        double *rec = tw.data + i * LUBY_TWEEN_STRIDE;
+        int finished = 0;
+        if (rc == 0) {
+            rec[LUBY_TWEEN_ELAPSED] += dt;
+            double t = rec[LUBY_TWEEN_DURATION] > 0.0 ? rec[LUBY_TWEEN_ELAPSED] / rec[LUBY_TWEEN_DURATION] : 1.0;
+            finished = t >= 1.0;
+            int curve = (int)rec[LUBY_TWEEN_CURVE];
+            luby_value v = luby_tween_value(rec, finished ? 1.0 : curve ? luby_ease_apply(curve, t) : t);
+            rc = luby_tween_access(L, tw.items->items[i], tw.props->items[i], rec, 2, &v);
+            if (rc != 0) finished = 0;
+        }
+        if (finished && tw.done->items[i].type == LUBY_T_PROC) {
+            if (!fired) {
+                luby_value fv = luby_array_new(L);
+                if (fv.type != LUBY_T_ARRAY || !luby_gc_push_temp(L, fv)) return (int)LUBY_E_OOM;
+                fired = (luby_array *)fv.as.ptr;
+            }
+            if (luby_array_append(L, fired, tw.done->items[i]) != 0 ||
+                luby_array_append(L, fired, tw.items->items[i]) != 0) rc = (int)LUBY_E_OOM;
+        }
+        if (finished) continue;
+        if (kept != i) luby_tweener_move(&tw, i, kept);
+        kept++;
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "    end\n  end\n");
-
-    /* each */
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "  def each(&blk)\n");
-    for (int i = 0; i < field_count; i++) {
-        pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "    blk.call(@%s)\n", fields[i]);
+    tw.items->count = tw.props->count = tw.done->count = kept;
+    if (rc != 0) return rc;
+    for (size_t i = 0; fired && i + 1 < fired->count; i += 2) {
+        luby_value res = luby_nil();
+        int brc = luby_call_block(L, (luby_proc *)fired->items[i].as.ptr, 1, &fired->items[i + 1], &res);
+        if (brc == (int)LUBY_E_BREAK) {
+            L->block_break = 0;
+            continue;
+        }
+        if (brc != 0) {
+            if (L->last_error.code == LUBY_E_OK) luby_set_error(L, LUBY_E_RUNTIME, "tween block failed", NULL, 0, 0);
+            return (int)LUBY_E_RUNTIME;
+        }
     }
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "    self\n  end\n");
-
-    pos += snprintf(buf + pos, (size_t)(sizeof(buf) - pos), "end\n");
+    if (out) *out = luby_int((int64_t)tw.items->count);
+    return (int)LUBY_E_OK;
+}
 
-    /* Eval the class definition */
-    int eval_rc = luby_eval(L, buf, 0, "<struct>", NULL);
-    (void)eval_rc;
-    luby_clear_error(L);
+// cancel(target, prop = nil): drop target's tweens (only those of prop if
+// given) without running their blocks; returns how many were dropped
+static int luby_tweener_cancel(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_TWEENER_SELF(L, argc, argv, tw);
+    if (argc < 2) return luby_tweener_error(L, "cancel: expected a target");
+    const char *name = argc >= 3 && (argv[2].type == LUBY_T_SYMBOL || argv[2].type == LUBY_T_STRING)
+                     ? luby_tween_prop_name(argv[2]) : NULL;
+    size_t n = tw.items->count, kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        luby_value t = tw.items->items[i];
+        int match = t.type == argv[1].type && t.as.ptr == argv[1].as.ptr &&
+                    (!name || strcmp(luby_tween_prop_name(tw.props->items[i]), name) == 0);
+        if (match) continue;
+        if (kept != i) luby_tweener_move(&tw, i, kept);
+        kept++;
+    }
+    tw.items->count = tw.props->count = tw.done->count = kept;
+    if (out) *out = luby_int((int64_t)(n - kept));
+    return (int)LUBY_E_OK;
+}
 
-    /* Return the class */
-    if (out) *out = luby_get_global_value(L, class_name);
+static int luby_tweener_clear(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    LUBY_TWEENER_SELF(L, argc, argv, tw);
+    tw.items->count = tw.props->count = tw.done->count = 0;
+    if (out) *out = argv[0];
     return (int)LUBY_E_OK;
 }
 
+// Pure numeric builtins: typed, so the VM checks arguments and, where an
+// unboxed entry is given, calls it directly with doubles
+static void luby_register_numeric(luby_state *L, const char *name, luby_cfunc fn, int arity,
+                                  double (*num1)(double), double (*num2)(double, double)) {
+    luby_signature sig;
+    memset(&sig, 0, sizeof(sig));
+    sig.arity = arity;
+    for (int i = 0; i < arity; i++) sig.args[i] = LUBY_ARG_NUMBER;
+    sig.pure = 1;
+    sig.num1 = num1;
+    sig.num2 = num2;
+    luby_register_function_ex(L, name, fn, &sig);
+}
+
 LUBY_API void luby_open_base(luby_state *L) {
     if (!L) return;
     luby_register_function(L, "print", luby_base_print);
@@ -13020,9 +20751,13 @@ LUBY_API void luby_open_base(luby_state *L) {
     luby_register_function(L, "defined?", luby_base_defined);
     luby_register_function(L, "inspect", luby_base_inspect);
     luby_register_function(L, "object_id", luby_base_object_id);
+    luby_register_function(L, "hash", luby_base_hash);
     luby_register_function(L, "name", luby_class_name);
     luby_register_function(L, "superclass", luby_class_superclass);
     luby_register_function(L, "ancestors", luby_class_ancestors);
+    luby_register_function(L, "pool", luby_class_pool);
+    luby_register_function(L, "acquire", luby_class_acquire);
+    luby_register_function(L, "release", luby_class_release);
     luby_register_function(L, "to_sym", luby_symbol_to_sym);
     luby_register_function(L, "require", luby_base_require);
     luby_register_function(L, "load", luby_base_load);
@@ -13043,6 +20778,10 @@ LUBY_API void luby_open_base(luby_state *L) {
     luby_register_function(L, "lazy_to_a", luby_lazy_to_a);
     luby_register_function(L, "lazy_each", luby_lazy_each);
     luby_register_function(L, "lazy_first_n", luby_lazy_first_n);
+    /* Scoped numeric constants (the parser resolves Float::X as a global) */
+    luby_set_global_value(L, "Float::INFINITY", luby_float(HUGE_VAL));
+    luby_set_global_value(L, "Float::NAN", luby_float(NAN));
+    luby_set_global_value(L, "Float::EPSILON", luby_float(DBL_EPSILON));
     luby_register_function(L, "send", luby_base_send);
     luby_register_function(L, "caller", luby_base_caller);
     luby_register_function(L, "public_send", luby_base_public_send);
@@ -13063,6 +20802,16 @@ LUBY_API void luby_open_base(luby_state *L) {
     luby_register_function(L, "alias", luby_base_alias);
     luby_register_function(L, "array_push", luby_array_push);
     luby_register_function(L, "array_pop", luby_array_pop);
+    luby_register_function(L, "push", luby_array_push);
+    luby_register_function(L, "pop", luby_array_pop);
+    luby_register_function(L, "shift", luby_array_shift);
+    luby_register_function(L, "unshift", luby_array_unshift);
+    luby_register_function(L, "insert", luby_array_insert);
+    luby_register_function(L, "<<", luby_base_shl);
+    luby_register_function(L, ">>", luby_base_shr);
+    luby_register_function(L, "&", luby_base_and);
+    luby_register_function(L, "|", luby_base_or);
+    luby_register_function(L, "^", luby_base_xor);
     luby_register_function(L, "array_map", luby_array_map);
     luby_register_function(L, "array_select", luby_array_select);
     luby_register_function(L, "array_reject", luby_array_reject);
@@ -13141,6 +20890,9 @@ LUBY_API void luby_open_base(luby_state *L) {
     luby_register_function(L, "last", luby_array_last);
     luby_register_function(L, "flatten", luby_array_flatten);
     luby_register_function(L, "uniq", luby_array_uniq);
+    luby_register_function(L, "difference", luby_array_difference);
+    luby_register_function(L, "intersection", luby_array_intersection);
+    luby_register_function(L, "union", luby_array_union);
     luby_register_function(L, "sort", luby_array_sort);
     luby_register_function(L, "sort_by", luby_array_sort_by);
     luby_register_function(L, "min_by", luby_array_min_by);
@@ -13194,29 +20946,33 @@ LUBY_API void luby_open_base(luby_state *L) {
     luby_register_function(L, "rjust", luby_str_rjust);
     luby_register_function(L, "include?", luby_str_include);
     // Game math helpers
-    luby_register_function(L, "lerp", luby_math_lerp);
-    luby_register_function(L, "inverse_lerp", luby_math_inverse_lerp);
-    luby_register_function(L, "smoothstep", luby_math_smoothstep);
+    luby_register_numeric(L, "lerp", luby_math_lerp, 3, NULL, NULL);
+    luby_register_numeric(L, "inverse_lerp", luby_math_inverse_lerp, 3, NULL, NULL);
+    luby_register_numeric(L, "smoothstep", luby_math_smoothstep, 3, NULL, NULL);
+    {
+        luby_signature sig = { 2, { LUBY_ARG_ANY, LUBY_ARG_NUMBER }, LUBY_BLOCK_NONE, 1, NULL, NULL };
+        luby_register_function_ex(L, "ease", luby_math_ease, &sig);
+    }
     luby_register_function(L, "clamp", luby_math_clamp);
     luby_register_function(L, "wrap", luby_math_wrap);
     luby_register_function(L, "sign", luby_math_sign);
     luby_register_function(L, "min", luby_math_min);
     luby_register_function(L, "max", luby_math_max);
-    luby_register_function(L, "deg_to_rad", luby_math_deg_to_rad);
-    luby_register_function(L, "rad_to_deg", luby_math_rad_to_deg);
-    luby_register_function(L, "sin", luby_math_sin);
-    luby_register_function(L, "cos", luby_math_cos);
-    luby_register_function(L, "tan", luby_math_tan);
-    luby_register_function(L, "asin", luby_math_asin);
-    luby_register_function(L, "acos", luby_math_acos);
-    luby_register_function(L, "atan", luby_math_atan);
-    luby_register_function(L, "atan2", luby_math_atan2);
-    luby_register_function(L, "sqrt", luby_math_sqrt);
-    luby_register_function(L, "pow", luby_math_pow);
-    luby_register_function(L, "log", luby_math_log);
-    luby_register_function(L, "exp", luby_math_exp);
-    luby_register_function(L, "distance", luby_math_distance);
-    luby_register_function(L, "distance_squared", luby_math_distance_squared);
+    luby_register_numeric(L, "deg_to_rad", luby_math_deg_to_rad, 1, luby_num_deg_to_rad, NULL);
+    luby_register_numeric(L, "rad_to_deg", luby_math_rad_to_deg, 1, luby_num_rad_to_deg, NULL);
+    luby_register_numeric(L, "sin", luby_math_sin, 1, sin, NULL);
+    luby_register_numeric(L, "cos", luby_math_cos, 1, cos, NULL);
+    luby_register_numeric(L, "tan", luby_math_tan, 1, tan, NULL);
+    luby_register_numeric(L, "asin", luby_math_asin, 1, asin, NULL);
+    luby_register_numeric(L, "acos", luby_math_acos, 1, acos, NULL);
+    luby_register_numeric(L, "atan", luby_math_atan, 1, atan, NULL);
+    luby_register_numeric(L, "atan2", luby_math_atan2, 2, NULL, atan2);
+    luby_register_numeric(L, "sqrt", luby_math_sqrt, 1, sqrt, NULL);
+    luby_register_numeric(L, "pow", luby_math_pow, 2, NULL, pow);
+    luby_register_numeric(L, "log", luby_math_log, 1, log, NULL);
+    luby_register_numeric(L, "exp", luby_math_exp, 1, exp, NULL);
+    luby_register_numeric(L, "distance", luby_math_distance, 4, NULL, NULL);
+    luby_register_numeric(L, "distance_squared", luby_math_distance_squared, 4, NULL, NULL);
     luby_register_function(L, "normalize", luby_math_normalize);
     luby_register_function(L, "dot", luby_math_dot);
     luby_register_function(L, "cross", luby_math_cross);
@@ -13323,38 +21079,13 @@ LUBY_API void luby_open_base(luby_state *L) {
             luby_value v; v.type = LUBY_T_MODULE; v.as.ptr = comp_mod;
             luby_string_view name = { "Comparable", 10 };
             luby_set_global(L, name, v);
-            luby_eval(L,
-                "module Comparable\n"
-                "  def <(other)\n"
-                "    (self <=> other) < 0\n"
-                "  end\n"
-                "  def <=(other)\n"
-                "    (self <=> other) <= 0\n"
-                "  end\n"
-                "  def ==(other)\n"
-                "    (self <=> other) == 0\n"
-                "  end\n"
-                "  def >(other)\n"
-                "    (self <=> other) > 0\n"
-                "  end\n"
-                "  def >=(other)\n"
-                "    (self <=> other) >= 0\n"
-                "  end\n"
-                "  def between?(mn, mx)\n"
-                "    self >= mn && self <= mx\n"
-                "  end\n"
-                "  def clamp(mn, mx)\n"
-                "    if self < mn\n"
-                "      mn\n"
-                "    elsif self > mx\n"
-                "      mx\n"
-                "    else\n"
-                "      self\n"
-                "    end\n"
-                "  end\n"
-                "end\n",
-                0, "<comparable>", NULL);
-            luby_clear_error(L);
+            luby_class_set_cmethod(L, comp_mod, "<", luby_comparable_lt);
+            luby_class_set_cmethod(L, comp_mod, "<=", luby_comparable_le);
+            luby_class_set_cmethod(L, comp_mod, "==", luby_comparable_eq);
+            luby_class_set_cmethod(L, comp_mod, ">", luby_comparable_gt);
+            luby_class_set_cmethod(L, comp_mod, ">=", luby_comparable_ge);
+            luby_class_set_cmethod(L, comp_mod, "between?", luby_comparable_between);
+            luby_class_set_cmethod(L, comp_mod, "clamp", luby_comparable_clamp);
         }
     }
 
@@ -13365,360 +21096,47 @@ LUBY_API void luby_open_base(luby_state *L) {
             luby_value v; v.type = LUBY_T_MODULE; v.as.ptr = enum_mod;
             luby_string_view name = { "Enumerable", 10 };
             luby_set_global(L, name, v);
+            luby_class_set_cmethod(L, enum_mod, "to_a", luby_enumerable_to_a);
+            luby_class_set_cmethod(L, enum_mod, "entries", luby_enumerable_to_a);
+            luby_class_set_cmethod(L, enum_mod, "map", luby_enumerable_map);
+            luby_class_set_cmethod(L, enum_mod, "collect", luby_enumerable_map);
+            luby_class_set_cmethod(L, enum_mod, "flat_map", luby_enumerable_flat_map);
+            luby_class_set_cmethod(L, enum_mod, "select", luby_enumerable_select);
+            luby_class_set_cmethod(L, enum_mod, "filter", luby_enumerable_select);
+            luby_class_set_cmethod(L, enum_mod, "reject", luby_enumerable_reject);
+            luby_class_set_cmethod(L, enum_mod, "find", luby_enumerable_find);
+            luby_class_set_cmethod(L, enum_mod, "detect", luby_enumerable_find);
+            luby_class_set_cmethod(L, enum_mod, "any?", luby_enumerable_any);
+            luby_class_set_cmethod(L, enum_mod, "all?", luby_enumerable_all);
+            luby_class_set_cmethod(L, enum_mod, "none?", luby_enumerable_none);
+            luby_class_set_cmethod(L, enum_mod, "count", luby_enumerable_count);
+            luby_class_set_cmethod(L, enum_mod, "include?", luby_enumerable_include);
+            luby_class_set_cmethod(L, enum_mod, "member?", luby_enumerable_include);
+            luby_class_set_cmethod(L, enum_mod, "first", luby_enumerable_first);
+            luby_class_set_cmethod(L, enum_mod, "take", luby_enumerable_first);
+            luby_class_set_cmethod(L, enum_mod, "drop", luby_enumerable_drop);
+            luby_class_set_cmethod(L, enum_mod, "each_with_index", luby_enumerable_each_with_index);
+            luby_class_set_cmethod(L, enum_mod, "each_with_object", luby_enumerable_each_with_object);
+            luby_class_set_cmethod(L, enum_mod, "reduce", luby_enumerable_reduce);
+            luby_class_set_cmethod(L, enum_mod, "inject", luby_enumerable_reduce);
+            luby_class_set_cmethod(L, enum_mod, "sum", luby_enumerable_sum);
+            luby_class_set_cmethod(L, enum_mod, "min", luby_enumerable_min);
+            luby_class_set_cmethod(L, enum_mod, "max", luby_enumerable_max);
+            luby_class_set_cmethod(L, enum_mod, "min_by", luby_enumerable_min_by);
+            luby_class_set_cmethod(L, enum_mod, "max_by", luby_enumerable_max_by);
+            luby_class_set_cmethod(L, enum_mod, "sort", luby_enumerable_sort);
+            luby_class_set_cmethod(L, enum_mod, "sort_by", luby_enumerable_sort_by);
+            luby_class_set_cmethod(L, enum_mod, "group_by", luby_enumerable_group_by);
+            luby_class_set_cmethod(L, enum_mod, "tally", luby_enumerable_tally);
+            luby_class_set_cmethod(L, enum_mod, "zip", luby_enumerable_zip);
+            luby_class_set_cmethod(L, enum_mod, "lazy", luby_enumerable_lazy);
+            /* A user each that is not a plain forward to an Array or Range
+               is driven by this helper; see enumerable_drive */
+            luby_register_function(L, "__enum_yield", luby_enumerable_yield);
             luby_eval(L,
                 "module Enumerable\n"
-                "  def to_a\n"
-                "    result = []\n"
-                "    each { |x| array_push(result, x) }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def entries\n"
-                "    to_a\n"
-                "  end\n"
-                "\n"
-                "  def map(&__blk)\n"
-                "    result = []\n"
-                "    each { |x| array_push(result, __blk.call(x)) }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def collect(&__blk)\n"
-                "    result = []\n"
-                "    each { |x| array_push(result, __blk.call(x)) }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def select(&__blk)\n"
-                "    result = []\n"
-                "    each { |x|\n"
-                "      if __blk.call(x)\n"
-                "        array_push(result, x)\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def filter(&__blk)\n"
-                "    result = []\n"
-                "    each { |x|\n"
-                "      if __blk.call(x)\n"
-                "        array_push(result, x)\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def reject(&__blk)\n"
-                "    result = []\n"
-                "    each { |x|\n"
-                "      if !__blk.call(x)\n"
-                "        array_push(result, x)\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def find(&__blk)\n"
-                "    found = nil\n"
-                "    done = false\n"
-                "    each { |x|\n"
-                "      if !done && __blk.call(x)\n"
-                "        found = x\n"
-                "        done = true\n"
-                "      end\n"
-                "    }\n"
-                "    found\n"
-                "  end\n"
-                "\n"
-                "  def detect(&__blk)\n"
-                "    found = nil\n"
-                "    done = false\n"
-                "    each { |x|\n"
-                "      if !done && __blk.call(x)\n"
-                "        found = x\n"
-                "        done = true\n"
-                "      end\n"
-                "    }\n"
-                "    found\n"
-                "  end\n"
-                "\n"
-                "  def any?(&__blk)\n"
-                "    result = false\n"
-                "    each { |x|\n"
-                "      __v = __blk ? __blk.call(x) : x\n"
-                "      if __v\n"
-                "        result = true\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def all?(&__blk)\n"
-                "    result = true\n"
-                "    each { |x|\n"
-                "      __v = __blk ? __blk.call(x) : x\n"
-                "      if !__v\n"
-                "        result = false\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def none?(&__blk)\n"
-                "    result = true\n"
-                "    each { |x|\n"
-                "      __v = __blk ? __blk.call(x) : x\n"
-                "      if __v\n"
-                "        result = false\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def reduce(init, &__blk)\n"
-                "    acc = init\n"
-                "    each { |x| acc = __blk.call(acc, x) }\n"
-                "    acc\n"
-                "  end\n"
-                "\n"
-                "  def inject(init, &__blk)\n"
-                "    acc = init\n"
-                "    each { |x| acc = __blk.call(acc, x) }\n"
-                "    acc\n"
-                "  end\n"
-                "\n"
-                "  def count(&__blk)\n"
-                "    n = 0\n"
-                "    if __blk\n"
-                "      each { |x|\n"
-                "        if __blk.call(x)\n"
-                "          n = n + 1\n"
-                "        end\n"
-                "      }\n"
-                "    else\n"
-                "      each { |x| n = n + 1 }\n"
-                "    end\n"
-                "    n\n"
-                "  end\n"
-                "\n"
-                "  def sum(init)\n"
-                "    acc = init ? init : 0\n"
-                "    each { |x| acc = acc + x }\n"
-                "    acc\n"
-                "  end\n"
-                "\n"
-                "  def min\n"
-                "    best = nil\n"
-                "    each { |x|\n"
-                "      if best == nil || x < best\n"
-                "        best = x\n"
-                "      end\n"
-                "    }\n"
-                "    best\n"
-                "  end\n"
-                "\n"
-                "  def max\n"
-                "    best = nil\n"
-                "    each { |x|\n"
-                "      if best == nil || x > best\n"
-                "        best = x\n"
-                "      end\n"
-                "    }\n"
-                "    best\n"
-                "  end\n"
-                "\n"
-                "  def min_by(&__blk)\n"
-                "    best = nil\n"
-                "    best_val = nil\n"
-                "    each { |x|\n"
-                "      __v = __blk.call(x)\n"
-                "      if best_val == nil || __v < best_val\n"
-                "        best = x\n"
-                "        best_val = __v\n"
-                "      end\n"
-                "    }\n"
-                "    best\n"
-                "  end\n"
-                "\n"
-                "  def max_by(&__blk)\n"
-                "    best = nil\n"
-                "    best_val = nil\n"
-                "    each { |x|\n"
-                "      __v = __blk.call(x)\n"
-                "      if best_val == nil || __v > best_val\n"
-                "        best = x\n"
-                "        best_val = __v\n"
-                "      end\n"
-                "    }\n"
-                "    best\n"
-                "  end\n"
-                "\n"
-                "  def sort\n"
-                "    arr = to_a\n"
-                "    __n = length(arr)\n"
-                "    __i = 0\n"
-                "    while __i < __n - 1\n"
-                "      __j = 0\n"
-                "      while __j < __n - __i - 1\n"
-                "        if arr[__j] > arr[__j + 1]\n"
-                "          __tmp = arr[__j]\n"
-                "          arr[__j] = arr[__j + 1]\n"
-                "          arr[__j + 1] = __tmp\n"
-                "        end\n"
-                "        __j = __j + 1\n"
-                "      end\n"
-                "      __i = __i + 1\n"
-                "    end\n"
-                "    arr\n"
-                "  end\n"
-                "\n"
-                "  def sort_by(&__blk)\n"
-                "    arr = to_a\n"
-                "    __n = length(arr)\n"
-                "    __keys = []\n"
-                "    each { |x| array_push(__keys, __blk.call(x)) }\n"
-                "    __i = 0\n"
-                "    while __i < __n - 1\n"
-                "      __j = 0\n"
-                "      while __j < __n - __i - 1\n"
-                "        if __keys[__j] > __keys[__j + 1]\n"
-                "          __tmp = arr[__j]\n"
-                "          arr[__j] = arr[__j + 1]\n"
-                "          arr[__j + 1] = __tmp\n"
-                "          __tmp = __keys[__j]\n"
-                "          __keys[__j] = __keys[__j + 1]\n"
-                "          __keys[__j + 1] = __tmp\n"
-                "        end\n"
-                "        __j = __j + 1\n"
-                "      end\n"
-                "      __i = __i + 1\n"
-                "    end\n"
-                "    arr\n"
-                "  end\n"
-                "\n"
-                "  def flat_map(&__blk)\n"
-                "    result = []\n"
-                "    each { |x|\n"
-                "      __v = __blk.call(x)\n"
-                "      if type(__v) == \"array\"\n"
-                "        __fi = 0\n"
-                "        while __fi < length(__v)\n"
-                "          array_push(result, __v[__fi])\n"
-                "          __fi = __fi + 1\n"
-                "        end\n"
-                "      else\n"
-                "        array_push(result, __v)\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def each_with_index(&__blk)\n"
-                "    __ei = 0\n"
-                "    each { |x|\n"
-                "      __blk.call(x, __ei)\n"
-                "      __ei = __ei + 1\n"
-                "    }\n"
-                "    self\n"
-                "  end\n"
-                "\n"
-                "  def each_with_object(obj, &__blk)\n"
-                "    each { |x| __blk.call(x, obj) }\n"
-                "    obj\n"
-                "  end\n"
-                "\n"
-                "  def include?(val)\n"
-                "    found = false\n"
-                "    each { |x|\n"
-                "      if x == val\n"
-                "        found = true\n"
-                "      end\n"
-                "    }\n"
-                "    found\n"
-                "  end\n"
-                "\n"
-                "  def first(n)\n"
-                "    if n\n"
-                "      result = []\n"
-                "      __fsi = 0\n"
-                "      each { |x|\n"
-                "        if __fsi < n\n"
-                "          array_push(result, x)\n"
-                "          __fsi = __fsi + 1\n"
-                "        end\n"
-                "      }\n"
-                "      result\n"
-                "    else\n"
-                "      found = nil\n"
-                "      __done = false\n"
-                "      each { |x|\n"
-                "        if !__done\n"
-                "          found = x\n"
-                "          __done = true\n"
-                "        end\n"
-                "      }\n"
-                "      found\n"
-                "    end\n"
-                "  end\n"
-                "\n"
-                "  def take(n)\n"
-                "    first(n)\n"
-                "  end\n"
-                "\n"
-                "  def drop(n)\n"
-                "    result = []\n"
-                "    __di = 0\n"
-                "    each { |x|\n"
-                "      if __di >= n\n"
-                "        array_push(result, x)\n"
-                "      end\n"
-                "      __di = __di + 1\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def group_by(&__blk)\n"
-                "    result = {}\n"
-                "    each { |x|\n"
-                "      __key = __blk.call(x)\n"
-                "      if result[__key] == nil\n"
-                "        result[__key] = []\n"
-                "      end\n"
-                "      array_push(result[__key], x)\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def tally\n"
-                "    result = {}\n"
-                "    each { |x|\n"
-                "      if result[x]\n"
-                "        result[x] = result[x] + 1\n"
-                "      else\n"
-                "        result[x] = 1\n"
-                "      end\n"
-                "    }\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def zip(other)\n"
-                "    arr = to_a\n"
-                "    result = []\n"
-                "    __zi = 0\n"
-                "    while __zi < length(arr)\n"
-                "      if __zi < length(other)\n"
-                "        array_push(result, [arr[__zi], other[__zi]])\n"
-                "      else\n"
-                "        array_push(result, [arr[__zi], nil])\n"
-                "      end\n"
-                "      __zi = __zi + 1\n"
-                "    end\n"
-                "    result\n"
-                "  end\n"
-                "\n"
-                "  def lazy\n"
-                "    lazy_create(self)\n"
+                "  def __enum_drive\n"
+                "    each { |x| break if __enum_yield(x) }\n"
                 "  end\n"
                 "end\n",
                 0, "<enumerable>", NULL);
@@ -13726,6 +21144,204 @@ LUBY_API void luby_open_base(luby_state *L) {
         }
     }
 
+    /* ---- Set and PriorityQueue ---- */
+    {
+        luby_string_view enum_name = { "Enumerable", 10 };
+        luby_value ev = luby_get_global(L, enum_name);
+        luby_class_obj *enum_mod = ev.type == LUBY_T_MODULE ? (luby_class_obj *)ev.as.ptr : NULL;
+        luby_class_obj *set_cls = luby_class_new(L, "Set", NULL);
+        if (set_cls) {
+            luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = set_cls;
+            luby_string_view name = { "Set", 3 };
+            luby_set_global(L, name, v);
+            if (enum_mod) luby_class_add_include(L, set_cls, enum_mod);
+            luby_class_set_cmethod(L, set_cls, "new", luby_set_new);
+            luby_class_set_cmethod(L, set_cls, "each", luby_collection_each);
+            luby_class_set_cmethod(L, set_cls, "size", luby_collection_size);
+            luby_class_set_cmethod(L, set_cls, "length", luby_collection_size);
+            luby_class_set_cmethod(L, set_cls, "empty?", luby_collection_empty);
+            luby_class_set_cmethod(L, set_cls, "to_a", luby_collection_to_a);
+            luby_class_set_cmethod(L, set_cls, "add", luby_set_add);
+            luby_class_set_cmethod(L, set_cls, "<<", luby_set_add);
+            luby_class_set_cmethod(L, set_cls, "add?", luby_set_add_p);
+            luby_class_set_cmethod(L, set_cls, "delete", luby_set_delete);
+            luby_class_set_cmethod(L, set_cls, "delete?", luby_set_delete_p);
+            luby_class_set_cmethod(L, set_cls, "include?", luby_set_include);
+            luby_class_set_cmethod(L, set_cls, "member?", luby_set_include);
+            luby_class_set_cmethod(L, set_cls, "clear", luby_set_clear);
+            luby_class_set_cmethod(L, set_cls, "|", luby_set_union);
+            luby_class_set_cmethod(L, set_cls, "+", luby_set_union);
+            luby_class_set_cmethod(L, set_cls, "union", luby_set_union);
+            luby_class_set_cmethod(L, set_cls, "&", luby_set_intersection);
+            luby_class_set_cmethod(L, set_cls, "intersection", luby_set_intersection);
+            luby_class_set_cmethod(L, set_cls, "-", luby_set_difference);
+            luby_class_set_cmethod(L, set_cls, "difference", luby_set_difference);
+            luby_class_set_cmethod(L, set_cls, "subset?", luby_set_subset);
+            luby_class_set_cmethod(L, set_cls, "superset?", luby_set_superset);
+            luby_class_set_cmethod(L, set_cls, "disjoint?", luby_set_disjoint);
+            luby_class_set_cmethod(L, set_cls, "intersect?", luby_set_intersect);
+            luby_class_set_cmethod(L, set_cls, "==", luby_set_equal);
+        }
+        luby_class_obj *pq_cls = luby_class_new(L, "PriorityQueue", NULL);
+        if (pq_cls) {
+            luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = pq_cls;
+            luby_string_view name = { "PriorityQueue", 13 };
+            luby_set_global(L, name, v);
+            if (enum_mod) luby_class_add_include(L, pq_cls, enum_mod);
+            luby_class_set_cmethod(L, pq_cls, "new", luby_pqueue_new);
+            luby_class_set_cmethod(L, pq_cls, "each", luby_collection_each);
+            luby_class_set_cmethod(L, pq_cls, "size", luby_collection_size);
+            luby_class_set_cmethod(L, pq_cls, "length", luby_collection_size);
+            luby_class_set_cmethod(L, pq_cls, "empty?", luby_collection_empty);
+            luby_class_set_cmethod(L, pq_cls, "to_a", luby_collection_to_a);
+            luby_class_set_cmethod(L, pq_cls, "push", luby_pqueue_push);
+            luby_class_set_cmethod(L, pq_cls, "<<", luby_pqueue_push);
+            luby_class_set_cmethod(L, pq_cls, "pop", luby_pqueue_pop);
+            luby_class_set_cmethod(L, pq_cls, "peek", luby_pqueue_peek);
+            luby_class_set_cmethod(L, pq_cls, "clear", luby_pqueue_clear);
+        }
+        luby_class_obj *grid_cls = luby_class_new(L, "SpatialHash", NULL);
+        if (grid_cls) {
+            luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = grid_cls;
+            luby_string_view name = { "SpatialHash", 11 };
+            luby_set_global(L, name, v);
+            if (enum_mod) luby_class_add_include(L, grid_cls, enum_mod);
+            luby_class_set_cmethod(L, grid_cls, "new", luby_spatial_new);
+            luby_class_set_cmethod(L, grid_cls, "each", luby_collection_each);
+            luby_class_set_cmethod(L, grid_cls, "size", luby_collection_size);
+            luby_class_set_cmethod(L, grid_cls, "length", luby_collection_size);
+            luby_class_set_cmethod(L, grid_cls, "empty?", luby_collection_empty);
+            luby_class_set_cmethod(L, grid_cls, "to_a", luby_collection_to_a);
+            luby_class_set_cmethod(L, grid_cls, "insert", luby_spatial_insert);
+            luby_class_set_cmethod(L, grid_cls, "move", luby_spatial_move);
+            luby_class_set_cmethod(L, grid_cls, "remove", luby_spatial_remove);
+            luby_class_set_cmethod(L, grid_cls, "position", luby_spatial_position);
+            luby_class_set_cmethod(L, grid_cls, "include?", luby_spatial_include);
+            luby_class_set_cmethod(L, grid_cls, "clear", luby_spatial_clear);
+            luby_class_set_cmethod(L, grid_cls, "cell_size", luby_spatial_cell_size);
+            luby_class_set_cmethod(L, grid_cls, "query", luby_spatial_query);
+            luby_class_set_cmethod(L, grid_cls, "query_rect", luby_spatial_query_rect);
+        }
+        luby_class_obj *tween_cls = luby_class_new(L, "Tweener", NULL);
+        if (tween_cls) {
+            luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = tween_cls;
+            luby_string_view name = { "Tweener", 7 };
+            luby_set_global(L, name, v);
+            luby_class_set_cmethod(L, tween_cls, "new", luby_tweener_new);
+            luby_class_set_cmethod(L, tween_cls, "add", luby_tweener_add);
+            luby_class_set_cmethod(L, tween_cls, "tick", luby_tweener_tick);
+            luby_class_set_cmethod(L, tween_cls, "cancel", luby_tweener_cancel);
+            luby_class_set_cmethod(L, tween_cls, "clear", luby_tweener_clear);
+            luby_class_set_cmethod(L, tween_cls, "size", luby_collection_size);
+            luby_class_set_cmethod(L, tween_cls, "length", luby_collection_size);
+            luby_class_set_cmethod(L, tween_cls, "empty?", luby_collection_empty);
+        }
+    }
+
+    /* ---- Vector math ---- */
+    {
+        static const char *const names[] = { "Vector2", "Vector3", "Quaternion", "Matrix4" };
+        static const luby_cfunc ctors[] = { luby_vector2_new, luby_vector3_new, luby_quat_new, luby_mat4_new };
+        for (int kind = 0; kind < 4; kind++) {
+            luby_class_obj *cls = luby_class_new(L, names[kind], NULL);
+            if (!cls) continue;
+            luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
+            luby_string_view name = { names[kind], strlen(names[kind]) };
+            luby_set_global(L, name, v);
+            L->vector_classes[kind] = cls;
+            luby_class_set_cmethod(L, cls, "new", ctors[kind]);
+            luby_class_set_cmethod(L, cls, "[]", luby_vector_index);
+            luby_class_set_cmethod(L, cls, "to_a", luby_vector_to_a);
+            luby_class_set_cmethod(L, cls, "+", luby_vector_op_add);
+            luby_class_set_cmethod(L, cls, "-", luby_vector_op_sub);
+            luby_class_set_cmethod(L, cls, "*", luby_vector_op_mul);
+            luby_class_set_cmethod(L, cls, "/", luby_vector_op_div);
+            if (kind == LUBY_MATRIX4) continue;
+            luby_class_set_cmethod(L, cls, "x", luby_vector_x);
+            luby_class_set_cmethod(L, cls, "y", luby_vector_y);
+            if (kind != LUBY_VECTOR2) luby_class_set_cmethod(L, cls, "z", luby_vector_z);
+            if (kind == LUBY_QUATERNION) luby_class_set_cmethod(L, cls, "w", luby_vector_w);
+            luby_class_set_cmethod(L, cls, "length", luby_vector_length);
+            luby_class_set_cmethod(L, cls, "magnitude", luby_vector_length);
+            luby_class_set_cmethod(L, cls, "length_squared", luby_vector_length_squared);
+            luby_class_set_cmethod(L, cls, "normalize", luby_vector_normalize);
+            luby_class_set_cmethod(L, cls, "normalized", luby_vector_normalize);
+            luby_class_set_cmethod(L, cls, "dot", luby_vector_dot);
+            luby_class_set_cmethod(L, cls, "lerp", luby_vector_lerp);
+            if (kind == LUBY_QUATERNION) continue;
+            luby_class_set_cmethod(L, cls, "cross", luby_vector_cross);
+            luby_class_set_cmethod(L, cls, "distance", luby_vector_distance);
+            luby_class_set_cmethod(L, cls, "distance_squared", luby_vector_distance_squared);
+            luby_class_set_cmethod(L, cls, "angle", luby_vector_angle);
+        }
+        luby_class_obj *quat = L->vector_classes[LUBY_QUATERNION];
+        if (quat) {
+            luby_class_set_cmethod(L, quat, "identity", luby_vector_identity);
+            luby_class_set_cmethod(L, quat, "axis_angle", luby_quat_axis_angle);
+            luby_class_set_cmethod(L, quat, "conjugate", luby_quat_conjugate);
+            luby_class_set_cmethod(L, quat, "inverse", luby_quat_inverse);
+            luby_class_set_cmethod(L, quat, "slerp", luby_quat_slerp_m);
+            luby_class_set_cmethod(L, quat, "rotate", luby_quat_rotate_m);
+        }
+        luby_class_obj *mat = L->vector_classes[LUBY_MATRIX4];
+        if (mat) {
+            luby_class_set_cmethod(L, mat, "identity", luby_vector_identity);
+            luby_class_set_cmethod(L, mat, "translation", luby_mat4_translation);
+            luby_class_set_cmethod(L, mat, "scaling", luby_mat4_scaling);
+            luby_class_set_cmethod(L, mat, "rotation", luby_mat4_rotation);
+            luby_class_set_cmethod(L, mat, "transpose", luby_mat4_transpose);
+            luby_class_set_cmethod(L, mat, "inverse", luby_mat4_inverse);
+            luby_class_set_cmethod(L, mat, "determinant", luby_mat4_determinant);
+            luby_class_set_cmethod(L, mat, "transform_point", luby_mat4_transform_point);
+            luby_class_set_cmethod(L, mat, "transform_direction", luby_mat4_transform_direction);
+            luby_class_set_cmethod(L, mat, "transform_points", luby_mat4_transform_points_m);
+        }
+    }
+
+    /* ---- Typed arrays ---- */
+    {
+        static const char *const names[] = { "Float32Array", "Float64Array", "Int32Array" };
+        luby_string_view enum_name = { "Enumerable", 10 };
+        luby_value ev = luby_get_global(L, enum_name);
+        luby_class_obj *enum_mod = ev.type == LUBY_T_MODULE ? (luby_class_obj *)ev.as.ptr : NULL;
+        for (int kind = 0; kind < 3; kind++) {
+            luby_class_obj *cls = luby_class_new(L, names[kind], NULL);
+            if (!cls) continue;
+            luby_value v; v.type = LUBY_T_CLASS; v.as.ptr = cls;
+            luby_string_view name = { names[kind], strlen(names[kind]) };
+            luby_set_global(L, name, v);
+            L->buffer_classes[kind] = cls;
+            if (enum_mod) luby_class_add_include(L, cls, enum_mod);
+            luby_class_set_cmethod(L, cls, "new", luby_buffer_construct);
+            luby_class_set_cmethod(L, cls, "length", luby_buffer_length);
+            luby_class_set_cmethod(L, cls, "size", luby_buffer_length);
+            luby_class_set_cmethod(L, cls, "[]", luby_buffer_index);
+            luby_class_set_cmethod(L, cls, "[]=", luby_buffer_index_set);
+            luby_class_set_cmethod(L, cls, "to_a", luby_buffer_to_a);
+            luby_class_set_cmethod(L, cls, "each", luby_buffer_each);
+            luby_class_set_cmethod(L, cls, "dup", luby_buffer_dup);
+            luby_class_set_cmethod(L, cls, "fill", luby_buffer_fill);
+            luby_class_set_cmethod(L, cls, "view", luby_buffer_view);
+            luby_class_set_cmethod(L, cls, "+", luby_buffer_add);
+            luby_class_set_cmethod(L, cls, "-", luby_buffer_sub);
+            luby_class_set_cmethod(L, cls, "*", luby_buffer_mul);
+            luby_class_set_cmethod(L, cls, "scale", luby_buffer_mul);
+            luby_class_set_cmethod(L, cls, "add!", luby_buffer_add_bang);
+            luby_class_set_cmethod(L, cls, "sub!", luby_buffer_sub_bang);
+            luby_class_set_cmethod(L, cls, "mul!", luby_buffer_mul_bang);
+            luby_class_set_cmethod(L, cls, "scale!", luby_buffer_mul_bang);
+            luby_class_set_cmethod(L, cls, "sum", luby_buffer_sum);
+            luby_class_set_cmethod(L, cls, "dot", luby_buffer_dot);
+            luby_class_set_cmethod(L, cls, "min", luby_buffer_min);
+            luby_class_set_cmethod(L, cls, "max", luby_buffer_max);
+            luby_class_set_cmethod(L, cls, "clamp", luby_buffer_clamp);
+            luby_class_set_cmethod(L, cls, "clamp!", luby_buffer_clamp_bang);
+            luby_class_set_cmethod(L, cls, "lerp", luby_buffer_lerp);
+            luby_class_set_cmethod(L, cls, "lerp!", luby_buffer_lerp_bang);
+            luby_class_set_cmethod(L, cls, "==", luby_buffer_equal);
+        }
+    }
+
     /* ---- Lazy class ---- */
     {
         luby_class_obj *lazy_cls = lazy_get_class(L);
@@ -13762,15 +21378,6 @@ LUBY_API void luby_open_base(luby_state *L) {
                 " def force\n"
                 "  lazy_to_a(self)\n"
                 " end\n"
-                " def each\n"
-                "  __arr = lazy_to_a(self)\n"
-                "  __i = 0\n"
-                "  while __i < length(__arr)\n"
-                "    yield __arr[__i]\n"
-                "    __i = __i + 1\n"
-                "  end\n"
-                "  __arr\n"
-                " end\n"
                 " def first(n = nil)\n"
                 "  if n\n"
                 "    lazy_first_n(self, n)\n"
@@ -13784,6 +21391,7 @@ LUBY_API void luby_open_base(luby_state *L) {
                 "  lazy_each(self) { |x|\n"
                 "    if x == val\n"
                 "      found = true\n"
+                "      break\n"
                 "    end\n"
                 "  }\n"
                 "  found\n"
@@ -13794,6 +21402,7 @@ LUBY_API void luby_open_base(luby_state *L) {
                 "    __v = __blk ? __blk.call(x) : x\n"
                 "    if __v\n"
                 "      found = true\n"
+                "      break\n"
                 "    end\n"
                 "  }\n"
                 "  found\n"
@@ -13804,6 +21413,7 @@ LUBY_API void luby_open_base(luby_state *L) {
                 "    __v = __blk ? __blk.call(x) : x\n"
                 "    if !__v\n"
                 "      result = false\n"
+                "      break\n"
                 "    end\n"
                 "  }\n"
                 "  result\n"
@@ -13814,6 +21424,7 @@ LUBY_API void luby_open_base(luby_state *L) {
                 "    __v = __blk ? __blk.call(x) : x\n"
                 "    if __v\n"
                 "      result = false\n"
+                "      break\n"
                 "    end\n"
                 "  }\n"
                 "  result\n"
@@ -13861,11 +21472,10 @@ LUBY_API void luby_open_base(luby_state *L) {
                 " end\n"
                 " def find(&__blk)\n"
                 "  found = nil\n"
-                "  done = false\n"
                 "  lazy_each(self) { |x|\n"
-                "    if !done && __blk.call(x)\n"
+                "    if __blk.call(x)\n"
                 "      found = x\n"
-                "      done = true\n"
+                "      break\n"
                 "    end\n"
                 "  }\n"
                 "  found\n"
@@ -13876,6 +21486,8 @@ LUBY_API void luby_open_base(luby_state *L) {
                 "end\n",
                 0, "<lazy>", NULL);
             luby_clear_error(L);
+            /* each streams natively so endless sources work with break */
+            luby_class_set_cmethod(L, lazy_get_class(L), "each", luby_lazy_each);
         }
     }
 
@@ -13944,10 +21556,20 @@ LUBY_API luby_class *luby_define_class(luby_state *L, const char *name, const ch
 }
 
 LUBY_API int luby_define_method(luby_state *L, luby_class *cls, const char *name, luby_cfunc fn) {
+    return luby_define_method_ex(L, cls, name, fn, NULL);
+}
+
+LUBY_API int luby_define_method_ex(luby_state *L, luby_class *cls, const char *name, luby_cfunc fn, const luby_signature *sig) {
     if (!L || !cls || !cls->obj || !name || !fn) return 0;
-    luby_cmethod *cm = (luby_cmethod *)luby_gc_alloc(L, sizeof(luby_cmethod), LUBY_GC_CMETHOD);
+    if (sig && !luby_sig_valid(sig)) return 0;
+    size_t size = sizeof(luby_cmethod) + (sig ? sizeof(luby_signature) : 0);
+    luby_cmethod *cm = (luby_cmethod *)luby_gc_alloc(L, size, LUBY_GC_CMETHOD);
     if (!cm) return 0;
     cm->fn = fn;
+    if (sig) {
+        cm->sig = (luby_signature *)(cm + 1);
+        *cm->sig = *sig;
+    }
     luby_value key = luby_symbol(L, name, 0);
     luby_value val; val.type = LUBY_T_CMETHOD; val.as.ptr = cm;
     luby_hash_set_value(L, (luby_value){ .type = LUBY_T_HASH, .as.ptr = cls->obj->methods }, key, val);
@@ -13955,11 +21577,44 @@ LUBY_API int luby_define_method(luby_state *L, luby_class *cls, const char *name
     return 1;
 }
 
+LUBY_API int luby_define_fields(luby_state *L, luby_class *cls, const luby_field *fields, size_t count) {
+    if (!L || !cls || !cls->obj || (!fields && count)) return 0;
+    luby_class_obj *c = cls->obj;
+    L->method_epoch++;  // invalidate call caches up front; a failure may leave earlier entries applied
+    for (size_t i = 0; i < count; i++) {
+        const luby_field *fd = &fields[i];
+        if (!fd->name || !fd->name[0] || (int)fd->type < LUBY_FIELD_INT8 || fd->type > LUBY_FIELD_BOOL) return 0;
+        size_t len = strlen(fd->name);
+        luby_field_slot *slot = NULL;
+        for (size_t j = 0; j < c->field_count; j++) {
+            if (c->fields[j].name_len == len && memcmp(c->fields[j].name, fd->name, len) == 0) { slot = &c->fields[j]; break; }
+        }
+        if (!slot) {
+            char *name = (char *)luby_alloc_raw(L, NULL, len + 2);
+            if (!name) return 0;
+            memcpy(name, fd->name, len);
+            name[len] = '=';
+            name[len + 1] = '\0';
+            luby_field_slot *grown = (luby_field_slot *)luby_alloc_raw(L, c->fields, (c->field_count + 1) * sizeof(luby_field_slot));
+            if (!grown) { luby_alloc_raw(L, name, 0); return 0; }
+            c->fields = grown;
+            slot = &c->fields[c->field_count++];
+            slot->name = name;
+            slot->name_len = len;
+        }
+        slot->offset = fd->offset;
+        slot->type = fd->type;
+        slot->readonly = fd->readonly ? 1 : 0;
+    }
+    return 1;
+}
+
 LUBY_API luby_value luby_new_userdata(luby_state *L, size_t size, luby_finalizer finalize) {
     luby_userdata *ud = (luby_userdata *)luby_gc_alloc(L, sizeof(luby_userdata), LUBY_GC_USERDATA);
     if (!ud) return luby_nil();
     ud->klass = NULL;
     ud->finalize = finalize;
+    ud->copy = NULL;
     ud->alive = 1;
     if (size > 0) {
         ud->data = luby_alloc_raw(L, NULL, size);
@@ -13979,6 +21634,7 @@ LUBY_API luby_value luby_wrap_userdata(luby_state *L, void *ptr, luby_finalizer
     ud->data = ptr;
     ud->size = 0;  // 0 means we don't own the memory
     ud->finalize = finalize;
+    ud->copy = NULL;
     ud->alive = 1;
     luby_value v; v.type = LUBY_T_USERDATA; v.as.ptr = ud; return v;
 }
@@ -14000,7 +21656,8 @@ LUBY_API int luby_invalidate_userdata(luby_value v) {
     if (!ud->alive) return 0;  // already dead
     if (ud->finalize) ud->finalize(ud->data);
     ud->alive = 0;
-    ud->data = NULL;
+    // VM-owned bytes stay until the sweep frees them; a host pointer is dropped
+    if (ud->size == 0) ud->data = NULL;
     return 1;
 }
 
@@ -14010,6 +21667,22 @@ LUBY_API void luby_set_userdata_class(luby_state *L, luby_value v, luby_class *c
     ((luby_userdata *)v.as.ptr)->klass = cls->obj;
 }
 
+LUBY_API int luby_set_userdata_copy(luby_state *L, luby_value v, luby_copy_fn copy) {
+    (void)L;
+    if (v.type != LUBY_T_USERDATA || !v.as.ptr) return 0;
+    luby_userdata *ud = (luby_userdata *)v.as.ptr;
+    if (ud->size == 0) return 0;
+    ud->copy = copy;
+    return 1;
+}
+
+LUBY_API int luby_set_userdata_class_value(luby_state *L, luby_value v, luby_value cls) {
+    (void)L;
+    if (v.type != LUBY_T_USERDATA || !v.as.ptr || cls.type != LUBY_T_CLASS || !cls.as.ptr) return 0;
+    ((luby_userdata *)v.as.ptr)->klass = (luby_class_obj *)cls.as.ptr;
+    return 1;
+}
+
 LUBY_API luby_coroutine *luby_coroutine_new(luby_state *L, luby_value func) {
     if (!L || func.type != LUBY_T_PROC || !func.as.ptr) return NULL;
     luby_coroutine *co = (luby_coroutine *)luby_gc_alloc(L, sizeof(luby_coroutine), LUBY_GC_COROUTINE);
@@ -0,0 +1,429 @@
+// luby.hpp - optional C++17 binding layer for luby.h
+//
+// Generates native trampolines for C++ functions and member functions at
+// compile time, so binding an engine class needs no hand-written argv
+// unpacking:
+//
+//     luby::class_<Enemy>(L, "Enemy")
+//         .constructor<int>()
+//         .def<&Enemy::attack>("attack")
+//         .def<&Enemy::hp>("hp");
+//     luby::def<&spawn_wave>(L, "spawn_wave");
+//
+// Each trampoline is a plain luby_cfunc specialised on the bound function
+// pointer: argument conversion is chosen from the parameter types and the
+// call is direct, with no runtime dispatch table. Bound objects are userdata
+// tagged with a per-type id, so a script can't pass an Enemy where a Player
+// is expected.
+//
+// Header-only on top of luby.h. The implementation (LUBY_IMPLEMENTATION)
+// is C99 and still has to be compiled in one C translation unit.
+
+#ifndef LUBY_HPP
+#define LUBY_HPP
+
+#include "luby.h"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define LUBY_HPP_EXCEPTIONS 1
+#else
+#define LUBY_HPP_EXCEPTIONS 0
+#endif
+
+namespace luby {
+
+namespace detail {
+
+// One address per bound type; its userdata carry it
+template <class T> struct type_tag { static const char id; };
+template <class T> const char type_tag<T>::id = 0;
+
+// Script-side class name of a bound type, set by class_<T>
+template <class T> struct type_name { static const char *value; };
+template <class T> const char *type_name<T>::value = nullptr;
+
+// Userdata payload of a bound object. A host-owned object is referenced
+// through `ptr`; a VM-owned one is constructed right after the header
+// (`ptr` NULL). Snapshots and clones copy-construct a VM-owned object that
+// is not trivially copyable into the new state (see copy_object).
+struct box {
+    const void *tag;
+    void *ptr;
+    void (*destroy)(box *);
+};
+
+template <class T> struct owned_box {
+    box head;
+    alignas(T) unsigned char storage[sizeof(T)];
+};
+
+template <class T> T *box_object(box *b) {
+    if (b->ptr) return static_cast<T *>(b->ptr);
+    return std::launder(reinterpret_cast<T *>(reinterpret_cast<owned_box<T> *>(b)->storage));
+}
+
+template <class T> void destroy_object(box *b) { box_object<T>(b)->~T(); }
+
+// Userdata copy hook: the clone gets its own T, so each copy is destroyed
+// once. Types that can't be copied refuse the snapshot.
+template <class T> int copy_object(void *dst, const void *src, std::size_t) {
+    if constexpr (!std::is_copy_constructible<T>::value) {
+        (void)dst; (void)src;
+        return LUBY_E_RUNTIME;
+    } else {
+        box *s = static_cast<box *>(const_cast<void *>(src));
+        box *d = static_cast<box *>(dst);
+        d->tag = s->tag;
+        d->ptr = nullptr;
+        d->destroy = nullptr;
+#if LUBY_HPP_EXCEPTIONS
+        try {
+#endif
+            new (reinterpret_cast<owned_box<T> *>(d)->storage) T(*box_object<T>(s));
+#if LUBY_HPP_EXCEPTIONS
+        } catch (...) {
+            return LUBY_E_RUNTIME;
+        }
+#endif
+        d->destroy = destroy_object<T>;
+        return 0;
+    }
+}
+
+inline void box_finalize(void *data) {
+    box *b = static_cast<box *>(data);
+    if (b && b->destroy) b->destroy(b);
+}
+
+// The T inside a bound userdata, or nullptr if `v` is anything else
+template <class T> T *unbox(luby_value v) {
+    if (v.type != LUBY_T_USERDATA) return nullptr;
+    box *b = static_cast<box *>(luby_userdata_ptr(v));
+    if (!b || b->tag != &type_tag<T>::id) return nullptr;
+    return box_object<T>(b);
+}
+
+inline int set_class(luby_state *L, luby_value ud, luby_value cls) {
+    return luby_set_userdata_class_value(L, ud, cls);
+}
+
+template <class T> int set_class(luby_state *L, luby_value ud) {
+    if (!type_name<T>::value) return 0;
+    return luby_set_userdata_class_value(L, ud, luby_get_global_value(L, type_name<T>::value));
+}
+
+template <class T, class... A> luby_value make_owned(luby_state *L, A &&...args) {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+    luby_value ud = luby_new_userdata(L, sizeof(owned_box<T>), box_finalize);
+    box *b = static_cast<box *>(luby_userdata_ptr(ud));
+    if (!b) return luby_nil();
+    b->tag = &type_tag<T>::id;
+    b->ptr = nullptr;
+    b->destroy = nullptr;
+    new (reinterpret_cast<owned_box<T> *>(b)->storage) T(std::forward<A>(args)...);
+    b->destroy = destroy_object<T>;
+    // A byte copy is only a valid T when T is trivially copyable
+    if (!std::is_trivially_copyable<T>::value) luby_set_userdata_copy(L, ud, copy_object<T>);
+    return ud;
+}
+
+template <class T> luby_value make_ref(luby_state *L, const T *p) {
+    if (!p) return luby_nil();
+    luby_value ud = luby_new_userdata(L, sizeof(box), nullptr);
+    box *b = static_cast<box *>(luby_userdata_ptr(ud));
+    if (!b) return luby_nil();
+    b->tag = &type_tag<T>::id;
+    b->ptr = const_cast<void *>(static_cast<const void *>(p));
+    b->destroy = nullptr;
+    set_class<T>(L, ud);
+    return ud;
+}
+
+// ---- Value conversion ----
+
+template <class T, class Enable = void> struct convert;
+
+template <> struct convert<luby_value> {
+    static bool get(luby_state *, luby_value v, luby_value &out) { out = v; return true; }
+    static luby_value push(luby_state *, luby_value v) { return v; }
+};
+
+template <> struct convert<bool> {
+    static bool get(luby_state *, luby_value v, bool &out) {
+        if (v.type != LUBY_T_BOOL) return false;
+        out = v.as.b != 0;
+        return true;
+    }
+    static luby_value push(luby_state *, bool b) { return luby_bool(b); }
+};
+
+template <class T>
+struct convert<T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>> {
+    static bool get(luby_state *, luby_value v, T &out) {
+        if (v.type != LUBY_T_INT) return false;
+        out = static_cast<T>(v.as.i);
+        return true;
+    }
+    static luby_value push(luby_state *, T x) { return luby_int(static_cast<int64_t>(x)); }
+};
+
+template <class T> struct convert<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+    static bool get(luby_state *, luby_value v, T &out) {
+        if (v.type == LUBY_T_FLOAT) out = static_cast<T>(v.as.f);
+        else if (v.type == LUBY_T_INT) out = static_cast<T>(v.as.i);
+        else return false;
+        return true;
+    }
+    static luby_value push(luby_state *, T x) { return luby_float(static_cast<double>(x)); }
+};
+
+template <class T> struct convert<T, std::enable_if_t<std::is_enum<T>::value>> {
+    using U = std::underlying_type_t<T>;
+    static bool get(luby_state *L, luby_value v, T &out) {
+        U u;
+        if (!convert<U>::get(L, v, u)) return false;
+        out = static_cast<T>(u);
+        return true;
+    }
+    static luby_value push(luby_state *L, T x) { return convert<U>::push(L, static_cast<U>(x)); }
+};
+
+template <> struct convert<std::string> {
+    static bool get(luby_state *, luby_value v, std::string &out) {
+        if (v.type != LUBY_T_STRING && v.type != LUBY_T_SYMBOL) return false;
+        out.assign(static_cast<const char *>(v.as.ptr));
+        return true;
+    }
+    static luby_value push(luby_state *L, const std::string &s) { return luby_string(L, s.data(), s.size()); }
+};
+
+// Borrowed: valid for the duration of the call
+template <> struct convert<const char *> {
+    static bool get(luby_state *, luby_value v, const char *&out) {
+        if (v.type != LUBY_T_STRING && v.type != LUBY_T_SYMBOL) return false;
+        out = static_cast<const char *>(v.as.ptr);
+        return true;
+    }
+    static luby_value push(luby_state *L, const char *s) { return s ? luby_string(L, s, std::strlen(s)) : luby_nil(); }
+};
+
+template <class T> struct is_bound
+    : std::integral_constant<bool, std::is_class<T>::value && !std::is_same<T, std::string>::value &&
+                                       !std::is_same<T, luby_value>::value> {};
+
+// Bound class returned by value: the VM owns a copy
+template <class T> struct convert<T, std::enable_if_t<is_bound<T>::value>> {
+    static luby_value push(luby_state *L, const T &x) {
+        luby_value ud = make_owned<T>(L, x);
+        set_class<T>(L, ud);
+        return ud;
+    }
+};
+
+// Bound class returned by pointer: the host keeps ownership
+template <class T> struct convert<T *, std::enable_if_t<is_bound<std::remove_cv_t<T>>::value>> {
+    static luby_value push(luby_state *L, T *p) { return make_ref<std::remove_cv_t<T>>(L, p); }
+};
+
+// How one parameter is unpacked: `stored` holds the converted value for
+// the duration of the call and `pass` hands it to the callee
+template <class A, class Enable = void> struct arg {
+    using stored = std::remove_cv_t<std::remove_reference_t<A>>;
+    static bool get(luby_state *L, luby_value v, stored &out) { return convert<stored>::get(L, v, out); }
+    static A pass(stored &s) { return static_cast<A>(s); }
+};
+
+template <class A> struct arg<A, std::enable_if_t<is_bound<std::remove_cv_t<std::remove_reference_t<A>>>::value>> {
+    using T = std::remove_cv_t<std::remove_reference_t<A>>;
+    using stored = T *;
+    static bool get(luby_state *, luby_value v, stored &out) { return (out = unbox<T>(v)) != nullptr; }
+    static A pass(stored &s) { return static_cast<A>(*s); }
+};
+
+template <class A> struct arg<A *, std::enable_if_t<is_bound<std::remove_cv_t<A>>::value>> {
+    using T = std::remove_cv_t<A>;
+    using stored = T *;
+    static bool get(luby_state *, luby_value v, stored &out) {
+        if (v.type == LUBY_T_NIL) { out = nullptr; return true; }
+        return (out = unbox<T>(v)) != nullptr;
+    }
+    static A *pass(stored &s) { return s; }
+};
+
+// ---- Signatures ----
+
+template <class F> struct signature;
+
+template <class R, class... A> struct signature<R (*)(A...)> {
+    using self = void;
+    using result = R;
+    using args = std::tuple<A...>;
+};
+template <class R, class... A> struct signature<R (*)(A...) noexcept> : signature<R (*)(A...)> {};
+
+template <class C, class R, class... A> struct signature<R (C::*)(A...)> {
+    using self = C;
+    using result = R;
+    using args = std::tuple<A...>;
+};
+template <class C, class R, class... A> struct signature<R (C::*)(A...) const> : signature<R (C::*)(A...)> {};
+template <class C, class R, class... A> struct signature<R (C::*)(A...) noexcept> : signature<R (C::*)(A...)> {};
+template <class C, class R, class... A> struct signature<R (C::*)(A...) const noexcept> : signature<R (C::*)(A...)> {};
+
+template <class R> struct result {
+    template <class Call> static luby_value call(luby_state *L, Call &&c) {
+        return convert<std::remove_cv_t<std::remove_reference_t<R>>>::push(L, c());
+    }
+};
+
+template <> struct result<void> {
+    template <class Call> static luby_value call(luby_state *, Call &&c) {
+        c();
+        return luby_nil();
+    }
+};
+
+template <class Args, std::size_t... I>
+bool unpack(luby_state *L, const luby_value *argv, std::tuple<typename arg<std::tuple_element_t<I, Args>>::stored...> &st,
+            std::index_sequence<I...>) {
+    (void)L; (void)argv; (void)st;
+    return (arg<std::tuple_element_t<I, Args>>::get(L, argv[I], std::get<I>(st)) && ...);
+}
+
+// Unpack argv[first...] into the callee's parameters and call it through `invoke`
+template <class Sig, class Invoke, std::size_t... I>
+int dispatch(luby_state *L, int argc, const luby_value *argv, luby_value *out, int first, Invoke &&invoke,
+             std::index_sequence<I...> seq) {
+    using Args = typename Sig::args;
+    if (argc != first + static_cast<int>(sizeof...(I))) return LUBY_E_TYPE;
+#if LUBY_HPP_EXCEPTIONS
+    // Converters may throw too (std::string allocation, user convert<>)
+    bool unpacked = false;
+    try {
+#endif
+        std::tuple<typename arg<std::tuple_element_t<I, Args>>::stored...> st;
+        if (!unpack<Args>(L, argv + first, st, seq)) return LUBY_E_TYPE;
+#if LUBY_HPP_EXCEPTIONS
+        unpacked = true;
+#endif
+        luby_value r = result<typename Sig::result>::call(L, [&]() -> decltype(auto) {
+            return invoke(arg<std::tuple_element_t<I, Args>>::pass(std::get<I>(st))...);
+        });
+        if (out) *out = r;
+#if LUBY_HPP_EXCEPTIONS
+    } catch (...) {
+        // Unwinding through the C VM is undefined; report the failure instead
+        return unpacked ? LUBY_E_RUNTIME : LUBY_E_TYPE;
+    }
+#endif
+    return 0;
+}
+
+template <auto F, class Sig = signature<decltype(F)>, class Self = typename Sig::self>
+struct trampoline {
+    // Member function: argv[0] is the receiver
+    static int fn(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+        if (argc < 1) return LUBY_E_TYPE;
+        Self *self = unbox<Self>(argv[0]);
+        if (!self) return LUBY_E_TYPE;
+        constexpr std::size_t n = std::tuple_size<typename Sig::args>::value;
+        return dispatch<Sig>(L, argc, argv, out, 1, [self](auto &&...a) -> decltype(auto) {
+            return (self->*F)(std::forward<decltype(a)>(a)...);
+        }, std::make_index_sequence<n>{});
+    }
+};
+
+template <auto F, class Sig> struct trampoline<F, Sig, void> {
+    // Free function: argv maps onto the parameters, so a first parameter of
+    // a bound class type receives the receiver when bound as a method
+    static int fn(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+        constexpr std::size_t n = std::tuple_size<typename Sig::args>::value;
+        return dispatch<Sig>(L, argc, argv, out, 0, [](auto &&...a) -> decltype(auto) {
+            return F(std::forward<decltype(a)>(a)...);
+        }, std::make_index_sequence<n>{});
+    }
+};
+
+template <class T, class... A> int construct(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    // argv[0] is the class `new` was called on
+    using Sig = signature<void (*)(A...)>;
+    luby_value cls = argc > 0 ? argv[0] : luby_nil();
+    luby_value ud = luby_nil();
+    int rc = dispatch<Sig>(L, argc, argv, nullptr, 1, [&](auto &&...a) {
+        ud = make_owned<T>(L, std::forward<decltype(a)>(a)...);
+    }, std::index_sequence_for<A...>{});
+    if (rc != 0) return rc;
+    if (ud.type != LUBY_T_USERDATA) return LUBY_E_OOM;
+    set_class(L, ud, cls);
+    if (out) *out = ud;
+    return 0;
+}
+
+} // namespace detail
+
+// The luby_cfunc generated for F
+template <auto F> constexpr luby_cfunc cfunc = &detail::trampoline<F>::fn;
+
+// Register F as a global function
+template <auto F> int def(luby_state *L, const char *name) {
+    return luby_register_function(L, name, cfunc<F>);
+}
+
+// Bound object or nullptr if `v` doesn't hold a T
+template <class T> T *get(luby_value v) { return detail::unbox<T>(v); }
+
+// Hand a host-owned object to scripts; the host must outlive or
+// invalidate the returned userdata
+template <class T> luby_value ref(luby_state *L, T *p) { return detail::make_ref<T>(L, p); }
+
+// Copy or move a value into VM-owned storage
+template <class T> luby_value own(luby_state *L, T &&x) {
+    using U = std::remove_cv_t<std::remove_reference_t<T>>;
+    luby_value ud = detail::make_owned<U>(L, std::forward<T>(x));
+    detail::set_class<U>(L, ud);
+    return ud;
+}
+
+template <class T> luby_value push(luby_state *L, T &&x) {
+    return detail::convert<std::remove_cv_t<std::remove_reference_t<T>>>::push(L, std::forward<T>(x));
+}
+
+// Binds C++ type T as the script class `name`. One name per type: every
+// state that binds T must use the same name.
+template <class T> class class_ {
+public:
+    class_(luby_state *L, const char *name, const char *super_name = nullptr)
+        : L_(L), cls_(luby_define_class(L, name, super_name)) {
+        detail::type_name<T>::value = name;
+    }
+
+    luby_class *handle() const { return cls_; }
+
+    // Member function or free function taking the object first
+    template <auto F> class_ &def(const char *name) {
+        luby_define_method(L_, cls_, name, cfunc<F>);
+        return *this;
+    }
+
+    // `Class.new(args...)` constructs a VM-owned T
+    template <class... A> class_ &constructor() {
+        luby_define_method(L_, cls_, "new", &detail::construct<T, A...>);
+        return *this;
+    }
+
+private:
+    luby_state *L_;
+    luby_class *cls_;
+};
+
+} // namespace luby
+
+#endif // LUBY_HPP
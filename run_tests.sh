@@ -23,11 +23,33 @@ echo "  Luby Test Suite"
 echo "=================================="
 echo ""
 
+# C++ tests link against the C99 implementation compiled on its own
+build_test() {
+    local test_file=$1
+    local test_bin=$2
+    case "$test_file" in
+        *.cpp)
+            gcc -std=c99 -x c -DLUBY_IMPLEMENTATION -c luby.h -o "$test_bin.o" 2>/dev/null &&
+                g++ -o "$test_bin" "$test_file" "$test_bin.o" -I. -std=c++17 -lm 2>/dev/null
+            ;;
+        *)
+            gcc -o "$test_bin" "$test_file" -I. -std=c99 -lm 2>/dev/null
+            ;;
+    esac
+}
+
 run_test() {
     local test_name=$1
     local test_file="tests/${test_name}.c"
     local test_bin="tests/${test_name}"
     
+    if [ ! -f "$test_file" ] && [ -f "tests/${test_name}.cpp" ]; then
+        test_file="tests/${test_name}.cpp"
+        if ! command -v g++ > /dev/null; then
+            echo -e "${YELLOW}SKIP${NC} $test_name (no C++ compiler)"
+            return
+        fi
+    fi
     if [ ! -f "$test_file" ]; then
         echo -e "${YELLOW}SKIP${NC} $test_name (file not found)"
         return
@@ -36,7 +58,7 @@ run_test() {
     TOTAL=$((TOTAL + 1))
     
     echo -n "Building $test_name... "
-    if gcc -o "$test_bin" "$test_file" -I. -std=c99 -lm 2>/dev/null; then
+    if build_test "$test_file" "$test_bin"; then
         echo "done"
         echo -n "Running $test_name... "
         
@@ -97,6 +119,23 @@ run_test "attr_methods"
 run_test "error_paths"
 run_test "method_name"
 run_test "exec_limits"
+run_test "method_ref"
+run_test "gc"
+run_test "image"
+run_test "snapshot"
+run_test "actor"
+run_test "array_mutation"
+run_test "enumerable_native"
+run_test "value_hash"
+run_test "set_pqueue"
+run_test "vector_math"
+run_test "typed_array"
+run_test "userdata_fields"
+run_test "cpp_binding"
+run_test "typed_natives"
+run_test "object_pool"
+run_test "spatial_hash"
+run_test "tween"
 
 # Summary
 echo "=================================="
@@ -0,0 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define TEST(name) printf("  %-50s ", name);
+#define PASS() do { printf("PASS\n"); tests_passed++; } while(0)
+#define FAIL(msg) do { printf("FAIL: %s\n", msg); tests_failed++; } while(0)
+
+// Thread API on plain pthreads: one detached thread per job
+typedef struct job_start {
+    void (*job)(void *arg);
+    void *arg;
+} job_start;
+
+static void *job_thread(void *p) {
+    job_start s = *(job_start *)p;
+    free(p);
+    s.job(s.arg);
+    return NULL;
+}
+
+static int pt_submit(void *user, void (*job)(void *arg), void *arg) {
+    (void)user;
+    job_start *s = (job_start *)malloc(sizeof(job_start));
+    if (!s) return -1;
+    s->job = job;
+    s->arg = arg;
+    pthread_t t;
+    if (pthread_create(&t, NULL, job_thread, s) != 0) {
+        free(s);
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+static void *pt_mutex_new(void *user) {
+    (void)user;
+    pthread_mutex_t *m = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+    if (m) pthread_mutex_init(m, NULL);
+    return m;
+}
+
+static void pt_mutex_free(void *user, void *m) {
+    (void)user;
+    pthread_mutex_destroy((pthread_mutex_t *)m);
+    free(m);
+}
+
+static void pt_lock(void *user, void *m) { (void)user; pthread_mutex_lock((pthread_mutex_t *)m); }
+static void pt_unlock(void *user, void *m) { (void)user; pthread_mutex_unlock((pthread_mutex_t *)m); }
+
+static void *pt_cond_new(void *user) {
+    (void)user;
+    pthread_cond_t *c = (pthread_cond_t *)malloc(sizeof(pthread_cond_t));
+    if (c) pthread_cond_init(c, NULL);
+    return c;
+}
+
+static void pt_cond_free(void *user, void *c) {
+    (void)user;
+    pthread_cond_destroy((pthread_cond_t *)c);
+    free(c);
+}
+
+static void pt_wait(void *user, void *c, void *m) {
+    (void)user;
+    pthread_cond_wait((pthread_cond_t *)c, (pthread_mutex_t *)m);
+}
+
+static void pt_broadcast(void *user, void *c) { (void)user; pthread_cond_broadcast((pthread_cond_t *)c); }
+
+static const luby_thread_api PTHREADS = {
+    NULL, pt_submit, pt_mutex_new, pt_mutex_free, pt_lock, pt_unlock,
+    pt_cond_new, pt_cond_free, pt_wait, pt_broadcast
+};
+
+static const char *WORKER_LIB =
+    "def sum_to(n)\n"
+    "  (1..n).sum\n"
+    "end\n"
+    "def describe(name, scores)\n"
+    "  { name: name, total: scores.sum, range: (1...3), tags: [:a, 2.5, nil, true] }\n"
+    "end\n"
+    "def nested(n)\n"
+    "  spawn(:sum_to, n).value + 1\n"
+    "end\n"
+    "def drain(ch)\n"
+    "  total = 0\n"
+    "  loop do\n"
+    "    v = ch.pop\n"
+    "    break if v.nil?\n"
+    "    total += v * v\n"
+    "  end\n"
+    "  total\n"
+    "end\n"
+    "def produce(ch, n)\n"
+    "  i = 1\n"
+    "  while i <= n\n"
+    "    ch.push(i)\n"
+    "    i += 1\n"
+    "  end\n"
+    "  ch.close\n"
+    "  n\n"
+    "end\n"
+    "def boom\n"
+    "  raise \"kaboom\"\n"
+    "end\n"
+    "def spin(q, points)\n"
+    "  points.map { |p| q * p }\n"
+    "end\n"
+    "def scaled(samples, k)\n"
+    "  samples.scale!(k)\n"
+    "end\n"
+    "def touch(list, h)\n"
+    "  h[:k] = 2\n"
+    "  [list.frozen?, h.frozen?, h[:k]]\n"
+    "end\n";
+
+typedef struct fixture {
+    luby_snapshot *snap;
+    luby_actor_pool *pool;
+    luby_state *L;
+} fixture;
+
+static fixture setup(void) {
+    fixture f;
+    luby_state *boot = luby_new(NULL);
+    luby_open_base(boot);
+    luby_value out;
+    if (luby_eval(boot, WORKER_LIB, 0, "<lib>", &out) != 0) printf("setup failed ");
+    f.snap = luby_snapshot_new(boot);
+    luby_free(boot);
+    f.pool = luby_actor_pool_new(f.snap, &PTHREADS);
+    f.L = luby_clone(f.snap);
+    luby_set_actor_pool(f.L, f.pool);
+    return f;
+}
+
+static void teardown(fixture *f) {
+    luby_free(f->L);
+    luby_actor_pool_free(f->pool);
+    luby_snapshot_free(f->snap);
+}
+
+static int eval_int(luby_state *L, const char *code, int64_t *out) {
+    luby_value v;
+    if (luby_eval(L, code, 0, "<test>", &v) != 0 || v.type != LUBY_T_INT) return 0;
+    *out = v.as.i;
+    return 1;
+}
+
+int main() {
+    printf("=== Actor Tests ===\n\n");
+
+    TEST("actor runs a function in a worker state") {
+        fixture f = setup();
+        int64_t v = 0;
+        int ok = f.pool && eval_int(f.L, "a = spawn(:sum_to, 1000)\na.value", &v) && v == 500500;
+        ok = ok && eval_int(f.L, "a.done? ? 1 : 0", &v) && v == 1;
+        ok = ok && eval_int(f.L, "spawn(:nested, 10).value", &v) && v == 56;
+        teardown(&f);
+        if (ok) PASS(); else FAIL("wrong actor result");
+    }
+
+    TEST("arguments and results are deep copied") {
+        fixture f = setup();
+        int64_t v = 0;
+        int ok = eval_int(f.L,
+            "d = spawn(:describe, \"ann\", [1, 2, 3]).value\n"
+            "t = d[:tags]\n"
+            "ok = d[:name] == \"ann\" && t[0] == :a && t[1] == 2.5 && t[2].nil? && t[3] == true\n"
+            "ok ? d[:total] + d[:range].to_a.sum : -1", &v) && v == 9;
+        // Mutations in the worker do not reach the caller; frozen stays frozen
+        ok = ok && eval_int(f.L,
+            "list = [1, 2].freeze\n"
+            "h = { k: 1 }\n"
+            "r = spawn(:touch, list, h).value\n"
+            "(r[0] && !r[1] && r[2] == 2) ? h[:k] : -1", &v) && v == 1;
+        // Vector math values travel by value
+        ok = ok && eval_int(f.L,
+            "q = Quaternion.axis_angle(Vector3.new(0, 0, 1), 3.14159265 / 2)\n"
+            "r = spawn(:spin, q, [Vector3.new(1, 0, 0), Vector3.new(0, 2, 0)]).value\n"
+            "(r[0] - Vector3.new(0, 1, 0)).length < 0.001 && (r[1] - Vector3.new(-2, 0, 0)).length < 0.001 ? 1 : 0", &v) && v == 1;
+        // Typed arrays are copied; a view sends just its elements
+        ok = ok && eval_int(f.L,
+            "s = Float32Array.new([1, 2, 3, 4])\n"
+            "r = spawn(:scaled, s.view(1, 2), 10).value\n"
+            "r.length * 1000 + r.sum.to_i + s.sum.to_i", &v) && v == 2060;
+        teardown(&f);
+        if (ok) PASS(); else FAIL("values did not round-trip");
+    }
+
+    TEST("channels fan work out to several actors") {
+        fixture f = setup();
+        int64_t v = 0;
+        int ok = eval_int(f.L,
+            "jobs = Channel.new(8)\n"
+            "workers = [spawn(:drain, jobs), spawn(:drain, jobs), spawn(:drain, jobs), spawn(:drain, jobs)]\n"
+            "i = 1\n"
+            "while i <= 100\n"
+            "  jobs.push(i)\n"
+            "  i += 1\n"
+            "end\n"
+            "jobs.close\n"
+            "workers.map { |w| w.value }.sum", &v) && v == 338350;
+        teardown(&f);
+        if (ok) PASS(); else FAIL("fan-out lost items");
+    }
+
+    TEST("bounded channel keeps order under backpressure") {
+        fixture f = setup();
+        int64_t v = 0;
+        int ok = eval_int(f.L,
+            "ch = Channel.new(2)\n"
+            "p = spawn(:produce, ch, 50)\n"
+            "expect = 1\n"
+            "max_seen = 0\n"
+            "loop do\n"
+            "  max_seen = ch.size if ch.size > max_seen\n"
+            "  x = ch.pop\n"
+            "  break if x.nil?\n"
+            "  expect = -1000 if x != expect\n"
+            "  expect += 1\n"
+            "end\n"
+            "(ch.closed? && max_seen <= 2) ? expect + p.value : -1", &v) && v == 101;
+        teardown(&f);
+        if (ok) PASS(); else FAIL("channel reordered or overflowed");
+    }
+
+    TEST("actor errors surface from value") {
+        fixture f = setup();
+        luby_value out;
+        int ok = luby_eval(f.L, "spawn(:boom).value", 0, "<test>", &out) != 0;
+        luby_error err = luby_last_error(f.L);
+        ok = ok && err.message && strstr(err.message, "kaboom") != NULL;
+        int64_t v = 0;
+        ok = ok && eval_int(f.L, "spawn(:no_such_function).done?\n7", &v) && v == 7;
+        ok = ok && luby_eval(f.L, "spawn(:no_such_function).value", 0, "<test>", &out) != 0;
+        teardown(&f);
+        if (ok) PASS(); else FAIL("error was not propagated");
+    }
+
+    TEST("values that cannot cross states are rejected") {
+        fixture f = setup();
+        luby_value out;
+        int ok = luby_eval(f.L, "class Blob\nend\nspawn(:sum_to, Blob.new)", 0, "<test>", &out) != 0;
+        ok = ok && luby_last_error(f.L).code == LUBY_E_TYPE;
+        ok = ok && luby_eval(f.L, "Channel.new(1).push(->(x) { x })", 0, "<test>", &out) != 0;
+        ok = ok && luby_last_error(f.L).code == LUBY_E_TYPE;
+        ok = ok && luby_eval(f.L, "c = Channel.new(1)\nc.close\nc.push(1)", 0, "<test>", &out) != 0;
+        teardown(&f);
+        if (ok) PASS(); else FAIL("unsendable value accepted");
+    }
+
+    TEST("worker states are pooled and reused") {
+        fixture f = setup();
+        int64_t v = 0;
+        int ok = eval_int(f.L, "t = 0\n10.times { |i| t += spawn(:sum_to, i).value }\nt", &v) && v == 165;
+        // Sequential actors hand the same worker state back and forth
+        pt_lock(NULL, f.pool->mutex);
+        while (f.pool->running > 0) pt_wait(NULL, f.pool->cond, f.pool->mutex);
+        ok = ok && f.pool->idle_count == 1;
+        pt_unlock(NULL, f.pool->mutex);
+        teardown(&f);
+        if (ok) PASS(); else FAIL("worker states were not reused");
+    }
+
+    printf("\n=== Results ===\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    return tests_failed > 0 ? 1 : 0;
+}
@@ -1,6 +1,9 @@
 #define LUBY_IMPLEMENTATION
 #include "../luby.h"
 #include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 // Code that exercises the parser/compiler with various constructs
@@ -31,6 +34,81 @@ const char *TEST_CODE =
     "total_age\n";  // Should be 90
 
 #define ITERATIONS 10000
+#define LIST_ITERATIONS 200
+
+// Allocator that counts every allocation/reallocation request
+static size_t alloc_calls = 0;
+
+static void *counting_alloc(void *user, void *ptr, size_t size) {
+    (void)user;
+    if (size == 0) { free(ptr); return NULL; }
+    alloc_calls++;
+    return realloc(ptr, size);
+}
+
+// Build a script dominated by long parser lists: a big array literal,
+// a big hash literal, a long call argument list and a long method body.
+static char *build_list_code(void) {
+    size_t cap = 1 << 20, len = 0;
+    char *buf = (char *)malloc(cap);
+    if (!buf) return NULL;
+    len += (size_t)snprintf(buf + len, cap - len, "arr = [");
+    for (int i = 0; i < 2000; i++) len += (size_t)snprintf(buf + len, cap - len, "%d, ", i);
+    len += (size_t)snprintf(buf + len, cap - len, "0]\nh = {");
+    for (int i = 0; i < 1000; i++) len += (size_t)snprintf(buf + len, cap - len, "k%d: %d, ", i, i);
+    len += (size_t)snprintf(buf + len, cap - len, "z: 0}\ndef many(*a)\n  a.size\nend\nmany(");
+    for (int i = 0; i < 500; i++) len += (size_t)snprintf(buf + len, cap - len, "%d, ", i);
+    len += (size_t)snprintf(buf + len, cap - len, "0)\ndef body\n  x = 0\n");
+    for (int i = 0; i < 1000; i++) len += (size_t)snprintf(buf + len, cap - len, "  x = x + %d\n", i);
+    len += (size_t)snprintf(buf + len, cap - len, "  x\nend\nbody()\n");
+    return buf;
+}
+
+static int bench_lists(void) {
+    char *code = build_list_code();
+    if (!code) return 1;
+    luby_config cfg = {0};
+    cfg.alloc = counting_alloc;
+
+    printf("=== Parser List Benchmark ===\n\n");
+    printf("Code: %zu bytes (2000-element array, 1000-pair hash, 501 call args, 1002-statement body)\n", strlen(code));
+    printf("Iterations: %d\n\n", LIST_ITERATIONS);
+
+    // Allocator calls for one eval, minus the cost of an empty eval
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+    luby_value result;
+    alloc_calls = 0;
+    luby_eval(L, "nil", 0, "<bench>", &result);
+    size_t baseline = alloc_calls;
+    alloc_calls = 0;
+    int rc = luby_eval(L, code, 0, "<bench>", &result);
+    size_t calls = alloc_calls;
+    if (rc != 0 || result.type != LUBY_T_INT || result.as.i != 499500) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("ERROR: List code failed (rc=%d): %s\n", rc, buf);
+        luby_free(L);
+        free(code);
+        return 1;
+    }
+    printf("Correctness verified: result = %" PRId64 " (expected 499500)\n", result.as.i);
+    printf("Allocator calls per eval: %zu (empty eval: %zu)\n\n", calls, baseline);
+
+    clock_t start = clock();
+    for (int i = 0; i < LIST_ITERATIONS; i++) {
+        luby_eval(L, code, 0, "<bench>", &result);
+    }
+    clock_t end = clock();
+    double elapsed = (double)(end - start) / CLOCKS_PER_SEC;
+    luby_free(L);
+
+    printf("Time for %d iterations: %.3f seconds\n", LIST_ITERATIONS, elapsed);
+    printf("Average per iteration: %.3f ms\n", (elapsed / LIST_ITERATIONS) * 1000);
+    printf("Eval throughput: %.1f MB/s\n", (double)strlen(code) * LIST_ITERATIONS / elapsed / (1024.0 * 1024.0));
+    free(code);
+    return 0;
+}
 
 int main() {
     printf("=== Arena Allocation Benchmark ===\n\n");
@@ -45,13 +123,13 @@ int main() {
     if (rc != 0 || result.type != LUBY_T_INT || result.as.i != 90) {
         char buf[256];
         luby_format_error(L, buf, sizeof(buf));
-        printf("ERROR: Test code failed (rc=%d, expected 90, got %lld)\n", 
-               rc, result.type == LUBY_T_INT ? result.as.i : -1);
+        printf("ERROR: Test code failed (rc=%d, expected 90, got %" PRId64 ")\n", 
+               rc, result.type == LUBY_T_INT ? result.as.i : (int64_t)-1);
         printf("Error: %s\n", buf);
         luby_free(L);
         return 1;
     }
-    printf("Correctness verified: result = %lld (expected 90)\n\n", result.as.i);
+    printf("Correctness verified: result = %" PRId64 " (expected 90)\n\n", result.as.i);
     luby_free(L);
     
     // Benchmark
@@ -69,7 +147,7 @@ int main() {
     
     printf("Time for %d iterations: %.3f seconds\n", ITERATIONS, elapsed);
     printf("Average per iteration: %.3f ms\n", (elapsed / ITERATIONS) * 1000);
-    printf("Iterations per second: %.0f\n", ITERATIONS / elapsed);
+    printf("Iterations per second: %.0f\n\n", ITERATIONS / elapsed);
     
-    return 0;
+    return bench_lists();
 }
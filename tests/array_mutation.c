@@ -0,0 +1,194 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Returns the array a script leaves behind, for checks on its storage
+static luby_array *eval_array(luby_state *L, const char *label, const char *code) {
+    luby_value out;
+    if (!eval_check(L, label, code, &out)) return NULL;
+    return out.type == LUBY_T_ARRAY ? (luby_array *)out.as.ptr : NULL;
+}
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+
+    printf("=== Array Mutation Tests ===\n\n");
+
+    /* ---- push / pop ---- */
+    printf("--- push / pop ---\n");
+
+    test_str(L, "push_pop_in_place",
+        "a = [1]\n"
+        "b = a\n"
+        "a << 2 << 3\n"
+        "a.push(4, 5)\n"
+        "last = a.pop\n"
+        "tail = a.pop(2)\n"
+        "(b + [last] + tail).map { |x| x.to_s }.join(\",\")", "1,2,5,3,4");
+
+    test_int(L, "pop_empty",
+        "[].pop.nil? ? 0 : 9", 0);
+
+    /* ---- shift / unshift ---- */
+    printf("\n--- shift / unshift ---\n");
+
+    test_str(L, "shift_unshift_front",
+        "a = [3, 4]\n"
+        "a.unshift(1, 2)\n"
+        "a.unshift(0)\n"
+        "first = a.shift\n"
+        "two = a.shift(2)\n"
+        "(a + [first] + two).map { |x| x.to_s }.join(\",\")", "3,4,0,1,2");
+
+    test_int(L, "shift_empty",
+        "[].shift.nil? ? 0 : 9", 0);
+
+    /* ---- insert / concat ---- */
+    printf("\n--- insert / concat ---\n");
+
+    test_str(L, "insert_positions",
+        "a = [1, 4]\n"
+        "a.insert(1, 2, 3)\n"
+        "a.insert(-1, 5)\n"
+        "a.insert(0, 0)\n"
+        "a.insert(8, 8)\n"
+        "a.map { |x| x.nil? ? \"_\" : x.to_s }.join(\",\")", "0,1,2,3,4,5,_,_,8");
+
+    test_str(L, "concat_self",
+        "c = [1, 2]\n"
+        "r = c.concat([3], c)\n"
+        "r[0] = 0\n"
+        "c.map { |x| x.to_s }.join(\",\")", "0,2,3,1,2");
+
+    /* ---- O(1) shift storage ---- */
+    printf("\n--- shift storage ---\n");
+
+    luby_array *arr = eval_array(L, "queue_setup", "q = []\n100.times { |i| q << i }\nq");
+    luby_value *items = arr ? arr->items : NULL;
+    if (arr) {
+        test_int(L, "shift_three", "q.shift + q.shift + q.shift", 3);
+        check("shift_advances_head", arr->items == items + 3 && arr->head == 3 && arr->count == 97);
+        // unshift reuses the gap left by shift
+        test_int(L, "unshift_into_gap", "q.unshift(-1)\nq[0] + q[1]", 2);
+        check("unshift_reuses_gap", arr->items == items + 2);
+        // Draining resets the array to the start of its block
+        test_int(L, "drain", "q.shift(200).size + q.size", 98);
+        check("drain_resets_head", arr->head == 0 && arr->items == items);
+    }
+
+    arr = eval_array(L, "rolling_queue_setup",
+        "q = []\n"
+        "total = 0\n"
+        "i = 0\n"
+        "while i < 20000\n"
+        "  q.push(i)\n"
+        "  total += q.shift if q.size > 64\n"
+        "  i += 1\n"
+        "end\n"
+        "q");
+    if (arr) {
+        test_int(L, "rolling_queue_total", "total + q.sum", 19999LL * 20000 / 2);
+        check("rolling_queue_bounded", arr->count == 64 && arr->head + arr->capacity <= 256);
+    }
+
+    /* ---- << and >> dispatch ---- */
+    printf("\n--- << and >> ---\n");
+
+    test_int(L, "integer_shifts",
+        "(1 << 10) + (1024 >> 3) + (-8 >> 1) + (1 << 64)", 1024 + 128 - 4);
+
+    test_int(L, "user_defined_append",
+        "class Log\n"
+        "  attr_reader :lines\n"
+        "  def initialize\n"
+        "    @lines = []\n"
+        "  end\n"
+        "  def <<(line)\n"
+        "    @lines << line\n"
+        "    self\n"
+        "  end\n"
+        "end\n"
+        "log = Log.new\n"
+        "log << 1 << 2\n"
+        "log.lines.size", 2);
+
+    /* ---- frozen arrays ---- */
+    printf("\n--- frozen ---\n");
+
+    const char *frozen_cases[] = {
+        "[1].freeze << 2", "[1].freeze.push(2)", "[1].freeze.pop", "[1].freeze.shift",
+        "[1].freeze.unshift(0)", "[1].freeze.insert(0, 1)", "[1].freeze.concat([2])"
+    };
+    luby_value out;
+    int rejected = 1;
+    for (size_t i = 0; i < sizeof(frozen_cases) / sizeof(frozen_cases[0]); i++) {
+        if (luby_eval(L, frozen_cases[i], 0, "<test>", &out) == 0) {
+            printf("  accepted: %s\n", frozen_cases[i]);
+            rejected = 0;
+        }
+    }
+    check("frozen_mutators_raise", rejected);
+    check("string_append_type_error",
+        luby_eval(L, "\"a\" << 1", 0, "<test>", &out) != 0 && luby_last_error(L).code == LUBY_E_TYPE);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
@@ -185,6 +185,75 @@ int main(void) {
     run(L, "ch.extra = 20");
     test_bool(L, "inherited write both", "ch.val == 10 && ch.extra == 20");
 
+    printf("\n=== native accessors ===\n");
+
+    run(L,
+        "class Wide\n"
+        "  attr_accessor :an_attribute_name_long_enough_to_overflow_the_old_one_hundred_and_twenty_eight_byte_source_buffer_used_by_attr\n"
+        "  attr_reader :n\n"
+        "  def initialize\n"
+        "    @n = 0\n"
+        "  end\n"
+        "  def bump\n"
+        "    self.n + n() + 1\n"
+        "  end\n"
+        "end\n"
+        "w = Wide.new\n"
+        "w.an_attribute_name_long_enough_to_overflow_the_old_one_hundred_and_twenty_eight_byte_source_buffer_used_by_attr = 5\n");
+    test_int(L, "long attribute name", "w.an_attribute_name_long_enough_to_overflow_the_old_one_hundred_and_twenty_eight_byte_source_buffer_used_by_attr", 5);
+    test_int(L, "implicit and explicit self", "w.bump", 1);
+    test_int(L, "accessor via send", "w.send(:n) + w.send(\"an_attribute_name_long_enough_to_overflow_the_old_one_hundred_and_twenty_eight_byte_source_buffer_used_by_attr\")", 5);
+    test_int(L, "writer via send", "w.send(\"an_attribute_name_long_enough_to_overflow_the_old_one_hundred_and_twenty_eight_byte_source_buffer_used_by_attr=\", 8) + 1", 9);
+
+    // One call site sees the accessor, an override, and a singleton method
+    run(L,
+        "class Probe\n"
+        "  def read(o)\n"
+        "    o.n\n"
+        "  end\n"
+        "end\n"
+        "pr = Probe.new\n"
+        "r1 = pr.read(w)\n"
+        "class Wider < Wide\n"
+        "  def n\n"
+        "    @n + 100\n"
+        "  end\n"
+        "end\n"
+        "r2 = pr.read(Wider.new)\n"
+        "v = Wide.new\n"
+        "def v.n\n"
+        "  7\n"
+        "end\n"
+        "r3 = pr.read(v)\n");
+    test_string(L, "call site follows overrides", "[r1, r2, r3].map { |x| x.to_s }.join(\" \")", "0 100 7");
+
+    run(L,
+        "class Counter\n"
+        "  attr_accessor :count\n"
+        "end\n"
+        "k = Counter.new\n"
+        "k.count = 0\n"
+        "i = 0\n"
+        "while i < 1000\n"
+        "  k.count = k.count + 1\n"
+        "  i += 1\n"
+        "end\n");
+    test_int(L, "accessor loop", "k.count", 1000);
+
+    {
+        luby_snapshot *snap = luby_snapshot_new(L);
+        luby_state *C = snap ? luby_clone(snap) : NULL;
+        if (C) {
+            run(C, "k.count = k.count + 1");
+            test_int(C, "accessor in clone", "k.count + Counter.new.count.to_i", 1001);
+            luby_free(C);
+        } else {
+            printf("FAIL accessor in clone: no clone\n");
+            fail_count++;
+        }
+        if (snap) luby_snapshot_free(snap);
+    }
+
     printf("\n%d passed, %d failed\n", pass_count, fail_count);
     luby_free(L);
     return fail_count ? 1 : 0;
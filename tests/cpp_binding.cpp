@@ -0,0 +1,253 @@
+#include "../luby.hpp"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+static int pass_count = 0, fail_count = 0;
+
+static int created = 0, destroyed = 0;
+
+enum class Team { Red = 1, Blue = 2 };
+
+struct Vec2 {
+    double x = 0, y = 0;
+    Vec2() = default;
+    Vec2(double x_, double y_) : x(x_), y(y_) {}
+    double get_x() const { return x; }
+    double dot(const Vec2 &o) const { return x * o.x + y * o.y; }
+    Vec2 scaled(double k) const { return Vec2(x * k, y * k); }
+};
+
+struct Enemy {
+    std::string name;
+    int hp;
+    Team team = Team::Red;
+    Vec2 pos;
+    Enemy(const std::string &n, int h) : name(n), hp(h) { created++; }
+    Enemy(const Enemy &o) : name(o.name), hp(o.hp), team(o.team), pos(o.pos) { created++; }
+    ~Enemy() { destroyed++; }
+    int damage(int amount, bool critical) { hp -= critical ? amount * 2 : amount; return hp; }
+    const std::string &get_name() const { return name; }
+    void rename(const char *n) { name = n; }
+    Team get_team() const { return team; }
+    void set_team(Team t) { team = t; }
+    Vec2 *position() { return &pos; }
+    void move_to(const Vec2 *p) { pos = p ? *p : Vec2(); }
+    int fail() { throw 42; }
+};
+
+// Move-only: can't be copied into a clone
+struct Token {
+    std::unique_ptr<int> id;
+    explicit Token(int i) : id(new int(i)) {}
+    int get() const { return *id; }
+};
+
+// Converted from a number by a user convert<> that throws on negatives
+struct Meters {
+    double v;
+};
+
+namespace luby {
+namespace detail {
+template <> struct is_bound<Meters> : std::false_type {};
+template <> struct convert<Meters> {
+    static bool get(luby_state *L, luby_value v, Meters &out) {
+        if (!convert<double>::get(L, v, out.v)) return false;
+        if (out.v < 0) throw std::domain_error("negative length");
+        return true;
+    }
+    static luby_value push(luby_state *, Meters m) { return luby_float(m.v); }
+};
+} // namespace detail
+} // namespace luby
+
+static double half(Meters m) { return m.v / 2; }
+
+static bool alive(const Enemy &e) { return e.hp > 0; }
+static double distance2(const Vec2 &a, const Vec2 &b) { Vec2 d(a.x - b.x, a.y - b.y); return d.dot(d); }
+static std::string greet(const std::string &who, int times) {
+    std::string s;
+    for (int i = 0; i < times; i++) s += "hi " + who + (i + 1 < times ? "," : "");
+    return s;
+}
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static int check(const char *name, bool cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && std::strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got %s\n", name, expected,
+           out.type == LUBY_T_STRING ? (const char *)out.as.ptr : "a non-string");
+    fail_count++;
+    return 0;
+}
+
+int main() {
+    luby_state *L = luby_new(nullptr);
+    luby_open_base(L);
+    luby::class_<Vec2>(L, "Vec2")
+        .constructor<double, double>()
+        .def<&Vec2::get_x>("x")
+        .def<&Vec2::dot>("dot")
+        .def<&Vec2::scaled>("scaled");
+    luby::class_<Enemy>(L, "Enemy")
+        .constructor<std::string, int>()
+        .def<&Enemy::damage>("damage")
+        .def<&Enemy::get_name>("name")
+        .def<&Enemy::rename>("rename")
+        .def<&Enemy::get_team>("team")
+        .def<&Enemy::set_team>("team=")
+        .def<&Enemy::position>("position")
+        .def<&Enemy::move_to>("move_to")
+        .def<&Enemy::fail>("fail")
+        .def<&alive>("alive?");
+    luby::class_<Token>(L, "Token")
+        .constructor<int>()
+        .def<&Token::get>("get");
+    luby::def<&distance2>(L, "distance2");
+    luby::def<&half>(L, "half");
+    luby::def<&greet>(L, "greet");
+    luby_value out;
+
+    printf("=== C++ Binding Tests ===\n\n");
+
+    /* ---- calls ---- */
+    printf("--- calls ---\n");
+
+    test_str(L, "constructors_members_free_functions",
+        "e = Enemy.new(\"orc\", 10)\n"
+        "a = e.damage(3, false)\n"
+        "b = e.damage(2, true)\n"
+        "e.rename(\"boss\")\n"
+        "v = Vec2.new(3, 4)\n"
+        "[a, b, e.name, e.alive?, v.dot(Vec2.new(1, 1)), v.scaled(2).x, distance2(v, Vec2.new(0, 0)), greet(\"bob\", 2)]"
+        ".map { |x| x.to_s }.join(\" \")",
+        "7 3 boss true 7 6 25 hi bob,hi bob");
+    test_str(L, "enum_and_pointer_members",
+        "e.team = 2\n"
+        "e.position.x.to_s + \" \" + e.team.to_s", "0 2");
+    if (eval_check(L, "enemy_lookup", "e", &out)) {
+        Enemy *e = luby::get<Enemy>(out);
+        check("host_reads_bound_object", e && e->team == Team::Blue && e->name == "boss" && !luby::get<Vec2>(out));
+    }
+
+    /* ---- host objects ---- */
+    printf("\n--- host objects ---\n");
+
+    {
+        Enemy boss("dragon", 100);
+        luby_set_global_value(L, "boss", luby::ref(L, &boss));
+        test_str(L, "host_object_shared",
+            "boss.damage(40, false)\n"
+            "boss.move_to(Vec2.new(5, 6))\n"
+            "p = boss.position\n"
+            "boss.move_to(nil)\n"
+            "boss.name + \" \" + p.x.to_s", "dragon 0");
+        check("host_sees_script_calls", boss.hp == 60 && boss.pos.x == 0);
+        luby_eval(L, "boss = nil\np = nil", 0, "<test>", &out);
+    }
+    luby_value v = luby::push(L, Vec2(1.5, 2));
+    Vec2 *copy = luby::get<Vec2>(v);
+    check("push_copies_value", copy && copy->x == 1.5);
+    luby_set_global_value(L, "w", v);
+    test_str(L, "pushed_value_is_bound", "w.x.to_s + \" \" + w.is_a?(Vec2).to_s", "1.5 true");
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    const char *cases[] = {
+        "Enemy.new(1, 2)", "Enemy.new(\"a\")", "Enemy.new(\"a\", 1).damage(1)",
+        "Enemy.new(\"a\", 1).damage(1.5, true)", "Enemy.new(\"a\", 1).damage(1, nil)",
+        "distance2(Vec2.new(0, 0), Enemy.new(\"a\", 1))", "Vec2.new(1, 2).dot(nil)",
+        "Enemy.new(\"a\", 1).fail", "greet(:x)", "half(-1)"
+    };
+    bool rejected = true;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (luby_eval(L, cases[i], 0, "<test>", &out) == 0) {
+            printf("  accepted: %s\n", cases[i]);
+            rejected = false;
+        }
+    }
+    check("invalid_calls_raise", rejected);
+    test_str(L, "symbol_converts_to_string", "greet(:x, 1)", "hi x");
+    test_str(L, "converter_accepts", "half(3).to_s", "1.5");
+    // A throwing converter fails the argument, not the process
+    luby_value neg = luby_int(-4);
+    check("throwing_converter_is_type_error", luby_invoke_global(L, "half", 1, &neg, &out) == LUBY_E_TYPE);
+
+    /* ---- VM-owned objects ---- */
+    printf("\n--- VM-owned objects ---\n");
+
+    int before = destroyed;
+    if (eval_check(L, "owned_setup", "3.times { |i| Enemy.new(\"e\", i) }\nkeep = Enemy.new(\"k\", 1)", &out)) {
+        check("invalidate_destroys_now", luby_invalidate_userdata(out) && destroyed > before);
+        check("invalidated_object_raises", luby_eval(L, "keep.name", 0, "<test>", &out) != 0);
+    }
+
+    /* ---- snapshot / clone ---- */
+    printf("\n--- snapshot / clone ---\n");
+
+    eval_check(L, "clone_setup",
+        "keep = Enemy.new(\"a long name that does not fit inline\", 5)\n"
+        "spots = [Vec2.new(1, 2)]", &out);
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : nullptr;
+    if (C) {
+        // Source, snapshot and clone each own a copy-constructed Enemy
+        test_str(C, "clone_owns_its_objects", "keep.rename(\"clone\")\nkeep.name + \" \" + spots[0].x.to_s", "clone 1");
+        test_str(L, "source_unchanged_by_clone", "keep.name", "a long name that does not fit inline");
+        luby_free(C);
+    } else {
+        printf("FAIL clone_owns_its_objects: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+
+    if (eval_check(L, "token_setup", "t = Token.new(7)\nt.get", &out)) check("move_only_object", out.as.i == 7);
+    snap = luby_snapshot_new(L);
+    luby_error err = luby_last_error(L);
+    check("move_only_refuses_snapshot",
+        !snap && err.code == LUBY_E_RUNTIME && std::strcmp(err.message, "userdata could not be copied") == 0);
+    luby_snapshot_free(snap);
+    test_str(L, "move_only_survives_refusal", "t.get.to_s", "7");
+    eval_check(L, "token_drop", "t = nil", &out);
+    snap = luby_snapshot_new(L);
+    check("snapshot_after_drop", snap != nullptr);
+    luby_snapshot_free(snap);
+
+    luby_free(L);
+    // Every Enemy made by the VM, a snapshot or a clone was destroyed exactly once
+    check("each_enemy_destroyed_once", created > 0 && destroyed == created);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    return fail_count ? 1 : 0;
+}
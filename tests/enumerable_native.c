@@ -0,0 +1,299 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static void check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+    } else {
+        printf("FAIL %s\n", name);
+        fail_count++;
+    }
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code fails with `expected` and, if given, a message containing `part`
+static int test_error(luby_state *L, const char *name, const char *code, luby_error_code expected, const char *part) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        luby_error err = luby_last_error(L);
+        if ((expected == LUBY_E_OK || err.code == expected) && (!part || (err.message && strstr(err.message, part)))) {
+            printf("PASS %s\n", name);
+            pass_count++;
+            return 1;
+        }
+        printf("FAIL %s: unexpected error \"%s\"\n", name, err.message ? err.message : "");
+    } else {
+        printf("FAIL %s: expected an error\n", name);
+    }
+    fail_count++;
+    return 0;
+}
+
+// Three collections: one forwarding to an ivar (direct iteration), one
+// with a hand-written loop (driven through __enum_drive) and one that logs
+// every element it produces
+static const char *COLLECTIONS =
+    "class Bag\n"
+    "  include Enumerable\n"
+    "  def initialize(items)\n"
+    "    @items = items\n"
+    "  end\n"
+    "  def each(&blk)\n"
+    "    @items.each { |x| blk.call(x) }\n"
+    "    self\n"
+    "  end\n"
+    "end\n"
+    "class Walk\n"
+    "  include Enumerable\n"
+    "  def initialize(items)\n"
+    "    @data = items\n"
+    "  end\n"
+    "  def each(&blk)\n"
+    "    i = 0\n"
+    "    while i < @data.length\n"
+    "      blk.call(@data[i])\n"
+    "      i += 1\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "class Pair\n"
+    "  include Enumerable\n"
+    "  def initialize(a, b)\n"
+    "    @a = a\n"
+    "    @b = b\n"
+    "  end\n"
+    "  def each(&f)\n"
+    "    f.call(@a)\n"
+    "    f.call(@b)\n"
+    "  end\n"
+    "end\n"
+    "class Counting\n"
+    "  include Enumerable\n"
+    "  attr_reader :produced\n"
+    "  def initialize\n"
+    "    @produced = 0\n"
+    "  end\n"
+    "  def each(&blk)\n"
+    "    i = 0\n"
+    "    while i < 1000\n"
+    "      @produced += 1\n"
+    "      blk.call(i)\n"
+    "      i += 1\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "class Money\n"
+    "  include Comparable\n"
+    "  attr_reader :cents\n"
+    "  def initialize(cents)\n"
+    "    @cents = cents\n"
+    "  end\n"
+    "  def <=>(other)\n"
+    "    @cents <=> other.cents\n"
+    "  end\n"
+    "end\n";
+
+// Every method against one collection, joined into a string
+static const char *SUMMARY =
+    "r = []\n"
+    "r << c.map { |x| x * 2 }.sum\n"
+    "r << c.select { |x| x > 2 }.size\n"
+    "r << c.reject { |x| x > 2 }.size\n"
+    "r << c.find { |x| x > 4 }\n"
+    "r << (c.any? { |x| x > 7 } ? 1 : 0)\n"
+    "r << (c.all? { |x| x > 0 } ? 1 : 0)\n"
+    "r << (c.none? { |x| x > 100 } ? 1 : 0)\n"
+    "r << c.count + c.count { |x| x.odd? } * 10 + c.count(3) * 100\n"
+    "r << (c.include?(3) ? 1 : 0)\n"
+    "r << c.first\n"
+    "r << c.first(2).sum + c.take(1).sum\n"
+    "r << c.drop(1).sum\n"
+    "r << c.reduce(0) { |a, x| a + x } + c.inject { |a, x| a * x }\n"
+    "r << c.sum + c.sum(100) + c.sum { |x| x * x }\n"
+    "r << c.min * 10 + c.max\n"
+    "r << c.min_by { |x| -x } * 10 + c.max_by { |x| -x }\n"
+    "r << c.sort.map { |x| x.to_s }.join\n"
+    "r << c.sort_by { |x| -x }.map { |x| x.to_s }.join\n"
+    "r << c.flat_map { |x| [x, x] }.size\n"
+    "r << c.to_a.size + c.entries.size\n"
+    "r << c.each_with_object([]) { |x, acc| acc << x }.size\n"
+    "w = 0\n"
+    "c.each_with_index { |x, i| w += x * i }\n"
+    "r << w\n"
+    "r << c.group_by { |x| x % 2 }.size\n"
+    "r << c.tally[3]\n"
+    "r << c.zip([1, 2]).size\n"
+    "r << c.lazy.map { |x| x + 1 }.first(2).sum\n"
+    "r.map { |x| x.to_s }.join(\",\")";
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+    run(L, COLLECTIONS);
+
+    printf("=== Native Enumerable Tests ===\n\n");
+
+    /* ---- each shapes ---- */
+    printf("--- each shapes ---\n");
+
+    // Forwarding, looping and range-backed each run every method the same way
+    const char *expect = "34,3,1,5,1,1,1,134,1,5,13,12,137,233,18,81,1358,8531,8,8,4,22,2,1,4,10";
+    char code[2048];
+    snprintf(code, sizeof(code), "c = Bag.new([5, 3, 8, 1])\n%s", SUMMARY);
+    test_str(L, "forwarding_each", code, expect);
+    snprintf(code, sizeof(code), "c = Walk.new([5, 3, 8, 1])\n%s", SUMMARY);
+    test_str(L, "looping_each", code, expect);
+    snprintf(code, sizeof(code), "c = Bag.new(1..4)\n%s", SUMMARY);
+    test_str(L, "range_backed_each", code, "20,2,2,,0,1,1,124,1,1,4,9,34,150,14,41,1234,4321,8,8,4,20,2,1,4,5");
+
+    /* ---- direct iteration ---- */
+    printf("\n--- direct iteration ---\n");
+
+    // Reading @items directly skips every interpreted each/blk.call step
+    run(L, "data = (1..1000).to_a\nfast = Bag.new(data)\nslow = Walk.new(data)");
+    test_int(L, "forwarded_map", "fast.map { |e| e }.size", 1000);
+    size_t fast_steps = L->instruction_count;
+    test_int(L, "looping_map", "slow.map { |e| e }.size", 1000);
+    size_t slow_steps = L->instruction_count;
+    check("forwarded_ivar_skips_each", fast_steps * 3 < slow_steps);
+    // Mutating the collection from the block is seen by the iteration
+    test_int(L, "block_mutation_seen",
+        "list = [1, 2]\n"
+        "b = Bag.new(list)\n"
+        "b.map { |e| list << 9 if e == 1; e }.size", 3);
+
+    /* ---- early exit ---- */
+    printf("\n--- early exit ---\n");
+
+    test_int(L, "find_stops_each", "c = Counting.new\nc.find { |x| x == 3 }\nc.produced", 4);
+    test_int(L, "first_n_stops_each", "c = Counting.new\nc.first(5).size + c.produced * 100", 505);
+    test_int(L, "first_stops_each", "c = Counting.new\nc.first\nc.produced", 1);
+    test_int(L, "include_stops_each", "c = Counting.new\n(c.include?(9) ? 1000 : 0) + c.produced", 1010);
+    test_int(L, "all_stops_each", "c = Counting.new\n(c.all? { |x| x < 2 } ? 1000 : 0) + c.produced", 3);
+    // Nothing is taken: each is never started
+    test_int(L, "first_zero_skips_each", "c = Counting.new\nc.first(0).size + c.produced", 0);
+
+    /* ---- break ---- */
+    printf("\n--- break ---\n");
+
+    test_int(L, "break_from_map", "Walk.new([1, 2, 3]).map { |x| break x * 100 if x == 2\nx }", 200);
+    test_int(L, "break_from_each_with_index", "Bag.new([1, 2, 3]).each_with_index { |x, i| break i + 40 if x == 3 }", 42);
+    test_int(L, "break_stops_each", "c = Counting.new\nc.each_with_index { |x, i| break if i == 6 }\nc.produced", 7);
+    test_int(L, "usable_after_break", "Walk.new([4, 5]).sum", 9);
+
+    /* ---- nesting ---- */
+    printf("\n--- nesting ---\n");
+
+    test_int(L, "nested_map",
+        "outer = Pair.new(1, 3)\n"
+        "inner = Walk.new([10, 20])\n"
+        "outer.map { |a| inner.map { |b| a * b }.sum }.sum", 120);
+    test_int(L, "nested_flat_map", "Pair.new(Walk.new([1, 2]), Bag.new([3])).flat_map { |w| w.to_a }.sum", 6);
+
+    /* ---- comparisons ---- */
+    printf("\n--- comparisons ---\n");
+
+    test_int(L, "sort_min_max_objects",
+        "m = Walk.new([Money.new(30), Money.new(5), Money.new(12)])\n"
+        "m.sort.first.cents * 10000 + m.min.cents * 100 + m.max.cents", 5 * 10000 + 5 * 100 + 30);
+    test_int(L, "sort_by_objects", "Bag.new([3, 1, 2]).sort_by { |x| Money.new(-x) }.first", 3);
+    test_error(L, "sort_mixed_types", "Bag.new([1, \"a\"]).sort", LUBY_E_TYPE, NULL);
+    test_int(L, "comparable_operators",
+        "a = Money.new(1)\n"
+        "b = Money.new(2)\n"
+        "n = 0\n"
+        "n += 1 if a.send(\"<\", b)\n"
+        "n += 2 if a.send(\"<=\", a)\n"
+        "n += 4 if b.send(\">\", a)\n"
+        "n += 8 if b.send(\">=\", b)\n"
+        "n += 16 if a == Money.new(1)\n"
+        "n += 32 if a != b\n"
+        "n += 64 if Money.new(5).between?(a, Money.new(9))\n"
+        "n += 128 unless Money.new(10).between?(a, Money.new(9))\n"
+        "n += 256 if a < b && b >= a && !(a > b)\n"
+        "n", 511);
+    test_int(L, "comparable_clamp",
+        "lo = Money.new(10)\n"
+        "hi = Money.new(20)\n"
+        "Money.new(5).clamp(lo, hi).cents + Money.new(25).clamp(lo, hi).cents * 100 + Money.new(15).clamp(lo, hi).cents * 10000",
+        10 + 2000 + 150000);
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    test_error(L, "block_error_propagates", "Walk.new([1, 2]).map { |x| raise \"boom\" }", LUBY_E_OK, "boom");
+    test_error(L, "each_error_propagates",
+        "class Broken\n"
+        "  include Enumerable\n"
+        "  def each(&blk)\n"
+        "    raise \"bad each\"\n"
+        "  end\n"
+        "end\n"
+        "Broken.new.to_a", LUBY_E_OK, "bad each");
+    test_error(L, "yield_outside_drive", "__enum_yield(1)", LUBY_E_OK, NULL);
+    test_int(L, "usable_after_errors", "Walk.new([1, 2]).map { |x| x }.size", 2);
+
+    // Runs last: the limit stays on the state
+    luby_set_instruction_limit(L, 5000);
+    test_error(L, "instruction_limit_stops_endless_range",
+        "Bag.new(1..Float::INFINITY).find { |x| x < 0 }", LUBY_E_RUNTIME, NULL);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
@@ -0,0 +1,266 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static void check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+    } else {
+        printf("FAIL %s\n", name);
+        fail_count++;
+    }
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int collections = 0;
+static int paused_collections = 0;
+static int sweeps_left_pending = 0;
+
+// Host function: force a full collection right now, from inside whatever
+// block or method is running
+static int gc_now(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)argc; (void)argv;
+    if (L->gc_paused) paused_collections++;
+    luby_gc_collect(L);
+    collections++;
+    if (L->gc_sweep_list) sweeps_left_pending++;
+    if (out) *out = luby_nil();
+    return 0;
+}
+
+static int finalized = 0;
+static int finalized_sum = 0;
+
+static void count_finalizer(void *data) {
+    finalized++;
+    if (data) finalized_sum += *(int *)data;
+}
+
+static void reset_counts(void) {
+    collections = 0;
+    paused_collections = 0;
+    sweeps_left_pending = 0;
+}
+
+int main(void) {
+    // Incremental sweeping and deferred finalizers throughout; a second
+    // gc_now() finishes the sweep the first one left pending
+    luby_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.gc_sweep_batch = 64;
+    cfg.defer_finalizers = 1;
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+    luby_register_function(L, "gc_now", gc_now);
+    luby_value out;
+
+    printf("=== GC Tests ===\n\n");
+
+    /* ---- deep structures ---- */
+    printf("--- deep structures ---\n");
+
+    // 1M nodes are marked iteratively
+    test_int(L, "deep_linked_list",
+        "class Node\n  attr_accessor :next\nend\n"
+        "head = nil\ni = 0\n"
+        "while i < 1000000\n  n = Node.new\n  n.next = head\n  head = n\n  i += 1\nend\n"
+        "gc_now()\n"
+        "count = 0\nnode = head\n"
+        "while node\n  count += 1\n  node = node.next\nend\ncount", 1000000);
+    // Drop the list so the later heap-size check starts small
+    run(L, "head = nil\nn = nil");
+    test_int(L, "deep_nested_arrays",
+        "a = []\ni = 0\nwhile i < 200000\n  a = [a]\n  i += 1\nend\n"
+        "gc_now()\n"
+        "depth = 0\nwhile a.length > 0\n  a = a[0]\n  depth += 1\nend\ndepth", 200000);
+
+    /* ---- collection inside blocks ---- */
+    printf("\n--- collection inside blocks ---\n");
+
+    reset_counts();
+    test_str(L, "map_keeps_receiver_and_result",
+        "r = [\"a\" + \"1\", \"b\" + \"2\", \"c\" + \"3\"].map { |s| gc_now()\n s + \"!\" }\n"
+        "r.join(\",\")", "a1!,b2!,c3!");
+    check("map_collects_unpaused", collections == 3 && paused_collections == 0);
+
+    reset_counts();
+    test_str(L, "nested_blocks_keep_outer_values",
+        "r = [1, 2].map { |a| [3, 4].map { |b| gc_now()\n \"#{a}-#{b}\" }.join(\"+\") }\n"
+        "r.join(\",\")", "1-3+1-4,2-3+2-4");
+    check("nested_blocks_collect_unpaused", collections == 4 && paused_collections == 0);
+
+    reset_counts();
+    test_str(L, "group_by_keeps_groups",
+        "h = [1, 2, 3, 4, 5].group_by { |x| gc_now()\n x.even? ? \"even\" : \"odd\" }\n"
+        "h[\"odd\"].map { |x| x.to_s }.join(\",\") + \"/\" + h[\"even\"].map { |x| x.to_s }.join(\",\")", "1,3,5/2,4");
+    check("group_by_collects_unpaused", collections == 5 && paused_collections == 0);
+
+    reset_counts();
+    test_str(L, "sort_by_keeps_keys",
+        "r = [3, 1, 2].sort_by { |x| gc_now()\n \"k\" + x.to_s }\n"
+        "r.map { |x| x.to_s }.join(\",\")", "1,2,3");
+    check("sort_by_collects", collections == 3);
+
+    reset_counts();
+    test_str(L, "lazy_to_a_streams",
+        "r = (1..6).lazy.map { |x| gc_now()\n \"v\" + x.to_s }.select { |s| s != \"v3\" }.to_a\n"
+        "r.join(\",\")", "v1,v2,v4,v5,v6");
+    check("lazy_collects_unpaused", collections == 6 && paused_collections == 0);
+
+    test_int(L, "long_map_result",
+        "r = (1..20000).map { |x| t = [x, x, x, x].map { |y| y.to_s * 8 }\n t.length }\n"
+        "r.length", 20000);
+    // Without collection inside the block every temporary array and
+    // string would still be live at this point
+    check("long_map_reclaims_temporaries", L->gc_total < 20000 * 4);
+
+    run(L, "class Greeter\n  def greet(name)\n    gc_now()\n    \"hi \" + name\n  end\nend\n"
+           "g = Greeter.new");
+    luby_method_ref *ref = luby_method_ref_new(L, NULL, "greet");
+    luby_value name = luby_string(L, "bob", 0);
+    luby_value r;
+    check("method_handle_keeps_arguments",
+          ref && luby_method_ref_call(L, ref, luby_get_global_value(L, "g"), 1, &name, &r) == 0 &&
+          r.type == LUBY_T_STRING && strcmp((const char *)r.as.ptr, "hi bob") == 0);
+    luby_method_ref_free(L, ref);
+
+    /* ---- handles ---- */
+    printf("\n--- handles ---\n");
+
+    // A strong handle keeps a value alive without globals
+    run(L, "tmp = [\"kept\" + \"!\"]");
+    int kept = luby_ref(L, luby_get_global_value(L, "tmp"));
+    run(L, "tmp = nil\ngc_now()\ngc_now()");
+    luby_value v = luby_ref_get(L, kept), s;
+    check("strong_handle_pins", kept != LUBY_NOREF && v.type == LUBY_T_ARRAY && luby_array_get(v, 0, &s) == 0 &&
+          s.type == LUBY_T_STRING && strcmp((const char *)s.as.ptr, "kept!") == 0);
+    luby_unref(L, kept);
+
+    // A weak handle is cleared once its value is collected
+    run(L, "tmp = [1, 2, 3]");
+    luby_value arr = luby_get_global_value(L, "tmp");
+    int strong = luby_ref(L, arr);
+    int weak = luby_ref_weak(L, arr);
+    int weak_int = luby_ref_weak(L, luby_int(7));
+    run(L, "tmp = nil\ngc_now()\ngc_now()");
+    check("weak_handle_kept_while_pinned", luby_ref_get(L, weak).type == LUBY_T_ARRAY);
+    luby_unref(L, strong);
+    run(L, "gc_now()\ngc_now()");
+    check("weak_handle_cleared", luby_ref_get(L, weak).type == LUBY_T_NIL);
+    // Immediates are never collected, so weak handles to them persist
+    check("weak_handle_to_immediate", luby_ref_get(L, weak_int).type == LUBY_T_INT && luby_ref_get(L, weak_int).as.i == 7);
+    luby_unref(L, weak);
+    luby_unref(L, weak_int);
+
+    // Freed slots are reused before the table grows
+    int handles[1000];
+    int allocated = 1, top = 0;
+    for (int i = 0; i < 1000; i++) {
+        handles[i] = luby_ref(L, luby_int(i));
+        allocated = allocated && handles[i] != LUBY_NOREF;
+        if (handles[i] > top) top = handles[i];
+    }
+    check("handles_allocated", allocated);
+    for (int i = 0; i < 1000; i += 2) luby_unref(L, handles[i]);
+    luby_unref(L, handles[0]);  // double unref is a no-op
+    int reused = 1;
+    for (int i = 0; i < 500; i++) reused = reused && luby_ref(L, luby_int(-1)) <= top;
+    check("handles_reused_after_unref", reused && luby_ref(L, luby_int(0)) == top + 1);
+    int intact = 1;
+    for (int i = 1; i < 1000; i += 2) intact = intact && luby_ref_get(L, handles[i]).as.i == i;
+    check("held_handles_intact", intact);
+    check("bad_handles_read_nil", luby_ref_get(L, LUBY_NOREF).type == LUBY_T_NIL && luby_ref_get(L, 99999).type == LUBY_T_NIL);
+
+    /* ---- incremental sweep ---- */
+    printf("\n--- incremental sweep ---\n");
+
+    reset_counts();
+    test_int(L, "incremental_sweep_keeps_live",
+        "keep = (0...5000).map { |i| [i, \"x\" * 16] }\n"
+        "gc_now()\n"
+        "i = 0\nwhile i < 20000\n  t = [i, i]\n  i += 1\nend\n"
+        "sum = 0\nkeep.each { |a| sum += a[0] }\nsum", 12497500);
+    // The collection only marked; sweeping was left to later allocations
+    check("sweep_left_to_allocations", sweeps_left_pending == 1);
+
+    /* ---- deferred finalizers ---- */
+    printf("\n--- deferred finalizers ---\n");
+
+    run(L, "gc_now()\ngc_now()");
+    luby_run_finalizers(L, 0);
+    finalized = 0;
+    finalized_sum = 0;
+    for (int i = 1; i <= 4; i++) {
+        luby_value ud = luby_new_userdata(L, sizeof(int), count_finalizer);
+        *(int *)luby_userdata_ptr(ud) = i;
+    }
+    eval_check(L, "collect_userdata", "gc_now()\ngc_now()\n0", &out);
+    check("finalizers_queued", finalized == 0 && luby_pending_finalizers(L) == 4);
+    check("run_one_finalizer", luby_run_finalizers(L, 1) == 1 && finalized == 1);
+    check("run_remaining_finalizers", luby_run_finalizers(L, 0) == 3 && finalized == 4 && finalized_sum == 10);
+    check("queue_drained", luby_pending_finalizers(L) == 0 && luby_run_finalizers(L, 0) == 0);
+    luby_wrap_userdata(L, NULL, count_finalizer);
+    eval_check(L, "collect_wrapped", "gc_now()\ngc_now()\n0", &out);
+    check("finalizer_queued_at_shutdown", luby_pending_finalizers(L) == 1);
+
+    luby_free(L);
+    // Anything still queued at shutdown runs in luby_free
+    check("shutdown_runs_queued_finalizers", finalized == 5);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    return fail_count ? 1 : 0;
+}
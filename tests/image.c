@@ -0,0 +1,218 @@
+#define _POSIX_C_SOURCE 200809L
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static void check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+    } else {
+        printf("FAIL %s\n", name);
+        fail_count++;
+    }
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_bool(luby_state *L, const char *name, const char *code, int expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_BOOL && out.as.b == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %s\n", name, expected ? "true" : "false");
+    fail_count++;
+    return 0;
+}
+
+static int gc_now(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)argc; (void)argv;
+    luby_gc_collect(L);
+    if (out) *out = luby_nil();
+    return 0;
+}
+
+// Library script: classes, default and keyword arguments, blocks and
+// string/symbol constants
+static const char *LIB_CODE =
+    "class Counter\n"
+    "  attr_reader :count\n"
+    "  def initialize(start = 0)\n"
+    "    @count = start\n"
+    "  end\n"
+    "  def bump(by: 1)\n"
+    "    @count += by\n"
+    "    self\n"
+    "  end\n"
+    "  def label\n"
+    "    \"count=\" + @count.to_s\n"
+    "  end\n"
+    "end\n"
+    "def squares(n)\n"
+    "  (1..n).map { |i| i * i }.sum\n"
+    "end\n"
+    "counter = Counter.new(10)\n"
+    ":loaded\n";
+
+// The cross-state checks need states besides the one in main
+static luby_state *new_state(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+    luby_register_function(L, "gc_now", gc_now);
+    return L;
+}
+
+static size_t image_count(luby_state *L) {
+    size_t n = 0;
+    for (luby_image_attachment *it = L->images; it; it = it->next) n++;
+    return n;
+}
+
+typedef struct worker {
+    luby_image *image;
+    int64_t result;
+    int ok;
+} worker;
+
+static void *worker_main(void *arg) {
+    worker *w = (worker *)arg;
+    luby_state *L = new_state();
+    luby_value out;
+    w->ok = luby_image_run(L, w->image, &out) == 0;
+    int64_t sum = 0;
+    for (int i = 0; i < 50 && w->ok; i++) {
+        w->ok = luby_eval(L, "c = Counter.new(1)\nc.bump(by: 2).bump\ngc_now()\nc.count + squares(10)", 0, "<test>", &out) == 0
+             && out.type == LUBY_T_INT;
+        if (w->ok) sum += out.as.i;
+    }
+    w->result = sum;
+    luby_free(L);
+    return NULL;
+}
+
+int main(void) {
+    luby_state *L = new_state();
+
+    printf("=== Code Image Tests ===\n\n");
+
+    /* ---- running ---- */
+    printf("--- running ---\n");
+
+    luby_image *img = luby_image_compile(L, LIB_CODE, 0, "lib.rb");
+    check("compile", img != NULL);
+    luby_value out;
+    check("run_returns_last_value", img && luby_image_run(L, img, &out) == 0
+          && out.type == LUBY_T_SYMBOL && strcmp((const char *)out.as.ptr, "loaded") == 0);
+    test_int(L, "runs_like_source", "counter.bump(by: 5).count + squares(3)", 29);
+    test_str(L, "survives_collection", "gc_now()\nCounter.new.bump.label", "count=1");
+
+    // Re-running an image in a state reuses its instance
+    luby_image *hello = luby_image_compile(L, "def hello\n  \"hi\"\nend\nhello()", 0, "hello.rb");
+    luby_value first, second;
+    check("rerun_same_result", hello && luby_image_run(L, hello, &first) == 0 && luby_image_run(L, hello, &second) == 0
+          && first.type == LUBY_T_STRING && second.type == LUBY_T_STRING && strcmp((const char *)second.as.ptr, "hi") == 0);
+    size_t instances = image_count(L);
+    check("rerun_reuses_instance", hello && luby_image_run(L, hello, &second) == 0 && image_count(L) == instances);
+    luby_image_release(hello);
+
+    luby_image *bad = luby_image_compile(L, "def broken(\n", 0, "bad.rb");
+    check("compile_error_returns_null", !bad && luby_last_error(L).code == LUBY_E_PARSE);
+
+    /* ---- sharing ---- */
+    printf("\n--- sharing ---\n");
+
+    // Each state gets its own classes and globals
+    luby_state *B = new_state();
+    check("runs_in_second_state", img && luby_image_run(B, img, &out) == 0);
+    test_int(L, "first_state_globals", "counter.bump(by: 100)\ncounter.count", 115);
+    test_int(B, "second_state_globals", "counter.count", 10);
+    // Reopening a class in one state does not leak into the other
+    run(L, "class Counter\n  def extra\n    1\n  end\nend");
+    test_bool(B, "reopened_class_not_shared", "Counter.new.respond_to?(:extra)", 0);
+    luby_free(B);
+
+    worker workers[4];
+    pthread_t threads[4];
+    int started = img != NULL;
+    for (int i = 0; i < 4 && started; i++) {
+        workers[i].image = img;
+        workers[i].ok = 0;
+        started = pthread_create(&threads[i], NULL, worker_main, &workers[i]) == 0;
+    }
+    for (int i = 0; i < 4 && started; i++) pthread_join(threads[i], NULL);
+    // Each iteration: count 1 + 2 + 1 = 4, squares(10) = 385
+    int agreed = started;
+    for (int i = 0; i < 4 && agreed; i++) agreed = workers[i].ok && workers[i].result == 50 * 389;
+    check("threads_share_one_image", agreed);
+
+    /* ---- lifetime ---- */
+    printf("\n--- lifetime ---\n");
+
+    luby_free(L);
+    // The image outlives the state that compiled it
+    B = new_state();
+    check("runs_after_compiling_state_freed", img && luby_image_run(B, img, &out) == 0);
+    // The state keeps its own reference while attached
+    luby_image_release(img);
+    test_int(B, "attached_state_holds_reference", "gc_now()\nsquares(4) + counter.count", 40);
+    luby_free(B);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    return fail_count ? 1 : 0;
+}
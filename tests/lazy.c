@@ -270,6 +270,59 @@ int main(void) {
         "r = Trio.new(10, 20, 30).lazy.map { |x| x + 1 }.to_a; "
         "r[0] == 11 && r[1] == 21 && r[2] == 31");
 
+    /* ---- Compiled pipelines ---- */
+    printf("\n--- Compiled pipelines ---\n");
+
+    test_bool(L, "long_chain",
+        "z = (1..10).lazy; i = 0\n"
+        "while i < 200\n"
+        "  z = z.map { |x| x + 1 }\n"
+        "  i = i + 1\n"
+        "end\n"
+        "r = z.first(2); r[0] == 201 && r[1] == 202");
+
+    test_bool(L, "cached_program_reused",
+        "z = (1..5).lazy.map { |x| x * 2 }.take(3); a = z.to_a; b = z.to_a; "
+        "length(a) == 3 && length(b) == 3 && b[2] == 6");
+
+    test_bool(L, "take_take_drop_drop",
+        "r = (1..20).lazy.drop(2).drop(3).take(10).take(2).to_a; "
+        "length(r) == 2 && r[0] == 6 && r[1] == 7");
+
+    test_int(L, "take_stops_upstream",
+        "calls = 0; (1..100).lazy.map { |x| calls = calls + 1; x }.take(3).to_a; calls", 3);
+
+    test_int(L, "flat_map_unbounded",
+        "length([1,2].lazy.flat_map { |x| (1..300).to_a }.to_a)", 600);
+
+    test_bool(L, "hash_source",
+        "r = {a: 1, b: 2}.lazy.map { |pair| pair[1] * 10 }.to_a; r[0] == 10 && r[1] == 20");
+
+    /* ---- Endless sources ---- */
+    printf("\n--- Endless sources ---\n");
+
+    test_bool(L, "infinite_first",
+        "r = (1..Float::INFINITY).lazy.map { |x| x * x }.select { |x| x % 3 == 0 }.first(3); "
+        "r[0] == 9 && r[1] == 36 && r[2] == 81");
+
+    test_bool(L, "infinite_take_to_a",
+        "r = (1..Float::INFINITY).lazy.reject { |x| x % 2 == 0 }.take(3).to_a; "
+        "length(r) == 3 && r[2] == 5");
+
+    test_int(L, "infinite_find",
+        "(1..Float::INFINITY).lazy.map { |x| x * 7 }.find { |x| x > 100 }", 105);
+
+    test_bool(L, "infinite_include",
+        "(1..Float::INFINITY).lazy.map { |x| x * 2 }.include?(5000)");
+
+    test_int(L, "infinite_each_break",
+        "n = 0\n"
+        "(1..Float::INFINITY).lazy.map { |x| \"v#{x}\" }.each { |v|\n"
+        "  n = n + 1\n"
+        "  break if n == 200000\n"
+        "}\n"
+        "n", 200000);
+
     printf("\n%d passed, %d failed\n", pass_count, fail_count);
     luby_free(L);
     return fail_count ? 1 : 0;
@@ -0,0 +1,93 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Representative script chunk: keywords, identifiers, comments, strings
+// with interpolation and escapes, symbols, numbers and operators
+const char *CHUNK =
+    "# Enemy AI controller -- picks a target and moves toward it each frame\n"
+    "class EnemyController < Controller\n"
+    "  attr_reader :target, :speed, :state\n"
+    "\n"
+    "  def initialize(entity, speed = 2.5)\n"
+    "    @entity = entity   # owning entity\n"
+    "    @speed = speed\n"
+    "    @state = :idle\n"
+    "    @path = []\n"
+    "  end\n"
+    "\n"
+    "  def update(dt, world)\n"
+    "    return nil unless @entity.alive?\n"
+    "    if @state == :idle && world.players.any? { |p| p.visible? }\n"
+    "      @target = world.players.min_by { |p| distance_to(p) }\n"
+    "      @state = :chasing\n"
+    "    elsif @state == :chasing\n"
+    "      step = @speed * dt\n"
+    "      @entity.x += (@target.x - @entity.x) * step / 100.0\n"
+    "      log(\"chasing #{@target.name} at #{@entity.x}, #{@entity.y}\")\n"
+    "    else\n"
+    "      @path.each_with_index do |node, i|\n"
+    "        break if i > 16\n"
+    "        puts 'waypoint \\'' + node.to_s + '\\''\n"
+    "      end\n"
+    "    end\n"
+    "    self\n"
+    "  end\n"
+    "end\n"
+    "\n";
+
+#define TARGET_BYTES (4 * 1024 * 1024)
+#define ITERATIONS 20
+
+int main() {
+    size_t chunk_len = strlen(CHUNK);
+    size_t copies = TARGET_BYTES / chunk_len;
+    size_t len = copies * chunk_len;
+    char *code = (char *)malloc(len + 1);
+    if (!code) return 1;
+    for (size_t i = 0; i < copies; i++) memcpy(code + i * chunk_len, CHUNK, chunk_len);
+    code[len] = '\0';
+
+    printf("=== Lexer Throughput Benchmark ===\n\n");
+    printf("Input: %.1f MB (%zu copies of a %zu-byte chunk)\n", len / (1024.0 * 1024.0), copies, chunk_len);
+    printf("Iterations: %d\n\n", ITERATIONS);
+
+    // Checksum of the token stream, so lexer changes can be compared for
+    // identical output as well as speed
+    size_t tokens = 0;
+    unsigned long long checksum = 0;
+    clock_t start = clock();
+    for (int it = 0; it < ITERATIONS; it++) {
+        luby_lexer lex;
+        luby_lexer_init(&lex, code, len, "<bench>");
+        for (;;) {
+            luby_token tok = luby_lexer_next(&lex);
+            if (tok.kind == LUBY_TOK_EOF) break;
+            if (tok.kind == LUBY_TOK_ERROR) {
+                printf("ERROR: lexer error at line %d, column %d\n", tok.line, tok.column);
+                free(code);
+                return 1;
+            }
+            if (it == 0) {
+                tokens++;
+                checksum = checksum * 31 + (unsigned long long)tok.kind;
+                checksum = checksum * 31 + tok.lexeme.length;
+                checksum = checksum * 31 + (unsigned long long)tok.line;
+                checksum = checksum * 31 + (unsigned long long)tok.column;
+            }
+        }
+    }
+    clock_t end = clock();
+    double elapsed = (double)(end - start) / CLOCKS_PER_SEC;
+
+    printf("Tokens per pass: %zu (checksum %016llx)\n", tokens, checksum);
+    printf("Time for %d iterations: %.3f seconds\n", ITERATIONS, elapsed);
+    printf("Throughput: %.1f MB/s\n", (double)len * ITERATIONS / elapsed / (1024.0 * 1024.0));
+    printf("Tokens per second: %.0f\n", (double)tokens * ITERATIONS / elapsed);
+
+    free(code);
+    return 0;
+}
@@ -0,0 +1,295 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static void check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+    } else {
+        printf("FAIL %s\n", name);
+        fail_count++;
+    }
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", name, buf);
+        fail_count++;
+        return 0;
+    }
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Calls `ref` on `recv` and checks for an integer result
+static int call_int(luby_state *L, luby_method_ref *ref, luby_value recv, int argc, const luby_value *argv, int64_t expected) {
+    luby_value r;
+    return luby_method_ref_call(L, ref, recv, argc, argv, &r) == 0 && r.type == LUBY_T_INT && r.as.i == expected;
+}
+
+static luby_method_ref *reentrant_ref = NULL;
+
+// Host callback used from script: forwards to reentrant_ref on its argument
+static int host_forward(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    if (argc < 1) return 1;
+    luby_value one = luby_int(1);
+    return luby_method_ref_call(L, reentrant_ref, argv[0], 1, &one, out);
+}
+
+static int native_scale(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 2 || argv[1].type != LUBY_T_INT) return 1;
+    *out = luby_int(argv[1].as.i * 10);
+    return 0;
+}
+
+// Batch argument callback: one argument, the index as an integer
+static int index_args(luby_state *L, size_t index, luby_value recv, luby_value *argv, void *user) {
+    (void)L; (void)recv; (void)user;
+    argv[0] = luby_int((int64_t)index);
+    return 1;
+}
+
+static int dt_args(luby_state *L, size_t index, luby_value recv, luby_value *argv, void *user) {
+    (void)L; (void)index; (void)recv;
+    argv[0] = *(luby_value *)user;
+    return 1;
+}
+
+static int failing_args(luby_state *L, size_t index, luby_value recv, luby_value *argv, void *user) {
+    (void)L; (void)recv; (void)user;
+    argv[0] = luby_int(0);
+    return index == 1 ? -1 : 1;
+}
+
+static const char *ENEMY_CODE =
+    "class Enemy\n"
+    "  attr_reader :x\n"
+    "  def initialize(x)\n"
+    "    @x = x\n"
+    "  end\n"
+    "  def update(dt)\n"
+    "    @x = @x + dt\n"
+    "  end\n"
+    "end\n"
+    "class Boss < Enemy\n"
+    "  def update(dt)\n"
+    "    @x = @x + dt * 100\n"
+    "  end\n"
+    "end\n"
+    "enemies = (1..1000).map { |i| Enemy.new(i) }\n";
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+    luby_register_function(L, "host_forward", host_forward);
+    run(L, ENEMY_CODE);
+
+    printf("=== Method Ref Tests ===\n\n");
+
+    /* ---- dispatch ---- */
+    printf("--- dispatch ---\n");
+
+    luby_method_ref *update = luby_method_ref_new(L, luby_define_class(L, "Enemy", NULL), "update");
+    luby_value enemies = luby_get_global_value(L, "enemies");
+    luby_value dt = luby_int(2);
+    int ok = update != NULL;
+    for (int frame = 0; frame < 3 && ok; frame++) {
+        for (size_t i = 0; i < luby_array_len(enemies) && ok; i++) {
+            luby_value e, r;
+            luby_array_get(enemies, i, &e);
+            ok = luby_method_ref_call(L, update, e, 1, &dt, &r) == 0;
+        }
+    }
+    check("many_receivers_called", ok);
+    // sum(1..1000) + 1000 enemies * 3 frames * 2
+    test_int(L, "many_receivers_updated", "enemies.map { |e| e.x }.sum", 500500 + 6000);
+    luby_method_ref_free(L, update);
+
+    luby_method_ref *any_update = luby_method_ref_new(L, NULL, "update");
+    run(L, "e = Enemy.new(0)\nb = Boss.new(0)");
+    luby_value e = luby_get_global_value(L, "e"), b = luby_get_global_value(L, "b");
+    dt = luby_int(1);
+    check("dispatch_per_class",
+          call_int(L, any_update, e, 1, &dt, 1) && call_int(L, any_update, b, 1, &dt, 100) && call_int(L, any_update, e, 1, &dt, 2));
+
+    run(L, "class Foo\n  def val\n    1\n  end\nend\nf = Foo.new");
+    luby_class *foo = luby_define_class(L, "Foo", NULL);
+    luby_method_ref *val = luby_method_ref_new(L, foo, "val");
+    luby_value f = luby_get_global_value(L, "f");
+    check("before_redefinition", call_int(L, val, f, 0, NULL, 1));
+    luby_define_method(L, foo, "val", native_scale);
+    luby_value two = luby_int(2);
+    check("sees_redefinition", call_int(L, val, f, 1, &two, 20));
+
+    run(L,
+        "class Single\n  def val\n    1\n  end\nend\n"
+        "sa = Single.new\nsb = Single.new\n"
+        "def sb.val\n  99\nend\n");
+    luby_value sa = luby_get_global_value(L, "sa"), sb = luby_get_global_value(L, "sb");
+    check("honors_singleton_methods",
+          call_int(L, val, sa, 0, NULL, 1) && call_int(L, val, sb, 0, NULL, 99) && call_int(L, val, sa, 0, NULL, 1));
+
+    run(L, "class Maker\n  def self.make(n)\n    n * 3\n  end\nend");
+    luby_method_ref *make = luby_method_ref_new(L, NULL, "make");
+    luby_value seven = luby_int(7);
+    check("class_method_on_class", call_int(L, make, luby_get_global_value(L, "Maker"), 1, &seven, 21));
+
+    luby_class *native = luby_define_class(L, "Native", NULL);
+    luby_define_method(L, native, "scale", native_scale);
+    luby_value ud = luby_new_userdata(L, 8, NULL);
+    luby_set_userdata_class(L, ud, native);
+    luby_method_ref *scale = luby_method_ref_new(L, native, "scale");
+    luby_value four = luby_int(4);
+    check("native_method", call_int(L, scale, ud, 1, &four, 40));
+
+    /* ---- errors and re-entry ---- */
+    printf("\n--- errors and re-entry ---\n");
+
+    run(L, "class Empty\nend\nempty = Empty.new");
+    luby_method_ref *nope = luby_method_ref_new(L, NULL, "nope");
+    luby_value r;
+    int rc = luby_method_ref_call(L, nope, luby_get_global_value(L, "empty"), 0, NULL, &r);
+    int rc2 = luby_method_ref_call(L, nope, luby_int(1), 0, NULL, &r);
+    check("undefined_method_name_error", rc == LUBY_E_NAME && rc2 == LUBY_E_NAME);
+    luby_clear_error(L);
+
+    run(L, "class Checker\n  def check(n)\n    raise \"bad\" if n < 0\n    n\n  end\nend\nchecker = Checker.new");
+    luby_method_ref *check_ref = luby_method_ref_new(L, NULL, "check");
+    luby_value checker = luby_get_global_value(L, "checker");
+    luby_value neg = luby_int(-1), pos = luby_int(5);
+    rc = luby_method_ref_call(L, check_ref, checker, 1, &neg, &r);
+    luby_clear_error(L);
+    check("recovers_after_script_error", rc != 0 && call_int(L, check_ref, checker, 1, &pos, 5));
+
+    run(L,
+        "class Node\n"
+        "  def initialize(child)\n    @child = child\n  end\n"
+        "  def depth(n)\n"
+        "    if @child.nil?\n      n\n    else\n      host_forward(@child) + n\n    end\n"
+        "  end\n"
+        "end\n"
+        "root = Node.new(Node.new(Node.new(nil)))\n");
+    reentrant_ref = luby_method_ref_new(L, NULL, "depth");
+    luby_value one = luby_int(1);
+    check("reentrant_through_host", call_int(L, reentrant_ref, luby_get_global_value(L, "root"), 1, &one, 3));
+
+    run(L, "class Churn\n  def total\n    [1, 2, 3].sum\n  end\nend\nchurn = Churn.new");
+    luby_method_ref *total = luby_method_ref_new(L, NULL, "total");
+    luby_value churn = luby_get_global_value(L, "churn");
+    ok = call_int(L, total, churn, 0, NULL, 6);
+    // Churn the heap so several collections run between calls
+    run(L, "10000.times { |i| [i, i.to_s] }");
+    check("cached_target_survives_gc", ok && call_int(L, total, churn, 0, NULL, 6));
+
+    /* ---- batches ---- */
+    printf("\n--- batches ---\n");
+
+    run(L, "enemies = (1..1000).map { |i| Enemy.new(i) }");
+    enemies = luby_get_global_value(L, "enemies");
+    size_t n = luby_array_len(enemies);
+    luby_value recvs[1000], results[1000];
+    int status[1000];
+    for (size_t i = 0; i < n; i++) luby_array_get(enemies, i, &recvs[i]);
+    dt = luby_int(3);
+    ok = n == 1000 && luby_invoke_batch(L, any_update, recvs, n, dt_args, &dt, results, status) == 0;
+    for (size_t i = 0; i < n && ok; i++) {
+        ok = status[i] == 0 && results[i].type == LUBY_T_INT && results[i].as.i == (int64_t)i + 1 + 3;
+    }
+    check("batch_updates_every_receiver", ok);
+
+    run(L,
+        "class BatchCheck\n  def check(n)\n    raise \"bad\" if n == 2\n    n * 2\n  end\nend\n"
+        "items = [BatchCheck.new, BatchCheck.new, BatchCheck.new, BatchCheck.new]");
+    luby_value items = luby_get_global_value(L, "items");
+    for (size_t i = 0; i < 4; i++) luby_array_get(items, i, &recvs[i]);
+    recvs[4] = luby_int(7);  // no class dispatch
+    rc = luby_invoke_batch(L, check_ref, recvs, 5, index_args, NULL, results, status);
+    check("batch_per_item_errors", rc != 0 && status[0] == 0 && status[1] == 0 && status[2] != 0 &&
+          status[3] == 0 && status[4] == LUBY_E_NAME && results[3].as.i == 6 && results[2].type == LUBY_T_NIL &&
+          luby_last_error(L).code == (luby_error_code)status[2]);
+    luby_clear_error(L);
+
+    run(L, "class Plus\n  def plus(n)\n    n + 1\n  end\nend\nplus = Plus.new");
+    luby_method_ref *plus = luby_method_ref_new(L, NULL, "plus");
+    luby_value p = luby_get_global_value(L, "plus");
+    for (size_t i = 0; i < 3; i++) recvs[i] = p;
+    luby_invoke_batch(L, plus, recvs, 3, failing_args, NULL, results, status);
+    check("batch_isolates_argument_failures",
+          status[0] == 0 && status[1] == LUBY_E_TYPE && status[2] == 0 && results[2].as.i == 1);
+    luby_clear_error(L);
+
+    run(L,
+        "class Tag\n"
+        "  def label(n)\n"
+        "    40.times { |i| [i, i.to_s] }\n"
+        "    \"tag\" + n.to_s\n"
+        "  end\n"
+        "end\n"
+        "tag = Tag.new");
+    luby_method_ref *label = luby_method_ref_new(L, NULL, "label");
+    luby_value t = luby_get_global_value(L, "tag");
+    for (size_t i = 0; i < 300; i++) recvs[i] = t;
+    ok = luby_invoke_batch(L, label, recvs, 300, index_args, NULL, results, NULL) == 0;
+    char expect[32];
+    for (size_t i = 0; i < 300 && ok; i++) {
+        snprintf(expect, sizeof(expect), "tag%zu", i);
+        ok = results[i].type == LUBY_T_STRING && strcmp((const char *)results[i].as.ptr, expect) == 0;
+    }
+    check("batch_results_survive_collections", ok);
+
+    run(L, "class Answer\n  def answer\n    42\n  end\nend\nans = Answer.new");
+    luby_method_ref *answer = luby_method_ref_new(L, NULL, "answer");
+    recvs[0] = recvs[1] = luby_get_global_value(L, "ans");
+    rc = luby_invoke_batch(L, answer, recvs, 2, NULL, NULL, results, NULL);
+    check("batch_without_argument_callback", rc == 0 && results[0].as.i == 42 && results[1].as.i == 42);
+
+    // Runs last: the limit stays on the state
+    run(L,
+        "class Spin\n"
+        "  def run(n)\n    i = 0\n    while i < n * 40\n      i = i + 1\n    end\n    i\n  end\n"
+        "end\n"
+        "spin = Spin.new");
+    luby_method_ref *spin = luby_method_ref_new(L, NULL, "run");
+    luby_value s = luby_get_global_value(L, "spin");
+    for (size_t i = 0; i < 6; i++) recvs[i] = s;
+    luby_set_instruction_limit(L, 3000);
+    // Each item fits the budget on its own; all six together would not
+    luby_invoke_batch(L, spin, recvs, 6, index_args, NULL, results, status);
+    ok = 1;
+    for (int i = 0; i < 6; i++) ok = ok && status[i] == 0 && results[i].as.i == i * 40;
+    check("batch_limit_per_item", ok);
+    // A single item past the budget still fails
+    luby_value big = luby_int(1000);
+    int st;
+    luby_invoke_batch(L, spin, recvs, 1, dt_args, &big, NULL, &st);
+    check("batch_item_over_limit_fails", st == LUBY_E_RUNTIME);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static size_t object_blocks = 0;
+
+// Counts new blocks the size of a plain instance
+static void *counting_alloc(void *user, void *ptr, size_t size) {
+    (void)user;
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!ptr && size == sizeof(luby_object)) object_blocks++;
+    return realloc(ptr, size);
+}
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code raises a TypeError with exactly `message`
+static int test_type_error(luby_state *L, const char *name, const char *code, const char *message) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        luby_error err = luby_last_error(L);
+        if (err.code == LUBY_E_TYPE && err.message && strcmp(err.message, message) == 0) {
+            printf("PASS %s\n", name);
+            pass_count++;
+            return 1;
+        }
+        printf("FAIL %s: expected \"%s\", got \"%s\"\n", name, message, err.message ? err.message : "");
+    } else {
+        printf("FAIL %s: expected an error\n", name);
+    }
+    fail_count++;
+    return 0;
+}
+
+static luby_class_obj *global_class(luby_state *L, const char *name) {
+    luby_value v;
+    if (luby_eval(L, name, 0, "<test>", &v) != 0 || v.type != LUBY_T_CLASS) return NULL;
+    return (luby_class_obj *)v.as.ptr;
+}
+
+int main(void) {
+    luby_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.alloc = counting_alloc;
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+    luby_value out;
+
+    run(L,
+        "class Bullet\n"
+        "  attr_accessor :x, :dx, :hits\n"
+        "  def initialize(x, dx)\n"
+        "    @x = x\n"
+        "    @dx = dx\n"
+        "  end\n"
+        "  def step\n"
+        "    @x += @dx\n"
+        "  end\n"
+        "end\n");
+    luby_class_obj *bullet = global_class(L, "Bullet");
+
+    printf("=== Object Pool Tests ===\n\n");
+
+    /* ---- acquire / release ---- */
+    printf("--- acquire / release ---\n");
+
+    test_str(L, "acquire_reuses_released",
+        "Bullet.pool(4)\n"
+        "a = Bullet.acquire(1, 2)\n"
+        "a.hits = 3\n"
+        "a.step\n"
+        "first = a.x\n"
+        "r = [Bullet.release(a), Bullet.release(a), a.x.nil?, a.hits.nil?].map { |x| x.to_s }.join(\",\")\n"
+        "b = Bullet.acquire(10, 1)\n"
+        "b.step\n"
+        "c = Bullet.acquire(0, 0)\n"
+        "[first, r, b.object_id == a.object_id, b.x, b.hits.nil?, c.object_id == a.object_id]"
+        ".map { |x| x.to_s }.join(\" \")",
+        "3 true,false,true,true true 11 true false");
+
+    // Hosts reach the same entry through luby_invoke_global
+    luby_value args[3], s;
+    args[0] = luby_eval(L, "Bullet", 0, "<test>", &out) == 0 ? out : luby_nil();
+    args[1] = luby_int(5);
+    args[2] = luby_int(5);
+    if (check("invoke_global_acquire", luby_invoke_global(L, "acquire", 3, args, &s) == 0 && s.type == LUBY_T_OBJECT)) {
+        luby_set_global_value(L, "s", s);
+        test_str(L, "invoke_global_instance_runs", "s.step\ns.x.to_s", "10");
+    }
+
+    /* ---- pool size ---- */
+    printf("\n--- pool size ---\n");
+
+    test_str(L, "release_stops_at_pool_size",
+        "Bullet.pool(2)\n"
+        "all = [Bullet.new(1, 1), Bullet.new(2, 1), Bullet.new(3, 1)]\n"
+        "kept = all.map { |b| Bullet.release(b).to_s }.join(\",\")\n"
+        "Bullet.pool(1)\n"
+        "[kept, Bullet.release(all[2])].map { |x| x.to_s }.join(\" \")",
+        "true,true,false false");
+    test_str(L, "pool_zero_turns_off", "Bullet.pool(0)\nBullet.new(1, 2).x.to_s", "1");
+
+    // pool(0) unroots the class and unpools the instances it made
+    luby_value first;
+    if (eval_check(L, "pool_zero_instance", "all[0]", &first)) {
+        check("pool_zero_unroots_class",
+            L->pool_class_count == 0 && first.type == LUBY_T_OBJECT && !((luby_object *)first.as.ptr)->pooled);
+    }
+    run(L, "all = nil\nBullet.pool(0)");
+    luby_gc_collect(L);
+    test_type_error(L, "acquire_after_pool_zero", "Bullet.acquire(1, 2)", "acquire: class is not pooled");
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    test_type_error(L, "negative_size", "Bullet.pool(-1)", "pool: expected a non-negative Integer size");
+    test_type_error(L, "release_unpooled", "Bullet.release(Bullet.new(1, 1))", "release: class is not pooled");
+    run(L,
+        "class Shard\n  def self.new\n    1\n  end\nend\n"
+        "class Other\nend\n"
+        "Bullet.pool(2)");
+    test_type_error(L, "own_new_refused", "Shard.pool(2)", "pool: class defines its own new");
+    test_type_error(L, "release_other_class", "Bullet.release(Other.new)", "release: expected an instance of the pooled class");
+    test_type_error(L, "release_non_object", "Bullet.release(5)", "release: expected an instance of the pooled class");
+
+    /* ---- recycled blocks ---- */
+    printf("\n--- recycled blocks ---\n");
+
+    run(L, "Bullet.pool(64)");
+    check("pool_preallocates", bullet && bullet->pool_free_count == 64);
+    test_str(L, "new_on_pooled_class",
+        "t = 0\n"
+        "200.times do |i|\n"
+        "  b = Bullet.new(i, 1)\n"
+        "  b.hits = i\n"
+        "  b.step\n"
+        "  t += b.x\n"
+        "end\n"
+        "t.to_s", "20100");
+    luby_gc_collect(L);
+    if (check("collected_blocks_recycled", bullet && bullet->pool_free_count == 64)) {
+        // Recycled blocks keep the ivar shape, with every value reset
+        int shaped = 0, reset = 1;
+        for (luby_gc_obj *b = bullet->pool_free; b; b = b->gc_next) {
+            luby_object *o = (luby_object *)b;
+            if (o->ivar_count == 3) shaped++;
+            for (size_t i = 0; i < o->ivar_count; i++) reset = reset && o->ivar_values[i].type == LUBY_T_NIL;
+        }
+        check("recycled_blocks_keep_shape", shaped > 0 && reset);
+    }
+    test_str(L, "new_on_recycled_block", "b = Bullet.new(7, 1)\n[b.x, b.hits.nil?].map { |x| x.to_s }.join(\" \")", "7 true");
+
+    /* ---- allocation counts ---- */
+    printf("\n--- allocation counts ---\n");
+
+    run(L,
+        "class Shell < Bullet\nend\n"
+        "Bullet.pool(1024)\n"
+        "def frame(live)\n"
+        "  i = 0\n"
+        "  while i < 100\n"
+        "    b = Bullet.acquire(i, 1)\n"
+        "    b.hits = 0\n"
+        "    b.step\n"
+        "    live.push(b)\n"
+        "    i += 1\n"
+        "  end\n"
+        "  while live.size > 0\n"
+        "    Bullet.release(live.pop)\n"
+        "  end\n"
+        "  i\n"
+        "end\n"
+        "def burst\n"
+        "  t = 0\n"
+        "  200.times do |i|\n"
+        "    b = Bullet.new(i, 1)\n"
+        "    b.hits = i\n"
+        "    t += 1\n"
+        "  end\n"
+        "  t\n"
+        "end\n"
+        "def burst_plain\n"
+        "  t = 0\n"
+        "  200.times do |i|\n"
+        "    b = Shell.new(i, 1)\n"
+        "    b.hits = i\n"
+        "    t += 1\n"
+        "  end\n"
+        "  t\n"
+        "end\n"
+        "live = []\n"
+        "frame(live) + burst()");
+    size_t before = object_blocks;
+    test_int(L, "acquire_release_frames", "t = 0\n100.times { t += frame(live) }\nt", 10000);
+    check("frames_do_not_allocate", object_blocks == before);
+    // Plain new recycles collected instances; an unpooled class allocates each one
+    before = object_blocks;
+    test_int(L, "pooled_bursts", "t = 0\n50.times { t += burst() }\nt", 10000);
+    size_t pooled = object_blocks - before;
+    before = object_blocks;
+    test_int(L, "plain_bursts", "t = 0\n50.times { t += burst_plain() }\nt", 10000);
+    check("pooled_new_reuses_blocks", object_blocks - before >= 10000 && pooled < 1000);
+
+    /* ---- structs ---- */
+    printf("\n--- structs ---\n");
+
+    luby_value spark;
+    if (eval_check(L, "struct_setup", "Struct.new(:x, :y)", &spark)) luby_set_global_value(L, "Spark", spark);
+    test_str(L, "struct_slots_reset",
+        "Spark.pool(8)\n"
+        "s = Spark.acquire(1, 2)\n"
+        "Spark.release(s)\n"
+        "mid = s.to_a.map { |x| x.to_s }.join(\",\")\n"
+        "t = Spark.acquire(3)\n"
+        "[mid, t.x, t.y.nil?, t.object_id == s.object_id].map { |x| x.to_s }.join(\" \")",
+        ", 3 true true");
+    test_int(L, "struct_new_on_pool", "n = 0\n300.times { |i| n += Spark.new(i, 1).y }\nn", 300);
+
+    /* ---- snapshot / clone ---- */
+    printf("\n--- snapshot / clone ---\n");
+
+    run(L,
+        "Bullet.pool(4)\n"
+        "kept = Bullet.acquire(1, 1)\n"
+        "Bullet.release(kept)\n"
+        "300.times { |i| Bullet.new(i, 1) }");
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    luby_class_obj *cls = C ? global_class(C, "Bullet") : NULL;
+    if (check("clone_keeps_pool_size", cls && cls->pool_capacity == 4 && cls->pool_free_count == 0)) {
+        test_str(C, "clone_acquires_released",
+            "b = Bullet.acquire(2, 3)\n"
+            "b.step\n"
+            "100.times { |i| Bullet.new(i, 1) }\n"
+            "[b.x, b.object_id == kept.object_id].map { |x| x.to_s }.join(\" \")", "5 true");
+        luby_gc_collect(C);
+        check("clone_recycles_blocks", cls->pool_free_count == 4);
+    }
+    if (C) luby_free(C);
+    luby_snapshot_free(snap);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code fails with the given error code (0 accepts any)
+static int test_error(luby_state *L, const char *name, const char *code, luby_error_code expected) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0 &&
+        (expected == LUBY_E_OK || luby_last_error(L).code == expected)) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected an error\n", name);
+    fail_count++;
+    return 0;
+}
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+
+    printf("=== Set and PriorityQueue Tests ===\n\n");
+
+    /* ---- Set membership ---- */
+    printf("--- Set membership ---\n");
+
+    test_str(L, "set_add_delete",
+        "s = Set.new([3, 1, 3, 2])\n"
+        "s << 4 << 1\n"
+        "r = [s.add?(1).nil?, s.add?(5).nil?, s.include?(2), s.member?(9)]\n"
+        "s.delete(1)\n"
+        "r << s.delete?(1).nil?\n"
+        "r.map { |x| x.to_s }.join(\",\") + \":\" + s.to_a.map { |x| x.to_s }.join(\",\")",
+        "true,false,true,false,true:3,5,2,4");
+
+    test_int(L, "set_frozen_array_keys",
+        "Set.new([[1, 2].freeze, [1, 2].freeze, \"a\", \"a\"]).size", 2);
+
+    test_int(L, "set_clear",
+        "s.clear\ns.empty? ? (s << 7).size : -1", 1);
+
+    /* ---- Set algebra ---- */
+    printf("\n--- Set algebra ---\n");
+
+    test_str(L, "set_operators",
+        "a = Set.new([1, 2, 3])\n"
+        "b = Set.new([2, 3, 4])\n"
+        "[(a | b).to_a, (a & b).to_a, (a - b).to_a, (a + [9]).to_a, a.difference([1, 3]).to_a]"
+        ".map { |x| x.map { |y| y.to_s }.join }.join(\",\")",
+        "1234,23,1,1239,2");
+
+    test_str(L, "set_relations",
+        "c = Set.new([1, 2])\n"
+        "[c.subset?(a), a.superset?(c), c.disjoint?(Set.new([5])), c.intersect?(b), "
+        "c == Set.new([2, 1]), c == a, c == [1, 2]].map { |x| x.to_s }.join(\",\")",
+        "true,true,true,true,true,false,false");
+
+    /* ---- Set with user objects ---- */
+    printf("\n--- Set with user objects ---\n");
+
+    run(L,
+        "class Cell\n"
+        "  attr_reader :x, :y\n"
+        "  def initialize(x, y)\n"
+        "    @x = x\n"
+        "    @y = y\n"
+        "  end\n"
+        "  def hash\n"
+        "    [@x, @y].hash\n"
+        "  end\n"
+        "  def eql?(o)\n"
+        "    @x == o.x && @y == o.y\n"
+        "  end\n"
+        "end\n");
+
+    test_int(L, "set_user_hash_eql",
+        "seen = Set.new\n"
+        "20.times { |i| seen << Cell.new(i % 4, i % 2) }\n"
+        "seen.size * 10 + (seen.include?(Cell.new(3, 1)) ? 1 : 0)", 41);
+
+    test_int(L, "set_many_deletes",
+        "s = Set.new\n"
+        "i = 0\n"
+        "while i < 20000\n"
+        "  s << i % 5000\n"
+        "  i += 1\n"
+        "end\n"
+        "j = 0\n"
+        "while j < 2500\n"
+        "  s.delete(j * 2)\n"
+        "  j += 1\n"
+        "end\n"
+        "bad = s.count { |x| x % 2 == 0 || !s.include?(x) }\n"
+        "s.size * 10 + bad", 25000);
+
+    /* ---- PriorityQueue ---- */
+    printf("\n--- PriorityQueue ---\n");
+
+    test_str(L, "pqueue_min_order",
+        "q = PriorityQueue.new\n"
+        "[5, 3, 8, 1, 9, 2, 7].each { |x| q.push(x) }\n"
+        "out = []\n"
+        "out << q.pop while !q.empty?\n"
+        "out.map { |x| x.to_s }.join(\",\") + (q.pop.nil? ? \"\" : \"!\")", "1,2,3,5,7,8,9");
+
+    test_str(L, "pqueue_max_by_block",
+        "w = PriorityQueue.new(:max) { |s| s.size }\n"
+        "[\"aa\", \"b\", \"cccc\", \"ddd\"].each { |s| w << s }\n"
+        "w.peek + \",\" + w.pop + \",\" + w.pop + \",\" + w.size.to_s", "cccc,cccc,ddd,2");
+
+    test_str(L, "pqueue_explicit_priority",
+        "t = PriorityQueue.new\n"
+        "t.push(:later, 10)\n"
+        "t.push(:now, 1)\n"
+        "t.push(:soon, 5)\n"
+        "t.pop.to_s + \",\" + t.sort_by { |x| x.to_s }.map { |x| x.to_s }.join(\",\")", "now,later,soon");
+
+    test_int(L, "pqueue_spaceship",
+        "class Job\n"
+        "  attr_reader :due\n"
+        "  def initialize(due)\n"
+        "    @due = due\n"
+        "  end\n"
+        "  def <=>(o)\n"
+        "    @due <=> o.due\n"
+        "  end\n"
+        "end\n"
+        "q = PriorityQueue.new\n"
+        "i = 0\n"
+        "while i < 5000\n"
+        "  q << Job.new((i * 7919) % 5003)\n"
+        "  i += 1\n"
+        "end\n"
+        "last = -1\n"
+        "sorted = 1\n"
+        "while !q.empty?\n"
+        "  d = q.pop.due\n"
+        "  sorted = 0 if d < last\n"
+        "  last = d\n"
+        "end\n"
+        "sorted", 1);
+
+    // A failed comparison leaves the queue intact
+    test_error(L, "pqueue_bad_push",
+        "q = PriorityQueue.new\nq.push(3)\nq.push(1)\nq.push(\"x\")", LUBY_E_TYPE);
+    test_int(L, "pqueue_after_bad_push",
+        "q.size * 100 + q.pop * 10 + q.pop", 213);
+    test_error(L, "pqueue_bad_order",
+        "PriorityQueue.new(:median)", LUBY_E_OK);
+
+    /* ---- snapshot / clone ---- */
+    printf("\n--- snapshot / clone ---\n");
+
+    run(L,
+        "s = Set.new([\"a\", \"b\", \"c\"])\n"
+        "q = PriorityQueue.new\n"
+        "[4, 2, 6].each { |x| q << x }");
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_int(C, "clone_collections",
+            "s << \"d\"\n"
+            "s.delete(\"a\")\n"
+            "(s.include?(\"b\") && !s.include?(\"a\") ? s.size * 10 : 0) + q.pop", 32);
+        luby_free(C);
+    } else {
+        printf("FAIL clone_collections: snapshot failed\n");
+        fail_count++;
+    }
+    test_int(L, "source_unchanged_by_clone", "s.size * 10 + q.size", 33);
+    luby_snapshot_free(snap);
+
+    /* ---- arithmetic dispatch ---- */
+    printf("\n--- arithmetic dispatch ---\n");
+
+    test_int(L, "operators_dispatch_to_objects",
+        "class Money\n"
+        "  attr_reader :cents\n"
+        "  def initialize(c)\n"
+        "    @cents = c\n"
+        "  end\n"
+        "  def +(o)\n"
+        "    Money.new(@cents + o.cents)\n"
+        "  end\n"
+        "  def -(o)\n"
+        "    Money.new(@cents - o.cents)\n"
+        "  end\n"
+        "  def *(k)\n"
+        "    Money.new(@cents * k)\n"
+        "  end\n"
+        "  def /(k)\n"
+        "    Money.new(@cents / k)\n"
+        "  end\n"
+        "  def %(k)\n"
+        "    Money.new(@cents % k)\n"
+        "  end\n"
+        "end\n"
+        "m = (Money.new(500) + Money.new(250)) * 2 - Money.new(100)\n"
+        "(m / 4).cents * 100 + (m % 9).cents", 35005);
+
+    test_error(L, "operator_undefined",
+        "class Blob\nend\nBlob.new + 1", LUBY_E_OK);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
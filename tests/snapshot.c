@@ -0,0 +1,319 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static void check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+    } else {
+        printf("FAIL %s\n", name);
+        fail_count++;
+    }
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int finalized = 0;
+
+static void count_finalizer(void *data) {
+    (void)data;
+    finalized++;
+}
+
+static int host_double(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L;
+    if (argc < 1 || argv[0].type != LUBY_T_INT) return (int)LUBY_E_TYPE;
+    *out = luby_int(argv[0].as.i * 2);
+    return 0;
+}
+
+static int gc_now(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)argc; (void)argv;
+    luby_gc_collect(L);
+    if (out) *out = luby_nil();
+    return 0;
+}
+
+static int copies = 0;
+
+// Copies an int, doubling it so the test can tell the hook ran; 0 refuses
+static int doubling_copy(void *dst, const void *src, size_t size) {
+    (void)size;
+    copies++;
+    if (*(const int *)src == 0) return 1;
+    *(int *)dst = *(const int *)src * 2;
+    return 0;
+}
+
+// Lets the snapshot's copy through but refuses every clone
+static int snapshot_only_copy(void *dst, const void *src, size_t size) {
+    if (copies++ > 0) return 1;
+    memcpy(dst, src, size);
+    return 0;
+}
+
+static const char *GAME_LIB =
+    "point = Struct.new(:x, :y)\n"
+    "class Player\n"
+    "  include Comparable\n"
+    "  attr_reader :name, :score\n"
+    "  @@count = 0\n"
+    "  def initialize(name, score)\n"
+    "    @name = name\n"
+    "    @score = score\n"
+    "    @@count += 1\n"
+    "  end\n"
+    "  def <=>(other)\n"
+    "    @score <=> other.score\n"
+    "  end\n"
+    "  def self.count\n"
+    "    @@count\n"
+    "  end\n"
+    "end\n"
+    "roster = [Player.new(\"ann\", 30), Player.new(\"bob\", 10)]\n"
+    "settings = { speed: 3, label: \"fast\" }\n"
+    "evens = (1..Float::INFINITY).lazy.select { |i| i % 2 == 0 }\n"
+    "first_evens = evens.first(3)\n"
+    "gen = Fiber.new { Fiber.yield(1); 2 }\n";
+
+// Only the boot-versus-clone timing builds states of its own
+static luby_state *boot_game(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+    luby_register_function(L, "host_double", host_double);
+    luby_register_function(L, "gc_now", gc_now);
+    luby_eval(L, GAME_LIB, 0, "<setup>", NULL);
+    return L;
+}
+
+int main(void) {
+    // Incremental sweeping so a collection can leave objects on the sweep list
+    luby_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.gc_sweep_batch = 8;
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+    luby_register_function(L, "host_double", host_double);
+    luby_register_function(L, "gc_now", gc_now);
+    run(L, GAME_LIB);
+
+    printf("=== Snapshot Tests ===\n\n");
+
+    /* ---- cloning ---- */
+    printf("--- cloning ---\n");
+
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_int(C, "clone_sees_objects",
+            "(roster[0] > roster[1] ? roster[0].score : 0) + settings[:speed] + Player.count", 35);
+        test_int(C, "clone_keeps_structs_and_natives", "p = point.new(1, 2)\np.x + p.y + host_double(4)", 11);
+        test_int(C, "clone_keeps_lazy_chains", "gc_now()\nfirst_evens.sum + evens.first(2).sum", 18);
+        test_str(C, "clone_keeps_strings", "settings[:label] + \"!\"", "fast!");
+        luby_free(C);
+    } else {
+        printf("FAIL clone_sees_objects: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+
+    // Clones are isolated from each other and from the source
+    snap = luby_snapshot_new(L);
+    luby_state *A = snap ? luby_clone(snap) : NULL;
+    luby_state *B = snap ? luby_clone(snap) : NULL;
+    if (A && B) {
+        test_int(A, "clone_mutates_own_heap",
+            "Player.new(\"cy\", 50)\nsettings[:speed] = 9\nroster[0] = nil\nPlayer.count + settings[:speed]", 12);
+        test_int(B, "sibling_clone_unchanged", "Player.count + settings[:speed] + roster[0].score", 35);
+        test_int(L, "source_unchanged", "Player.count + settings[:speed] + roster[0].score", 35);
+    } else {
+        printf("FAIL clone_mutates_own_heap: snapshot failed\n");
+        fail_count++;
+    }
+    if (A) luby_free(A);
+    if (B) luby_free(B);
+    luby_snapshot_free(snap);
+
+    /* ---- fibers ---- */
+    printf("\n--- fibers ---\n");
+
+    snap = luby_snapshot_new(L);
+    C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_int(C, "unstarted_fiber_resumable", "a = gen.resume\nb = gen.resume\na * 10 + b", 12);
+        luby_free(C);
+    } else {
+        printf("FAIL unstarted_fiber_resumable: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+    // The source's fiber is untouched by the clone's run
+    test_int(L, "source_fiber_untouched", "gen.resume", 1);
+
+    // While the fiber is suspended the state cannot be snapshotted
+    snap = luby_snapshot_new(L);
+    check("suspended_fiber_refused", !snap && luby_last_error(L).code == LUBY_E_RUNTIME);
+    luby_snapshot_free(snap);
+    test_int(L, "source_fiber_finishes", "gen.resume", 2);
+    snap = luby_snapshot_new(L);
+    check("finished_fiber_allowed", snap != NULL);
+    luby_snapshot_free(snap);
+
+    /* ---- userdata copy hooks ---- */
+    printf("\n--- userdata copy hooks ---\n");
+
+    luby_value ud = luby_new_userdata(L, sizeof(int), NULL);
+    int h = luby_ref(L, ud);
+    *(int *)luby_userdata_ptr(ud) = 5;
+    check("hook_on_owned_userdata", luby_set_userdata_copy(L, ud, doubling_copy));
+    static int hook_host_value = 1;
+    check("no_hook_on_wrapped_userdata",
+          !luby_set_userdata_copy(L, luby_wrap_userdata(L, &hook_host_value, NULL), doubling_copy));
+    copies = 0;
+    snap = luby_snapshot_new(L);
+    C = snap ? luby_clone(snap) : NULL;
+    check("hook_runs_for_each_copy", C && copies == 2 && *(int *)luby_userdata_ptr(luby_ref_get(C, h)) == 20);
+    if (C) luby_free(C);
+    luby_snapshot_free(snap);
+
+    // A failed clone returns NULL and leaves the shared snapshot untouched
+    copies = 0;
+    luby_set_userdata_copy(L, ud, snapshot_only_copy);
+    snap = luby_snapshot_new(L);
+    check("failed_clone_leaves_snapshot", snap && !luby_clone(snap) && snap->state->last_error.code == LUBY_E_OK);
+    luby_snapshot_free(snap);
+
+    // A refusing hook fails the snapshot with its own error
+    luby_set_userdata_copy(L, ud, doubling_copy);
+    *(int *)luby_userdata_ptr(ud) = 0;
+    snap = luby_snapshot_new(L);
+    luby_error err = luby_last_error(L);
+    check("refusing_hook_fails_snapshot",
+          !snap && err.code == LUBY_E_RUNTIME && strcmp(err.message, "userdata could not be copied") == 0);
+    luby_snapshot_free(snap);
+    *(int *)luby_userdata_ptr(ud) = 5;
+
+    /* ---- timing ---- */
+    printf("\n--- timing ---\n");
+
+    enum { N = 200 };
+    snap = luby_snapshot_new(L);
+    clock_t t0 = clock();
+    for (int i = 0; i < N; i++) luby_free(boot_game());
+    clock_t t1 = clock();
+    int cloned = snap != NULL;
+    for (int i = 0; i < N && cloned; i++) {
+        C = luby_clone(snap);
+        cloned = C != NULL;
+        if (C) luby_free(C);
+    }
+    clock_t t2 = clock();
+    luby_snapshot_free(snap);
+    printf("  boot %.1f us, clone %.1f us\n",
+           (double)(t1 - t0) * 1e6 / CLOCKS_PER_SEC / N, (double)(t2 - t1) * 1e6 / CLOCKS_PER_SEC / N);
+    check("clone_cheaper_than_boot", cloned && t2 - t1 < t1 - t0);
+
+    /* ---- host handles ---- */
+    printf("\n--- host handles ---\n");
+
+    finalized = 0;
+    luby_value owned = luby_new_userdata(L, sizeof(int), count_finalizer);
+    int h_owned = luby_ref(L, owned);
+    *(int *)luby_userdata_ptr(owned) = 7;
+    static int host_value = 99;
+    luby_value wrapped = luby_wrap_userdata(L, &host_value, count_finalizer);
+    int h_wrapped = luby_ref(L, wrapped);
+    snap = luby_snapshot_new(L);
+    C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        luby_value co = luby_ref_get(C, h_owned);
+        luby_value cw = luby_ref_get(C, h_wrapped);
+        // Owned data is copied; the wrapped pointer is shared
+        check("owned_userdata_copied",
+              co.type == LUBY_T_USERDATA && luby_userdata_ptr(co) != luby_userdata_ptr(owned) && *(int *)luby_userdata_ptr(co) == 7);
+        check("wrapped_userdata_shared", luby_userdata_ptr(cw) == &host_value);
+        luby_free(C);
+        // Each copy finalizes its own owned data only
+        check("clone_finalizes_own_copy", finalized == 1);
+    } else {
+        printf("FAIL owned_userdata_copied: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+    check("snapshot_finalizes_own_copy", finalized == 2);
+
+    /* ---- sweep list ---- */
+    printf("\n--- sweep list ---\n");
+
+    // The collection leaves the suspended fiber on the pending sweep list
+    run(L,
+        "f = Fiber.new { Fiber.yield(1); 2 }\n"
+        "f.resume\n"
+        "50.times { |i| i.to_s }\n"
+        "gc_now()");
+    check("sweep_list_pending", L->gc_sweep_list != NULL);
+    snap = luby_snapshot_new(L);
+    check("suspended_fiber_on_sweep_list_refused", !snap && luby_last_error(L).code == LUBY_E_RUNTIME);
+    luby_snapshot_free(snap);
+
+    luby_free(L);
+    // The source finalizes both its owned and wrapped userdata
+    check("source_finalizes_owned_and_wrapped", finalized == 4);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    return fail_count ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code raises a TypeError with exactly `message`
+static int test_type_error(luby_state *L, const char *name, const char *code, const char *message) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        luby_error err = luby_last_error(L);
+        if (err.code == LUBY_E_TYPE && err.message && strcmp(err.message, message) == 0) {
+            printf("PASS %s\n", name);
+            pass_count++;
+            return 1;
+        }
+        printf("FAIL %s: expected \"%s\", got \"%s\"\n", name, message, err.message ? err.message : "");
+    } else {
+        printf("FAIL %s: expected an error\n", name);
+    }
+    fail_count++;
+    return 0;
+}
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+
+    printf("=== SpatialHash Tests ===\n\n");
+
+    /* ---- insert / move / remove ---- */
+    printf("--- insert / move / remove ---\n");
+
+    test_str(L, "insert_move_remove",
+        "g = SpatialHash.new(10)\n"
+        "g.insert(:a, 1, 1).insert(:b, 5, 5).insert(:c, 25, 3).insert(:d, -4, -4)\n"
+        "r1 = g.query(0, 0, 8).map { |x| x.to_s }.sort.join(\",\")\n"
+        "g.move(:c, 2, 0)\n"
+        "g.insert(:a, 100, 100)\n"
+        "r2 = g.query(Vector2.new(0, 0), 8).map { |x| x.to_s }.sort.join(\",\")\n"
+        "r3 = [g.remove(:b), g.remove(:zz), g.move(:zz, 1, 1), g.size, g.include?(:b), g.include?(:a)]"
+        ".map { |x| x.to_s }.join(\",\")\n"
+        "r4 = g.query_rect(-5, -5, 3, 3).map { |x| x.to_s }.sort.join(\",\")\n"
+        "r5 = g.position(:a).map { |x| x.to_s }.join(\",\") + \" \" + g.position(:b).nil?.to_s\n"
+        "[r1, r2, r3, r4, r5, g.cell_size].map { |x| x.to_s }.join(\" \")",
+        "a,b,d b,c,d b,,,3,false,true c,d 100,100 true 10");
+
+    /* ---- brute-force cross check ---- */
+    printf("\n--- brute-force cross check ---\n");
+
+    // Every query checked against a brute-force scan of the same points
+    run(L,
+        "def ids(list)\n"
+        "  list.sort.map { |x| x.to_s }.join(\",\")\n"
+        "end\n"
+        "def brute(pts, x, y, r)\n"
+        "  ids(pts.select { |p| (p[1] - x) * (p[1] - x) + (p[2] - y) * (p[2] - y) <= r * r }.map { |p| p[0] })\n"
+        "end\n"
+        "def brute_rect(pts, x0, y0, x1, y1)\n"
+        "  ids(pts.select { |p| p[1] >= x0 && p[1] <= x1 && p[2] >= y0 && p[2] <= y1 }.map { |p| p[0] })\n"
+        "end\n"
+        "def check(seed, grid, pts)\n"
+        "  bad = 0\n"
+        "  40.times do |q|\n"
+        "    x = (seed * 37 + q * 113) % 500 - 20\n"
+        "    y = (seed * 53 + q * 71) % 400 - 20\n"
+        "    r = (q * 13) % 90\n"
+        "    bad += 1 if ids(grid.query(x, y, r)) != brute(pts, x, y, r)\n"
+        "    bad += 1 if ids(grid.query_rect(x, y, x - r * 2, y + r)) != brute_rect(pts, x - r * 2, y, x, y + r)\n"
+        "  end\n"
+        "  bad += 1 if grid.query(0, 0, 10000).size != pts.size\n"
+        "  bad\n"
+        "end\n");
+
+    test_str(L, "matches_brute_force",
+        "grid = SpatialHash.new(16)\n"
+        "pts = []\n"
+        "300.times do |i|\n"
+        "  p = [i, (i * 7919) % 461 + 0.5, (i * 104729) % 353 - 0.25]\n"
+        "  pts.push(p)\n"
+        "  grid.insert(i, p[1], p[2])\n"
+        "end\n"
+        "bad = check(1, grid, pts)\n"
+        // Move a third of the points and drop another third
+        "100.times do |i|\n"
+        "  p = pts[i]\n"
+        "  p[1] = (p[1] * 3) % 470\n"
+        "  p[2] = 300 - p[2]\n"
+        "  grid.move(i, p[1], p[2])\n"
+        "end\n"
+        "kept = []\n"
+        "pts.each do |p|\n"
+        "  if p[0] % 3 == 1\n"
+        "    grid.remove(p[0])\n"
+        "  else\n"
+        "    kept.push(p)\n"
+        "  end\n"
+        "end\n"
+        "bad += check(2, grid, kept)\n"
+        "[bad, grid.size, grid.count { |x| x >= 0 }].map { |x| x.to_s }.join(\" \")",
+        "0 200 200");
+
+    /* ---- blocks ---- */
+    printf("\n--- blocks ---\n");
+
+    test_str(L, "block_edits_grid",
+        "g = SpatialHash.new(4)\n"
+        "20.times { |i| g.insert(i, i, 0) }\n"
+        "seen = []\n"
+        "r = g.query(0, 0, 5.5) do |e|\n"
+        "  seen.push(e)\n"
+        "  g.remove(e)\n"
+        "  g.insert(e + 100, 50, 50)\n"
+        "end\n"
+        "first = g.query_rect(6, -1, 9, 1) { |e| break e }\n"
+        "[seen.sort.map { |x| x.to_s }.join(\",\"), r.object_id == g.object_id, g.size, g.query(50, 50, 0).size, first >= 6 && first <= 9].map { |x| x.to_s }.join(\" \")",
+        "0,1,2,3,4,5 true 20 6 true");
+
+    test_str(L, "object_keys",
+        "class Ent\nend\n"
+        "objs = [Ent.new, Ent.new, \"s\", [1, 2]]\n"
+        "h = SpatialHash.new(1.5)\n"
+        "objs.each_with_index { |o, i| h.insert(o, i, i) }\n"
+        "h.insert(\"s\", 9, 9)\n"
+        "[h.size, h.query(0, 0, 1.5).size, h.include?(objs[3]) && !h.include?([1, 2]), h.position(\"s\")[0]].map { |x| x.to_s }.join(\" \")",
+        "4 2 true 9");
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    test_type_error(L, "zero_cell_size", "SpatialHash.new(0)", "SpatialHash: expected a positive cell size");
+    test_type_error(L, "string_cell_size", "SpatialHash.new(\"x\")", "SpatialHash: expected a positive cell size");
+    test_type_error(L, "insert_missing_y", "SpatialHash.new.insert(:a, 1)", "SpatialHash: expected x and y numbers or a Vector2");
+    test_type_error(L, "negative_radius", "SpatialHash.new.query(1, 2, -1)", "query: expected a non-negative radius");
+    test_type_error(L, "query_rect_missing_corner", "SpatialHash.new.query_rect(1, 2, 3)", "SpatialHash: expected x and y numbers or a Vector2");
+    test_type_error(L, "pool_refused", "SpatialHash.pool(4)", "pool: class defines its own new");
+    test_str(L, "default_cell_size", "SpatialHash.new.cell_size.to_s", "64");
+
+    /* ---- growth, far coordinates and clones ---- */
+    printf("\n--- growth and clones ---\n");
+
+    test_str(L, "growth_and_far_coordinates",
+        "g = SpatialHash.new(8)\n"
+        "far = 1000000.0 * 1000000000.0\n"
+        "5000.times { |i| g.insert(i, (i % 100) * 3.0, (i / 100) * 3.0) }\n"
+        "g.insert(:far, far, -far)\n"
+        "g.insert(:also_far, far, 8 - far)\n"
+        "[g.size, g.query(0, 0, 4.5).size, g.query(far, -far, 1).map { |x| x.to_s }.join(\",\")]"
+        ".map { |x| x.to_s }.join(\" \")",
+        "5002 4 far");
+
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_str(C, "clone_edits_own_grid",
+            "g.remove(0)\n"
+            "g.move(1, 500, 500)\n"
+            "[g.size, g.query(0, 0, 4.5).size, g.query(500, 500, 0)[0]].map { |x| x.to_s }.join(\" \")",
+            "5001 2 1");
+        luby_free(C);
+    } else {
+        printf("FAIL clone_edits_own_grid: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+    test_str(L, "source_unchanged_by_clone",
+        "[g.size, g.query(0, 0, 4.5).size].map { |x| x.to_s }.join(\" \")", "5002 4");
+    test_str(L, "clear",
+        "g.clear\n[g.size, g.query(0, 0, 100).size, g.insert(:a, 0, 0).size].map { |x| x.to_s }.join(\" \")",
+        "0 0 1");
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
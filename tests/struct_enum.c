@@ -88,6 +88,40 @@ int main(void) {
     test_bool(L, "3field_read", "c.r == 255 && c.g == 128 && c.b == 0");
     test_bool(L, "3field_to_a", "r = c.to_a; r.length == 3 && r[2] == 0");
 
+    /* keys, equality and hashing */
+    test_bool(L, "bracket_neg_str", "c[-1] == 0 && c[\"g\"] == 128 && c[3] == nil && c[:zz] == nil");
+    test_bool(L, "to_s", "point.new(1, \"a\").to_s == \"#<struct x=1, y=a>\"");
+    test_bool(L, "eql_hash", "a = point.new(1, \"s\"); b = point.new(1, \"s\"); a.eql?(b) && a.hash == b.hash && [a, b].uniq.length == 1");
+    test_bool(L, "eq_other_class", "!(point.new(1, 2) == color.new(1, 2, 3)) && !(point.new(1, 2) == 5)");
+    test_bool(L, "eq_nested", "point.new(point.new(1, 2), 0) == point.new(point.new(1, 2), 0)");
+    test_bool(L, "missing_args_nil", "point.new(5).y == nil");
+    test_bool(L, "accessor_send", "p1.send(:x) == 42 && p1.respond_to?(:y)");
+
+    /* members live in slots; @member inside methods reaches them */
+    {
+        luby_value cls;
+        luby_eval(L, "Struct.new(:w, :h)", 0, "<test>", &cls);
+        luby_set_global_value(L, "Size", cls);
+        run(L,
+            "class Box < Size\n"
+            "  def initialize(w, h, d)\n"
+            "    super(w, h)\n"
+            "    @d = d\n"
+            "  end\n"
+            "  def volume\n"
+            "    @w * self.h * @d\n"
+            "  end\n"
+            "end\n");
+        test_bool(L, "subclass_super", "b = Box.new(2, 3, 4); b.volume == 24 && b.to_a.length == 2 && b.w == 2");
+    }
+    test_bool(L, "many", "t = 0; 1000.times { |i| t += point.new(i, 1)[:y] }; t == 1000");
+    {
+        luby_value out;
+        int ok = luby_eval(L, "Struct.new(:a, :a)", 0, "<test>", &out) != 0;
+        printf("%s duplicate_member\n", ok ? "PASS" : "FAIL");
+        if (ok) pass_count++; else fail_count++;
+    }
+
     printf("\n=== Enumerable Tests ===\n");
 
     /* Define a class that includes Enumerable */
@@ -0,0 +1,261 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+typedef struct {
+    float x, y;
+    int32_t hp;
+    uint32_t id;
+} Camera;
+
+static const luby_field camera_fields[] = {
+    LUBY_FIELD(Camera, x, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Camera, y, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Camera, hp, LUBY_FIELD_INT32),
+    LUBY_FIELD_READONLY(Camera, id, LUBY_FIELD_UINT32),
+};
+
+static size_t allocations = 0;
+
+static void *counting_alloc(void *user, void *ptr, size_t size) {
+    (void)user;
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!ptr) allocations++;
+    return realloc(ptr, size);
+}
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code raises an error with exactly `message`
+static int test_error(luby_state *L, const char *name, const char *code, const char *message) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        luby_error err = luby_last_error(L);
+        if (err.message && strcmp(err.message, message) == 0) {
+            printf("PASS %s\n", name);
+            pass_count++;
+            return 1;
+        }
+        printf("FAIL %s: expected \"%s\", got \"%s\"\n", name, message, err.message ? err.message : "");
+    } else {
+        printf("FAIL %s: expected an error\n", name);
+    }
+    fail_count++;
+    return 0;
+}
+
+int main(void) {
+    luby_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.alloc = counting_alloc;
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+
+    // A host struct the tweens drive through its bound fields
+    Camera cam = { 20.0f, 0.0f, 0, 7 };
+    luby_class *camera = luby_define_class(L, "Camera", NULL);
+    luby_define_fields(L, camera, camera_fields, sizeof(camera_fields) / sizeof(camera_fields[0]));
+    luby_value ud = luby_wrap_userdata(L, &cam, NULL);
+    luby_set_userdata_class(L, ud, camera);
+    luby_set_global_value(L, "cam", ud);
+    run(L,
+        "class Box\n"
+        "  attr_accessor :x, :alpha, :score\n"
+        "  def initialize(x)\n"
+        "    @x = x\n"
+        "  end\n"
+        "end\n");
+    luby_value point;
+    if (eval_check(L, "point_setup", "Struct.new(:x, :y)", &point)) luby_set_global_value(L, "Point", point);
+
+    printf("=== Tween Tests ===\n\n");
+
+    /* ---- property kinds ---- */
+    printf("--- property kinds ---\n");
+
+    test_str(L, "tick_writes_ivars_slots_fields",
+        "tw = Tweener.new\n"
+        "b = Box.new(0)\n"
+        "p = Point.new(1, 0.0)\n"
+        "tw.add(b, :x, 0.0, 10, 1.0).add(p, :y, 0.0, 4.0, 2.0, :quad_in).add(cam, :x, nil, 100, 0.5)\n"
+        "tw.add(b, :alpha, 1.0, 0.0, 2.0)\n"
+        "left = tw.tick(0.5)\n"
+        "[left, b.x, p.y, cam.x, b.alpha, tw.size].map { |x| x.to_s }.join(\" \")",
+        "3 5 0.25 100 0.75 3");
+    check("host_sees_field_write", cam.x == 100.0f);
+    test_str(L, "tick_finishes_all",
+        "tw.tick(5)\n[tw.size, tw.empty?, b.x, p.y, b.alpha].map { |x| x.to_s }.join(\" \")",
+        "0 true 10 4 0");
+
+    /* ---- easing ---- */
+    printf("\n--- easing ---\n");
+
+    test_str(L, "ease_values",
+        "[ease(:linear, 0.25), ease(:quad_in, 0.5), ease(:cubic_out, 0.5), ease(:quad_in_out, 0.25),"
+        " ease(\"sine_in_out\", 0.5), ease(:bounce_out, 2), ease(:elastic_in, -1)].map { |x| x.to_s }.join(\" \")",
+        "0.25 0.25 0.875 0.125 0.5 1 0");
+    test_str(L, "ease_endpoints",
+        "bad = 0\n"
+        "[\"quad\", \"cubic\", \"quart\", \"quint\", \"sine\", \"expo\", \"circ\", \"back\", \"elastic\", \"bounce\"].each do |f|\n"
+        "  [\"_in\", \"_out\", \"_in_out\"].each do |s|\n"
+        "    bad += 1 if (ease(f + s, 0) - 0).abs > 0.000001 || (ease(f + s, 1) - 1).abs > 0.000001\n"
+        "  end\n"
+        "end\n"
+        "mid = ease(:back_in, 0.5) < 0 ? \"under\" : \"over\"\n"
+        "bad.to_s + \" \" + mid + \" \" + (ease(:elastic_out, 0.2) > 1).to_s",
+        "0 under true");
+    test_error(L, "ease_unknown_curve", "ease(:wobble, 0.5)", "ease: unknown easing curve");
+    test_error(L, "ease_nil_time", "ease(:linear, nil)", "ease: argument 2 must be number, got nil");
+
+    /* ---- completion blocks ---- */
+    printf("\n--- completion blocks ---\n");
+
+    test_str(L, "blocks_run_in_order",
+        "tw = Tweener.new\n"
+        "log = []\n"
+        "a = Box.new(0)\n"
+        "c = Box.new(0)\n"
+        "tw.add(a, :x, 0, 1, 1) { |t| log.push(\"a\" + tw.size.to_s) }\n"
+        "tw.add(c, :x, 0, 1, 2) { |t| log.push(\"c\") }\n"
+        "tw.add(a, :alpha, 0, 1, 1) do |t|\n"
+        "  log.push(\"b\" + t.x.to_s)\n"
+        "  tw.add(t, :x, 1, 0, 1) { |u| log.push(\"back\") }\n"
+        "end\n"
+        "r1 = tw.tick(1)\n"
+        "r2 = tw.tick(1)\n"
+        "[r1, r2, log.join(\",\"), a.x, tw.tick(1)].map { |x| x.to_s }.join(\" \")",
+        "2 0 a1,b1,c,back 0 0");
+    test_str(L, "block_break",
+        "n = 0\n"
+        "tw.add(a, :x, 0, 1, 0) { |t| break }\n"
+        "tw.add(a, :x, 0, 1, 0) { |t| n += 1 }\n"
+        "tw.tick(0)\n"
+        "n.to_s", "1");
+    // A failing block stops the batch; the finished tweens are gone
+    luby_value out;
+    check("failing_block_raises", luby_eval(L,
+        "tw.add(a, :x, 0, 1, 0) { |t| undefined_thing(t) }\n"
+        "tw.add(a, :x, 0, 1, 1)\n"
+        "tw.tick(0)", 0, "<test>", &out) != 0);
+    test_str(L, "failing_block_drops_finished", "tw.size.to_s", "1");
+
+    /* ---- rounding, cancel and errors ---- */
+    printf("\n--- rounding, cancel and errors ---\n");
+
+    cam.hp = 10;
+    test_str(L, "integers_round_and_cancel",
+        "tw = Tweener.new\n"
+        "b = Box.new(0)\n"
+        "tw.add(b, :score, 0, 10, 1).add(cam, :hp, nil, 0, 1).add(b, \"@x\", 0.0, 8, 1).add(b, :alpha, 0, 1, 1)\n"
+        "tw.tick(0.25)\n"
+        "r = [b.score, b.score / 2, cam.hp, b.x, b.x / 4].map { |x| x.to_s }.join(\",\")\n"
+        "[r, tw.cancel(b, :x), tw.cancel(b), tw.cancel(cam, :y), tw.size].map { |x| x.to_s }.join(\" \")",
+        "3,1,8,2,0.5 1 2 0 1");
+    check("host_sees_int_field", cam.hp == 8);
+    test_error(L, "add_non_object", "tw.add(5, :x, 0, 1, 1)", "add: target has no such ivar or writable numeric field");
+    test_error(L, "add_readonly_field", "tw.add(cam, :id, 0, 1, 1)", "add: target has no such ivar or writable numeric field");
+    test_error(L, "add_string_from", "tw.add(b, :x, \"a\", 1, 1)", "add: from, to and duration must be numbers");
+    test_error(L, "add_negative_duration", "tw.add(b, :x, 0, 1, -1)", "add: duration must not be negative");
+    test_error(L, "add_unknown_curve", "tw.add(b, :x, 0, 1, 1, :wobble)", "add: unknown easing curve");
+    test_error(L, "add_nil_property", "tw.add(Box.new(nil), :x, nil, 1, 1)", "add: property does not hold a number");
+    test_error(L, "tick_negative", "tw.tick(-1)", "tick: expected a non-negative time step");
+    test_error(L, "tick_frozen_target", "f = Box.new(0)\ntw.add(f, :x, 0, 1, 1)\nf.freeze\ntw.tick(0.5)", "frozen");
+    test_str(L, "clear", "tw.clear\ntw.size.to_s", "0");
+
+    /* ---- one host call per frame ---- */
+    printf("\n--- frame loop ---\n");
+
+    cam.y = 0.0f;
+    luby_value tw;
+    if (eval_check(L, "frame_setup",
+            "boxes = []\n"
+            "tw = Tweener.new\n"
+            "2000.times do |i|\n"
+            "  b = Box.new(0)\n"
+            "  b.alpha = 1.0\n"
+            "  boxes.push(b)\n"
+            "  tw.add(b, :x, 0, i, 1.0, :cubic_in_out).add(b, :alpha, nil, 0.0, 0.5, :expo_out)\n"
+            "end\n"
+            "tw.add(cam, :y, 0, 50, 1.0, :bounce_out)\n"
+            "tw", &tw)) {
+        size_t before = allocations;
+        luby_value dt = luby_float(1.0 / 64.0);
+        int ok = 1;
+        for (int frame = 0; ok && frame < 32; frame++) {
+            ok = luby_invoke_method(L, tw, "tick", 1, &dt, &out) == 0 && out.type == LUBY_T_INT;
+        }
+        check("ticks_do_not_allocate", ok && out.as.i == 2001 && allocations == before);
+        test_str(L, "frame_values", "[boxes[1000].x, boxes[7].alpha].map { |x| x.to_s }.join(\" \")", "500 0");
+        check("host_field_eased", cam.y > 38.28f && cam.y < 38.29f);   // 50 * bounce_out(0.5)
+    }
+
+    // Clones pick up mid-flight tweens where the snapshot left them
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_str(C, "clone_resumes_tweens",
+            "[tw.tick(0.5), boxes[1000].x, boxes[3].alpha].map { |x| x.to_s }.join(\" \")", "0 1000 0");
+        luby_free(C);
+    } else {
+        printf("FAIL clone_resumes_tweens: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+    test_str(L, "source_unchanged_by_clone", "boxes[1000].x.to_s", "500");
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
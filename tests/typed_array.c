@@ -0,0 +1,216 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+    luby_value out;
+
+    printf("=== Typed Array Tests ===\n\n");
+
+    /* ---- construction and indexing ---- */
+    printf("--- construction ---\n");
+
+    test_str(L, "construct_index_convert",
+        "a = Float32Array.new([1, 2.5, 3])\n"
+        "z = Float64Array.new(2)\n"
+        "i = Int32Array.new([7, -1.9, 2147483648])\n"
+        "a[1] = 4\n"
+        "i[-1] = 9\n"
+        "[a, z, i, Int32Array.new(a), a[0], a[-1], a[3].nil?, i[0], a.size].map { |x| x.to_s }.join(\" \")",
+        "Float32Array[1, 4, 3] Float64Array[0, 0] Int32Array[7, -1, 9] Int32Array[1, 4, 3] 1 3 true 7 3");
+
+    test_str(L, "enumerable_and_inspect",
+        "t = 0\n"
+        "a.each { |x| t += x }\n"
+        "[t, a.map { |x| (x * 2).to_s }.join(\",\"), a.select { |x| x > 2 }.size, a.to_a.size, a.include?(4.0), "
+        "Float32Array.new(20).fill(1).inspect].map { |x| x.to_s }.join(\" \")",
+        "8 2,8,6 2 3 true Float32Array[1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, ...]");
+
+    /* ---- elementwise arithmetic ---- */
+    printf("\n--- arithmetic ---\n");
+
+    // Lengths 1..11 cover the four-lane body and every remainder
+    test_int(L, "simd_tails",
+        "bad = 0\n"
+        "(1..11).each do |len|\n"
+        "  src = []\n"
+        "  len.times { |k| src << k + 1 }\n"
+        "  x1 = Float32Array.new(src)\n"
+        "  x2 = Float32Array.new(len).fill(2)\n"
+        "  s = x1 + x2\n"
+        "  d = x1 - x2\n"
+        "  m = x1 * x2\n"
+        "  k = x1 * 0.5\n"
+        "  len.times do |k2|\n"
+        "    x = src[k2]\n"
+        "    bad += 1 if s[k2] != x + 2.0 || d[k2] != x - 2.0 || m[k2] != x * 2.0 || k[k2] != x * 0.5\n"
+        "  end\n"
+        "  bad += 1 if x1.sum != len * (len + 1) / 2.0 || x1.dot(x2) != len * (len + 1) * 1.0\n"
+        "  bad += 1 if x1.min != 1.0 || x1.max != len * 1.0\n"
+        "end\n"
+        "bad", 0);
+
+    test_str(L, "float64_in_place_chain",
+        "a = Float64Array.new([1, 2, 3, 4, 5])\n"
+        "b = Float64Array.new([5, 4, 3, 2, 1])\n"
+        "c = a.dup\n"
+        "c.add!(b).scale!(2).sub!(a)\n"
+        "[c, a.clamp(2, 4), a.lerp(b, 0.25), a.scale(3), a.sum, a.dot(b)].map { |x| x.to_s }.join(\" \")",
+        "Float64Array[11, 10, 9, 8, 7] Float64Array[2, 2, 3, 4, 4] Float64Array[2, 2.5, 3, 3.5, 4] "
+        "Float64Array[3, 6, 9, 12, 15] 15 35");
+
+    test_str(L, "clamp_lerp_equality",
+        "f = Float32Array.new([-3, 0.5, 9, 2, 7])\n"
+        "f.clamp!(0, 5)\n"
+        "g = Float32Array.new([1, 1, 1, 1, 1])\n"
+        "g.lerp!(f, 0.5)\n"
+        "[f, g, f == Float32Array.new([0, 0.5, 5, 2, 5]), f == g, Float32Array.new(0).min.nil?].map { |x| x.to_s }.join(\" \")",
+        "Float32Array[0, 0.5, 5, 2, 5] Float32Array[0.5, 0.75, 3, 1.5, 3] true false true");
+
+    test_str(L, "int32_wraps_and_reduces",
+        "i = Int32Array.new([2147483647, -5, 7])\n"
+        "j = i + 1\n"
+        "k = Int32Array.new([3, 4, 5]) * 2\n"
+        "[j, k, i.sum, i.dot(i), i.min, i.max, k.clamp(7, 9), k.lerp(j, 0.5)].map { |x| x.to_s }.join(\" \")",
+        "Int32Array[-2147483648, -4, 8] Int32Array[6, 8, 10] 2147483649 4611686014132420683 -5 2147483647 "
+        "Int32Array[7, 8, 9] Int32Array[-1073741821, 2, 9]");
+
+    /* ---- views ---- */
+    printf("\n--- views ---\n");
+
+    if (eval_check(L, "view_setup",
+            "a = Float32Array.new([0, 1, 2, 3, 4, 5, 6, 7])\n"
+            "v = a.view(2, 4)\n"
+            "w = v.view(1)\n"
+            "v[0] = 20\n"
+            "w.scale!(10)\n"
+            "a", &out)) {
+        luby_buffer_kind kind = LUBY_INT32;
+        size_t len = 0, wlen = 0;
+        float *base = (float *)luby_buffer_data(out, &kind, &len);
+        check("view_owner_storage", base && kind == LUBY_FLOAT32 && len == 8);
+        float *wp = eval_check(L, "view_lookup", "w", &out) ? (float *)luby_buffer_data(out, NULL, &wlen) : NULL;
+        check("view_aliases_owner", base && wp == base + 3 && wlen == 3);
+    }
+
+    test_str(L, "view_writes_show_through",
+        "a.to_s + \" \" + w.to_s + \" \" + w.dup.add!(w).to_s",
+        "Float32Array[0, 1, 20, 30, 40, 50, 6, 7] Float32Array[30, 40, 50] Float32Array[60, 80, 100]");
+
+    // In-place ops read an overlapping operand as it was before the call
+    test_str(L, "overlapping_in_place",
+        "b = Float32Array.new([1, 2, 3, 4, 5, 6])\n"
+        "b.view(1, 5).add!(b.view(0, 5))\n"
+        "b.to_s", "Float32Array[1, 3, 5, 7, 9, 11]");
+
+    /* ---- host pointer API ---- */
+    printf("\n--- host pointers ---\n");
+
+    double init[3] = { 1.5, 2.5, 3.5 };
+    luby_value buf = luby_buffer_new(L, LUBY_FLOAT64, 3, init);
+    luby_set_global_value(L, "samples", buf);
+    double *data = (double *)luby_buffer_data(buf, NULL, NULL);
+    if (check("buffer_new_copies_init", data && data[2] == 3.5)) {
+        data[0] = 10.0;
+        test_int(L, "script_sees_host_writes", "samples.scale!(2)\n(samples.sum * 10).to_i", 320);
+        check("host_sees_script_writes", data[0] == 20.0 && data[1] == 5.0);
+    }
+    int32_t ints[4] = { 1, 2, 3, 4 };
+    luby_value iv = luby_buffer_new(L, LUBY_INT32, 4, ints);
+    check("int32_buffer_new", iv.type == LUBY_T_BUFFER && ((int32_t *)luby_buffer_data(iv, NULL, NULL))[3] == 4);
+    check("buffer_data_rejects_non_buffers", !luby_buffer_data(luby_int(1), NULL, NULL));
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    const char *bad_cases[] = {
+        "Float32Array.new(2) + Float32Array.new(3)", "Float32Array.new(2) + Float64Array.new(2)",
+        "Float32Array.new(2) + \"a\"", "Int32Array.new(2) * 1.5", "Float32Array.new(-1)",
+        "Float32Array.new([1, \"a\"])", "Float32Array.new(4).view(2, 3)", "Float32Array.new(2).dot([1, 2])",
+        "Float32Array.new(2).clamp(3, 1)", "Float32Array.new(2).lerp(Float32Array.new(2))",
+        "Float32Array.new(2).send(:[]=, 5, 1)", "Float32Array.new(2).each"
+    };
+    int rejected = 1;
+    for (size_t i = 0; i < sizeof(bad_cases) / sizeof(bad_cases[0]); i++) {
+        if (luby_eval(L, bad_cases[i], 0, "<test>", &out) == 0) {
+            printf("  accepted: %s\n", bad_cases[i]);
+            rejected = 0;
+        }
+    }
+    check("bad_operands_raise", rejected);
+
+    /* ---- snapshot / clone ---- */
+    printf("\n--- snapshot / clone ---\n");
+
+    eval_check(L, "clone_setup", "grid = Int32Array.new([1, 2, 3, 4, 5, 6])\nrow = grid.view(3, 3)", &out);
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (check("snapshot_taken", C != NULL)) {
+        test_str(C, "clone_view_aliases_clone_owner", "row.add!(10)\ngrid.to_s", "Int32Array[1, 2, 3, 14, 15, 16]");
+        luby_free(C);
+    }
+    test_str(L, "source_unchanged_by_clone", "grid.to_s", "Int32Array[1, 2, 3, 4, 5, 6]");
+    luby_snapshot_free(snap);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int boxed_calls = 0;
+
+// Typed natives read argv without checking it
+static int repeat_fn(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)argc;
+    const char *s = (const char *)argv[1].as.ptr;
+    size_t len = strlen(s);
+    char buf[64];
+    size_t n = 0;
+    for (int64_t i = 0; i < argv[0].as.i && n + len < sizeof(buf); i++, n += len) memcpy(buf + n, s, len);
+    *out = luby_string(L, buf, n);
+    return 0;
+}
+
+static int hypot_fn(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L; (void)argc;
+    double a = argv[0].type == LUBY_T_INT ? (double)argv[0].as.i : argv[0].as.f;
+    double b = argv[1].type == LUBY_T_INT ? (double)argv[1].as.i : argv[1].as.f;
+    boxed_calls++;
+    *out = luby_float(sqrt(a * a + b * b));
+    return 0;
+}
+
+static double hypot_num(double a, double b) { return sqrt(a * a + b * b); }
+
+static int each_twice(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    luby_value r = luby_nil();
+    for (int i = 0; i < 2; i++) {
+        if (luby_yield(L, argc, argv, &r) != 0) return (int)LUBY_E_RUNTIME;
+    }
+    *out = r;
+    return 0;
+}
+
+static int meter_scale(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L; (void)argc;
+    *out = luby_float(argv[1].as.f * 2.0);
+    return 0;
+}
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code raises a TypeError with exactly `message`
+static int test_type_error(luby_state *L, const char *name, const char *code, const char *message) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        luby_error err = luby_last_error(L);
+        if (err.code == LUBY_E_TYPE && err.message && strcmp(err.message, message) == 0) {
+            printf("PASS %s\n", name);
+            pass_count++;
+            return 1;
+        }
+        printf("FAIL %s: expected \"%s\", got \"%s\"\n", name, message, err.message ? err.message : "");
+    } else {
+        printf("FAIL %s: expected an error\n", name);
+    }
+    fail_count++;
+    return 0;
+}
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+    luby_signature rep = { 2, { LUBY_ARG_INT, LUBY_ARG_STRING }, LUBY_BLOCK_NONE, 1, NULL, NULL };
+    luby_signature hyp = { 2, { LUBY_ARG_NUMBER, LUBY_ARG_NUMBER }, LUBY_BLOCK_NONE, 1, NULL, hypot_num };
+    luby_signature twice = { -1, { LUBY_ARG_ANY }, LUBY_BLOCK_REQUIRED, 0, NULL, NULL };
+    luby_register_function_ex(L, "repeat", repeat_fn, &rep);
+    luby_register_function_ex(L, "hyp", hypot_fn, &hyp);
+    luby_register_function_ex(L, "twice", each_twice, &twice);
+    luby_value args[2], out;
+
+    printf("=== Typed Native Tests ===\n\n");
+
+    /* ---- checked calls ---- */
+    printf("--- checked calls ---\n");
+
+    test_str(L, "typed_calls",
+        "t = 0\n"
+        "twice(1) { |x| t += x }\n"
+        "[repeat(3, \"ab\"), hyp(3, 4), sqrt(16), atan2(0, 1), lerp(0, 10, 0.5), t].map { |x| x.to_s }.join(\" \")",
+        "ababab 5 4 0 5 2");
+    test_str(L, "typed_call_in_loop", "def go(n)\n  s = 0\n  n.times { |i| s += hyp(i, 0) }\n  s\nend\ngo(100).to_s", "4950");
+    test_str(L, "typed_methods_on_numbers", "2.pow(10).to_s + \" \" + 16.sqrt.to_s", "1024 4");
+
+    /* ---- unboxed entry points ---- */
+    printf("\n--- unboxed entry points ---\n");
+
+    boxed_calls = 0;
+    test_str(L, "unboxed_loop", "s = 0\n1000.times { |i| s += hyp(i, 1.5) }\n(s > 0).to_s", "true");
+    check("vm_skips_boxed_native", boxed_calls == 0);
+    args[0] = luby_int(6);
+    args[1] = luby_int(8);
+    check("host_calls_boxed_native",
+        luby_invoke_global(L, "hyp", 2, args, &out) == 0 && out.type == LUBY_T_FLOAT && out.as.f == 10.0 && boxed_calls == 1);
+
+    /* ---- mismatches ---- */
+    printf("\n--- mismatches ---\n");
+
+    test_type_error(L, "wrong_arg_type", "repeat(2, 3)", "repeat: argument 2 must be string, got int");
+    test_type_error(L, "wrong_arg_count", "repeat(2)", "repeat: wrong number of arguments (given 1, expected 2)");
+    test_type_error(L, "builtin_arg_type", "sin(\"x\")", "sin: argument 1 must be number, got string");
+    test_type_error(L, "missing_block", "twice(1)", "twice: no block given");
+    test_type_error(L, "unboxed_site_falls_back", "x = [1]\n5.times { |i| hyp(i, x) }", "hyp: argument 2 must be number, got array");
+    args[0] = luby_int(1);
+    check("host_call_checked", luby_invoke_global(L, "repeat", 1, args, &out) == (int)LUBY_E_TYPE);
+    luby_signature bad = { 2, { LUBY_ARG_NUMBER }, LUBY_BLOCK_NONE, 1, sqrt, NULL };
+    check("unboxed_arity_mismatch_refused", luby_register_function_ex(L, "bad", hypot_fn, &bad) == (int)LUBY_E_TYPE);
+
+    /* ---- typed methods ---- */
+    printf("\n--- typed methods ---\n");
+
+    luby_class *cls = luby_define_class(L, "Meter", NULL);
+    luby_signature sig = { 1, { LUBY_ARG_FLOAT }, LUBY_BLOCK_NONE, 1, NULL, NULL };
+    int defined = luby_define_method_ex(L, cls, "scale", meter_scale, &sig);
+    sig.arity = 2;
+    sig.num1 = sqrt;
+    check("method_signatures_checked", defined && luby_define_method_ex(L, cls, "bad", meter_scale, &sig) == 0);
+    test_str(L, "typed_method_call", "m = Meter.new\nm.scale(1.5).to_s", "3");
+    test_type_error(L, "typed_method_arg_type", "m.scale(1)", "scale: argument 1 must be float, got int");
+    luby_value m;
+    args[0] = luby_float(2.0);
+    args[1] = luby_float(1.0);
+    if (eval_check(L, "meter_lookup", "m", &m)) {
+        check("host_method_call", luby_invoke_method(L, m, "scale", 1, args, &out) == 0 && out.as.f == 4.0);
+        check("host_method_call_checked", luby_invoke_method(L, m, "scale", 2, args, &out) == (int)LUBY_E_TYPE);
+    }
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_str(C, "clone_keeps_signatures", "m.scale(0.25).to_s + \" \" + repeat(2, \"z\")", "0.5 zz");
+        test_type_error(C, "clone_checks_arguments", "Meter.new.scale(nil)", "scale: argument 1 must be float, got nil");
+        luby_free(C);
+    } else {
+        printf("FAIL clone_keeps_signatures: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+
+    /* ---- shadowing ---- */
+    printf("\n--- shadowing ---\n");
+
+    test_str(L, "cached_site", "def go\n  hyp(3, 4)\nend\ngo().to_s", "5");
+    test_str(L, "definition_shadows_native", "def hyp(a, b)\n  a + b\nend\ngo().to_s", "7");
+    test_str(L, "method_shadows_native",
+        "class Shape\n"
+        "  def sqrt(x)\n    \"own\"\n  end\n"
+        "  def area\n    sqrt(9)\n  end\n"
+        "end\n"
+        "Shape.new.area + \" \" + sqrt(9).to_s", "own 3");
+    // Re-registering swaps the native in place
+    luby_signature one = { 1, { LUBY_ARG_INT }, LUBY_BLOCK_NONE, 1, NULL, NULL };
+    check("reregister_native", luby_register_function_ex(L, "repeat", hypot_fn, &one) == 0);
+    test_type_error(L, "reregistered_signature", "repeat(2, \"a\")", "repeat: wrong number of arguments (given 2, expected 1)");
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
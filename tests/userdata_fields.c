@@ -0,0 +1,327 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+static int pass_count = 0, fail_count = 0;
+
+typedef struct {
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    int64_t i64;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    float f;
+    double d;
+    bool b;
+} Sample;
+
+typedef struct {
+    float x, y;
+    float vx, vy;
+    int32_t hp;
+    uint32_t id;
+} Entity;
+
+static const luby_field sample_fields[] = {
+    LUBY_FIELD(Sample, i8, LUBY_FIELD_INT8),
+    LUBY_FIELD(Sample, i16, LUBY_FIELD_INT16),
+    LUBY_FIELD(Sample, i32, LUBY_FIELD_INT32),
+    LUBY_FIELD(Sample, i64, LUBY_FIELD_INT64),
+    LUBY_FIELD(Sample, u8, LUBY_FIELD_UINT8),
+    LUBY_FIELD(Sample, u16, LUBY_FIELD_UINT16),
+    LUBY_FIELD(Sample, u32, LUBY_FIELD_UINT32),
+    LUBY_FIELD(Sample, f, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Sample, d, LUBY_FIELD_DOUBLE),
+    LUBY_FIELD(Sample, b, LUBY_FIELD_BOOL),
+};
+
+static const luby_field entity_fields[] = {
+    LUBY_FIELD(Entity, x, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Entity, y, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Entity, vx, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Entity, vy, LUBY_FIELD_FLOAT),
+    LUBY_FIELD(Entity, hp, LUBY_FIELD_INT32),
+    LUBY_FIELD_READONLY(Entity, id, LUBY_FIELD_UINT32),
+};
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code fails with the given error code (0 accepts any)
+static int test_error(luby_state *L, const char *name, const char *code, luby_error_code expected) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0 &&
+        (expected == LUBY_E_OK || luby_last_error(L).code == expected)) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected an error\n", name);
+    fail_count++;
+    return 0;
+}
+
+static void bind(luby_state *L, luby_class *cls, const char *name, void *ptr) {
+    luby_value ud = luby_wrap_userdata(L, ptr, NULL);
+    luby_set_userdata_class(L, ud, cls);
+    luby_set_global_value(L, name, ud);
+}
+
+static int native_calls = 0;
+
+static int entity_speed(luby_state *L, int argc, const luby_value *argv, luby_value *out) {
+    (void)L; (void)argc;
+    native_calls++;
+    Entity *e = (Entity *)luby_userdata_ptr(argv[0]);
+    *out = luby_float(e->vx * 100.0);
+    return 0;
+}
+
+static size_t allocations = 0;
+
+static void *counting_alloc(void *user, void *ptr, size_t size) {
+    (void)user;
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!ptr) allocations++;
+    return realloc(ptr, size);
+}
+
+int main(void) {
+    luby_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.alloc = counting_alloc;
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+    luby_value out;
+
+    luby_class *sample = luby_define_class(L, "Sample", NULL);
+    luby_class *entity = luby_define_class(L, "Entity", NULL);
+    int defined = luby_define_fields(L, sample, sample_fields, sizeof(sample_fields) / sizeof(sample_fields[0]));
+    defined = defined && luby_define_fields(L, entity, entity_fields, sizeof(entity_fields) / sizeof(entity_fields[0]));
+
+    printf("=== Userdata Field Binding Tests ===\n\n");
+
+    /* ---- field types ---- */
+    printf("--- field types ---\n");
+
+    check("define_fields", defined);
+    Sample s = { -5, 300, -70000, 5000000000LL, 200, 60000, 4000000000u, 1.5f, 2.25, true };
+    bind(L, sample, "s", &s);
+    test_str(L, "read_every_type",
+        "[s.i8, s.i16, s.i32, s.i64, s.u8, s.u16, s.u32, s.f, s.d, s.b].map { |x| x.to_s }.join(\",\")",
+        "-5,300,-70000,5000000000,200,60000,4000000000,1.5,2.25,true");
+    test_str(L, "write_every_type",
+        "s.i8 = 130\n"
+        "s.i16 = -2\n"
+        "s.i32 = s.i32 * 2\n"
+        "s.i64 = -1\n"
+        "s.u8 = 257\n"
+        "s.u16 = -1\n"
+        "s.u32 = 7\n"
+        "s.f = 3\n"
+        "s.d = 0.125\n"
+        "s.b = false\n"
+        "[s.i8, s.i16, s.i32, s.i64, s.u8, s.u16, s.u32, s.f, s.d, s.b].map { |x| x.to_s }.join(\",\")",
+        "-126,-2,-140000,-1,1,65535,7,3,0.125,false");
+    check("host_sees_writes",
+        s.i8 == -126 && s.i32 == -140000 && s.u8 == 1 && s.u16 == 65535 && s.f == 3.0f && s.d == 0.125 && !s.b);
+    // The setter's value is the stored, wrapped value
+    test_int(L, "setter_returns_stored", "s.send(\"u8=\", 300)", 44);
+    check("setter_wraps", s.u8 == 44);
+    test_int(L, "respond_to_fields", "s.respond_to?(:i16) && s.respond_to?(\"d=\") && !s.respond_to?(:nope) ? 1 : 0", 1);
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    Entity e = { 0 };
+    e.id = 9;
+    bind(L, entity, "e", &e);
+    check("readonly_raises_at_line",
+        luby_eval(L, "e.hp = 1\ne.id = 3", 0, "<test>", &out) != 0 && luby_last_error(L).line == 2 && e.id == 9 && e.hp == 1);
+    test_error(L, "int_field_rejects_float", "e.hp = 1.5", LUBY_E_TYPE);
+    test_error(L, "float_field_rejects_string", "e.x = \"far\"", LUBY_E_TYPE);
+    test_error(L, "reader_rejects_arguments", "e.hp(1, 2)", LUBY_E_OK);
+    check("invalidate", luby_eval(L, "e", 0, "<test>", &out) == 0 && luby_invalidate_userdata(out));
+    test_error(L, "dead_userdata_raises", "e.x", LUBY_E_OK);
+    // An unbound class and a failed definition leave dispatch alone
+    luby_class *plain = luby_define_class(L, "Plain", NULL);
+    bind(L, plain, "p", &e);
+    test_error(L, "unbound_class_raises", "p.x", LUBY_E_OK);
+    luby_field bad = { "x", 0, (luby_field_type)99, 0 };
+    check("bad_field_refused", !luby_define_fields(L, plain, &bad, 1));
+    test_error(L, "refused_field_not_bound", "p.x", LUBY_E_OK);
+
+    /* ---- entity loop ---- */
+    printf("\n--- entity loop ---\n");
+
+    enum { COUNT = 1000 };
+    Entity *ents = (Entity *)calloc(COUNT, sizeof(Entity));
+    luby_value list = luby_array_new(L);
+    luby_set_global_value(L, "ents", list);
+    for (int i = 0; i < COUNT; i++) {
+        ents[i].vx = 1;
+        ents[i].vy = 0.5f;
+        ents[i].hp = i;
+        luby_value ud = luby_wrap_userdata(L, &ents[i], NULL);
+        luby_set_userdata_class(L, ud, entity);
+        luby_array_push_value(L, list, ud);
+    }
+    eval_check(L, "loop_setup",
+        "def run(ents, frames, dt)\n"
+        "  f = 0\n"
+        "  while f < frames\n"
+        "    i = 0\n"
+        "    n = ents.size\n"
+        "    while i < n\n"
+        "      e = ents[i]\n"
+        "      e.x = e.x + e.vx * dt\n"
+        "      e.y = e.y + e.vy * dt\n"
+        "      e.hp = e.hp - 1 if e.y > 1\n"
+        "      i += 1\n"
+        "    end\n"
+        "    f += 1\n"
+        "  end\n"
+        "end\n"
+        "run(ents, 1, 1)", &out);
+    size_t before = allocations;
+    if (eval_check(L, "loop_run", "run(ents, 20, 0.5)", &out)) {
+        // Only compiling the driver may touch the allocator
+        check("loop_barely_allocates", allocations - before < 100);
+        check("loop_writes_fields", ents[10].x == 11.0f && ents[10].y == 5.5f && ents[10].hp == 10 - 18 && native_calls == 0);
+    }
+
+    /* ---- method refs and batches ---- */
+    printf("\n--- method refs and batches ---\n");
+
+    Entity trio[3] = { { 0 } };
+    luby_value recvs[3], results[3];
+    for (int i = 0; i < 3; i++) {
+        trio[i].hp = 10 * (i + 1);
+        recvs[i] = luby_wrap_userdata(L, &trio[i], NULL);
+        luby_ref(L, recvs[i]);
+        luby_set_userdata_class(L, recvs[i], entity);
+    }
+    luby_method_ref *get = luby_method_ref_new(L, entity, "hp");
+    luby_method_ref *set = luby_method_ref_new(L, NULL, "x=");
+    luby_value v = luby_float(2.5);
+    check("ref_calls_setter", luby_method_ref_call(L, set, recvs[1], 1, &v, &out) == 0 && trio[1].x == 2.5f);
+    check("ref_calls_reader",
+        luby_method_ref_call(L, get, recvs[2], 0, NULL, &out) == 0 && out.type == LUBY_T_INT && out.as.i == 30);
+    int status[3];
+    int batch_ok = luby_invoke_batch(L, get, recvs, 3, NULL, NULL, results, status) == 0;
+    for (int i = 0; i < 3 && batch_ok; i++) batch_ok = status[i] == 0 && results[i].as.i == 10 * (i + 1);
+    check("batch_reads_fields", batch_ok);
+    // Read-only members refuse the setter through a handle as well
+    luby_method_ref *set_id = luby_method_ref_new(L, NULL, "id=");
+    check("ref_readonly_refused", luby_method_ref_call(L, set_id, recvs[0], 1, &v, &out) != 0);
+
+    /* ---- snapshot / clone ---- */
+    printf("\n--- snapshot / clone ---\n");
+
+    eval_check(L, "heal_setup", "def heal(n, e)\n  e.hp = e.hp + n\nend", &out);
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        Entity c = { 0 };
+        c.hp = 1;
+        c.id = 4;
+        bind(C, luby_define_class(C, "Entity", NULL), "e", &c);
+        test_int(C, "clone_keeps_layout", "heal(5, e)\ne.hp * 10 + e.id", 64);
+        check("clone_writes_host_struct", c.hp == 6);
+        luby_free(C);
+    } else {
+        printf("FAIL clone_keeps_layout: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+
+    /* ---- dispatch order ---- */
+    printf("\n--- dispatch order ---\n");
+
+    eval_check(L, "subclass_setup",
+        "class Enemy < Entity\n"
+        "  def hp\n"
+        "    -1\n"
+        "  end\n"
+        "end", &out);
+    luby_class *enemy = luby_define_class(L, "Enemy", "Entity");
+    Entity a = { 0 }, b = { 0 };
+    a.vx = 2; a.hp = 10;
+    b.vx = 3; b.hp = 50;
+    bind(L, entity, "a", &a);
+    bind(L, enemy, "b", &b);
+    // One call site sees both classes in turn
+    test_int(L, "methods_win_subclasses_inherit", "t = 0\n4.times { [a, b].each { |o| t += o.vx + o.hp } }\nt.to_i", 56);
+    luby_define_method(L, entity, "vx", entity_speed);
+    test_int(L, "native_method_shadows_field", "t = 0\n[a, b].each { |o| t += o.vx + o.hp }\nt.to_i", 509);
+    check("native_called_per_receiver", native_calls == 2);
+    // Rebinding a name to another member is picked up by warm sites
+    luby_field moved = LUBY_FIELD(Entity, hp, LUBY_FIELD_INT32);
+    moved.name = "vy";
+    a.vy = 7;
+    check("rebind_field", luby_define_fields(L, entity, &moved, 1));
+    test_int(L, "warm_site_follows_rebind", "a.vy", 10);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    free(ents);
+    return fail_count ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <string.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static void run(luby_state *L, const char *code) {
+    int rc = luby_eval(L, code, 0, "<test>", NULL);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("  ERROR: %s\n", buf);
+    }
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+// Passes when the code fails with `expected` and, if given, a message containing `part`
+static int test_error(luby_state *L, const char *name, const char *code, luby_error_code expected, const char *part) {
+    luby_value out;
+    if (luby_eval(L, code, 0, "<test>", &out) != 0) {
+        luby_error err = luby_last_error(L);
+        if ((expected == LUBY_E_OK || err.code == expected) && (!part || (err.message && strstr(err.message, part)))) {
+            printf("PASS %s\n", name);
+            pass_count++;
+            return 1;
+        }
+    }
+    printf("FAIL %s: expected an error\n", name);
+    fail_count++;
+    return 0;
+}
+
+int main(void) {
+    luby_state *L = luby_new(NULL);
+    luby_open_base(L);
+
+    run(L,
+        "class Point\n"
+        "  attr_reader :x, :y\n"
+        "  def initialize(x, y)\n"
+        "    @x = x\n"
+        "    @y = y\n"
+        "  end\n"
+        "  def hash\n"
+        "    [@x, @y].hash\n"
+        "  end\n"
+        "  def eql?(other)\n"
+        "    other.x == @x && other.y == @y\n"
+        "  end\n"
+        "end\n"
+        "class Plain\n"
+        "end\n");
+
+    printf("=== Value Hashing Tests ===\n\n");
+
+    /* ---- uniq ---- */
+    printf("--- uniq ---\n");
+
+    test_str(L, "uniq_keeps_first",
+        "[3, 1, 3, \"a\", :a, \"a\", 1.5, 1.5, nil, nil, true, false, true, 1]"
+        ".uniq.map { |x| x.to_s }.join(\",\")", "3,1,a,a,1.5,,true,false");
+    // Integers and floats stay distinct, -0.0 equals 0.0
+    test_int(L, "uniq_numeric_kinds", "[1, 1.0, 0.0, -0.0].uniq.size", 3);
+
+    /* ---- arrays and objects ---- */
+    printf("\n--- arrays and objects ---\n");
+
+    test_int(L, "frozen_arrays_by_content",
+        "a = [1, [2, \"x\"].freeze].freeze\n"
+        "b = [1, [2, \"x\"].freeze].freeze\n"
+        "c = [1, 2]\n"
+        "d = [1, 2]\n"
+        "[a, b, c, d, c].uniq.size", 3);
+    test_int(L, "frozen_array_difference", "([a, c] - [b]).size", 1);
+    test_int(L, "user_hash_and_eql",
+        "ps = [Point.new(1, 2), Point.new(3, 4), Point.new(1, 2)]\n"
+        "ps.uniq.size * 100 + (ps - [Point.new(3, 4)]).size * 10 + (ps & [Point.new(1, 2)]).size", 221);
+    test_int(L, "plain_objects_by_identity", "p = Plain.new\n[p, Plain.new, p].uniq.size", 2);
+    test_int(L, "tally_user_keys", "[Point.new(0, 0), Point.new(0, 0)].tally.size", 1);
+
+    /* ---- set operators ---- */
+    printf("\n--- set operators ---\n");
+
+    test_str(L, "operators_and_named_forms",
+        "r = []\n"
+        "r << ([1, 2, 2, 3, 4] - [2, 4]).map { |x| x.to_s }.join\n"
+        "r << ([1, 1, 2, 3] & [3, 1, 9]).map { |x| x.to_s }.join\n"
+        "r << ([1, 1, 2] | [3, 2, 4]).map { |x| x.to_s }.join\n"
+        "r << [1, 2, 3, 4].difference([1], [4]).map { |x| x.to_s }.join\n"
+        "r << [1, 2, 3, 2].intersection([2, 3], [3, 2, 7]).map { |x| x.to_s }.join\n"
+        "r << [1].union([2, 1], [3]).map { |x| x.to_s }.join\n"
+        "r << [2, 2].intersection.map { |x| x.to_s }.join\n"
+        "r.join(\" \")", "13 13 1234 23 23 123 2");
+    test_int(L, "integer_bit_operators", "(12 & 10) * 10000 + (12 | 10) * 100 + (12 ^ 10)", 8 * 10000 + 14 * 100 + 6);
+    test_error(L, "array_and_integer", "[1] & 5", LUBY_E_TYPE, NULL);
+    test_error(L, "string_or_integer", "\"a\" | 1", LUBY_E_TYPE, NULL);
+
+    /* ---- many keys ---- */
+    printf("\n--- many keys ---\n");
+
+    test_int(L, "tally_group_by",
+        "ids = []\n"
+        "i = 0\n"
+        "while i < 30000\n"
+        "  ids << \"id\" + (i % 7000).to_s\n"
+        "  i += 1\n"
+        "end\n"
+        "t = ids.tally\n"
+        "g = ids.group_by { |s| s.length }\n"
+        "t.size * 1000 + t[\"id5\"] * 100 + g.size", 7000 * 1000 + 5 * 100 + 4);
+    test_int(L, "uniq_and_difference", "ids.uniq.size + (ids - ids.take(7000)).size", 7000);
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    test_error(L, "hash_must_return_integer",
+        "class BadHash\n"
+        "  def hash\n"
+        "    \"nope\"\n"
+        "  end\n"
+        "end\n"
+        "[BadHash.new, BadHash.new].uniq", LUBY_E_TYPE, NULL);
+    test_error(L, "eql_error_propagates",
+        "class Boom\n"
+        "  def hash\n"
+        "    1\n"
+        "  end\n"
+        "  def eql?(o)\n"
+        "    raise \"boom\"\n"
+        "  end\n"
+        "end\n"
+        "[Boom.new, Boom.new].tally", LUBY_E_OK, "boom");
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}
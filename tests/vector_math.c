@@ -0,0 +1,228 @@
+#define LUBY_IMPLEMENTATION
+#include "../luby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static int pass_count = 0, fail_count = 0;
+
+static int eval_check(luby_state *L, const char *label, const char *code, luby_value *out) {
+    int rc = luby_eval(L, code, 0, "<test>", out);
+    if (rc != 0) {
+        char buf[256];
+        luby_format_error(L, buf, sizeof(buf));
+        printf("FAIL %s: %s\n", label, buf);
+        fail_count++;
+        return 0;
+    }
+    return 1;
+}
+
+static int check(const char *name, int cond) {
+    if (cond) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s\n", name);
+    fail_count++;
+    return 0;
+}
+
+static int test_str(luby_state *L, const char *name, const char *code, const char *expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_STRING && strcmp((const char *)out.as.ptr, expected) == 0) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected \"%s\", got ", name, expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static int test_int(luby_state *L, const char *name, const char *code, int64_t expected) {
+    luby_value out;
+    if (!eval_check(L, name, code, &out)) return 0;
+    if (out.type == LUBY_T_INT && out.as.i == expected) {
+        printf("PASS %s\n", name);
+        pass_count++;
+        return 1;
+    }
+    printf("FAIL %s: expected %lld, got ", name, (long long)expected);
+    luby_print_value(out);
+    printf("\n");
+    fail_count++;
+    return 0;
+}
+
+static size_t allocations = 0;
+
+static void *counting_alloc(void *user, void *ptr, size_t size) {
+    (void)user;
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!ptr) allocations++;
+    return realloc(ptr, size);
+}
+
+int main(void) {
+    luby_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.alloc = counting_alloc;
+    luby_state *L = luby_new(&cfg);
+    luby_open_base(L);
+    luby_value out;
+
+    printf("=== Vector Math Tests ===\n\n");
+
+    /* ---- vectors ---- */
+    printf("--- vectors ---\n");
+
+    test_str(L, "vector_arithmetic",
+        "a = Vector2.new(1, 2)\n"
+        "b = Vector2.new(3, 4.5)\n"
+        "[a + b, a - b, a * 2, 2 * a, b / 2, -a, a * b, Vector3.new].map { |v| v.to_s }.join(\" \")",
+        "Vector2(4, 6.5) Vector2(-2, -2.5) Vector2(2, 4) Vector2(2, 4) Vector2(1.5, 2.25) "
+        "Vector2(-1, -2) Vector2(3, 9) Vector3(0, 0, 0)");
+    test_str(L, "vector3_methods",
+        "v = Vector3.new(0, 3, 4)\n"
+        "[v.x, v.length, v.length_squared, v[2], v[-3], v.dot(Vector3.new(1, 1, 1))].map { |x| x.to_s }.join(\",\") + "
+        "v.normalize.inspect + Vector3.new(1, 0, 0).cross(Vector3.new(0, 1, 0)).to_s",
+        "0,5,25,4,0,7Vector3(0, 0.6, 0.8)Vector3(0, 0, 1)");
+    test_int(L, "vector_destructuring",
+        "x, y = Vector2.new(3, 4).to_a\n"
+        "p, q = Vector2.new(5, 6)\n"
+        "(x + y + p + q).to_i", 18);
+    test_str(L, "compare_and_hash_by_value",
+        "a = Vector2.new(1, 2)\n"
+        "h = { a => :hit }\n"
+        "s = Set.new([a, Vector2.new(1.0, 2.0), Vector2.new(2, 1)])\n"
+        "[a == Vector2.new(1, 2), a != Vector2.new(1, 3), a == Vector3.new(1, 2, 0), "
+        "h[Vector2.new(1, 2)], s.size, a.frozen?, a.is_a?(Vector2)].map { |x| x.to_s }.join(\",\")",
+        "true,true,false,hit,2,true,true");
+
+    /* ---- quaternions and matrices ---- */
+    printf("\n--- quaternions and matrices ---\n");
+
+    test_int(L, "quaternion_rotate_slerp",
+        "half_pi = 3.14159265 / 2\n"
+        "q = Quaternion.axis_angle(Vector3.new(0, 0, 1), half_pi)\n"
+        "r = q * Vector3.new(1, 0, 0)\n"
+        "m = Matrix4.rotation(q) * Vector3.new(1, 0, 0)\n"
+        "s = Quaternion.identity.slerp(q, 0.5)\n"
+        "h = Quaternion.axis_angle(Vector3.new(0, 0, 1), half_pi / 2)\n"
+        "ok = (r - Vector3.new(0, 1, 0)).length < 0.0001\n"
+        "ok = ok && (m - r).length < 0.0001\n"
+        "ok = ok && (s - h).length < 0.0001\n"
+        "ok = ok && ((q * q.inverse) - Quaternion.identity).length < 0.0001\n"
+        "ok = ok && (q.rotate(q.conjugate * Vector3.new(4, 5, 6)) - Vector3.new(4, 5, 6)).length < 0.0001\n"
+        "ok ? 1 : 0", 1);
+    test_int(L, "matrix_inverse_determinant",
+        "m = Matrix4.translation(Vector3.new(1, 2, 3)) * Matrix4.rotation(Quaternion.axis_angle(Vector3.new(1, 1, 0), 0.7)) * Matrix4.scaling(2)\n"
+        "e = m * m.inverse - Matrix4.identity\n"
+        "err = e.to_a.map { |x| x.abs }.sum\n"
+        "p = Vector3.new(1, -1, 0.5)\n"
+        "ok = err < 0.0001 && (m.inverse * (m * p) - p).length < 0.0001\n"
+        "ok = ok && (m.determinant - 8).abs < 0.001 && m.transpose.transpose == m\n"
+        "ok = ok && Matrix4.translation(Vector3.new(1, 2, 3)).transform_direction(p) == p\n"
+        "ok = ok && Matrix4.new([1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 5, 6, 7, 1])[12] == 5.0\n"
+        "ok ? 1 : 0", 1);
+    test_int(L, "transform_points_matches_single",
+        "pts = []\n"
+        "50.times { |i| pts << Vector3.new(i, i * 0.5, -i) }\n"
+        "out = m.transform_points(pts)\n"
+        "bad = 0\n"
+        "50.times { |i| bad += 1 if (out[i] - m.transform_point(pts[i])).length > 0.0001 }\n"
+        "out.size * 10 + bad", 500);
+
+    /* ---- C API ---- */
+    printf("\n--- C API ---\n");
+
+    float m[16] = { 0, 1, 0, 0,  -1, 0, 0, 0,  0, 0, 1, 0,  10, 20, 30, 1 };
+    float pts[9] = { 1, 0, 0,  0, 1, 0,  1, 2, 3 };
+    float expect[9] = { 10, 21, 30,  9, 20, 30,  8, 21, 33 };
+    luby_mat4_transform_points(m, pts, pts, 3);
+    int close = 1;
+    for (int i = 0; i < 9; i++) close = close && fabsf(pts[i] - expect[i]) < 1e-5f;
+    check("batch_transform_in_place", close);
+    luby_value mv = luby_vector_new(L, LUBY_MATRIX4, m);
+    luby_vector_kind kind = LUBY_VECTOR2;
+    const float *data = luby_vector_data(mv, &kind);
+    check("vector_data", data && kind == LUBY_MATRIX4 && data[12] == 10 && !luby_vector_data(luby_int(1), NULL));
+    luby_set_global_value(L, "m", mv);
+    test_int(L, "host_matrix_in_script", "(m * Vector3.new(1, 0, 0)).y.to_i", 21);
+
+    /* ---- errors ---- */
+    printf("\n--- errors ---\n");
+
+    const char *bad_cases[] = {
+        "Vector2.new(1, 2) + 1", "Vector2.new(1, 2) + Vector3.new(1, 2, 3)", "Vector2.new(1, \"a\")",
+        "Vector3.new(1, 2)", "Matrix4.new(1, 2, 3)", "Quaternion.identity * Vector2.new(1, 2)",
+        "Matrix4.new([0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]).inverse",
+        "Vector2.new(1, 2).z", "Vector3.new(1, 2, 3).dot(Vector2.new(1, 2))"
+    };
+    int rejected = 1;
+    for (size_t i = 0; i < sizeof(bad_cases) / sizeof(bad_cases[0]); i++) {
+        if (luby_eval(L, bad_cases[i], 0, "<test>", &out) == 0) {
+            printf("  accepted: %s\n", bad_cases[i]);
+            rejected = 0;
+        }
+    }
+    check("bad_operands_raise", rejected);
+    check("division_by_zero_line",
+        luby_eval(L, "Vector2.new(1, 2) / 0", 0, "<test>", &out) != 0 && luby_last_error(L).line == 1);
+
+    /* ---- allocation ---- */
+    printf("\n--- allocation ---\n");
+
+    eval_check(L, "simulate_setup",
+        "def simulate(n)\n"
+        "  pos = Vector3.new(0, 0, 0)\n"
+        "  vel = Vector3.new(1, 2, 3)\n"
+        "  spin = Quaternion.axis_angle(Vector3.new(0, 1, 0), 0.01)\n"
+        "  i = 0\n"
+        "  while i < n\n"
+        "    vel = spin * vel\n"
+        "    pos = pos + vel * 0.016\n"
+        "    i += 1\n"
+        "  end\n"
+        "  pos\n"
+        "end\n"
+        "simulate(1000)", &out);
+    size_t before = allocations;
+    if (eval_check(L, "simulate_run", "simulate(100000)", &out)) {
+        // 300000 temporaries; only compiling the call may touch the allocator
+        check("temporaries_reuse_storage", out.type == LUBY_T_VECTOR && allocations - before < 100);
+    }
+
+    /* ---- snapshot / clone ---- */
+    printf("\n--- snapshot / clone ---\n");
+
+    eval_check(L, "clone_setup",
+        "origin = Vector3.new(1, 2, 3)\n"
+        "xf = Matrix4.translation(Vector3.new(1, 1, 1))\n"
+        "seen = { origin => 1 }", &out);
+    luby_snapshot *snap = luby_snapshot_new(L);
+    luby_state *C = snap ? luby_clone(snap) : NULL;
+    if (C) {
+        test_str(C, "clone_keeps_vectors",
+            "(xf * origin + Vector3.new(1, 0, 0)).to_s + seen[Vector3.new(1, 2, 3)].to_s + normalize(0, 2).to_s",
+            "Vector3(3, 3, 4)1Vector2(0, 1)");
+        luby_free(C);
+    } else {
+        printf("FAIL clone_keeps_vectors: snapshot failed\n");
+        fail_count++;
+    }
+    luby_snapshot_free(snap);
+
+    printf("\n%d passed, %d failed\n", pass_count, fail_count);
+    luby_free(L);
+    return fail_count ? 1 : 0;
+}